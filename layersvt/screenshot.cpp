@@ -33,6 +33,11 @@
 #include <set>
 #include <vector>
 #include <fstream>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 
 using namespace std;
 
@@ -140,13 +145,17 @@ typedef enum colorSpaceFormat {
 
 colorSpaceFormat userColorSpaceFormat = UNDEFINED;
 
+struct SwapchainCaptureData;
+
 // unordered map: associates a swap chain with a device, image extent, format,
-// and list of images
+// list of images, and the resources used to take its screenshots
 typedef struct {
     VkDevice device;
     VkExtent2D imageExtent;
     VkFormat format;
     VkImage *imageList;
+    uint32_t imageCount;
+    SwapchainCaptureData *captureData;
 } SwapchainMapStruct;
 static unordered_map<VkSwapchainKHR, SwapchainMapStruct *> swapchainMap;
 
@@ -158,13 +167,13 @@ typedef struct {
 } ImageMapStruct;
 static unordered_map<VkImage, ImageMapStruct *> imageMap;
 
-// unordered map: associates a device with a queue, commandPool, and physical
+// unordered map: associates a device with a queue and its family, and physical
 // device also contains per device info including dispatch table
 typedef struct {
     VkLayerDispatchTable *device_dispatch_table;
     bool wsi_enabled;
     VkQueue queue;
-    std::list<VkCommandPool> commandPools;
+    uint32_t queueFamilyIndex;
     VkPhysicalDevice physicalDevice;
     PFN_vkSetDeviceLoaderData pfn_dev_init;
 } DeviceMapStruct;
@@ -349,83 +358,55 @@ static void init_screenshot() {
     readScreenShotFormatENV();
 }
 
-// Track allocated resources in writePPM()
-// and clean them up when they go out of scope.
-struct WritePPMCleanupData {
-    VkDevice device;
-    VkLayerDispatchTable *pTableDevice;
+// The most screenshots of a swapchain that can be in flight at once.  Each
+// one has staging images and a command buffer of its own; when all of them
+// are busy, the next screenshot waits until one of them has been written.
+#define MAX_PENDING_SCREENSHOTS 3
+
+// The staging resources of one screenshot.  The swapchain image is copied or
+// blitted to image2, and from there copied to image3 if the device cannot
+// blit to a linear image.  The final image stays mapped.
+struct ScreenshotSlot {
     VkImage image2;
     VkImage image3;
     VkDeviceMemory mem2;
     VkDeviceMemory mem3;
-    bool mem2mapped;
-    bool mem3mapped;
+    const char *pMapped;  // first pixel of the final image
+    VkDeviceSize rowPitch;
     VkCommandBuffer commandBuffer;
-    VkCommandPool commandPool;
-    ~WritePPMCleanupData();
+    VkFence fence;
+    VkSemaphore semaphore;  // signaled by the copy, waited for by the present
+    bool busy;  // submitted, but not written to its file yet
+    string filename;
 };
 
-WritePPMCleanupData::~WritePPMCleanupData() {
-    if (mem2mapped) pTableDevice->UnmapMemory(device, mem2);
-    if (mem2) pTableDevice->FreeMemory(device, mem2, NULL);
-    if (image2) pTableDevice->DestroyImage(device, image2, NULL);
-
-    if (mem3mapped) pTableDevice->UnmapMemory(device, mem3);
-    if (mem3) pTableDevice->FreeMemory(device, mem3, NULL);
-    if (image3) pTableDevice->DestroyImage(device, image3, NULL);
-
-    if (commandBuffer) pTableDevice->FreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
-// Save an image to a PPM image file.
-//
-// This function issues commands to copy/convert the swapchain image
-// from whatever compatible format the swapchain image uses
-// to a single format (VK_FORMAT_R8G8B8A8_UNORM) so that the converted
-// result can be easily written to a PPM file.
-//
-// Error handling: If there is a problem, this function should silently
-// fail without affecting the Present operation going on in the caller.
-// The numerous debug asserts are to catch programming errors and are not
-// expected to assert.  Recovery and clean up are implemented for image memory
-// allocation failures.
-// (TODO) It would be nice to pass any failure info to DebugReport or something.
-static void writePPM(const char *filename, VkImage image1) {
-    VkResult err;
-    bool pass;
-
-    // Bail immediately if we can't find the image.
-    if (imageMap.empty() || imageMap.find(image1) == imageMap.end()) return;
-
-    // Collect object info from maps.  This info is generally recorded
-    // by the other functions hooked in this layer.
-    VkDevice device = imageMap[image1]->device;
-    VkPhysicalDevice physicalDevice = deviceMap[device]->physicalDevice;
-    VkInstance instance = physDeviceMap[physicalDevice]->instance;
-    VkQueue queue = deviceMap[device]->queue;
-    DeviceMapStruct *devMap = get_dev_info(device);
-    if (NULL == devMap) {
-        assert(0);
-        return;
-    }
-    VkLayerDispatchTable *pTableDevice = devMap->device_dispatch_table;
-    VkLayerDispatchTable *pTableQueue = get_dev_info(static_cast<VkDevice>(static_cast<void *>(queue)))->device_dispatch_table;
-    VkLayerInstanceDispatchTable *pInstanceTable;
-    pInstanceTable = instance_dispatch_table(instance);
-
-    // Gather incoming image info and check image format for compatibility with
-    // the target format.
-    // This function supports both 24-bit and 32-bit swapchain images.
-    uint32_t const width = imageMap[image1]->imageExtent.width;
-    uint32_t const height = imageMap[image1]->imageExtent.height;
-    VkFormat const format = imageMap[image1]->format;
-    uint32_t const numChannels = FormatChannelCount(format);
-
-    if ((3 != numChannels) && (4 != numChannels)) {
-        assert(0);
-        return;
-    }
+// The screenshot resources of a swapchain.  They are created the first time
+// one of its images is captured and kept until the swapchain or its device
+// is destroyed.  The encoder thread waits for the fence of each queued slot
+// and writes its file while the application keeps rendering.
+struct SwapchainCaptureData {
+    VkDevice device;
+    VkLayerDispatchTable *pTableDevice;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numChannels;
+    bool copyOnly;
+    bool need2steps;
+    ScreenshotSlot slots[MAX_PENDING_SCREENSHOTS];
+
+    std::thread encoder;
+    std::mutex mutex;  // guards the fields below and the busy flags of the slots
+    std::condition_variable slotQueued;
+    std::condition_variable slotWritten;
+    std::deque<ScreenshotSlot *> pendingSlots;
+    bool stopping;
+};
 
+// Returns the format that images of the given swapchain format are converted
+// to, so that the converted result can be easily written to a PPM file.
+static VkFormat getScreenshotFormat(VkFormat format, uint32_t numChannels) {
     // Initial dest format is undefined as we will look for one
     VkFormat destformat = VK_FORMAT_UNDEFINED;
 
@@ -541,72 +522,132 @@ static void writePPM(const char *filename, VkImage image1) {
             destformat = VK_FORMAT_R8G8B8_UNORM;
     }
 
-    if ((FormatCompatibilityClass(destformat) != FormatCompatibilityClass(format))) {
-        assert(0);
+    return destformat;
+}
+
+// Drops the alpha channel of a row of 4-channel pixels.  The loop only moves
+// bytes at fixed strides, so that the compiler can vectorize it.
+static void copyRowToRGB(char *pDst, const char *pSrc, uint32_t width) {
+    for (uint32_t x = 0; x < width; x++) {
+        pDst[3 * x + 0] = pSrc[4 * x + 0];
+        pDst[3 * x + 1] = pSrc[4 * x + 1];
+        pDst[3 * x + 2] = pSrc[4 * x + 2];
+    }
+}
+
+// Writes the pixels of a finished screenshot to a PPM file, one row at a
+// time.
+static void writePPMFile(const char *filename, const char *ptr, VkDeviceSize rowPitch, uint32_t width, uint32_t height,
+                         uint32_t numChannels) {
+    ofstream file(filename, ios::binary);
+    assert(file.is_open());
+
+    if (!file.is_open()) {
+#ifdef ANDROID
+        __android_log_print(ANDROID_LOG_DEBUG, "screenshot",
+                            "Failed to open output file: %s.  Be sure to grant read and write permissions.", filename);
+#else
+        fprintf(stderr, "Failed to open output file:%s,  Be sure to grant read and write permissions\n", filename);
+#endif
         return;
     }
 
-    // General Approach
-    //
-    // The idea here is to copy/convert the swapchain image into another image
-    // that can be mapped and read by the CPU to produce a PPM file.
-    // The image must be untiled and converted to a specific format for easy
-    // parsing.  The memory for the final image must be host-visible.
-    // Note that in Vulkan, a BLIT operation must be used to perform a format
-    // conversion.
-    //
-    // Devices vary in their ability to blit to/from linear and optimal tiling.
-    // So we must query the device properties to get this information.
-    //
-    // If the device cannot BLIT to a LINEAR image, then the operation must be
-    // done in two steps:
-    // 1) BLIT the swapchain image (image1) to a temp image (image2) that is
-    // created with TILING_OPTIMAL.
-    // 2) COPY image2 to another temp image (image3) that is created with
-    // TILING_LINEAR.
-    // 3) Map image 3 and write the PPM file.
-    //
-    // If the device can BLIT to a LINEAR image, then:
-    // 1) BLIT the swapchain image (image1) to a temp image (image2) that is
-    // created with TILING_LINEAR.
-    // 2) Map image 2 and write the PPM file.
-    //
-    // There seems to be no way to tell if the swapchain image (image1) is tiled
-    // or not.  We therefore assume that the BLIT operation can always read from
-    // both linear and optimal tiled (swapchain) images.
-    // There is therefore no point in looking at the BLIT_SRC properties.
-    //
-    // There is also the optimization where the incoming and target formats are
-    // the same.  In this case, just do a COPY.
+    file << "P6\n";
+    file << width << "\n";
+    file << height << "\n";
+    file << 255 << "\n";
 
-    VkFormatProperties targetFormatProps;
-    pInstanceTable->GetPhysicalDeviceFormatProperties(physicalDevice, destformat, &targetFormatProps);
-    bool need2steps = false;
-    bool copyOnly = false;
-    if (destformat == format) {
-        copyOnly = true;
-    } else {
-        bool const bltLinear = targetFormatProps.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT ? true : false;
-        bool const bltOptimal = targetFormatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT ? true : false;
-        if (!bltLinear && !bltOptimal) {
-            // Cannot blit to either target tiling type.  It should be pretty
-            // unlikely to have a device that cannot blit to either type.
-            // But punt by just doing a copy and possibly have the wrong
-            // colors.  This should be quite rare.
-            copyOnly = true;
-        } else if (!bltLinear && bltOptimal) {
-            // Cannot blit to a linear target but can blt to optimal, so copy
-            // after blit is needed.
-            need2steps = true;
+    if (3 == numChannels) {
+        for (uint32_t y = 0; y < height; y++) {
+            file.write(ptr, 3 * width);
+            ptr += rowPitch;
         }
-        // Else bltLinear is available and only 1 step is needed.
+    } else if (4 == numChannels) {
+        // PPM has no alpha channel, so each row is converted to RGB first.
+        vector<char> row(3 * width);
+        for (uint32_t y = 0; y < height; y++) {
+            copyRowToRGB(row.data(), ptr, width);
+            file.write(row.data(), row.size());
+            ptr += rowPitch;
+        }
+    }
+    file.close();
+}
+
+// Runs on the encoder thread of a swapchain until it is stopped and every
+// queued slot has been written.
+static void screenshotEncoderMain(SwapchainCaptureData *pData) {
+    std::unique_lock<std::mutex> lock(pData->mutex);
+    while (true) {
+        pData->slotQueued.wait(lock, [pData] { return !pData->pendingSlots.empty() || pData->stopping; });
+        if (pData->pendingSlots.empty()) {
+            break;
+        }
+        ScreenshotSlot *pSlot = pData->pendingSlots.front();
+        pData->pendingSlots.pop_front();
+        lock.unlock();
+
+        VkResult err = pData->pTableDevice->WaitForFences(pData->device, 1, &pSlot->fence, VK_TRUE, UINT64_MAX);
+        assert(!err);
+        if (VK_SUCCESS == err) {
+            const VkMappedMemoryRange range = {VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, NULL,
+                                               pData->need2steps ? pSlot->mem3 : pSlot->mem2, 0, VK_WHOLE_SIZE};
+            pData->pTableDevice->InvalidateMappedMemoryRanges(pData->device, 1, &range);
+            writePPMFile(pSlot->filename.c_str(), pSlot->pMapped, pSlot->rowPitch, pData->width, pData->height,
+                         pData->numChannels);
+        }
+
+        lock.lock();
+        pSlot->busy = false;
+        pData->slotWritten.notify_all();
+    }
+}
+
+static void destroyScreenshotSlot(SwapchainCaptureData *pData, ScreenshotSlot *pSlot) {
+    VkDevice device = pData->device;
+    VkLayerDispatchTable *pTableDevice = pData->pTableDevice;
+
+    if (pSlot->fence) pTableDevice->DestroyFence(device, pSlot->fence, NULL);
+    if (pSlot->semaphore) pTableDevice->DestroySemaphore(device, pSlot->semaphore, NULL);
+    if (pSlot->commandBuffer) pTableDevice->FreeCommandBuffers(device, pData->commandPool, 1, &pSlot->commandBuffer);
+
+    if (pSlot->pMapped) pTableDevice->UnmapMemory(device, pData->need2steps ? pSlot->mem3 : pSlot->mem2);
+    if (pSlot->mem2) pTableDevice->FreeMemory(device, pSlot->mem2, NULL);
+    if (pSlot->image2) pTableDevice->DestroyImage(device, pSlot->image2, NULL);
+    if (pSlot->mem3) pTableDevice->FreeMemory(device, pSlot->mem3, NULL);
+    if (pSlot->image3) pTableDevice->DestroyImage(device, pSlot->image3, NULL);
+
+    *pSlot = ScreenshotSlot();
+}
+
+// Waits until the queued screenshots of a swapchain are written, then
+// destroys its screenshot resources.
+static void destroySwapchainCaptureData(SwapchainCaptureData *pData) {
+    if (pData->encoder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(pData->mutex);
+            pData->stopping = true;
+            pData->slotQueued.notify_one();
+        }
+        pData->encoder.join();
+    }
+
+    for (uint32_t i = 0; i < MAX_PENDING_SCREENSHOTS; i++) {
+        destroyScreenshotSlot(pData, &pData->slots[i]);
     }
+    if (pData->commandPool) pData->pTableDevice->DestroyCommandPool(pData->device, pData->commandPool, NULL);
+    delete pData;
+}
 
-    // Put resources that need to be cleaned up in a struct with a destructor
-    // so that things get cleaned up when this function is exited.
-    WritePPMCleanupData data = {};
-    data.device = device;
-    data.pTableDevice = pTableDevice;
+// Creates the staging images, command buffer, fence and semaphore of a slot.  Returns
+// false if one of them cannot be created; the caller then destroys the slot.
+static bool createScreenshotSlot(SwapchainCaptureData *pData, ScreenshotSlot *pSlot, VkFormat destformat,
+                                 VkPhysicalDeviceMemoryProperties *pMemoryProperties, PFN_vkSetDeviceLoaderData pfn_dev_init) {
+    VkResult err;
+    bool pass;
+    VkDevice device = pData->device;
+    VkLayerDispatchTable *pTableDevice = pData->pTableDevice;
+    bool const need2steps = pData->need2steps;
 
     // Set up the image creation info for both the blit and copy images, in case
     // both are needed.
@@ -616,7 +657,7 @@ static void writePPM(const char *filename, VkImage image1) {
         0,
         VK_IMAGE_TYPE_2D,
         destformat,
-        {width, height, 1},
+        {pData->width, pData->height, 1},
         1,
         1,
         VK_SAMPLE_COUNT_1_BIT,
@@ -641,88 +682,288 @@ static void writePPM(const char *filename, VkImage image1) {
         0   // memoryTypeIndex, queried later
     };
     VkMemoryRequirements memRequirements;
-    VkPhysicalDeviceMemoryProperties memoryProperties;
 
     // Create image2 and allocate its memory.  It could be the intermediate or
     // final image.
-    err = pTableDevice->CreateImage(device, &imgCreateInfo2, NULL, &data.image2);
+    err = pTableDevice->CreateImage(device, &imgCreateInfo2, NULL, &pSlot->image2);
     assert(!err);
-    if (VK_SUCCESS != err) return;
-    pTableDevice->GetImageMemoryRequirements(device, data.image2, &memRequirements);
+    if (VK_SUCCESS != err) return false;
+    pTableDevice->GetImageMemoryRequirements(device, pSlot->image2, &memRequirements);
     memAllocInfo.allocationSize = memRequirements.size;
-    pInstanceTable->GetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-    pass = memory_type_from_properties(&memoryProperties, memRequirements.memoryTypeBits,
+    pass = memory_type_from_properties(pMemoryProperties, memRequirements.memoryTypeBits,
                                        need2steps ? VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT : VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
                                        &memAllocInfo.memoryTypeIndex);
     assert(pass);
-    err = pTableDevice->AllocateMemory(device, &memAllocInfo, NULL, &data.mem2);
+    if (!pass) return false;
+    err = pTableDevice->AllocateMemory(device, &memAllocInfo, NULL, &pSlot->mem2);
     assert(!err);
-    if (VK_SUCCESS != err) return;
-    err = pTableQueue->BindImageMemory(device, data.image2, data.mem2, 0);
+    if (VK_SUCCESS != err) return false;
+    err = pTableDevice->BindImageMemory(device, pSlot->image2, pSlot->mem2, 0);
     assert(!err);
-    if (VK_SUCCESS != err) return;
+    if (VK_SUCCESS != err) return false;
 
     // Create image3 and allocate its memory, if needed.
     if (need2steps) {
-        err = pTableDevice->CreateImage(device, &imgCreateInfo3, NULL, &data.image3);
+        err = pTableDevice->CreateImage(device, &imgCreateInfo3, NULL, &pSlot->image3);
         assert(!err);
-        if (VK_SUCCESS != err) return;
-        pTableDevice->GetImageMemoryRequirements(device, data.image3, &memRequirements);
+        if (VK_SUCCESS != err) return false;
+        pTableDevice->GetImageMemoryRequirements(device, pSlot->image3, &memRequirements);
         memAllocInfo.allocationSize = memRequirements.size;
-        pInstanceTable->GetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
-        pass = memory_type_from_properties(&memoryProperties, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        pass = memory_type_from_properties(pMemoryProperties, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
                                            &memAllocInfo.memoryTypeIndex);
         assert(pass);
-        err = pTableDevice->AllocateMemory(device, &memAllocInfo, NULL, &data.mem3);
+        if (!pass) return false;
+        err = pTableDevice->AllocateMemory(device, &memAllocInfo, NULL, &pSlot->mem3);
         assert(!err);
-        if (VK_SUCCESS != err) return;
-        err = pTableQueue->BindImageMemory(device, data.image3, data.mem3, 0);
+        if (VK_SUCCESS != err) return false;
+        err = pTableDevice->BindImageMemory(device, pSlot->image3, pSlot->mem3, 0);
         assert(!err);
-        if (VK_SUCCESS != err) return;
+        if (VK_SUCCESS != err) return false;
     }
 
-    // Set up the command buffer.  We get a command buffer from a pool we saved
-    // in a hooked function, which would be the application's pool.
-    if (deviceMap[device]->commandPools.empty()) {
-        assert(!deviceMap[device]->commandPools.empty());
-        return;
+    // Map the final image so that the CPU can read it.  It stays mapped until
+    // the slot is destroyed.
+    const VkImageSubresource sr = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
+    VkSubresourceLayout srLayout;
+    char *ptr;
+    if (!need2steps) {
+        pTableDevice->GetImageSubresourceLayout(device, pSlot->image2, &sr, &srLayout);
+        err = pTableDevice->MapMemory(device, pSlot->mem2, 0, VK_WHOLE_SIZE, 0, (void **)&ptr);
+    } else {
+        pTableDevice->GetImageSubresourceLayout(device, pSlot->image3, &sr, &srLayout);
+        err = pTableDevice->MapMemory(device, pSlot->mem3, 0, VK_WHOLE_SIZE, 0, (void **)&ptr);
     }
-
-    VkCommandPool commandPool = deviceMap[device]->commandPools.front();
+    assert(!err);
+    if (VK_SUCCESS != err) return false;
+    pSlot->pMapped = ptr + srLayout.offset;
+    pSlot->rowPitch = srLayout.rowPitch;
 
     const VkCommandBufferAllocateInfo allocCommandBufferInfo = {VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, NULL,
-        commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
-    data.commandPool = commandPool;
-    err = pTableDevice->AllocateCommandBuffers(device, &allocCommandBufferInfo, &data.commandBuffer);
+        pData->commandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
+    err = pTableDevice->AllocateCommandBuffers(device, &allocCommandBufferInfo, &pSlot->commandBuffer);
     assert(!err);
-    if (VK_SUCCESS != err) return;
-
-    VkDevice cmdBuf = static_cast<VkDevice>(static_cast<void *>(data.commandBuffer));
-    deviceMap.emplace(cmdBuf, devMap);
-    VkLayerDispatchTable *pTableCommandBuffer;
-    pTableCommandBuffer = get_dev_info(cmdBuf)->device_dispatch_table;
+    if (VK_SUCCESS != err) return false;
 
     // We have just created a dispatchable object, but the dispatch table has
     // not been placed in the object yet.  When a "normal" application creates
     // a command buffer, the dispatch table is installed by the top-level api
     // binding (trampoline.c). But here, we have to do it ourselves.
-    if (!devMap->pfn_dev_init) {
-        *((const void **)data.commandBuffer) = *(void **)device;
+    if (!pfn_dev_init) {
+        *((const void **)pSlot->commandBuffer) = *(void **)device;
     } else {
-        err = devMap->pfn_dev_init(device, (void *)data.commandBuffer);
+        err = pfn_dev_init(device, (void *)pSlot->commandBuffer);
         assert(!err);
     }
 
+    const VkFenceCreateInfo fenceCreateInfo = {VK_STRUCTURE_TYPE_FENCE_CREATE_INFO, NULL, 0};
+    err = pTableDevice->CreateFence(device, &fenceCreateInfo, NULL, &pSlot->fence);
+    assert(!err);
+    if (VK_SUCCESS != err) return false;
+
+    const VkSemaphoreCreateInfo semaphoreCreateInfo = {VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO, NULL, 0};
+    err = pTableDevice->CreateSemaphore(device, &semaphoreCreateInfo, NULL, &pSlot->semaphore);
+    assert(!err);
+    return VK_SUCCESS == err;
+}
+
+// Returns the screenshot resources of a swapchain, creating them the first
+// time.  Returns NULL if they cannot be created.
+static SwapchainCaptureData *getSwapchainCaptureData(VkSwapchainKHR swapchain) {
+    SwapchainMapStruct *swapchainMapElem = swapchainMap[swapchain];
+    if (swapchainMapElem->captureData != NULL) {
+        return swapchainMapElem->captureData;
+    }
+
+    // Collect object info from maps.  This info is generally recorded
+    // by the other functions hooked in this layer.
+    VkDevice device = swapchainMapElem->device;
+    DeviceMapStruct *devMap = get_dev_info(device);
+    if (NULL == devMap) {
+        assert(0);
+        return NULL;
+    }
+    VkPhysicalDevice physicalDevice = devMap->physicalDevice;
+    VkInstance instance = physDeviceMap[physicalDevice]->instance;
+    VkLayerInstanceDispatchTable *pInstanceTable;
+    pInstanceTable = instance_dispatch_table(instance);
+
+    // Check the swapchain format for compatibility with the target format.
+    // This function supports both 24-bit and 32-bit swapchain images.
+    VkFormat const format = swapchainMapElem->format;
+    uint32_t const numChannels = FormatChannelCount(format);
+
+    if ((3 != numChannels) && (4 != numChannels)) {
+        assert(0);
+        return NULL;
+    }
+
+    VkFormat const destformat = getScreenshotFormat(format, numChannels);
+    if ((FormatCompatibilityClass(destformat) != FormatCompatibilityClass(format))) {
+        assert(0);
+        return NULL;
+    }
+
+    // General Approach
+    //
+    // The idea here is to copy/convert the swapchain image into another image
+    // that can be mapped and read by the CPU to produce a PPM file.
+    // The image must be untiled and converted to a specific format for easy
+    // parsing.  The memory for the final image must be host-visible.
+    // Note that in Vulkan, a BLIT operation must be used to perform a format
+    // conversion.
+    //
+    // Devices vary in their ability to blit to/from linear and optimal tiling.
+    // So we must query the device properties to get this information.
+    //
+    // If the device cannot BLIT to a LINEAR image, then the operation must be
+    // done in two steps:
+    // 1) BLIT the swapchain image (image1) to a temp image (image2) that is
+    // created with TILING_OPTIMAL.
+    // 2) COPY image2 to another temp image (image3) that is created with
+    // TILING_LINEAR.
+    // 3) Map image 3 and write the PPM file.
+    //
+    // If the device can BLIT to a LINEAR image, then:
+    // 1) BLIT the swapchain image (image1) to a temp image (image2) that is
+    // created with TILING_LINEAR.
+    // 2) Map image 2 and write the PPM file.
+    //
+    // There seems to be no way to tell if the swapchain image (image1) is tiled
+    // or not.  We therefore assume that the BLIT operation can always read from
+    // both linear and optimal tiled (swapchain) images.
+    // There is therefore no point in looking at the BLIT_SRC properties.
+    //
+    // There is also the optimization where the incoming and target formats are
+    // the same.  In this case, just do a COPY.
+
+    VkFormatProperties targetFormatProps;
+    pInstanceTable->GetPhysicalDeviceFormatProperties(physicalDevice, destformat, &targetFormatProps);
+    bool need2steps = false;
+    bool copyOnly = false;
+    if (destformat == format) {
+        copyOnly = true;
+    } else {
+        bool const bltLinear = targetFormatProps.linearTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT ? true : false;
+        bool const bltOptimal = targetFormatProps.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT ? true : false;
+        if (!bltLinear && !bltOptimal) {
+            // Cannot blit to either target tiling type.  It should be pretty
+            // unlikely to have a device that cannot blit to either type.
+            // But punt by just doing a copy and possibly have the wrong
+            // colors.  This should be quite rare.
+            copyOnly = true;
+        } else if (!bltLinear && bltOptimal) {
+            // Cannot blit to a linear target but can blt to optimal, so copy
+            // after blit is needed.
+            need2steps = true;
+        }
+        // Else bltLinear is available and only 1 step is needed.
+    }
+
+    SwapchainCaptureData *pData = new SwapchainCaptureData();
+    pData->device = device;
+    pData->pTableDevice = devMap->device_dispatch_table;
+    pData->queue = devMap->queue;
+    pData->width = swapchainMapElem->imageExtent.width;
+    pData->height = swapchainMapElem->imageExtent.height;
+    pData->numChannels = numChannels;
+    pData->copyOnly = copyOnly;
+    pData->need2steps = need2steps;
+
+    // The command buffers come from a pool of this layer's own, so that each
+    // one can be recorded again for every screenshot it takes.
+    const VkCommandPoolCreateInfo commandPoolCreateInfo = {VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, NULL,
+                                                           VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+                                                           devMap->queueFamilyIndex};
+    VkResult err = pData->pTableDevice->CreateCommandPool(device, &commandPoolCreateInfo, NULL, &pData->commandPool);
+    assert(!err);
+    bool pass = (VK_SUCCESS == err);
+
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    pInstanceTable->GetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    for (uint32_t i = 0; pass && i < MAX_PENDING_SCREENSHOTS; i++) {
+        pass = createScreenshotSlot(pData, &pData->slots[i], destformat, &memoryProperties, devMap->pfn_dev_init);
+    }
+    if (!pass) {
+        destroySwapchainCaptureData(pData);
+        return NULL;
+    }
+
+    pData->encoder = std::thread(screenshotEncoderMain, pData);
+    swapchainMapElem->captureData = pData;
+    return pData;
+}
+
+// Save a swapchain image to a PPM image file.
+//
+// This function issues commands to copy/convert the swapchain image
+// from whatever compatible format the swapchain image uses
+// to a single format (VK_FORMAT_R8G8B8A8_UNORM) so that the converted
+// result can be easily written to a PPM file.
+//
+// The commands are recorded into the command buffer of a free slot of the
+// swapchain's screenshot resources and submitted with the slot's fence.  The
+// encoder thread writes the file once the fence signals, so the queue and the
+// device are not idled here.  This only waits when every slot still holds a
+// screenshot that has not been written.
+//
+// This is called before the image is presented.  The copy waits for the
+// semaphores that the present was given, so it comes after the rendering of
+// the image on any queue, and signals the slot's semaphore, which the present
+// then waits for in their place.  The image is handed back to the
+// presentation engine only once it is in the present layout again.  Returns
+// that semaphore, or VK_NULL_HANDLE if no copy was submitted, in which case
+// the present goes ahead as it was.
+//
+// Error handling: If there is a problem, this function should silently
+// fail without affecting the Present operation going on in the caller.
+// The numerous debug asserts are to catch programming errors and are not
+// expected to assert.  Recovery and clean up are implemented for image memory
+// allocation failures.
+// (TODO) It would be nice to pass any failure info to DebugReport or something.
+static VkSemaphore writePPM(const char *filename, VkSwapchainKHR swapchain, VkImage image1, const VkPresentInfoKHR *pPresentInfo) {
+    VkResult err;
+
+    // Bail immediately if we can't find the image.
+    if (imageMap.empty() || imageMap.find(image1) == imageMap.end()) return VK_NULL_HANDLE;
+
+    SwapchainCaptureData *pData = getSwapchainCaptureData(swapchain);
+    if (NULL == pData) return VK_NULL_HANDLE;
+
+    // Wait for a slot whose previous screenshot has been written.
+    ScreenshotSlot *pSlot = NULL;
+    {
+        std::unique_lock<std::mutex> lock(pData->mutex);
+        pData->slotWritten.wait(lock, [pData, &pSlot] {
+            for (uint32_t i = 0; i < MAX_PENDING_SCREENSHOTS; i++) {
+                if (!pData->slots[i].busy) {
+                    pSlot = &pData->slots[i];
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    uint32_t const width = pData->width;
+    uint32_t const height = pData->height;
+    bool const copyOnly = pData->copyOnly;
+    bool const need2steps = pData->need2steps;
+    VkLayerDispatchTable *pTableDevice = pData->pTableDevice;
+    VkCommandBuffer commandBuffer = pSlot->commandBuffer;
+
     const VkCommandBufferBeginInfo commandBufferBeginInfo = {
         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, NULL, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
-    err = pTableCommandBuffer->BeginCommandBuffer(data.commandBuffer, &commandBufferBeginInfo);
+    err = pTableDevice->BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
     assert(!err);
+    if (VK_SUCCESS != err) return VK_NULL_HANDLE;
 
-    // This barrier is used to transition from/to present Layout
+    // This barrier is used to transition from/to present Layout.  The image
+    // may have been rendered earlier on the same queue without a semaphore,
+    // so the transition waits for all writes before it.
     VkImageMemoryBarrier presentMemoryBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
                                                  NULL,
-                                                 VK_ACCESS_TRANSFER_WRITE_BIT,
+                                                 VK_ACCESS_MEMORY_WRITE_BIT,
                                                  VK_ACCESS_TRANSFER_READ_BIT,
                                                  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
                                                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -741,19 +982,19 @@ static void writePPM(const char *filename, VkImage image1) {
                                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                               VK_QUEUE_FAMILY_IGNORED,
                                               VK_QUEUE_FAMILY_IGNORED,
-                                              data.image2,
+                                              pSlot->image2,
                                               {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
 
     // This barrier is used to transition a dest layout to general layout.
     VkImageMemoryBarrier generalMemoryBarrier = {VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
                                                  NULL,
                                                  VK_ACCESS_TRANSFER_WRITE_BIT,
-                                                 VK_ACCESS_TRANSFER_READ_BIT,
+                                                 VK_ACCESS_HOST_READ_BIT,
                                                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                                  VK_IMAGE_LAYOUT_GENERAL,
                                                  VK_QUEUE_FAMILY_IGNORED,
                                                  VK_QUEUE_FAMILY_IGNORED,
-                                                 data.image2,
+                                                 pSlot->image2,
                                                  {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1}};
 
     VkPipelineStageFlags srcStages = VK_PIPELINE_STAGE_TRANSFER_BIT;
@@ -761,19 +1002,19 @@ static void writePPM(const char *filename, VkImage image1) {
 
     // The source image needs to be transitioned from present to transfer
     // source.
-    pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
-                                            &presentMemoryBarrier);
+    pTableDevice->CmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, dstStages, 0, 0, NULL, 0, NULL, 1,
+                                     &presentMemoryBarrier);
 
     // image2 needs to be transitioned from its undefined state to transfer
     // destination.
-    pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1, &destMemoryBarrier);
+    pTableDevice->CmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1, &destMemoryBarrier);
 
     const VkImageCopy imageCopyRegion = {
         {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1}, {0, 0, 0}, {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1}, {0, 0, 0}, {width, height, 1}};
 
     if (copyOnly) {
-        pTableCommandBuffer->CmdCopyImage(data.commandBuffer, image1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, data.image2,
-                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
+        pTableDevice->CmdCopyImage(commandBuffer, image1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pSlot->image2,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
     } else {
         VkImageBlit imageBlitRegion = {};
         imageBlitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -791,14 +1032,14 @@ static void writePPM(const char *filename, VkImage image1) {
         imageBlitRegion.dstOffsets[1].y = height;
         imageBlitRegion.dstOffsets[1].z = 1;
 
-        pTableCommandBuffer->CmdBlitImage(data.commandBuffer, image1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, data.image2,
-                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlitRegion, VK_FILTER_NEAREST);
+        pTableDevice->CmdBlitImage(commandBuffer, image1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pSlot->image2,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlitRegion, VK_FILTER_NEAREST);
         if (need2steps) {
             // image 3 needs to be transitioned from its undefined state to a
             // transfer destination.
-            destMemoryBarrier.image = data.image3;
-            pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
-                                                    &destMemoryBarrier);
+            destMemoryBarrier.image = pSlot->image3;
+            pTableDevice->CmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
+                                             &destMemoryBarrier);
 
             // Transition image2 so that it can be read for the upcoming copy to
             // image 3.
@@ -806,112 +1047,64 @@ static void writePPM(const char *filename, VkImage image1) {
             destMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
             destMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
             destMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-            destMemoryBarrier.image = data.image2;
-            pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
-                                                    &destMemoryBarrier);
+            destMemoryBarrier.image = pSlot->image2;
+            pTableDevice->CmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
+                                             &destMemoryBarrier);
 
             // This step essentially untiles the image.
-            pTableCommandBuffer->CmdCopyImage(data.commandBuffer, data.image2, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, data.image3,
-                                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
-            generalMemoryBarrier.image = data.image3;
+            pTableDevice->CmdCopyImage(commandBuffer, pSlot->image2, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pSlot->image3,
+                                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageCopyRegion);
+            generalMemoryBarrier.image = pSlot->image3;
         }
     }
 
     // The destination needs to be transitioned from the optimal copy format to
-    // the format we can read with the CPU.
-    pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
-                                            &generalMemoryBarrier);
+    // the format we can read with the CPU, and the copy made visible to the
+    // encoder thread, which reads it once the fence signals.
+    pTableDevice->CmdPipelineBarrier(commandBuffer, srcStages, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 0, NULL, 1,
+                                     &generalMemoryBarrier);
 
-    // Restore the swap chain image layout to what it was before.
-    // This may not be strictly needed, but it is generally good to restore
-    // things to original state.
+    // Restore the swap chain image layout to what it was before, since the
+    // image is presented after the copy.
     presentMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
     presentMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
     presentMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
     presentMemoryBarrier.dstAccessMask = 0;
-    pTableCommandBuffer->CmdPipelineBarrier(data.commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
-                                            &presentMemoryBarrier);
+    pTableDevice->CmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, NULL, 0, NULL, 1,
+                                     &presentMemoryBarrier);
 
-    err = pTableCommandBuffer->EndCommandBuffer(data.commandBuffer);
+    err = pTableDevice->EndCommandBuffer(commandBuffer);
     assert(!err);
+    if (VK_SUCCESS != err) return VK_NULL_HANDLE;
 
-    VkFence nullFence = {VK_NULL_HANDLE};
+    err = pTableDevice->ResetFences(pData->device, 1, &pSlot->fence);
+    assert(!err);
+    if (VK_SUCCESS != err) return VK_NULL_HANDLE;
+
+    // The copy takes over the semaphores of the present.
+    vector<VkPipelineStageFlags> waitStages(pPresentInfo->waitSemaphoreCount, VK_PIPELINE_STAGE_TRANSFER_BIT);
     VkSubmitInfo submitInfo;
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submitInfo.pNext = NULL;
-    submitInfo.waitSemaphoreCount = 0;
-    submitInfo.pWaitSemaphores = NULL;
-    submitInfo.pWaitDstStageMask = NULL;
+    submitInfo.waitSemaphoreCount = pPresentInfo->waitSemaphoreCount;
+    submitInfo.pWaitSemaphores = pPresentInfo->pWaitSemaphores;
+    submitInfo.pWaitDstStageMask = waitStages.data();
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &data.commandBuffer;
-    submitInfo.signalSemaphoreCount = 0;
-    submitInfo.pSignalSemaphores = NULL;
-
-    err = pTableQueue->QueueSubmit(queue, 1, &submitInfo, nullFence);
-    assert(!err);
-
-    err = pTableQueue->QueueWaitIdle(queue);
-    assert(!err);
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &pSlot->semaphore;
 
-    err = pTableDevice->DeviceWaitIdle(device);
+    err = pTableDevice->QueueSubmit(pData->queue, 1, &submitInfo, pSlot->fence);
     assert(!err);
-
-    // Map the final image so that the CPU can read it.
-    const VkImageSubresource sr = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0};
-    VkSubresourceLayout srLayout;
-    const char *ptr;
-    if (!need2steps) {
-        pTableDevice->GetImageSubresourceLayout(device, data.image2, &sr, &srLayout);
-        err = pTableDevice->MapMemory(device, data.mem2, 0, VK_WHOLE_SIZE, 0, (void **)&ptr);
-        assert(!err);
-        if (VK_SUCCESS != err) return;
-        data.mem2mapped = true;
-    } else {
-        pTableDevice->GetImageSubresourceLayout(device, data.image3, &sr, &srLayout);
-        err = pTableDevice->MapMemory(device, data.mem3, 0, VK_WHOLE_SIZE, 0, (void **)&ptr);
-        assert(!err);
-        if (VK_SUCCESS != err) return;
-        data.mem3mapped = true;
-    }
-
-    // Write the data to a PPM file.
-    ofstream file(filename, ios::binary);
-    assert(file.is_open());
-
-    if (!file.is_open()) {
-#ifdef ANDROID
-        __android_log_print(ANDROID_LOG_DEBUG, "screenshot",
-                            "Failed to open output file: %s.  Be sure to grant read and write permissions.", filename);
-#else
-        fprintf(stderr, "Failed to open output file:%s,  Be sure to grant read and write permissions\n", filename);
-#endif
-        return;
-    }
-
-    file << "P6\n";
-    file << width << "\n";
-    file << height << "\n";
-    file << 255 << "\n";
-
-    ptr += srLayout.offset;
-    if (3 == numChannels) {
-        for (uint32_t y = 0; y < height; y++) {
-            file.write(ptr, 3 * width);
-            ptr += srLayout.rowPitch;
-        }
-    } else if (4 == numChannels) {
-        for (uint32_t y = 0; y < height; y++) {
-            const unsigned int *row = (const unsigned int *)ptr;
-            for (uint32_t x = 0; x < width; x++) {
-                file.write((char *)row, 3);
-                row++;
-            }
-            ptr += srLayout.rowPitch;
-        }
-    }
-    file.close();
-
-    // Clean up handled by ~WritePPMCleanupData()
+    if (VK_SUCCESS != err) return VK_NULL_HANDLE;
+
+    // Hand the slot to the encoder thread.
+    std::lock_guard<std::mutex> lock(pData->mutex);
+    pSlot->filename = filename;
+    pSlot->busy = true;
+    pData->pendingSlots.push_back(pSlot);
+    pData->slotQueued.notify_one();
+    return pSlot->semaphore;
 }
 
 VKAPI_ATTR VkResult VKAPI_CALL CreateInstance(const VkInstanceCreateInfo *pCreateInfo, const VkAllocationCallbacks *pAllocator,
@@ -947,6 +1140,7 @@ static void createDeviceRegisterExtensions(const VkDeviceCreateInfo *pCreateInfo
     VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
     PFN_vkGetDeviceProcAddr gpa = pDisp->GetDeviceProcAddr;
     pDisp->CreateSwapchainKHR = (PFN_vkCreateSwapchainKHR)gpa(device, "vkCreateSwapchainKHR");
+    pDisp->DestroySwapchainKHR = (PFN_vkDestroySwapchainKHR)gpa(device, "vkDestroySwapchainKHR");
     pDisp->GetSwapchainImagesKHR = (PFN_vkGetSwapchainImagesKHR)gpa(device, "vkGetSwapchainImagesKHR");
     pDisp->AcquireNextImageKHR = (PFN_vkAcquireNextImageKHR)gpa(device, "vkAcquireNextImageKHR");
     pDisp->QueuePresentKHR = (PFN_vkQueuePresentKHR)gpa(device, "vkQueuePresentKHR");
@@ -1022,6 +1216,19 @@ VKAPI_ATTR void VKAPI_CALL DestroyDevice(VkDevice device, const VkAllocationCall
     DeviceMapStruct *devMap = get_dev_info(device);
     assert(devMap);
     VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
+
+    // Finish the screenshots of swapchains that were not destroyed before
+    // the device, and free their resources.
+    loader_platform_thread_lock_mutex(&globalLock);
+    for (auto swapchainIter = swapchainMap.begin(); swapchainIter != swapchainMap.end(); swapchainIter++) {
+        SwapchainMapStruct *swapchainMapElem = swapchainIter->second;
+        if (swapchainMapElem->device == device && swapchainMapElem->captureData != NULL) {
+            destroySwapchainCaptureData(swapchainMapElem->captureData);
+            swapchainMapElem->captureData = NULL;
+        }
+    }
+    loader_platform_thread_unlock_mutex(&globalLock);
+
     pDisp->DestroyDevice(device, pAllocator);
 
     local_free_getenv(vk_screenshot_format);
@@ -1052,51 +1259,10 @@ VKAPI_ATTR void VKAPI_CALL GetDeviceQueue(VkDevice device, uint32_t queueNodeInd
 
     // Create a mapping from a device to a queue
     devMap->queue = *pQueue;
+    devMap->queueFamilyIndex = queueNodeIndex;
     loader_platform_thread_unlock_mutex(&globalLock);
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL CreateCommandPool(VkDevice device, const VkCommandPoolCreateInfo *pCreateInfo,
-                                                 const VkAllocationCallbacks *pAllocator, VkCommandPool *pCommandPool) {
-    DeviceMapStruct *devMap = get_dev_info(device);
-    assert(devMap);
-    VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
-    VkResult result = pDisp->CreateCommandPool(device, pCreateInfo, pAllocator, pCommandPool);
-
-    // Save the command pool on a map if we are taking screenshots.
-    loader_platform_thread_lock_mutex(&globalLock);
-    if (screenshotFramesReceived && screenshotFrames.empty() && !screenShotFrameRange.valid) {
-        // No screenshots in the list to take
-        loader_platform_thread_unlock_mutex(&globalLock);
-        return result;
-    }
-
-    // Create a mapping from a device to a commandPool
-    devMap->commandPools.push_front(*pCommandPool);
-    loader_platform_thread_unlock_mutex(&globalLock);
-    return result;
-}
-
-VKAPI_ATTR void VKAPI_CALL DestroyCommandPool(VkDevice device, VkCommandPool commandPool, const VkAllocationCallbacks *pAllocator) {
-    DeviceMapStruct *devMap = get_dev_info(device);
-    assert(devMap);
-    VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
-    pDisp->DestroyCommandPool(device, commandPool, pAllocator);
-
-    // Remove the command pool from the map if we are taking screenshots.
-    loader_platform_thread_lock_mutex(&globalLock);
-    if (screenshotFramesReceived && screenshotFrames.empty() && !screenShotFrameRange.valid) {
-        // No screenshots in the list to take
-        loader_platform_thread_unlock_mutex(&globalLock);
-        return;
-    }
-
-    // Remove the commandPool from the device mapping
-    devMap->commandPools.remove(commandPool);
-    loader_platform_thread_unlock_mutex(&globalLock);
-    return;
-}
-
-
 VKAPI_ATTR VkResult VKAPI_CALL CreateSwapchainKHR(VkDevice device, const VkSwapchainCreateInfoKHR *pCreateInfo,
                                                   const VkAllocationCallbacks *pAllocator, VkSwapchainKHR *pSwapchain) {
     DeviceMapStruct *devMap = get_dev_info(device);
@@ -1124,6 +1290,9 @@ VKAPI_ATTR VkResult VKAPI_CALL CreateSwapchainKHR(VkDevice device, const VkSwapc
         swapchainMapElem->device = device;
         swapchainMapElem->imageExtent = pCreateInfo->imageExtent;
         swapchainMapElem->format = pCreateInfo->imageFormat;
+        swapchainMapElem->imageList = NULL;
+        swapchainMapElem->imageCount = 0;
+        swapchainMapElem->captureData = NULL;
         swapchainMap.insert(make_pair(*pSwapchain, swapchainMapElem));
 
         // Create a mapping for the swapchain object into the dispatch table
@@ -1135,6 +1304,38 @@ VKAPI_ATTR VkResult VKAPI_CALL CreateSwapchainKHR(VkDevice device, const VkSwapc
     return result;
 }
 
+VKAPI_ATTR void VKAPI_CALL DestroySwapchainKHR(VkDevice device, VkSwapchainKHR swapchain, const VkAllocationCallbacks *pAllocator) {
+    DeviceMapStruct *devMap = get_dev_info(device);
+    assert(devMap);
+    VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
+
+    // The screenshots of the swapchain are written before its images go away.
+    // The swapchain and its images are then forgotten, so that a swapchain
+    // created later with the same handle, e.g. when the window is resized,
+    // is captured with its own extent, format and images.
+    loader_platform_thread_lock_mutex(&globalLock);
+    auto swapchainIter = swapchainMap.find(swapchain);
+    if (swapchainIter != swapchainMap.end()) {
+        SwapchainMapStruct *swapchainMapElem = swapchainIter->second;
+        if (swapchainMapElem->captureData != NULL) {
+            destroySwapchainCaptureData(swapchainMapElem->captureData);
+        }
+        for (uint32_t i = 0; i < swapchainMapElem->imageCount; i++) {
+            auto imageIter = imageMap.find(swapchainMapElem->imageList[i]);
+            if (imageIter != imageMap.end()) {
+                delete imageIter->second;
+                imageMap.erase(imageIter);
+            }
+        }
+        delete[] swapchainMapElem->imageList;
+        delete swapchainMapElem;
+        swapchainMap.erase(swapchainIter);
+    }
+    loader_platform_thread_unlock_mutex(&globalLock);
+
+    pDisp->DestroySwapchainKHR(device, swapchain, pAllocator);
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL GetSwapchainImagesKHR(VkDevice device, VkSwapchainKHR swapchain, uint32_t *pCount,
                                                      VkImage *pSwapchainImages) {
     DeviceMapStruct *devMap = get_dev_info(device);
@@ -1169,7 +1370,9 @@ VKAPI_ATTR VkResult VKAPI_CALL GetSwapchainImagesKHR(VkDevice device, VkSwapchai
         SwapchainMapStruct *swapchainMapElem = swapchainMap[swapchain];
         if (i >= 1 && swapchainMapElem) {
             VkImage *imageList = new VkImage[i];
+            delete[] swapchainMapElem->imageList;
             swapchainMapElem->imageList = imageList;
+            swapchainMapElem->imageCount = i;
             for (unsigned j = 0; j < i; j++) {
                 swapchainMapElem->imageList[j] = pSwapchainImages[j];
             }
@@ -1187,7 +1390,6 @@ VKAPI_ATTR VkResult VKAPI_CALL QueuePresentKHR(VkQueue queue, const VkPresentInf
     DeviceMapStruct *devMap = get_dev_info((VkDevice)queue);
     assert(devMap);
     VkLayerDispatchTable *pDisp = devMap->device_dispatch_table;
-    VkResult result = pDisp->QueuePresentKHR(queue, pPresentInfo);
     loader_platform_thread_lock_mutex(&globalLock);
 
     if (!screenshotFramesReceived) {
@@ -1207,12 +1409,15 @@ VKAPI_ATTR VkResult VKAPI_CALL QueuePresentKHR(VkQueue queue, const VkPresentInf
         local_free_getenv(vk_screenshot_frames);
     }
 
-    if (result == VK_SUCCESS && (!screenshotFrames.empty() || screenShotFrameRange.valid)) {
-        set<int>::iterator it;
-        bool inScreenShotFrames = false;
-        bool inScreenShotFrameRange = false;
-        it = screenshotFrames.find(frameNumber);
-        inScreenShotFrames = (it != screenshotFrames.end());
+    // The image is captured before it is presented, see writePPM.  If the
+    // copy is submitted, the present waits for its semaphore instead of the
+    // ones it was given.
+    VkPresentInfoKHR presentInfo = *pPresentInfo;
+    VkSemaphore copySemaphore = VK_NULL_HANDLE;
+    bool inScreenShotFrames = false;
+    bool inScreenShotFrameRange = false;
+    if (!screenshotFrames.empty() || screenShotFrameRange.valid) {
+        inScreenShotFrames = (screenshotFrames.find(frameNumber) != screenshotFrames.end());
         isInScreenShotFrameRange(frameNumber, &screenShotFrameRange, &inScreenShotFrameRange);
         if ((inScreenShotFrames) || (inScreenShotFrameRange)) {
             string fileName;
@@ -1232,31 +1437,56 @@ VKAPI_ATTR VkResult VKAPI_CALL QueuePresentKHR(VkQueue queue, const VkPresentInf
             VkSwapchainKHR swapchain;
             // We'll dump only one image: the first
             swapchain = pPresentInfo->pSwapchains[0];
-            image = swapchainMap[swapchain]->imageList[pPresentInfo->pImageIndices[0]];
-            writePPM(fileName.c_str(), image);
-            if (inScreenShotFrames) {
-                screenshotFrames.erase(it);
+            auto swapchainIter = swapchainMap.find(swapchain);
+            if (swapchainIter != swapchainMap.end() && pPresentInfo->pImageIndices[0] < swapchainIter->second->imageCount) {
+                image = swapchainIter->second->imageList[pPresentInfo->pImageIndices[0]];
+                copySemaphore = writePPM(fileName.c_str(), swapchain, image, pPresentInfo);
+            }
+            if (copySemaphore != VK_NULL_HANDLE) {
+                presentInfo.waitSemaphoreCount = 1;
+                presentInfo.pWaitSemaphores = &copySemaphore;
+            }
+        }
+    }
+    loader_platform_thread_unlock_mutex(&globalLock);
+
+    VkResult result = pDisp->QueuePresentKHR(queue, &presentInfo);
+
+    loader_platform_thread_lock_mutex(&globalLock);
+    if ((inScreenShotFrames) || (inScreenShotFrameRange)) {
+        if (inScreenShotFrames) {
+            screenshotFrames.erase(frameNumber);
+        }
+
+        if (screenshotFrames.empty() && isEndOfScreenShotFrameRange(frameNumber, &screenShotFrameRange)) {
+            // The present may still be waiting for the semaphore of the last
+            // screenshot, which goes away with the rest of its resources.
+            if (copySemaphore != VK_NULL_HANDLE) {
+                pDisp->QueueWaitIdle(queue);
             }
 
-            if (screenshotFrames.empty() && isEndOfScreenShotFrameRange(frameNumber, &screenShotFrameRange)) {
-                // Free all our maps since we are done with them.
-                for (auto swapchainIter = swapchainMap.begin(); swapchainIter != swapchainMap.end(); swapchainIter++) {
-                    SwapchainMapStruct *swapchainMapElem = swapchainIter->second;
-                    delete swapchainMapElem;
-                }
-                for (auto imageIter = imageMap.begin(); imageIter != imageMap.end(); imageIter++) {
-                    ImageMapStruct *imageMapElem = imageIter->second;
-                    delete imageMapElem;
+            // Free all our maps since we are done with them, once the
+            // screenshots that are still pending have been written.
+            for (auto swapchainIter = swapchainMap.begin(); swapchainIter != swapchainMap.end(); swapchainIter++) {
+                SwapchainMapStruct *swapchainMapElem = swapchainIter->second;
+                if (swapchainMapElem->captureData != NULL) {
+                    destroySwapchainCaptureData(swapchainMapElem->captureData);
                 }
-                for (auto physDeviceIter = physDeviceMap.begin(); physDeviceIter != physDeviceMap.end(); physDeviceIter++) {
-                    PhysDeviceMapStruct *physDeviceMapElem = physDeviceIter->second;
-                    delete physDeviceMapElem;
-                }
-                swapchainMap.clear();
-                imageMap.clear();
-                physDeviceMap.clear();
-                screenShotFrameRange.valid = false;
+                delete[] swapchainMapElem->imageList;
+                delete swapchainMapElem;
+            }
+            for (auto imageIter = imageMap.begin(); imageIter != imageMap.end(); imageIter++) {
+                ImageMapStruct *imageMapElem = imageIter->second;
+                delete imageMapElem;
+            }
+            for (auto physDeviceIter = physDeviceMap.begin(); physDeviceIter != physDeviceMap.end(); physDeviceIter++) {
+                PhysDeviceMapStruct *physDeviceMapElem = physDeviceIter->second;
+                delete physDeviceMapElem;
             }
+            swapchainMap.clear();
+            imageMap.clear();
+            physDeviceMap.clear();
+            screenShotFrameRange.valid = false;
         }
     }
     frameNumber++;
@@ -1369,8 +1599,6 @@ static PFN_vkVoidFunction intercept_core_device_command(const char *name) {
     } core_device_commands[] = {
         {"vkGetDeviceProcAddr", reinterpret_cast<PFN_vkVoidFunction>(GetDeviceProcAddr)},
         {"vkGetDeviceQueue", reinterpret_cast<PFN_vkVoidFunction>(GetDeviceQueue)},
-        {"vkCreateCommandPool", reinterpret_cast<PFN_vkVoidFunction>(CreateCommandPool)},
-        {"vkDestroyCommandPool", reinterpret_cast<PFN_vkVoidFunction>(DestroyCommandPool)},
         {"vkDestroyDevice", reinterpret_cast<PFN_vkVoidFunction>(DestroyDevice)},
     };
 
@@ -1387,6 +1615,7 @@ static PFN_vkVoidFunction intercept_khr_swapchain_command(const char *name, VkDe
         PFN_vkVoidFunction proc;
     } khr_swapchain_commands[] = {
         {"vkCreateSwapchainKHR", reinterpret_cast<PFN_vkVoidFunction>(CreateSwapchainKHR)},
+        {"vkDestroySwapchainKHR", reinterpret_cast<PFN_vkVoidFunction>(DestroySwapchainKHR)},
         {"vkGetSwapchainImagesKHR", reinterpret_cast<PFN_vkVoidFunction>(GetSwapchainImagesKHR)},
         {"vkQueuePresentKHR", reinterpret_cast<PFN_vkVoidFunction>(QueuePresentKHR)},
     };
@@ -495,6 +495,7 @@ class VkTraceFileOutputGenerator(OutputGenerator):
         replay_objmapper_header += '#include <string>\n'
         replay_objmapper_header += '#include "vulkan/vulkan.h"\n'
         replay_objmapper_header += '#include "vktrace_pageguard_memorycopy.h"\n'
+        replay_objmapper_header += '#include "vkreplay_handle_map.h"\n'
         replay_objmapper_header += '\n'
         replay_objmapper_header += '#include "vkreplay_objmapper_class_defs.h"\n\n'
 
@@ -519,7 +520,7 @@ class VkTraceFileOutputGenerator(OutputGenerator):
                 obj_name = item[2:].lower() + 'Obj'
             else:
                 obj_name = item
-            replay_objmapper_header += '    std::map<%s, %s> %s;\n' % (item, obj_name, mangled_name)
+            replay_objmapper_header += '    vkReplayHandleMap<%s, %s> %s;\n' % (item, obj_name, mangled_name)
             replay_objmapper_header += '    void add_to_%s_map(%s pTraceVal, %s pReplayVal) {\n' % (map_name, item, obj_name)
             replay_objmapper_header += '        %s[pTraceVal] = pReplayVal;\n' % mangled_name
             replay_objmapper_header += '    }\n\n'
@@ -531,14 +532,14 @@ class VkTraceFileOutputGenerator(OutputGenerator):
             replay_objmapper_header += '    %s remap_%s(const %s& value) {\n' % (item, map_name, item)
             replay_objmapper_header += '        if (value == 0) { return 0; }\n'
             if item in remapped_objects:
-                replay_objmapper_header += '        std::map<%s, %s>::const_iterator q = %s.find(value);\n' % (item, obj_name, mangled_name)
+                replay_objmapper_header += '        vkReplayHandleMap<%s, %s>::const_iterator q = %s.find(value);\n' % (item, obj_name, mangled_name)
                 if item == 'VkDeviceMemory':
                     replay_objmapper_header += '        if (q == %s.end()) { vktrace_LogError("Failed to remap %s."); return VK_NULL_HANDLE; }\n' % (mangled_name, item)
                 else:
                     replay_objmapper_header += '        if (q == %s.end()) return VK_NULL_HANDLE;\n' % mangled_name
                 replay_objmapper_header += '        return q->second.replay%s;\n' % item[2:]
             else:
-                replay_objmapper_header += '        std::map<%s, %s>::const_iterator q = %s.find(value);\n' % (item, obj_name, mangled_name)
+                replay_objmapper_header += '        vkReplayHandleMap<%s, %s>::const_iterator q = %s.find(value);\n' % (item, obj_name, mangled_name)
                 replay_objmapper_header += '        if (q == %s.end()) { vktrace_LogError("Failed to remap %s."); return VK_NULL_HANDLE; }\n' % (mangled_name, item)
                 replay_objmapper_header += '        return q->second;\n'
             replay_objmapper_header += '    }\n\n'
@@ -704,6 +705,8 @@ class VkTraceFileOutputGenerator(OutputGenerator):
         replay_gen_source += 'vktrace_replay::VKTRACE_REPLAY_RESULT vkReplay::replay(vktrace_trace_packet_header *packet) { \n'
         replay_gen_source += '    vktrace_replay::VKTRACE_REPLAY_RESULT returnValue = vktrace_replay::VKTRACE_REPLAY_SUCCESS;\n'
         replay_gen_source += '    VkResult replayResult = VK_ERROR_VALIDATION_FAILED_EXT;\n'
+        replay_gen_source += '    // Release the temporary arrays of the previous packet\n'
+        replay_gen_source += '    m_scratch.reset();\n'
         replay_gen_source += '    switch (packet->packet_id) {\n'
         replay_gen_source += '        case VKTRACE_TPI_VK_vkApiVersion:\n'
         replay_gen_source += '            // Ignore api version packets\n'
@@ -1584,6 +1587,13 @@ class VkTraceFileOutputGenerator(OutputGenerator):
             trim_instructions.append('        } else {')
             trim_instructions.append('            vktrace_delete_trace_packet(&pHeader);')
             trim_instructions.append('        }')
+        elif 'vkResetCommandPool' == proto.name:
+            trim_instructions.append("        trim::reset_CommandPool(commandPool);")
+            trim_instructions.append('        if (g_trimIsInTrim) {')
+            trim_instructions.append('            trim::write_packet(pHeader);')
+            trim_instructions.append('        } else {')
+            trim_instructions.append('            vktrace_delete_trace_packet(&pHeader);')
+            trim_instructions.append('        }')
         elif 'vkDestroyCommandPool' == proto.name:
             trim_instructions.append("        trim::remove_CommandPool_object(commandPool);")
             trim_instructions.append('        if (g_trimIsInTrim) {')
@@ -2052,7 +2062,7 @@ class VkTraceFileOutputGenerator(OutputGenerator):
         elif 'vkCreateShaderModule' == proto.name:
             trim_instructions.append("        trim::ObjectInfo &info = trim::add_ShaderModule_object(*pShaderModule);")
             trim_instructions.append("        info.belongsToDevice = device;")
-            trim_instructions.append("        trim::StateTracker::copy_VkShaderModuleCreateInfo(&info.ObjectInfo.ShaderModule.createInfo, *pCreateInfo);")
+            trim_instructions.append("        info.ObjectInfo.ShaderModule.pCreatePacket = trim::copy_packet(pHeader);")
             trim_instructions.append("        if (pAllocator != NULL) {")
             trim_instructions.append("            info.ObjectInfo.ShaderModule.pAllocator = pAllocator;")
             trim_instructions.append("            trim::add_Allocator(pAllocator);")
@@ -2260,10 +2270,20 @@ class VkTraceFileOutputGenerator(OutputGenerator):
         trace_vk_src += '    const char *ipPort = "vktrace";\n'
         trace_vk_src += '    gMessageStream = vktrace_MessageStream_create_port_string(FALSE, ipAddr, ipPort);\n'
         trace_vk_src += '#else\n'
-        trace_vk_src += '    const char *ipAddr = vktrace_get_global_var("VKTRACE_LIB_IPADDR");\n'
-        trace_vk_src += '    if (ipAddr == NULL)\n'
-        trace_vk_src += '        ipAddr = "127.0.0.1";\n'
-        trace_vk_src += '    gMessageStream = vktrace_MessageStream_create(FALSE, ipAddr, VKTRACE_BASE_PORT + VKTRACE_TID_VULKAN);\n'
+        trace_vk_src += '    // When vktrace launched this process it may have set up a shared memory ring, which avoids the socket round trip\n'
+        trace_vk_src += '    const char *shmRingName = vktrace_get_global_var(_VKTRACE_SHM_RING_ENV);\n'
+        trace_vk_src += '    if (shmRingName != NULL && strlen(shmRingName) > 0) {\n'
+        trace_vk_src += '        // vktrace only reads from the ring it set up and doesn\'t listen on the socket, so there is nothing to fall back to\n'
+        trace_vk_src += '        gMessageStream = vktrace_MessageStream_create_shm(FALSE, shmRingName);\n'
+        trace_vk_src += '        if (gMessageStream == NULL)\n'
+        trace_vk_src += '            vktrace_LogError("Unable to open the shared memory ring %s, nothing will be traced. Run vktrace with -shm false to trace over a socket.",\n'
+        trace_vk_src += '                             shmRingName);\n'
+        trace_vk_src += '    } else {\n'
+        trace_vk_src += '        const char *ipAddr = vktrace_get_global_var("VKTRACE_LIB_IPADDR");\n'
+        trace_vk_src += '        if (ipAddr == NULL)\n'
+        trace_vk_src += '            ipAddr = "127.0.0.1";\n'
+        trace_vk_src += '        gMessageStream = vktrace_MessageStream_create(FALSE, ipAddr, VKTRACE_BASE_PORT + VKTRACE_TID_VULKAN);\n'
+        trace_vk_src += '    }\n'
         trace_vk_src += '#endif\n'
         trace_vk_src += '    vktrace_trace_set_trace_file(vktrace_FileLike_create_msg(gMessageStream));\n'
         trace_vk_src += '    vktrace_tracelog_set_tracer_id(VKTRACE_TID_VULKAN);\n'
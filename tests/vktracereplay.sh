@@ -47,6 +47,44 @@ function trace_replay {
 	fi
 }
 
+function trim_replay {
+	PGM=$1
+	FRAMES=$2
+	VKTRACE=${PWD}/../vktrace/vktrace
+	VKTRIM=${PWD}/../vktrace/vktrim
+	VKREPLAY=${PWD}/../vktrace/vkreplay
+	APPDIR=${LVL_BUILD}/demos
+	printf "$GREEN[ TRACE    ]$NC ${PGM}\n"
+	${VKTRACE}	--Program ${APPDIR}/${PGM} \
+			--Arguments "--c 100" \
+			--WorkingDir ${APPDIR} \
+			--OutputTrace ${PGM}.vktrace \
+			--PMB false
+	printf "$GREEN[ TRIM     ]$NC ${PGM} ${FRAMES}\n"
+	${VKTRIM}	-i ${PGM}.vktrace \
+			-o ${PGM}-trimmed.vktrace \
+			-f ${FRAMES}
+	RES=$?
+	printf "$GREEN[ REPLAY   ]$NC ${PGM}-trimmed\n"
+	if [ $RES -eq 0 ] ; then
+		${VKREPLAY} --Open ${PGM}-trimmed.vktrace > ${PGM}-trimmed.log 2>&1
+		RES=$?
+	fi
+	# Replay errors don't stop vkreplay, so they are looked for in what it printed.
+	if [ $RES -eq 0 ] && grep -q -e "Skipping" -e "Failed to replay" -e "invalid remapped" ${PGM}-trimmed.log ; then
+		cat ${PGM}-trimmed.log
+		RES=1
+	fi
+	rm -f ${PGM}.vktrace ${PGM}-trimmed.vktrace ${PGM}-trimmed.log
+	if [ $RES -eq 0 ] ; then
+	   printf "$GREEN[  PASSED  ]$NC ${PGM} trimmed to ${FRAMES}\n"
+	else
+	   printf "$RED[  FAILED  ]$NC ${PGM} trimmed to ${FRAMES}\n"
+	   printf "TEST FAILED\n"
+	   exit 1
+	fi
+}
+
 trace_replay cube "" "--PMB false"
 # Test smoketest with pageguard
 trace_replay smoketest "" "--PMB true"
@@ -54,6 +92,9 @@ trace_replay smoketest "" "--PMB true"
 trace_replay smoketest "-p" "--PMB false"
 # Test smoketest without pageguard, using flush call
 trace_replay smoketest "--flush" "--PMB false"
+# Test a window of frames cut out by vktrim. cube destroys its shader modules as soon as its
+# pipeline is created, so they are only in the trimmed trace if vktrim keeps them for the pipeline.
+trim_replay cube "50,10"
 
 exit 0
 
@@ -0,0 +1,337 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Writes a block compressed trace file the way vktrace does and reads it
+// back the way vkreplay does:
+//   - a round trip of a file header followed by a stream that has text,
+//     runs, and random bytes that don't compress, written in pieces of
+//     random sizes and read back at random offsets across blocks,
+//   - the same file cut short at several lengths, which the reader must
+//     refuse to open,
+//   - the file with a block whose index entry is cut short, and one whose
+//     stored bytes are overwritten, which must fail to read while the
+//     other blocks still read back,
+//   - random bytes of compressed blocks flipped, where decompressing must
+//     either fail or stop at the end of its output.
+// It fails if a read returns bytes that weren't written, or if a broken
+// file or block is read without an error.
+//
+// usage: vktrace_block_file_test [random corruptions]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "vktrace_block_file.h"
+#include "vktrace_trace_packet_identifiers.h"
+#include "vktrace_test_harness.h"
+
+namespace {
+
+const uint64_t kHeaderSize = 200;
+const uint32_t kBlockSize = 4096;
+const uint64_t kStreamSize = 40 * kBlockSize + 1234;
+const uint32_t kMaxWriteSize = 3 * kBlockSize;
+const uint8_t kGuardByte = 0xcd;
+const size_t kGuardSize = 64;
+
+// Text, runs, and random bytes, so there are blocks that compress and
+// blocks that are stored as they are.
+std::vector<uint8_t> make_stream(std::mt19937_64 &random) {
+    static const char kText[] = "vkCmdDraw vkCmdBindPipeline vkCmdBindDescriptorSets vkQueueSubmit ";
+    std::vector<uint8_t> stream;
+    while (stream.size() < kStreamSize) {
+        uint64_t kind = random() % 3;
+        uint64_t count = 1 + random() % (2 * kBlockSize);
+        for (uint64_t i = 0; i < count && stream.size() < kStreamSize; i++) {
+            if (kind == 0) {
+                stream.push_back(static_cast<uint8_t>(kText[i % (sizeof(kText) - 1)]));
+            } else if (kind == 1) {
+                stream.push_back(static_cast<uint8_t>(count));
+            } else {
+                stream.push_back(static_cast<uint8_t>(random()));
+            }
+        }
+    }
+    return stream;
+}
+
+std::vector<uint8_t> read_file(FILE *pFile) {
+    fseek(pFile, 0, SEEK_END);
+    std::vector<uint8_t> bytes(static_cast<size_t>(ftell(pFile)));
+    rewind(pFile);
+    if (fread(bytes.data(), 1, bytes.size(), pFile) != bytes.size()) {
+        bytes.clear();
+    }
+    return bytes;
+}
+
+FILE *write_file(const uint8_t *pBytes, size_t size) {
+    FILE *pFile = tmpfile();
+    if (pFile != NULL && size > 0) {
+        fwrite(pBytes, 1, size, pFile);
+    }
+    if (pFile != NULL) {
+        rewind(pFile);
+    }
+    return pFile;
+}
+
+// Writes the header as is and the stream through the block writer in pieces
+// of random sizes. Returns the bytes of the file, or nothing if it failed.
+std::vector<uint8_t> write_block_file(const std::vector<uint8_t> &header, const std::vector<uint8_t> &stream,
+                                      std::mt19937_64 &random) {
+    std::vector<uint8_t> bytes;
+    FILE *pFile = tmpfile();
+    if (pFile == NULL || fwrite(header.data(), 1, header.size(), pFile) != header.size()) {
+        return bytes;
+    }
+    vktrace_block_writer *pWriter = vktrace_block_writer_create(pFile, header.size(), kBlockSize);
+    bool bWritten = pWriter != NULL;
+    for (size_t offset = 0; bWritten && offset < stream.size();) {
+        size_t count = static_cast<size_t>(1 + random() % kMaxWriteSize);
+        count = (count < stream.size() - offset) ? count : stream.size() - offset;
+        bWritten = vktrace_block_writer_write(pWriter, stream.data() + offset, count) == TRUE &&
+                   vktrace_block_writer_get_position(pWriter) == header.size() + offset + count;
+        offset += count;
+    }
+    bWritten = bWritten && vktrace_block_writer_finish(pWriter) == TRUE;
+    vktrace_block_writer_destroy(&pWriter);
+    if (bWritten) {
+        bytes = read_file(pFile);
+    }
+    fclose(pFile);
+    return bytes;
+}
+
+// Reads all of the logical file, then pieces of it at random offsets.
+// Returns false if a read fails or returns bytes that weren't written.
+bool read_back(vktrace_block_reader *pReader, const std::vector<uint8_t> &logical, std::mt19937_64 &random) {
+    if (vktrace_block_reader_get_length(pReader) != logical.size()) {
+        return false;
+    }
+    std::vector<uint8_t> bytes(logical.size());
+    if (!vktrace_block_reader_read(pReader, 0, bytes.data(), bytes.size()) || bytes != logical) {
+        return false;
+    }
+    for (int i = 0; i < 1000; i++) {
+        uint64_t offset = random() % logical.size();
+        uint64_t count = 1 + random() % kMaxWriteSize;
+        count = (count < logical.size() - offset) ? count : logical.size() - offset;
+        if (!vktrace_block_reader_read(pReader, offset, bytes.data(), count) ||
+            memcmp(bytes.data(), logical.data() + offset, (size_t)count) != 0) {
+            return false;
+        }
+    }
+    // Reads past the end fail.
+    return !vktrace_block_reader_read(pReader, logical.size() - 1, bytes.data(), 2) &&
+           !vktrace_block_reader_read(pReader, logical.size() + 1, bytes.data(), 0);
+}
+
+bool check_round_trip(const std::vector<uint8_t> &file, const std::vector<uint8_t> &logical, std::mt19937_64 &random) {
+    FILE *pFile = write_file(file.data(), file.size());
+    vktrace_block_reader *pReader = pFile ? vktrace_block_reader_create(pFile) : NULL;
+    bool bPassed = pReader != NULL && read_back(pReader, logical, random);
+    vktrace_block_reader_destroy(&pReader);
+    if (pFile != NULL) {
+        fclose(pFile);
+    }
+    return bPassed;
+}
+
+// A file cut short loses its footer, or the footer no longer matches the
+// file length, so the reader must not open it.
+bool check_truncated_files(const std::vector<uint8_t> &file) {
+    const size_t lengths[] = {0,
+                              kHeaderSize,
+                              file.size() / 2,
+                              file.size() - sizeof(vktrace_block_file_footer) - 1,
+                              file.size() - sizeof(vktrace_block_file_footer),
+                              file.size() - 8,
+                              file.size() - 1};
+    bool bPassed = true;
+    for (size_t length : lengths) {
+        FILE *pFile = write_file(file.data(), length);
+        vktrace_block_reader *pReader = pFile ? vktrace_block_reader_create(pFile) : NULL;
+        if (pReader != NULL) {
+            printf("A file cut to %zu of %zu bytes was opened.\n", length, file.size());
+            bPassed = false;
+        }
+        vktrace_block_reader_destroy(&pReader);
+        if (pFile != NULL) {
+            fclose(pFile);
+        }
+    }
+    return bPassed;
+}
+
+// Opens the broken file and checks that the broken block fails to read,
+// both on its own and as part of a larger read, while the blocks around it
+// still read back as written.
+bool check_broken_block(const std::vector<uint8_t> &file, const std::vector<uint8_t> &logical, uint64_t block,
+                        const char *pWhat) {
+    FILE *pFile = write_file(file.data(), file.size());
+    vktrace_block_reader *pReader = pFile ? vktrace_block_reader_create(pFile) : NULL;
+    bool bPassed = pReader != NULL;
+    if (bPassed) {
+        uint64_t blockOffset = kHeaderSize + block * kBlockSize;
+        std::vector<uint8_t> bytes(3 * kBlockSize);
+        bPassed = !vktrace_block_reader_read(pReader, blockOffset, bytes.data(), kBlockSize) &&
+                  !vktrace_block_reader_read(pReader, blockOffset - kBlockSize, bytes.data(), 3 * kBlockSize) &&
+                  vktrace_block_reader_read(pReader, blockOffset - kBlockSize, bytes.data(), kBlockSize) &&
+                  memcmp(bytes.data(), logical.data() + blockOffset - kBlockSize, kBlockSize) == 0 &&
+                  vktrace_block_reader_read(pReader, blockOffset + kBlockSize, bytes.data(), kBlockSize) &&
+                  memcmp(bytes.data(), logical.data() + blockOffset + kBlockSize, kBlockSize) == 0;
+    }
+    if (!bPassed) {
+        printf("Block %llu with %s didn't fail alone.\n", (unsigned long long)block, pWhat);
+    }
+    vktrace_block_reader_destroy(&pReader);
+    if (pFile != NULL) {
+        fclose(pFile);
+    }
+    return bPassed;
+}
+
+// The footer and index aren't aligned in the file, so they are copied.
+vktrace_block_file_footer get_footer(const std::vector<uint8_t> &file) {
+    vktrace_block_file_footer footer;
+    memcpy(&footer, file.data() + file.size() - sizeof(footer), sizeof(footer));
+    return footer;
+}
+
+uint8_t *get_entry_bytes(std::vector<uint8_t> &file, uint64_t block) {
+    return file.data() + get_footer(file).indexOffset + block * sizeof(vktrace_block_index_entry);
+}
+
+// Returns the first block that was, or wasn't, compressed, and its entry.
+uint64_t find_block(std::vector<uint8_t> &file, bool bCompressed, vktrace_block_index_entry *pEntry) {
+    for (uint64_t block = 1; block + 1 < get_footer(file).blockCount; block++) {
+        memcpy(pEntry, get_entry_bytes(file, block), sizeof(*pEntry));
+        if (((pEntry->flags & VKTRACE_BLOCK_COMPRESSED) != 0) == bCompressed) {
+            return block;
+        }
+    }
+    return 0;
+}
+
+bool check_broken_blocks(const std::vector<uint8_t> &file, const std::vector<uint8_t> &logical) {
+    bool bPassed = true;
+    for (int compressed = 1; compressed >= 0; compressed--) {
+        std::vector<uint8_t> broken = file;
+        vktrace_block_index_entry entry;
+        uint64_t block = find_block(broken, compressed != 0, &entry);
+        if (block == 0) {
+            printf("The stream has no %s block.\n", compressed ? "compressed" : "stored");
+            bPassed = false;
+            continue;
+        }
+
+        // The index entry says the block is shorter than it is.
+        vktrace_block_index_entry cutEntry = entry;
+        cutEntry.storedSize -= 5;
+        memcpy(get_entry_bytes(broken, block), &cutEntry, sizeof(cutEntry));
+        bPassed = check_broken_block(broken, logical, block, compressed ? "a cut compressed size" : "a cut stored size") && bPassed;
+        memcpy(get_entry_bytes(broken, block), &entry, sizeof(entry));
+
+        // A compressed block whose bytes are overwritten. Lengths of 255
+        // run past the end of the block. A stored block has no way to tell.
+        if (compressed) {
+            memset(broken.data() + entry.fileOffset, 0xff, entry.storedSize);
+            bPassed = check_broken_block(broken, logical, block, "overwritten bytes") && bPassed;
+        }
+    }
+    return bPassed;
+}
+
+// Flips random bytes of compressed blocks. Decompressing must fail or stop
+// at the end of its output, which is followed by guard bytes.
+bool check_flipped_bytes(const std::vector<uint8_t> &logical, uint64_t corruptionCount, std::mt19937_64 &random) {
+    std::vector<uint8_t> compressed((size_t)vktrace_block_compress_bound(kBlockSize));
+    std::vector<uint8_t> decompressed(kBlockSize + kGuardSize);
+    uint64_t failedCount = 0;
+    for (uint64_t i = 0; i < corruptionCount; i++) {
+        uint64_t offset = kHeaderSize + (random() % (logical.size() / kBlockSize - 1)) * kBlockSize;
+        uint64_t compressedSize = vktrace_block_compress(logical.data() + offset, kBlockSize, compressed.data(), compressed.size());
+        if (compressedSize == 0 || !vktrace_block_decompress(compressed.data(), compressedSize, decompressed.data(), kBlockSize) ||
+            memcmp(decompressed.data(), logical.data() + offset, kBlockSize) != 0) {
+            printf("A block at %llu didn't round trip.\n", (unsigned long long)offset);
+            return false;
+        }
+
+        for (int flip = 1 + random() % 4; flip > 0; flip--) {
+            compressed[random() % compressedSize] ^= static_cast<uint8_t>(1 + random() % 255);
+        }
+        uint64_t cutSize = (random() % 4 == 0) ? random() % compressedSize : compressedSize;
+        memset(decompressed.data() + kBlockSize, kGuardByte, kGuardSize);
+        if (!vktrace_block_decompress(compressed.data(), cutSize, decompressed.data(), kBlockSize)) {
+            failedCount++;
+        }
+        for (size_t guard = kBlockSize; guard < decompressed.size(); guard++) {
+            if (decompressed[guard] != kGuardByte) {
+                printf("Decompressing a corrupt block wrote past its end.\n");
+                return false;
+            }
+        }
+    }
+    printf("%llu of %llu corrupt blocks failed to decompress\n", (unsigned long long)failedCount,
+           (unsigned long long)corruptionCount);
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {10000};
+    if (!vktrace_test::read_counts(argc, argv, "[random corruptions]", counts)) {
+        return 1;
+    }
+    uint64_t corruptionCount = counts[0];
+
+    // The broken files log errors the test expects.
+    vktrace_LogSetLevel(VKTRACE_LOG_NONE);
+    // The file header, followed by bytes that stand in for the gpu info.
+    std::mt19937_64 random(1);
+    std::vector<uint8_t> header(kHeaderSize);
+    for (size_t i = 0; i < header.size(); i++) {
+        header[i] = static_cast<uint8_t>(i);
+    }
+    vktrace_trace_file_header fileHeader = {};
+    fileHeader.trace_file_version = VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED;
+    fileHeader.magic = VKTRACE_FILE_MAGIC;
+    fileHeader.first_packet_offset = kHeaderSize;
+    memcpy(header.data(), &fileHeader, sizeof(fileHeader));
+    std::vector<uint8_t> stream = make_stream(random);
+    std::vector<uint8_t> logical = header;
+    logical.insert(logical.end(), stream.begin(), stream.end());
+
+    std::vector<uint8_t> file = write_block_file(header, stream, random);
+    bool bPassed = vktrace_test::report(!file.empty() && check_round_trip(file, logical, random),
+                                        "Round trip of %llu bytes in %u byte blocks, %zu bytes compressed",
+                                        (unsigned long long)logical.size(), kBlockSize, file.size());
+    if (!bPassed) {
+        return 1;
+    }
+    bPassed = vktrace_test::report(check_truncated_files(file), "Truncated files") && bPassed;
+    bPassed = vktrace_test::report(check_broken_blocks(file, logical), "Truncated and corrupt blocks") && bPassed;
+    bPassed = vktrace_test::report(check_flipped_bytes(logical, corruptionCount, random), "%llu random corruptions",
+                                   (unsigned long long)corruptionCount) &&
+              bPassed;
+    return vktrace_test::exit_code(bPassed);
+}
@@ -0,0 +1,225 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures how long the trace layer takes to create, finalize, write and
+// delete the small packets that most traced calls make, like the ones of
+// vkCmdDraw and vkCmdBindVertexBuffers.
+//
+// Each thread builds its packets the way the generated wrappers do and
+// writes them to its own FileLike on the null device, once with the write
+// and once without it, so the packet handling is also timed on its own.
+// This is done two ways:
+//   - allocating every packet with malloc, clearing all of it and freeing
+//     it, which is how packets were handled before the per-thread packet
+//     cache,
+//   - with vktrace_create_trace_packet(), vktrace_finalize_trace_packet()
+//     and vktrace_delete_trace_packet(), which reuse buffers from the
+//     cache and only clear what the packet doesn't fill in.
+// It fails if a packet that reuses a buffer from the cache carries bytes
+// of the packet that used the buffer before.
+//
+// usage: vktrace_packet_benchmark [packets per thread] [threads]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_filelike.h"
+#include "vktrace_trace_packet_utils.h"
+}
+
+namespace {
+
+// Stand-ins for the packets of vkCmdDraw and vkCmdBindVertexBuffers, which
+// hold handles and counts and point to their additional buffers.
+struct DrawPacket {
+    void *commandBuffer;
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t firstVertex;
+    uint32_t firstInstance;
+};
+
+struct BindVertexBuffersPacket {
+    void *commandBuffer;
+    uint32_t firstBinding;
+    uint32_t bindingCount;
+    const uint64_t *pBuffers;
+    const uint64_t *pOffsets;
+};
+
+const uint32_t kBindingCount = 2;
+
+// Stands in for the packet index the trace layer hands out.
+std::atomic<uint64_t> s_packetIndex(0);
+
+#if defined(WIN32)
+const char *kNullDevice = "NUL";
+#else
+const char *kNullDevice = "/dev/null";
+#endif
+
+// Builds and writes a packet with malloc and a clear of the whole packet.
+void write_malloc_packet(FileLike *pFile, uint16_t packetId, uint64_t packetSize, uint64_t buffersSize, const void *pBuffers) {
+    uint64_t size = ROUNDUP_TO_8(sizeof(vktrace_trace_packet_header) + ROUNDUP_TO_8(packetSize) + buffersSize);
+    vktrace_trace_packet_header *pHeader = static_cast<vktrace_trace_packet_header *>(malloc((size_t)size));
+    memset(pHeader, 0, (size_t)size);
+    pHeader->size = size;
+    pHeader->global_packet_index = s_packetIndex++;
+    pHeader->tracer_id = VKTRACE_TID_VULKAN;
+    pHeader->packet_id = packetId;
+    pHeader->vktrace_begin_time = vktrace_get_time();
+    pHeader->pBody = (uintptr_t)(pHeader + 1);
+    if (buffersSize != 0) {
+        memcpy(reinterpret_cast<char *>(pHeader + 1) + ROUNDUP_TO_8(packetSize), pBuffers, (size_t)buffersSize);
+    }
+    pHeader->vktrace_end_time = vktrace_get_time();
+    if (pFile != nullptr) {
+        vktrace_write_trace_packet(pHeader, pFile);
+    }
+    free(pHeader);
+}
+
+void run_malloc(uint64_t packetCount, bool bWrite) {
+    FILE *pNull = fopen(kNullDevice, "wb");
+    FileLike *pFile = bWrite ? vktrace_FileLike_create_file(pNull) : nullptr;
+    uint64_t buffers[2 * kBindingCount] = {};
+    for (uint64_t i = 0; i < packetCount; i++) {
+        if (i % 4 == 3) {
+            write_malloc_packet(pFile, VKTRACE_TPI_VK_vkCmdBindVertexBuffers, sizeof(BindVertexBuffersPacket), sizeof(buffers),
+                                buffers);
+        } else {
+            write_malloc_packet(pFile, VKTRACE_TPI_VK_vkCmdDraw, sizeof(DrawPacket), 0, nullptr);
+        }
+    }
+    if (pFile != nullptr) {
+        vktrace_FileLike_destroy(&pFile);
+    }
+    fclose(pNull);
+}
+
+void run_packet_utils(uint64_t packetCount, bool bWrite) {
+    FILE *pNull = fopen(kNullDevice, "wb");
+    FileLike *pFile = bWrite ? vktrace_FileLike_create_file(pNull) : nullptr;
+    uint64_t vertexBuffers[kBindingCount] = {1, 2};
+    uint64_t offsets[kBindingCount] = {};
+    for (uint64_t i = 0; i < packetCount; i++) {
+        vktrace_trace_packet_header *pHeader;
+        if (i % 4 == 3) {
+            pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCmdBindVertexBuffers,
+                                                  sizeof(BindVertexBuffersPacket), sizeof(vertexBuffers) + sizeof(offsets));
+            BindVertexBuffersPacket *pPacket = reinterpret_cast<BindVertexBuffersPacket *>(pHeader->pBody);
+            pPacket->firstBinding = 0;
+            pPacket->bindingCount = kBindingCount;
+            vktrace_add_buffer_to_trace_packet(pHeader, (void **)&pPacket->pBuffers, sizeof(vertexBuffers), vertexBuffers);
+            vktrace_add_buffer_to_trace_packet(pHeader, (void **)&pPacket->pOffsets, sizeof(offsets), offsets);
+            vktrace_finalize_buffer_address(pHeader, (void **)&pPacket->pBuffers);
+            vktrace_finalize_buffer_address(pHeader, (void **)&pPacket->pOffsets);
+        } else {
+            pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCmdDraw, sizeof(DrawPacket), 0);
+            DrawPacket *pPacket = reinterpret_cast<DrawPacket *>(pHeader->pBody);
+            pPacket->vertexCount = 3;
+            pPacket->instanceCount = 1;
+        }
+        vktrace_set_packet_entrypoint_end_time(pHeader);
+        vktrace_finalize_trace_packet(pHeader);
+        if (pFile != nullptr) {
+            vktrace_write_trace_packet(pHeader, pFile);
+        }
+        vktrace_delete_trace_packet(&pHeader);
+    }
+    if (pFile != nullptr) {
+        vktrace_FileLike_destroy(&pFile);
+    }
+    fclose(pNull);
+}
+
+double measure_ms(void (*pRun)(uint64_t, bool), uint64_t packetCount, uint32_t threadCount, bool bWrite) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < threadCount; i++) {
+        threads.push_back(std::thread(pRun, packetCount, bWrite));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns false if a packet that reuses a cached buffer has bytes of the
+// packet before it in its padding or in the space it reserved but didn't
+// use.
+bool check_reused_packet_is_clear() {
+    const uint64_t kReservedSize = 64;
+    const uint32_t kData[3] = {0x11111111, 0x22222222, 0x33333333};
+
+    vktrace_trace_packet_header *pHeader =
+        vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCmdDraw, sizeof(DrawPacket), kReservedSize);
+    memset(pHeader + 1, 0xab, (size_t)(pHeader->size - sizeof(vktrace_trace_packet_header)));
+    vktrace_delete_trace_packet(&pHeader);
+
+    pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCmdDraw, sizeof(DrawPacket), kReservedSize);
+    void *pData = nullptr;
+    vktrace_add_buffer_to_trace_packet(pHeader, &pData, sizeof(kData), kData);
+    vktrace_finalize_trace_packet(pHeader);
+
+    const unsigned char *pBytes = reinterpret_cast<const unsigned char *>(pHeader);
+    const unsigned char *pDataBytes = static_cast<const unsigned char *>(pData);
+    bool bClear = true;
+    for (uint64_t i = sizeof(vktrace_trace_packet_header); i < pHeader->size; i++) {
+        bool bData = pBytes + i >= pDataBytes && pBytes + i < pDataBytes + sizeof(kData);
+        if (!bData && pBytes[i] != 0) {
+            bClear = false;
+        }
+    }
+    bClear = bClear && memcmp(pData, kData, sizeof(kData)) == 0;
+    vktrace_delete_trace_packet(&pHeader);
+    return bClear;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {1000000, 8};
+    if (!vktrace_test::read_counts(argc, argv, "[packets per thread] [threads]", counts)) {
+        return 1;
+    }
+    uint64_t packetCount = counts[0];
+    uint32_t maxThreadCount = (uint32_t)counts[1];
+
+    if (!vktrace_test::report(check_reused_packet_is_clear(), "Packets that reuse a cached buffer are clear")) {
+        return 1;
+    }
+
+    for (uint32_t threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        for (int write = 1; write >= 0; write--) {
+            double mallocMs = measure_ms(run_malloc, packetCount, threadCount, write != 0);
+            double utilsMs = measure_ms(run_packet_utils, packetCount, threadCount, write != 0);
+            double packets = (double)packetCount * threadCount;
+            printf("%2u threads, %-13s: malloc and clear %7.1f ns/packet, packet cache %7.1f ns/packet\n", threadCount,
+                   write ? "with write" : "without write", mallocMs * 1e6 / packets, utilsMs * 1e6 / packets);
+        }
+    }
+    return 0;
+}
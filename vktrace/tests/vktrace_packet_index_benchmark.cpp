@@ -0,0 +1,238 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures what taking packet indices and timestamps costs when many
+// application threads record command buffers at once.
+//
+// kThreadCount threads each do the same thing at the same time:
+//   - take packet indices, with a critical section around a counter, which
+//     is how vktrace_get_unique_packet_index() used to take them, and with
+//     vktrace_get_unique_packet_index(), which is an atomic add,
+//   - read the clock, with CLOCK_MONOTONIC, which vktrace_get_time() used
+//     to read, and with vktrace_get_time(),
+//   - record vkCmdDraw packets with vktrace_create_trace_packet() and
+//     vktrace_finalize_trace_packet(), which take an index, the thread id
+//     and three timestamps per packet.
+// The clock and the packets are measured with the OS clock, then again
+// with the TSC clock that --TscClock turns on, if the CPU has an invariant
+// TSC. It fails if two packets get the same index, if a thread's packet
+// times go backwards, or if the TSC clock ends up kMaxDriftNs away from
+// the OS clock.
+//
+// usage: vktrace_packet_index_benchmark [packets per thread]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#if defined(PLATFORM_LINUX)
+#include <time.h>
+#endif
+
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_platform.h"
+#include "vktrace_trace_packet_utils.h"
+
+// Defined by vktrace_trace_packet_utils.c, which only uses it itself.
+uint64_t vktrace_get_unique_packet_index();
+}
+
+namespace {
+
+const uint32_t kThreadCount = 16;
+const int64_t kMaxDriftNs = 1000000;
+
+// A stand-in for the packet of vkCmdDraw.
+struct DrawPacket {
+    void *commandBuffer;
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t firstVertex;
+    uint32_t firstInstance;
+};
+
+// How vktrace_get_unique_packet_index() took indices before.
+VKTRACE_CRITICAL_SECTION s_packetIndexLock;
+uint64_t s_lockedPacketIndex = 0;
+
+uint64_t get_locked_packet_index() {
+    vktrace_enter_critical_section(&s_packetIndexLock);
+    uint64_t index = s_lockedPacketIndex++;
+    vktrace_leave_critical_section(&s_packetIndexLock);
+    return index;
+}
+
+// How vktrace_get_time() read the clock before.
+uint64_t get_old_time() {
+#if defined(PLATFORM_LINUX)
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+#else
+    return vktrace_get_time();
+#endif
+}
+
+struct ThreadResult {
+    std::vector<uint64_t> indices;
+    bool bTimesInOrder;
+    uint64_t checksum;  // keeps the clock reads from being optimized away
+};
+
+void take_locked_indices(uint64_t count, ThreadResult *pResult) {
+    for (uint64_t i = 0; i < count; i++) {
+        pResult->indices[i] = get_locked_packet_index();
+    }
+}
+
+void take_indices(uint64_t count, ThreadResult *pResult) {
+    for (uint64_t i = 0; i < count; i++) {
+        pResult->indices[i] = vktrace_get_unique_packet_index();
+    }
+}
+
+void read_old_clock(uint64_t count, ThreadResult *pResult) {
+    for (uint64_t i = 0; i < count; i++) {
+        pResult->checksum += get_old_time();
+    }
+}
+
+void read_clock(uint64_t count, ThreadResult *pResult) {
+    uint64_t previous = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t time = vktrace_get_time();
+        pResult->bTimesInOrder = pResult->bTimesInOrder && time >= previous;
+        pResult->checksum += time;
+        previous = time;
+    }
+}
+
+void record_packets(uint64_t count, ThreadResult *pResult) {
+    uint64_t previousEnd = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        vktrace_trace_packet_header *pHeader =
+            vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCmdDraw, sizeof(DrawPacket), 0);
+        DrawPacket *pPacket = reinterpret_cast<DrawPacket *>(pHeader->pBody);
+        pPacket->vertexCount = 3;
+        pPacket->instanceCount = 1;
+        vktrace_set_packet_entrypoint_end_time(pHeader);
+        vktrace_finalize_trace_packet(pHeader);
+        pResult->indices[i] = pHeader->global_packet_index;
+        pResult->bTimesInOrder = pResult->bTimesInOrder && previousEnd <= pHeader->vktrace_begin_time &&
+                                 pHeader->vktrace_begin_time <= pHeader->entrypoint_end_time &&
+                                 pHeader->entrypoint_end_time <= pHeader->vktrace_end_time;
+        previousEnd = pHeader->vktrace_end_time;
+        vktrace_delete_trace_packet(&pHeader);
+    }
+}
+
+// Runs pRun on kThreadCount threads at once. Returns false if two threads
+// got the same index or one's times went backwards.
+bool run_threads(void (*pRun)(uint64_t, ThreadResult *), uint64_t count, bool bIndices, const char *pName) {
+    std::vector<ThreadResult> results(kThreadCount);
+    for (uint32_t i = 0; i < kThreadCount; i++) {
+        results[i].indices.resize(bIndices ? (size_t)count : 0);
+        results[i].bTimesInOrder = true;
+        results[i].checksum = 0;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < kThreadCount; i++) {
+        threads.push_back(std::thread(pRun, count, &results[i]));
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    bool bPassed = true;
+    std::vector<uint64_t> indices;
+    for (uint32_t i = 0; i < kThreadCount; i++) {
+        indices.insert(indices.end(), results[i].indices.begin(), results[i].indices.end());
+        if (!results[i].bTimesInOrder) {
+            printf("%s: the times of thread %u went backwards.\n", pName, i);
+            bPassed = false;
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    if (std::adjacent_find(indices.begin(), indices.end()) != indices.end()) {
+        printf("%s: two packets got the same index.\n", pName);
+        bPassed = false;
+    }
+
+    printf("%-36s %7.1f ns/call\n", pName, ms * 1e6 / ((double)count * kThreadCount));
+    fflush(stdout);
+    return bPassed;
+}
+
+#if defined(PLATFORM_LINUX) && defined(CLOCK_MONOTONIC_RAW)
+// The OS clock vktrace_get_time() calibrates the TSC against.
+uint64_t get_raw_time() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+    return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
+}
+#endif
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {200000};
+    if (!vktrace_test::read_counts(argc, argv, "[packets per thread]", counts)) {
+        return 1;
+    }
+    uint64_t count = counts[0];
+
+    printf("%u threads, %llu calls each\n", kThreadCount, (unsigned long long)count);
+    vktrace_create_critical_section(&s_packetIndexLock);
+    bool bPassed = run_threads(take_locked_indices, count, true, "index, critical section");
+    bPassed = run_threads(take_indices, count, true, "index, atomic add") && bPassed;
+    bPassed = run_threads(read_old_clock, count, false, "clock, CLOCK_MONOTONIC") && bPassed;
+    bPassed = run_threads(read_clock, count, false, "clock, vktrace_get_time, OS clock") && bPassed;
+    bPassed = run_threads(record_packets, count, true, "vkCmdDraw packets, OS clock") && bPassed;
+    vktrace_delete_critical_section(&s_packetIndexLock);
+
+    // What the trace layer does when vktrace is run with --TscClock.
+    vktrace_set_global_var(_VKTRACE_TSC_CLOCK_ENV, "1");
+    vktrace_initialize_trace_packet_utils();
+    uint64_t timeSource = VKTRACE_TIME_SOURCE_CLOCK, tscFrequency = 0;
+    vktrace_get_time_source(&timeSource, &tscFrequency);
+    if (timeSource != VKTRACE_TIME_SOURCE_TSC) {
+        printf("TSC clock skipped, the CPU doesn't have an invariant TSC\n");
+    } else {
+        uint64_t calibratedTime = vktrace_get_time();
+        bPassed = run_threads(read_clock, count, false, "clock, vktrace_get_time, TSC") && bPassed;
+        bPassed = run_threads(record_packets, count, true, "vkCmdDraw packets, TSC") && bPassed;
+#if defined(PLATFORM_LINUX) && defined(CLOCK_MONOTONIC_RAW)
+        int64_t driftNs = (int64_t)(vktrace_get_time() - get_raw_time());
+        printf("TSC at %.3f GHz, %lld ns from CLOCK_MONOTONIC_RAW after %.0f ms\n", tscFrequency / 1e9, (long long)driftNs,
+               (vktrace_get_time() - calibratedTime) / 1e6);
+        if (driftNs > kMaxDriftNs || driftNs < -kMaxDriftNs) {
+            printf("The TSC clock drifted too far from the OS clock.\n");
+            bPassed = false;
+        }
+#endif
+    }
+    vktrace_deinitialize_trace_packet_utils();
+    return vktrace_test::exit_code(bPassed);
+}
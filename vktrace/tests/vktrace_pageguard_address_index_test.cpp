@@ -0,0 +1,267 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Checks PageGuardAddressIndex, which the page guard handler uses to find
+// the mapped memory a fault address belongs to:
+//   - random inserts, re-inserts, removes and finds, including addresses
+//     at and next to the ends of the ranges, are checked against a
+//     std::map,
+//   - with kMappingCount live mappings that are write protected, a signal
+//     handler looks up every fault with the index and unprotects the
+//     page, the way the page guard handler does. Each fault must land in
+//     the mapping that was written. This reports how long the faults take
+//     and how long lookups take with the index and with a scan of all the
+//     mappings, which is how the handler found them before.
+//
+// usage: vktrace_pageguard_address_index_test [random operations]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#if defined(PLATFORM_LINUX)
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "vktrace_lib_pageguardaddressindex.h"
+#include "vktrace_test_harness.h"
+
+namespace {
+
+const size_t kMappingCount = 10000;
+const size_t kSlotSize = 1024 * 1024;
+
+// The index never looks at the mapped memory, so the tests use numbered stand-ins.
+PageGuardMappedMemory *mapped_memory(size_t id) { return reinterpret_cast<PageGuardMappedMemory *>(id + 1); }
+
+size_t mapped_memory_id(PageGuardMappedMemory *pMappedMemory) { return reinterpret_cast<size_t>(pMappedMemory) - 1; }
+
+struct Range {
+    PBYTE pStart;
+    PBYTE pEnd;
+};
+
+PageGuardMappedMemory *find_in_map(const std::map<PBYTE, std::pair<PBYTE, PageGuardMappedMemory *>> &ranges, PBYTE addr) {
+    auto next = ranges.upper_bound(addr);
+    if (next == ranges.begin()) {
+        return nullptr;
+    }
+    --next;
+    return (addr < next->second.first) ? next->second.second : nullptr;
+}
+
+// Every mapped memory gets its own slot of the address space, so ranges never overlap, as with real mappings.
+bool check_against_map(uint64_t operationCount) {
+    std::mt19937_64 random(1);
+    PBYTE pBase = reinterpret_cast<PBYTE>(static_cast<uintptr_t>(0x100000000ULL));
+    const size_t kIdCount = 2000;
+
+    PageGuardAddressIndex index;
+    std::map<PBYTE, std::pair<PBYTE, PageGuardMappedMemory *>> reference;
+    std::vector<Range> ranges(kIdCount, Range{nullptr, nullptr});
+
+    for (uint64_t operation = 0; operation < operationCount; operation++) {
+        size_t id = random() % kIdCount;
+        switch (random() % 4) {
+            case 0: {
+                // Maps id, or maps it again somewhere else in its slot.
+                if (ranges[id].pStart != nullptr) {
+                    reference.erase(ranges[id].pStart);
+                }
+                uint64_t offset = random() % (kSlotSize / 2);
+                uint64_t size = 1 + random() % (kSlotSize / 2);
+                ranges[id].pStart = pBase + id * kSlotSize + offset;
+                ranges[id].pEnd = ranges[id].pStart + size;
+                reference[ranges[id].pStart] = std::make_pair(ranges[id].pEnd, mapped_memory(id));
+                index.insert(ranges[id].pStart, size, mapped_memory(id));
+                break;
+            }
+            case 1:
+                if (ranges[id].pStart != nullptr) {
+                    reference.erase(ranges[id].pStart);
+                    ranges[id].pStart = ranges[id].pEnd = nullptr;
+                }
+                index.remove(mapped_memory(id));
+                break;
+            default: {
+                // A random address, and the addresses at and next to both ends of a range if id is mapped.
+                PBYTE addresses[5] = {pBase + random() % (kIdCount * kSlotSize)};
+                size_t addressCount = 1;
+                if (ranges[id].pStart != nullptr) {
+                    addresses[addressCount++] = ranges[id].pStart - 1;
+                    addresses[addressCount++] = ranges[id].pStart;
+                    addresses[addressCount++] = ranges[id].pEnd - 1;
+                    addresses[addressCount++] = ranges[id].pEnd;
+                }
+                for (size_t i = 0; i < addressCount; i++) {
+                    if (index.find(addresses[i]) != find_in_map(reference, addresses[i])) {
+                        printf("Operation %llu: the index and the map disagree about address %p.\n",
+                               (unsigned long long)operation, addresses[i]);
+                        return false;
+                    }
+                }
+                break;
+            }
+        }
+        if (index.size() != reference.size()) {
+            printf("Operation %llu: the index has %zu ranges, the map %zu.\n", (unsigned long long)operation, index.size(),
+                   reference.size());
+            return false;
+        }
+    }
+    return true;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#if defined(PLATFORM_LINUX)
+
+const size_t kPagesPerMapping = 4;
+
+size_t s_pageSize;
+PageGuardAddressIndex *s_pIndex;
+std::vector<uint32_t> *s_pFaultCounts;
+struct sigaction s_previousHandler;
+
+// Like the page guard handler: find the mapped memory with the index and let the write through.
+void fault_handler(int, siginfo_t *pInfo, void *) {
+    PBYTE addr = static_cast<PBYTE>(pInfo->si_addr);
+    PageGuardMappedMemory *pMappedMemory = s_pIndex->find(addr);
+    if (pMappedMemory == nullptr) {
+        sigaction(SIGSEGV, &s_previousHandler, nullptr);
+        return;
+    }
+    (*s_pFaultCounts)[mapped_memory_id(pMappedMemory)]++;
+    PBYTE pPage = reinterpret_cast<PBYTE>(reinterpret_cast<uintptr_t>(addr) & ~(uintptr_t)(s_pageSize - 1));
+    mprotect(pPage, s_pageSize, PROT_READ | PROT_WRITE);
+}
+
+bool stress_faults() {
+    s_pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t mappingSize = kPagesPerMapping * s_pageSize;
+
+    PageGuardAddressIndex index;
+    std::vector<Range> ranges(kMappingCount);
+    std::vector<uint32_t> faultCounts(kMappingCount, 0);
+    for (size_t id = 0; id < kMappingCount; id++) {
+        void *pMapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMapping == MAP_FAILED) {
+            printf("Failed to map mapping %zu.\n", id);
+            return false;
+        }
+        ranges[id].pStart = static_cast<PBYTE>(pMapping);
+        ranges[id].pEnd = ranges[id].pStart + mappingSize;
+        index.insert(ranges[id].pStart, mappingSize, mapped_memory(id));
+    }
+
+    s_pIndex = &index;
+    s_pFaultCounts = &faultCounts;
+    struct sigaction handler;
+    memset(&handler, 0, sizeof(handler));
+    handler.sa_sigaction = fault_handler;
+    handler.sa_flags = SA_SIGINFO;
+    sigemptyset(&handler.sa_mask);
+    sigaction(SIGSEGV, &handler, &s_previousHandler);
+
+    // Write every page of every mapping once, in random order, so each write faults.
+    std::vector<std::pair<size_t, size_t>> pages;
+    for (size_t id = 0; id < kMappingCount; id++) {
+        for (size_t page = 0; page < kPagesPerMapping; page++) {
+            pages.push_back(std::make_pair(id, page));
+        }
+    }
+    std::shuffle(pages.begin(), pages.end(), std::mt19937(2));
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < pages.size(); i++) {
+        ranges[pages[i].first].pStart[pages[i].second * s_pageSize + i % s_pageSize] = 1;
+    }
+    double faultMs = elapsed_ms(start);
+    sigaction(SIGSEGV, &s_previousHandler, nullptr);
+
+    bool bCorrect = true;
+    for (size_t id = 0; id < kMappingCount; id++) {
+        if (faultCounts[id] != kPagesPerMapping) {
+            printf("Mapping %zu had %u faults, expected %zu.\n", id, faultCounts[id], kPagesPerMapping);
+            bCorrect = false;
+        }
+    }
+
+    // Lookups alone, with the index and with a scan of every mapping.
+    std::mt19937_64 random(3);
+    std::vector<PBYTE> addresses(pages.size());
+    for (size_t i = 0; i < addresses.size(); i++) {
+        addresses[i] = ranges[random() % kMappingCount].pStart + random() % mappingSize;
+    }
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < addresses.size(); i++) {
+        found += (index.find(addresses[i]) != nullptr);
+    }
+    double indexMs = elapsed_ms(start);
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < addresses.size(); i++) {
+        for (size_t id = 0; id < kMappingCount; id++) {
+            if (addresses[i] >= ranges[id].pStart && addresses[i] < ranges[id].pEnd) {
+                found++;
+                break;
+            }
+        }
+    }
+    double scanMs = elapsed_ms(start);
+    if (found != 2 * addresses.size()) {
+        printf("Only %zu of %zu lookups found their mapping.\n", found, 2 * addresses.size());
+        bCorrect = false;
+    }
+
+    printf("%zu mappings: %zu faults %.1f ms, %zu lookups with the index %.3f ms, with a scan %.1f ms\n", kMappingCount,
+           pages.size(), faultMs, addresses.size(), indexMs, scanMs);
+
+    for (size_t id = 0; id < kMappingCount; id++) {
+        munmap(ranges[id].pStart, mappingSize);
+        index.remove(mapped_memory(id));
+    }
+    return bCorrect && index.size() == 0;
+}
+
+#endif  // PLATFORM_LINUX
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {1000000};
+    if (!vktrace_test::read_counts(argc, argv, "[random operations]", counts)) {
+        return 1;
+    }
+    uint64_t operationCount = counts[0];
+
+    bool bPassed = vktrace_test::report(check_against_map(operationCount), "%llu random operations against std::map",
+                                        (unsigned long long)operationCount);
+#if defined(PLATFORM_LINUX)
+    bPassed = vktrace_test::report(stress_faults(), "Faults in %zu write protected mappings", kMappingCount) && bPassed;
+#endif
+    return vktrace_test::exit_code(bPassed);
+}
@@ -0,0 +1,237 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures how long finding the pages an app writes to persistently mapped
+// memory takes with each way the trace layer has of finding them, see
+// getPageGuardTrackingMode().
+//
+// A mapping of kMappingSize bytes goes through vkMapMemoryPageGuardHandle()
+// the way __HOOKED_vkMapMemory hands it over, then every frame the app
+// scribbles on all of its pages, or on 1 in kSparseStride of them, and
+// flushAllChangedMappedMemory() flushes it the way __HOOKED_vkQueueSubmit
+// does. This reports how long the scribble and the flush take per frame.
+// The tracking mode is chosen once per process, so on Linux each mode runs
+// in a child process of its own. The uffd and softdirty modes are skipped
+// when the kernel doesn't support them, or can't track the mapping with
+// them. It fails if the flushed package of a frame doesn't hold exactly the
+// pages written in it, or if the real memory doesn't match the memory the
+// app wrote after the flush.
+//
+// usage: vktrace_pageguard_benchmark [frames]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#if defined(PLATFORM_LINUX)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "vktrace_lib_helpers.h"
+#include "vktrace_lib_pageguardmappedmemory.h"
+#include "vktrace_lib_pageguardcapture.h"
+#include "vktrace_lib_pageguard.h"
+#include "vktrace_lib_trim.h"
+#include "vktrace_test_harness.h"
+
+// Defined by vktrace_lib_trace.cpp and vktrace_lib_trim.cpp in the layer.
+VKMemInfo g_memInfo;
+VKTRACE_CRITICAL_SECTION g_memInfoLock;
+bool g_trimEnabled = false;
+bool g_trimIsPreTrim = false;
+bool g_trimIsInTrim = false;
+bool g_trimIsPostTrim = false;
+namespace trim {
+void write_packet(vktrace_trace_packet_header *pHeader) { vktrace_delete_trace_packet(&pHeader); }
+}  // namespace trim
+
+namespace {
+
+const uint64_t kMappingSize = 256 * 1024 * 1024;
+const uint64_t kSparseStride = 16;
+
+struct TrackingMode {
+    const char *pName;  // value of VKTRACE_PAGEGUARD_TRACKING_ENV
+    int mode;           // PAGEGUARD_TRACKING_*
+};
+
+const TrackingMode kTrackingModes[] = {
+    {"pageguard", PAGEGUARD_TRACKING_PAGE_GUARD},
+    {"softdirty", PAGEGUARD_TRACKING_SOFT_DIRTY},
+    {"uffd", PAGEGUARD_TRACKING_UFFD_WP},
+};
+
+// What the flushes of the current frame saved.
+uint64_t s_flushedBytes;
+bool s_bFlushedUnknownMemory;
+
+// Stands in for vkFlushMappedMemoryRangesWithoutAPICall, it does the page
+// guard half of it and checks the packages instead of writing a packet.
+VkResult VKAPI_CALL flush_without_packet(VkDevice device, uint32_t memoryRangeCount, const VkMappedMemoryRange *pMemoryRanges) {
+    PageGuardCapture &capture = getPageGuardControlInstance();
+    std::vector<PBYTE> packagesOutOfMap(memoryRangeCount);
+    capture.vkFlushMappedMemoryRangesPageGuardHandle(device, memoryRangeCount, pMemoryRanges, packagesOutOfMap.data());
+    for (uint32_t i = 0; i < memoryRangeCount; i++) {
+        LPPageGuardMappedMemory pMappedMemory = capture.findMappedMemoryObject(device, &pMemoryRanges[i]);
+        if (pMappedMemory == nullptr) {
+            s_bFlushedUnknownMemory = true;
+            capture.clearChangedDataPackageOutOfMap(packagesOutOfMap.data(), i);
+            continue;
+        }
+        PBYTE pPackage = pMappedMemory->getChangedDataPackage(nullptr);
+        if (pPackage != nullptr) {
+            s_flushedBytes += reinterpret_cast<PageGuardChangedBlockInfo *>(pPackage)[0].length;
+        }
+        pMappedMemory->clearChangedDataPackage();
+        pMappedMemory->resetMemoryObjectAllChangedFlagAndPageGuard();
+    }
+    return VK_SUCCESS;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns false if a frame's flush didn't match what was written in it.
+bool run_frames(PBYTE pMappedData, PBYTE pRealData, uint64_t frameCount, uint64_t stride, const char *pModeName) {
+    uint64_t pageSize = pageguardGetSystemPageSize();
+    uint64_t pageCount = kMappingSize / pageSize;
+    uint64_t writtenPageCount = (pageCount + stride - 1) / stride;
+    double writeMs = 0, flushMs = 0, maxWriteMs = 0, maxFlushMs = 0;
+    bool bMatched = true;
+
+    for (uint64_t frame = 0; frame < frameCount; frame++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t page = frame % stride; page < pageCount; page += stride) {
+            uint64_t *pWord = reinterpret_cast<uint64_t *>(pMappedData + page * pageSize + (frame * 64) % pageSize);
+            *pWord = (frame << 32) | page;
+        }
+        double frameWriteMs = elapsed_ms(start);
+
+        s_flushedBytes = 0;
+        s_bFlushedUnknownMemory = false;
+        start = std::chrono::steady_clock::now();
+        pageguardEnter();
+        flushAllChangedMappedMemory(flush_without_packet);
+        resetAllReadFlagAndPageGuard();
+        pageguardExit();
+        double frameFlushMs = elapsed_ms(start);
+
+        uint64_t frameWrittenPageCount = (pageCount - frame % stride + stride - 1) / stride;
+        bool bCopiedBack = memcmp(pMappedData, pRealData, (size_t)kMappingSize) == 0;
+        if (s_bFlushedUnknownMemory || !bCopiedBack || s_flushedBytes != frameWrittenPageCount * pageSize) {
+            printf("%s, frame %llu: flushed %llu bytes for %llu written pages%s.\n", pModeName, (unsigned long long)frame,
+                   (unsigned long long)s_flushedBytes, (unsigned long long)frameWrittenPageCount,
+                   bCopiedBack ? "" : ", the real memory doesn't match");
+            bMatched = false;
+        }
+        writeMs += frameWriteMs;
+        flushMs += frameFlushMs;
+        maxWriteMs = (frameWriteMs > maxWriteMs) ? frameWriteMs : maxWriteMs;
+        maxFlushMs = (frameFlushMs > maxFlushMs) ? frameFlushMs : maxFlushMs;
+    }
+
+    printf("%-9s  %6llu pages/frame  write %8.2f ms/frame (max %8.2f)  flush %8.2f ms/frame (max %8.2f)\n", pModeName,
+           (unsigned long long)writtenPageCount, writeMs / frameCount, maxWriteMs, flushMs / frameCount, maxFlushMs);
+    return bMatched;
+}
+
+// Runs the frames with the tracking mode, which must be the first one the
+// process asks for. Returns false if they failed.
+bool run_tracking_mode(const TrackingMode &trackingMode, uint64_t frameCount) {
+    vktrace_set_global_var(VKTRACE_PAGEGUARD_TRACKING_ENV, trackingMode.pName);
+    if (getPageGuardTrackingMode() != trackingMode.mode) {
+        printf("%-9s  skipped, the kernel doesn't support it\n", trackingMode.pName);
+        return true;
+    }
+
+    // The memory the driver maps.
+    PBYTE pRealData = static_cast<PBYTE>(pageguardAllocateMemory(kMappingSize));
+    if (pRealData == nullptr) {
+        printf("%-9s  failed to allocate %llu bytes\n", trackingMode.pName, (unsigned long long)kMappingSize);
+        return false;
+    }
+    memset(pRealData, 0, (size_t)kMappingSize);
+
+#if defined(USE_PAGEGUARD_SPEEDUP) && !defined(PAGEGUARD_MEMCPY_USE_PPL_LIB)
+    // Started by vkCreateInstance in the trace layer.
+    vktrace_pageguard_init_multi_threads_memcpy();
+#endif
+
+    VkDevice device = (VkDevice)(uintptr_t)0x1000;
+    VkDeviceMemory memory = (VkDeviceMemory)(uintptr_t)0x2000;
+    void *pMappedData = pRealData;
+    pageguardEnter();
+    getPageGuardControlInstance().vkMapMemoryPageGuardHandle(device, memory, 0, kMappingSize, 0, &pMappedData);
+    pageguardExit();
+
+    bool bPassed = true;
+    LPPageGuardMappedMemory pMappedMemory = getPageGuardControlInstance().findMappedMemoryObject(device, memory);
+    if (pMappedMemory == nullptr) {
+        printf("%-9s  the mapping isn't tracked\n", trackingMode.pName);
+        bPassed = false;
+    } else if (pMappedMemory->getTrackingMode() != trackingMode.mode) {
+        printf("%-9s  skipped, the mapping can't be tracked this way\n", trackingMode.pName);
+    } else {
+        bPassed = run_frames(static_cast<PBYTE>(pMappedData), pRealData, frameCount, 1, trackingMode.pName) &&
+                  run_frames(static_cast<PBYTE>(pMappedData), pRealData, frameCount, kSparseStride, trackingMode.pName);
+    }
+
+    pageguardEnter();
+    getPageGuardControlInstance().vkUnmapMemoryPageGuardHandle(device, memory, &pMappedData, flush_without_packet);
+    pageguardExit();
+    pageguardFreeMemory(pRealData);
+#if defined(USE_PAGEGUARD_SPEEDUP) && !defined(PAGEGUARD_MEMCPY_USE_PPL_LIB)
+    vktrace_pageguard_done_multi_threads_memcpy();
+#endif
+    return bPassed;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {10};
+    if (!vktrace_test::read_counts(argc, argv, "[frames]", counts)) {
+        return 1;
+    }
+    uint64_t frameCount = counts[0];
+
+    printf("%llu MB mapping, %llu frames\n", (unsigned long long)(kMappingSize / (1024 * 1024)), (unsigned long long)frameCount);
+    fflush(stdout);
+
+    bool bPassed = true;
+#if defined(PLATFORM_LINUX)
+    for (size_t i = 0; i < sizeof(kTrackingModes) / sizeof(kTrackingModes[0]); i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            bool bPassed = run_tracking_mode(kTrackingModes[i], frameCount);
+            fflush(stdout);
+            _exit(bPassed ? 0 : 1);
+        }
+        int status = 0;
+        bool bExited = pid != -1 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        bPassed = vktrace_test::report(bExited, "%s", kTrackingModes[i].pName) && bPassed;
+    }
+#else
+    // Windows only has page guard.
+    bPassed = vktrace_test::report(run_tracking_mode(kTrackingModes[0], frameCount), "%s", kTrackingModes[0].pName);
+#endif
+    return vktrace_test::exit_code(bPassed);
+}
@@ -0,0 +1,281 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Checks the memcpy threads that vktrace_pageguard_memcpy(),
+// vktrace_pageguard_memcpy_blocks() and vktrace_pageguard_run_tasks() hand
+// their work to, which deal it out in ranges the threads steal from each
+// other:
+//   - copies of random sizes between random alignments, and changed blocks
+//     with random gaps between them, must copy every byte and leave the
+//     guard bytes around the destination, and the gaps, alone,
+//   - tasks that copy, and that run tasks of their own, while the threads
+//     run them must not wait for the threads they are running on,
+//   - kCallerCount threads copying at once, only one of which gets the
+//     threads, must all get their copies right,
+//   - init and done calls can be nested, the threads stop at the last done
+//     and copies are done by the caller after that.
+// The threads are started with kThreadCount threads whatever the machine
+// has, and the first time with the size from which they are used measured
+// by vktrace_pageguard_calibrate(). After that they are used for every
+// copy, so small copies go through the work stealing too.
+//
+// usage: vktrace_pageguard_memcpy_test [random copies]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "vktrace_pageguard_memorycopy.h"
+#include "vktrace_test_harness.h"
+
+namespace {
+
+const char *kThreadsEnv = "VKTRACE_PAGEGUARD_MEMCPY_THREADS";
+const char *kMinSizeEnv = "VKTRACE_PAGEGUARD_MEMCPY_MIN_SIZE";
+const char *kThreadCount = "4";
+const size_t kCallerCount = 8;
+const size_t kMaxCopySize = 8 * 1024 * 1024;
+const size_t kMaxAlignment = 4096;
+const size_t kGuardSize = 64;
+const uint8_t kGuardByte = 0xcd;
+
+void fill_random(std::vector<uint8_t> &bytes, std::mt19937_64 &random) {
+    for (size_t i = 0; i < bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t value = random();
+        memcpy(&bytes[i], &value, std::min(sizeof(value), bytes.size() - i));
+    }
+}
+
+// Most copies are a few pages, like the changed blocks of a frame, some are big.
+size_t random_size(std::mt19937_64 &random) {
+    switch (random() % 4) {
+        case 0:
+            return random() % 4096;
+        case 1:
+            return random() % (256 * 1024);
+        default:
+            return random() % kMaxCopySize;
+    }
+}
+
+// A destination with kGuardSize guard bytes on both sides, and a source
+// with kMaxAlignment bytes of room to be placed at any alignment.
+struct CopyBuffers {
+    std::vector<uint8_t> source;
+    std::vector<uint8_t> destination;
+
+    CopyBuffers() : source(kMaxCopySize + kMaxAlignment), destination(kMaxCopySize + kMaxAlignment + 2 * kGuardSize) {}
+};
+
+// Returns false if the copy of size bytes from source to dest, which
+// starts kGuardSize bytes into the destination buffer, is wrong or wrote
+// outside of it. Clears the destination for the next copy.
+bool check_copy(std::vector<uint8_t> &destination, uint8_t *dest, const uint8_t *source, size_t size) {
+    size_t begin = (size_t)(dest - destination.data());
+    bool bCorrect = memcmp(dest, source, size) == 0;
+    for (size_t i = begin - kGuardSize; i < begin; i++) {
+        bCorrect = bCorrect && destination[i] == kGuardByte;
+    }
+    for (size_t i = begin + size; i < begin + size + kGuardSize; i++) {
+        bCorrect = bCorrect && destination[i] == kGuardByte;
+    }
+    memset(dest - kGuardSize, kGuardByte, size + 2 * kGuardSize);
+    return bCorrect;
+}
+
+// Returns false if a random copy went wrong.
+bool copy_random(CopyBuffers &buffers, std::mt19937_64 &random, uint64_t copyCount, const char *pName) {
+    fill_random(buffers.source, random);
+    memset(buffers.destination.data(), kGuardByte, buffers.destination.size());
+    for (uint64_t copy = 0; copy < copyCount; copy++) {
+        size_t size = random_size(random);
+        const uint8_t *source = buffers.source.data() + random() % kMaxAlignment;
+        uint8_t *dest = buffers.destination.data() + kGuardSize + random() % kMaxAlignment;
+        vktrace_pageguard_memcpy(dest, source, size);
+        if (!check_copy(buffers.destination, dest, source, size)) {
+            printf("%s, copy %llu: copying %zu bytes from alignment %zu to alignment %zu went wrong.\n", pName,
+                   (unsigned long long)copy, size, (size_t)((uintptr_t)source % kMaxAlignment),
+                   (size_t)((uintptr_t)dest % kMaxAlignment));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns false if a random set of changed blocks was copied wrong.
+bool copy_random_blocks(CopyBuffers &buffers, std::mt19937_64 &random, uint64_t copyCount, const char *pName) {
+    fill_random(buffers.source, random);
+    std::vector<uint8_t> expected(buffers.destination.size());
+    std::vector<PageGuardChangedBlockInfo> blocks;
+    for (uint64_t copy = 0; copy < copyCount; copy++) {
+        memset(buffers.destination.data(), (int)copy, buffers.destination.size());
+        memcpy(expected.data(), buffers.destination.data(), expected.size());
+
+        // The blocks are packed at the source and go to increasing offsets with gaps between them.
+        uint8_t *dest = buffers.destination.data() + kGuardSize;
+        size_t destSize = buffers.destination.size() - 2 * kGuardSize;
+        size_t maxBlockSize = (random() % 2) ? 4096 * 4 : 1024 * 1024;
+        blocks.clear();
+        size_t offset = random() % kMaxAlignment, sourceSize = 0;
+        while (true) {
+            PageGuardChangedBlockInfo block = {};
+            block.offset = (uint32_t)offset;
+            block.length = (uint32_t)(1 + random() % maxBlockSize);
+            if (offset + block.length > destSize || sourceSize + block.length > kMaxCopySize) {
+                break;
+            }
+            memcpy(expected.data() + kGuardSize + offset, buffers.source.data() + sourceSize, block.length);
+            blocks.push_back(block);
+            sourceSize += block.length;
+            offset += block.length + random() % maxBlockSize;
+        }
+
+        vktrace_pageguard_memcpy_blocks(dest, buffers.source.data(), blocks.data(), blocks.size());
+        if (memcmp(buffers.destination.data(), expected.data(), expected.size()) != 0) {
+            printf("%s, copy %llu: copying %zu blocks of %zu bytes went wrong.\n", pName, (unsigned long long)copy, blocks.size(),
+                   sourceSize);
+            return false;
+        }
+    }
+    return true;
+}
+
+struct CopyTask {
+    const uint8_t *source;
+    uint8_t *dest;
+    size_t size;
+    std::vector<CopyTask> subtasks;  // copies of its own it runs as tasks
+    std::vector<void *> subtaskParameters;
+};
+
+void run_copy_task(void *pParameter) {
+    CopyTask *pTask = static_cast<CopyTask *>(pParameter);
+    vktrace_pageguard_memcpy(pTask->dest, pTask->source, pTask->size);
+    if (!pTask->subtasks.empty()) {
+        vktrace_pageguard_run_tasks(run_copy_task, pTask->subtaskParameters.data(), pTask->subtaskParameters.size());
+    }
+}
+
+// Returns false if tasks that copy, and run copying tasks of their own, went wrong.
+bool copy_in_tasks(CopyBuffers &buffers, std::mt19937_64 &random, uint64_t jobCount) {
+    const size_t kTaskCount = 16;
+    const size_t kSubtaskCount = 4;
+    size_t taskSize = kMaxCopySize / (kTaskCount * (kSubtaskCount + 1));
+    fill_random(buffers.source, random);
+
+    for (uint64_t job = 0; job < jobCount; job++) {
+        memset(buffers.destination.data(), kGuardByte, buffers.destination.size());
+        uint8_t *dest = buffers.destination.data() + kGuardSize;
+        std::vector<CopyTask> tasks(kTaskCount);
+        std::vector<void *> parameters(kTaskCount);
+        size_t offset = 0;
+        for (size_t i = 0; i < kTaskCount; i++) {
+            size_t size = random() % taskSize;
+            tasks[i].source = buffers.source.data() + offset;
+            tasks[i].dest = dest + offset;
+            tasks[i].size = size;
+            offset += size;
+            tasks[i].subtasks.resize((i % 2) ? kSubtaskCount : 0);
+            for (size_t j = 0; j < tasks[i].subtasks.size(); j++) {
+                size = random() % taskSize;
+                tasks[i].subtasks[j].source = buffers.source.data() + offset;
+                tasks[i].subtasks[j].dest = dest + offset;
+                tasks[i].subtasks[j].size = size;
+                tasks[i].subtaskParameters.push_back(&tasks[i].subtasks[j]);
+                offset += size;
+            }
+            parameters[i] = &tasks[i];
+        }
+
+        vktrace_pageguard_run_tasks(run_copy_task, parameters.data(), parameters.size());
+        if (!check_copy(buffers.destination, dest, buffers.source.data(), offset)) {
+            printf("Tasks, job %llu: copying %zu bytes in tasks went wrong.\n", (unsigned long long)job, offset);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns false if a copy of one of kCallerCount threads copying at once went wrong.
+bool copy_concurrently(uint64_t copyCount) {
+    std::vector<CopyBuffers> buffers(kCallerCount);
+    std::atomic<uint32_t> failedCount(0);
+    std::vector<std::thread> callers;
+    for (size_t i = 0; i < kCallerCount; i++) {
+        callers.push_back(std::thread([&buffers, &failedCount, i, copyCount]() {
+            std::mt19937_64 random(100 + i);
+            bool bCorrect = (i % 2) ? copy_random_blocks(buffers[i], random, copyCount, "Concurrent blocks")
+                                    : copy_random(buffers[i], random, copyCount, "Concurrent copies");
+            failedCount += bCorrect ? 0 : 1;
+        }));
+    }
+    for (size_t i = 0; i < callers.size(); i++) {
+        callers[i].join();
+    }
+    return failedCount == 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {1000};
+    if (!vktrace_test::read_counts(argc, argv, "[random copies]", counts)) {
+        return 1;
+    }
+    uint64_t copyCount = counts[0];
+
+    std::mt19937_64 random(1);
+    CopyBuffers buffers;
+    vktrace_set_global_var(kThreadsEnv, kThreadCount);
+
+    // The threads as the trace layer starts them, with the size they are used from measured as on the first flush.
+    bool bPassed = vktrace_pageguard_init_multi_threads_memcpy() == TRUE;
+    vktrace_pageguard_calibrate_multi_threads_memcpy();
+    bPassed = copy_random(buffers, random, copyCount / 10, "Calibrated") && bPassed;
+    vktrace_pageguard_done_multi_threads_memcpy();
+
+    // From here on the threads take every copy.
+    vktrace_set_global_var(kMinSizeEnv, "0");
+    bPassed = vktrace_pageguard_init_multi_threads_memcpy() == TRUE && bPassed;
+    bPassed = copy_random(buffers, random, copyCount, "Copies") && bPassed;
+    bPassed = copy_random_blocks(buffers, random, copyCount / 10, "Blocks") && bPassed;
+    bPassed = copy_in_tasks(buffers, random, copyCount / 10) && bPassed;
+    bPassed = copy_concurrently(copyCount / 10) && bPassed;
+    vktrace_test::report(bPassed, "%s threads: copies, blocks, tasks and %zu concurrent callers", kThreadCount, kCallerCount);
+
+    // Nested init and done, the threads stay until the last done.
+    bool bNested = vktrace_pageguard_init_multi_threads_memcpy() == TRUE;
+    vktrace_pageguard_done_multi_threads_memcpy();
+    bNested = copy_random(buffers, random, copyCount / 10, "Nested, still started") && bNested;
+    bNested = copy_in_tasks(buffers, random, copyCount / 100 + 1) && bNested;
+    vktrace_pageguard_done_multi_threads_memcpy();
+    bNested = copy_random(buffers, random, copyCount / 10, "Nested, stopped") && bNested;
+    bNested = copy_in_tasks(buffers, random, copyCount / 100 + 1) && bNested;
+    // A done too many must not stop threads started after it.
+    vktrace_pageguard_done_multi_threads_memcpy();
+    bNested = vktrace_pageguard_init_multi_threads_memcpy() == TRUE && bNested;
+    bNested = copy_random(buffers, random, copyCount / 10, "Restarted") && bNested;
+    vktrace_pageguard_done_multi_threads_memcpy();
+    vktrace_test::report(bNested, "Nested init and done");
+
+    return vktrace_test::exit_code(bPassed && bNested);
+}
@@ -0,0 +1,165 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures how long vkreplay takes to remap descriptor sets with the maps
+// of vkReplayObjMapper, on a replay with a million descriptor sets.
+//
+// The object mapper keeps a vkReplayHandleMap per object type, it used to
+// keep a std::map. Both are run through the same replay:
+//   - vkAllocateDescriptorSets adds every descriptor set,
+//   - each frame, vkUpdateDescriptorSets remaps kUpdatesPerFrame sets and
+//     vkCmdBindDescriptorSets remaps kBindsPerFrame draws' worth of
+//     kSetsPerBind sets, which is what manually_replay_vkQueueSubmit and
+//     the descriptor set calls spend their time on,
+//   - between frames, vkFreeDescriptorSets removes kChurnPerFrame sets and
+//     vkAllocateDescriptorSets adds as many new ones,
+//   - vkDestroyDescriptorPool removes all of them at the end.
+// This reports how long each step takes with each map. It fails if a remap
+// doesn't return the replay handle its trace handle was added with, or if
+// the maps don't end up empty.
+//
+// usage: vktrace_replay_handle_map_benchmark [descriptor sets] [frames]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "vkreplay_handle_map.h"
+#include "vktrace_test_harness.h"
+
+namespace {
+
+// A stand-in for VkDescriptorSet, which is a pointer to an opaque struct on
+// 64-bit platforms.
+typedef struct DescriptorSet_T *DescriptorSet;
+
+const uint32_t kUpdatesPerFrame = 2000;
+const uint32_t kBindsPerFrame = 20000;
+const uint32_t kSetsPerBind = 4;
+const uint32_t kChurnPerFrame = 5000;
+
+// Descriptor pools hand out sets from slabs, so trace handles are aligned
+// and mostly sequential.
+DescriptorSet trace_handle(uint64_t setNumber) { return reinterpret_cast<DescriptorSet>(0x7f0000000000ULL + setNumber * 64); }
+
+DescriptorSet replay_handle(DescriptorSet traceHandle) {
+    return reinterpret_cast<DescriptorSet>(reinterpret_cast<uintptr_t>(traceHandle) ^ 0x0000555500000000ULL);
+}
+
+// How remap_descriptorsets() looks a handle up.
+template <typename Map>
+DescriptorSet remap(const Map &map, DescriptorSet value) {
+    if (value == 0) {
+        return 0;
+    }
+    typename Map::const_iterator q = map.find(value);
+    if (q == map.end()) {
+        return 0;
+    }
+    return q->second;
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Replays the descriptor set calls with Map. Returns false if a remap went wrong.
+template <typename Map>
+bool replay(const char *pName, uint64_t setCount, uint32_t frameCount) {
+    std::mt19937_64 random(1);
+    Map map;
+    std::vector<uint64_t> liveSets(setCount);
+    uint64_t nextSet = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < setCount; i++) {
+        liveSets[i] = nextSet++;
+        map[trace_handle(liveSets[i])] = replay_handle(trace_handle(liveSets[i]));
+    }
+    double allocateMs = elapsed_ms(start);
+
+    bool bRemapped = true;
+    double remapMs = 0, churnMs = 0;
+    uint64_t remapCount = 0;
+    std::vector<DescriptorSet> calls((size_t)kUpdatesPerFrame + kBindsPerFrame * kSetsPerBind);
+    for (uint32_t frame = 0; frame < frameCount; frame++) {
+        // The sets a frame uses are picked before the timing starts.
+        for (size_t i = 0; i < calls.size(); i++) {
+            calls[i] = trace_handle(liveSets[random() % setCount]);
+        }
+
+        start = std::chrono::steady_clock::now();
+        uint64_t mismatchCount = 0;
+        for (size_t i = 0; i < calls.size(); i++) {
+            mismatchCount += (remap(map, calls[i]) != replay_handle(calls[i]));
+        }
+        remapMs += elapsed_ms(start);
+        remapCount += calls.size();
+        if (mismatchCount != 0) {
+            printf("%s, frame %u: %llu remaps returned the wrong handle.\n", pName, frame, (unsigned long long)mismatchCount);
+            bRemapped = false;
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < kChurnPerFrame; i++) {
+            uint64_t &set = liveSets[random() % setCount];
+            map.erase(trace_handle(set));
+            set = nextSet++;
+            map[trace_handle(set)] = replay_handle(trace_handle(set));
+        }
+        churnMs += elapsed_ms(start);
+    }
+
+    if (map.size() != setCount) {
+        printf("%s: the map has %zu sets, %llu are live.\n", pName, map.size(), (unsigned long long)setCount);
+        bRemapped = false;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < setCount; i++) {
+        map.erase(trace_handle(liveSets[i]));
+    }
+    double destroyMs = elapsed_ms(start);
+    if (!map.empty()) {
+        printf("%s: %zu sets are left after all were removed.\n", pName, map.size());
+        bRemapped = false;
+    }
+
+    printf("%-17s  allocate %7.1f ms  remap %6.1f ns/set  free and allocate %6.1f ns/set  destroy %7.1f ms\n", pName,
+           allocateMs, remapMs * 1e6 / (double)remapCount, churnMs * 1e6 / ((double)frameCount * kChurnPerFrame), destroyMs);
+    return bRemapped;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {1000000, 100};
+    if (!vktrace_test::read_counts(argc, argv, "[descriptor sets] [frames]", counts)) {
+        return 1;
+    }
+    uint64_t setCount = counts[0];
+    uint32_t frameCount = (uint32_t)counts[1];
+
+    printf("%llu descriptor sets, %u frames of %u remaps\n", (unsigned long long)setCount, frameCount,
+           kUpdatesPerFrame + kBindsPerFrame * kSetsPerBind);
+    bool bPassed = replay<std::map<DescriptorSet, DescriptorSet>>("std::map", setCount, frameCount);
+    bPassed = replay<vkReplayHandleMap<DescriptorSet, DescriptorSet>>("vkReplayHandleMap", setCount, frameCount) && bPassed;
+    return vktrace_test::exit_code(bPassed);
+}
@@ -0,0 +1,305 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Sends records through a small shared memory ring from several threads
+// while the main thread reads them back, the way the trace layer and
+// vktrace use it:
+//   - records of random sizes, so the ring wraps around many times,
+//   - some records larger than a quarter of the ring, which are written
+//     out of line,
+//   - records copied in with vktrace_shm_ring_write,
+//   - trace packets built by vktrace_create_trace_packet and sent by
+//     vktrace_write_trace_packet, and packets that are deleted without
+//     being written, which must not reach the reader.
+// Every record carries its thread and sequence number and a pattern
+// derived from them. It fails if a record is lost, reordered within its
+// thread, corrupted, or if a packet that wasn't written is read.
+//
+// usage: vktrace_shm_ring_test [records per thread] [threads]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_filelike.h"
+#include "vktrace_interconnect.h"
+#include "vktrace_shm_ring.h"
+#include "vktrace_trace_packet_utils.h"
+}
+
+#if defined(VKTRACE_SHM_RING_SUPPORTED)
+
+namespace {
+
+const uint64_t kRingSize = 64 * 1024;
+const uint32_t kMaxRecordSize = 3000;
+const uint32_t kOversizedRecordSize = 40 * 1024;
+const uint32_t kOversizedEvery = 500;
+
+// Starts every record.
+struct RecordHeader {
+    uint32_t size;
+    uint32_t thread;
+    uint32_t sequence;
+    uint32_t reserved;
+};
+
+uint8_t pattern_byte(uint32_t thread, uint32_t sequence, uint32_t offset) {
+    return static_cast<uint8_t>(thread * 31 + sequence * 7 + offset);
+}
+
+void fill_record(uint8_t *pRecord, uint32_t size, uint32_t thread, uint32_t sequence) {
+    RecordHeader header = {size, thread, sequence, 0};
+    memcpy(pRecord, &header, sizeof(header));
+    for (uint32_t offset = sizeof(header); offset < size; offset++) {
+        pRecord[offset] = pattern_byte(thread, sequence, offset);
+    }
+}
+
+bool check_record(const uint8_t *pRecord, const RecordHeader &header) {
+    for (uint32_t offset = sizeof(header); offset < header.size; offset++) {
+        if (pRecord[offset] != pattern_byte(header.thread, header.sequence, offset)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void produce_records(vktrace_shm_ring *pRing, uint32_t thread, uint32_t recordCount) {
+    std::mt19937 random(thread);
+    std::vector<uint8_t> record(kOversizedRecordSize);
+    for (uint32_t sequence = 0; sequence < recordCount; sequence++) {
+        uint32_t size = (sequence % kOversizedEvery == kOversizedEvery - 1)
+                            ? kOversizedRecordSize
+                            : static_cast<uint32_t>(sizeof(RecordHeader) + random() % (kMaxRecordSize - sizeof(RecordHeader)));
+        fill_record(record.data(), size, thread, sequence);
+        if (!vktrace_shm_ring_write(pRing, record.data(), size)) {
+            printf("Thread %u failed to write record %u.\n", thread, sequence);
+            return;
+        }
+    }
+}
+
+// Reads exactly _len bytes, waiting for producers that are behind.
+bool read_exact(vktrace_shm_ring *pRing, void *_out, uint64_t _len) {
+    uint64_t total = 0;
+    while (total < _len) {
+        uint64_t bytesRead = 0;
+        bool open = vktrace_shm_ring_read(pRing, static_cast<uint8_t *>(_out) + total, _len - total, &bytesRead) != FALSE;
+        total += bytesRead;
+        if (!open && total < _len) {
+            return false;
+        }
+        if (bytesRead == 0) {
+            std::this_thread::yield();
+        }
+    }
+    return true;
+}
+
+// Reads records until the producer detaches and checks them.
+bool consume_records(vktrace_shm_ring *pRing, uint32_t threadCount, uint32_t recordCount) {
+    std::vector<uint32_t> nextSequence(threadCount, 0);
+    std::vector<uint8_t> record(kOversizedRecordSize);
+    uint64_t received = 0;
+    RecordHeader header;
+    while (read_exact(pRing, &header, sizeof(header))) {
+        if (header.thread >= threadCount || header.sequence != nextSequence[header.thread] || header.size < sizeof(header) ||
+            header.size > kOversizedRecordSize) {
+            printf("Read record %u of thread %u, expected record %u.\n", header.sequence, header.thread,
+                   (header.thread < threadCount) ? nextSequence[header.thread] : 0);
+            return false;
+        }
+        memcpy(record.data(), &header, sizeof(header));
+        if (!read_exact(pRing, record.data() + sizeof(header), header.size - sizeof(header)) ||
+            !check_record(record.data(), header)) {
+            printf("Record %u of thread %u is corrupted.\n", header.sequence, header.thread);
+            return false;
+        }
+        nextSequence[header.thread]++;
+        received++;
+    }
+
+    if (received != (uint64_t)threadCount * recordCount) {
+        printf("Read %llu records, expected %llu.\n", (unsigned long long)received,
+               (unsigned long long)threadCount * recordCount);
+        return false;
+    }
+    return true;
+}
+
+bool test_records(uint32_t threadCount, uint32_t recordCount) {
+    char name[64];
+    snprintf(name, sizeof(name), "/vktrace_shm_ring_test_%d", (int)getpid());
+    vktrace_shm_ring *pConsumer = vktrace_shm_ring_create(name, kRingSize);
+    vktrace_shm_ring *pProducer = (pConsumer != nullptr) ? vktrace_shm_ring_open(name) : nullptr;
+    if (pProducer == nullptr) {
+        printf("Failed to set up shared memory ring %s.\n", name);
+        vktrace_shm_ring_close(&pConsumer);
+        return false;
+    }
+
+    std::vector<std::thread> producers;
+    for (uint32_t thread = 0; thread < threadCount; thread++) {
+        producers.push_back(std::thread(produce_records, pProducer, thread, recordCount));
+    }
+    std::thread detach([&]() {
+        for (size_t i = 0; i < producers.size(); i++) {
+            producers[i].join();
+        }
+        vktrace_shm_ring_close(&pProducer);
+    });
+
+    bool bPassed = consume_records(pConsumer, threadCount, recordCount);
+    detach.join();
+    vktrace_shm_ring_close(&pConsumer);
+    return bPassed;
+}
+
+void produce_packets(FileLike *pFile, uint32_t thread, uint32_t packetCount) {
+    std::mt19937 random(thread);
+    std::vector<uint8_t> buffer(kOversizedRecordSize);
+    for (uint32_t sequence = 0; sequence < packetCount; sequence++) {
+        uint32_t size = (sequence % kOversizedEvery == kOversizedEvery - 1)
+                            ? kOversizedRecordSize
+                            : static_cast<uint32_t>(sizeof(RecordHeader) + random() % (kMaxRecordSize - sizeof(RecordHeader)));
+        size &= ~3u;
+
+        // Packets that are deleted without being written are not sent.
+        if (random() % 8 == 0) {
+            vktrace_trace_packet_header *pSkipped =
+                vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_MARKER_CHECKPOINT, sizeof(RecordHeader), size);
+            vktrace_delete_trace_packet(&pSkipped);
+        }
+
+        vktrace_trace_packet_header *pHeader =
+            vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_MARKER_CHECKPOINT, sizeof(RecordHeader), size);
+        RecordHeader *pPacket = reinterpret_cast<RecordHeader *>(pHeader->pBody);
+        pPacket->size = size;
+        pPacket->thread = thread;
+        pPacket->sequence = sequence;
+        void *pData = nullptr;
+        fill_record(buffer.data(), size, thread, sequence);
+        vktrace_add_buffer_to_trace_packet(pHeader, &pData, size, buffer.data());
+        vktrace_finalize_trace_packet(pHeader);
+        vktrace_write_trace_packet(pHeader, pFile);
+        vktrace_delete_trace_packet(&pHeader);
+    }
+}
+
+bool consume_packets(vktrace_shm_ring *pRing, uint32_t threadCount, uint32_t packetCount) {
+    std::vector<uint32_t> nextSequence(threadCount, 0);
+    std::vector<uint8_t> packet;
+    uint64_t received = 0;
+    vktrace_trace_packet_header header;
+    while (read_exact(pRing, &header, sizeof(header))) {
+        packet.resize((size_t)header.size);
+        memcpy(packet.data(), &header, sizeof(header));
+        if (header.size < sizeof(header) + sizeof(RecordHeader) ||
+            !read_exact(pRing, packet.data() + sizeof(header), header.size - sizeof(header))) {
+            printf("Packet %llu is truncated.\n", (unsigned long long)header.global_packet_index);
+            return false;
+        }
+
+        const RecordHeader *pPacket = reinterpret_cast<const RecordHeader *>(packet.data() + sizeof(header));
+        const uint8_t *pData = reinterpret_cast<const uint8_t *>(pPacket + 1);
+        if (pPacket->thread >= threadCount || pPacket->sequence != nextSequence[pPacket->thread] ||
+            sizeof(header) + sizeof(RecordHeader) + pPacket->size > header.size) {
+            printf("Read packet %u of thread %u, expected packet %u.\n", pPacket->sequence, pPacket->thread,
+                   (pPacket->thread < threadCount) ? nextSequence[pPacket->thread] : 0);
+            return false;
+        }
+        RecordHeader dataHeader;
+        memcpy(&dataHeader, pData, sizeof(dataHeader));
+        if (memcmp(&dataHeader, pPacket, sizeof(dataHeader)) != 0 || !check_record(pData, *pPacket)) {
+            printf("Packet %u of thread %u is corrupted.\n", pPacket->sequence, pPacket->thread);
+            return false;
+        }
+        nextSequence[pPacket->thread]++;
+        received++;
+    }
+
+    if (received != (uint64_t)threadCount * packetCount) {
+        printf("Read %llu packets, expected %llu.\n", (unsigned long long)received,
+               (unsigned long long)threadCount * packetCount);
+        return false;
+    }
+    return true;
+}
+
+bool test_packets(uint32_t threadCount, uint32_t packetCount) {
+    char name[64];
+    snprintf(name, sizeof(name), "/vktrace_shm_ring_test_packets_%d", (int)getpid());
+    vktrace_shm_ring *pConsumer = vktrace_shm_ring_create(name, kRingSize);
+    MessageStream *pStream = (pConsumer != nullptr) ? vktrace_MessageStream_create_shm(FALSE, name) : nullptr;
+    if (pStream == nullptr) {
+        printf("Failed to set up shared memory ring %s.\n", name);
+        vktrace_shm_ring_close(&pConsumer);
+        return false;
+    }
+    FileLike *pFile = vktrace_FileLike_create_msg(pStream);
+
+    std::vector<std::thread> producers;
+    for (uint32_t thread = 0; thread < threadCount; thread++) {
+        producers.push_back(std::thread(produce_packets, pFile, thread, packetCount));
+    }
+    std::thread detach([&]() {
+        for (size_t i = 0; i < producers.size(); i++) {
+            producers[i].join();
+        }
+        vktrace_FileLike_destroy(&pFile);
+        vktrace_MessageStream_destroy(&pStream);
+    });
+
+    bool bPassed = consume_packets(pConsumer, threadCount, packetCount);
+    detach.join();
+    vktrace_shm_ring_close(&pConsumer);
+    return bPassed;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {20000, 4};
+    if (!vktrace_test::read_counts(argc, argv, "[records per thread] [threads]", counts)) {
+        return 1;
+    }
+    uint32_t recordCount = (uint32_t)counts[0];
+    uint32_t threadCount = (uint32_t)counts[1];
+
+    bool bPassed = vktrace_test::report(test_records(threadCount, recordCount), "%u threads writing %u records each", threadCount,
+                                        recordCount);
+    bPassed = vktrace_test::report(test_packets(threadCount, recordCount), "%u threads writing %u packets each", threadCount,
+                                   recordCount) &&
+              bPassed;
+    return vktrace_test::exit_code(bPassed);
+}
+
+#else  // VKTRACE_SHM_RING_SUPPORTED
+
+int main(int argc, char **argv) {
+    printf("The shared memory ring is not supported on this platform.\n");
+    return 0;
+}
+
+#endif  // VKTRACE_SHM_RING_SUPPORTED
@@ -0,0 +1,263 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures how fast vktrace writes the packets it receives from the trace
+// layer over the socket to the trace file.
+//
+// A thread stands in for the traced application and sends packets of the
+// sizes a trace has, mostly small command packets, with a 16 KB packet
+// every 16 packets and a 1 MB memory upload every 1024 packets. vktrace's
+// end of the socket receives them two ways, each into a file of its own:
+//   - reading every packet with vktrace_read_trace_packet() and writing it
+//     with an fwrite and fflush under the trace file lock, which is how
+//     vktrace wrote packets before TraceFileWriter,
+//   - reading every packet straight into space reserved in a
+//     TraceFileWriter, the way receive_trace_packet() in vktrace_process.cpp
+//     does, which writes whole buffers on a thread of its own.
+// This reports the throughput of each from the first packet received until
+// the last one is in the file. It fails if a file doesn't hold exactly the
+// packets sent, in the order they were sent.
+//
+// usage: vktrace_socket_replay_benchmark [packets]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "vktrace_writer.h"
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_filelike.h"
+#include "vktrace_interconnect.h"
+#include "vktrace_trace_packet_utils.h"
+}
+
+namespace {
+
+const unsigned int kPort = VKTRACE_BASE_PORT + 100;
+const uint64_t kLargePacketSize = 1024 * 1024;
+const uint32_t kConnectAttempts = 100;
+
+// The size of packet packetIndex, header included.
+uint64_t packet_size(uint64_t packetIndex) {
+    uint64_t bodySize;
+    if (packetIndex % 1024 == 1023) {
+        bodySize = kLargePacketSize;
+    } else if (packetIndex % 16 == 15) {
+        bodySize = 16 * 1024;
+    } else {
+        bodySize = 64 + (packetIndex * 37 % 8) * 32;
+    }
+    return ROUNDUP_TO_8(sizeof(vktrace_trace_packet_header) + bodySize);
+}
+
+uint16_t packet_id(uint64_t packetIndex) {
+    if (packetIndex % 1024 == 1023) {
+        return VKTRACE_TPI_VK_vkFlushMappedMemoryRanges;
+    }
+    return (packetIndex % 16 == 15) ? VKTRACE_TPI_VK_vkUpdateDescriptorSets : VKTRACE_TPI_VK_vkCmdDraw;
+}
+
+// The bodies of all packets start with the same bytes, so a packet that
+// lost or gained bytes on the way shows up when the file is read back.
+const std::vector<uint8_t> &body_pattern() {
+    static std::vector<uint8_t> s_pattern;
+    if (s_pattern.empty()) {
+        s_pattern.resize((size_t)kLargePacketSize);
+        for (size_t i = 0; i < s_pattern.size(); i++) {
+            s_pattern[i] = (uint8_t)(i * 7 + i / 251);
+        }
+    }
+    return s_pattern;
+}
+
+uint64_t total_size(uint64_t packetCount) {
+    uint64_t size = 0;
+    for (uint64_t i = 0; i < packetCount; i++) {
+        size += packet_size(i);
+    }
+    return size;
+}
+
+// Stands in for the traced application.
+void send_packets(uint64_t packetCount, bool *pbSent) {
+    *pbSent = false;
+    MessageStream *pStream = nullptr;
+    for (uint32_t attempt = 0; attempt < kConnectAttempts && pStream == nullptr; attempt++) {
+        pStream = vktrace_MessageStream_create(FALSE, "localhost", kPort);
+        if (pStream == nullptr) {
+            Sleep(10);
+        }
+    }
+    if (pStream == nullptr) {
+        printf("The application couldn't connect to port %u.\n", kPort);
+        return;
+    }
+
+    FileLike *pFile = vktrace_FileLike_create_msg(pStream);
+    std::vector<uint8_t> packet(sizeof(vktrace_trace_packet_header) + (size_t)kLargePacketSize + 8);
+    memcpy(packet.data() + sizeof(vktrace_trace_packet_header), body_pattern().data(), body_pattern().size());
+    vktrace_trace_packet_header *pHeader = reinterpret_cast<vktrace_trace_packet_header *>(packet.data());
+    bool bSent = true;
+    for (uint64_t i = 0; i < packetCount && bSent; i++) {
+        pHeader->size = packet_size(i);
+        pHeader->global_packet_index = i;
+        pHeader->tracer_id = VKTRACE_TID_VULKAN;
+        pHeader->packet_id = packet_id(i);
+        bSent = vktrace_FileLike_WriteRaw(pFile, pHeader, pHeader->size) == TRUE;
+    }
+    vktrace_FileLike_destroy(&pFile);
+    vktrace_MessageStream_destroy(&pStream);
+    *pbSent = bSent;
+}
+
+// vktrace before TraceFileWriter: an fwrite and fflush for every packet.
+bool receive_per_packet(FileLike *pFileLike, FILE *pTraceFile, uint64_t packetCount) {
+    VKTRACE_CRITICAL_SECTION traceFileCriticalSection;
+    vktrace_create_critical_section(&traceFileCriticalSection);
+    bool bReceived = true;
+    for (uint64_t i = 0; i < packetCount && bReceived; i++) {
+        vktrace_trace_packet_header *pHeader = vktrace_read_trace_packet(pFileLike);
+        if (pHeader == nullptr) {
+            bReceived = false;
+            break;
+        }
+        vktrace_enter_critical_section(&traceFileCriticalSection);
+        bReceived = fwrite(pHeader, 1, (size_t)pHeader->size, pTraceFile) == pHeader->size;
+        fflush(pTraceFile);
+        vktrace_leave_critical_section(&traceFileCriticalSection);
+        vktrace_delete_trace_packet(&pHeader);
+    }
+    vktrace_delete_critical_section(&traceFileCriticalSection);
+    return bReceived;
+}
+
+// vktrace now, see receive_trace_packet() in vktrace_process.cpp.
+bool receive_with_writer(FileLike *pFileLike, FILE *pTraceFile, uint64_t packetCount) {
+    VKTRACE_CRITICAL_SECTION traceFileCriticalSection;
+    vktrace_create_critical_section(&traceFileCriticalSection);
+    TraceFileWriter traceWriter(pTraceFile, &traceFileCriticalSection);
+    bool bReceived = traceWriter.start();
+    for (uint64_t i = 0; i < packetCount && bReceived; i++) {
+        uint64_t packetSize = 0;
+        if (vktrace_FileLike_ReadRaw(pFileLike, &packetSize, sizeof(packetSize)) == FALSE ||
+            packetSize < sizeof(vktrace_trace_packet_header)) {
+            bReceived = false;
+            break;
+        }
+        vktrace_trace_packet_header *pHeader = static_cast<vktrace_trace_packet_header *>(traceWriter.reserve(packetSize));
+        if (pHeader == nullptr) {
+            bReceived = false;
+            break;
+        }
+        pHeader->size = packetSize;
+        if (vktrace_FileLike_ReadRaw(pFileLike, reinterpret_cast<char *>(pHeader) + sizeof(uint64_t),
+                                     packetSize - sizeof(uint64_t)) == FALSE) {
+            traceWriter.commit(0);
+            bReceived = false;
+            break;
+        }
+        traceWriter.commit(packetSize);
+    }
+    traceWriter.finish();
+    bReceived = bReceived && !traceWriter.hasWriteError();
+    vktrace_delete_critical_section(&traceFileCriticalSection);
+    return bReceived;
+}
+
+// Returns false if the file doesn't hold the packets sent, in order.
+bool check_trace_file(FILE *pTraceFile, uint64_t packetCount, const char *pName) {
+    fseek(pTraceFile, 0, SEEK_END);
+    uint64_t fileSize = (uint64_t)ftell(pTraceFile);
+    if (fileSize != total_size(packetCount)) {
+        printf("%s: the file has %llu bytes, %llu were sent.\n", pName, (unsigned long long)fileSize,
+               (unsigned long long)total_size(packetCount));
+        return false;
+    }
+
+    fseek(pTraceFile, 0, SEEK_SET);
+    std::vector<uint8_t> packet(sizeof(vktrace_trace_packet_header) + (size_t)kLargePacketSize + 8);
+    vktrace_trace_packet_header *pHeader = reinterpret_cast<vktrace_trace_packet_header *>(packet.data());
+    for (uint64_t i = 0; i < packetCount; i++) {
+        uint64_t size = packet_size(i);
+        if (fread(packet.data(), (size_t)size, 1, pTraceFile) != 1 || pHeader->size != size ||
+            pHeader->global_packet_index != i || pHeader->packet_id != packet_id(i) ||
+            memcmp(pHeader + 1, body_pattern().data(), (size_t)(size - sizeof(vktrace_trace_packet_header))) != 0) {
+            printf("%s: packet %llu in the file isn't the packet %llu sent.\n", pName, (unsigned long long)i,
+                   (unsigned long long)i);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Receives packetCount packets with pReceive into a temporary file. Returns
+// false if they didn't all reach it.
+bool measure(bool (*pReceive)(FileLike *, FILE *, uint64_t), uint64_t packetCount, const char *pName) {
+    FILE *pTraceFile = tmpfile();
+    if (pTraceFile == nullptr) {
+        printf("%s: couldn't create a temporary file.\n", pName);
+        return false;
+    }
+
+    bool bSent = false;
+    std::thread application(send_packets, packetCount, &bSent);
+    MessageStream *pStream = vktrace_MessageStream_create(TRUE, "", kPort);
+    if (pStream == nullptr) {
+        application.join();
+        fclose(pTraceFile);
+        printf("%s: couldn't listen on port %u.\n", pName, kPort);
+        return false;
+    }
+    FileLike *pFileLike = vktrace_FileLike_create_msg(pStream);
+
+    auto start = std::chrono::steady_clock::now();
+    bool bReceived = pReceive(pFileLike, pTraceFile, packetCount);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    application.join();
+    vktrace_FileLike_destroy(&pFileLike);
+    vktrace_MessageStream_destroy(&pStream);
+
+    bool bPassed = bSent && bReceived && check_trace_file(pTraceFile, packetCount, pName);
+    fclose(pTraceFile);
+
+    double megabytes = (double)total_size(packetCount) / (1024.0 * 1024.0);
+    printf("%-16s  %8.1f MB/s  %10.0f packets/s%s\n", pName, megabytes / seconds, packetCount / seconds,
+           bPassed ? "" : "  FAILED");
+    fflush(stdout);
+    return bPassed;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {100000};
+    if (!vktrace_test::read_counts(argc, argv, "[packets]", counts)) {
+        return 1;
+    }
+    uint64_t packetCount = counts[0];
+
+    printf("%llu packets, %.1f MB\n", (unsigned long long)packetCount, (double)total_size(packetCount) / (1024.0 * 1024.0));
+    bool bPassed = measure(receive_per_packet, packetCount, "per packet");
+    bPassed = measure(receive_with_writer, packetCount, "TraceFileWriter") && bPassed;
+    return vktrace_test::exit_code(bPassed);
+}
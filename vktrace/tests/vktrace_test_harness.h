@@ -0,0 +1,74 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// What the vktrace tests and benchmarks have in common. They take counts
+// on the command line and print their usage if one of them is 0, print
+// "passed" or "FAILED" for each thing they check, and exit with 1 if any
+// of them failed.
+//-------------------------------------------------------------------------
+#pragma once
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace vktrace_test {
+
+// Reads the arguments into counts, which hold the defaults of the ones not
+// given. Prints the usage and returns false if a count is 0.
+template <size_t N>
+bool read_counts(int argc, char **argv, const char *pUsage, uint64_t (&counts)[N]) {
+    bool bValid = true;
+    for (size_t i = 0; i < N; i++) {
+        if ((int)i + 1 < argc) counts[i] = strtoull(argv[i + 1], nullptr, 10);
+        bValid = bValid && counts[i] != 0;
+    }
+    if (!bValid) {
+        printf("usage: %s %s\n", argv[0], pUsage);
+    }
+    return bValid;
+}
+
+// Prints what was checked and whether it passed, returns bPassed.
+inline bool report(bool bPassed, const char *pFormat, ...) {
+    va_list args;
+    va_start(args, pFormat);
+    vprintf(pFormat, args);
+    va_end(args);
+    printf(": %s\n", bPassed ? "passed" : "FAILED");
+    fflush(stdout);
+    return bPassed;
+}
+
+// The number of checks that failed.
+inline int &failure_count() {
+    static int s_failureCount = 0;
+    return s_failureCount;
+}
+
+// For tests that check many things, only prints the ones that fail.
+inline void check(bool condition, const char *pDescription) {
+    if (!condition) {
+        printf("FAILED: %s\n", pDescription);
+        failure_count()++;
+    }
+}
+
+inline int exit_code(bool bPassed) { return (bPassed && failure_count() == 0) ? 0 : 1; }
+
+}  // namespace vktrace_test
@@ -0,0 +1,377 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures how far threads that record command buffers can run in parallel
+// while the trace layer tracks state for trimming.
+//
+// Each thread records its own command buffers over and over, the way the
+// layer's wrappers would with trim enabled: every command is copied into
+// the calls of its command buffer, every 8th command looks up an image and
+// adds a transition, and every 16th looks up the command buffer. This is
+// done three ways:
+//   - with trim disabled, where the packet is only built and deleted,
+//   - with one lock for the objects, one for the command buffer calls and
+//     one for the transitions, which is how the layer locked before,
+//   - with one lock per CopyOnWriteMap shard, which is how it locks now,
+//     see get_state_tracker_lock() in vktrace_lib_trim.cpp.
+// The first run of each takes a snapshot in the middle of recording and
+// reads its calls while recording goes on, like trimming starting does.
+//
+// Wall times only show scaling on a machine with as many CPUs as threads.
+// So each scheme also runs all the threads' work on one thread and reports
+// how long its busiest lock was held. The work can't be spread over more
+// threads than total time / busiest lock time.
+//
+// usage: vktrace_trim_lock_benchmark [frames] [commands per recording] [threads]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <thread>
+#include <vector>
+
+#include "vktrace_lib_trim_copyonwrite.h"
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_platform.h"
+}
+
+using trim::CopyOnWriteMap;
+using trim::kCopyOnWriteShardCount;
+
+namespace {
+
+// Stand-ins for the handles and packets that the layer keeps.
+struct CommandBuffer_T {};
+struct Image_T {};
+typedef CommandBuffer_T *CommandBuffer;
+typedef Image_T *Image;
+
+struct Packet {
+    uint64_t size;
+    char body[120];
+};
+
+struct Transition {
+    Image image;
+    int oldLayout;
+    int newLayout;
+};
+
+struct ObjectInfo {
+    uint64_t handle;
+    int layout;
+};
+
+void copy_calls(std::list<Packet *> *pDst, const std::list<Packet *> &src) {
+    for (Packet *pPacket : src) {
+        Packet *pCopy = static_cast<Packet *>(malloc(sizeof(Packet)));
+        memcpy(pCopy, pPacket, sizeof(Packet));
+        pDst->push_back(pCopy);
+    }
+}
+
+void delete_calls(std::list<Packet *> *pCalls) {
+    for (Packet *pPacket : *pCalls) {
+        free(pPacket);
+    }
+    pCalls->clear();
+}
+
+struct StateTracker {
+    StateTracker() : commandBufferCalls(copy_calls, delete_calls) {}
+
+    CopyOnWriteMap<CommandBuffer, std::list<Packet *>> commandBufferCalls;
+    CopyOnWriteMap<CommandBuffer, std::list<Transition>> imageTransitions;
+    CopyOnWriteMap<Image, ObjectInfo> images;
+    CopyOnWriteMap<CommandBuffer, ObjectInfo> commandBuffers;
+};
+
+enum LockScheme { kTrimDisabled, kOneLock, kShardLocks, kLockSchemeCount };
+const char *const kLockSchemeNames[kLockSchemeCount] = {"trim disabled", "trim, one lock", "trim, shard locks"};
+
+const int kCommandBuffersPerThread = 4;
+const int kImageCount = 4096;
+
+StateTracker s_stateTracker;
+StateTracker s_snapshot;
+LockScheme s_lockScheme = kTrimDisabled;
+int s_frameCount = 20;
+int s_commandsPerRecording = 2000;
+int s_threadCount = 16;
+std::vector<CommandBuffer> s_commandBuffers;
+std::vector<Image> s_images;
+
+// The locks of both schemes, and how long each one was held while s_measureLocks is set.
+enum { kStateTrackerLock, kCommandBufferCallLock, kTransitionLock, kFirstShardLock, kLockCount = kFirstShardLock + kCopyOnWriteShardCount };
+VKTRACE_CRITICAL_SECTION s_locks[kLockCount];
+bool s_measureLocks = false;
+uint64_t s_lockHeldNs[kLockCount];
+thread_local std::chrono::steady_clock::time_point t_lockEnterTime[kLockCount];
+thread_local int t_lockDepth[kLockCount];
+
+void enter_lock(int lock) {
+    vktrace_enter_critical_section(&s_locks[lock]);
+    if (s_measureLocks && t_lockDepth[lock]++ == 0) {
+        t_lockEnterTime[lock] = std::chrono::steady_clock::now();
+    }
+}
+
+void leave_lock(int lock) {
+    if (s_measureLocks && --t_lockDepth[lock] == 0) {
+        s_lockHeldNs[lock] +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_lockEnterTime[lock]).count();
+    }
+    vktrace_leave_critical_section(&s_locks[lock]);
+}
+
+template <typename Key>
+int get_lock(int oneLock, const Key &key) {
+    return (s_lockScheme == kOneLock) ? oneLock : kFirstShardLock + static_cast<int>(trim::get_copy_on_write_shard_index(key));
+}
+
+// The wrappers of the layer that recording threads call.
+void add_CommandBuffer_call(CommandBuffer commandBuffer, Packet *pPacket) {
+    int lock = get_lock(kCommandBufferCallLock, commandBuffer);
+    enter_lock(lock);
+    s_stateTracker.commandBufferCalls[commandBuffer].push_back(pPacket);
+    leave_lock(lock);
+}
+
+void remove_CommandBuffer_calls(CommandBuffer commandBuffer) {
+    int lock = get_lock(kCommandBufferCallLock, commandBuffer);
+    enter_lock(lock);
+    s_stateTracker.commandBufferCalls.erase(commandBuffer);
+    leave_lock(lock);
+}
+
+void AddImageTransition(CommandBuffer commandBuffer, const Transition &transition) {
+    int lock = get_lock(kTransitionLock, commandBuffer);
+    enter_lock(lock);
+    s_stateTracker.imageTransitions[commandBuffer].push_back(transition);
+    leave_lock(lock);
+}
+
+void ClearImageTransitions(CommandBuffer commandBuffer) {
+    int lock = get_lock(kTransitionLock, commandBuffer);
+    enter_lock(lock);
+    s_stateTracker.imageTransitions.erase(commandBuffer);
+    leave_lock(lock);
+}
+
+ObjectInfo *get_Image_objectInfo(Image image) {
+    int lock = get_lock(kStateTrackerLock, image);
+    enter_lock(lock);
+    ObjectInfo *pInfo = s_stateTracker.images.get(image);
+    leave_lock(lock);
+    return pInfo;
+}
+
+ObjectInfo *get_CommandBuffer_objectInfo(CommandBuffer commandBuffer) {
+    int lock = get_lock(kStateTrackerLock, commandBuffer);
+    enter_lock(lock);
+    ObjectInfo *pInfo = s_stateTracker.commandBuffers.get(commandBuffer);
+    leave_lock(lock);
+    return pInfo;
+}
+
+void take_snapshot() {
+    if (s_lockScheme == kOneLock) {
+        enter_lock(kStateTrackerLock);
+        enter_lock(kCommandBufferCallLock);
+    } else {
+        for (int lock = kFirstShardLock; lock < kLockCount; lock++) {
+            enter_lock(lock);
+        }
+    }
+    s_snapshot.commandBufferCalls = s_stateTracker.commandBufferCalls;
+    s_snapshot.images = s_stateTracker.images;
+    if (s_lockScheme == kOneLock) {
+        leave_lock(kCommandBufferCallLock);
+        leave_lock(kStateTrackerLock);
+    } else {
+        for (int lock = kLockCount - 1; lock >= kFirstShardLock; lock--) {
+            leave_lock(lock);
+        }
+    }
+}
+
+void record_command_buffers(int thread) {
+    uint32_t seed = thread * 7919 + 1;
+    for (int frame = 0; frame < s_frameCount; frame++) {
+        for (int i = 0; i < kCommandBuffersPerThread; i++) {
+            CommandBuffer commandBuffer = s_commandBuffers[thread * kCommandBuffersPerThread + i];
+            if (s_lockScheme != kTrimDisabled) {
+                // vkBeginCommandBuffer
+                remove_CommandBuffer_calls(commandBuffer);
+                ClearImageTransitions(commandBuffer);
+            }
+            for (int command = 0; command < s_commandsPerRecording; command++) {
+                // The layer builds the packet whether it trims or not.
+                Packet *pPacket = static_cast<Packet *>(malloc(sizeof(Packet)));
+                pPacket->size = sizeof(Packet);
+                memset(pPacket->body, command, sizeof(pPacket->body));
+                if (s_lockScheme == kTrimDisabled) {
+                    free(pPacket);
+                    continue;
+                }
+
+                if (command % 8 == 0) {
+                    seed = seed * 1103515245 + 12345;
+                    Image image = s_images[(seed >> 8) % kImageCount];
+                    if (get_Image_objectInfo(image) != nullptr) {
+                        AddImageTransition(commandBuffer, Transition{image, 1, 2});
+                    }
+                }
+                if (command % 16 == 0) {
+                    get_CommandBuffer_objectInfo(commandBuffer);
+                }
+
+                // add_CommandBuffer_call(commandBuffer, trim::copy_packet(pHeader)), then the packet is deleted.
+                Packet *pCopy = static_cast<Packet *>(malloc(sizeof(Packet)));
+                memcpy(pCopy, pPacket, sizeof(Packet));
+                free(pPacket);
+                add_CommandBuffer_call(commandBuffer, pCopy);
+            }
+        }
+    }
+}
+
+// Returns the wall time of recording on all the threads, in milliseconds.
+double run_threads(bool bTakeSnapshot) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < s_threadCount; thread++) {
+        threads.emplace_back(record_command_buffers, thread);
+    }
+
+    if (bTakeSnapshot && s_lockScheme != kTrimDisabled) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        take_snapshot();
+
+        // Like write_all_referenced_object_calls(), read the snapshot without a lock while recording goes on.
+        const StateTracker &snapshot = s_snapshot;
+        uint64_t snapshotBytes = 0;
+        for (auto entry = snapshot.commandBufferCalls.begin(); entry != snapshot.commandBufferCalls.end(); ++entry) {
+            for (const Packet *pPacket : entry->second) {
+                snapshotBytes += pPacket->size;
+            }
+        }
+        printf("  read %llu bytes of snapshot calls while recording\n", (unsigned long long)snapshotBytes);
+    }
+
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Each command buffer has to hold the calls of its last recording.
+bool check_command_buffer_calls() {
+    const StateTracker &stateTracker = s_stateTracker;
+    for (CommandBuffer commandBuffer : s_commandBuffers) {
+        const std::list<Packet *> *pCalls = stateTracker.commandBufferCalls.get(commandBuffer);
+        if (pCalls == nullptr || pCalls->size() != static_cast<size_t>(s_commandsPerRecording)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {(uint64_t)s_frameCount, (uint64_t)s_commandsPerRecording, (uint64_t)s_threadCount};
+    if (!vktrace_test::read_counts(argc, argv, "[frames] [commands per recording] [threads]", counts)) {
+        return 1;
+    }
+    s_frameCount = (int)counts[0];
+    s_commandsPerRecording = (int)counts[1];
+    s_threadCount = (int)counts[2];
+
+    for (int lock = 0; lock < kLockCount; lock++) {
+        vktrace_create_critical_section(&s_locks[lock]);
+    }
+    for (int i = 0; i < s_threadCount * kCommandBuffersPerThread; i++) {
+        CommandBuffer commandBuffer = new CommandBuffer_T;
+        s_commandBuffers.push_back(commandBuffer);
+        s_stateTracker.commandBuffers.add(commandBuffer).handle = reinterpret_cast<uint64_t>(commandBuffer);
+    }
+    for (int i = 0; i < kImageCount; i++) {
+        Image image = new Image_T;
+        s_images.push_back(image);
+        s_stateTracker.images.add(image).handle = reinterpret_cast<uint64_t>(image);
+    }
+
+    printf("%d threads record %d command buffers each, %d times, %d commands per recording\n", s_threadCount,
+           kCommandBuffersPerThread, s_frameCount, s_commandsPerRecording);
+    bool bPassed = true;
+    for (int scheme = kTrimDisabled; scheme < kLockSchemeCount; scheme++) {
+        s_lockScheme = static_cast<LockScheme>(scheme);
+
+        // Best of three runs, the first of which takes a snapshot.
+        double bestMs = 0.0;
+        for (int run = 0; run < 3; run++) {
+            double ms = run_threads(run == 0);
+            if (run == 0 || ms < bestMs) {
+                bestMs = ms;
+            }
+        }
+        if (s_lockScheme != kTrimDisabled && !check_command_buffer_calls()) {
+            printf("%-18s lost command buffer calls\n", kLockSchemeNames[scheme]);
+            bPassed = false;
+        }
+
+        // Do the work of all threads on this one, so that threads that are switched out while they hold a lock don't
+        // make it look busier than it is.
+        double busiestMs = 0.0;
+        double totalMs = 0.0;
+        if (s_lockScheme != kTrimDisabled) {
+            memset(s_lockHeldNs, 0, sizeof(s_lockHeldNs));
+            s_measureLocks = true;
+            auto start = std::chrono::steady_clock::now();
+            for (int thread = 0; thread < s_threadCount; thread++) {
+                record_command_buffers(thread);
+            }
+            totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            s_measureLocks = false;
+            for (int lock = 0; lock < kLockCount; lock++) {
+                if (s_lockHeldNs[lock] / 1e6 > busiestMs) {
+                    busiestMs = s_lockHeldNs[lock] / 1e6;
+                }
+            }
+        }
+
+        if (busiestMs > 0.0) {
+            printf("%-18s %8.1f ms  busiest lock held %7.1f of %7.1f ms -> at most %5.1fx parallel\n", kLockSchemeNames[scheme],
+                   bestMs, busiestMs, totalMs, totalMs / busiestMs);
+        } else {
+            printf("%-18s %8.1f ms\n", kLockSchemeNames[scheme], bestMs);
+        }
+    }
+
+    s_snapshot.commandBufferCalls.clear();
+    s_stateTracker.commandBufferCalls.clear();
+    for (int lock = 0; lock < kLockCount; lock++) {
+        vktrace_delete_critical_section(&s_locks[lock]);
+    }
+    return vktrace_test::exit_code(bPassed);
+}
@@ -0,0 +1,221 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Measures the hitch of trimming starting against how many objects the
+// application has created.
+//
+// When trimming starts, the present that starts it takes a snapshot of the
+// state tracker. The layer used to deep copy every object into the snapshot,
+// now the snapshot shares them through CopyOnWriteMap and only copies the
+// ones handed out to calls that may still be running, see
+// StateTracker::snapshot(). For each object count this reports:
+//   - how long the deep copy takes,
+//   - how long the snapshot takes with 1% of the objects handed out,
+//   - how long changing another 1% of the objects takes after the snapshot,
+//     which is when a shared object gets copied.
+// It fails if a change made through a handed out object shows up
+// in the snapshot or is lost to the live map, or if from kCheckedCount
+// objects on the snapshot doesn't take less than 1/kMinSpeedup of the deep
+// copy. It also fails unless an object handed out to a call that is still
+// running on another thread is copied, however long ago the call got it,
+// and an object handed out to a call that has returned is shared.
+//
+// usage: vktrace_trim_snapshot_benchmark [largest object count]
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "vktrace_lib_trim_copyonwrite.h"
+#include "vktrace_test_harness.h"
+
+using trim::CopyOnWriteMap;
+
+namespace {
+
+// A stand-in for ObjectInfo, which holds the packet that created the object.
+struct ObjectInfo {
+    uint64_t handle;
+    uint64_t packetSize;
+    char *pCreatePacket;
+};
+
+const uint64_t kPacketSize = 256;
+const uint64_t kCheckedCount = 100000;
+const double kMinSpeedup = 10.0;
+
+void copy_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    if (src.pCreatePacket != nullptr) {
+        pDst->pCreatePacket = static_cast<char *>(malloc(src.packetSize));
+        memcpy(pDst->pCreatePacket, src.pCreatePacket, src.packetSize);
+    }
+}
+
+void delete_objectInfo(ObjectInfo *pInfo) {
+    free(pInfo->pCreatePacket);
+    pInfo->pCreatePacket = nullptr;
+}
+
+void init_objectInfo(ObjectInfo *pInfo, uint64_t handle) {
+    pInfo->handle = handle;
+    pInfo->packetSize = kPacketSize;
+    pInfo->pCreatePacket = static_cast<char *>(malloc(kPacketSize));
+    memset(pInfo->pCreatePacket, static_cast<int>(handle), kPacketSize);
+}
+
+// Stands in for the packet that a traced call creates first.
+void start_call() {
+    vktrace_trace_packet_header *pHeader = vktrace_create_trace_packet(0, 0, 0, 0);
+    vktrace_delete_trace_packet(&pHeader);
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Returns false if the snapshot saw a change made after it was taken, if the
+// live map lost one, or if the snapshot was too slow.
+bool measure(uint64_t objectCount) {
+    // How the layer kept objects before.
+    std::unordered_map<uint64_t, ObjectInfo> deepLive;
+    CopyOnWriteMap<uint64_t, ObjectInfo> live(copy_objectInfo, delete_objectInfo);
+    for (uint64_t handle = 1; handle <= objectCount; handle++) {
+        init_objectInfo(&deepLive[handle], handle);
+        init_objectInfo(&live.add(handle), handle);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::unordered_map<uint64_t, ObjectInfo> deepSnapshot;
+    for (auto entry = deepLive.begin(); entry != deepLive.end(); ++entry) {
+        copy_objectInfo(&deepSnapshot[entry->first], entry->second);
+    }
+    double deepCopyMs = elapsed_ms(start);
+
+    // 1% of the objects are handed out to the call that takes the snapshot,
+    // and changed after it.
+    start_call();
+    std::unordered_map<uint64_t, ObjectInfo *> lent;
+    for (uint64_t handle = 1; handle <= objectCount; handle += 100) {
+        lent[handle] = live.lend(handle);
+    }
+
+    start = std::chrono::steady_clock::now();
+    CopyOnWriteMap<uint64_t, ObjectInfo> snapshot;
+    snapshot.snapshot(live);
+    double snapshotMs = elapsed_ms(start);
+
+    for (auto entry = lent.begin(); entry != lent.end(); ++entry) {
+        entry->second->pCreatePacket[0] = 0;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (uint64_t handle = 51; handle <= objectCount; handle += 100) {
+        live.lend(handle)->pCreatePacket[0] = 0;
+    }
+    double changeMs = elapsed_ms(start);
+
+    bool bUnchanged = true;
+    for (uint64_t handle = 1; handle <= objectCount; handle += 50) {
+        const ObjectInfo *pInfo = static_cast<const CopyOnWriteMap<uint64_t, ObjectInfo> &>(snapshot).get(handle);
+        if (pInfo == nullptr || pInfo->pCreatePacket[0] != static_cast<char>(handle)) {
+            bUnchanged = false;
+        }
+    }
+
+    // The changes made through the objects handed out before the snapshot
+    // belong to the live map, and it keeps handing out the same objects.
+    bool bKept = true;
+    for (auto entry = lent.begin(); entry != lent.end(); ++entry) {
+        if (live.lend(entry->first) != entry->second || entry->second->pCreatePacket[0] != 0) {
+            bKept = false;
+        }
+    }
+
+    bool bFast = objectCount < kCheckedCount || snapshotMs * kMinSpeedup < deepCopyMs;
+
+    printf("%8llu objects: deep copy %9.3f ms, snapshot %8.3f ms, changing 1%% after it %8.3f ms%s%s%s\n",
+           (unsigned long long)objectCount, deepCopyMs, snapshotMs, changeMs, bUnchanged ? "" : "  SNAPSHOT CHANGED",
+           bKept ? "" : "  CHANGES LOST", bFast ? "" : "  SNAPSHOT TOO SLOW");
+
+    for (auto entry = deepSnapshot.begin(); entry != deepSnapshot.end(); ++entry) {
+        delete_objectInfo(&entry->second);
+    }
+    for (auto entry = deepLive.begin(); entry != deepLive.end(); ++entry) {
+        delete_objectInfo(&entry->second);
+    }
+    return bUnchanged && bKept && bFast;
+}
+
+// Returns false if the snapshot shares the object of a call that is still
+// running or copies the one of a call that has returned.
+bool check_running_calls() {
+    CopyOnWriteMap<uint64_t, ObjectInfo> live(copy_objectInfo, delete_objectInfo);
+    for (uint64_t handle = 1; handle <= 3; handle++) {
+        init_objectInfo(&live.add(handle), handle);
+    }
+
+    // A call on another thread gets object 1 and is still running many
+    // frames later when the snapshot is taken.
+    std::promise<ObjectInfo *> lentPromise;
+    std::promise<void> snapshotPromise;
+    std::shared_future<void> snapshotTaken = snapshotPromise.get_future().share();
+    std::thread caller([&live, &lentPromise, snapshotTaken]() {
+        start_call();
+        lentPromise.set_value(live.lend(1));
+        snapshotTaken.wait();
+    });
+    ObjectInfo *pRunning = lentPromise.get_future().get();
+
+    // A call on this thread gets object 2 and returns, the next one takes
+    // the snapshot.
+    start_call();
+    live.lend(2);
+    start_call();
+    CopyOnWriteMap<uint64_t, ObjectInfo> snapshot;
+    snapshot.snapshot(live);
+    pRunning->pCreatePacket[0] = 0;
+    snapshotPromise.set_value();
+    caller.join();
+
+    bool bCopied = snapshot.find(1)->second.pCreatePacket[0] == 1 && live.find(1)->second.pCreatePacket[0] == 0 &&
+                   &live.find(1)->second == pRunning;
+    bool bShared = &snapshot.find(2)->second == &live.find(2)->second && &snapshot.find(3)->second == &live.find(3)->second;
+    bool bPassed = vktrace_test::report(bCopied, "The object of a call still running is copied into the snapshot");
+    return vktrace_test::report(bShared, "The objects of calls that returned are shared with the snapshot") && bPassed;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    uint64_t counts[] = {100000};
+    if (!vktrace_test::read_counts(argc, argv, "[largest object count]", counts)) {
+        return 1;
+    }
+    uint64_t largestCount = counts[0];
+
+    bool bPassed = check_running_calls();
+    for (uint64_t objectCount = 1000; objectCount <= largestCount; objectCount *= 10) {
+        bPassed = measure(objectCount) && bPassed;
+    }
+    return vktrace_test::exit_code(bPassed);
+}
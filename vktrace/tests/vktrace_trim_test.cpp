@@ -0,0 +1,269 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+//-------------------------------------------------------------------------
+// Runs the trim code of the trace layer without a Vulkan driver.
+//
+// A device, a command pool with three command buffers and some large device
+// memory allocations are added to the state tracker, the way the wrappers
+// would add them. The command buffers record calls, then their pool is reset
+// and one of them records again. The frames trigger "frames-2-3:5,2" is then
+// driven by the frame counter logic of vkQueuePresentKHR, and the trace file
+// is read back. It checks that:
+//   - resetting the pool drops the calls recorded before it,
+//   - each of the two windows recreates every object once, in order, and the
+//     second one starts with a VKTRACE_TPI_MARKER_TRIM_WINDOW packet,
+//   - the state packet writer writes allocations larger than its queue,
+//   - under a memory budget, the allocations, a shader module and the
+//     updates of a descriptor set are moved to the scratch file, and read
+//     back when they are written or when the descriptor set is updated,
+//   - the pre-trim, in-trim and post-trim flags never overlap.
+//
+// None of the objects needs a call down the chain to be recreated, so the
+// device has an empty dispatch table.
+//
+// usage: vktrace_trim_test
+//-------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#include "vktrace_lib_helpers.h"
+#include "vktrace_lib_trim.h"
+#include "vktrace_vk_vk_packets.h"
+#include "vktrace_vk_packet_id.h"
+#include "vktrace_test_harness.h"
+
+extern "C" {
+#include "vktrace_filelike.h"
+#include "vktrace_platform.h"
+#include "vktrace_tracelog.h"
+#include "vktrace_trace_packet_utils.h"
+}
+
+// Defined by vktrace_lib_trace.cpp in the layer.
+static layer_device_data s_deviceData;
+static layer_instance_data s_instanceData;
+layer_device_data *mdd(void *) { return &s_deviceData; }
+layer_instance_data *mid(void *) { return &s_instanceData; }
+uint64_t getVkComputePipelineCreateInfosAdditionalSize(uint32_t, const VkComputePipelineCreateInfo *) {
+    return 0;
+}
+
+namespace {
+
+using vktrace_test::check;
+
+const int kCommandBufferCount = 3;
+const int kCallsPerRecording = 4;
+const int kMemoryCount = 4;
+const uint64_t kMemoryPacketBytes = 20 * 1024 * 1024;
+const int kFrameCount = 10;
+const uint64_t kShaderModulePacketBytes = 2 * 1024 * 1024;
+const uint32_t kDescriptorCount = 64 * 1024;
+
+vktrace_trace_packet_header *create_packet(uint16_t packetId, uint64_t bufferBytes) {
+    vktrace_trace_packet_header *pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, packetId, 0, bufferBytes);
+    vktrace_finalize_trace_packet(pHeader);
+    return pHeader;
+}
+
+// The frames trigger part of __HOOKED_vkQueuePresentKHR.
+void present() {
+    g_trimFrameCounter++;
+    if (g_trimIsInTrim && g_trimEndFrame < UINT64_MAX && g_trimFrameCounter == g_trimEndFrame + 1) {
+        trim::stop();
+    }
+    if (g_trimIsPreTrim && g_trimFrameCounter == g_trimStartFrame) {
+        trim::start();
+    }
+}
+
+std::vector<uint16_t> read_packet_ids(FILE *pFile) {
+    std::vector<uint16_t> packetIds;
+    fflush(pFile);
+    rewind(pFile);
+    FileLike *pFileLike = vktrace_FileLike_create_file(pFile);
+    vktrace_trace_packet_header *pHeader;
+    while ((pHeader = vktrace_read_trace_packet(pFileLike)) != NULL) {
+        packetIds.push_back(pHeader->packet_id);
+        vktrace_delete_trace_packet(&pHeader);
+    }
+    vktrace_FileLike_destroy(&pFileLike);
+    return packetIds;
+}
+
+}  // namespace
+
+int main() {
+    vktrace_set_global_var(VKTRACE_TRIM_TRIGGER_ENV, "frames-2-3:5,2");
+    vktrace_set_global_var(VKTRACE_TRIM_MEMORY_BUDGET_ENV, "1");
+    FILE *pTraceFile = tmpfile();
+    if (pTraceFile == NULL) {
+        printf("could not create a trace file\n");
+        return 1;
+    }
+    FileLike *pTraceFileLike = vktrace_FileLike_create_file(pTraceFile);
+    vktrace_trace_set_trace_file(pTraceFileLike);
+
+    trim::initialize();
+    check(g_trimEnabled && g_trimIsPreTrim && g_trimStartFrame == 2 && g_trimEndFrame == 3, "the frames trigger is parsed");
+
+    VkDevice device = reinterpret_cast<VkDevice>(0x1000);
+    VkCommandPool commandPool = reinterpret_cast<VkCommandPool>(0x2000);
+    trim::ObjectInfo &deviceInfo = trim::add_Device_object(device);
+    deviceInfo.ObjectInfo.Device.pCreatePacket = create_packet(VKTRACE_TPI_VK_vkCreateDevice, 0);
+
+    trim::ObjectInfo &poolInfo = trim::add_CommandPool_object(commandPool);
+    poolInfo.belongsToDevice = device;
+    poolInfo.ObjectInfo.CommandPool.pCreatePacket = create_packet(VKTRACE_TPI_VK_vkCreateCommandPool, 0);
+    poolInfo.ObjectInfo.CommandPool.numCommandBuffersAllocated[VK_COMMAND_BUFFER_LEVEL_PRIMARY] = kCommandBufferCount;
+
+    VkCommandBuffer commandBuffers[kCommandBufferCount];
+    for (int i = 0; i < kCommandBufferCount; i++) {
+        commandBuffers[i] = reinterpret_cast<VkCommandBuffer>(0x3000 + i * 0x10);
+        trim::ObjectInfo &info = trim::add_CommandBuffer_object(commandBuffers[i]);
+        info.belongsToDevice = device;
+        info.ObjectInfo.CommandBuffer.commandPool = commandPool;
+        info.ObjectInfo.CommandBuffer.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        for (int call = 0; call < kCallsPerRecording; call++) {
+            trim::add_CommandBuffer_call(commandBuffers[i], create_packet(VKTRACE_TPI_VK_vkCmdDraw, 0));
+        }
+    }
+
+    // Only the call recorded after the reset should be written.
+    trim::reset_CommandPool(commandPool);
+    check(trim::get_CommandBuffer_objectInfo(commandBuffers[1]) != NULL, "resetting a pool keeps its command buffers");
+    trim::add_CommandBuffer_call(commandBuffers[0], create_packet(VKTRACE_TPI_VK_vkCmdDraw, 0));
+
+    // Together these are larger than the queue of the state packet writer.
+    for (int i = 0; i < kMemoryCount; i++) {
+        trim::ObjectInfo &info = trim::add_DeviceMemory_object(reinterpret_cast<VkDeviceMemory>(0x4000 + i * 0x10));
+        info.belongsToDevice = device;
+        info.ObjectInfo.DeviceMemory.pCreatePacket = create_packet(VKTRACE_TPI_VK_vkAllocateMemory, kMemoryPacketBytes);
+    }
+
+    VkShaderModule shaderModule = reinterpret_cast<VkShaderModule>(0x5000);
+    trim::ObjectInfo &moduleInfo = trim::add_ShaderModule_object(shaderModule);
+    moduleInfo.belongsToDevice = device;
+    moduleInfo.ObjectInfo.ShaderModule.pCreatePacket =
+        create_packet(VKTRACE_TPI_VK_vkCreateShaderModule, kShaderModulePacketBytes);
+
+    VkDescriptorSet descriptorSet = reinterpret_cast<VkDescriptorSet>(0x6000);
+    trim::ObjectInfo &setInfo = trim::add_DescriptorSet_object(descriptorSet);
+    setInfo.belongsToDevice = device;
+    setInfo.ObjectInfo.DescriptorSet.numBindings = 1;
+    setInfo.ObjectInfo.DescriptorSet.writeDescriptorCount = 1;
+    setInfo.ObjectInfo.DescriptorSet.pWriteDescriptorSets = new VkWriteDescriptorSet[1]();
+    setInfo.ObjectInfo.DescriptorSet.pCopyDescriptorSets = new VkCopyDescriptorSet[1]();
+    VkWriteDescriptorSet &write = setInfo.ObjectInfo.DescriptorSet.pWriteDescriptorSets[0];
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptorSet;
+    write.descriptorCount = kDescriptorCount;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    VkDescriptorImageInfo *pImageInfo = new VkDescriptorImageInfo[kDescriptorCount]();
+    for (uint32_t i = 0; i < kDescriptorCount; i++) {
+        pImageInfo[i].imageView = reinterpret_cast<VkImageView>(0x7000 + i * 0x10);
+    }
+    write.pImageInfo = pImageInfo;
+
+    // The first check packs the descriptor set, the second one spills what
+    // was kept before the first, and the third one the descriptor set.
+    for (int i = 0; i < 3; i++) {
+        trim::check_memory_budget();
+        Sleep(1);
+    }
+
+    int windowCount = 0;
+    for (int frame = 0; frame < kFrameCount; frame++) {
+        bool wasInTrim = g_trimIsInTrim;
+        present();
+        if (!wasInTrim && g_trimIsInTrim) {
+            windowCount++;
+        }
+        check(!(g_trimIsPreTrim && g_trimIsInTrim) && !(g_trimIsPreTrim && g_trimIsPostTrim) &&
+                  !(g_trimIsInTrim && g_trimIsPostTrim),
+              "the trim phases don't overlap");
+    }
+    check(windowCount == 2, "both frame ranges are trimmed");
+    check(g_trimAlreadyFinished && g_trimIsPostTrim, "trimming finishes after the last frame range");
+
+    std::vector<uint16_t> packetIds = read_packet_ids(pTraceFile);
+    std::map<uint16_t, int> packetCounts;
+    for (size_t i = 0; i < packetIds.size(); i++) {
+        packetCounts[packetIds[i]]++;
+    }
+    check(packetCounts[VKTRACE_TPI_MARKER_TRIM_WINDOW] == 1, "one window marker is written");
+    check(packetCounts[VKTRACE_TPI_VK_vkCreateDevice] == 2, "each window creates the device");
+    check(packetCounts[VKTRACE_TPI_VK_vkCreateCommandPool] == 2, "each window creates the command pool");
+    check(packetCounts[VKTRACE_TPI_VK_vkAllocateCommandBuffers] == 2, "each window allocates the command buffers");
+    check(packetCounts[VKTRACE_TPI_VK_vkAllocateMemory] == 2 * kMemoryCount, "each window allocates the memory");
+    check(packetCounts[VKTRACE_TPI_VK_vkCmdDraw] == 2, "each window records the calls made after the pool reset");
+    check(packetCounts[VKTRACE_TPI_VK_vkCreateShaderModule] == 2, "each window creates the shader module");
+    check(packetCounts[VKTRACE_TPI_VK_vkUpdateDescriptorSets] == 2, "each window updates the descriptor set");
+
+    // The state packets of the second window follow its marker.
+    size_t marker = 0;
+    while (marker < packetIds.size() && packetIds[marker] != VKTRACE_TPI_MARKER_TRIM_WINDOW) {
+        marker++;
+    }
+    check(!packetIds.empty() && packetIds[0] == VKTRACE_TPI_VK_vkCreateDevice, "the first window starts with the device");
+    check(marker + 1 < packetIds.size() && packetIds[marker + 1] == VKTRACE_TPI_VK_vkCreateDevice,
+          "the second window starts with the device");
+
+    trim::ObjectInfo *pSetInfo = trim::get_DescriptorSet_objectInfo(descriptorSet);
+    check(pSetInfo != NULL && pSetInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets != NULL &&
+              pSetInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[0].descriptorCount == kDescriptorCount &&
+              pSetInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[0].pImageInfo[kDescriptorCount - 1].imageView ==
+                  reinterpret_cast<VkImageView>(0x7000 + (kDescriptorCount - 1) * 0x10),
+          "the updates of the descriptor set are read back when it is updated");
+
+    // A snapshot copies what was handed out to the call that takes it, since
+    // that call may still change it, and shares what earlier calls got.
+    {
+        trim::StateTracker live;
+        VkFence oldFence = reinterpret_cast<VkFence>(0x8000);
+        VkFence newFence = reinterpret_cast<VkFence>(0x8010);
+        vktrace_trace_packet_header *pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCreateFence, 0, 0);
+        vktrace_delete_trace_packet(&pHeader);
+        live.add_Fence(oldFence).ObjectInfo.Fence.signaled = true;
+        pHeader = vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_VK_vkCreateFence, 0, 0);
+        vktrace_delete_trace_packet(&pHeader);
+        trim::ObjectInfo &newFenceInfo = live.add_Fence(newFence);
+        trim::StateTracker snapshot;
+        snapshot.snapshot(live);
+        newFenceInfo.ObjectInfo.Fence.signaled = true;
+        check(!snapshot.createdFences.find(newFence)->second.ObjectInfo.Fence.signaled,
+              "a snapshot doesn't see changes to objects handed out to the running call");
+        check(live.createdFences.find(newFence)->second.ObjectInfo.Fence.signaled,
+              "changes to objects handed out before a snapshot stay in the live state tracker");
+        check(&snapshot.createdFences.find(oldFence)->second == &live.createdFences.find(oldFence)->second,
+              "a snapshot shares objects handed out to calls that returned");
+    }
+
+    trim::deinitialize();
+    vktrace_FileLike_destroy(&pTraceFileLike);
+    fclose(pTraceFile);
+
+    if (vktrace_test::failure_count() > 0) {
+        printf("%d checks failed\n", vktrace_test::failure_count());
+        return 1;
+    }
+    printf("%zu packets written, all checks passed\n", packetIds.size());
+    return 0;
+}
@@ -0,0 +1,689 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrace_block_file.h"
+
+#include <string.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "vktrace_trace_packet_identifiers.h"
+#include "vktrace_tracelog.h"
+}
+
+// ------------------------------------------------------------------------------------------------
+// Block codec
+//
+// Output follows the LZ4 block format: a sequence of (token, literals, match) records where the
+// token holds the literal count and match length in 4 bits each (15 meaning more length bytes
+// follow), matches are a 16 bit backwards offset and at least 4 bytes long, and the last
+// kLastLiterals bytes of a block are always literals. The compressor is a single pass greedy
+// matcher with one hash table slot per 4 byte prefix.
+// ------------------------------------------------------------------------------------------------
+static const uint32_t kHashLog = 16;
+static const uint32_t kMinMatch = 4;
+static const uint32_t kLastLiterals = 5;
+static const uint32_t kMatchSearchLimit = 12;  // a match may not start in the last 12 bytes
+static const uint32_t kMaxOffset = 65535;
+static const uint32_t kSkipTrigger = 6;
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) { return (v * 2654435761U) >> (32 - kHashLog); }
+
+// Writes the extra length bytes for a length that didn't fit in its 4 bit token field.
+static inline uint8_t* write_length(uint8_t* op, uint64_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static inline uint64_t sequence_bound(uint64_t literalCount, uint64_t matchLength) {
+    return 1 + literalCount + (literalCount / 255 + 1) + 2 + (matchLength / 255 + 1);
+}
+
+uint64_t vktrace_block_compress_bound(uint64_t srcSize) { return srcSize + srcSize / 255 + 16; }
+
+uint64_t vktrace_block_compress(const void* src, uint64_t srcSize, void* dst, uint64_t dstCapacity) {
+    const uint8_t* const base = (const uint8_t*)src;
+    uint8_t* const dstBase = (uint8_t*)dst;
+    uint8_t* const dstEnd = dstBase + dstCapacity;
+    uint8_t* op = dstBase;
+    uint64_t anchor = 0;
+
+    if (srcSize > kMatchSearchLimit) {
+        std::vector<uint32_t> table((size_t)1 << kHashLog, 0);
+        const uint64_t matchStartLimit = srcSize - kMatchSearchLimit;
+        const uint64_t matchEndLimit = srcSize - kLastLiterals;
+        uint64_t ip = 0;
+        uint32_t searchCount = 1 << kSkipTrigger;
+
+        while (ip < matchStartLimit) {
+            uint32_t sequence = read32(base + ip);
+            uint32_t h = hash32(sequence);
+            uint64_t candidate = table[h];
+            table[h] = (uint32_t)ip;
+
+            if (candidate >= ip || ip - candidate > kMaxOffset || read32(base + candidate) != sequence) {
+                // Step further ahead the longer nothing has matched, so incompressible data goes quickly.
+                ip += searchCount++ >> kSkipTrigger;
+                continue;
+            }
+            searchCount = 1 << kSkipTrigger;
+
+            while (ip > anchor && candidate > 0 && base[ip - 1] == base[candidate - 1]) {
+                ip--;
+                candidate--;
+            }
+            uint64_t matchLength = kMinMatch;
+            while (ip + matchLength < matchEndLimit && base[candidate + matchLength] == base[ip + matchLength]) {
+                matchLength++;
+            }
+
+            uint64_t literalCount = ip - anchor;
+            if ((uint64_t)(dstEnd - op) < sequence_bound(literalCount, matchLength)) {
+                return 0;
+            }
+
+            uint8_t* token = op++;
+            *token = (uint8_t)((literalCount >= 15 ? 15 : literalCount) << 4);
+            if (literalCount >= 15) {
+                op = write_length(op, literalCount - 15);
+            }
+            memcpy(op, base + anchor, (size_t)literalCount);
+            op += literalCount;
+
+            uint16_t offset = (uint16_t)(ip - candidate);
+            op[0] = (uint8_t)(offset & 0xff);
+            op[1] = (uint8_t)(offset >> 8);
+            op += 2;
+
+            uint64_t extraLength = matchLength - kMinMatch;
+            *token |= (uint8_t)(extraLength >= 15 ? 15 : extraLength);
+            if (extraLength >= 15) {
+                op = write_length(op, extraLength - 15);
+            }
+
+            ip += matchLength;
+            anchor = ip;
+            if (ip < matchStartLimit) {
+                // Remember a position inside the match so runs of repeated data chain together.
+                table[hash32(read32(base + ip - 2))] = (uint32_t)(ip - 2);
+            }
+        }
+    }
+
+    uint64_t literalCount = srcSize - anchor;
+    if ((uint64_t)(dstEnd - op) < 1 + literalCount + (literalCount / 255 + 1)) {
+        return 0;
+    }
+    *op++ = (uint8_t)((literalCount >= 15 ? 15 : literalCount) << 4);
+    if (literalCount >= 15) {
+        op = write_length(op, literalCount - 15);
+    }
+    memcpy(op, base + anchor, (size_t)literalCount);
+    op += literalCount;
+
+    return (uint64_t)(op - dstBase);
+}
+
+// Reads the extra length bytes that follow a token field of 15.
+static inline BOOL read_length(const uint8_t** pIp, const uint8_t* ipEnd, uint64_t* pLength) {
+    const uint8_t* ip = *pIp;
+    uint8_t b;
+    do {
+        if (ip >= ipEnd) {
+            return FALSE;
+        }
+        b = *ip++;
+        *pLength += b;
+    } while (b == 255);
+    *pIp = ip;
+    return TRUE;
+}
+
+BOOL vktrace_block_decompress(const void* src, uint64_t srcSize, void* dst, uint64_t dstSize) {
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* const ipEnd = ip + srcSize;
+    uint8_t* const dstBase = (uint8_t*)dst;
+    uint8_t* op = dstBase;
+    uint8_t* const opEnd = dstBase + dstSize;
+
+    while (ip < ipEnd) {
+        uint8_t token = *ip++;
+
+        uint64_t literalCount = token >> 4;
+        if (literalCount == 15 && !read_length(&ip, ipEnd, &literalCount)) {
+            return FALSE;
+        }
+        if (literalCount > (uint64_t)(ipEnd - ip) || literalCount > (uint64_t)(opEnd - op)) {
+            return FALSE;
+        }
+        memcpy(op, ip, (size_t)literalCount);
+        ip += literalCount;
+        op += literalCount;
+
+        if (ip == ipEnd) {
+            // The last sequence only has literals.
+            break;
+        }
+
+        if (ipEnd - ip < 2) {
+            return FALSE;
+        }
+        uint64_t offset = (uint64_t)ip[0] | ((uint64_t)ip[1] << 8);
+        ip += 2;
+        uint64_t matchLength = token & 0xf;
+        if (matchLength == 15 && !read_length(&ip, ipEnd, &matchLength)) {
+            return FALSE;
+        }
+        matchLength += kMinMatch;
+        if (offset == 0 || offset > (uint64_t)(op - dstBase) || matchLength > (uint64_t)(opEnd - op)) {
+            return FALSE;
+        }
+
+        // Matches may overlap the bytes they produce, so copy forwards one byte at a time
+        // unless the source is far enough back.
+        const uint8_t* match = op - offset;
+        if (offset >= matchLength) {
+            memcpy(op, match, (size_t)matchLength);
+            op += matchLength;
+        } else {
+            for (uint64_t i = 0; i < matchLength; i++) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (op == opEnd) ? TRUE : FALSE;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writer
+// ------------------------------------------------------------------------------------------------
+struct vktrace_block_writer {
+    FILE* pFile;
+    uint64_t dataOffset;
+    uint64_t fileOffset;
+    uint64_t logicalPosition;
+    uint32_t blockSize;
+    std::vector<uint8_t> block;
+    size_t blockUsed;
+    std::vector<uint8_t> compressed;
+    std::vector<vktrace_block_index_entry> index;
+    bool finished;
+    bool writeError;
+};
+
+static BOOL block_writer_store(vktrace_block_writer* pWriter, const uint8_t* pData, uint64_t size) {
+    vktrace_block_index_entry entry;
+    entry.fileOffset = pWriter->fileOffset;
+    entry.flags = VKTRACE_BLOCK_COMPRESSED;
+
+    uint64_t compressedSize = vktrace_block_compress(pData, size, pWriter->compressed.data(), pWriter->compressed.size());
+    if (compressedSize == 0 || compressedSize >= size) {
+        compressedSize = size;
+        entry.flags = 0;
+    } else {
+        pData = pWriter->compressed.data();
+    }
+    entry.storedSize = (uint32_t)compressedSize;
+
+    if (fwrite(pData, 1, (size_t)compressedSize, pWriter->pFile) != compressedSize) {
+        vktrace_LogError("Failed to write compressed block %llu to the trace file.", (unsigned long long)pWriter->index.size());
+        pWriter->writeError = true;
+        return FALSE;
+    }
+    pWriter->fileOffset += compressedSize;
+    pWriter->index.push_back(entry);
+    return TRUE;
+}
+
+vktrace_block_writer* vktrace_block_writer_create(FILE* pFile, uint64_t dataOffset, uint32_t blockSize) {
+    if (blockSize == 0) {
+        blockSize = VKTRACE_BLOCK_FILE_DEFAULT_BLOCK_SIZE;
+    }
+    if (pFile == NULL || blockSize > VKTRACE_BLOCK_FILE_MAX_BLOCK_SIZE) {
+        return NULL;
+    }
+
+    vktrace_block_writer* pWriter = new vktrace_block_writer();
+    pWriter->pFile = pFile;
+    pWriter->dataOffset = dataOffset;
+    pWriter->fileOffset = dataOffset;
+    pWriter->logicalPosition = dataOffset;
+    pWriter->blockSize = blockSize;
+    pWriter->block.resize(blockSize);
+    pWriter->blockUsed = 0;
+    pWriter->compressed.resize((size_t)vktrace_block_compress_bound(blockSize));
+    pWriter->finished = false;
+    pWriter->writeError = false;
+    return pWriter;
+}
+
+BOOL vktrace_block_writer_write(vktrace_block_writer* pWriter, const void* _bytes, uint64_t _len) {
+    assert(!pWriter->finished);
+    const uint8_t* pBytes = (const uint8_t*)_bytes;
+    pWriter->logicalPosition += _len;
+
+    while (_len > 0) {
+        if (pWriter->blockUsed == 0 && _len >= pWriter->blockSize) {
+            // Whole blocks are compressed straight from the caller's buffer.
+            if (!block_writer_store(pWriter, pBytes, pWriter->blockSize)) {
+                return FALSE;
+            }
+            pBytes += pWriter->blockSize;
+            _len -= pWriter->blockSize;
+            continue;
+        }
+
+        size_t count = pWriter->blockSize - pWriter->blockUsed;
+        if (count > _len) {
+            count = (size_t)_len;
+        }
+        memcpy(pWriter->block.data() + pWriter->blockUsed, pBytes, count);
+        pWriter->blockUsed += count;
+        pBytes += count;
+        _len -= count;
+
+        if (pWriter->blockUsed == pWriter->blockSize) {
+            pWriter->blockUsed = 0;
+            if (!block_writer_store(pWriter, pWriter->block.data(), pWriter->blockSize)) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+uint64_t vktrace_block_writer_get_position(vktrace_block_writer* pWriter) { return pWriter->logicalPosition; }
+
+BOOL vktrace_block_writer_finish(vktrace_block_writer* pWriter) {
+    if (pWriter->finished) {
+        return pWriter->writeError ? FALSE : TRUE;
+    }
+    pWriter->finished = true;
+
+    if (pWriter->blockUsed > 0) {
+        if (!block_writer_store(pWriter, pWriter->block.data(), pWriter->blockUsed)) {
+            return FALSE;
+        }
+        pWriter->blockUsed = 0;
+    }
+
+    vktrace_block_file_footer footer;
+    footer.indexOffset = pWriter->fileOffset;
+    footer.blockCount = pWriter->index.size();
+    footer.dataOffset = pWriter->dataOffset;
+    footer.logicalLength = pWriter->logicalPosition;
+    footer.blockSize = pWriter->blockSize;
+    footer.reserved = 0;
+    footer.magic = VKTRACE_BLOCK_FILE_MAGIC;
+
+    if ((!pWriter->index.empty() &&
+         fwrite(pWriter->index.data(), sizeof(vktrace_block_index_entry), pWriter->index.size(), pWriter->pFile) !=
+             pWriter->index.size()) ||
+        fwrite(&footer, sizeof(footer), 1, pWriter->pFile) != 1) {
+        vktrace_LogError("Failed to write the block index to the trace file.");
+        pWriter->writeError = true;
+        return FALSE;
+    }
+    fflush(pWriter->pFile);
+
+    vktrace_LogVerbose("Compressed %llu bytes of trace packets into %llu bytes in %llu blocks.",
+                       (unsigned long long)(pWriter->logicalPosition - pWriter->dataOffset),
+                       (unsigned long long)(pWriter->fileOffset - pWriter->dataOffset), (unsigned long long)footer.blockCount);
+    return pWriter->writeError ? FALSE : TRUE;
+}
+
+void vktrace_block_writer_destroy(vktrace_block_writer** ppWriter) {
+    if (ppWriter == NULL || *ppWriter == NULL) {
+        return;
+    }
+    vktrace_block_writer_finish(*ppWriter);
+    delete *ppWriter;
+    *ppWriter = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reader
+//
+// Decoded blocks live in a handful of slots. The slot holding the block being read is pinned;
+// the others hold blocks queued for, or already done by, the worker thread. Every block the
+// caller moves into queues the next kReadAheadBlocks blocks, so a sequential reader normally
+// finds its next block already decoded.
+// ------------------------------------------------------------------------------------------------
+static const uint32_t kReadAheadBlocks = 2;
+static const uint32_t kSlotCount = kReadAheadBlocks + 2;
+
+enum BlockSlotState { BlockSlotEmpty, BlockSlotQueued, BlockSlotReady, BlockSlotFailed };
+
+struct BlockSlot {
+    std::vector<uint8_t> data;
+    uint64_t block;
+    BlockSlotState state;
+    uint64_t lastUse;
+};
+
+struct vktrace_block_reader {
+    FILE* pFile;
+    std::mutex fileMutex;
+    vktrace_block_file_footer footer;
+    std::vector<vktrace_block_index_entry> index;
+
+    std::mutex mutex;
+    std::condition_variable blockQueued;
+    std::condition_variable blockDone;
+    std::deque<uint32_t> queue;
+    std::thread worker;
+    bool stopWorker;
+
+    BlockSlot slots[kSlotCount];
+    int32_t current;
+    uint64_t useCounter;
+
+    // Statistics
+    uint64_t blocksRequested;
+    uint64_t blocksWaitedFor;
+};
+
+static uint64_t block_reader_block_size(vktrace_block_reader* pReader, uint64_t block) {
+    uint64_t start = pReader->footer.dataOffset + block * pReader->footer.blockSize;
+    uint64_t remaining = pReader->footer.logicalLength - start;
+    return (remaining < pReader->footer.blockSize) ? remaining : pReader->footer.blockSize;
+}
+
+static bool block_reader_load(vktrace_block_reader* pReader, uint64_t block, std::vector<uint8_t>& data,
+                              std::vector<uint8_t>& compressed) {
+    const vktrace_block_index_entry& entry = pReader->index[(size_t)block];
+    uint64_t size = block_reader_block_size(pReader, block);
+    bool isCompressed = (entry.flags & VKTRACE_BLOCK_COMPRESSED) != 0;
+    if (!isCompressed && entry.storedSize != size) {
+        return false;
+    }
+
+    data.resize((size_t)size);
+    uint8_t* pTarget = data.data();
+    if (isCompressed) {
+        compressed.resize(entry.storedSize);
+        pTarget = compressed.data();
+    }
+    {
+        std::lock_guard<std::mutex> lock(pReader->fileMutex);
+        if (Fseek(pReader->pFile, entry.fileOffset, SEEK_SET) != 0 ||
+            fread(pTarget, 1, entry.storedSize, pReader->pFile) != entry.storedSize) {
+            return false;
+        }
+    }
+    return !isCompressed || vktrace_block_decompress(compressed.data(), entry.storedSize, data.data(), size);
+}
+
+static void block_reader_worker(vktrace_block_reader* pReader) {
+    std::vector<uint8_t> compressed;
+    std::unique_lock<std::mutex> lock(pReader->mutex);
+    for (;;) {
+        pReader->blockQueued.wait(lock, [pReader] { return pReader->stopWorker || !pReader->queue.empty(); });
+        if (pReader->stopWorker) {
+            break;
+        }
+        uint32_t slotIndex = pReader->queue.front();
+        pReader->queue.pop_front();
+        BlockSlot& slot = pReader->slots[slotIndex];
+        uint64_t block = slot.block;
+
+        // The slot's data belongs to this thread until its state leaves BlockSlotQueued.
+        lock.unlock();
+        bool loaded = block_reader_load(pReader, block, slot.data, compressed);
+        lock.lock();
+
+        if (!loaded) {
+            vktrace_LogError("Failed to read block %llu of the compressed trace file.", (unsigned long long)block);
+        }
+        slot.state = loaded ? BlockSlotReady : BlockSlotFailed;
+        pReader->blockDone.notify_all();
+    }
+}
+
+static int32_t block_reader_find_slot_locked(vktrace_block_reader* pReader, uint64_t block) {
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        if (pReader->slots[i].state != BlockSlotEmpty && pReader->slots[i].block == block) {
+            return (int32_t)i;
+        }
+    }
+    return -1;
+}
+
+// Picks the least recently used slot that is neither pinned nor owned by the worker.
+static int32_t block_reader_free_slot_locked(vktrace_block_reader* pReader, uint64_t keepFirst, uint64_t keepLast) {
+    int32_t found = -1;
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        BlockSlot& slot = pReader->slots[i];
+        if ((int32_t)i == pReader->current || slot.state == BlockSlotQueued) {
+            continue;
+        }
+        if (slot.state == BlockSlotReady && slot.block >= keepFirst && slot.block <= keepLast) {
+            continue;
+        }
+        if (found < 0 || slot.state == BlockSlotEmpty || slot.lastUse < pReader->slots[found].lastUse) {
+            found = (int32_t)i;
+            if (slot.state == BlockSlotEmpty) {
+                break;
+            }
+        }
+    }
+    return found;
+}
+
+static void block_reader_queue_locked(vktrace_block_reader* pReader, uint32_t slotIndex, uint64_t block, bool urgent) {
+    BlockSlot& slot = pReader->slots[slotIndex];
+    slot.block = block;
+    slot.state = BlockSlotQueued;
+    slot.lastUse = ++pReader->useCounter;
+    if (urgent) {
+        pReader->queue.push_front(slotIndex);
+    } else {
+        pReader->queue.push_back(slotIndex);
+    }
+    pReader->blockQueued.notify_one();
+}
+
+// Returns the decoded data of a block and pins it until the next call.
+static const uint8_t* block_reader_acquire(vktrace_block_reader* pReader, uint64_t block) {
+    std::unique_lock<std::mutex> lock(pReader->mutex);
+
+    if (pReader->current >= 0 && pReader->slots[pReader->current].block == block &&
+        pReader->slots[pReader->current].state == BlockSlotReady) {
+        return pReader->slots[pReader->current].data.data();
+    }
+
+    pReader->blocksRequested++;
+    pReader->current = -1;
+    int32_t slotIndex = block_reader_find_slot_locked(pReader, block);
+    if (slotIndex < 0 || pReader->slots[slotIndex].state == BlockSlotFailed) {
+        if (slotIndex < 0) {
+            pReader->blockDone.wait(lock, [pReader, block, &slotIndex] {
+                slotIndex = block_reader_free_slot_locked(pReader, block, block);
+                return slotIndex >= 0;
+            });
+        }
+        block_reader_queue_locked(pReader, (uint32_t)slotIndex, block, true);
+    }
+    pReader->current = slotIndex;
+
+    BlockSlot& slot = pReader->slots[slotIndex];
+    if (slot.state == BlockSlotQueued) {
+        pReader->blocksWaitedFor++;
+        pReader->blockDone.wait(lock, [&slot] { return slot.state != BlockSlotQueued; });
+    }
+    if (slot.state != BlockSlotReady) {
+        slot.state = BlockSlotEmpty;
+        pReader->current = -1;
+        return NULL;
+    }
+    slot.lastUse = ++pReader->useCounter;
+
+    uint64_t lastBlock = block + kReadAheadBlocks;
+    if (lastBlock >= pReader->footer.blockCount) {
+        lastBlock = pReader->footer.blockCount - 1;
+    }
+    for (uint64_t next = block + 1; next <= lastBlock; next++) {
+        if (block_reader_find_slot_locked(pReader, next) >= 0) {
+            continue;
+        }
+        int32_t freeSlot = block_reader_free_slot_locked(pReader, block, lastBlock);
+        if (freeSlot < 0) {
+            break;
+        }
+        block_reader_queue_locked(pReader, (uint32_t)freeSlot, next, false);
+    }
+
+    return slot.data.data();
+}
+
+vktrace_block_reader* vktrace_block_reader_create(FILE* pFile) {
+    if (pFile == NULL) {
+        return NULL;
+    }
+
+    uint16_t version = 0;
+    vktrace_block_file_footer footer;
+    int64_t fileLength = -1;
+    if (Fseek(pFile, 0, SEEK_SET) != 0 || fread(&version, sizeof(version), 1, pFile) != 1 ||
+        !VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(version) || Fseek(pFile, 0, SEEK_END) != 0 ||
+        (fileLength = Ftell(pFile)) < (int64_t)sizeof(footer) || Fseek(pFile, -(int64_t)sizeof(footer), SEEK_END) != 0 ||
+        fread(&footer, sizeof(footer), 1, pFile) != 1) {
+        rewind(pFile);
+        return NULL;
+    }
+
+    uint64_t dataLength = (footer.logicalLength >= footer.dataOffset) ? footer.logicalLength - footer.dataOffset : 0;
+    if (footer.magic != VKTRACE_BLOCK_FILE_MAGIC || footer.blockSize == 0 || footer.blockSize > VKTRACE_BLOCK_FILE_MAX_BLOCK_SIZE ||
+        footer.logicalLength < footer.dataOffset || footer.indexOffset < footer.dataOffset ||
+        footer.blockCount != (dataLength + footer.blockSize - 1) / footer.blockSize ||
+        footer.indexOffset + footer.blockCount * sizeof(vktrace_block_index_entry) + sizeof(footer) != (uint64_t)fileLength) {
+        vktrace_LogError("Compressed trace file has an invalid block index.");
+        rewind(pFile);
+        return NULL;
+    }
+
+    vktrace_block_reader* pReader = new vktrace_block_reader();
+    pReader->pFile = pFile;
+    pReader->footer = footer;
+    pReader->index.resize((size_t)footer.blockCount);
+    if (footer.blockCount > 0 && (Fseek(pFile, footer.indexOffset, SEEK_SET) != 0 ||
+                                  fread(pReader->index.data(), sizeof(vktrace_block_index_entry), pReader->index.size(), pFile) !=
+                                      pReader->index.size())) {
+        vktrace_LogError("Failed to read the block index of the compressed trace file.");
+        delete pReader;
+        rewind(pFile);
+        return NULL;
+    }
+    for (size_t i = 0; i < pReader->index.size(); i++) {
+        const vktrace_block_index_entry& entry = pReader->index[i];
+        if (entry.fileOffset < footer.dataOffset || entry.fileOffset + entry.storedSize > footer.indexOffset) {
+            vktrace_LogError("Compressed trace file has an invalid entry for block %llu.", (unsigned long long)i);
+            delete pReader;
+            rewind(pFile);
+            return NULL;
+        }
+    }
+    rewind(pFile);
+
+    for (uint32_t i = 0; i < kSlotCount; i++) {
+        pReader->slots[i].block = 0;
+        pReader->slots[i].state = BlockSlotEmpty;
+        pReader->slots[i].lastUse = 0;
+    }
+    pReader->current = -1;
+    pReader->useCounter = 0;
+    pReader->stopWorker = false;
+    pReader->blocksRequested = 0;
+    pReader->blocksWaitedFor = 0;
+    pReader->worker = std::thread(block_reader_worker, pReader);
+    return pReader;
+}
+
+uint64_t vktrace_block_reader_get_length(vktrace_block_reader* pReader) { return pReader->footer.logicalLength; }
+
+BOOL vktrace_block_reader_read(vktrace_block_reader* pReader, uint64_t _offset, void* _bytes, uint64_t _len) {
+    const vktrace_block_file_footer& footer = pReader->footer;
+    if (_offset > footer.logicalLength || _len > footer.logicalLength - _offset) {
+        return FALSE;
+    }
+
+    uint8_t* pBytes = (uint8_t*)_bytes;
+    while (_len > 0) {
+        uint64_t count;
+        if (_offset < footer.dataOffset) {
+            // The file header is stored uncompressed at the same offset.
+            count = footer.dataOffset - _offset;
+            if (count > _len) {
+                count = _len;
+            }
+            std::lock_guard<std::mutex> lock(pReader->fileMutex);
+            if (Fseek(pReader->pFile, _offset, SEEK_SET) != 0 || fread(pBytes, 1, (size_t)count, pReader->pFile) != count) {
+                return FALSE;
+            }
+        } else {
+            uint64_t block = (_offset - footer.dataOffset) / footer.blockSize;
+            uint64_t offsetInBlock = (_offset - footer.dataOffset) % footer.blockSize;
+            const uint8_t* pBlock = block_reader_acquire(pReader, block);
+            if (pBlock == NULL) {
+                return FALSE;
+            }
+            count = block_reader_block_size(pReader, block) - offsetInBlock;
+            if (count > _len) {
+                count = _len;
+            }
+            memcpy(pBytes, pBlock + offsetInBlock, (size_t)count);
+        }
+        pBytes += count;
+        _offset += count;
+        _len -= count;
+    }
+    return TRUE;
+}
+
+void vktrace_block_reader_destroy(vktrace_block_reader** ppReader) {
+    if (ppReader == NULL || *ppReader == NULL) {
+        return;
+    }
+    vktrace_block_reader* pReader = *ppReader;
+    {
+        std::lock_guard<std::mutex> lock(pReader->mutex);
+        pReader->stopWorker = true;
+    }
+    pReader->blockQueued.notify_one();
+    pReader->worker.join();
+
+    vktrace_LogVerbose("Compressed trace reader switched blocks %llu times and waited for a block %llu times.",
+                       (unsigned long long)pReader->blocksRequested, (unsigned long long)pReader->blocksWaitedFor);
+    delete pReader;
+    *ppReader = NULL;
+}
@@ -0,0 +1,113 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include "vktrace_common.h"
+
+// Block compressed trace files (VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED).
+//
+// The uncompressed trace file is treated as a logical byte stream. The file
+// header and gpu info (everything before first_packet_offset) are stored
+// as is, so the header can still be read and patched in place. Everything
+// after that is cut into blocks of blockSize bytes (the last block may be
+// shorter) and each block is compressed on its own, so any block can be
+// decoded without reading the ones before it:
+//
+//   [file header + gpu info][block 0]...[block N-1][block index][footer]
+//
+// The block index has one vktrace_block_index_entry per block and the
+// footer is the last thing in the file, much like the portability table.
+// Logical offset X (X >= dataOffset) lives in block (X - dataOffset) /
+// blockSize, so readers can seek anywhere with one index lookup. All file
+// offsets a reader sees - first_packet_offset, the portability table and
+// packet bookmarks - are logical offsets, so they mean the same thing in
+// both formats.
+//
+// Blocks are compressed with an LZ4 compatible block codec. A block that
+// doesn't get smaller is stored uncompressed.
+
+#define VKTRACE_BLOCK_FILE_MAGIC 0x4B434F4C42545656ULL  // "VVTBLOCK"
+#define VKTRACE_BLOCK_FILE_DEFAULT_BLOCK_SIZE (1024 * 1024)
+#define VKTRACE_BLOCK_FILE_MAX_BLOCK_SIZE (64 * 1024 * 1024)
+
+// vktrace_block_index_entry.flags
+#define VKTRACE_BLOCK_COMPRESSED 0x1
+
+typedef struct vktrace_block_index_entry {
+    uint64_t fileOffset;
+    uint32_t storedSize;
+    uint32_t flags;
+} vktrace_block_index_entry;
+
+typedef struct vktrace_block_file_footer {
+    uint64_t indexOffset;    // file offset of the first vktrace_block_index_entry
+    uint64_t blockCount;
+    uint64_t dataOffset;     // logical (and file) offset of the first block
+    uint64_t logicalLength;  // size of the uncompressed trace file
+    uint32_t blockSize;
+    uint32_t reserved;
+    uint64_t magic;
+} vktrace_block_file_footer;
+
+typedef struct vktrace_block_writer vktrace_block_writer;
+typedef struct vktrace_block_reader vktrace_block_reader;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Worst case size of vktrace_block_compress output for srcSize bytes of input.
+uint64_t vktrace_block_compress_bound(uint64_t srcSize);
+
+// Compresses src into dst. Returns the compressed size, or 0 if the result would not fit in dstCapacity.
+uint64_t vktrace_block_compress(const void* src, uint64_t srcSize, void* dst, uint64_t dstCapacity);
+
+// Decompresses exactly dstSize bytes from src. Returns FALSE if the data is corrupt.
+BOOL vktrace_block_decompress(const void* src, uint64_t srcSize, void* dst, uint64_t dstSize);
+
+// Starts writing blocks at the current position of pFile, which must be dataOffset: the
+// caller writes the file header and gpu info itself. blockSize 0 picks the default.
+vktrace_block_writer* vktrace_block_writer_create(FILE* pFile, uint64_t dataOffset, uint32_t blockSize);
+
+// Appends _len bytes to the logical stream, compressing and writing every block that fills up.
+BOOL vktrace_block_writer_write(vktrace_block_writer* pWriter, const void* _bytes, uint64_t _len);
+
+// Logical offset the next vktrace_block_writer_write will store its data at.
+uint64_t vktrace_block_writer_get_position(vktrace_block_writer* pWriter);
+
+// Writes the last partial block, the block index and the footer. Nothing may be written afterwards.
+BOOL vktrace_block_writer_finish(vktrace_block_writer* pWriter);
+
+// Finishes the file if that hasn't been done yet and frees the writer. Does not close the file.
+void vktrace_block_writer_destroy(vktrace_block_writer** ppWriter);
+
+// Returns a reader if pFile is a block compressed trace file with a valid footer, otherwise NULL.
+// The reader decodes blocks ahead of the read position on a worker thread.
+vktrace_block_reader* vktrace_block_reader_create(FILE* pFile);
+
+uint64_t vktrace_block_reader_get_length(vktrace_block_reader* pReader);
+
+// Copies _len bytes starting at logical offset _offset. Returns FALSE past the end or on error.
+BOOL vktrace_block_reader_read(vktrace_block_reader* pReader, uint64_t _offset, void* _bytes, uint64_t _len);
+
+// Stops the worker thread and frees the reader. Does not close the file.
+void vktrace_block_reader_destroy(vktrace_block_reader** ppReader);
+
+#ifdef __cplusplus
+}
+#endif
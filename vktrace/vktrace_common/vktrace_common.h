@@ -140,12 +140,59 @@ static const uint32_t  INVALID_BINDING_INDEX = UINT32_MAX;
 // disabled.
 #define VKTRACE_PAGEGUARD_ENABLE_LAZY_COPY_ENV "VKTRACE_PAGEGUARD_ENABLE_LAZY_COPY"
 
+// VKTRACE_PAGEGUARD_TRACKING env var selects how PMB tracking finds the
+// pages written by the target app on Linux. It is one of "uffd" (write
+// protect the mapped memory with userfaultfd and collect the written
+// pages with the PAGEMAP_SCAN ioctl, needs Linux 6.7), "softdirty" (the
+// soft-dirty bits of /proc/self/pagemap), or "pageguard" (write protect
+// every page with mprotect and catch the writes in a SIGSEGV handler).
+// If the env var is undefined, "pageguard" is used. A mode the kernel
+// doesn't support falls back to "pageguard". The trace layer logs the
+// mode it uses once.
+#define VKTRACE_PAGEGUARD_TRACKING_ENV "VKTRACE_PAGEGUARD_TRACKING"
+
+// VKTRACE_PAGEGUARD_ENABLE_DELTA env var makes PMB tracking save only the
+// bytes of a changed page that differ from the real mapped memory, rather
+// than the whole page, once the page has been saved whole. The real mapped
+// memory also holds what the GPU wrote to it, so the bytes left out are
+// ones playback already has. It reads the real mapped memory, which may be
+// slow for the CPU to read. Apps that rewrite a few bytes of many pages
+// every frame, like streamed uniform buffers, get much smaller traces with
+// it. If the env var is not defined, whole changed pages are saved.
+#define VKTRACE_PAGEGUARD_ENABLE_DELTA_ENV "VKTRACE_PAGEGUARD_ENABLE_DELTA"
+
 // VKTRACE_TRIM_TRIGGER env var is set by the vktrace program to
 // communicate the --TraceTrigger command line argument to the
 // trace layer.
 #define VKTRACE_TRIM_TRIGGER_ENV "VKTRACE_TRIM_TRIGGER"
 
+// VKTRACE_TRIM_STAGING_BUDGET env var sets how many megabytes of staging
+// memory the trace layer uses for each device when it reads back the
+// contents of images and buffers at the start of trimming. If the env var
+// is undefined, 64 megabytes are used.
+#define VKTRACE_TRIM_STAGING_BUDGET_ENV "VKTRACE_TRIM_STAGING_BUDGET"
+
+// VKTRACE_TRIM_MEMORY_BUDGET env var sets how many megabytes of packets the
+// trace layer keeps in memory to recreate objects when trimming begins. Once
+// they grow past it, large packets of long-lived objects are moved to a
+// scratch file until they are written. If the env var is undefined, there is
+// no budget.
+#define VKTRACE_TRIM_MEMORY_BUDGET_ENV "VKTRACE_TRIM_MEMORY_BUDGET"
+
 // _VKTRACE_VERBOSITY env var is set by the vktrace program to
 // communicate verbosity level to the trace layer. It is set to
 // one of "quiet", "errors", "warnings", "full", or "debug".
 #define _VKTRACE_VERBOSITY_ENV "_VKTRACE_VERBOSITY"
+
+// _VKTRACE_SHM_RING env var is set by the vktrace program to the name
+// of the shared memory ring it created for the trace layer to send
+// packets through. If it is undefined or empty, the trace layer connects
+// to vktrace over a socket instead. vktrace doesn't listen on the socket
+// while it reads from a ring, so if the ring cannot be opened the trace
+// layer logs an error and traces nothing.
+#define _VKTRACE_SHM_RING_ENV "_VKTRACE_SHM_RING"
+
+// _VKTRACE_TSC_CLOCK env var is set to "1" by the vktrace program to
+// communicate the --TscClock arg to the trace layer, which then takes
+// packet timestamps from the CPU timestamp counter if it is invariant.
+#define _VKTRACE_TSC_CLOCK_ENV "_VKTRACE_TSC_CLOCK"
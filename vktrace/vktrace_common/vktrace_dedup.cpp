@@ -0,0 +1,489 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrace_dedup.h"
+
+#include <string.h>
+
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include "vktrace_tracelog.h"
+}
+
+// ------------------------------------------------------------------------------------------------
+// Chunk hash
+//
+// Four 64 bit lanes take turns consuming 8 byte words with the xxHash64 round function, and the
+// lanes are then merged twice, in opposite orders and with different multipliers, into the two
+// halves of the hash. Chunks are looked up by hash alone, so the hash has to be wide enough that
+// two different chunks never share one in practice.
+// ------------------------------------------------------------------------------------------------
+static const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(uint64_t v, int bits) { return (v << bits) | (v >> (64 - bits)); }
+
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotl64(acc, 31);
+    return acc * kPrime1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t lane) {
+    acc ^= hash_round(0, lane);
+    return acc * kPrime1 + kPrime4;
+}
+
+static inline uint64_t hash_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+void vktrace_dedup_hash128(const void* pBytes, uint64_t size, uint64_t* pHash) {
+    const uint8_t* p = (const uint8_t*)pBytes;
+    const uint8_t* const end = p + size;
+    uint64_t lane[4] = {kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1};
+
+    for (; p + 32 <= end; p += 32) {
+        lane[0] = hash_round(lane[0], read64(p));
+        lane[1] = hash_round(lane[1], read64(p + 8));
+        lane[2] = hash_round(lane[2], read64(p + 16));
+        lane[3] = hash_round(lane[3], read64(p + 24));
+    }
+
+    uint64_t h0 = rotl64(lane[0], 1) + rotl64(lane[1], 7) + rotl64(lane[2], 12) + rotl64(lane[3], 18);
+    uint64_t h1 = rotl64(lane[3], 1) + rotl64(lane[2], 7) + rotl64(lane[1], 12) + rotl64(lane[0], 18);
+    for (int i = 0; i < 4; i++) {
+        h0 = hash_merge(h0, lane[i]);
+        h1 = hash_merge(h1, lane[3 - i]) ^ kPrime5;
+    }
+    h0 += size;
+    h1 += size * kPrime3;
+
+    for (; p + 8 <= end; p += 8) {
+        uint64_t k = hash_round(0, read64(p));
+        h0 = rotl64(h0 ^ k, 27) * kPrime1 + kPrime4;
+        h1 = rotl64(h1 ^ k, 29) * kPrime3 + kPrime2;
+    }
+    for (; p < end; p++) {
+        h0 = rotl64(h0 ^ (*p * kPrime5), 11) * kPrime1;
+        h1 = rotl64(h1 ^ (*p * kPrime1), 13) * kPrime2;
+    }
+
+    pHash[0] = hash_avalanche(h0);
+    pHash[1] = hash_avalanche(h1 ^ pHash[0]);
+}
+
+// ------------------------------------------------------------------------------------------------
+// Content defined chunking
+//
+// A gear hash is rolled over the bytes of a packet: each byte shifts the hash left one bit and adds
+// the byte's random gear value, so the top bits only depend on the last 64 bytes. A chunk ends
+// where the top kChunkBits bits are all 0, which makes chunks 16 KB long on average, but never
+// shorter than VKTRACE_DEDUP_MIN_CHUNK_SIZE nor longer than VKTRACE_DEDUP_MAX_CHUNK_SIZE. Since
+// boundaries depend on the bytes around them and not on their offsets, data that moved within a
+// buffer, or was uploaded with a different offset or size, is still cut into the same chunks.
+// ------------------------------------------------------------------------------------------------
+static const uint32_t kChunkBits = 14;
+
+// Chunks this small cost about as much to refer to as to store.
+static const uint64_t kMinReferenceSize = 256;
+
+// The number of chunks the writer remembers, about 100 MB of table for 16 GB of unique data.
+static const size_t kMaxChunkCount = 1024 * 1024;
+
+struct GearTable {
+    uint64_t gear[256];
+    GearTable() {
+        uint64_t state = 0x5EED5EED5EED5EEDULL;
+        for (uint32_t i = 0; i < 256; i++) {
+            // splitmix64
+            state += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = state;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            gear[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+static const GearTable s_gearTable;
+
+// Returns the size of the chunk that starts at p.
+static uint64_t find_chunk_size(const uint8_t* p, uint64_t size) {
+    if (size <= VKTRACE_DEDUP_MIN_CHUNK_SIZE) {
+        return size;
+    }
+    uint64_t limit = size < VKTRACE_DEDUP_MAX_CHUNK_SIZE ? size : VKTRACE_DEDUP_MAX_CHUNK_SIZE;
+
+    // Boundaries before the minimum size are skipped, the hash only has to be warm when they start counting.
+    uint64_t h = 0;
+    for (uint64_t i = VKTRACE_DEDUP_MIN_CHUNK_SIZE - 64; i < limit; i++) {
+        h = (h << 1) + s_gearTable.gear[p[i]];
+        if (i >= VKTRACE_DEDUP_MIN_CHUNK_SIZE && (h >> (64 - kChunkBits)) == 0) {
+            return i + 1;
+        }
+    }
+    return limit;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writer
+// ------------------------------------------------------------------------------------------------
+namespace {
+
+struct ChunkKey {
+    uint64_t hash[2];
+    bool operator==(const ChunkKey& other) const { return hash[0] == other.hash[0] && hash[1] == other.hash[1]; }
+};
+
+struct ChunkKeyHasher {
+    size_t operator()(const ChunkKey& key) const { return (size_t)key.hash[0]; }
+};
+
+struct ChunkLocation {
+    uint64_t fileOffset;
+    uint64_t size;
+};
+
+struct Chunk {
+    uint64_t packetOffset;
+    uint64_t size;
+    ChunkKey key;
+    const ChunkLocation* pMatch;  // nullptr if the chunk is stored in this packet
+};
+
+}  // namespace
+
+struct vktrace_dedup_writer {
+    uint64_t minPacketSize;
+    std::vector<bool> excluded;  // by packet_id
+    std::unordered_map<ChunkKey, ChunkLocation, ChunkKeyHasher> chunks;
+    std::map<uint16_t, vktrace_dedup_stats> stats;
+
+    // Reused from packet to packet
+    std::vector<Chunk> packetChunks;
+    std::vector<uint8_t> packetBytes;
+};
+
+static void add_chunk(vktrace_dedup_writer* pWriter, const ChunkKey& key, uint64_t fileOffset, uint64_t size) {
+    if (pWriter->chunks.size() < kMaxChunkCount) {
+        ChunkLocation location = {fileOffset, size};
+        pWriter->chunks.emplace(key, location);
+    }
+}
+
+static void count_packet(vktrace_dedup_writer* pWriter, uint16_t packetId, uint64_t packetSize, uint64_t storedSize) {
+    vktrace_dedup_stats& stats = pWriter->stats[packetId];
+    stats.packetCount++;
+    stats.deduplicatedCount += (storedSize != packetSize) ? 1 : 0;
+    stats.packetBytes += packetSize;
+    stats.storedBytes += storedSize;
+}
+
+vktrace_dedup_writer* vktrace_dedup_writer_create(uint64_t minPacketSize) {
+    vktrace_dedup_writer* pWriter = new vktrace_dedup_writer;
+    pWriter->minPacketSize = minPacketSize;
+    pWriter->excluded.resize(UINT16_MAX + 1, false);
+    return pWriter;
+}
+
+void vktrace_dedup_writer_exclude(vktrace_dedup_writer* pWriter, uint16_t packetId) { pWriter->excluded[packetId] = true; }
+
+uint64_t vktrace_dedup_writer_process(vktrace_dedup_writer* pWriter, vktrace_trace_packet_header* pHeader, uint64_t fileOffset) {
+    const uint64_t packetSize = pHeader->size;
+    if (packetSize < pWriter->minPacketSize || packetSize <= sizeof(vktrace_trace_packet_header) ||
+        pWriter->excluded[pHeader->packet_id]) {
+        count_packet(pWriter, pHeader->packet_id, packetSize, packetSize);
+        return packetSize;
+    }
+
+    // Cut the bytes after the header into chunks and look each of them up.
+    const uint8_t* pPacket = (const uint8_t*)pHeader;
+    std::vector<Chunk>& packetChunks = pWriter->packetChunks;
+    packetChunks.clear();
+    uint64_t referenceCount = 0;
+    uint64_t literalSize = 0;
+    for (uint64_t offset = sizeof(vktrace_trace_packet_header); offset < packetSize;) {
+        Chunk chunk;
+        chunk.packetOffset = offset;
+        chunk.size = find_chunk_size(pPacket + offset, packetSize - offset);
+        vktrace_dedup_hash128(pPacket + offset, chunk.size, chunk.key.hash);
+        chunk.pMatch = nullptr;
+        if (chunk.size >= kMinReferenceSize) {
+            auto it = pWriter->chunks.find(chunk.key);
+            if (it != pWriter->chunks.end() && it->second.size == chunk.size) {
+                chunk.pMatch = &it->second;
+                referenceCount++;
+            }
+        }
+        if (chunk.pMatch == nullptr) {
+            literalSize += chunk.size;
+        }
+        packetChunks.push_back(chunk);
+        offset += chunk.size;
+    }
+
+    if (referenceCount == 0) {
+        // Stored as it is, its chunks are where they are in the packet.
+        for (const Chunk& chunk : packetChunks) {
+            if (chunk.size >= kMinReferenceSize) {
+                add_chunk(pWriter, chunk.key, fileOffset + chunk.packetOffset, chunk.size);
+            }
+        }
+        count_packet(pWriter, pHeader->packet_id, packetSize, packetSize);
+        return packetSize;
+    }
+
+    // Lay the packet out again as references followed by the chunks that weren't found. Every reference
+    // replaces at least kMinReferenceSize bytes, so the new packet is always smaller than the old one.
+    const uint64_t literalOffset = sizeof(vktrace_trace_packet_header) + sizeof(vktrace_trace_packet_deduplicated) +
+                                   referenceCount * sizeof(vktrace_dedup_reference);
+    // Padded so the packets that follow stay 8 byte aligned.
+    const uint64_t storedSize = ROUNDUP_TO_8(literalOffset + literalSize);
+    std::vector<uint8_t>& packetBytes = pWriter->packetBytes;
+    packetBytes.resize((size_t)storedSize);
+    memset(packetBytes.data() + literalOffset + literalSize, 0, (size_t)(storedSize - literalOffset - literalSize));
+
+    vktrace_trace_packet_header* pStoredHeader = (vktrace_trace_packet_header*)packetBytes.data();
+    memcpy(pStoredHeader, pHeader, sizeof(vktrace_trace_packet_header));
+    pStoredHeader->packet_id = VKTRACE_TPI_DEDUPLICATED_PACKET;
+    pStoredHeader->size = storedSize;
+
+    vktrace_trace_packet_deduplicated* pDeduplicated = (vktrace_trace_packet_deduplicated*)(pStoredHeader + 1);
+    pDeduplicated->packet_size = packetSize;
+    pDeduplicated->packet_id = pHeader->packet_id;
+    pDeduplicated->reserved = 0;
+    pDeduplicated->reference_count = (uint32_t)referenceCount;
+
+    vktrace_dedup_reference* pReference = (vktrace_dedup_reference*)(pDeduplicated + 1);
+    uint8_t* pLiteral = packetBytes.data() + literalOffset;
+    for (const Chunk& chunk : packetChunks) {
+        if (chunk.pMatch != nullptr) {
+            pReference->packet_offset = chunk.packetOffset;
+            pReference->file_offset = chunk.pMatch->fileOffset;
+            pReference->size = chunk.size;
+            pReference++;
+        } else {
+            if (chunk.size >= kMinReferenceSize) {
+                add_chunk(pWriter, chunk.key, fileOffset + (pLiteral - packetBytes.data()), chunk.size);
+            }
+            memcpy(pLiteral, pPacket + chunk.packetOffset, (size_t)chunk.size);
+            pLiteral += chunk.size;
+        }
+    }
+
+    count_packet(pWriter, pHeader->packet_id, packetSize, storedSize);
+    memcpy(pHeader, packetBytes.data(), (size_t)storedSize);
+    return storedSize;
+}
+
+vktrace_dedup_stats vktrace_dedup_writer_get_stats(vktrace_dedup_writer* pWriter, uint16_t packetId) {
+    auto it = pWriter->stats.find(packetId);
+    if (it == pWriter->stats.end()) {
+        vktrace_dedup_stats stats = {};
+        return stats;
+    }
+    return it->second;
+}
+
+vktrace_dedup_stats vktrace_dedup_writer_get_total_stats(vktrace_dedup_writer* pWriter) {
+    vktrace_dedup_stats total = {};
+    for (auto& it : pWriter->stats) {
+        total.packetCount += it.second.packetCount;
+        total.deduplicatedCount += it.second.deduplicatedCount;
+        total.packetBytes += it.second.packetBytes;
+        total.storedBytes += it.second.storedBytes;
+    }
+    return total;
+}
+
+void vktrace_dedup_writer_destroy(vktrace_dedup_writer** ppWriter) {
+    if (ppWriter == NULL || *ppWriter == NULL) {
+        return;
+    }
+    delete *ppWriter;
+    *ppWriter = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Reader
+// ------------------------------------------------------------------------------------------------
+namespace {
+
+struct CachedChunk {
+    uint64_t fileOffset;
+    std::vector<uint8_t> bytes;
+};
+
+}  // namespace
+
+struct vktrace_dedup_reader {
+    uint64_t cacheSize;
+    uint64_t cachedBytes;
+    std::list<CachedChunk> lru;  // most recently used first
+    std::unordered_map<uint64_t, std::list<CachedChunk>::iterator> cache;
+
+    uint64_t chunkCount;
+    uint64_t readCount;
+};
+
+vktrace_dedup_reader* vktrace_dedup_reader_create(uint64_t cacheSize) {
+    vktrace_dedup_reader* pReader = new vktrace_dedup_reader;
+    pReader->cacheSize = (cacheSize != 0) ? cacheSize : VKTRACE_DEDUP_DEFAULT_CACHE_SIZE;
+    pReader->cachedBytes = 0;
+    pReader->chunkCount = 0;
+    pReader->readCount = 0;
+    return pReader;
+}
+
+// Copies the chunk at fileOffset to pDst, from the cache if it's there.
+static bool read_chunk(vktrace_dedup_reader* pReader, const vktrace_dedup_reference& reference, uint8_t* pDst,
+                       vktrace_dedup_read_function pRead, void* pUserData) {
+    pReader->chunkCount++;
+    auto it = pReader->cache.find(reference.file_offset);
+    if (it != pReader->cache.end() && it->second->bytes.size() == reference.size) {
+        pReader->lru.splice(pReader->lru.begin(), pReader->lru, it->second);
+        memcpy(pDst, it->second->bytes.data(), (size_t)reference.size);
+        return true;
+    }
+
+    pReader->readCount++;
+    if (!pRead(pUserData, reference.file_offset, pDst, reference.size)) {
+        return false;
+    }
+    if (reference.size > pReader->cacheSize) {
+        return true;
+    }
+
+    if (it != pReader->cache.end()) {
+        pReader->cachedBytes -= it->second->bytes.size();
+        pReader->lru.erase(it->second);
+        pReader->cache.erase(it);
+    }
+    while (pReader->cachedBytes + reference.size > pReader->cacheSize) {
+        CachedChunk& oldest = pReader->lru.back();
+        pReader->cachedBytes -= oldest.bytes.size();
+        pReader->cache.erase(oldest.fileOffset);
+        pReader->lru.pop_back();
+    }
+    pReader->lru.emplace_front();
+    CachedChunk& chunk = pReader->lru.front();
+    chunk.fileOffset = reference.file_offset;
+    chunk.bytes.assign(pDst, pDst + reference.size);
+    pReader->cachedBytes += reference.size;
+    pReader->cache[reference.file_offset] = pReader->lru.begin();
+    return true;
+}
+
+vktrace_trace_packet_header* vktrace_dedup_reader_restore(vktrace_dedup_reader* pReader, const vktrace_trace_packet_header* pPacket,
+                                                          vktrace_dedup_read_function pRead, void* pUserData) {
+    const uint64_t storedSize = pPacket->size;
+    const vktrace_trace_packet_deduplicated* pDeduplicated = (const vktrace_trace_packet_deduplicated*)(pPacket + 1);
+    const vktrace_dedup_reference* pReferences = (const vktrace_dedup_reference*)(pDeduplicated + 1);
+    const uint64_t referenceOffset = sizeof(vktrace_trace_packet_header) + sizeof(vktrace_trace_packet_deduplicated);
+    bool valid = storedSize >= referenceOffset &&
+                 pDeduplicated->reference_count <= (storedSize - referenceOffset) / sizeof(vktrace_dedup_reference) &&
+                 pDeduplicated->packet_size >= sizeof(vktrace_trace_packet_header);
+
+    // The restored packet is made of the header, the literal bytes and the referenced chunks, check that
+    // before allocating it.
+    uint64_t restoredSize = sizeof(vktrace_trace_packet_header);
+    for (uint32_t i = 0; valid && i < pDeduplicated->reference_count; i++) {
+        valid = pReferences[i].size <= pDeduplicated->packet_size - restoredSize;
+        restoredSize += valid ? pReferences[i].size : 0;
+    }
+    if (valid) {
+        uint64_t literalSize = storedSize - referenceOffset - pDeduplicated->reference_count * sizeof(vktrace_dedup_reference);
+        uint64_t expectedLiteralSize = pDeduplicated->packet_size - restoredSize;
+        valid = expectedLiteralSize <= literalSize && literalSize - expectedLiteralSize < 8;
+    }
+    if (!valid) {
+        vktrace_LogError("Deduplicated trace packet %llu is invalid.", (unsigned long long)pPacket->global_packet_index);
+        return NULL;
+    }
+
+    vktrace_trace_packet_header* pHeader = (vktrace_trace_packet_header*)vktrace_malloc((size_t)pDeduplicated->packet_size);
+    if (pHeader == NULL) {
+        vktrace_LogError("Malloc failed in vktrace_dedup_reader_restore of size %llu.",
+                         (unsigned long long)pDeduplicated->packet_size);
+        return NULL;
+    }
+    memcpy(pHeader, pPacket, sizeof(vktrace_trace_packet_header));
+    pHeader->packet_id = pDeduplicated->packet_id;
+    pHeader->size = pDeduplicated->packet_size;
+
+    // References are in packet order, the literal bytes fill the gaps between them and are followed by up to 7 bytes
+    // of padding.
+    const uint8_t* pLiteral = (const uint8_t*)(pReferences + pDeduplicated->reference_count);
+    const uint8_t* const pLiteralEnd = (const uint8_t*)pPacket + storedSize;
+    uint8_t* pDst = (uint8_t*)pHeader;
+    uint64_t offset = sizeof(vktrace_trace_packet_header);
+    for (uint32_t i = 0; valid && i <= pDeduplicated->reference_count; i++) {
+        uint64_t end = (i < pDeduplicated->reference_count) ? pReferences[i].packet_offset : pHeader->size;
+        if (end < offset || end > pHeader->size || end - offset > (uint64_t)(pLiteralEnd - pLiteral)) {
+            valid = false;
+            break;
+        }
+        memcpy(pDst + offset, pLiteral, (size_t)(end - offset));
+        pLiteral += end - offset;
+        offset = end;
+        if (i < pDeduplicated->reference_count) {
+            valid = pReferences[i].size <= pHeader->size - offset &&
+                    read_chunk(pReader, pReferences[i], pDst + offset, pRead, pUserData);
+            offset += pReferences[i].size;
+        }
+    }
+
+    if (!valid || pLiteralEnd - pLiteral >= 8) {
+        vktrace_LogError("Failed to restore deduplicated trace packet %llu.", (unsigned long long)pPacket->global_packet_index);
+        vktrace_free(pHeader);
+        return NULL;
+    }
+    pHeader->pBody = (uintptr_t)pHeader + sizeof(vktrace_trace_packet_header);
+    return pHeader;
+}
+
+void vktrace_dedup_reader_get_stats(vktrace_dedup_reader* pReader, uint64_t* pChunkCount, uint64_t* pReadCount) {
+    *pChunkCount = pReader->chunkCount;
+    *pReadCount = pReader->readCount;
+}
+
+void vktrace_dedup_reader_destroy(vktrace_dedup_reader** ppReader) {
+    if (ppReader == NULL || *ppReader == NULL) {
+        return;
+    }
+    delete *ppReader;
+    *ppReader = NULL;
+}
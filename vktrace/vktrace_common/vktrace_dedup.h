@@ -0,0 +1,123 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include "vktrace_common.h"
+#include "vktrace_trace_packet_identifiers.h"
+
+// Deduplicated trace files (VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED).
+//
+// Titles often upload the same data again and again: texture mips that are
+// streamed in more than once, static vertex buffers after a device loss,
+// identical shader modules. When vktrace deduplicates a trace, the bytes of
+// every packet of at least a minimum size are cut into content defined
+// chunks (a chunk ends where a rolling hash of the bytes before it hits a
+// boundary value, so the same data is cut the same way wherever it lies in
+// a packet) and each chunk is hashed. A chunk that was already written is
+// replaced by a reference to the logical file offset of its first copy,
+// and the packet is stored as a VKTRACE_TPI_DEDUPLICATED_PACKET:
+//
+//   [packet header][vktrace_trace_packet_deduplicated]
+//   [vktrace_dedup_reference 0]...[vktrace_dedup_reference N-1][literal bytes]
+//
+// The packet header is the packet's own, apart from packet_id and size. The
+// literal bytes are the bytes of the packet after its header with the
+// referenced chunks left out, padded to a multiple of 8 bytes. Restoring a packet puts the referenced chunks
+// back where they were, which gives back exactly the packet that was
+// traced. The first copy of a chunk is stored in place in whichever packet
+// it first appeared in, so the trace has no separate blob section and a
+// chunk is found with a single read at its file offset.
+//
+// Packet offsets kept elsewhere (the portability table, the trace index and
+// bookmarks) are the offsets of the stored packets, and references are
+// logical offsets (see vktrace_block_file.h), so deduplicated traces can be
+// block compressed and converted with vktraceconvert like any other.
+
+#define VKTRACE_DEDUP_MIN_CHUNK_SIZE (4 * 1024)
+#define VKTRACE_DEDUP_MAX_CHUNK_SIZE (64 * 1024)
+#define VKTRACE_DEDUP_DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+
+typedef struct vktrace_trace_packet_deduplicated {
+    uint64_t packet_size;      // size of the restored packet
+    uint16_t packet_id;        // packet_id of the restored packet
+    uint16_t reserved;
+    uint32_t reference_count;  // number of vktrace_dedup_reference that follow
+} vktrace_trace_packet_deduplicated;
+
+typedef struct vktrace_dedup_reference {
+    uint64_t packet_offset;  // where the chunk goes in the restored packet, from the start of its header
+    uint64_t file_offset;    // logical file offset of the first copy of the chunk
+    uint64_t size;
+} vktrace_dedup_reference;
+
+typedef struct vktrace_dedup_writer vktrace_dedup_writer;
+typedef struct vktrace_dedup_reader vktrace_dedup_reader;
+
+// Reads size bytes at logical offset fileOffset of the trace file.
+typedef BOOL (*vktrace_dedup_read_function)(void* pUserData, uint64_t fileOffset, void* pBytes, uint64_t size);
+
+// Per packet id totals of a deduplicated trace, see vktrace_dedup_writer_get_stats.
+typedef struct vktrace_dedup_stats {
+    uint64_t packetCount;
+    uint64_t deduplicatedCount;  // packets stored as VKTRACE_TPI_DEDUPLICATED_PACKET
+    uint64_t packetBytes;        // size of the packets as traced
+    uint64_t storedBytes;        // size of the packets as stored
+} vktrace_dedup_stats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Hashes size bytes into two 64 bit words, pHash[0] and pHash[1].
+void vktrace_dedup_hash128(const void* pBytes, uint64_t size, uint64_t* pHash);
+
+// Deduplicates packets of at least minPacketSize bytes.
+vktrace_dedup_writer* vktrace_dedup_writer_create(uint64_t minPacketSize);
+
+// Packets with this packet_id are always stored as they are.
+void vktrace_dedup_writer_exclude(vktrace_dedup_writer* pWriter, uint16_t packetId);
+
+// Deduplicates the packet pHeader, which is about to be written at logical offset fileOffset. The packet
+// is rewritten in place and its new size returned, which is pHeader->size if it is stored as it is. Its
+// chunks are remembered either way, so later packets can refer to them.
+uint64_t vktrace_dedup_writer_process(vktrace_dedup_writer* pWriter, vktrace_trace_packet_header* pHeader, uint64_t fileOffset);
+
+// Totals of all packets so far with the given packet id.
+vktrace_dedup_stats vktrace_dedup_writer_get_stats(vktrace_dedup_writer* pWriter, uint16_t packetId);
+
+// Totals of all packets so far.
+vktrace_dedup_stats vktrace_dedup_writer_get_total_stats(vktrace_dedup_writer* pWriter);
+
+void vktrace_dedup_writer_destroy(vktrace_dedup_writer** ppWriter);
+
+// Keeps the most recently used chunks, up to cacheSize bytes of them. cacheSize 0 picks the default.
+vktrace_dedup_reader* vktrace_dedup_reader_create(uint64_t cacheSize);
+
+// Returns the packet pPacket was made from, allocated with vktrace_malloc, or NULL on error. Chunks
+// that aren't in the cache are read with pRead.
+vktrace_trace_packet_header* vktrace_dedup_reader_restore(vktrace_dedup_reader* pReader, const vktrace_trace_packet_header* pPacket,
+                                                          vktrace_dedup_read_function pRead, void* pUserData);
+
+// Number of chunks restored and how many of them were read from the file rather than the cache.
+void vktrace_dedup_reader_get_stats(vktrace_dedup_reader* pReader, uint64_t* pChunkCount, uint64_t* pReadCount);
+
+void vktrace_dedup_reader_destroy(vktrace_dedup_reader** ppReader);
+
+#ifdef __cplusplus
+}
+#endif
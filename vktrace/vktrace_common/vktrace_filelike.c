@@ -96,6 +96,13 @@ FileLike* vktrace_FileLike_create_file(FILE* fp) {
         pFile->mFile = fp;
         pFile->mMessageStream = NULL;
         pFile->mFileLen = vktrace_FileLike_GetFileLength(fp);
+        pFile->mBlockReader = vktrace_block_reader_create(fp);
+        pFile->mPosition = 0;
+        pFile->mDedupReader = NULL;
+        if (pFile->mBlockReader != NULL) {
+            pFile->mMode = BlockFile;
+            pFile->mFileLen = vktrace_block_reader_get_length(pFile->mBlockReader);
+        }
     }
     return pFile;
 }
@@ -109,10 +116,24 @@ FileLike* vktrace_FileLike_create_msg(MessageStream* _msgStream) {
         pFile->mFile = NULL;
         pFile->mMessageStream = _msgStream;
         pFile->mFileLen = 0;
+        pFile->mBlockReader = NULL;
+        pFile->mPosition = 0;
+        pFile->mDedupReader = NULL;
     }
     return pFile;
 }
 
+// ------------------------------------------------------------------------------------------------
+void vktrace_FileLike_destroy(FileLike** ppFileLike) {
+    if (ppFileLike == NULL || *ppFileLike == NULL) {
+        return;
+    }
+    vktrace_block_reader_destroy(&(*ppFileLike)->mBlockReader);
+    vktrace_dedup_reader_destroy(&(*ppFileLike)->mDedupReader);
+    VKTRACE_DELETE(*ppFileLike);
+    *ppFileLike = NULL;
+}
+
 // ------------------------------------------------------------------------------------------------
 uint64_t vktrace_FileLike_Read(FileLike* pFileLike, void* _bytes, uint64_t _len) {
     uint64_t minSize = 0;
@@ -149,6 +170,15 @@ BOOL vktrace_FileLike_ReadRaw(FileLike* pFileLike, void* _bytes, uint64_t _len)
             result = vktrace_MessageStream_BlockingRecv(pFileLike->mMessageStream, _bytes, _len);
             break;
         }
+        case BlockFile: {
+            result = vktrace_block_reader_read(pFileLike->mBlockReader, pFileLike->mPosition, _bytes, _len);
+            if (result == TRUE) {
+                pFileLike->mPosition += _len;
+            } else if (pFileLike->mPosition + _len > pFileLike->mFileLen) {
+                vktrace_LogVerbose("Reached end of file.");
+            }
+            break;
+        }
 
         default:
             assert(!"Invalid mode in FileLike_ReadRaw");
@@ -195,6 +225,10 @@ uint64_t vktrace_FileLike_GetCurrentPosition(FileLike* pFileLike) {
             offset = Ftell(pFileLike->mFile);
             break;
         }
+        case BlockFile: {
+            offset = pFileLike->mPosition;
+            break;
+        }
 
         default:
             assert(!"Invalid mode in vktrace_FileLike_GetCurrentPosition");
@@ -214,6 +248,13 @@ BOOL vktrace_FileLike_SetCurrentPosition(FileLike* pFileLike, uint64_t offset) {
             }
             break;
         }
+        case BlockFile: {
+            if (offset <= pFileLike->mFileLen) {
+                pFileLike->mPosition = offset;
+                ret = TRUE;
+            }
+            break;
+        }
 
         default:
             assert(!"Invalid mode in vktrace_FileLike_SetCurrentPosition");
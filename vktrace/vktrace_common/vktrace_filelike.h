@@ -29,16 +29,25 @@
 
 #include "vktrace_common.h"
 #include "vktrace_interconnect.h"
+#include "vktrace_block_file.h"
+#include "vktrace_dedup.h"
 
 typedef struct MessageStream MessageStream;
 
 struct FileLike;
 typedef struct FileLike FileLike;
 typedef struct FileLike {
-    enum { File, Socket } mMode;
+    enum { File, Socket, BlockFile } mMode;
     FILE* mFile;
     uint64_t mFileLen;
     MessageStream* mMessageStream;
+
+    // BlockFile mode only: mFileLen and positions are offsets in the uncompressed trace.
+    vktrace_block_reader* mBlockReader;
+    uint64_t mPosition;
+
+    // Created by vktrace_read_trace_packet on the first deduplicated packet it reads.
+    vktrace_dedup_reader* mDedupReader;
 } FileLike;
 
 // For creating checkpoints (consistency checks) in the various streams we're interacting with.
@@ -59,9 +68,13 @@ BOOL vktrace_Checkpoint_read(Checkpoint* pCheckpoint, FileLike* _in);
 // This is a simple file-like interface--it doesn't support rewinding or anything fancy, just fifo
 // reads and writes.
 
-// create a filelike interface for file streaming
+// create a filelike interface for file streaming. Block compressed trace files are
+// detected and read as if they were uncompressed.
 FileLike* vktrace_FileLike_create_file(FILE* fp);
 
+// releases a filelike and any block or dedup reader it owns; does not close the file or message stream
+void vktrace_FileLike_destroy(FileLike** ppFileLike);
+
 // create a filelike interface for network streaming
 FileLike* vktrace_FileLike_create_msg(MessageStream* _msgStream);
 
@@ -23,6 +23,7 @@
 #include "vktrace_common.h"
 
 #include "vktrace_filelike.h"
+#include "vktrace_shm_ring.h"
 
 #if defined(ANDROID)
 #include <sys/un.h>
@@ -61,6 +62,7 @@ MessageStream* vktrace_MessageStream_create_port_string(BOOL _isHost, const char
     pStream->mNextPacketId = 0;
     pStream->mSocket = INVALID_SOCKET;
     pStream->mSendBuffer = NULL;
+    pStream->mShmRing = NULL;
 
     if (vktrace_MessageStream_SetupSocket(pStream) == FALSE) {
         VKTRACE_DELETE(pStream);
@@ -77,7 +79,32 @@ MessageStream* vktrace_MessageStream_create(BOOL _isHost, const char* _address,
     return vktrace_MessageStream_create_port_string(_isHost, _address, portBuf);
 }
 
+MessageStream* vktrace_MessageStream_create_shm(BOOL _isHost, const char* _name) {
+    vktrace_shm_ring* pRing =
+        _isHost ? vktrace_shm_ring_create(_name, VKTRACE_SHM_RING_DEFAULT_SIZE) : vktrace_shm_ring_open(_name);
+    if (pRing == NULL) {
+        return NULL;
+    }
+
+    MessageStream* pStream = VKTRACE_NEW(MessageStream);
+    memset(pStream, 0, sizeof(MessageStream));
+    pStream->mHost = _isHost;
+    pStream->mSocket = INVALID_SOCKET;
+    pStream->mShmRing = pRing;
+
+    vktrace_LogVerbose("%s: Using shared memory ring %s.", _isHost ? "Host" : "Client", _name);
+    return pStream;
+}
+
 void vktrace_MessageStream_destroy(MessageStream** ppStream) {
+    if ((*ppStream)->mShmRing != NULL) {
+        vktrace_shm_ring_close(&(*ppStream)->mShmRing);
+        vktrace_LogDebug("Destroyed shared memory connection.");
+        VKTRACE_DELETE(*ppStream);
+        (*ppStream) = NULL;
+        return;
+    }
+
     if ((*ppStream)->mSendBuffer != NULL) {
         // Try to get our data out.
         vktrace_MessageStream_FlushSendBuffer(*ppStream, TRUE);
@@ -349,6 +376,10 @@ BOOL vktrace_MessageStream_BufferedSend(MessageStream* pStream, const void* _byt
 
 // ------------------------------------------------------------------------------------------------
 BOOL vktrace_MessageStream_Send(MessageStream* pStream, const void* _bytes, uint64_t _len) {
+    if (pStream->mShmRing != NULL) {
+        // Each thread copies straight into its own part of the ring; no send lock is needed.
+        return vktrace_shm_ring_write(pStream->mShmRing, _bytes, _len);
+    }
     return vktrace_MessageStream_BufferedSend(pStream, _bytes, _len, FALSE);
 }
 
@@ -389,9 +420,35 @@ BOOL vktrace_MessageStream_ReallySend(MessageStream* pStream, const void* _bytes
 }
 
 // ------------------------------------------------------------------------------------------------
+static BOOL vktrace_MessageStream_ShmRecv(MessageStream* pStream, void* _out, uint64_t _len) {
+    uint64_t totalDataRead = 0;
+    for (;;) {
+        uint64_t dataRead = 0;
+        BOOL open = vktrace_shm_ring_read(pStream->mShmRing, (char*)_out + totalDataRead, _len - totalDataRead, &dataRead);
+        totalDataRead += dataRead;
+        if (totalDataRead == _len) {
+            return TRUE;
+        }
+        if (!open) {
+            pStream->mErrorNum = WSAECONNRESET;
+            vktrace_LogDebug("Shared memory ring was closed by client.");
+            return FALSE;
+        }
+        if (totalDataRead == 0) {
+            pStream->mErrorNum = WSAEWOULDBLOCK;
+            return FALSE;
+        }
+        // The rest of the message is in a record that another thread has not committed yet.
+        Sleep(0);
+    }
+}
+
 BOOL vktrace_MessageStream_Recv(MessageStream* pStream, void* _out, uint64_t _len) {
     unsigned int totalDataRead = 0;
     unsigned int attempts = 0;
+    if (pStream->mShmRing != NULL) {
+        return vktrace_MessageStream_ShmRecv(pStream, _out, _len);
+    }
     do {
         attempts++;
         int dataRead = recv(pStream->mSocket, ((char*)_out) + totalDataRead, (int)_len - totalDataRead, 0);
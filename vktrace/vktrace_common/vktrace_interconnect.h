@@ -49,6 +49,7 @@ static const unsigned int VKTRACE_BASE_PORT = 34199;
 struct SSerializeDataPacket;
 
 struct SimpleBuffer;
+struct vktrace_shm_ring;
 
 // ------------------------------------------------------------------------------------------------
 // ------------------------------------------------------------------------------------------------
@@ -68,6 +69,9 @@ typedef struct MessageStream {
 
     BOOL mHost;
     int mErrorNum;
+
+    // Set when the stream runs over a shared memory ring instead of a socket.
+    struct vktrace_shm_ring* mShmRing;
 } MessageStream;
 
 #ifdef __cplusplus
@@ -75,6 +79,7 @@ extern "C" {
 #endif
 MessageStream* vktrace_MessageStream_create_port_string(BOOL _isHost, const char* _address, const char* _port);
 MessageStream* vktrace_MessageStream_create(BOOL _isHost, const char* _address, unsigned int _port);
+MessageStream* vktrace_MessageStream_create_shm(BOOL _isHost, const char* _name);
 void vktrace_MessageStream_destroy(MessageStream** ppStream);
 BOOL vktrace_MessageStream_BufferedSend(MessageStream* pStream, const void* _bytes, uint64_t _size, BOOL _optional);
 BOOL vktrace_MessageStream_Send(MessageStream* pStream, const void* _bytes, uint64_t _len);
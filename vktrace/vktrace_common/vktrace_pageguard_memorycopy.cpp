@@ -23,9 +23,9 @@
 
 static const size_t SIZE_LIMIT_TO_USE_OPTIMIZATION = 1 * 1024 * 1024;  // turn off optimization of memcpy if size < this limit.
 // for multithread memcopy, there is system cost on multiple threads include switch control from different threads,
-// synchronization and communication like semaphore wait and post and other process which system don't need to handle
-// in single thread memcpy, if these cost is greater than benefit of using multithread,we should directly call memcpy.
-// here set the value with 1M base on roughly estimation of the cost.
+// synchronization and communication which system don't need to handle in single thread memcpy, if these cost is greater
+// than benefit of using multithread,we should directly call memcpy. here set the value with 1M base on roughly estimation
+// of the cost; the cross-platform memcpy multithread measures it on the first flush, see vktrace_pageguard_calibrate.
 
 bool vktrace_sem_create(vktrace_sem_id *sem_id, uint32_t initvalue) {
     bool sem_create_ok = false;
@@ -141,77 +141,88 @@ extern "C" void *vktrace_pageguard_memcpy(void *destination, const void *source,
     }
     return pRet;
 }
+
+void vktrace_pageguard_run_tasks(vktrace_pageguard_ptr_task_unit_function pfunction, void **pparameters, size_t amount) {
+    parallel_for(size_t(0), amount, [pfunction, pparameters](size_t i) { pfunction(pparameters[i]); });
+}
+
+extern "C" void vktrace_pageguard_memcpy_blocks(void *destination, const void *source, const PageGuardChangedBlockInfo *pBlocks,
+                                                size_t blockCount) {
+    const uint8_t *pSource = (const uint8_t *)source;
+    for (size_t i = 0; i < blockCount; i++) {
+        vktrace_pageguard_memcpy((uint8_t *)destination + pBlocks[i].offset, pSource, pBlocks[i].length);
+        pSource += pBlocks[i].length;
+    }
+}
 #else  // defined(PAGEGUARD_MEMCPY_USE_PPL_LIB), Linux
 extern "C" void *vktrace_pageguard_memcpy(void *destination, const void *source, uint64_t size) {
     return memcpy(destination, source, (size_t)size);
 }
-#endif
-
-#else  //! defined(PAGEGUARD_MEMCPY_USE_PPL_LIB), use cross-platform memcpy multithread which exclude PPL
 
-typedef void (*vktrace_pageguard_ptr_task_unit_function)(void *pTaskUnitParaInput);
-
-typedef struct {
-    void *src, *dest;
-    size_t size;
-} vktrace_pageguard_task_unit_parameters;
-
-typedef struct {
-    size_t index;
-    vktrace_pageguard_task_unit_parameters *ptask_units;
-    size_t amount;
-    vktrace_sem_id sem_id_access;
-} vktrace_pageguard_task_queue;
-
-typedef struct {
-    size_t index;
-    vktrace_pageguard_thread_id thread_id;
-    vktrace_sem_id sem_id_task_start;
-    vktrace_sem_id sem_id_task_end;
-    // vktrace_pageguard_task_unit_parameters *ptask_para;
-} vktrace_pageguard_task_control_block;
+void vktrace_pageguard_run_tasks(vktrace_pageguard_ptr_task_unit_function pfunction, void **pparameters, size_t amount) {
+    for (size_t i = 0; i < amount; i++) {
+        pfunction(pparameters[i]);
+    }
+}
 
-#if defined(WIN32)
-typedef void (*vktrace_pageguard_thread_function_ptr)(void *parameters);
-#else
-typedef void *(*vktrace_pageguard_thread_function_ptr)(void *parameters);
+extern "C" void vktrace_pageguard_memcpy_blocks(void *destination, const void *source, const PageGuardChangedBlockInfo *pBlocks,
+                                                size_t blockCount) {
+    const uint8_t *pSource = (const uint8_t *)source;
+    for (size_t i = 0; i < blockCount; i++) {
+        vktrace_pageguard_memcpy((uint8_t *)destination + pBlocks[i].offset, pSource, pBlocks[i].length);
+        pSource += pBlocks[i].length;
+    }
+}
 #endif
-bool vktrace_pageguard_create_thread(vktrace_pageguard_thread_id *ptid, vktrace_pageguard_thread_function_ptr pfunc,
-                                     vktrace_pageguard_task_control_block *ptaskpara) {
-    bool create_thread_ok = false;
-#if defined(WIN32)
-    DWORD dwThreadID;
-    HANDLE thread_handle;
-    thread_handle = CreateThread(NULL, 0, (LPTHREAD_START_ROUTINE)pfunc, ptaskpara, 0, &dwThreadID);
 
-    if (thread_handle != INVALID_HANDLE_VALUE) {
-        *ptid = thread_handle;
-        create_thread_ok = true;
-    }
+#else  //! defined(PAGEGUARD_MEMCPY_USE_PPL_LIB), use cross-platform memcpy multithread which exclude PPL
 
+// The memcpy threads are a persistent pool, started by vktrace_pageguard_init_multi_threads_memcpy and kept until the
+// matching vktrace_pageguard_done_multi_threads_memcpy. A job, a big copy or a set of tasks, is cut into items which are
+// dealt out to the threads as contiguous ranges, one range per thread including the calling thread, which works on
+// the job too. A thread that has finished its own range steals the back half of the largest range that is left, so a
+// thread that is slowed down (by page faults, or by being scheduled out) doesn't hold up the whole job. Threads that
+// have no job spin for a few microseconds before they sleep on a condition variable, so the copies of one flush don't
+// pay for waking them, and idle threads don't take CPU time from the app.
+//
+// Only one job runs at a time. A copy or a set of tasks asked for while the pool is busy (from another thread, or from
+// a task running on the pool) is done on the calling thread.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PAGEGUARD_MEMCPY_NON_TEMPORAL
+#define PAGEGUARD_MEMCPY_PAUSE() _mm_pause()
 #else
-    pthread_t thread;
-    int state = PTHREAD_CANCEL_ENABLE, oldtype;
-    state = PTHREAD_CANCEL_ASYNCHRONOUS;
-    pthread_setcanceltype(state, &oldtype);
-    if (pthread_create(&thread, NULL, pfunc, (void *)ptaskpara) == 0) {
-        *ptid = thread;
-        create_thread_ok = true;
-    }
-    pthread_setcanceltype(oldtype, &state);
+#define PAGEGUARD_MEMCPY_PAUSE()
 #endif
-    return create_thread_ok;
-}
-
-void vktrace_pageguard_delete_thread(vktrace_pageguard_thread_id tid) {
-#if defined(WIN32)
-    DWORD dwExitCode = 0;
-    TerminateThread((HANDLE)tid, dwExitCode);
-#else
-    pthread_cancel((pthread_t)tid);
-    pthread_join((pthread_t)tid, NULL);
+#if defined(PLATFORM_LINUX)
+#include <sched.h>
 #endif
-}
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "vktrace_tracelog.h"
+
+#define VKTRACE_PAGEGUARD_MEMCPY_THREADS_ENV "VKTRACE_PAGEGUARD_MEMCPY_THREADS"
+#define VKTRACE_PAGEGUARD_MEMCPY_MIN_SIZE_ENV "VKTRACE_PAGEGUARD_MEMCPY_MIN_SIZE"
+
+// a job is split into items of at least this size, and no more than this many of them per thread,
+static const size_t PAGEGUARD_MEMCPY_MIN_ITEM_SIZE = 0x10000;
+static const size_t PAGEGUARD_MEMCPY_MAX_ITEM_SIZE = 0x400000;
+static const size_t PAGEGUARD_MEMCPY_ITEMS_PER_THREAD = 4;
+// and items start at a page of the destination, so no two threads write to the same page.
+static const size_t PAGEGUARD_MEMCPY_ITEM_ALIGNMENT = 0x1000;
+// copies bigger than the last level cache bypass it, the destination would only push out data that is still needed.
+static const size_t PAGEGUARD_MEMCPY_DEFAULT_CACHE_SIZE = 8 * 1024 * 1024;
+// how many times an idle thread checks for a new job before it goes to sleep.
+static const uint32_t PAGEGUARD_MEMCPY_SPIN_COUNT = 256;
+
+// set on the memcpy threads, and on the calling thread while it works on a job.
+static VKTRACE_THREAD_LOCAL bool s_vktrace_pageguard_task_thread = false;
 
 uint32_t vktrace_pageguard_get_cpu_core_count() {
     uint32_t iret = 4;
@@ -221,218 +232,444 @@ uint32_t vktrace_pageguard_get_cpu_core_count() {
     iret = sSysInfo.dwNumberOfProcessors;
 #else
     iret = sysconf(_SC_NPROCESSORS_ONLN);
+#if defined(PLATFORM_LINUX) && defined(CPU_COUNT)
+    // the process may be limited to fewer cores than the system has.
+    cpu_set_t cpuSet;
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0 && CPU_COUNT(&cpuSet) > 0) {
+        iret = CPU_COUNT(&cpuSet);
+    }
+#endif
 #endif
-    return iret;
+    return (iret > 0) ? iret : 1;
 }
 
-vktrace_pageguard_task_queue *vktrace_pageguard_get_task_queue() {
-    static vktrace_pageguard_task_queue *pvktrace_pageguard_task_queue_multi_thread_memcpy = nullptr;
-    if (!pvktrace_pageguard_task_queue_multi_thread_memcpy) {
-        pvktrace_pageguard_task_queue_multi_thread_memcpy = new vktrace_pageguard_task_queue;
-        memset(reinterpret_cast<void *>(pvktrace_pageguard_task_queue_multi_thread_memcpy), 0,
-               sizeof(vktrace_pageguard_task_queue));
-        vktrace_sem_create(&pvktrace_pageguard_task_queue_multi_thread_memcpy->sem_id_access, 1);
-    }
-    return pvktrace_pageguard_task_queue_multi_thread_memcpy;
+static size_t vktrace_pageguard_get_cache_size() {
+    size_t cacheSize = 0;
+#if defined(PLATFORM_LINUX) && defined(_SC_LEVEL3_CACHE_SIZE)
+    long l3Size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    long l2Size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    cacheSize = (size_t)std::max(std::max(l3Size, l2Size), 0L);
+#endif
+    return cacheSize ? cacheSize : PAGEGUARD_MEMCPY_DEFAULT_CACHE_SIZE;
 }
 
-vktrace_pageguard_task_unit_parameters *vktrace_pageguard_get_task_unit_parameters() {
-    vktrace_pageguard_task_unit_parameters *pret = nullptr;
-    vktrace_pageguard_task_queue *ptaskqueue = vktrace_pageguard_get_task_queue();
-    vktrace_sem_wait(ptaskqueue->sem_id_access);
-    if (ptaskqueue->index < ptaskqueue->amount) {
-        pret = &ptaskqueue->ptask_units[ptaskqueue->index];
-        ptaskqueue->index++;
+// Copies with stores that don't allocate cache lines, where the CPU has them.
+static void vktrace_pageguard_memcpy_non_temporal(void *dest, const void *src, size_t size) {
+#if defined(PAGEGUARD_MEMCPY_NON_TEMPORAL)
+    uint8_t *pDest = (uint8_t *)dest;
+    const uint8_t *pSrc = (const uint8_t *)src;
+    size_t head = (16 - ((uintptr_t)pDest & 15)) & 15;
+    if (size < head + 64) {
+        memcpy(dest, src, size);
+        return;
     }
-    vktrace_sem_post(ptaskqueue->sem_id_access);
-    return pret;
+    memcpy(pDest, pSrc, head);
+    pDest += head;
+    pSrc += head;
+    size -= head;
+    for (; size >= 64; size -= 64, pDest += 64, pSrc += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)pSrc);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(pSrc + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(pSrc + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(pSrc + 48));
+        _mm_stream_si128((__m128i *)pDest, v0);
+        _mm_stream_si128((__m128i *)(pDest + 16), v1);
+        _mm_stream_si128((__m128i *)(pDest + 32), v2);
+        _mm_stream_si128((__m128i *)(pDest + 48), v3);
+    }
+    _mm_sfence();
+    memcpy(pDest, pSrc, size);
+#else
+    memcpy(dest, src, size);
+#endif
 }
 
-vktrace_pageguard_task_control_block *vktrace_pageguard_get_task_control_block() {
-    static vktrace_pageguard_task_control_block *ptask_control_block = nullptr;
-    if (!ptask_control_block) {
-        int thread_number = vktrace_pageguard_get_cpu_core_count();
-        ptask_control_block = reinterpret_cast<vktrace_pageguard_task_control_block *>(
-            new uint8_t[thread_number * sizeof(vktrace_pageguard_task_control_block)]);
-        memset((void *)ptask_control_block, 0, thread_number * sizeof(vktrace_pageguard_task_control_block));
+typedef struct {
+    void *dest;
+    const void *src;
+    size_t size;
+} vktrace_pageguard_copy_item;
+
+class PageGuardCopyEngine {
+   public:
+    // threadCount is the number of threads working on a job, including the calling thread.
+    PageGuardCopyEngine(uint32_t threadCount, size_t minSize) : m_minSize(minSize), m_slots(threadCount) {
+        m_nonTemporalMinSize = vktrace_pageguard_get_cache_size();
+        for (uint32_t i = 1; i < threadCount; i++) {
+            m_threads.push_back(std::thread(&PageGuardCopyEngine::threadFunction, this, i));
+        }
     }
-    return ptask_control_block;
-}
 
-void vktrace_pageguard_thread_function(void *ptcbpara) {
-    vktrace_pageguard_task_control_block *ptasktcb = reinterpret_cast<vktrace_pageguard_task_control_block *>(ptcbpara);
-    vktrace_pageguard_task_unit_parameters *parameters;
-    bool stop_loop;
-    while (1) {
-        vktrace_sem_wait(ptasktcb->sem_id_task_start);
-        stop_loop = false;
-        while (!stop_loop) {
-            parameters = vktrace_pageguard_get_task_unit_parameters();
-            if (parameters != nullptr) {
-                memcpy(parameters->dest, parameters->src, parameters->size);
-            } else {
-                stop_loop = true;
+    ~PageGuardCopyEngine() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_generation.fetch_add(1);
+        }
+        m_wakeCondition.notify_all();
+        for (auto &thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    uint32_t getThreadCount() const { return (uint32_t)m_slots.size(); }
+    size_t getMinSize() const { return m_minSize; }
+    void setMinSize(size_t minSize) { m_minSize = minSize; }
+    bool isCalibrated() const { return m_calibrated.load(std::memory_order_acquire); }
+    void setCalibrated() { m_calibrated.store(true, std::memory_order_release); }
+
+    void copy(void *dest, const void *src, size_t size) {
+        if (size < m_minSize || s_vktrace_pageguard_task_thread || m_slots.size() < 2 || !m_jobMutex.try_lock()) {
+            memcpy(dest, src, size);
+            return;
+        }
+        size_t itemSize = getItemSize(size);
+        // the first item ends at a page of the destination, the others start at one.
+        size_t firstSize = itemSize - ((uintptr_t)dest & (PAGEGUARD_MEMCPY_ITEM_ALIGNMENT - 1));
+        m_copyDest = (uint8_t *)dest;
+        m_copySrc = (const uint8_t *)src;
+        m_copySize = size;
+        m_copyFirstSize = std::min(firstSize, size);
+        m_copyItemSize = itemSize;
+        m_copyNonTemporal = (size >= m_nonTemporalMinSize);
+        m_pItems = nullptr;
+        m_pfunction = nullptr;
+        run(1 + (size - m_copyFirstSize + itemSize - 1) / itemSize);
+        m_jobMutex.unlock();
+    }
+
+    // copies each of the items, size bytes in all, the bigger ones split up so the threads get about the same amount to copy.
+    void copyItems(const vktrace_pageguard_copy_item *pItems, size_t count, size_t size) {
+        if (size < m_minSize || s_vktrace_pageguard_task_thread || m_slots.size() < 2 || !m_jobMutex.try_lock()) {
+            for (size_t i = 0; i < count; i++) {
+                memcpy(pItems[i].dest, pItems[i].src, pItems[i].size);
+            }
+            return;
+        }
+        size_t itemSize = getItemSize(size);
+        m_items.clear();
+        for (size_t i = 0; i < count; i++) {
+            for (size_t offset = 0; offset < pItems[i].size; offset += itemSize) {
+                vktrace_pageguard_copy_item item = {(uint8_t *)pItems[i].dest + offset, (const uint8_t *)pItems[i].src + offset,
+                                                    std::min(itemSize, pItems[i].size - offset)};
+                m_items.push_back(item);
             }
         }
-        vktrace_sem_post(ptasktcb->sem_id_task_end);
+        m_copyNonTemporal = (size >= m_nonTemporalMinSize);
+        m_pItems = m_items.data();
+        m_pfunction = nullptr;
+        run(m_items.size());
+        m_jobMutex.unlock();
     }
-}
 
-bool vktrace_pageguard_init_multi_threads_memcpy_custom(vktrace_pageguard_thread_function_ptr pfunc) {
-    bool init_multi_threads_memcpy_custom_ok = false, success_sem_start = false, success_sem_end = false, success_thread = false;
-    vktrace_pageguard_task_control_block *ptcb = vktrace_pageguard_get_task_control_block();
-    int thread_number = vktrace_pageguard_get_cpu_core_count();
-    for (int i = 0; i < thread_number; i++) {
-        success_sem_start = vktrace_sem_create(&ptcb[i].sem_id_task_start, 0);
-        success_sem_end = vktrace_sem_create(&ptcb[i].sem_id_task_end, 0);
-        ptcb[i].index = i;
-        success_thread =
-            vktrace_pageguard_create_thread(&ptcb[i].thread_id, (vktrace_pageguard_thread_function_ptr)pfunc, &ptcb[i]);
-        if (success_sem_start && success_sem_end && success_thread) {
-            init_multi_threads_memcpy_custom_ok = true;
+    void runTasks(vktrace_pageguard_ptr_task_unit_function pfunction, void **pparameters, size_t amount) {
+        if (amount <= 1 || s_vktrace_pageguard_task_thread || m_slots.size() < 2 || !m_jobMutex.try_lock()) {
+            // A single task isn't worth waking the threads for, and is free to use them for its own copies.
+            for (size_t i = 0; i < amount; i++) {
+                pfunction(pparameters[i]);
+            }
+            return;
+        }
+        m_pfunction = pfunction;
+        m_pparameters = pparameters;
+        run(amount);
+        m_jobMutex.unlock();
+    }
+
+   private:
+    // a range of items, the next item to run in the upper 32 bits and the end in the lower 32 bits. The owning thread
+    // takes items from the front, other threads steal from the back.
+    struct Slot {
+        std::atomic<uint64_t> range;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+        Slot() : range(0) {}
+    };
+
+    static uint64_t makeRange(uint64_t begin, uint64_t end) { return (begin << 32) | end; }
+
+    size_t getItemSize(size_t size) const {
+        size_t itemSize = size / (m_slots.size() * PAGEGUARD_MEMCPY_ITEMS_PER_THREAD);
+        itemSize = (itemSize + PAGEGUARD_MEMCPY_ITEM_ALIGNMENT - 1) & ~(PAGEGUARD_MEMCPY_ITEM_ALIGNMENT - 1);
+        return std::min(std::max(itemSize, PAGEGUARD_MEMCPY_MIN_ITEM_SIZE), PAGEGUARD_MEMCPY_MAX_ITEM_SIZE);
+    }
+
+    void runItem(size_t index) {
+        if (m_pfunction != nullptr) {
+            m_pfunction(m_pparameters[index]);
+        } else if (m_pItems != nullptr) {
+            const vktrace_pageguard_copy_item &item = m_pItems[index];
+            if (m_copyNonTemporal) {
+                vktrace_pageguard_memcpy_non_temporal(item.dest, item.src, item.size);
+            } else {
+                memcpy(item.dest, item.src, item.size);
+            }
         } else {
-            init_multi_threads_memcpy_custom_ok = false;
-            break;
+            size_t offset = (index == 0) ? 0 : m_copyFirstSize + (index - 1) * m_copyItemSize;
+            size_t size = std::min((index == 0) ? m_copyFirstSize : m_copyItemSize, m_copySize - offset);
+            if (m_copyNonTemporal) {
+                vktrace_pageguard_memcpy_non_temporal(m_copyDest + offset, m_copySrc + offset, size);
+            } else {
+                memcpy(m_copyDest + offset, m_copySrc + offset, size);
+            }
         }
     }
-    return init_multi_threads_memcpy_custom_ok;
-}
 
-static vktrace_sem_id glocal_sem_id;
-#if defined(PLATFORM_LINUX)
-static bool glocal_sem_id_create_success __attribute__((unused)) = vktrace_sem_create(&glocal_sem_id, 1);
-#else
-static bool glocal_sem_id_create_success = vktrace_sem_create(&glocal_sem_id, 1);
-#endif
+    bool takeItem(Slot &slot, size_t &index) {
+        uint64_t range = slot.range.load(std::memory_order_acquire);
+        while ((range >> 32) < (range & 0xFFFFFFFF)) {
+            if (slot.range.compare_exchange_weak(range, range + (1ull << 32), std::memory_order_acq_rel)) {
+                index = (size_t)(range >> 32);
+                return true;
+            }
+        }
+        return false;
+    }
 
-int vktrace_pageguard_ref_count(bool release) {
-    static int ref_count = 0;
-    int curr_ref_count;
-    if (!release) {
-        vktrace_sem_wait(glocal_sem_id);
-        curr_ref_count = ref_count;
-        ++ref_count;
-        vktrace_sem_post(glocal_sem_id);
-        return curr_ref_count;
-    } else {
-        vktrace_sem_wait(glocal_sem_id);
-        --ref_count;
-        curr_ref_count = ref_count;
-        vktrace_sem_post(glocal_sem_id);
-        return curr_ref_count;
+    // moves the back half of the largest range left to the (empty) slot of thread index.
+    bool steal(uint32_t index) {
+        while (true) {
+            uint32_t victim = index;
+            uint64_t victimRange = 0, largest = 0;
+            for (uint32_t i = 0; i < m_slots.size(); i++) {
+                uint64_t range = m_slots[i].range.load(std::memory_order_acquire);
+                uint64_t begin = range >> 32, end = range & 0xFFFFFFFF;
+                if (begin < end && end - begin > largest) {
+                    largest = end - begin;
+                    victim = i;
+                    victimRange = range;
+                }
+            }
+            if (largest == 0) {
+                return false;
+            }
+            uint64_t begin = victimRange >> 32, end = victimRange & 0xFFFFFFFF, middle = end - (largest + 1) / 2;
+            if (m_slots[victim].range.compare_exchange_strong(victimRange, makeRange(begin, middle), std::memory_order_acq_rel)) {
+                m_slots[index].range.store(makeRange(middle, end), std::memory_order_release);
+                return true;
+            }
+        }
     }
-}
 
-extern "C" BOOL vktrace_pageguard_init_multi_threads_memcpy() {
-    int refnum = vktrace_pageguard_ref_count(false);
-    BOOL init_multi_threads_memcpy_ok = TRUE;
-    vktrace_pageguard_thread_function_ptr pfunc = (vktrace_pageguard_thread_function_ptr)vktrace_pageguard_thread_function;
-    if (!refnum) {
-        init_multi_threads_memcpy_ok = vktrace_pageguard_init_multi_threads_memcpy_custom(pfunc);
+    void work(uint32_t index) {
+        size_t item = 0;
+        do {
+            while (takeItem(m_slots[index], item)) {
+                runItem(item);
+            }
+        } while (steal(index));
     }
-    return init_multi_threads_memcpy_ok;
-}
 
-void vktrace_pageguard_delete_task_control_block() { delete[] vktrace_pageguard_get_task_control_block(); }
+    void run(size_t itemCount) {
+        assert(itemCount < 0xFFFFFFFF);
+        uint32_t threadCount = (uint32_t)std::min(m_slots.size(), itemCount);
+        for (uint32_t i = 0; i < m_slots.size(); i++) {
+            uint64_t begin = itemCount * i / threadCount, end = itemCount * (i + 1) / threadCount;
+            m_slots[i].range.store((i < threadCount) ? makeRange(begin, end) : 0, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_open = true;
+            m_generation.fetch_add(1, std::memory_order_release);
+        }
+        m_wakeCondition.notify_all();
 
-void vktrace_pageguard_delete_task_queue() { delete vktrace_pageguard_get_task_queue(); }
+        s_vktrace_pageguard_task_thread = true;
+        work(0);
+        s_vktrace_pageguard_task_thread = false;
 
-extern "C" void vktrace_pageguard_done_multi_threads_memcpy() {
-    int refnum = vktrace_pageguard_ref_count(true);
-    if (!refnum) {
-        vktrace_pageguard_task_control_block *task_control_block = vktrace_pageguard_get_task_control_block();
-        if (task_control_block != nullptr) {
-            int thread_number = vktrace_pageguard_get_cpu_core_count();
-
-            for (int i = 0; i < thread_number; i++) {
-                vktrace_pageguard_delete_thread(task_control_block[i].thread_id);
-                vktrace_sem_delete(task_control_block[i].sem_id_task_start);
-                vktrace_sem_delete(task_control_block[i].sem_id_task_end);
+        // every item has been taken, wait for the threads still running the last ones.
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_open = false;
+        m_doneCondition.wait(lock, [this] { return m_activeCount == 0; });
+    }
+
+    void threadFunction(uint32_t index) {
+        s_vktrace_pageguard_task_thread = true;
+        uint64_t generation = 0;
+        while (true) {
+            for (uint32_t i = 0; i < PAGEGUARD_MEMCPY_SPIN_COUNT; i++) {
+                if (m_generation.load(std::memory_order_acquire) != generation) break;
+                PAGEGUARD_MEMCPY_PAUSE();
+            }
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wakeCondition.wait(lock, [this, generation] { return m_generation.load() != generation; });
+                if (m_stop) {
+                    return;
+                }
+                generation = m_generation.load();
+                if (!m_open) {
+                    continue;
+                }
+                m_activeCount++;
+            }
+            work(index);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_activeCount--;
             }
-            vktrace_pageguard_delete_task_control_block();
-            vktrace_sem_delete(vktrace_pageguard_get_task_queue()->sem_id_access);
-            vktrace_pageguard_delete_task_queue();
+            m_doneCondition.notify_one();
         }
     }
-}
 
-// must keep units until vktrace_pageguard_multi_threads_memcpy_run finished
-void vktrace_pageguard_set_task_queue(vktrace_pageguard_task_unit_parameters *units, size_t unitamount) {
-    vktrace_sem_wait(glocal_sem_id);
-    vktrace_pageguard_task_queue *pqueue = vktrace_pageguard_get_task_queue();
-    pqueue->amount = unitamount;
-    pqueue->ptask_units = units;
-    pqueue->index = 0;
+    size_t m_minSize;
+    std::atomic<bool> m_calibrated{false};
+    size_t m_nonTemporalMinSize;
+    std::vector<Slot> m_slots;
+    std::vector<std::thread> m_threads;
+    std::mutex m_jobMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_doneCondition;
+    std::atomic<uint64_t> m_generation{0};
+    bool m_open = false;
+    bool m_stop = false;
+    uint32_t m_activeCount = 0;
+
+    // the job
+    uint8_t *m_copyDest = nullptr;
+    const uint8_t *m_copySrc = nullptr;
+    size_t m_copySize = 0, m_copyFirstSize = 0, m_copyItemSize = 0;
+    bool m_copyNonTemporal = false;
+    std::vector<vktrace_pageguard_copy_item> m_items;
+    const vktrace_pageguard_copy_item *m_pItems = nullptr;
+    vktrace_pageguard_ptr_task_unit_function m_pfunction = nullptr;
+    void **m_pparameters = nullptr;
+};
+
+static std::mutex s_engineMutex;
+static std::atomic<PageGuardCopyEngine *> s_pEngine{nullptr};
+static int s_engineRefCount = 0;
+// the size vktrace_pageguard_calibrate picked, 0 until it has run. Pools started later use it too.
+static size_t s_calibratedMinSize = 0;
+
+// Picks the smallest copy size from which copying on the threads is faster than memcpy on this machine.
+static size_t vktrace_pageguard_calibrate(PageGuardCopyEngine *pEngine) {
+    static const size_t maxSize = 8 * 1024 * 1024;
+    std::vector<uint8_t> src(maxSize, 1), dest(maxSize, 0);
+    size_t minSize = 2 * maxSize;
+    pEngine->setMinSize(0);
+    for (size_t size = maxSize; size >= PAGEGUARD_MEMCPY_MIN_ITEM_SIZE; size /= 2) {
+        std::chrono::steady_clock::duration singleTime = std::chrono::steady_clock::duration::max(), poolTime = singleTime;
+        for (int i = 0; i < 3; i++) {
+            auto start = std::chrono::steady_clock::now();
+            memcpy(dest.data(), src.data(), size);
+            auto middle = std::chrono::steady_clock::now();
+            pEngine->copy(dest.data(), src.data(), size);
+            auto end = std::chrono::steady_clock::now();
+            singleTime = std::min(singleTime, middle - start);
+            poolTime = std::min(poolTime, end - middle);
+        }
+        if (poolTime >= singleTime) {
+            break;
+        }
+        minSize = size;
+    }
+    return minSize;
 }
 
-void vktrace_pageguard_clear_task_queue() {
-    vktrace_pageguard_task_queue *pqueue = vktrace_pageguard_get_task_queue();
-    pqueue->amount = 0;
-    pqueue->ptask_units = nullptr;
-    pqueue->index = 0;
-    vktrace_sem_post(glocal_sem_id);
+extern "C" BOOL vktrace_pageguard_init_multi_threads_memcpy() {
+    std::lock_guard<std::mutex> lock(s_engineMutex);
+    if (s_engineRefCount++ == 0) {
+        uint32_t threadCount = vktrace_pageguard_get_cpu_core_count();
+        const char *pThreadsEnv = vktrace_get_global_var(VKTRACE_PAGEGUARD_MEMCPY_THREADS_ENV);
+        if (pThreadsEnv != nullptr && atoi(pThreadsEnv) > 0) {
+            threadCount = (uint32_t)atoi(pThreadsEnv);
+        }
+        PageGuardCopyEngine *pEngine = new PageGuardCopyEngine(threadCount, SIZE_LIMIT_TO_USE_OPTIMIZATION);
+        const char *pMinSizeEnv = vktrace_get_global_var(VKTRACE_PAGEGUARD_MEMCPY_MIN_SIZE_ENV);
+        if (pMinSizeEnv != nullptr) {
+            pEngine->setMinSize((size_t)strtoull(pMinSizeEnv, nullptr, 0));
+            pEngine->setCalibrated();
+        } else if (threadCount < 2) {
+            pEngine->setCalibrated();
+        } else if (s_calibratedMinSize != 0) {
+            pEngine->setMinSize(s_calibratedMinSize);
+            pEngine->setCalibrated();
+        }
+        if (pEngine->isCalibrated()) {
+            vktrace_LogVerbose("Copying %llu bytes or more on %u threads.", (unsigned long long)pEngine->getMinSize(), threadCount);
+        }
+        s_pEngine.store(pEngine);
+    }
+    return TRUE;
 }
 
-// The steps for using multithreading copy:
-//<1>init_multi_threads_memcpy
-//   it should be put at beginning of the app
-
-//<2>vktrace_pageguard_set_task_queue
-//<3>vktrace_pageguard_multi_threads_memcpy_run
-
-//<4>done_multi_threads_memcpy()
-//   it should be putted at end of the app
-void vktrace_pageguard_multi_threads_memcpy_run() {
-    vktrace_pageguard_task_control_block *ptcb = vktrace_pageguard_get_task_control_block();
-    int thread_number = vktrace_pageguard_get_cpu_core_count();
+extern "C" void vktrace_pageguard_calibrate_multi_threads_memcpy() {
+    PageGuardCopyEngine *pEngine = s_pEngine.load(std::memory_order_acquire);
+    if (pEngine == nullptr || pEngine->isCalibrated()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s_engineMutex);
+    pEngine = s_pEngine.load(std::memory_order_acquire);
+    if (pEngine == nullptr || pEngine->isCalibrated()) {
+        return;
+    }
+    if (s_calibratedMinSize == 0) {
+        s_calibratedMinSize = vktrace_pageguard_calibrate(pEngine);
+    }
+    pEngine->setMinSize(s_calibratedMinSize);
+    pEngine->setCalibrated();
+    vktrace_LogVerbose("Copying %llu bytes or more on %u threads.", (unsigned long long)pEngine->getMinSize(),
+                       pEngine->getThreadCount());
+}
 
-    for (int i = 0; i < thread_number; i++) {
-        vktrace_sem_post(ptcb[i].sem_id_task_start);
+extern "C" void vktrace_pageguard_done_multi_threads_memcpy() {
+    std::lock_guard<std::mutex> lock(s_engineMutex);
+    if (s_engineRefCount > 0 && --s_engineRefCount == 0) {
+        delete s_pEngine.exchange(nullptr);
     }
+}
 
-    for (int i = 0; i < thread_number; i++) {
-        vktrace_sem_wait(ptcb[i].sem_id_task_end);
+void vktrace_pageguard_memcpy_multithread(void *dest, const void *src, uint64_t n) {
+    PageGuardCopyEngine *pEngine = s_pEngine.load(std::memory_order_acquire);
+    if (pEngine != nullptr) {
+        pEngine->copy(dest, src, (size_t)n);
+    } else {
+        memcpy(dest, src, (size_t)n);
     }
 }
 
-void vktrace_pageguard_memcpy_multithread(void *dest, const void *src, size_t n) {
-    static const size_t PAGEGUARD_MEMCPY_MULTITHREAD_UNIT_SIZE = 0x10000;
-    uint32_t thread_number = vktrace_pageguard_get_cpu_core_count();
-
-    // taskunitamount should be >=thread_number, but should not >= a value which make the unit too small and the cost of switch
-    // thread > memcpy that unit, on the other side, too small is also not best if consider last task will determine the memcpy
-    // speed.
-    size_t taskunitamount = n / PAGEGUARD_MEMCPY_MULTITHREAD_UNIT_SIZE;
-    if (taskunitamount < thread_number) {
-        taskunitamount = thread_number;
-    }
-    size_t size_per_unit = n / taskunitamount, size_left = n % taskunitamount, size;
-    vktrace_pageguard_task_unit_parameters *units = reinterpret_cast<vktrace_pageguard_task_unit_parameters *>(
-        new uint8_t[taskunitamount * sizeof(vktrace_pageguard_task_unit_parameters)]);
-    assert(units);
-    for (uint32_t i = 0; i < taskunitamount; i++) {
-        size = size_per_unit;
-        if ((i + 1) == taskunitamount) {
-            size += size_left;
+void vktrace_pageguard_run_tasks(vktrace_pageguard_ptr_task_unit_function pfunction, void **pparameters, size_t amount) {
+    PageGuardCopyEngine *pEngine = s_pEngine.load(std::memory_order_acquire);
+    if (pEngine != nullptr) {
+        pEngine->runTasks(pfunction, pparameters, amount);
+    } else {
+        for (size_t i = 0; i < amount; i++) {
+            pfunction(pparameters[i]);
         }
-        units[i].src = (void *)((uint8_t *)src + i * size_per_unit);
-        units[i].dest = (void *)((uint8_t *)dest + i * size_per_unit);
-        units[i].size = size;
-    }
-    vktrace_pageguard_set_task_queue(units, taskunitamount);
-    vktrace_pageguard_multi_threads_memcpy_run();
-    delete[] units;
-    vktrace_pageguard_clear_task_queue();
+    }
 }
 
 extern "C" void *vktrace_pageguard_memcpy(void *destination, const void *source, uint64_t size) {
-    void *pRet = NULL;
-    if (size < SIZE_LIMIT_TO_USE_OPTIMIZATION) {
-        pRet = memcpy(destination, source, (size_t)size);
-    } else {
-        pRet = destination;
-        vktrace_pageguard_memcpy_multithread(destination, source, (size_t)size);
+    vktrace_pageguard_memcpy_multithread(destination, source, size);
+    return destination;
+}
+
+extern "C" void vktrace_pageguard_memcpy_blocks(void *destination, const void *source, const PageGuardChangedBlockInfo *pBlocks,
+                                                size_t blockCount) {
+    PageGuardCopyEngine *pEngine = s_pEngine.load(std::memory_order_acquire);
+    size_t size = 0;
+    for (size_t i = 0; i < blockCount; i++) {
+        size += pBlocks[i].length;
     }
-    return pRet;
+    if (pEngine == nullptr || size < pEngine->getMinSize()) {
+        const uint8_t *pSource = (const uint8_t *)source;
+        for (size_t i = 0; i < blockCount; i++) {
+            memcpy((uint8_t *)destination + pBlocks[i].offset, pSource, pBlocks[i].length);
+            pSource += pBlocks[i].length;
+        }
+        return;
+    }
+    std::vector<vktrace_pageguard_copy_item> items(blockCount);
+    size_t sourceOffset = 0;
+    for (size_t i = 0; i < blockCount; i++) {
+        items[i].dest = (uint8_t *)destination + pBlocks[i].offset;
+        items[i].src = (const uint8_t *)source + sourceOffset;
+        items[i].size = pBlocks[i].length;
+        sourceOffset += pBlocks[i].length;
+    }
+    pEngine->copyItems(items.data(), items.size(), size);
 }
 #endif
@@ -52,6 +52,8 @@ typedef struct __PageGuardChangedBlockInfo {
     uint32_t reserve1;
 } PageGuardChangedBlockInfo, *pPageGuardChangedBlockInfo;
 
+typedef void (*vktrace_pageguard_ptr_task_unit_function)(void *pTaskUnitParaInput);
+
 #if defined(WIN32)
 typedef HANDLE vktrace_pageguard_thread_id;
 typedef HANDLE vktrace_sem_id;
@@ -60,12 +62,32 @@ typedef pthread_t vktrace_pageguard_thread_id;
 typedef sem_t* vktrace_sem_id;
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+// Start and stop the memcpy threads, calls can be nested. Without them, copies are done on the calling thread.
+BOOL vktrace_pageguard_init_multi_threads_memcpy();
+void vktrace_pageguard_done_multi_threads_memcpy();
+// Measures from which size copying on the memcpy threads is faster than on the calling thread, the first time it is
+// called while they run. Until then copies from 1MB up use them. Called by the first flush, so apps that never flush
+// mapped memory don't pay for the measurement when they create an instance.
+void vktrace_pageguard_calibrate_multi_threads_memcpy();
+// Copies the changed blocks pBlocks[0..blockCount-1], packed one after the other at source, to their offsets from destination.
+void vktrace_pageguard_memcpy_blocks(void *destination, const void *source, const PageGuardChangedBlockInfo *pBlocks,
+                                     size_t blockCount);
+#ifdef __cplusplus
+}
+#endif
+
 #ifdef __cplusplus
 bool vktrace_sem_create(vktrace_sem_id *sem_id, uint32_t initvalue);
 void vktrace_sem_delete(vktrace_sem_id sid);
 void vktrace_sem_wait(vktrace_sem_id sid);
 void vktrace_sem_post(vktrace_sem_id sid);
 void vktrace_pageguard_memcpy_multithread(void *dest, const void *src, uint64_t n);
+// Calls pfunction for each of the amount parameters on the memcpy threads and returns when all calls have returned.
+// vktrace_pageguard_memcpy called from pfunction copies on the calling thread.
+void vktrace_pageguard_run_tasks(vktrace_pageguard_ptr_task_unit_function pfunction, void **pparameters, size_t amount);
 extern "C" void *vktrace_pageguard_memcpy(void *destination, const void *source, uint64_t size);
 #else
 void* vktrace_pageguard_memcpy(void* destination, const void* source, uint64_t size);
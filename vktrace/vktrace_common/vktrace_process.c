@@ -115,6 +115,9 @@ void vktrace_process_info_delete(vktrace_process_info* pInfo) {
     vktrace_platform_delete_thread(&(pInfo->watchdogThread));
 #endif
 
+    vktrace_block_writer_destroy(&pInfo->pTraceBlockWriter);
+    vktrace_trace_index_writer_destroy(&pInfo->pTraceIndexWriter);
+
     if (pInfo->pTraceFile != NULL) {
         vktrace_LogDebug("Closing trace file: '%s'", pInfo->traceFilename);
         fclose(pInfo->pTraceFile);
@@ -23,6 +23,8 @@
 
 #include "vktrace_platform.h"
 #include "vktrace_trace_packet_identifiers.h"
+#include "vktrace_block_file.h"
+#include "vktrace_trace_index.h"
 
 typedef struct vktrace_process_capture_trace_thread_info vktrace_process_capture_trace_thread_info;
 
@@ -34,6 +36,12 @@ typedef struct vktrace_process_info {
     char* traceFilename;
     FILE* pTraceFile;
 
+    // Set when the trace file is block compressed; all packet data goes through it.
+    vktrace_block_writer* pTraceBlockWriter;
+
+    // Index of the packets written so far, saved next to the trace file; NULL if it couldn't be created.
+    vktrace_trace_index_writer* pTraceIndexWriter;
+
     // vktrace's thread id
     vktrace_thread_id parentThreadId;
 
@@ -60,6 +68,9 @@ struct vktrace_process_capture_trace_thread_info {
     vktrace_thread recordingThread;
     vktrace_process_info* pProcessInfo;
     VKTRACE_TRACER_ID tracerId;
+
+    // Stream set up before the process was spawned; if NULL the recording thread listens on a socket.
+    struct MessageStream* pMessageStream;
 };
 
 BOOL vktrace_process_spawn(vktrace_process_info* pInfo);
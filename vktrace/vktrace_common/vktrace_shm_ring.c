@@ -0,0 +1,436 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrace_shm_ring.h"
+#include "vktrace_tracelog.h"
+
+#if defined(VKTRACE_SHM_RING_SUPPORTED)
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define VKTRACE_SHM_RING_MAGIC 0x474e495254565456ULL  // "VTVTRING"
+#define VKTRACE_SHM_RING_VERSION 2
+
+// The data area starts one page into the object so that it is page aligned.
+#define VKTRACE_SHM_RING_DATA_OFFSET 4096
+
+// Records are aligned to the size of their header so a header never wraps around the end of the ring.
+#define VKTRACE_SHM_RECORD_ALIGNMENT 16
+
+// Set in a record's size when the payload is a vktrace_shm_indirect_payload.
+#define VKTRACE_SHM_RECORD_INDIRECT 0x8000000000000000ULL
+
+// Number of times a producer waits for space before it checks whether vktrace is still alive.
+#define VKTRACE_SHM_SPINS_PER_LIVENESS_CHECK 4096
+
+#define VKTRACE_SHM_NAME_LENGTH 64
+
+// An indirect payload is named after its ring, followed by '.' and a 64-bit index of at most 20 digits.
+#define VKTRACE_SHM_INDIRECT_NAME_LENGTH (VKTRACE_SHM_NAME_LENGTH + 21)
+
+typedef struct vktrace_shm_ring_header {
+    uint64_t magic;
+    uint64_t capacity;
+    uint32_t version;
+    int32_t consumerPid;
+    int32_t producerPid;
+    uint32_t producerDetached;
+    uint64_t indirectCount;
+    // Producers and the consumer update these from different cores; keep them on separate cache lines.
+    uint8_t pad0[64 - 40];
+    uint64_t reserveHead;
+    uint8_t pad1[64 - 8];
+    uint64_t readTail;
+    uint8_t pad2[64 - 8];
+} vktrace_shm_ring_header;
+
+typedef struct vktrace_shm_record_header {
+    uint64_t stamp;
+    uint64_t size;
+} vktrace_shm_record_header;
+
+typedef struct vktrace_shm_indirect_payload {
+    uint64_t size;
+    char name[VKTRACE_SHM_INDIRECT_NAME_LENGTH];
+} vktrace_shm_indirect_payload;
+
+struct vktrace_shm_ring {
+    char name[VKTRACE_SHM_NAME_LENGTH];
+    BOOL isConsumer;
+    void* pMapping;
+    size_t mappingSize;
+    vktrace_shm_ring_header* pHeader;
+    uint8_t* pData;
+    uint64_t mask;
+
+    // Consumer state for the record currently being read.
+    uint64_t readPos;
+    BOOL inRecord;
+    uint64_t recordPayloadSize;
+    uint64_t recordSize;
+    uint64_t recordOffset;
+    const uint8_t* pIndirectData;
+    size_t indirectMappingSize;
+    char indirectName[VKTRACE_SHM_INDIRECT_NAME_LENGTH];
+};
+
+static uint64_t vktrace_shm_record_stamp(uint64_t position) { return position ^ VKTRACE_SHM_RING_MAGIC; }
+
+static uint64_t vktrace_shm_record_total_size(uint64_t payloadSize) {
+    return sizeof(vktrace_shm_record_header) +
+           ((payloadSize + VKTRACE_SHM_RECORD_ALIGNMENT - 1) & ~(uint64_t)(VKTRACE_SHM_RECORD_ALIGNMENT - 1));
+}
+
+static BOOL vktrace_shm_process_alive(int32_t pid) { return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH; }
+
+static void vktrace_shm_copy_in(vktrace_shm_ring* pRing, uint64_t position, const void* _bytes, uint64_t _len) {
+    uint64_t offset = position & pRing->mask;
+    uint64_t firstPart = pRing->mask + 1 - offset;
+    if (firstPart >= _len) {
+        memcpy(pRing->pData + offset, _bytes, (size_t)_len);
+    } else {
+        memcpy(pRing->pData + offset, _bytes, (size_t)firstPart);
+        memcpy(pRing->pData, (const uint8_t*)_bytes + firstPart, (size_t)(_len - firstPart));
+    }
+}
+
+static void vktrace_shm_copy_out(vktrace_shm_ring* pRing, uint64_t position, void* _out, uint64_t _len) {
+    uint64_t offset = position & pRing->mask;
+    uint64_t firstPart = pRing->mask + 1 - offset;
+    if (firstPart >= _len) {
+        memcpy(_out, pRing->pData + offset, (size_t)_len);
+    } else {
+        memcpy(_out, pRing->pData + offset, (size_t)firstPart);
+        memcpy((uint8_t*)_out + firstPart, pRing->pData, (size_t)(_len - firstPart));
+    }
+}
+
+static vktrace_shm_ring* vktrace_shm_ring_map(const char* name, int fd, size_t mappingSize, BOOL isConsumer) {
+    void* pMapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (pMapping == MAP_FAILED) {
+        vktrace_LogError("Failed to map shared memory ring %s, errno=%d.", name, errno);
+        return NULL;
+    }
+
+    vktrace_shm_ring* pRing = VKTRACE_NEW(vktrace_shm_ring);
+    memset(pRing, 0, sizeof(vktrace_shm_ring));
+    strncpy(pRing->name, name, VKTRACE_SHM_NAME_LENGTH - 1);
+    pRing->isConsumer = isConsumer;
+    pRing->pMapping = pMapping;
+    pRing->mappingSize = mappingSize;
+    pRing->pHeader = (vktrace_shm_ring_header*)pMapping;
+    pRing->pData = (uint8_t*)pMapping + VKTRACE_SHM_RING_DATA_OFFSET;
+    return pRing;
+}
+
+vktrace_shm_ring* vktrace_shm_ring_create(const char* name, uint64_t capacity) {
+    uint64_t ringSize = VKTRACE_SHM_RECORD_ALIGNMENT * 1024;
+    while (ringSize < capacity) {
+        ringSize <<= 1;
+    }
+
+    if (strlen(name) + 1 > VKTRACE_SHM_NAME_LENGTH) {
+        vktrace_LogError("Shared memory ring name %s is too long.", name);
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        vktrace_LogError("Failed to create shared memory ring %s, errno=%d.", name, errno);
+        return NULL;
+    }
+
+    size_t mappingSize = (size_t)(VKTRACE_SHM_RING_DATA_OFFSET + ringSize);
+    if (ftruncate(fd, (off_t)mappingSize) != 0) {
+        vktrace_LogError("Failed to size shared memory ring %s to %llu bytes, errno=%d.", name, (unsigned long long)mappingSize,
+                         errno);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    vktrace_shm_ring* pRing = vktrace_shm_ring_map(name, fd, mappingSize, TRUE);
+    close(fd);
+    if (pRing == NULL) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    pRing->mask = ringSize - 1;
+    pRing->pHeader->capacity = ringSize;
+    pRing->pHeader->version = VKTRACE_SHM_RING_VERSION;
+    pRing->pHeader->consumerPid = (int32_t)getpid();
+    __atomic_store_n(&pRing->pHeader->magic, VKTRACE_SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+    vktrace_LogVerbose("Created %llu byte shared memory ring %s.", (unsigned long long)ringSize, name);
+    return pRing;
+}
+
+vktrace_shm_ring* vktrace_shm_ring_open(const char* name) {
+    struct stat ringStat;
+    int32_t expectedPid = 0;
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        vktrace_LogVerbose("Unable to open shared memory ring %s, errno=%d.", name, errno);
+        return NULL;
+    }
+
+    if (fstat(fd, &ringStat) != 0 || ringStat.st_size <= VKTRACE_SHM_RING_DATA_OFFSET) {
+        vktrace_LogError("Shared memory ring %s has an invalid size.", name);
+        close(fd);
+        return NULL;
+    }
+
+    vktrace_shm_ring* pRing = vktrace_shm_ring_map(name, fd, (size_t)ringStat.st_size, FALSE);
+    close(fd);
+    if (pRing == NULL) {
+        return NULL;
+    }
+
+    if (__atomic_load_n(&pRing->pHeader->magic, __ATOMIC_ACQUIRE) != VKTRACE_SHM_RING_MAGIC ||
+        pRing->pHeader->version != VKTRACE_SHM_RING_VERSION ||
+        pRing->pHeader->capacity + VKTRACE_SHM_RING_DATA_OFFSET != (uint64_t)ringStat.st_size) {
+        vktrace_LogError("Shared memory ring %s was not created by a matching version of vktrace.", name);
+        vktrace_shm_ring_close(&pRing);
+        return NULL;
+    }
+    pRing->mask = pRing->pHeader->capacity - 1;
+
+    // The trace file header is sent once per ring, so only the first process to attach may use it.
+    if (!__atomic_compare_exchange_n(&pRing->pHeader->producerPid, &expectedPid, (int32_t)getpid(), FALSE, __ATOMIC_ACQ_REL,
+                                     __ATOMIC_ACQUIRE)) {
+        vktrace_LogError("Shared memory ring %s is already in use by process %d.", name, expectedPid);
+        vktrace_shm_ring_close(&pRing);
+        return NULL;
+    }
+
+    return pRing;
+}
+
+static void vktrace_shm_ring_release_indirect(vktrace_shm_ring* pRing) {
+    if (pRing->pIndirectData != NULL) {
+        munmap((void*)pRing->pIndirectData, pRing->indirectMappingSize);
+        pRing->pIndirectData = NULL;
+    }
+    if (pRing->indirectName[0] != '\0') {
+        shm_unlink(pRing->indirectName);
+        pRing->indirectName[0] = '\0';
+    }
+}
+
+void vktrace_shm_ring_close(vktrace_shm_ring** ppRing) {
+    vktrace_shm_ring* pRing = *ppRing;
+    if (pRing == NULL) {
+        return;
+    }
+
+    if (pRing->isConsumer) {
+        vktrace_shm_ring_release_indirect(pRing);
+        shm_unlink(pRing->name);
+    } else if (pRing->pHeader->producerPid == (int32_t)getpid()) {
+        __atomic_store_n(&pRing->pHeader->producerDetached, 1, __ATOMIC_RELEASE);
+    }
+
+    munmap(pRing->pMapping, pRing->mappingSize);
+    VKTRACE_DELETE(pRing);
+    *ppRing = NULL;
+}
+
+// Writes a payload that is too large for the ring into its own shared memory object.
+static BOOL vktrace_shm_ring_write_indirect(vktrace_shm_ring* pRing, const void* _bytes, uint64_t _len,
+                                            vktrace_shm_indirect_payload* pPayload) {
+    uint64_t index = __atomic_fetch_add(&pRing->pHeader->indirectCount, 1, __ATOMIC_RELAXED);
+    snprintf(pPayload->name, VKTRACE_SHM_INDIRECT_NAME_LENGTH, "%s.%llu", pRing->name, (unsigned long long)index);
+    pPayload->size = _len;
+
+    int fd = shm_open(pPayload->name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        vktrace_LogError("Failed to create shared memory object %s, errno=%d.", pPayload->name, errno);
+        return FALSE;
+    }
+
+    void* pMapping = MAP_FAILED;
+    if (ftruncate(fd, (off_t)_len) == 0) {
+        pMapping = mmap(NULL, (size_t)_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (pMapping == MAP_FAILED) {
+        vktrace_LogError("Failed to map %llu bytes of shared memory for %s, errno=%d.", (unsigned long long)_len, pPayload->name,
+                         errno);
+        shm_unlink(pPayload->name);
+        return FALSE;
+    }
+
+    memcpy(pMapping, _bytes, (size_t)_len);
+    munmap(pMapping, (size_t)_len);
+    return TRUE;
+}
+
+BOOL vktrace_shm_ring_write(vktrace_shm_ring* pRing, const void* _bytes, uint64_t _len) {
+    vktrace_shm_ring_header* pHeader = pRing->pHeader;
+    vktrace_shm_indirect_payload indirectPayload;
+    uint64_t recordFlags = 0;
+    uint32_t spins = 0;
+
+    assert(!pRing->isConsumer && _len > 0);
+
+    // Keep records to a fraction of the ring so several threads can be writing at once.
+    if (vktrace_shm_record_total_size(_len) > (pRing->mask + 1) / 4) {
+        if (!vktrace_shm_ring_write_indirect(pRing, _bytes, _len, &indirectPayload)) {
+            return FALSE;
+        }
+        _bytes = &indirectPayload;
+        _len = sizeof(indirectPayload);
+        recordFlags = VKTRACE_SHM_RECORD_INDIRECT;
+    }
+
+    uint64_t recordSize = vktrace_shm_record_total_size(_len);
+    uint64_t start = __atomic_fetch_add(&pHeader->reserveHead, recordSize, __ATOMIC_RELAXED);
+
+    // Wait until the consumer has read everything that previously occupied this range.
+    while (start + recordSize - __atomic_load_n(&pHeader->readTail, __ATOMIC_ACQUIRE) > pRing->mask + 1) {
+        if (++spins % VKTRACE_SHM_SPINS_PER_LIVENESS_CHECK == 0 && !vktrace_shm_process_alive(pHeader->consumerPid)) {
+            vktrace_LogError("vktrace is no longer reading the shared memory ring %s.", pRing->name);
+            return FALSE;
+        }
+        sched_yield();
+    }
+
+    vktrace_shm_copy_in(pRing, start + sizeof(vktrace_shm_record_header), _bytes, _len);
+
+    vktrace_shm_record_header* pRecord = (vktrace_shm_record_header*)(pRing->pData + (start & pRing->mask));
+    pRecord->size = _len | recordFlags;
+    __atomic_store_n(&pRecord->stamp, vktrace_shm_record_stamp(start), __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+typedef enum vktrace_shm_record_state {
+    VKTRACE_SHM_RECORD_NOT_READY,
+    VKTRACE_SHM_RECORD_READY,
+    VKTRACE_SHM_RECORD_ERROR,
+} vktrace_shm_record_state;
+
+// Starts reading the record at readPos if it has been committed.
+static vktrace_shm_record_state vktrace_shm_ring_begin_record(vktrace_shm_ring* pRing) {
+    vktrace_shm_record_header* pRecord = (vktrace_shm_record_header*)(pRing->pData + (pRing->readPos & pRing->mask));
+    if (__atomic_load_n(&pRecord->stamp, __ATOMIC_ACQUIRE) != vktrace_shm_record_stamp(pRing->readPos)) {
+        return VKTRACE_SHM_RECORD_NOT_READY;
+    }
+
+    pRing->recordOffset = 0;
+    pRing->recordPayloadSize = pRecord->size & ~VKTRACE_SHM_RECORD_INDIRECT;
+    pRing->recordSize = pRing->recordPayloadSize;
+    if ((pRecord->size & VKTRACE_SHM_RECORD_INDIRECT) != 0) {
+        vktrace_shm_indirect_payload payload;
+        vktrace_shm_copy_out(pRing, pRing->readPos + sizeof(vktrace_shm_record_header), &payload, sizeof(payload));
+        payload.name[VKTRACE_SHM_INDIRECT_NAME_LENGTH - 1] = '\0';
+        strcpy(pRing->indirectName, payload.name);
+
+        int fd = shm_open(payload.name, O_RDONLY, 0);
+        void* pMapping = MAP_FAILED;
+        if (fd >= 0) {
+            pMapping = mmap(NULL, (size_t)payload.size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+        }
+        if (pMapping == MAP_FAILED) {
+            // The stream cannot be resynchronized without this payload.
+            vktrace_LogError("Failed to map shared memory object %s, errno=%d.", payload.name, errno);
+            vktrace_shm_ring_release_indirect(pRing);
+            return VKTRACE_SHM_RECORD_ERROR;
+        }
+        pRing->pIndirectData = (const uint8_t*)pMapping;
+        pRing->indirectMappingSize = (size_t)payload.size;
+        pRing->recordSize = payload.size;
+    }
+
+    pRing->inRecord = TRUE;
+    return VKTRACE_SHM_RECORD_READY;
+}
+
+static void vktrace_shm_ring_end_record(vktrace_shm_ring* pRing) {
+    vktrace_shm_ring_release_indirect(pRing);
+    pRing->readPos += vktrace_shm_record_total_size(pRing->recordPayloadSize);
+    pRing->inRecord = FALSE;
+    __atomic_store_n(&pRing->pHeader->readTail, pRing->readPos, __ATOMIC_RELEASE);
+}
+
+// The producer is gone once it has detached or its process has exited.
+static BOOL vktrace_shm_ring_producer_gone(vktrace_shm_ring* pRing) {
+    int32_t producerPid = __atomic_load_n(&pRing->pHeader->producerPid, __ATOMIC_ACQUIRE);
+    return producerPid != 0 &&
+           (__atomic_load_n(&pRing->pHeader->producerDetached, __ATOMIC_ACQUIRE) || !vktrace_shm_process_alive(producerPid));
+}
+
+BOOL vktrace_shm_ring_read(vktrace_shm_ring* pRing, void* _out, uint64_t _len, uint64_t* pBytesRead) {
+    assert(pRing->isConsumer);
+    *pBytesRead = 0;
+
+    while (*pBytesRead < _len) {
+        if (!pRing->inRecord) {
+            vktrace_shm_record_state state = vktrace_shm_ring_begin_record(pRing);
+            if (state == VKTRACE_SHM_RECORD_ERROR) {
+                return FALSE;
+            }
+            if (state == VKTRACE_SHM_RECORD_NOT_READY) {
+                if (!vktrace_shm_ring_producer_gone(pRing)) {
+                    break;
+                }
+                // A record may have been committed just before the producer went away.
+                if (vktrace_shm_ring_begin_record(pRing) != VKTRACE_SHM_RECORD_READY) {
+                    return FALSE;
+                }
+            }
+        }
+
+        uint64_t available = pRing->recordSize - pRing->recordOffset;
+        uint64_t count = (_len - *pBytesRead < available) ? _len - *pBytesRead : available;
+        if (pRing->pIndirectData != NULL) {
+            memcpy((uint8_t*)_out + *pBytesRead, pRing->pIndirectData + pRing->recordOffset, (size_t)count);
+        } else {
+            vktrace_shm_copy_out(pRing, pRing->readPos + sizeof(vktrace_shm_record_header) + pRing->recordOffset,
+                                 (uint8_t*)_out + *pBytesRead, count);
+        }
+        pRing->recordOffset += count;
+        *pBytesRead += count;
+
+        if (pRing->recordOffset == pRing->recordSize) {
+            vktrace_shm_ring_end_record(pRing);
+        }
+    }
+    return TRUE;
+}
+
+#else  // VKTRACE_SHM_RING_SUPPORTED
+
+vktrace_shm_ring* vktrace_shm_ring_create(const char* name, uint64_t capacity) { return NULL; }
+
+vktrace_shm_ring* vktrace_shm_ring_open(const char* name) { return NULL; }
+
+void vktrace_shm_ring_close(vktrace_shm_ring** ppRing) { *ppRing = NULL; }
+
+BOOL vktrace_shm_ring_write(vktrace_shm_ring* pRing, const void* _bytes, uint64_t _len) { return FALSE; }
+
+BOOL vktrace_shm_ring_read(vktrace_shm_ring* pRing, void* _out, uint64_t _len, uint64_t* pBytesRead) {
+    *pBytesRead = 0;
+    return FALSE;
+}
+
+#endif  // VKTRACE_SHM_RING_SUPPORTED
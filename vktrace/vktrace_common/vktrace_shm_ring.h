@@ -0,0 +1,74 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include "vktrace_common.h"
+
+// Shared memory ring used to move trace packets from the trace layer to
+// the vktrace process when both run on the same machine. It replaces the
+// loopback TCP connection: every thread of the traced application that
+// sends a packet reserves its own range of the ring with a single atomic
+// add and copies the packet into it, so there is no system call and no
+// global send lock on the packet path.
+//
+// The ring is a sequence of records. Each record starts with a small
+// header holding the record size and a commit stamp derived from the
+// record's position in the stream; the consumer only reads a record once
+// its stamp matches, so records committed out of order by different
+// threads are still consumed in reservation order. A payload too large
+// for the ring is written to its own shared memory object and the ring
+// only carries that object's name.
+//
+// vktrace (the consumer) creates the ring and passes its name to the
+// trace layer (the single producer process) in _VKTRACE_SHM_RING_ENV.
+// Only supported on desktop Linux; elsewhere create/open return NULL and
+// callers fall back to the socket transport.
+#if defined(PLATFORM_LINUX) && !defined(ANDROID)
+#define VKTRACE_SHM_RING_SUPPORTED 1
+#endif
+
+// Default size of the ring, not counting large payloads that are written out of line.
+#define VKTRACE_SHM_RING_DEFAULT_SIZE (64 * 1024 * 1024)
+
+typedef struct vktrace_shm_ring vktrace_shm_ring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Consumer side: creates the ring object with the given name and capacity (rounded up to a power of two).
+vktrace_shm_ring* vktrace_shm_ring_create(const char* name, uint64_t capacity);
+
+// Producer side: attaches to a ring created by vktrace_shm_ring_create. Fails if another process already attached.
+vktrace_shm_ring* vktrace_shm_ring_open(const char* name);
+
+// Detaches from the ring. The consumer also removes the ring's name.
+void vktrace_shm_ring_close(vktrace_shm_ring** ppRing);
+
+// Copies _len bytes into the ring as one record, waiting for space if the consumer is behind.
+// Safe to call from several threads at once. Returns FALSE if the consumer has gone away.
+BOOL vktrace_shm_ring_write(vktrace_shm_ring* pRing, const void* _bytes, uint64_t _len);
+
+// Copies up to _len bytes of committed data out of the ring without waiting and stores the
+// amount copied in *pBytesRead. Returns FALSE once the producer has detached or exited and
+// everything it wrote has been read.
+BOOL vktrace_shm_ring_read(vktrace_shm_ring* pRing, void* _out, uint64_t _len, uint64_t* pBytesRead);
+
+#ifdef __cplusplus
+}
+#endif
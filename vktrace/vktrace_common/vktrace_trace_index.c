@@ -0,0 +1,227 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrace_trace_index.h"
+#include <string.h>
+
+// Entries are collected and written in batches so capture only calls fwrite now and then.
+#define VKTRACE_TRACE_INDEX_BATCH_SIZE 4096
+
+struct vktrace_trace_index_writer {
+    char* pFilename;
+    FILE* pFile;
+    vktrace_trace_index_header header;
+    uint64_t endOffset;
+    BOOL failed;
+    BOOL finished;
+    uint32_t batchCount;
+    vktrace_trace_index_entry batch[VKTRACE_TRACE_INDEX_BATCH_SIZE];
+};
+
+// ------------------------------------------------------------------------------------------------
+char* vktrace_trace_index_filename(const char* pTraceFilename) {
+    size_t length = strlen(pTraceFilename);
+    char* pFilename = (char*)vktrace_malloc(length + sizeof(VKTRACE_TRACE_INDEX_EXTENSION));
+    if (pFilename != NULL) {
+        memcpy(pFilename, pTraceFilename, length);
+        memcpy(pFilename + length, VKTRACE_TRACE_INDEX_EXTENSION, sizeof(VKTRACE_TRACE_INDEX_EXTENSION));
+    }
+    return pFilename;
+}
+
+// ------------------------------------------------------------------------------------------------
+vktrace_trace_index_writer* vktrace_trace_index_writer_create(const char* pTraceFilename, uint64_t firstPacketOffset) {
+    vktrace_trace_index_writer* pWriter = VKTRACE_NEW(vktrace_trace_index_writer);
+    if (pWriter == NULL) {
+        return NULL;
+    }
+    memset(pWriter, 0, sizeof(vktrace_trace_index_writer));
+    pWriter->pFilename = vktrace_trace_index_filename(pTraceFilename);
+    if (pWriter->pFilename != NULL) {
+        pWriter->pFile = fopen(pWriter->pFilename, "wb");
+    }
+    if (pWriter->pFile == NULL) {
+        vktrace_LogWarning("Unable to create trace index file for %s.", pTraceFilename);
+        vktrace_free(pWriter->pFilename);
+        vktrace_free(pWriter);
+        return NULL;
+    }
+
+    pWriter->header.magic = VKTRACE_TRACE_INDEX_MAGIC;
+    pWriter->header.version = VKTRACE_TRACE_INDEX_VERSION;
+    pWriter->header.entrySize = sizeof(vktrace_trace_index_entry);
+    pWriter->header.traceLength = 0;
+    pWriter->header.firstPacketOffset = firstPacketOffset;
+    pWriter->endOffset = firstPacketOffset;
+
+    // The header stays incomplete until vktrace_trace_index_writer_finish overwrites it.
+    if (fwrite(&pWriter->header, sizeof(pWriter->header), 1, pWriter->pFile) != 1) {
+        pWriter->failed = TRUE;
+    }
+    return pWriter;
+}
+
+// ------------------------------------------------------------------------------------------------
+static void vktrace_trace_index_writer_flush(vktrace_trace_index_writer* pWriter) {
+    if (pWriter->batchCount > 0 && !pWriter->failed &&
+        fwrite(pWriter->batch, sizeof(vktrace_trace_index_entry), pWriter->batchCount, pWriter->pFile) != pWriter->batchCount) {
+        vktrace_LogWarning("Failed to write to trace index file %s, no index will be saved.", pWriter->pFilename);
+        pWriter->failed = TRUE;
+    }
+    pWriter->batchCount = 0;
+}
+
+// ------------------------------------------------------------------------------------------------
+BOOL vktrace_trace_index_writer_add(vktrace_trace_index_writer* pWriter, uint64_t fileOffset,
+                                    const vktrace_trace_packet_header* pHeader, uint8_t flags) {
+    if (pWriter->failed) {
+        return FALSE;
+    }
+
+    vktrace_trace_index_entry* pEntry = &pWriter->batch[pWriter->batchCount++];
+    pEntry->fileOffset = fileOffset;
+    pEntry->globalPacketIndex = pHeader->global_packet_index;
+    pEntry->entrypointBeginTime = pHeader->entrypoint_begin_time;
+    pEntry->entrypointEndTime = pHeader->entrypoint_end_time;
+    pEntry->threadId = pHeader->thread_id;
+    pEntry->packetId = pHeader->packet_id;
+    pEntry->tracerId = pHeader->tracer_id;
+    pEntry->flags = flags;
+
+    pWriter->header.packetCount++;
+    if (flags & VKTRACE_TRACE_INDEX_FRAME_END) {
+        pWriter->header.frameCount++;
+    }
+    pWriter->endOffset = fileOffset + pHeader->size;
+
+    if (pWriter->batchCount == VKTRACE_TRACE_INDEX_BATCH_SIZE) {
+        vktrace_trace_index_writer_flush(pWriter);
+    }
+    return !pWriter->failed;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint64_t vktrace_trace_index_writer_get_end_offset(vktrace_trace_index_writer* pWriter) { return pWriter->endOffset; }
+
+// ------------------------------------------------------------------------------------------------
+BOOL vktrace_trace_index_writer_finish(vktrace_trace_index_writer* pWriter) {
+    vktrace_trace_index_writer_flush(pWriter);
+    if (!pWriter->failed) {
+        pWriter->header.traceLength = pWriter->endOffset;
+        if (Fseek(pWriter->pFile, 0, SEEK_SET) != 0 || fwrite(&pWriter->header, sizeof(pWriter->header), 1, pWriter->pFile) != 1 ||
+            fflush(pWriter->pFile) != 0) {
+            vktrace_LogWarning("Failed to write the header of trace index file %s.", pWriter->pFilename);
+            pWriter->failed = TRUE;
+        }
+    }
+    pWriter->finished = !pWriter->failed;
+    return pWriter->finished;
+}
+
+// ------------------------------------------------------------------------------------------------
+void vktrace_trace_index_writer_destroy(vktrace_trace_index_writer** ppWriter) {
+    vktrace_trace_index_writer* pWriter = *ppWriter;
+    if (pWriter == NULL) {
+        return;
+    }
+    if (fclose(pWriter->pFile) != 0) {
+        pWriter->finished = FALSE;
+    }
+    if (!pWriter->finished) {
+        remove(pWriter->pFilename);
+    }
+    vktrace_free(pWriter->pFilename);
+    vktrace_free(pWriter);
+    *ppWriter = NULL;
+}
+
+// ------------------------------------------------------------------------------------------------
+vktrace_trace_index* vktrace_trace_index_load(const char* pTraceFilename, uint64_t traceLength) {
+    char* pFilename = vktrace_trace_index_filename(pTraceFilename);
+    FILE* pFile = (pFilename != NULL) ? fopen(pFilename, "rb") : NULL;
+    if (pFile == NULL) {
+        vktrace_free(pFilename);
+        return NULL;
+    }
+
+    vktrace_trace_index* pIndex = VKTRACE_NEW(vktrace_trace_index);
+    if (pIndex == NULL) {
+        fclose(pFile);
+        vktrace_free(pFilename);
+        return NULL;
+    }
+    memset(pIndex, 0, sizeof(vktrace_trace_index));
+
+    BOOL valid = FALSE;
+    vktrace_trace_index_header* pHeader = &pIndex->header;
+    if (fread(pHeader, sizeof(vktrace_trace_index_header), 1, pFile) != 1 || pHeader->magic != VKTRACE_TRACE_INDEX_MAGIC ||
+        pHeader->version != VKTRACE_TRACE_INDEX_VERSION || pHeader->entrySize != sizeof(vktrace_trace_index_entry)) {
+        vktrace_LogWarning("%s is not a valid trace index file.", pFilename);
+    } else if (pHeader->traceLength != traceLength) {
+        vktrace_LogWarning("%s does not match its trace file, rebuild it with vktraceindex.", pFilename);
+    } else if (pHeader->packetCount > traceLength / sizeof(vktrace_trace_packet_header) ||
+               pHeader->frameCount > pHeader->packetCount) {
+        vktrace_LogWarning("%s is corrupt.", pFilename);
+    } else {
+        pIndex->pEntries = VKTRACE_NEW_ARRAY(vktrace_trace_index_entry, ((size_t)pHeader->packetCount + 1));
+        pIndex->pFrameStarts = VKTRACE_NEW_ARRAY(uint64_t, ((size_t)pHeader->frameCount + 1));
+        if (pIndex->pEntries == NULL || pIndex->pFrameStarts == NULL) {
+            vktrace_LogWarning("Unable to allocate memory for trace index %s.", pFilename);
+        } else if (fread(pIndex->pEntries, sizeof(vktrace_trace_index_entry), (size_t)pHeader->packetCount, pFile) !=
+                   pHeader->packetCount) {
+            vktrace_LogWarning("Failed to read trace index %s.", pFilename);
+        } else {
+            uint64_t frame = 0;
+            pIndex->pFrameStarts[0] = 0;
+            for (uint64_t i = 0; i < pHeader->packetCount && frame < pHeader->frameCount; i++) {
+                if (pIndex->pEntries[i].flags & VKTRACE_TRACE_INDEX_FRAME_END) {
+                    pIndex->pFrameStarts[++frame] = i + 1;
+                }
+            }
+            valid = (frame == pHeader->frameCount);
+            if (!valid) {
+                vktrace_LogWarning("%s is corrupt.", pFilename);
+            }
+        }
+    }
+
+    fclose(pFile);
+    vktrace_free(pFilename);
+    if (!valid) {
+        vktrace_trace_index_destroy(&pIndex);
+    }
+    return pIndex;
+}
+
+// ------------------------------------------------------------------------------------------------
+uint64_t vktrace_trace_index_find_frame(const vktrace_trace_index* pIndex, uint64_t frame) {
+    if (frame > pIndex->header.frameCount) {
+        return pIndex->header.packetCount;
+    }
+    return pIndex->pFrameStarts[frame];
+}
+
+// ------------------------------------------------------------------------------------------------
+void vktrace_trace_index_destroy(vktrace_trace_index** ppIndex) {
+    if (*ppIndex == NULL) {
+        return;
+    }
+    vktrace_free((*ppIndex)->pEntries);
+    vktrace_free((*ppIndex)->pFrameStarts);
+    vktrace_free(*ppIndex);
+    *ppIndex = NULL;
+}
@@ -0,0 +1,117 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include "vktrace_common.h"
+#include "vktrace_trace_packet_identifiers.h"
+
+// Trace index files.
+//
+// A trace index lives next to the trace file it describes, as "<trace>.idx",
+// and has one fixed size vktrace_trace_index_entry per packet in file order:
+//
+//   [vktrace_trace_index_header][entry 0]...[entry packetCount-1]
+//
+// vktrace writes the index while capturing and vktraceindex rebuilds it for
+// existing traces. Entries hold the packet's logical file offset (see
+// vktrace_block_file.h), so an index stays valid when vktraceconvert
+// compresses or decompresses the trace. Packets that end a frame (the
+// vkQueuePresentKHR calls) are flagged, which lets tools find where any
+// frame starts without reading the trace.
+//
+// The header is written last. An index whose traceLength doesn't match the
+// logical length of the trace, such as one left behind by an interrupted
+// capture or a trace that was edited afterwards, is ignored.
+
+#define VKTRACE_TRACE_INDEX_MAGIC 0x5844495845435254ULL  // "TRCEXIDX"
+#define VKTRACE_TRACE_INDEX_VERSION 1
+#define VKTRACE_TRACE_INDEX_EXTENSION ".idx"
+
+// vktrace_trace_index_entry.flags
+#define VKTRACE_TRACE_INDEX_FRAME_END 0x1
+
+typedef struct vktrace_trace_index_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t entrySize;    // sizeof(vktrace_trace_index_entry)
+    uint64_t traceLength;  // logical length of the indexed trace file, 0 until the index is complete
+    uint64_t firstPacketOffset;
+    uint64_t packetCount;
+    uint64_t frameCount;  // number of entries flagged VKTRACE_TRACE_INDEX_FRAME_END
+} vktrace_trace_index_header;
+
+typedef struct vktrace_trace_index_entry {
+    uint64_t fileOffset;
+    uint64_t globalPacketIndex;
+    uint64_t entrypointBeginTime;
+    uint64_t entrypointEndTime;
+    uint32_t threadId;
+    uint16_t packetId;
+    uint8_t tracerId;
+    uint8_t flags;
+} vktrace_trace_index_entry;
+
+typedef struct vktrace_trace_index {
+    vktrace_trace_index_header header;
+    vktrace_trace_index_entry* pEntries;
+
+    // Entry index of the first packet of each frame, frameCount + 1 of them. Frame N
+    // starts right after the Nth frame end, so the last one covers any packets after
+    // the last present.
+    uint64_t* pFrameStarts;
+} vktrace_trace_index;
+
+typedef struct vktrace_trace_index_writer vktrace_trace_index_writer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns "<trace>.idx" for pTraceFilename. The caller frees it with vktrace_free.
+char* vktrace_trace_index_filename(const char* pTraceFilename);
+
+// Creates the index file for pTraceFilename, replacing any existing one. Returns NULL if it can't be created.
+vktrace_trace_index_writer* vktrace_trace_index_writer_create(const char* pTraceFilename, uint64_t firstPacketOffset);
+
+// Adds the packet at logical offset fileOffset. Packets must be added in file order.
+BOOL vktrace_trace_index_writer_add(vktrace_trace_index_writer* pWriter, uint64_t fileOffset,
+                                    const vktrace_trace_packet_header* pHeader, uint8_t flags);
+
+// Logical offset just past the last packet added, which is where the next one goes.
+uint64_t vktrace_trace_index_writer_get_end_offset(vktrace_trace_index_writer* pWriter);
+
+// Writes the remaining entries and the header, marking the index as complete for a
+// trace that ends after the last packet added. Returns FALSE if anything failed to
+// write, in which case vktrace_trace_index_writer_destroy removes the index file.
+BOOL vktrace_trace_index_writer_finish(vktrace_trace_index_writer* pWriter);
+
+// Closes the index file; an index that wasn't finished is removed.
+void vktrace_trace_index_writer_destroy(vktrace_trace_index_writer** ppWriter);
+
+// Loads the index of pTraceFilename. Returns NULL if there is none, or if it doesn't
+// match a trace whose logical length is traceLength.
+vktrace_trace_index* vktrace_trace_index_load(const char* pTraceFilename, uint64_t traceLength);
+
+// Entry index of the first packet of frame, or packetCount if the trace doesn't have that many frames.
+uint64_t vktrace_trace_index_find_frame(const vktrace_trace_index* pIndex, uint64_t frame);
+
+void vktrace_trace_index_destroy(vktrace_trace_index** ppIndex);
+
+#ifdef __cplusplus
+}
+#endif
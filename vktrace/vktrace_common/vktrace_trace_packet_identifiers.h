@@ -29,13 +29,33 @@
 #define VKTRACE_TRACE_FILE_VERSION_5 0x0005
 #define VKTRACE_TRACE_FILE_VERSION_6 0x0006
 #define VKTRACE_TRACE_FILE_VERSION_7 0x0007  // Vulkan 1.1
+#define VKTRACE_TRACE_FILE_VERSION_8 0x0008  // Version 7 packets stored in compressed blocks, see vktrace_block_file.h
+#define VKTRACE_TRACE_FILE_VERSION_9 0x0009  // Version 7 with deduplicated packets, see vktrace_dedup.h
+#define VKTRACE_TRACE_FILE_VERSION_10 0x000A  // Version 9 packets stored in compressed blocks
 #define VKTRACE_TRACE_FILE_VERSION VKTRACE_TRACE_FILE_VERSION_7
 
+// Version written in place of VKTRACE_TRACE_FILE_VERSION when a trace is block compressed
+#define VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED VKTRACE_TRACE_FILE_VERSION_8
+
+// Versions written when a trace is deduplicated, and when it is also block compressed
+#define VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED VKTRACE_TRACE_FILE_VERSION_9
+#define VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED VKTRACE_TRACE_FILE_VERSION_10
+
+#define VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(version)          \
+    ((version) == VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED || \
+     (version) == VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED)
+#define VKTRACE_TRACE_FILE_IS_DEDUPLICATED(version) \
+    ((version) == VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED || (version) == VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED)
+
 // vkreplay can replay version 6 (the last Vulkan 1.0 format)
 #define VKTRACE_TRACE_FILE_VERSION_MINIMUM_COMPATIBLE VKTRACE_TRACE_FILE_VERSION_6
 
 #define VKTRACE_FILE_MAGIC 0xABADD068ADEAFD0C
 
+// vktrace_trace_file_header.time_source
+#define VKTRACE_TIME_SOURCE_CLOCK 0  // the OS monotonic clock
+#define VKTRACE_TIME_SOURCE_TSC 1    // the CPU timestamp counter, calibrated against the OS clock
+
 #define VKTRACE_MAX_TRACER_ID_ARRAY_SIZE 16  // Should be multiple of 8
 
 typedef enum VKTRACE_TRACER_ID {
@@ -367,8 +387,20 @@ typedef enum _VKTRACE_TRACE_PACKET_ID_VK {
     VKTRACE_TPI_VK_vkGetPhysicalDeviceExternalBufferProperties = 289,
     VKTRACE_TPI_VK_vkGetPhysicalDeviceExternalFenceProperties = 290,
     VKTRACE_TPI_VK_vkGetPhysicalDeviceExternalSemaphoreProperties = 291,
+
+    // Packets of the file format and the tools rather than Vulkan calls. They are kept far above the entry points, so that new
+    // entry points can go on being appended after the last one without colliding with them.
+    VKTRACE_TPI_NON_API_BEGIN = 0xFF00,
+    VKTRACE_TPI_DEDUPLICATED_PACKET = 0xFF00,         // stored with references to earlier copies of its bytes, see vktrace_dedup.h
+    VKTRACE_TPI_MARKER_TRIM_WINDOW = 0xFF01,          // sent by the trace layer before each trim window but the first, not stored
+    VKTRACE_TPI_MARKER_TRIM_SPILLED_PACKET = 0xFF02,  // stands in for a packet trim spilled to a scratch file, not written
+    VKTRACE_TPI_MARKER_TRIM_DESCRIPTOR_SET = 0xFF03,  // holds the updates of a descriptor set that trim packed, not written
 } VKTRACE_TRACE_PACKET_ID_VK;
 
+// Whether a packet is one of the Vulkan calls, that the replayer interprets.
+#define VKTRACE_TPI_IS_API_PACKET(packet_id) \
+    ((packet_id) >= VKTRACE_TPI_VK_vkApiVersion && (packet_id) < VKTRACE_TPI_NON_API_BEGIN)
+
 #define VKTRACE_BIG_ENDIAN 1
 #define VKTRACE_LITTLE_ENDIAN 0
 
@@ -410,8 +442,13 @@ typedef struct {
     ALIGN8 uint64_t arch;
     ALIGN8 uint64_t os;
 
+    // How the packet timestamps were taken. They are nanoseconds either way; traces
+    // written before these fields existed have zeros here, meaning VKTRACE_TIME_SOURCE_CLOCK.
+    ALIGN8 uint64_t time_source;
+    ALIGN8 uint64_t tsc_frequency;  // TSC ticks per second if time_source is VKTRACE_TIME_SOURCE_TSC
+
     // Reserve some spaece in case more fields need to be added in the future
-    ALIGN8 uint64_t reserved2[8];
+    ALIGN8 uint64_t reserved2[6];
 
     // The header ends with number of gpus and a gpu_id/drv_vers pair for each gpu
     ALIGN8 uint64_t n_gpuinfo;
@@ -37,32 +37,222 @@
 #include <sys/utsname.h>
 #endif
 
+#if defined(PLATFORM_LINUX)
+#include <malloc.h>
+#endif
+
 #if defined(PLATFORM_OSX)
 #include <mach/clock.h>
 #include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+// The TSC clock is only available on x86-64 Linux and Windows
+#if defined(PLATFORM_LINUX) && defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define VKTRACE_TSC_CLOCK_SUPPORTED 1
+#elif defined(PLATFORM_WINDOWS) && defined(_M_X64)
+#include <intrin.h>
+#define VKTRACE_TSC_CLOCK_SUPPORTED 1
 #endif
 
 #include "vk_struct_size_helper.c"
 #include "vktrace_pageguard_memorycopy.h"
 
-static VKTRACE_CRITICAL_SECTION s_packet_index_lock;
+//=============================================================================
+// Per-thread packet cache
+//
+// Nearly every traced call creates a small packet, sends it and deletes it
+// again on the same thread. Instead of returning those buffers to the heap,
+// vktrace_delete_trace_packet keeps a few of them per size class in a cache
+// owned by the calling thread, and vktrace_create_trace_packet takes buffers
+// from that cache first. Buffers are allocated at the full size of their
+// class, and a deleted buffer is filed by its usable size as reported by
+// the allocator, so packets that were copied or read with a plain malloc
+// (trim's copy_packet, vktrace_read_trace_packet) can be handed to
+// vktrace_delete_trace_packet as before.
+
+#define VKTRACE_PACKET_CACHE_MIN_SHIFT 8    // smallest class holds 256 bytes
+#define VKTRACE_PACKET_CACHE_CLASS_COUNT 9  // largest class holds 64 KB
+#define VKTRACE_PACKET_CACHE_DEPTH 8        // buffers kept per class and thread
+
+typedef struct vktrace_packet_cache {
+    void* pBuffers[VKTRACE_PACKET_CACHE_CLASS_COUNT][VKTRACE_PACKET_CACHE_DEPTH];
+    uint32_t count[VKTRACE_PACKET_CACHE_CLASS_COUNT];
+} vktrace_packet_cache;
+
+#if defined(WIN32)
+static INIT_ONCE s_packet_cache_once = INIT_ONCE_STATIC_INIT;
+static DWORD s_packet_cache_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_once_t s_packet_cache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t s_packet_cache_key;
+static BOOL s_packet_cache_key_valid = FALSE;
+#endif
+
+static size_t vktrace_packet_buffer_usable_size(void* pBuffer) {
+#if defined(WIN32)
+    return _msize(pBuffer);
+#elif defined(PLATFORM_OSX)
+    return malloc_size(pBuffer);
+#else
+    return malloc_usable_size(pBuffer);
+#endif
+}
+
+static void VKTRACE_WINAPI vktrace_packet_cache_destroy(void* pData) {
+    vktrace_packet_cache* pCache = (vktrace_packet_cache*)pData;
+    if (pCache == NULL) {
+        return;
+    }
+    for (uint32_t sizeClass = 0; sizeClass < VKTRACE_PACKET_CACHE_CLASS_COUNT; sizeClass++) {
+        for (uint32_t i = 0; i < pCache->count[sizeClass]; i++) {
+            vktrace_free(pCache->pBuffers[sizeClass][i]);
+        }
+    }
+    vktrace_free(pCache);
+}
+
+#if defined(WIN32)
+static BOOL CALLBACK vktrace_packet_cache_create_key(PINIT_ONCE initOnce, PVOID param, PVOID* lpContext) {
+    s_packet_cache_key = FlsAlloc(vktrace_packet_cache_destroy);
+    return TRUE;
+}
+#else
+static void vktrace_packet_cache_create_key(void) {
+    s_packet_cache_key_valid = (pthread_key_create(&s_packet_cache_key, vktrace_packet_cache_destroy) == 0);
+}
+#endif
+
+// The thread-local pointer is the fast path; the key only exists so the cache is released when the thread exits.
+static VKTRACE_THREAD_LOCAL vktrace_packet_cache* t_pPacketCache = NULL;
+
+static vktrace_packet_cache* vktrace_packet_cache_create() {
+    vktrace_platform_thread_once(&s_packet_cache_once, vktrace_packet_cache_create_key);
+#if defined(WIN32)
+    if (s_packet_cache_key == FLS_OUT_OF_INDEXES) {
+        return NULL;
+    }
+#else
+    if (!s_packet_cache_key_valid) {
+        return NULL;
+    }
+#endif
+
+    vktrace_packet_cache* pCache = VKTRACE_NEW(vktrace_packet_cache);
+    if (pCache != NULL) {
+        memset(pCache, 0, sizeof(vktrace_packet_cache));
+#if defined(WIN32)
+        FlsSetValue(s_packet_cache_key, pCache);
+#else
+        pthread_setspecific(s_packet_cache_key, pCache);
+#endif
+        t_pPacketCache = pCache;
+    }
+    return pCache;
+}
+
+static void* vktrace_allocate_packet_buffer(uint64_t size) {
+    uint32_t sizeClass = 0;
+    while (sizeClass < VKTRACE_PACKET_CACHE_CLASS_COUNT && ((uint64_t)1 << (sizeClass + VKTRACE_PACKET_CACHE_MIN_SHIFT)) < size) {
+        sizeClass++;
+    }
+    if (sizeClass == VKTRACE_PACKET_CACHE_CLASS_COUNT) {
+        return vktrace_malloc((size_t)size);
+    }
+
+    vktrace_packet_cache* pCache = t_pPacketCache;
+    if (pCache != NULL && pCache->count[sizeClass] > 0) {
+        return pCache->pBuffers[sizeClass][--pCache->count[sizeClass]];
+    }
+    return vktrace_malloc((size_t)1 << (sizeClass + VKTRACE_PACKET_CACHE_MIN_SHIFT));
+}
 
-void vktrace_initialize_trace_packet_utils() { vktrace_create_critical_section(&s_packet_index_lock); }
+static void vktrace_free_packet_buffer(void* pBuffer) {
+    size_t usableSize = vktrace_packet_buffer_usable_size(pBuffer);
+    size_t maxClassSize = (size_t)1 << (VKTRACE_PACKET_CACHE_CLASS_COUNT - 1 + VKTRACE_PACKET_CACHE_MIN_SHIFT);
 
-void vktrace_deinitialize_trace_packet_utils() { vktrace_delete_critical_section(&s_packet_index_lock); }
+    // Only keep buffers that are not much larger than the class they would be used for.
+    if (usableSize >= ((size_t)1 << VKTRACE_PACKET_CACHE_MIN_SHIFT) && usableSize < 2 * maxClassSize) {
+        uint32_t sizeClass = VKTRACE_PACKET_CACHE_CLASS_COUNT - 1;
+        while (((size_t)1 << (sizeClass + VKTRACE_PACKET_CACHE_MIN_SHIFT)) > usableSize) {
+            sizeClass--;
+        }
+
+        vktrace_packet_cache* pCache = (t_pPacketCache != NULL) ? t_pPacketCache : vktrace_packet_cache_create();
+        if (pCache != NULL && pCache->count[sizeClass] < VKTRACE_PACKET_CACHE_DEPTH) {
+            pCache->pBuffers[sizeClass][pCache->count[sizeClass]++] = pBuffer;
+            return;
+        }
+    }
+    vktrace_free(pBuffer);
+}
+
+static void vktrace_tsc_clock_calibrate();
+
+void vktrace_initialize_trace_packet_utils() {
+    const char* pTscClockEnv = vktrace_get_global_var(_VKTRACE_TSC_CLOCK_ENV);
+    if (pTscClockEnv != NULL && strcmp(pTscClockEnv, "1") == 0) {
+        vktrace_tsc_clock_calibrate();
+    }
+}
+
+void vktrace_deinitialize_trace_packet_utils() {
+    vktrace_packet_cache* pCache = t_pPacketCache;
+    if (pCache != NULL) {
+        t_pPacketCache = NULL;
+#if defined(WIN32)
+        FlsSetValue(s_packet_cache_key, NULL);
+#else
+        pthread_setspecific(s_packet_cache_key, NULL);
+#endif
+        vktrace_packet_cache_destroy(pCache);
+    }
+
+    // The trace layer can be unloaded while threads of the application keep running, so the key must not outlive it, or
+    // those threads would call vktrace_packet_cache_destroy in unmapped code when they exit. Caches that other threads
+    // still own are released by FlsFree on Windows and left behind elsewhere. Packets deleted after this are freed
+    // directly, because no cache can be created without the key.
+#if defined(WIN32)
+    if (s_packet_cache_key != FLS_OUT_OF_INDEXES) {
+        FlsFree(s_packet_cache_key);
+        s_packet_cache_key = FLS_OUT_OF_INDEXES;
+    }
+#else
+    if (s_packet_cache_key_valid) {
+        s_packet_cache_key_valid = FALSE;
+        pthread_key_delete(s_packet_cache_key);
+    }
+#endif
+}
 
 uint64_t vktrace_get_unique_packet_index() {
     // Keep the s_packet_index scope to within this method, to ensure this method is always used to get a unique packet index.
-    static uint64_t s_packet_index = 0;
+    static volatile uint64_t s_packet_index = 0;
+
+    // Every traced call on every thread takes an index, so this is a single atomic add rather than a lock.
+#if defined(WIN32)
+    return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)&s_packet_index, 1);
+#else
+    return __atomic_fetch_add(&s_packet_index, 1, __ATOMIC_RELAXED);
+#endif
+}
 
-    vktrace_enter_critical_section(&s_packet_index_lock);
-    // Store the value then increment within the critical section to avoid race conditions.
-    uint64_t index = s_packet_index;
-    s_packet_index += 1;
-    vktrace_leave_critical_section(&s_packet_index_lock);
+// Counts the packets the calling thread has created, see vktrace_get_thread_packet_count.
+static VKTRACE_THREAD_LOCAL uint64_t t_createdPacketCount = 0;
 
-    // Return the stored value rather than the actual variable (again to avoid race conditions).
-    return index;
+uint64_t vktrace_get_thread_packet_count() { return t_createdPacketCount; }
+
+// Threads keep their id once it is looked up, since every packet records it.
+static vktrace_thread_id vktrace_get_packet_thread_id() {
+    static VKTRACE_THREAD_LOCAL BOOL t_threadIdValid = FALSE;
+    static VKTRACE_THREAD_LOCAL vktrace_thread_id t_threadId;
+    if (!t_threadIdValid) {
+        t_threadId = vktrace_platform_get_thread_id();
+        t_threadIdValid = TRUE;
+    }
+    return t_threadId;
 }
 
 void vktrace_gen_uuid(uint32_t* pUuid) {
@@ -75,14 +265,31 @@ void vktrace_gen_uuid(uint32_t* pUuid) {
     pUuid[3] = buf[3];
 }
 
+//=============================================================================
+// Timestamps
+//
+// vktrace_get_time returns nanoseconds of a monotonic clock, CLOCK_MONOTONIC_RAW
+// on Linux. A packet takes up to four timestamps, so when vktrace is run with
+// --TscClock the trace layer calibrates the CPU's timestamp counter against that
+// clock and vktrace_get_time converts RDTSC readings to nanoseconds with a
+// multiply and a shift instead of asking the OS. The result is nanoseconds of the
+// same clock either way, so nothing that reads packet times has to know which
+// source was used; the trace file header records it (see vktrace_get_time_source).
+// The TSC is only used if the CPU reports it as invariant, i.e. running at a
+// constant rate in all power states and synchronized across cores.
+
 #if defined(PLATFORM_LINUX)
-uint64_t vktrace_get_time() {
+static uint64_t vktrace_get_clock_time() {
     struct timespec time;
+#if defined(CLOCK_MONOTONIC_RAW)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+#else
     clock_gettime(CLOCK_MONOTONIC, &time);
+#endif
     return ((uint64_t)time.tv_sec * 1000000000) + time.tv_nsec;
 }
 #elif defined(PLATFORM_OSX)
-uint64_t vktrace_get_time() {
+static uint64_t vktrace_get_clock_time() {
     clock_serv_t cclock;
     mach_timespec_t mts;
     host_get_clock_service(mach_host_self(), CALENDAR_CLOCK, &cclock);
@@ -92,16 +299,7 @@ uint64_t vktrace_get_time() {
     return ((uint64_t)mts.tv_sec * 1000000000) + mts.tv_nsec;
 }
 #elif defined(PLATFORM_WINDOWS)
-uint64_t vktrace_get_time() {
-    // Should really avoid using RDTSC here since for RDTSC to be
-    // accurate, the process needs to stay on the same CPU and the CPU
-    // needs to stay at the same clock rate, which isn't always the case
-    // with today's power managed CPUs.
-    // But if all that is OK, the following one-liner could be used instead
-    // of the rest of this function.
-    //
-    // return __rdtsc();
-    //
+static uint64_t vktrace_get_clock_time() {
     LARGE_INTEGER count;
     static LARGE_INTEGER start, freq;
     if (0 == start.QuadPart) {
@@ -113,9 +311,108 @@ uint64_t vktrace_get_time() {
     return (uint64_t)(((count.QuadPart - start.QuadPart) * 1000000000) / freq.QuadPart);
 }
 #else
-uint64_t vktrace_get_time() { return 0; }
+static uint64_t vktrace_get_clock_time() { return 0; }
 #endif
 
+#if defined(VKTRACE_TSC_CLOCK_SUPPORTED)
+// ns = baseNs + ((ticks - baseTicks) * mult) >> VKTRACE_TSC_SHIFT
+#define VKTRACE_TSC_SHIFT 32
+// Time spent measuring the TSC frequency when the trace layer starts
+#define VKTRACE_TSC_CALIBRATION_MS 50
+
+static struct {
+    BOOL enabled;
+    uint64_t baseTicks;
+    uint64_t baseNs;
+    uint64_t mult;
+    uint64_t frequency;  // ticks per second
+} s_tscClock;
+
+static BOOL vktrace_tsc_is_invariant() {
+#if defined(PLATFORM_WINDOWS)
+    int regs[4];
+    __cpuid(regs, 0x80000000);
+    if ((unsigned int)regs[0] < 0x80000007) {
+        return FALSE;
+    }
+    __cpuid(regs, 0x80000007);
+    return (regs[3] & (1 << 8)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return FALSE;
+    }
+    return (edx & (1 << 8)) != 0;
+#endif
+}
+
+static uint64_t vktrace_tsc_to_ns(uint64_t ticks) {
+    uint64_t delta = ticks - s_tscClock.baseTicks;
+#if defined(PLATFORM_WINDOWS)
+    uint64_t high;
+    uint64_t low = _umul128(delta, s_tscClock.mult, &high);
+    return s_tscClock.baseNs + __shiftright128(low, high, VKTRACE_TSC_SHIFT);
+#else
+    return s_tscClock.baseNs + (uint64_t)(((unsigned __int128)delta * s_tscClock.mult) >> VKTRACE_TSC_SHIFT);
+#endif
+}
+
+// Reads the clock and the TSC as close together as possible, taking the middle of the
+// two TSC readings around the clock read.
+static void vktrace_tsc_sample(uint64_t* pTicks, uint64_t* pNs) {
+    uint64_t before = __rdtsc();
+    *pNs = vktrace_get_clock_time();
+    uint64_t after = __rdtsc();
+    *pTicks = before + (after - before) / 2;
+}
+
+static void vktrace_tsc_clock_calibrate() {
+    if (!vktrace_tsc_is_invariant()) {
+        vktrace_LogWarning("The CPU does not have an invariant TSC, timestamps will be read from the OS clock.");
+        return;
+    }
+
+    uint64_t startTicks, startNs, endTicks, endNs;
+    vktrace_tsc_sample(&startTicks, &startNs);
+    Sleep(VKTRACE_TSC_CALIBRATION_MS);
+    vktrace_tsc_sample(&endTicks, &endNs);
+    if (endNs <= startNs || endTicks <= startTicks) {
+        vktrace_LogWarning("Failed to calibrate the TSC, timestamps will be read from the OS clock.");
+        return;
+    }
+
+    s_tscClock.frequency = (uint64_t)((double)(endTicks - startTicks) * 1000000000.0 / (double)(endNs - startNs));
+    s_tscClock.mult = (uint64_t)(((double)(endNs - startNs) / (double)(endTicks - startTicks)) * (double)(1ULL << VKTRACE_TSC_SHIFT));
+    s_tscClock.baseTicks = endTicks;
+    s_tscClock.baseNs = endNs;
+    s_tscClock.enabled = TRUE;
+    vktrace_LogVerbose("Using the TSC for timestamps, measured at %llu Hz.", (unsigned long long)s_tscClock.frequency);
+}
+#else
+static void vktrace_tsc_clock_calibrate() { vktrace_LogWarning("The TSC clock is not supported on this platform."); }
+#endif
+
+uint64_t vktrace_get_time() {
+#if defined(VKTRACE_TSC_CLOCK_SUPPORTED)
+    if (s_tscClock.enabled) {
+        return vktrace_tsc_to_ns(__rdtsc());
+    }
+#endif
+    return vktrace_get_clock_time();
+}
+
+void vktrace_get_time_source(uint64_t* pTimeSource, uint64_t* pTscFrequency) {
+#if defined(VKTRACE_TSC_CLOCK_SUPPORTED)
+    if (s_tscClock.enabled) {
+        *pTimeSource = VKTRACE_TIME_SOURCE_TSC;
+        *pTscFrequency = s_tscClock.frequency;
+        return;
+    }
+#endif
+    *pTimeSource = VKTRACE_TIME_SOURCE_CLOCK;
+    *pTscFrequency = 0;
+}
+
 uint64_t get_endianess() {
     uint32_t x = 1;
     return *((char*)&x) ? VKTRACE_LITTLE_ENDIAN : VKTRACE_BIG_ENDIAN;
@@ -167,6 +464,26 @@ uint64_t get_os() {
     return rval;
 }
 
+static const uint16_t s_portability_table_packet_ids[] = {
+    VKTRACE_TPI_VK_vkBindImageMemory, VKTRACE_TPI_VK_vkBindBufferMemory, VKTRACE_TPI_VK_vkBindImageMemory2KHR,
+    VKTRACE_TPI_VK_vkBindBufferMemory2KHR, VKTRACE_TPI_VK_vkAllocateMemory, VKTRACE_TPI_VK_vkDestroyImage,
+    VKTRACE_TPI_VK_vkDestroyBuffer, VKTRACE_TPI_VK_vkFreeMemory, VKTRACE_TPI_VK_vkCreateBuffer,
+    VKTRACE_TPI_VK_vkCreateImage};
+
+const uint16_t* vktrace_get_portability_table_packet_ids(uint32_t* pCount) {
+    *pCount = sizeof(s_portability_table_packet_ids) / sizeof(s_portability_table_packet_ids[0]);
+    return s_portability_table_packet_ids;
+}
+
+BOOL vktrace_is_portability_table_packet(uint16_t packet_id) {
+    for (uint32_t i = 0; i < sizeof(s_portability_table_packet_ids) / sizeof(s_portability_table_packet_ids[0]); i++) {
+        if (packet_id == s_portability_table_packet_ids[i]) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 //=============================================================================
 // Methods for creating, populating, and writing trace packets
 
@@ -175,14 +492,21 @@ vktrace_trace_packet_header* vktrace_create_trace_packet(uint8_t tracer_id, uint
     // Always allocate at least enough space for the packet header
     uint64_t total_packet_size =
         ROUNDUP_TO_8(sizeof(vktrace_trace_packet_header) + ROUNDUP_TO_8(packet_size) + additional_buffers_size);
-    void* pMemory = vktrace_malloc((size_t)total_packet_size);
-    memset(pMemory, 0, (size_t)total_packet_size);
+    void* pMemory = vktrace_allocate_packet_buffer(total_packet_size);
+
+    // Only the header and packet struct are cleared here. Cached buffers still hold the previous packet, so the round-up
+    // padding of the additional buffers is cleared as they are added, and the slack after them when the packet is finalized.
+    // Anything else written into the space after the packet struct must go through vktrace_add_buffer_to_trace_packet, or be
+    // written after vktrace_finalize_trace_packet, like the memory handle __HOOKED_vkAllocateMemory keeps at the end of its
+    // packet. Otherwise the packet carries bytes of whatever packet used the buffer before.
+    memset(pMemory, 0, (size_t)(sizeof(vktrace_trace_packet_header) + ROUNDUP_TO_8(packet_size)));
 
     vktrace_trace_packet_header* pHeader = (vktrace_trace_packet_header*)pMemory;
     pHeader->size = total_packet_size;
     pHeader->global_packet_index = vktrace_get_unique_packet_index();
     pHeader->tracer_id = tracer_id;
-    pHeader->thread_id = vktrace_platform_get_thread_id();
+    pHeader->thread_id = vktrace_get_packet_thread_id();
+    t_createdPacketCount++;
     pHeader->packet_id = packet_id;
     if (pHeader->vktrace_begin_time == 0) pHeader->vktrace_begin_time = vktrace_get_time();
     pHeader->entrypoint_begin_time = pHeader->vktrace_begin_time;
@@ -205,7 +529,7 @@ void vktrace_delete_trace_packet(vktrace_trace_packet_header** ppHeader) {
     if (ppHeader == NULL) return;
     if (*ppHeader == NULL) return;
 
-    VKTRACE_DELETE(*ppHeader);
+    vktrace_free_packet_buffer(*ppHeader);
     *ppHeader = NULL;
 }
 
@@ -248,6 +572,9 @@ void vktrace_add_buffer_to_trace_packet(vktrace_trace_packet_header* pHeader, vo
 
         // copy buffer to the location
         vktrace_pageguard_memcpy(*ptr_address, pBuffer, (size_t)size);
+        if (ROUNDUP_TO_4(size) != size) {
+            memset((char*)*ptr_address + size, 0, (size_t)(ROUNDUP_TO_4(size) - size));
+        }
     }
 }
 
@@ -398,6 +725,10 @@ void vktrace_set_packet_entrypoint_end_time(vktrace_trace_packet_header* pHeader
 }
 
 void vktrace_finalize_trace_packet(vktrace_trace_packet_header* pHeader) {
+    // Clear the space reserved for additional buffers that wasn't used, see vktrace_create_trace_packet().
+    if (pHeader->next_buffers_offset < pHeader->size) {
+        memset((char*)pHeader + pHeader->next_buffers_offset, 0, (size_t)(pHeader->size - pHeader->next_buffers_offset));
+    }
     if (pHeader->entrypoint_end_time == 0) {
         vktrace_set_packet_entrypoint_end_time(pHeader);
     }
@@ -416,6 +747,14 @@ void vktrace_write_trace_packet(const vktrace_trace_packet_header* pHeader, File
 //=============================================================================
 // Methods for Reading and interpretting trace packets
 
+// Reads the first copy of a deduplicated chunk, and goes back to where the next packet starts.
+static BOOL vktrace_read_trace_bytes(void* pUserData, uint64_t fileOffset, void* pBytes, uint64_t size) {
+    FileLike* pFile = (FileLike*)pUserData;
+    uint64_t position = vktrace_FileLike_GetCurrentPosition(pFile);
+    BOOL result = vktrace_FileLike_SetCurrentPosition(pFile, fileOffset) && vktrace_FileLike_ReadRaw(pFile, pBytes, size);
+    return vktrace_FileLike_SetCurrentPosition(pFile, position) && result;
+}
+
 vktrace_trace_packet_header* vktrace_read_trace_packet(FileLike* pFile) {
     // read size
     // allocate space
@@ -443,6 +782,16 @@ vktrace_trace_packet_header* vktrace_read_trace_packet(FileLike* pFile) {
         vktrace_LogError("Malloc failed in vktrace_read_trace_packet of size %u.", total_packet_size);
     }
 
+    if (pHeader != NULL && pHeader->packet_id == VKTRACE_TPI_DEDUPLICATED_PACKET) {
+        if (pFile->mDedupReader == NULL) {
+            pFile->mDedupReader = vktrace_dedup_reader_create(0);
+        }
+        vktrace_trace_packet_header* pRestored =
+            vktrace_dedup_reader_restore(pFile->mDedupReader, pHeader, vktrace_read_trace_bytes, pFile);
+        vktrace_free(pHeader);
+        pHeader = pRestored;
+    }
+
     return pHeader;
 }
 
@@ -36,6 +36,10 @@ void vktrace_gen_uuid(uint32_t* pUuid);
 
 uint64_t vktrace_get_time();
 
+// How vktrace_get_time takes timestamps in this process, a VKTRACE_TIME_SOURCE_* value, and the
+// TSC frequency in ticks per second if it uses the TSC.
+void vktrace_get_time_source(uint64_t* pTimeSource, uint64_t* pTscFrequency);
+
 void vktrace_initialize_trace_packet_utils();
 void vktrace_deinitialize_trace_packet_utils();
 
@@ -43,6 +47,11 @@ uint64_t get_endianess();
 uint64_t get_arch();
 uint64_t get_os();
 
+// Packets vkreplay needs to find before replaying them to determine what memory index should be used, their file
+// offsets are kept in the portability table. Returns their packet ids and sets *pCount to how many there are.
+const uint16_t* vktrace_get_portability_table_packet_ids(uint32_t* pCount);
+BOOL vktrace_is_portability_table_packet(uint16_t packet_id);
+
 static FILE* vktrace_open_trace_file(vktrace_process_info* pProcInfo) {
     FILE* tracefp = NULL;
     assert(pProcInfo != NULL);
@@ -73,10 +82,20 @@ static FILE* vktrace_open_trace_file(vktrace_process_info* pProcInfo) {
 // \param packet_size should include the total bytes for the specific type of packet, and any additional buffers needed by the
 // packet.
 //        The size of the header will be added automatically within the function.
+// Only the header and packet struct are zeroed, since the buffer may be reused from the packet cache. The additional
+// buffers are written by vktrace_add_buffer_to_trace_packet, which zeroes their padding, and the space left after them is
+// zeroed by vktrace_finalize_trace_packet. Data written into the packet any other way has to be written after the packet
+// is finalized.
 vktrace_trace_packet_header* vktrace_create_trace_packet(uint8_t tracer_id, uint16_t packet_id, uint64_t packet_size,
                                                          uint64_t additional_buffers_size);
 
+// Returns how many packets the calling thread has created with vktrace_create_trace_packet. Every traced call creates its
+// packet before it does anything else, so this changes when the thread starts its next call.
+uint64_t vktrace_get_thread_packet_count();
+
 // deletes a trace packet and sets pointer to NULL
+// Small packets are kept in a cache owned by the calling thread and reused by vktrace_create_trace_packet.
+// Any packet allocated with malloc may be passed in, not just those from vktrace_create_trace_packet.
 void vktrace_delete_trace_packet(vktrace_trace_packet_header** ppHeader);
 
 // gets the next address available to write a buffer into the packet
@@ -98,6 +117,9 @@ void vktrace_set_packet_entrypoint_end_time(vktrace_trace_packet_header* pHeader
 
 // void initialize_trace_packet_header(vktrace_trace_packet_header* pHeader, uint8_t tracer_id, uint16_t packet_id, uint64_t
 // total_packet_size);
+
+// Sets the end times and zeroes the space after the last additional buffer, so anything stored in that space has to be
+// written after this call.
 void vktrace_finalize_trace_packet(vktrace_trace_packet_header* pHeader);
 
 // Write the trace packet to the filelike thing.
@@ -107,7 +129,8 @@ void vktrace_write_trace_packet(const vktrace_trace_packet_header* pHeader, File
 //=============================================================================
 // Methods for Reading and interpretting trace packets
 
-// Reads in the trace packet header, the body of the packet, and additional buffers
+// Reads in the trace packet header, the body of the packet, and additional buffers.
+// A VKTRACE_TPI_DEDUPLICATED_PACKET is returned as the packet it was made from.
 vktrace_trace_packet_header* vktrace_read_trace_packet(FileLike* pFile);
 
 // converts a pointer variable that is currently byte offset into a pointer to the actual offset location
@@ -0,0 +1,229 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+extern "C" {
+#include "vktrace_common.h"
+#include "vktrace_block_file.h"
+#include "vktrace_filelike.h"
+#include "vktrace_settings.h"
+#include "vktrace_trace_packet_identifiers.h"
+}
+
+// vktraceconvert converts a trace file between the uncompressed format and the block
+// compressed format (VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED), in whichever direction
+// the input file calls for. Only the container changes: the packets, the portability table
+// and all file offsets stored in the trace stay the same, so deduplicated traces
+// (VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED) stay deduplicated.
+
+typedef struct vktraceconvert_settings {
+    const char* pInputTrace;
+    const char* pOutputTrace;
+    unsigned int blockSizeKB;
+    const char* verbosity;
+} vktraceconvert_settings;
+
+static vktraceconvert_settings g_settings = {NULL, NULL, VKTRACE_BLOCK_FILE_DEFAULT_BLOCK_SIZE / 1024, NULL};
+static vktraceconvert_settings g_default_settings = {NULL, NULL, VKTRACE_BLOCK_FILE_DEFAULT_BLOCK_SIZE / 1024, NULL};
+
+static vktrace_SettingInfo g_settings_info[] = {
+    {"i",
+     "InputTrace",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pInputTrace},
+     {&g_default_settings.pInputTrace},
+     TRUE,
+     "Path to the trace file to convert."},
+    {"o",
+     "OutputTrace",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pOutputTrace},
+     {&g_default_settings.pOutputTrace},
+     TRUE,
+     "Path to the converted trace file."},
+    {"b",
+     "BlockSize",
+     VKTRACE_SETTING_UINT,
+     {&g_settings.blockSizeKB},
+     {&g_default_settings.blockSizeKB},
+     TRUE,
+     "Size in KB of the uncompressed data in each block when compressing, default is 1024."},
+    {"v",
+     "Verbosity",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.verbosity},
+     {&g_default_settings.verbosity},
+     TRUE,
+     "Verbosity mode. Modes are \"quiet\", \"errors\", \"warnings\", "
+     "\"full\"."},
+};
+
+static vktrace_SettingGroup g_settingGroup = {"vktraceconvert", sizeof(g_settings_info) / sizeof(g_settings_info[0]),
+                                              &g_settings_info[0]};
+
+static const uint64_t kCopyChunkSize = 8 * 1024 * 1024;
+
+// Copies everything from the current position of pInput to its end, either to pOutput or through pBlockWriter.
+static bool copy_packets(FileLike* pInput, FILE* pOutput, vktrace_block_writer* pBlockWriter) {
+    std::vector<char> buffer((size_t)kCopyChunkSize);
+    uint64_t remaining = pInput->mFileLen - vktrace_FileLike_GetCurrentPosition(pInput);
+    while (remaining > 0) {
+        uint64_t count = (remaining < kCopyChunkSize) ? remaining : kCopyChunkSize;
+        if (!vktrace_FileLike_ReadRaw(pInput, buffer.data(), count)) {
+            vktrace_LogError("Failed to read from the input trace file.");
+            return false;
+        }
+        bool written = (pBlockWriter != NULL) ? vktrace_block_writer_write(pBlockWriter, buffer.data(), count) == TRUE
+                                              : fwrite(buffer.data(), 1, (size_t)count, pOutput) == count;
+        if (!written) {
+            vktrace_LogError("Failed to write to the output trace file.");
+            return false;
+        }
+        remaining -= count;
+    }
+    return true;
+}
+
+static int convert(FileLike* pInput, FILE* pOutput) {
+    vktrace_trace_file_header header;
+    if (!vktrace_FileLike_ReadRaw(pInput, &header, sizeof(header)) || header.magic != VKTRACE_FILE_MAGIC ||
+        header.first_packet_offset < sizeof(header) || header.first_packet_offset > pInput->mFileLen) {
+        vktrace_LogError("%s does not appear to be a valid Vulkan trace file.", g_settings.pInputTrace);
+        return -1;
+    }
+
+    bool compress = (pInput->mMode != FileLike::BlockFile);
+    bool deduplicated = VKTRACE_TRACE_FILE_IS_DEDUPLICATED(header.trace_file_version);
+    if (compress && header.trace_file_version != VKTRACE_TRACE_FILE_VERSION &&
+        header.trace_file_version != VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED) {
+        vktrace_LogError("Only version %u and %u trace files can be compressed, %s is version %u.", VKTRACE_TRACE_FILE_VERSION,
+                         VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED, g_settings.pInputTrace, header.trace_file_version);
+        return -1;
+    }
+    if (!compress && !VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(header.trace_file_version)) {
+        vktrace_LogError("%s has a block index but unexpected trace file version %u.", g_settings.pInputTrace,
+                         header.trace_file_version);
+        return -1;
+    }
+
+    // The header and gpu info are copied as they are, apart from the version.
+    std::vector<char> headerData((size_t)header.first_packet_offset);
+    if (!vktrace_FileLike_SetCurrentPosition(pInput, 0) ||
+        !vktrace_FileLike_ReadRaw(pInput, headerData.data(), header.first_packet_offset)) {
+        vktrace_LogError("Unable to read header from file.");
+        return -1;
+    }
+    if (deduplicated) {
+        header.trace_file_version =
+            compress ? VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED : VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED;
+    } else {
+        header.trace_file_version = compress ? VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED : VKTRACE_TRACE_FILE_VERSION;
+    }
+    memcpy(headerData.data(), &header, sizeof(header));
+    if (fwrite(headerData.data(), 1, headerData.size(), pOutput) != headerData.size()) {
+        vktrace_LogError("Unable to write trace file header.");
+        return -1;
+    }
+
+    vktrace_block_writer* pBlockWriter = NULL;
+    if (compress) {
+        uint64_t blockSize = (uint64_t)g_settings.blockSizeKB * 1024;
+        if (blockSize == 0 || blockSize > VKTRACE_BLOCK_FILE_MAX_BLOCK_SIZE) {
+            vktrace_LogError("Block size must be between 1 and %u KB.", VKTRACE_BLOCK_FILE_MAX_BLOCK_SIZE / 1024);
+            return -1;
+        }
+        pBlockWriter = vktrace_block_writer_create(pOutput, header.first_packet_offset, (uint32_t)blockSize);
+    }
+
+    bool copied = copy_packets(pInput, pOutput, pBlockWriter);
+    if (pBlockWriter != NULL) {
+        copied = vktrace_block_writer_finish(pBlockWriter) && copied;
+        vktrace_block_writer_destroy(&pBlockWriter);
+    }
+    if (!copied) {
+        return -1;
+    }
+
+    vktrace_LogVerbose("%s %s into %s.", compress ? "Compressed" : "Decompressed", g_settings.pInputTrace,
+                       g_settings.pOutputTrace);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+
+    if (vktrace_SettingGroup_init_from_cmdline(&g_settingGroup, argc, argv, NULL) != 0) {
+        return -1;
+    }
+
+    if (g_settings.verbosity == NULL || !strcmp(g_settings.verbosity, "errors"))
+        vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+    else if (!strcmp(g_settings.verbosity, "quiet"))
+        vktrace_LogSetLevel(VKTRACE_LOG_NONE);
+    else if (!strcmp(g_settings.verbosity, "warnings"))
+        vktrace_LogSetLevel(VKTRACE_LOG_WARNING);
+    else if (!strcmp(g_settings.verbosity, "full"))
+        vktrace_LogSetLevel(VKTRACE_LOG_VERBOSE);
+    else {
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    if (g_settings.pInputTrace == NULL || g_settings.pOutputTrace == NULL) {
+        vktrace_LogError("Usage: vktraceconvert -i <input trace> -o <output trace> [options]");
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+    if (!strcmp(g_settings.pInputTrace, g_settings.pOutputTrace)) {
+        vktrace_LogError("The input and output trace files must be different.");
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FILE* pInputFile = fopen(g_settings.pInputTrace, "rb");
+    if (pInputFile == NULL) {
+        vktrace_LogError("Cannot open trace file: '%s'.", g_settings.pInputTrace);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+    FILE* pOutputFile = fopen(g_settings.pOutputTrace, "wb");
+    if (pOutputFile == NULL) {
+        vktrace_LogError("Cannot create trace file: '%s'.", g_settings.pOutputTrace);
+        fclose(pInputFile);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FileLike* pInput = vktrace_FileLike_create_file(pInputFile);
+    int result = convert(pInput, pOutputFile);
+    vktrace_FileLike_destroy(&pInput);
+
+    fclose(pInputFile);
+    if (fclose(pOutputFile) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        remove(g_settings.pOutputTrace);
+    }
+    vktrace_SettingGroup_delete(&g_settingGroup);
+    return result;
+}
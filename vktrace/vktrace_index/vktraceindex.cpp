@@ -0,0 +1,217 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+
+extern "C" {
+#include "vktrace_common.h"
+#include "vktrace_dedup.h"
+#include "vktrace_filelike.h"
+#include "vktrace_settings.h"
+#include "vktrace_trace_index.h"
+#include "vktrace_trace_packet_identifiers.h"
+#include "vktrace_vk_packet_id.h"
+}
+
+// vktraceindex writes the packet index (see vktrace_trace_index.h) of a trace file that
+// was captured without one, or whose index is out of date. Only packet headers are
+// read, so this works on compressed trace files too. Deduplicated packets are indexed
+// as the packets they were made from, and can be reported on per packet type.
+
+typedef struct vktraceindex_settings {
+    const char* pInputTrace;
+    BOOL report;
+    const char* verbosity;
+} vktraceindex_settings;
+
+static vktraceindex_settings g_settings = {NULL, FALSE, NULL};
+static vktraceindex_settings g_default_settings = {NULL, FALSE, NULL};
+
+static vktrace_SettingInfo g_settings_info[] = {
+    {"i",
+     "InputTrace",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pInputTrace},
+     {&g_default_settings.pInputTrace},
+     TRUE,
+     "Path to the trace file to index."},
+    {"r",
+     "Report",
+     VKTRACE_SETTING_BOOL,
+     {&g_settings.report},
+     {&g_default_settings.report},
+     TRUE,
+     "Print the number of packets of each type, their size in the trace file and their size when restored."},
+    {"v",
+     "Verbosity",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.verbosity},
+     {&g_default_settings.verbosity},
+     TRUE,
+     "Verbosity mode. Modes are \"quiet\", \"errors\", \"warnings\", "
+     "\"full\"."},
+};
+
+static vktrace_SettingGroup g_settingGroup = {"vktraceindex", sizeof(g_settings_info) / sizeof(g_settings_info[0]),
+                                              &g_settings_info[0]};
+
+static void print_report(const std::map<uint16_t, vktrace_dedup_stats>& stats) {
+    vktrace_dedup_stats total = {};
+    vktrace_LogAlways("%-48s %10s %10s %14s %14s %7s", "Packet", "Count", "Dedup'd", "Stored bytes", "Traced bytes", "Ratio");
+    for (auto& it : stats) {
+        const vktrace_dedup_stats& packetStats = it.second;
+        const char* pName = vktrace_vk_packet_id_name((VKTRACE_TRACE_PACKET_ID_VK)it.first);
+        char name[32];
+        if (pName == NULL) {
+            // Markers, messages and the portability table
+            snprintf(name, sizeof(name), "packet id %u", (unsigned)it.first);
+            pName = name;
+        }
+        vktrace_LogAlways("%-48s %10llu %10llu %14llu %14llu %6.2fx", pName,
+                          (unsigned long long)packetStats.packetCount, (unsigned long long)packetStats.deduplicatedCount,
+                          (unsigned long long)packetStats.storedBytes, (unsigned long long)packetStats.packetBytes,
+                          (double)packetStats.packetBytes / (double)packetStats.storedBytes);
+        total.packetCount += packetStats.packetCount;
+        total.deduplicatedCount += packetStats.deduplicatedCount;
+        total.storedBytes += packetStats.storedBytes;
+        total.packetBytes += packetStats.packetBytes;
+    }
+    vktrace_LogAlways("%-48s %10llu %10llu %14llu %14llu %6.2fx", "Total", (unsigned long long)total.packetCount,
+                      (unsigned long long)total.deduplicatedCount, (unsigned long long)total.storedBytes,
+                      (unsigned long long)total.packetBytes,
+                      total.storedBytes > 0 ? (double)total.packetBytes / (double)total.storedBytes : 1.0);
+}
+
+static int build_index(FileLike* pInput) {
+    vktrace_trace_file_header header;
+    if (!vktrace_FileLike_ReadRaw(pInput, &header, sizeof(header)) || header.magic != VKTRACE_FILE_MAGIC ||
+        header.first_packet_offset < sizeof(header) || header.first_packet_offset > pInput->mFileLen) {
+        vktrace_LogError("%s does not appear to be a valid Vulkan trace file.", g_settings.pInputTrace);
+        return -1;
+    }
+
+    vktrace_trace_index_writer* pWriter = vktrace_trace_index_writer_create(g_settings.pInputTrace, header.first_packet_offset);
+    if (pWriter == NULL) {
+        return -1;
+    }
+
+    bool indexed = true;
+    uint64_t packetCount = 0;
+    uint64_t frameCount = 0;
+    uint64_t fileOffset = header.first_packet_offset;
+    vktrace_trace_packet_header packetHeader;
+    vktrace_trace_packet_deduplicated deduplicated;
+    std::map<uint16_t, vktrace_dedup_stats> stats;
+    while (indexed && fileOffset < pInput->mFileLen) {
+        if (!vktrace_FileLike_SetCurrentPosition(pInput, fileOffset) ||
+            !vktrace_FileLike_ReadRaw(pInput, &packetHeader, sizeof(packetHeader))) {
+            vktrace_LogError("Failed to read the packet at offset %llu.", (unsigned long long)fileOffset);
+            indexed = false;
+        } else if (packetHeader.size < sizeof(packetHeader) || packetHeader.size > pInput->mFileLen - fileOffset) {
+            vktrace_LogError("The packet at offset %llu has an invalid size of %llu.", (unsigned long long)fileOffset,
+                             (unsigned long long)packetHeader.size);
+            indexed = false;
+        } else if (packetHeader.packet_id == VKTRACE_TPI_DEDUPLICATED_PACKET &&
+                   (packetHeader.size < sizeof(packetHeader) + sizeof(deduplicated) ||
+                    !vktrace_FileLike_ReadRaw(pInput, &deduplicated, sizeof(deduplicated)))) {
+            vktrace_LogError("Failed to read the deduplicated packet at offset %llu.", (unsigned long long)fileOffset);
+            indexed = false;
+        } else {
+            uint64_t packetSize = packetHeader.size;
+            if (packetHeader.packet_id == VKTRACE_TPI_DEDUPLICATED_PACKET) {
+                packetHeader.packet_id = deduplicated.packet_id;
+                packetSize = deduplicated.packet_size;
+            }
+            vktrace_dedup_stats& packetStats = stats[packetHeader.packet_id];
+            packetStats.packetCount++;
+            packetStats.deduplicatedCount += (packetSize != packetHeader.size) ? 1 : 0;
+            packetStats.packetBytes += packetSize;
+            packetStats.storedBytes += packetHeader.size;
+
+            uint8_t flags = 0;
+            if (packetHeader.packet_id == VKTRACE_TPI_VK_vkQueuePresentKHR) {
+                flags = VKTRACE_TRACE_INDEX_FRAME_END;
+                frameCount++;
+            }
+            indexed = vktrace_trace_index_writer_add(pWriter, fileOffset, &packetHeader, flags) == TRUE;
+            fileOffset += packetHeader.size;
+            packetCount++;
+        }
+    }
+
+    if (indexed) {
+        indexed = vktrace_trace_index_writer_finish(pWriter) == TRUE;
+    }
+    vktrace_trace_index_writer_destroy(&pWriter);
+    if (!indexed) {
+        return -1;
+    }
+
+    vktrace_LogVerbose("Indexed %llu packets and %llu frames of %s.", (unsigned long long)packetCount,
+                       (unsigned long long)frameCount, g_settings.pInputTrace);
+    if (g_settings.report) {
+        print_report(stats);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+
+    if (vktrace_SettingGroup_init_from_cmdline(&g_settingGroup, argc, argv, NULL) != 0) {
+        return -1;
+    }
+
+    if (g_settings.verbosity == NULL || !strcmp(g_settings.verbosity, "errors"))
+        vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+    else if (!strcmp(g_settings.verbosity, "quiet"))
+        vktrace_LogSetLevel(VKTRACE_LOG_NONE);
+    else if (!strcmp(g_settings.verbosity, "warnings"))
+        vktrace_LogSetLevel(VKTRACE_LOG_WARNING);
+    else if (!strcmp(g_settings.verbosity, "full"))
+        vktrace_LogSetLevel(VKTRACE_LOG_VERBOSE);
+    else {
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    if (g_settings.pInputTrace == NULL) {
+        vktrace_LogError("Usage: vktraceindex -i <trace> [options]");
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FILE* pInputFile = fopen(g_settings.pInputTrace, "rb");
+    if (pInputFile == NULL) {
+        vktrace_LogError("Cannot open trace file: '%s'.", g_settings.pInputTrace);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FileLike* pInput = vktrace_FileLike_create_file(pInputFile);
+    int result = build_index(pInput);
+    vktrace_FileLike_destroy(&pInput);
+
+    fclose(pInputFile);
+    vktrace_SettingGroup_delete(&g_settingGroup);
+    return result;
+}
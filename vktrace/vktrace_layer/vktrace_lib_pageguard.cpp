@@ -21,6 +21,58 @@
 #include "vktrace_lib_pageguardcapture.h"
 #include "vktrace_lib_pageguard.h"
 #include "vktrace_lib_trim.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#if defined(PLATFORM_LINUX)
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+
+#if defined(__NR_userfaultfd) && defined(UFFDIO_WRITEPROTECT)
+#define PAGEGUARD_UFFD_WP_SUPPORTED
+#endif
+
+// Kernel interfaces added in Linux 6.7, for building with older kernel headers.
+#ifndef UFFD_USER_MODE_ONLY
+#define UFFD_USER_MODE_ONLY 1
+#endif
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_UNPOPULATED (1 << 13)
+#define UFFD_FEATURE_WP_ASYNC (1 << 15)
+#endif
+#ifndef PAGEMAP_SCAN
+#define PAGE_IS_WRITTEN (1 << 1)
+#define PM_SCAN_WP_MATCHING (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC (1 << 1)
+struct page_region {
+    uint64_t start;
+    uint64_t end;
+    uint64_t categories;
+};
+struct pm_scan_arg {
+    uint64_t size;
+    uint64_t flags;
+    uint64_t start;
+    uint64_t end;
+    uint64_t walk_end;
+    uint64_t vec;
+    uint64_t vec_len;
+    uint64_t max_pages;
+    uint64_t category_inverted;
+    uint64_t category_mask;
+    uint64_t category_anyof_mask;
+    uint64_t return_mask;
+};
+#define PAGEMAP_SCAN _IOWR('f', 16, struct pm_scan_arg)
+#endif
+
+static const uint64_t PAGEGUARD_PAGEMAP_SOFT_DIRTY = 1ULL << 55;  // bit of a /proc/self/pagemap entry
+static const uint64_t PAGEGUARD_PAGEMAP_BATCH_SIZE = 512;         // pagemap entries read at once
+static const uint64_t PAGEGUARD_SCAN_REGION_COUNT = 64;           // written page ranges returned by one PAGEMAP_SCAN
+#endif
 
 static const bool PAGEGUARD_PAGEGUARD_ENABLE_DEFAULT = true;
 
@@ -138,9 +190,174 @@ bool getEnablePageGuardLazyCopyFlag() {
     return EnablePageGuardLazyCopyFlag;
 }
 
+bool getEnablePageGuardDeltaFlag() {
+    static bool EnablePageGuardDeltaFlag;
+    static bool FirstTimeRun = true;
+    if (FirstTimeRun) {
+        EnablePageGuardDeltaFlag = (vktrace_get_global_var(VKTRACE_PAGEGUARD_ENABLE_DELTA_ENV) != NULL);
+        FirstTimeRun = false;
+    }
+    return EnablePageGuardDeltaFlag;
+}
+
 #if defined(PLATFORM_LINUX)
 static struct sigaction g_old_sa;
+
+// The uffd and softdirty tracking modes share these for the whole process, they stay open until the process quits.
+#if defined(PAGEGUARD_UFFD_WP_SUPPORTED)
+static int g_uffd = -1;  // userfaultfd the tracked mapped memory is registered with
 #endif
+static int g_pagemap_fd = -1;     // /proc/self/pagemap
+static int g_clear_refs_fd = -1;  // /proc/self/clear_refs
+
+static bool pageguardReadPagemap(PBYTE pFirstPage, uint64_t* pEntries, uint64_t count) {
+    off_t offset = (off_t)(((uint64_t)pFirstPage / pageguardGetSystemPageSize()) * sizeof(uint64_t));
+    ssize_t length = (ssize_t)(count * sizeof(uint64_t));
+    return pread(g_pagemap_fd, pEntries, length, offset) == length;
+}
+
+static bool pageguardInitSoftDirtyTracking() {
+    bool supported = false;
+    uint64_t pageSize = pageguardGetSystemPageSize();
+    g_pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    g_clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    void* pProbe = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if ((g_pagemap_fd != -1) && (g_clear_refs_fd != -1) && (pProbe != MAP_FAILED)) {
+        // Kernels built without CONFIG_MEM_SOFT_DIRTY accept the clear but never set the bit, so check that a write sets it.
+        volatile BYTE* pPage = (volatile BYTE*)pProbe;
+        uint64_t entry = 0;
+        pPage[0] = 1;
+        pageguardClearSoftDirtyPages();
+        supported = pageguardReadPagemap((PBYTE)pProbe, &entry, 1) && !(entry & PAGEGUARD_PAGEMAP_SOFT_DIRTY);
+        pPage[0] = 2;
+        supported = supported && pageguardReadPagemap((PBYTE)pProbe, &entry, 1) && (entry & PAGEGUARD_PAGEMAP_SOFT_DIRTY);
+    }
+    if (pProbe != MAP_FAILED) {
+        munmap(pProbe, pageSize);
+    }
+    if (!supported) {
+        if (g_pagemap_fd != -1) {
+            close(g_pagemap_fd);
+            g_pagemap_fd = -1;
+        }
+        if (g_clear_refs_fd != -1) {
+            close(g_clear_refs_fd);
+            g_clear_refs_fd = -1;
+        }
+    }
+    return supported;
+}
+
+// Finds the pages in [pMemory, pMemory + size) that were written since they were last write protected, and write protects them
+// again. Returns the number of page ranges stored in pRegions or -1 on failure. *ppScanEnd is set to where the scan stopped,
+// which is before pMemory + size if pRegions filled up.
+static long pageguardScanWrittenPages(PBYTE pMemory, uint64_t size, struct page_region* pRegions, uint64_t regionCount,
+                                      PBYTE* ppScanEnd) {
+    struct pm_scan_arg scanArg;
+    memset(&scanArg, 0, sizeof(scanArg));
+    scanArg.size = sizeof(scanArg);
+    scanArg.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+    scanArg.start = (uint64_t)pMemory;
+    scanArg.end = (uint64_t)pMemory + size;
+    scanArg.vec = (uint64_t)pRegions;
+    scanArg.vec_len = regionCount;
+    scanArg.category_mask = PAGE_IS_WRITTEN;
+    scanArg.return_mask = PAGE_IS_WRITTEN;
+    long count = ioctl(g_pagemap_fd, PAGEMAP_SCAN, &scanArg);
+    if ((count >= 0) && (scanArg.walk_end <= scanArg.start)) {
+        count = -1;  // no progress
+    }
+    *ppScanEnd = (PBYTE)scanArg.walk_end;
+    return count;
+}
+
+static bool pageguardInitUffdWriteTracking() {
+    bool supported = false;
+#if defined(PAGEGUARD_UFFD_WP_SUPPORTED)
+    // UFFD_USER_MODE_ONLY is enough for write protection and lets the app use userfaultfd even if vm.unprivileged_userfaultfd
+    // is 0, kernels older than 5.11 don't know it.
+    g_uffd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (g_uffd == -1) {
+        g_uffd = (int)syscall(__NR_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+    }
+    g_pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if ((g_uffd != -1) && (g_pagemap_fd != -1)) {
+        // With WP_ASYNC the kernel resolves the write faults itself and only records that the page was written, so the app
+        // never waits on a write and nothing has to read fault events from the userfaultfd.
+        struct uffdio_api uffdApi;
+        memset(&uffdApi, 0, sizeof(uffdApi));
+        uffdApi.api = UFFD_API;
+        uffdApi.features = UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED;
+        supported = (ioctl(g_uffd, UFFDIO_API, &uffdApi) == 0);
+    }
+    if (supported) {
+        // Check a written page is found once on a probe page, as a kernel without PAGEMAP_SCAN fails the scan.
+        uint64_t pageSize = pageguardGetSystemPageSize();
+        void* pProbe = mmap(NULL, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        supported = (pProbe != MAP_FAILED) && pageguardStartWriteTracking((PBYTE)pProbe, pageSize);
+        if (supported) {
+            struct page_region region;
+            PBYTE pScanEnd;
+            *(volatile BYTE*)pProbe = 1;
+            supported = (pageguardScanWrittenPages((PBYTE)pProbe, pageSize, &region, 1, &pScanEnd) == 1) &&
+                        (pageguardScanWrittenPages((PBYTE)pProbe, pageSize, &region, 1, &pScanEnd) == 0);
+            pageguardStopWriteTracking((PBYTE)pProbe, pageSize);
+        }
+        if (pProbe != MAP_FAILED) {
+            munmap(pProbe, pageSize);
+        }
+    }
+    if (!supported) {
+        if (g_uffd != -1) {
+            close(g_uffd);
+            g_uffd = -1;
+        }
+        if (g_pagemap_fd != -1) {
+            close(g_pagemap_fd);
+            g_pagemap_fd = -1;
+        }
+    }
+#endif
+    return supported;
+}
+#endif
+
+// return how the pages written by the target app are found, one of PAGEGUARD_TRACKING_*.
+// On Linux, the page guard (SIGSEGV) mode costs a signal on the first write to every page and an mprotect for every page at
+// every flush, the uffd and softdirty modes let the kernel record the writes and only collect them at flush time. Windows
+// always uses page guard.
+int getPageGuardTrackingMode() {
+    static int TrackingMode = PAGEGUARD_TRACKING_PAGE_GUARD;
+    static bool FirstTimeRun = true;
+    if (FirstTimeRun) {
+        FirstTimeRun = false;
+#if defined(PLATFORM_LINUX)
+        const char* env_tracking = vktrace_get_global_var(VKTRACE_PAGEGUARD_TRACKING_ENV);
+        // Page guard is the default, the other modes are opt-in.
+        if ((env_tracking == NULL) || (strcmp(env_tracking, "pageguard") == 0)) {
+            TrackingMode = PAGEGUARD_TRACKING_PAGE_GUARD;
+        } else if (strcmp(env_tracking, "uffd") == 0) {
+            if (pageguardInitUffdWriteTracking()) {
+                TrackingMode = PAGEGUARD_TRACKING_UFFD_WP;
+            } else {
+                vktrace_LogWarning("userfaultfd write protection is not supported, PMB tracking falls back to page guard.");
+            }
+        } else if (strcmp(env_tracking, "softdirty") == 0) {
+            if (pageguardInitSoftDirtyTracking()) {
+                TrackingMode = PAGEGUARD_TRACKING_SOFT_DIRTY;
+            } else {
+                vktrace_LogWarning("Soft-dirty bits are not supported, PMB tracking falls back to page guard.");
+            }
+        } else {
+            vktrace_LogWarning("Unknown %s value \"%s\", PMB tracking uses page guard.", VKTRACE_PAGEGUARD_TRACKING_ENV,
+                               env_tracking);
+        }
+        static const char* const trackingModeNames[] = {"pageguard", "softdirty", "uffd"};
+        vktrace_LogAlways("PMB tracking mode: %s.", trackingModeNames[TrackingMode]);
+#endif
+    }
+    return TrackingMode;
+}
 
 void setPageGuardExceptionHandler() {
     // Reference this variable to avoid compiler warnings
@@ -202,7 +419,9 @@ uint64_t pageguardGetAdjustedSize(uint64_t size) {
 #if defined(PLATFORM_LINUX)
 // Keep a map of memory allocations and sizes.
 // We need the size when we want to free the memory on Linux.
+// Changed data packages of several mapped memory are allocated and freed in parallel, see flushAllChangedMappedMemory.
 static std::unordered_map<void*, size_t> allocateMemoryMap;
+static std::mutex allocateMemoryMapMutex;
 #endif
 
 // Page guard only works for virtual memory. Real device memory
@@ -218,7 +437,12 @@ void* pageguardAllocateMemory(uint64_t size) {
                                       PAGE_READWRITE);
 #else
         pMemory = mmap(NULL, pageguardGetAdjustedSize(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-        if (pMemory != nullptr) allocateMemoryMap[pMemory] = pageguardGetAdjustedSize(size);
+        if (pMemory != MAP_FAILED) {
+            std::lock_guard<std::mutex> lock(allocateMemoryMapMutex);
+            allocateMemoryMap[pMemory] = pageguardGetAdjustedSize(size);
+        } else {
+            pMemory = nullptr;
+        }
 #endif
     }
     if (pMemory == nullptr) vktrace_LogError("pageguardAllocateMemory(%d) memory allocation failed", size);
@@ -230,6 +454,7 @@ void pageguardFreeMemory(void* pMemory) {
 #if defined(WIN32)
         VirtualFree(pMemory, 0, MEM_RELEASE);
 #else
+        std::lock_guard<std::mutex> lock(allocateMemoryMapMutex);
         munmap(pMemory, allocateMemoryMap[pMemory]);
         allocateMemoryMap.erase(pMemory);
 #endif
@@ -246,6 +471,98 @@ uint64_t pageguardGetSystemPageSize() {
 #endif
 }
 
+// Registers the memory with the userfaultfd of the uffd tracking mode and write protects it. Returns false if the memory
+// can't be tracked that way.
+bool pageguardStartWriteTracking(PBYTE pMemory, uint64_t size) {
+#if defined(PAGEGUARD_UFFD_WP_SUPPORTED)
+    if (g_uffd != -1) {
+        struct uffdio_register uffdRegister;
+        uffdRegister.range.start = (uint64_t)pMemory;
+        uffdRegister.range.len = pageguardGetAdjustedSize(size);
+        uffdRegister.mode = UFFDIO_REGISTER_MODE_WP;
+        if (ioctl(g_uffd, UFFDIO_REGISTER, &uffdRegister) == 0) {
+            struct uffdio_writeprotect uffdWriteProtect;
+            uffdWriteProtect.range.start = (uint64_t)pMemory;
+            uffdWriteProtect.range.len = pageguardGetAdjustedSize(size);
+            uffdWriteProtect.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+            if (ioctl(g_uffd, UFFDIO_WRITEPROTECT, &uffdWriteProtect) == 0) {
+                return true;
+            }
+            ioctl(g_uffd, UFFDIO_UNREGISTER, &uffdWriteProtect.range);
+        }
+        vktrace_LogDebug("userfaultfd can't write protect mapped memory at %p, using page guard for it.", pMemory);
+    }
+#endif
+    return false;
+}
+
+void pageguardStopWriteTracking(PBYTE pMemory, uint64_t size) {
+#if defined(PAGEGUARD_UFFD_WP_SUPPORTED)
+    struct uffdio_range uffdRange;
+    uffdRange.start = (uint64_t)pMemory;
+    uffdRange.len = pageguardGetAdjustedSize(size);
+    if (ioctl(g_uffd, UFFDIO_UNREGISTER, &uffdRange) == -1) {
+        vktrace_LogError("Unregister mapped memory from userfaultfd failed !");
+    }
+#endif
+}
+
+// Marks the pages of the mapped memory which were written since the last harvest as changed, for the uffd and softdirty
+// tracking modes; the page guard handler marks them as they are written. uffd write protects the pages again as it finds them,
+// softdirty needs pageguardClearSoftDirtyPages to be called after all mapped memory has been harvested.
+void pageguardHarvestDirtyPages(LPPageGuardMappedMemory pMappedMemory) {
+#if defined(PLATFORM_LINUX)
+    PBYTE pMemory = pMappedMemory->getMappedDataPointer();
+    uint64_t pageSize = pageguardGetSystemPageSize();
+    uint64_t pageCount = pageguardGetAdjustedSize(pMappedMemory->getMappedSize()) / pageSize;
+    if (pMappedMemory->getTrackingMode() == PAGEGUARD_TRACKING_UFFD_WP) {
+        struct page_region regions[PAGEGUARD_SCAN_REGION_COUNT];
+        PBYTE pScanStart = pMemory, pScanEnd = pMemory + pageCount * pageSize;
+        while (pScanStart < pScanEnd) {
+            long count = pageguardScanWrittenPages(pScanStart, pScanEnd - pScanStart, regions, PAGEGUARD_SCAN_REGION_COUNT,
+                                                   &pScanStart);
+            if (count < 0) {
+                vktrace_LogError("Find written pages of mapped memory failed, all pages are saved !");
+                pMappedMemory->setMappedBlockRangeChanged(0, pageCount, true, BLOCK_FLAG_ARRAY_CHANGED);
+                break;
+            }
+            for (long i = 0; i < count; i++) {
+                uint64_t index = (regions[i].start - (uint64_t)pMemory) / pageSize;
+                pMappedMemory->setMappedBlockRangeChanged(index, (regions[i].end - regions[i].start) / pageSize, true,
+                                                          BLOCK_FLAG_ARRAY_CHANGED);
+            }
+        }
+    } else if (pMappedMemory->getTrackingMode() == PAGEGUARD_TRACKING_SOFT_DIRTY) {
+        uint64_t entries[PAGEGUARD_PAGEMAP_BATCH_SIZE];
+        for (uint64_t first = 0; first < pageCount; first += PAGEGUARD_PAGEMAP_BATCH_SIZE) {
+            uint64_t count = pageCount - first;
+            if (count > PAGEGUARD_PAGEMAP_BATCH_SIZE) {
+                count = PAGEGUARD_PAGEMAP_BATCH_SIZE;
+            }
+            bool readSuccessfully = pageguardReadPagemap(pMemory + first * pageSize, entries, count);
+            if (!readSuccessfully) {
+                vktrace_LogError("Read soft-dirty bits of mapped memory failed, all pages are saved !");
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                if (!readSuccessfully || (entries[i] & PAGEGUARD_PAGEMAP_SOFT_DIRTY)) {
+                    pMappedMemory->setMappedBlockChanged(first + i, true, BLOCK_FLAG_ARRAY_CHANGED);
+                }
+            }
+        }
+    }
+#endif
+}
+
+// Soft-dirty bits can only be cleared for the whole process, and the kernel write protects every page of the process to do
+// it, so it's done once after harvesting all mapped memory rather than per memory object.
+void pageguardClearSoftDirtyPages() {
+#if defined(PLATFORM_LINUX)
+    if ((g_clear_refs_fd != -1) && (write(g_clear_refs_fd, "4", 1) != 1)) {
+        vktrace_LogError("Clear soft-dirty bits failed !");
+    }
+#endif
+}
+
 void setFlagTovkFlushMappedMemoryRangesSpecial(PBYTE pOPTPackageData) {
     PageGuardChangedBlockInfo* pChangedInfoArray = (PageGuardChangedBlockInfo*)pOPTPackageData;
     pChangedInfoArray[0].reserve0 = pChangedInfoArray[0].reserve0 | PAGEGUARD_SPECIAL_FORMAT_PACKET_FOR_VKFLUSHMAPPEDMEMORYRANGES;
@@ -274,21 +591,62 @@ void flushTargetChangedMappedMemory(LPPageGuardMappedMemory TargetMappedMemory,
     }
 }
 
+// Run on the memcpy threads by flushAllChangedMappedMemory, one mapped memory per call.
+static void prepareChangedDataPackage(void* pParameters) {
+    LPPageGuardMappedMemory pMappedMemory = (LPPageGuardMappedMemory)pParameters;
+    pMappedMemory->vkFlushMappedMemoryRangePageGuardHandle(pMappedMemory->getMappedDevice(), pMappedMemory->getMappedMemory(),
+                                                           pMappedMemory->getMappedOffset(), pMappedMemory->getMappedSize(),
+                                                           nullptr, nullptr, nullptr);
+    pMappedMemory->resetMemoryObjectAllChangedFlagAndPageGuard();
+}
+
+static bool isMappedDeviceLess(void* pMappedMemory0, void* pMappedMemory1) {
+    return (uintptr_t)((LPPageGuardMappedMemory)pMappedMemory0)->getMappedDevice() <
+           (uintptr_t)((LPPageGuardMappedMemory)pMappedMemory1)->getMappedDevice();
+}
+
+// Saves the changed pages of all mapped memory before vkQueueSubmit, in one vkFlushMappedMemoryRanges packet per device.
+// The packages of changed pages are built on the memcpy threads, a mapped memory each: saving the changed pages, copying them
+// back to the real mapped memory and protecting them again. Mapped memory without changed pages isn't in the packet.
 void flushAllChangedMappedMemory(vkFlushMappedMemoryRangesFunc pFunc) {
-    LPPageGuardMappedMemory pMappedMemoryTemp;
-    uint64_t amount = getPageGuardControlInstance().getMapMemory().size();
-    if (amount) {
-        int i = 0;
-        VkMappedMemoryRange* pMemoryRanges = new VkMappedMemoryRange[1];  // amount
-        for (std::unordered_map<VkDeviceMemory, PageGuardMappedMemory>::iterator it =
-                 getPageGuardControlInstance().getMapMemory().begin();
-             it != getPageGuardControlInstance().getMapMemory().end(); it++) {
-            pMappedMemoryTemp = &(it->second);
-            flushTargetChangedMappedMemory(pMappedMemoryTemp, pFunc, pMemoryRanges);
-            i++;
+    if (getPageGuardControlInstance().getMapMemory().empty()) {
+        return;
+    }
+    // harvest the written pages of all mapped memory in one go rather than once per flush
+    getPageGuardControlInstance().harvestDirtyPages(nullptr, 0, nullptr);
+    getPageGuardControlInstance().setDirtyPagesHarvested(true);
+
+    std::vector<void*> changedMappedMemory;
+    for (std::unordered_map<VkDeviceMemory, PageGuardMappedMemory>::iterator it =
+             getPageGuardControlInstance().getMapMemory().begin();
+         it != getPageGuardControlInstance().getMapMemory().end(); it++) {
+        if (!it->second.isNoMappedBlockChanged()) {
+            changedMappedMemory.push_back(&(it->second));
         }
-        delete[] pMemoryRanges;
     }
+    vktrace_pageguard_run_tasks(prepareChangedDataPackage, changedMappedMemory.data(), changedMappedMemory.size());
+
+    std::stable_sort(changedMappedMemory.begin(), changedMappedMemory.end(), isMappedDeviceLess);
+    std::vector<VkMappedMemoryRange> memoryRanges(changedMappedMemory.size());
+    for (size_t i = 0; i < changedMappedMemory.size(); i++) {
+        LPPageGuardMappedMemory pMappedMemoryTemp = (LPPageGuardMappedMemory)changedMappedMemory[i];
+        memoryRanges[i].sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        memoryRanges[i].pNext = nullptr;
+        memoryRanges[i].memory = pMappedMemoryTemp->getMappedMemory();
+        memoryRanges[i].offset = pMappedMemoryTemp->getMappedOffset();
+        memoryRanges[i].size = pMappedMemoryTemp->getMappedSize();
+    }
+    size_t first = 0;
+    while (first < changedMappedMemory.size()) {
+        VkDevice device = ((LPPageGuardMappedMemory)changedMappedMemory[first])->getMappedDevice();
+        size_t last = first + 1;
+        while ((last < changedMappedMemory.size()) && !isMappedDeviceLess(changedMappedMemory[first], changedMappedMemory[last])) {
+            last++;
+        }
+        (*pFunc)(device, (uint32_t)(last - first), &memoryRanges[first]);
+        first = last;
+    }
+    getPageGuardControlInstance().setDirtyPagesHarvested(false);
 }
 
 void resetAllReadFlagAndPageGuard() {
@@ -92,8 +92,14 @@ VkDeviceSize& ref_target_range_size();
 bool getPageGuardEnableFlag();
 bool getEnableReadPMBFlag();
 bool getEnablePageGuardLazyCopyFlag();
+bool getEnablePageGuardDeltaFlag();
+int getPageGuardTrackingMode();
 void setPageGuardExceptionHandler();
 void removePageGuardExceptionHandler();
+bool pageguardStartWriteTracking(PBYTE pMemory, uint64_t size);
+void pageguardStopWriteTracking(PBYTE pMemory, uint64_t size);
+void pageguardHarvestDirtyPages(LPPageGuardMappedMemory pMappedMemory);
+void pageguardClearSoftDirtyPages();
 uint64_t pageguardGetAdjustedSize(uint64_t size);
 void* pageguardAllocateMemory(uint64_t size);
 void pageguardFreeMemory(void* pMemory);
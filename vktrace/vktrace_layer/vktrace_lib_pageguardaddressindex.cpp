@@ -0,0 +1,69 @@
+/*
+* Copyright (C) 2018 LunarG, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "vktrace_lib_pageguardaddressindex.h"
+
+PageGuardAddressIndex::PageGuardAddressIndex() {}
+
+PageGuardAddressIndex::~PageGuardAddressIndex() {}
+
+void PageGuardAddressIndex::insert(PBYTE pStart, uint64_t size, PageGuardMappedMemory *pMappedMemory) {
+    remove(pMappedMemory);
+
+    Range range;
+    range.pStart = pStart;
+    range.pEnd = pStart + size;
+    range.pMappedMemory = pMappedMemory;
+
+    size_t low = 0, high = Ranges.size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (Ranges[middle].pStart < pStart) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    Ranges.insert(Ranges.begin() + low, range);
+}
+
+void PageGuardAddressIndex::remove(PageGuardMappedMemory *pMappedMemory) {
+    for (std::vector<Range>::iterator it = Ranges.begin(); it != Ranges.end(); it++) {
+        if (it->pMappedMemory == pMappedMemory) {
+            Ranges.erase(it);
+            break;
+        }
+    }
+}
+
+PageGuardMappedMemory *PageGuardAddressIndex::find(PBYTE addr) const {
+    // find the last range which starts at or before addr, addr is in that range or in none.
+    const Range *pRanges = Ranges.data();
+    size_t low = 0, high = Ranges.size();
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (pRanges[middle].pStart <= addr) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if ((low > 0) && (addr < pRanges[low - 1].pEnd)) {
+        return pRanges[low - 1].pMappedMemory;
+    }
+    return nullptr;
+}
+
+size_t PageGuardAddressIndex::size() const { return Ranges.size(); }
@@ -0,0 +1,53 @@
+/*
+* Copyright (C) 2018 LunarG, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#pragma once
+
+#include <vector>
+#include "vktrace_platform.h"
+
+class PageGuardMappedMemory;
+
+// Address ranges [pMappedData, pMappedData + MappedSize) of the page guarded mapped memory, sorted by start address, so
+// the page guard handler finds which mapped memory a fault address belongs to with a binary search instead of going
+// through every mapped memory.
+//
+// insert and remove may allocate and must not be called from the page guard handler. find neither allocates nor takes any
+// lock of its own, so it's safe to call from the handler. The index doesn't synchronize insert/remove with find, they are all
+// called under pageguardEnter() like the rest of the page guard state.
+typedef class PageGuardAddressIndex {
+   public:
+    PageGuardAddressIndex();
+    ~PageGuardAddressIndex();
+
+    /// add the range [pStart, pStart + size) of pMappedMemory, replacing any range pMappedMemory already has.
+    void insert(PBYTE pStart, uint64_t size, PageGuardMappedMemory *pMappedMemory);
+
+    void remove(PageGuardMappedMemory *pMappedMemory);
+
+    /// return the mapped memory whose range includes addr, or nullptr if there is none.
+    PageGuardMappedMemory *find(PBYTE addr) const;
+
+    size_t size() const;
+
+   private:
+    struct Range {
+        PBYTE pStart;
+        PBYTE pEnd;
+        PageGuardMappedMemory *pMappedMemory;
+    };
+
+    std::vector<Range> Ranges;  /// sorted by pStart, the ranges never overlap
+} PageGuardAddressIndex;
@@ -27,8 +27,9 @@
 #include "vktrace_lib_pageguardmappedmemory.h"
 #include "vktrace_lib_pageguardcapture.h"
 #include "vktrace_lib_pageguard.h"
+#include <vector>
 
-PageGuardCapture::PageGuardCapture() {
+PageGuardCapture::PageGuardCapture() : DirtyPagesHarvested(false) {
     EmptyChangedInfoArray.offset = 0;
     EmptyChangedInfoArray.length = 0;
 }
@@ -44,7 +45,14 @@ void PageGuardCapture::vkMapMemoryPageGuardHandle(VkDevice device, VkDeviceMemor
 #endif
         {
             OPTmappedmem.vkMapMemoryPageGuardHandle(device, memory, offset, size, flags, ppData);
+            if (OPTmappedmem.getTrackingMode() == PAGEGUARD_TRACKING_SOFT_DIRTY) {
+                // The new memory is all soft-dirty. Clearing that clears the bits of all other mapped memory too, so harvest
+                // those first.
+                harvestDirtyPages(device, 0, nullptr);
+            }
             MapMemory[memory] = OPTmappedmem;
+            LPPageGuardMappedMemory lpOPTMemoryTemp = &MapMemory[memory];
+            MapMemoryAddressIndex.insert(lpOPTMemoryTemp->pMappedData, lpOPTMemoryTemp->MappedSize, lpOPTMemoryTemp);
         }
     }
     MapMemoryPtr[memory] = (PBYTE)(*ppData);
@@ -58,6 +66,7 @@ void PageGuardCapture::vkUnmapMemoryPageGuardHandle(VkDevice device, VkDeviceMem
     if (lpOPTMemoryTemp) {
         VkMappedMemoryRange memoryRange;
         flushTargetChangedMappedMemory(lpOPTMemoryTemp, pFunc, &memoryRange);
+        MapMemoryAddressIndex.remove(lpOPTMemoryTemp);
         lpOPTMemoryTemp->vkUnmapMemoryPageGuardHandle(device, memory, MappedData);
         MapMemory.erase(memory);
     }
@@ -72,6 +81,37 @@ VkDeviceSize PageGuardCapture::getMappedMemoryOffset(VkDevice device, VkDeviceMe
 
 VkDeviceSize PageGuardCapture::getMappedMemorySize(VkDevice device, VkDeviceMemory memory) { return MapMemorySize[memory]; }
 
+// Run on the memcpy threads by harvestDirtyPages, one mapped memory per call.
+static void harvestMappedMemoryDirtyPages(void* pParameters) { pageguardHarvestDirtyPages((LPPageGuardMappedMemory)pParameters); }
+
+void PageGuardCapture::harvestDirtyPages(VkDevice device, uint32_t memoryRangeCount, const VkMappedMemoryRange* pMemoryRanges) {
+    if (!getPageGuardEnableFlag()) {
+        return;
+    }
+    int trackingMode = getPageGuardTrackingMode();
+    if ((trackingMode == PAGEGUARD_TRACKING_SOFT_DIRTY) || ((trackingMode == PAGEGUARD_TRACKING_UFFD_WP) && !pMemoryRanges)) {
+        std::vector<void*> mappedMemory;
+        mappedMemory.reserve(MapMemory.size());
+        for (std::unordered_map<VkDeviceMemory, PageGuardMappedMemory>::iterator it = MapMemory.begin(); it != MapMemory.end();
+             it++) {
+            mappedMemory.push_back(&(it->second));
+        }
+        vktrace_pageguard_run_tasks(harvestMappedMemoryDirtyPages, mappedMemory.data(), mappedMemory.size());
+        if (trackingMode == PAGEGUARD_TRACKING_SOFT_DIRTY) {
+            pageguardClearSoftDirtyPages();
+        }
+    } else if (trackingMode == PAGEGUARD_TRACKING_UFFD_WP) {
+        for (uint32_t i = 0; i < memoryRangeCount; i++) {
+            LPPageGuardMappedMemory lpOPTMemoryTemp = findMappedMemoryObject(device, pMemoryRanges[i].memory);
+            if (lpOPTMemoryTemp) {
+                pageguardHarvestDirtyPages(lpOPTMemoryTemp);
+            }
+        }
+    }
+}
+
+void PageGuardCapture::setDirtyPagesHarvested(bool bHarvested) { DirtyPagesHarvested = bHarvested; }
+
 // return: if it's target mapped memory and no change at all;
 // PBYTE *ppPackageDataforOutOfMap, must be an array include memoryRangeCount elements
 bool PageGuardCapture::vkFlushMappedMemoryRangesPageGuardHandle(VkDevice device, uint32_t memoryRangeCount,
@@ -79,6 +119,10 @@ bool PageGuardCapture::vkFlushMappedMemoryRangesPageGuardHandle(VkDevice device,
                                                                 PBYTE* ppPackageDataforOutOfMap) {
     bool handleSuccessfully = false, bChanged = false;
     std::unordered_map<VkDeviceMemory, PageGuardMappedMemory>::const_iterator mappedmem_it;
+    vktrace_pageguard_calibrate_multi_threads_memcpy();
+    if (!DirtyPagesHarvested) {
+        harvestDirtyPages(device, memoryRangeCount, pMemoryRanges);
+    }
     for (uint32_t i = 0; i < memoryRangeCount; i++) {
         VkMappedMemoryRange* pRange = (VkMappedMemoryRange*)&pMemoryRanges[i];
 
@@ -89,8 +133,11 @@ bool PageGuardCapture::vkFlushMappedMemoryRangesPageGuardHandle(VkDevice device,
             if (pRange->size == VK_WHOLE_SIZE) {
                 pRange->size = lpOPTMemoryTemp->getMappedSize() - (pRange->offset - lpOPTMemoryTemp->MappedOffset);
             }
-            if (lpOPTMemoryTemp->vkFlushMappedMemoryRangePageGuardHandle(device, pRange->memory, pRange->offset, pRange->size,
-                                                                         nullptr, nullptr, nullptr)) {
+            if (lpOPTMemoryTemp->getChangedDataPackage(nullptr) != nullptr) {
+                // flushAllChangedMappedMemory already built the package, only mapped memory with changed pages gets one
+                bChanged = true;
+            } else if (lpOPTMemoryTemp->vkFlushMappedMemoryRangePageGuardHandle(device, pRange->memory, pRange->offset,
+                                                                                pRange->size, nullptr, nullptr, nullptr)) {
                 bChanged = true;
             }
         } else {
@@ -135,33 +182,25 @@ LPPageGuardMappedMemory PageGuardCapture::findMappedMemoryObject(VkDevice device
 
 LPPageGuardMappedMemory PageGuardCapture::findMappedMemoryObject(PBYTE addr, VkDeviceSize* pOffsetOfAddr, PBYTE* ppBlock,
                                                                  VkDeviceSize* pBlockSize) {
-    LPPageGuardMappedMemory pMappedMemoryObject = nullptr;
-    LPPageGuardMappedMemory pMappedMemoryTemp;
+    LPPageGuardMappedMemory pMappedMemoryObject = MapMemoryAddressIndex.find(addr);
     PBYTE pBlock = nullptr;
     VkDeviceSize OffsetOfAddr = 0, BlockSize = 0;
 
-    for (std::unordered_map<VkDeviceMemory, PageGuardMappedMemory>::iterator it = MapMemory.begin(); it != MapMemory.end(); it++) {
-        pMappedMemoryTemp = &(it->second);
-        if ((addr >= pMappedMemoryTemp->pMappedData) && (addr < (pMappedMemoryTemp->pMappedData + pMappedMemoryTemp->MappedSize))) {
-            pMappedMemoryObject = pMappedMemoryTemp;
-
-            OffsetOfAddr = (VkDeviceSize)(addr - pMappedMemoryTemp->pMappedData);
-            BlockSize = pMappedMemoryTemp->PageGuardSize;
-            pBlock = addr - OffsetOfAddr % BlockSize;
-            if (ppBlock) {
-                *ppBlock = pBlock;
-            }
-            if (pBlockSize) {
-                *pBlockSize = BlockSize;
-            }
-            if (pOffsetOfAddr) {
-                *pOffsetOfAddr = OffsetOfAddr;
-            }
-
-            return pMappedMemoryObject;
+    if (pMappedMemoryObject) {
+        OffsetOfAddr = (VkDeviceSize)(addr - pMappedMemoryObject->pMappedData);
+        BlockSize = pMappedMemoryObject->PageGuardSize;
+        pBlock = addr - OffsetOfAddr % BlockSize;
+        if (ppBlock) {
+            *ppBlock = pBlock;
+        }
+        if (pBlockSize) {
+            *pBlockSize = BlockSize;
+        }
+        if (pOffsetOfAddr) {
+            *pOffsetOfAddr = OffsetOfAddr;
         }
     }
-    return NULL;
+    return pMappedMemoryObject;
 }
 
 LPPageGuardMappedMemory PageGuardCapture::findMappedMemoryObject(VkDevice device, const VkMappedMemoryRange* pMemoryRange) {
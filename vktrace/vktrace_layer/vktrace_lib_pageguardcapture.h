@@ -29,6 +29,7 @@
 
 #include "vktrace_pageguard_memorycopy.h"
 #include "vktrace_lib_pageguardmappedmemory.h"
+#include "vktrace_lib_pageguardaddressindex.h"
 
 #define PAGEGUARD_TARGET_RANGE_SIZE_CONTROL
 
@@ -52,6 +53,8 @@ typedef class PageGuardCapture {
     std::unordered_map<VkDeviceMemory, PBYTE> MapMemoryPtr;
     std::unordered_map<VkDeviceMemory, VkDeviceSize> MapMemorySize;
     std::unordered_map<VkDeviceMemory, VkDeviceSize> MapMemoryOffset;
+    PageGuardAddressIndex MapMemoryAddressIndex;  /// address ranges of the mapped memory in MapMemory, for the page guard handler
+    bool DirtyPagesHarvested;  /// if set, flushes use the changed pages already harvested instead of harvesting them again
 
    public:
     PageGuardCapture();
@@ -70,6 +73,14 @@ typedef class PageGuardCapture {
 
     VkDeviceSize getMappedMemorySize(VkDevice device, VkDeviceMemory memory);
 
+    /// for the uffd and softdirty tracking modes, mark the pages written since the last harvest as changed in the mapped
+    /// memory of pMemoryRanges, or in all mapped memory if pMemoryRanges==nullptr. The softdirty mode always harvests all mapped
+    /// memory.
+    void harvestDirtyPages(VkDevice device, uint32_t memoryRangeCount, const VkMappedMemoryRange* pMemoryRanges);
+
+    /// set before flushing all mapped memory after a harvestDirtyPages for all of it, clear after.
+    void setDirtyPagesHarvested(bool bHarvested);
+
     /// return: if it's target mapped memory and no change at all;
     /// PBYTE *ppPackageDataforOutOfMap, must be an array include memoryRangeCount elements
     bool vkFlushMappedMemoryRangesPageGuardHandle(VkDevice device, uint32_t memoryRangeCount,
@@ -77,6 +88,7 @@ typedef class PageGuardCapture {
 
     LPPageGuardMappedMemory findMappedMemoryObject(VkDevice device, VkDeviceMemory memory);
 
+    /// find the mapped memory which includes addr, it neither allocates nor locks so the page guard handler can call it.
     LPPageGuardMappedMemory findMappedMemoryObject(PBYTE addr, VkDeviceSize* pOffsetOfAddr = nullptr, PBYTE* ppBlock = nullptr,
                                                    VkDeviceSize* pBlockSize = nullptr);
 
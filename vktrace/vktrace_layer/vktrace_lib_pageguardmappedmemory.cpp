@@ -22,6 +22,8 @@
 //     the capture time reduce to round 15 minutes, the trace file size is round 40G,
 //     The Playback time for these trace file is round 7 minutes(on Win10/AMDFury/32GRam/I5 system).
 
+#include <inttypes.h>
+#include <vector>
 #include "vktrace_pageguard_memorycopy.h"
 #include "vktrace_lib_pagestatusarray.h"
 #include "vktrace_lib_pageguardmappedmemory.h"
@@ -40,6 +42,8 @@ PBYTE &PageGuardMappedMemory::getMappedDataPointer() { return pMappedData; }
 
 VkDeviceSize &PageGuardMappedMemory::getMappedSize() { return MappedSize; }
 
+int PageGuardMappedMemory::getTrackingMode() { return TrackingMode; }
+
 PageGuardMappedMemory::PageGuardMappedMemory()
     : MappedDevice(nullptr),
       MappedMemory((VkDeviceMemory) nullptr),
@@ -47,8 +51,10 @@ PageGuardMappedMemory::PageGuardMappedMemory()
       pMappedData(nullptr),
       pRealMappedData(nullptr),
       pChangedDataPackage(nullptr),
+      DeltaEncoding(false),
       MappedSize(0),
       PageGuardSize(pageguardGetSystemPageSize()),
+      TrackingMode(PAGEGUARD_TRACKING_PAGE_GUARD),
       pPageStatus(nullptr),
       BlockConflictError(false),
       PageSizeLeft(0),
@@ -119,6 +125,15 @@ void PageGuardMappedMemory::setMappedBlockChanged(uint64_t index, bool changed,
     }
 }
 
+void PageGuardMappedMemory::setMappedBlockRangeChanged(uint64_t index, uint64_t count, bool changed, int which) {
+    if (index < PageGuardAmount) {
+        if (count > PageGuardAmount - index) {
+            count = PageGuardAmount - index;
+        }
+        pPageStatus->setBlockRange(which, index, count, changed);
+    }
+}
+
 bool PageGuardMappedMemory::isMappedBlockChanged(uint64_t index, int which) {
     bool mappedBlockChanged = false;
     if (index < PageGuardAmount) {
@@ -168,6 +183,14 @@ uint64_t PageGuardMappedMemory::getMappedBlockSize(uint64_t index) {
     return mappedBlockSize;
 }
 
+uint64_t PageGuardMappedMemory::getMappedBlockRangeSize(uint64_t index, uint64_t count) {
+    uint64_t mappedBlockRangeSize = count * PageGuardSize;
+    if (((index + count) == PageGuardAmount) && PageSizeLeft) {
+        mappedBlockRangeSize -= PageGuardSize - PageSizeLeft;
+    }
+    return mappedBlockRangeSize;
+}
+
 uint64_t PageGuardMappedMemory::getMappedBlockOffset(uint64_t index) {
     uint64_t mappedBlockOffset = 0;
     if (index < PageGuardAmount) {
@@ -177,75 +200,72 @@ uint64_t PageGuardMappedMemory::getMappedBlockOffset(uint64_t index) {
 }
 
 bool PageGuardMappedMemory::isNoMappedBlockChanged() {
-    bool noMappedBlockChanged = true;
-    for (uint64_t i = 0; i < PageGuardAmount; i++) {
-        if (isMappedBlockChanged(i, BLOCK_FLAG_ARRAY_CHANGED)) {
-            noMappedBlockChanged = false;
-            break;
-        }
-    }
-    return noMappedBlockChanged;
+    uint64_t runStart, runEnd;
+    return !pPageStatus->findBlockRun(BLOCK_FLAG_ARRAY_CHANGED, 0, &runStart, &runEnd);
 }
 
+// Changed pages are mostly next to each other, so the page guard is set again a run of pages at a time rather than a page at a
+// time, which saves most of the VirtualProtect/mprotect calls and the TLB flushes they cause.
 void PageGuardMappedMemory::resetMemoryObjectAllChangedFlagAndPageGuard() {
-    for (uint64_t i = 0; i < PageGuardAmount; i++) {
-        if (isMappedBlockChanged(i, BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT)) {
+    uint64_t runStart, runEnd = 0;
+    while (pPageStatus->findBlockRun(BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT, runEnd, &runStart, &runEnd)) {
+        PBYTE pRunAddr = pMappedData + runStart * PageGuardSize;
+        SIZE_T runSize = (SIZE_T)getMappedBlockRangeSize(runStart, runEnd - runStart);
 #if defined(WIN32)
-            uint64_t pageSize = pageguardGetSystemPageSize();
-            uint64_t pmask = ~(pageSize - 1);
-            PVOID Addresses[1];
-            ULONG Granularity;
-            ULONG_PTR Count = 1;
-            UINT rval;
-            DWORD oldProt;
-            void *pgAddr = (void *)((uint64_t)(pMappedData + i * PageGuardSize));
-            assert(((SIZE_T)pgAddr & (~pmask)) == 0);
-            VirtualProtect(pgAddr, (SIZE_T)getMappedBlockSize(i), PAGE_READWRITE | PAGE_GUARD, &oldProt);
-            rval = GetWriteWatch(WRITE_WATCH_FLAG_RESET, pgAddr, (size_t)pageSize, &Addresses[0], &Count, &Granularity);
-            assert(rval == 0);
-            assert(Count == 0 || Count == 1);
-            assert(Granularity == pageSize);
-            assert((Count == 1) ? (Addresses[0] == pgAddr) : 1);
-            if (Count == 1) {
-                // Page was modified after we copied it, so mark the page as changed.
-                VirtualProtect(pgAddr, (SIZE_T)getMappedBlockSize(i), PAGE_READWRITE, &oldProt);
-                setMappedBlockChanged(i, true, BLOCK_FLAG_ARRAY_CHANGED);
-
-                // for one page, there are two ways that trigger page guard and then the page
-                // need to be rearmed: write and read, we also use two flags for the page
-                // to record page guard is triggered by write (dirty) or by read, then base on
-                // the two flags, we rearm page guard in different functions.
-                // here if GetWriteWatch detect dirty page, we set it's a dirty page, also
-                // need to clear another read flag to avoid dead lock: if two flags
-                // all set to true, and if already rearm page guard by read related process,
-                // then when write the dirty page (because it's marked as dirty page), copy
-                // the dirty page will trigger unexpected page guard, cause a deadlock.
-                setMappedBlockChanged(i, false, BLOCK_FLAG_ARRAY_READ);
-            }
+        uint64_t pageSize = pageguardGetSystemPageSize();
+        uint64_t pmask = ~(pageSize - 1);
+        std::vector<PVOID> Addresses((size_t)(runEnd - runStart));
+        ULONG Granularity;
+        ULONG_PTR Count = (ULONG_PTR)Addresses.size();
+        UINT rval;
+        DWORD oldProt;
+        assert(((SIZE_T)pRunAddr & (~pmask)) == 0);
+        VirtualProtect(pRunAddr, runSize, PAGE_READWRITE | PAGE_GUARD, &oldProt);
+        rval = GetWriteWatch(WRITE_WATCH_FLAG_RESET, pRunAddr, runSize, Addresses.data(), &Count, &Granularity);
+        assert(rval == 0);
+        assert(Granularity == pageSize);
+        for (ULONG_PTR j = 0; j < Count; j++) {
+            // Page was modified after we copied it, so mark the page as changed.
+            uint64_t index = ((PBYTE)Addresses[j] - pMappedData) / PageGuardSize;
+            VirtualProtect(Addresses[j], (SIZE_T)getMappedBlockSize(index), PAGE_READWRITE, &oldProt);
+            setMappedBlockChanged(index, true, BLOCK_FLAG_ARRAY_CHANGED);
+
+            // for one page, there are two ways that trigger page guard and then the page
+            // need to be rearmed: write and read, we also use two flags for the page
+            // to record page guard is triggered by write (dirty) or by read, then base on
+            // the two flags, we rearm page guard in different functions.
+            // here if GetWriteWatch detect dirty page, we set it's a dirty page, also
+            // need to clear another read flag to avoid dead lock: if two flags
+            // all set to true, and if already rearm page guard by read related process,
+            // then when write the dirty page (because it's marked as dirty page), copy
+            // the dirty page will trigger unexpected page guard, cause a deadlock.
+            setMappedBlockChanged(index, false, BLOCK_FLAG_ARRAY_READ);
+        }
 #else
-            if (mprotect(pMappedData + i * PageGuardSize, (SIZE_T)getMappedBlockSize(i), PROT_READ) == -1) {
-                vktrace_LogError("Set memory protect on page(%d) failed !", i);
-            }
-#endif
-            setMappedBlockChanged(i, false, BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT);
+        // The other tracking modes write protected the pages again when they found they were written.
+        if ((TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) && (mprotect(pRunAddr, runSize, PROT_READ) == -1)) {
+            vktrace_LogError("Set memory protect on pages(%" PRIu64 "-%" PRIu64 ") failed !", runStart, runEnd - 1);
         }
+#endif
+        pPageStatus->setBlockRange(BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT, runStart, runEnd - runStart, false);
     }
 }
 
 void PageGuardMappedMemory::resetMemoryObjectAllReadFlagAndPageGuard() {
     backupBlockReadArraySnapshot();
-    for (uint64_t i = 0; i < PageGuardAmount; i++) {
-        if (isMappedBlockChanged(i, BLOCK_FLAG_ARRAY_READ_SNAPSHOT)) {
+    uint64_t runStart, runEnd = 0;
+    while (pPageStatus->findBlockRun(BLOCK_FLAG_ARRAY_READ_SNAPSHOT, runEnd, &runStart, &runEnd)) {
+        PBYTE pRunAddr = pMappedData + runStart * PageGuardSize;
+        SIZE_T runSize = (SIZE_T)getMappedBlockRangeSize(runStart, runEnd - runStart);
 #if defined(WIN32)
-            DWORD oldProt;
-            VirtualProtect(pMappedData + i * PageGuardSize, (SIZE_T)getMappedBlockSize(i), PAGE_READWRITE | PAGE_GUARD, &oldProt);
+        DWORD oldProt;
+        VirtualProtect(pRunAddr, runSize, PAGE_READWRITE | PAGE_GUARD, &oldProt);
 #else
-            if (mprotect(pMappedData + i * PageGuardSize, (SIZE_T)getMappedBlockSize(i), PROT_READ) == -1) {
-                vktrace_LogError("Set memory protect on page(%d) failed !", i);
-            }
-#endif
-            setMappedBlockChanged(i, false, BLOCK_FLAG_ARRAY_READ_SNAPSHOT);
+        if ((TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) && (mprotect(pRunAddr, runSize, PROT_READ) == -1)) {
+            vktrace_LogError("Set memory protect on pages(%" PRIu64 "-%" PRIu64 ") failed !", runStart, runEnd - 1);
         }
+#endif
+        pPageStatus->setBlockRange(BLOCK_FLAG_ARRAY_READ_SNAPSHOT, runStart, runEnd - runStart, false);
     }
 }
 
@@ -258,27 +278,26 @@ bool PageGuardMappedMemory::setAllPageGuardAndFlag(bool bSetPageGuard, bool bSet
     // check write counts of pages.
 
     bool setSuccessfully = true;
+    if ((TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) && PageGuardAmount) {
+        // All pages get the same protection, so protect the whole mapped memory with one call.
+        SIZE_T protectSize = (SIZE_T)getMappedBlockRangeSize(0, PageGuardAmount);
 #if defined(WIN32)
-    DWORD dwMemSetting = bSetPageGuard ? (PAGE_READWRITE | PAGE_GUARD) : PAGE_READWRITE;
-#else
-    int prot = bSetPageGuard ? PROT_READ : (PROT_READ | PROT_WRITE);
-#endif
-
-    for (uint64_t i = 0; i < PageGuardAmount; i++) {
-#if defined(WIN32)
-        DWORD oldProt, dwErr;
-        if (!VirtualProtect(pMappedData + i * PageGuardSize, (SIZE_T)getMappedBlockSize(i), dwMemSetting, &oldProt)) {
-            dwErr = GetLastError();
+        DWORD dwMemSetting = bSetPageGuard ? (PAGE_READWRITE | PAGE_GUARD) : PAGE_READWRITE;
+        DWORD oldProt;
+        if (!VirtualProtect(pMappedData, protectSize, dwMemSetting, &oldProt)) {
             setSuccessfully = false;
         }
 #else
-        if (mprotect(pMappedData + i * PageGuardSize, (SIZE_T)getMappedBlockSize(i), prot) == -1) {
-            vktrace_LogError("Set memory protect(%d) on page(%d) failed !", prot, i);
+        int prot = bSetPageGuard ? PROT_READ : (PROT_READ | PROT_WRITE);
+        if (mprotect(pMappedData, protectSize, prot) == -1) {
+            vktrace_LogError("Set memory protect(%d) on mapped memory failed !", prot);
             setSuccessfully = false;
         }
 #endif
-        setMappedBlockChanged(i, bSetBlockChanged, BLOCK_FLAG_ARRAY_CHANGED);
     }
+    // The other tracking modes have nothing to protect, vkMapMemoryPageGuardHandle and vkUnmapMemoryPageGuardHandle start and
+    // stop the tracking.
+    setMappedBlockRangeChanged(0, PageGuardAmount, bSetBlockChanged, BLOCK_FLAG_ARRAY_CHANGED);
     return setSuccessfully;
 }
 
@@ -310,7 +329,14 @@ bool PageGuardMappedMemory::vkMapMemoryPageGuardHandle(VkDevice device, VkDevice
 #endif
     MappedSize = size;
 
-    setPageGuardExceptionHandler();
+    TrackingMode = getPageGuardTrackingMode();
+    if ((TrackingMode == PAGEGUARD_TRACKING_UFFD_WP) && !pageguardStartWriteTracking(pMappedData, size)) {
+        // userfaultfd can't write protect every kind of mapping, fall back to page guard for this one.
+        TrackingMode = PAGEGUARD_TRACKING_PAGE_GUARD;
+    }
+    if (TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) {
+        setPageGuardExceptionHandler();
+    }
 
     PageSizeLeft = size % PageGuardSize;
     PageGuardAmount = size / PageGuardSize;
@@ -319,6 +345,8 @@ bool PageGuardMappedMemory::vkMapMemoryPageGuardHandle(VkDevice device, VkDevice
     }
     pPageStatus = new PageStatusArray(PageGuardAmount);
     assert(pPageStatus);
+    // the bytes are compared with the real mapped memory, so there is nothing to compare with when the app writes it directly
+    DeltaEncoding = getEnablePageGuardDeltaFlag() && isUseCopyForRealMappedMemory();
     if (!setAllPageGuardAndFlag(true, false)) {
         handleSuccessfully = false;
     }
@@ -329,8 +357,13 @@ bool PageGuardMappedMemory::vkMapMemoryPageGuardHandle(VkDevice device, VkDevice
 void PageGuardMappedMemory::vkUnmapMemoryPageGuardHandle(VkDevice device, VkDeviceMemory memory, void **MappedData) {
     if ((memory == MappedMemory) && (device == MappedDevice)) {
         setAllPageGuardAndFlag(false, false);
-        removePageGuardExceptionHandler();
+        if (TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) {
+            removePageGuardExceptionHandler();
+        } else if (TrackingMode == PAGEGUARD_TRACKING_UFFD_WP) {
+            pageguardStopWriteTracking(pMappedData, MappedSize);
+        }
         clearChangedDataPackage();
+        DeltaEncoding = false;
 #ifndef PAGEGUARD_ADD_PAGEGUARD_ON_REAL_MAPPED_MEMORY
         if (MappedData == nullptr) {
             pageguardFreeMemory(pMappedData);
@@ -356,15 +389,7 @@ void PageGuardMappedMemory::backupBlockChangedArraySnapshot() { pPageStatus->bac
 
 void PageGuardMappedMemory::backupBlockReadArraySnapshot() { pPageStatus->backupReadArray(); }
 
-size_t PageGuardMappedMemory::getChangedBlockAmount(int useWhich) {
-    size_t dwAmount = 0;
-    for (size_t i = 0; i < PageGuardAmount; i++) {
-        if (isMappedBlockChanged(i, useWhich)) {
-            dwAmount++;
-        }
-    }
-    return dwAmount;
-}
+size_t PageGuardMappedMemory::getChangedBlockAmount(int useWhich) { return (size_t)pPageStatus->getBlockCount(useWhich); }
 
 // is RangeLimit cover or partly cover Range
 bool PageGuardMappedMemory::isRangeIncluded(VkDeviceSize RangeOffsetLimit, VkDeviceSize RangeSizeLimit, VkDeviceSize RangeOffset,
@@ -391,67 +416,76 @@ bool PageGuardMappedMemory::isRangeIncluded(VkDeviceSize RangeOffsetLimit, VkDev
 // uint64_t *pInfoSize, the size of array of PageGuardChangedBlockInfo
 // VkDeviceSize RangeOffset, RangeSize, only consider the block which is in the range which start from RangeOffset and size is
 // RangeSize, if RangeOffset<0, consider whole mapped memory
+// changed pages next to each other are saved as one block.
 // return the amount of changed blocks.
 uint64_t PageGuardMappedMemory::getChangedBlockInfo(VkDeviceSize RangeOffset, VkDeviceSize RangeSize, uint64_t *pdwSaveSize,
                                                     uint64_t *pInfoSize, PBYTE pData, uint64_t DataOffset, int useWhich) {
-    uint64_t dwAmount = getChangedBlockAmount(useWhich), dwIndex = 0, offset = 0;
-    uint64_t infosize = sizeof(PageGuardChangedBlockInfo) * (dwAmount + 1), SaveSize = 0, CurrentBlockSize = 0;
-    PBYTE pChangedData;
+    // Each run of changed pages is saved as one block, its length must fit in PageGuardChangedBlockInfo.
+    uint64_t maxRunAmount = PAGEGUARD_MAX_CHANGED_BLOCK_SIZE / PageGuardSize;
+    uint64_t dwAmount = 0, SaveSize = 0, runStart, runEnd = 0;
+    while (pPageStatus->findBlockRun(useWhich, runEnd, &runStart, &runEnd)) {
+        if (runEnd - runStart > maxRunAmount) {
+            runEnd = runStart + maxRunAmount;
+        }
+        SaveSize += getMappedBlockRangeSize(runStart, runEnd - runStart);
+        dwAmount++;
+    }
+    uint64_t infosize = sizeof(PageGuardChangedBlockInfo) * (dwAmount + 1);
     PageGuardChangedBlockInfo *pChangedInfoArray = (PageGuardChangedBlockInfo *)(pData ? (pData + DataOffset) : nullptr);
-    void *srcAddr;
 
     if (pInfoSize) {
         *pInfoSize = infosize;
     }
-    for (uint64_t i = 0; i < PageGuardAmount; i++) {
-        CurrentBlockSize = getMappedBlockSize(i);
-        offset = getMappedBlockOffset(i);
-        if (isMappedBlockChanged(i, useWhich)) {
-            if (pChangedInfoArray) {
-                pChangedInfoArray[dwIndex + 1].offset = (uint32_t)offset;
-                pChangedInfoArray[dwIndex + 1].length = (uint32_t)CurrentBlockSize;
-                pChangedInfoArray[dwIndex + 1].reserve0 = 0;
-                pChangedInfoArray[dwIndex + 1].reserve1 = 0;
-                pChangedData = pData + DataOffset + infosize + SaveSize;
-
-                srcAddr = (void *)((uint64_t)(pMappedData + offset));
+    if (pChangedInfoArray) {
+        uint64_t dwIndex = 0, CurrentOffset = 0;
+        runEnd = 0;
+        while ((dwIndex < dwAmount) && pPageStatus->findBlockRun(useWhich, runEnd, &runStart, &runEnd)) {
+            if (runEnd - runStart > maxRunAmount) {
+                runEnd = runStart + maxRunAmount;
+            }
+            uint64_t offset = getMappedBlockOffset(runStart);
+            uint64_t CurrentBlockSize = getMappedBlockRangeSize(runStart, runEnd - runStart);
+            pChangedInfoArray[dwIndex + 1].offset = (uint32_t)offset;
+            pChangedInfoArray[dwIndex + 1].length = (uint32_t)CurrentBlockSize;
+            pChangedInfoArray[dwIndex + 1].reserve0 = 0;
+            pChangedInfoArray[dwIndex + 1].reserve1 = 0;
+            PBYTE pChangedData = pData + DataOffset + infosize + CurrentOffset;
+
+            void *srcAddr = (void *)((uint64_t)(pMappedData + offset));
 #ifdef WIN32
-                // We are about to copy from mapped memory to a temporary buffer.
-                // If another thread were to change this mapped memory after the
-                // copy but before the VirtualProtect we'll be doing later to
-                // re-arm PAGE_GUARD exceptions for this page, we would not see
-                // the change to mapped memory. So we call GetWriteWatch to reset the
-                // write count on this page, and then we'll call it again after the
-                // the VirtualProtect to see if it was written to between the copy
-                // and the VirtualProtect.
-
-                uint64_t pageSize = pageguardGetSystemPageSize();
-                uint64_t pmask = ~(pageSize - 1);
-                PVOID Addresses[1];
-                ULONG Granularity;
-                ULONG_PTR Count = 1;
-                UINT rval;
-                assert((((SIZE_T)(srcAddr)) & (~pmask)) == 0);
-                rval = GetWriteWatch(WRITE_WATCH_FLAG_RESET, srcAddr, (size_t)pageSize, Addresses, &Count, &Granularity);
-                assert(rval == 0);
-                assert(Count == 0 || Count == 1);
-                assert(Granularity == pageSize);
-                assert((Count == 1) ? (Addresses[0] == srcAddr) : true);
+            // We are about to copy from mapped memory to a temporary buffer.
+            // If another thread were to change this mapped memory after the
+            // copy but before the VirtualProtect we'll be doing later to
+            // re-arm PAGE_GUARD exceptions for these pages, we would not see
+            // the change to mapped memory. So we call GetWriteWatch to reset the
+            // write count on these pages, and then we'll call it again after the
+            // the VirtualProtect to see if they were written to between the copy
+            // and the VirtualProtect.
+
+            uint64_t pageSize = pageguardGetSystemPageSize();
+            uint64_t pmask = ~(pageSize - 1);
+            std::vector<PVOID> Addresses((size_t)(runEnd - runStart));
+            ULONG Granularity;
+            ULONG_PTR Count = (ULONG_PTR)Addresses.size();
+            UINT rval;
+            assert((((SIZE_T)(srcAddr)) & (~pmask)) == 0);
+            rval = GetWriteWatch(WRITE_WATCH_FLAG_RESET, srcAddr, (SIZE_T)CurrentBlockSize, Addresses.data(), &Count, &Granularity);
+            assert(rval == 0);
+            assert(Granularity == pageSize);
 #else
-                // Disable writes to the page before we copy from it.
-                // If it is modified by another thread while copying, we'll get
-                // another signal and mark it dirty, and we will copy it again.
-                if (mprotect(srcAddr, CurrentBlockSize, PROT_READ) == -1) {
-                    vktrace_LogError("Set memory protect on page failed!");
-                }
-#endif
-                vktrace_pageguard_memcpy(pChangedData, srcAddr, CurrentBlockSize);
+            // Disable writes to the pages before we copy from them.
+            // If one is modified by another thread while copying, we'll get
+            // another signal and mark it dirty, and we will copy it again.
+            // The other tracking modes already write protected the pages
+            // when they harvested them.
+            if ((TrackingMode == PAGEGUARD_TRACKING_PAGE_GUARD) && (mprotect(srcAddr, (SIZE_T)CurrentBlockSize, PROT_READ) == -1)) {
+                vktrace_LogError("Set memory protect on pages failed!");
             }
-            SaveSize += CurrentBlockSize;
+#endif
+            vktrace_pageguard_memcpy(pChangedData, srcAddr, (size_t)CurrentBlockSize);
+            CurrentOffset += CurrentBlockSize;
             dwIndex++;
         }
-    }
-    if (pChangedInfoArray) {
         pChangedInfoArray[0].offset = (uint32_t)dwAmount;
         pChangedInfoArray[0].length = (uint32_t)SaveSize;
     }
@@ -482,16 +516,19 @@ bool PageGuardMappedMemory::vkFlushMappedMemoryRangePageGuardHandle(VkDevice dev
     if ((dwSaveSize != 0)) {
         handleSuccessfully = true;
     }
-    if (pChangedSize) {
-        *pChangedSize = dwSaveSize;
-    }
-    if (pDataPackageSize) {
-        *pDataPackageSize = dwSaveSize + InfoSize;
-    }
     pChangedDataPackage = (PBYTE)pageguardAllocateMemory(dwSaveSize + InfoSize);
     getChangedBlockInfo(offset, size, &dwSaveSize, &InfoSize, pChangedDataPackage, 0, BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT);
 
-// if use copy of real mapped memory, need copy back to real mapped memory
+    // the package is delta encoded against the real mapped memory, so before the changed blocks are copied back to it
+    if (DeltaEncoding) {
+        encodeChangedDataPackageDelta();
+        PageGuardChangedBlockInfo *pDeltaInfoArray = (PageGuardChangedBlockInfo *)pChangedDataPackage;
+        dwSaveSize = pDeltaInfoArray[0].length;
+        InfoSize = sizeof(PageGuardChangedBlockInfo) * (pDeltaInfoArray[0].offset + 1);
+    }
+
+// if use copy of real mapped memory, need copy back to real mapped memory. A delta encoded package leaves out only bytes that are
+// already equal in the real mapped memory.
 #ifndef PAGEGUARD_ADD_PAGEGUARD_ON_REAL_MAPPED_MEMORY
     PageGuardChangedBlockInfo *pChangedInfoArray = (PageGuardChangedBlockInfo *)pChangedDataPackage;
     if (pChangedInfoArray[0].length) {
@@ -505,6 +542,13 @@ bool PageGuardMappedMemory::vkFlushMappedMemoryRangePageGuardHandle(VkDevice dev
     }
 #endif
 
+    if (pChangedSize) {
+        *pChangedSize = dwSaveSize;
+    }
+    if (pDataPackageSize) {
+        *pDataPackageSize = dwSaveSize + InfoSize;
+    }
+
     if (ppChangedDataPackage) {
         // regist the changed package
         *ppChangedDataPackage = pChangedDataPackage;
@@ -512,6 +556,113 @@ bool PageGuardMappedMemory::vkFlushMappedMemoryRangePageGuardHandle(VkDevice dev
     return handleSuccessfully;
 }
 
+// Look for the first range of bytes at or after *pStart that differ between pNew and pOld, which are size bytes long. Differing
+// bytes less than gap bytes apart are put in one range, as another PageGuardChangedBlockInfo would cost more than the equal bytes
+// between them. The range is [*pStart, *pEnd), return false if there is none.
+static bool pageguardFindDeltaRange(PBYTE pNew, PBYTE pOld, uint64_t size, uint64_t gap, uint64_t *pStart, uint64_t *pEnd) {
+    const uint64_t chunkSize = 64, wordSize = sizeof(uint64_t);
+    uint64_t pos = *pStart;
+
+    // memcmp compares a vector register at a time, let it skip the equal chunks, then find the first differing word
+    while ((pos + chunkSize <= size) && (memcmp(pNew + pos, pOld + pos, chunkSize) == 0)) {
+        pos += chunkSize;
+    }
+    uint64_t newWord, oldWord;
+    while (pos + wordSize <= size) {
+        memcpy(&newWord, pNew + pos, wordSize);
+        memcpy(&oldWord, pOld + pos, wordSize);
+        if (newWord != oldWord) {
+            break;
+        }
+        pos += wordSize;
+    }
+    if ((pos + wordSize > size) && ((pos == size) || (memcmp(pNew + pos, pOld + pos, (size_t)(size - pos)) == 0))) {
+        return false;
+    }
+
+    // the range goes on until gap equal bytes in a row
+    uint64_t start = pos, end = pos, equalSize = 0;
+    while ((pos < size) && (equalSize < gap)) {
+        uint64_t compareSize = (size - pos < wordSize) ? (size - pos) : wordSize;
+        if (memcmp(pNew + pos, pOld + pos, (size_t)compareSize) == 0) {
+            equalSize += compareSize;
+        } else {
+            equalSize = 0;
+            end = pos + compareSize;
+        }
+        pos += compareSize;
+    }
+    *pStart = start;
+    *pEnd = end;
+    return true;
+}
+
+// Streamed uniform buffers and the like change a few bytes of a page at a time, so when a page has been saved before, only the
+// bytes that differ from the real mapped memory are put in the package. Once a page has been saved whole, the memory at playback
+// holds what the real mapped memory does, including what the GPU wrote to it, so the bytes left out are the ones playback already
+// has. The package keeps the format that getChangedBlockInfo writes, its blocks are just byte ranges rather than pages, so
+// playback doesn't need to know about it.
+void PageGuardMappedMemory::encodeChangedDataPackageDelta() {
+    PageGuardChangedBlockInfo *pChangedInfoArray = (PageGuardChangedBlockInfo *)pChangedDataPackage;
+    PBYTE pChangedData = pChangedDataPackage + sizeof(PageGuardChangedBlockInfo) * (pChangedInfoArray[0].offset + 1);
+    const uint64_t gap = sizeof(PageGuardChangedBlockInfo);
+    std::vector<PageGuardChangedBlockInfo> deltaInfo;
+    std::vector<PBYTE> deltaData;  /// where the data of each entry of deltaInfo is in the old package
+    uint64_t deltaSize = 0, CurrentOffset = 0;
+
+    for (uint64_t i = 0; i < pChangedInfoArray[0].offset; i++) {
+        uint64_t blockOffset = pChangedInfoArray[i + 1].offset, blockSize = pChangedInfoArray[i + 1].length;
+        for (uint64_t pageOffset = 0; pageOffset < blockSize; pageOffset += PageGuardSize) {
+            uint64_t index = (blockOffset + pageOffset) / PageGuardSize;
+            uint64_t pageSize = (blockSize - pageOffset < PageGuardSize) ? (blockSize - pageOffset) : PageGuardSize;
+            PBYTE pPageData = pChangedData + CurrentOffset + pageOffset;
+            uint64_t rangeStart = 0, rangeEnd = pageSize;
+            bool sent = pPageStatus->getBlockSentArray(index);
+            if (!sent) {
+                pPageStatus->setBlockRange(BLOCK_FLAG_ARRAY_SENT, index, 1, true);
+            }
+            while (!sent || pageguardFindDeltaRange(pPageData, pRealMappedData + blockOffset + pageOffset, pageSize, gap,
+                                                    &rangeStart, &rangeEnd)) {
+                // a range that starts close to the end of the previous one, in the same page or the page before it, joins it
+                uint64_t rangeOffset = blockOffset + pageOffset + rangeStart;
+                PageGuardChangedBlockInfo *pLast = deltaInfo.empty() ? nullptr : &deltaInfo.back();
+                if (pLast && (rangeOffset - (pLast->offset + pLast->length) < gap) &&
+                    (rangeOffset + (rangeEnd - rangeStart) - pLast->offset <= PAGEGUARD_MAX_CHANGED_BLOCK_SIZE) &&
+                    (deltaData.back() + (rangeOffset - pLast->offset) == pPageData + rangeStart)) {
+                    deltaSize += rangeOffset + (rangeEnd - rangeStart) - (pLast->offset + pLast->length);
+                    pLast->length = (uint32_t)(rangeOffset + (rangeEnd - rangeStart) - pLast->offset);
+                } else {
+                    PageGuardChangedBlockInfo info = {(uint32_t)rangeOffset, (uint32_t)(rangeEnd - rangeStart), 0, 0};
+                    deltaInfo.push_back(info);
+                    deltaData.push_back(pPageData + rangeStart);
+                    deltaSize += rangeEnd - rangeStart;
+                }
+                if (!sent) {
+                    break;
+                }
+                rangeStart = rangeEnd;
+            }
+        }
+        CurrentOffset += blockSize;
+    }
+
+    uint64_t infoSize = sizeof(PageGuardChangedBlockInfo) * (deltaInfo.size() + 1);
+    PBYTE pDeltaPackage = (PBYTE)pageguardAllocateMemory(infoSize + deltaSize);
+    PageGuardChangedBlockInfo *pDeltaInfoArray = (PageGuardChangedBlockInfo *)pDeltaPackage;
+    pDeltaInfoArray[0].offset = (uint32_t)deltaInfo.size();
+    pDeltaInfoArray[0].length = (uint32_t)deltaSize;
+    pDeltaInfoArray[0].reserve0 = pChangedInfoArray[0].reserve0;
+    pDeltaInfoArray[0].reserve1 = pChangedInfoArray[0].reserve1;
+    PBYTE pDeltaData = pDeltaPackage + infoSize;
+    for (size_t i = 0; i < deltaInfo.size(); i++) {
+        pDeltaInfoArray[i + 1] = deltaInfo[i];
+        vktrace_pageguard_memcpy(pDeltaData, deltaData[i], deltaInfo[i].length);
+        pDeltaData += deltaInfo[i].length;
+    }
+    pageguardFreeMemory(pChangedDataPackage);
+    pChangedDataPackage = pDeltaPackage;
+}
+
 void PageGuardMappedMemory::clearChangedDataPackage() {
     if (pChangedDataPackage) {
         pageguardFreeMemory(pChangedDataPackage);
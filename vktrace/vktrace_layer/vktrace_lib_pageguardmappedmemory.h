@@ -30,6 +30,14 @@
 #include "vktrace_pageguard_memorycopy.h"
 #include "vktrace_lib_pagestatusarray.h"
 
+// How the pages written by the target app are found, see getPageGuardTrackingMode().
+static const int PAGEGUARD_TRACKING_PAGE_GUARD = 0;  /// page guard exception (Windows) or SIGSEGV (Linux) on first write to a page
+static const int PAGEGUARD_TRACKING_SOFT_DIRTY = 1;  /// soft-dirty bits of /proc/self/pagemap, Linux only
+static const int PAGEGUARD_TRACKING_UFFD_WP = 2;     /// userfaultfd write protect and PAGEMAP_SCAN, Linux only
+
+// Runs of changed pages are saved as one block, the offset and length of a block are 32 bit.
+static const uint64_t PAGEGUARD_MAX_CHANGED_BLOCK_SIZE = 0x80000000;
+
 typedef class PageGuardMappedMemory {
     friend class PageGuardCapture;
 
@@ -43,10 +51,14 @@ typedef class PageGuardMappedMemory {
     PBYTE pRealMappedData;      /// point to real mapped memory in app process
     PBYTE pChangedDataPackage;  /// if not nullptr, it point to a package which include changed info array and changed data block,
                                 /// allocated by this class
+    bool DeltaEncoding;  /// if true, changed blocks are saved as the bytes that differ from the real mapped memory, see
+                         /// getEnablePageGuardDeltaFlag()
     VkDeviceSize MappedSize;    /// the size of range
 
     VkDeviceSize PageGuardSize;  /// size for one block
 
+    int TrackingMode;  /// PAGEGUARD_TRACKING_*, page guard if the memory can't be tracked the way getPageGuardTrackingMode() says
+
    protected:
     PageStatusArray *pPageStatus;
     bool BlockConflictError;  /// record if any block has been read by host and also write by host
@@ -70,6 +82,8 @@ typedef class PageGuardMappedMemory {
 
     VkDeviceSize &getMappedSize();  /// get the size of range
 
+    int getTrackingMode();
+
     bool isUseCopyForRealMappedMemory();
 
     /// get head addr and size for a block which is located by a given index
@@ -80,6 +94,9 @@ typedef class PageGuardMappedMemory {
 
     void setMappedBlockChanged(uint64_t index, bool bChanged, int useWhich);
 
+    /// set or clear the flags of count blocks starting from index
+    void setMappedBlockRangeChanged(uint64_t index, uint64_t count, bool bChanged, int useWhich);
+
     bool isMappedBlockChanged(uint64_t index, int useWhich);
 
     bool isMappedBlockLoaded(uint64_t index);
@@ -88,6 +105,9 @@ typedef class PageGuardMappedMemory {
 
     uint64_t getMappedBlockSize(uint64_t index);
 
+    /// get the size of count blocks starting from index, the last block may be smaller than a page
+    uint64_t getMappedBlockRangeSize(uint64_t index, uint64_t count);
+
     uint64_t getMappedBlockOffset(uint64_t index);
 
     bool isNoMappedBlockChanged();
@@ -124,6 +144,7 @@ typedef class PageGuardMappedMemory {
     /// size_t *pInfoSize, the size of array of PageGuardChangedBlockInfo
     /// VkDeviceSize RangeOffset, RangeSize, only consider the block which is in the range which start from RangeOffset and size is
     /// RangeSize, if RangeOffset<0, consider whole mapped memory
+    /// changed pages next to each other are saved as one block.
     /// return the amount of changed blocks.
     uint64_t getChangedBlockInfo(VkDeviceSize RangeOffset, VkDeviceSize RangeSize, uint64_t *pdwSaveSize, uint64_t *pInfoSize,
                                  PBYTE pData, uint64_t DataOffset, int useWhich = BLOCK_FLAG_ARRAY_CHANGED);
@@ -141,6 +162,11 @@ typedef class PageGuardMappedMemory {
                                                  VkDeviceSize *pChangedSize, VkDeviceSize *pDataPackageSize,
                                                  PBYTE *ppChangedDataPackage);
 
+    /// replace the changed data package by one that only includes the bytes of the changed blocks that differ from the real
+    /// mapped memory, blocks that haven't been saved since vkMap... are included whole. Must be called before the changed
+    /// blocks are copied back to the real mapped memory.
+    void encodeChangedDataPackageDelta();
+
     void clearChangedDataPackage();
 
     /// get ptr and size of OPTChangedDataPackage;
@@ -21,26 +21,57 @@
 //     Here we use page guard to record which page of big memory block has been changed and only save those changed pages, it make
 //     the capture time reduce to round 15 minutes, the trace file size is round 40G,
 //     The Playback time for these trace file is round 7 minutes(on Win10/AMDFury/32GRam/I5 system).
-#include <atomic>
 #include "vktrace_lib_pagestatusarray.h"
+#if defined(WIN32)
+#include <intrin.h>
+#endif
 
-const uint64_t PageStatusArray::PAGE_FLAG_AMOUNT_PER_BYTE = 1;
-const uint64_t PageStatusArray::PAGE_NUMBER_FROM_BIT_SHIFT = 0;
+const uint64_t PageStatusArray::PAGE_FLAG_AMOUNT_PER_WORD = 64;
+const uint64_t PageStatusArray::PAGE_NUMBER_FROM_BIT_SHIFT = 6;
+
+// index of the lowest set bit of a non-zero word
+static inline uint64_t pageStatusLowestBit(uint64_t word) {
+#if defined(WIN32)
+    unsigned long index;
+#if defined(_WIN64)
+    _BitScanForward64(&index, word);
+#else
+    if (!_BitScanForward(&index, (unsigned long)word)) {
+        _BitScanForward(&index, (unsigned long)(word >> 32));
+        index += 32;
+    }
+#endif
+    return index;
+#else
+    return (uint64_t)__builtin_ctzll(word);
+#endif
+}
+
+static inline uint64_t pageStatusBitCount(uint64_t word) {
+#if defined(WIN32)
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (word * 0x0101010101010101ULL) >> 56;
+#else
+    return (uint64_t)__builtin_popcountll(word);
+#endif
+}
 
 PageStatusArray::PageStatusArray(uint64_t pageCount) {
-    ByteCount = (pageCount % PAGE_FLAG_AMOUNT_PER_BYTE) ? (pageCount / PAGE_FLAG_AMOUNT_PER_BYTE) + 1
-                                                        : pageCount / PAGE_FLAG_AMOUNT_PER_BYTE;
+    PageCount = pageCount;
+    WordCount = (pageCount + PAGE_FLAG_AMOUNT_PER_WORD - 1) >> PAGE_NUMBER_FROM_BIT_SHIFT;
 
-    pChangedArray[0] = new uint8_t[(size_t)ByteCount];
+    pChangedArray[0] = new uint64_t[(size_t)WordCount];
     assert(pChangedArray[0]);
 
-    pChangedArray[1] = new uint8_t[(size_t)ByteCount];
+    pChangedArray[1] = new uint64_t[(size_t)WordCount];
     assert(pChangedArray[1]);
 
-    pReadArray[0] = new uint8_t[(size_t)ByteCount];
+    pReadArray[0] = new uint64_t[(size_t)WordCount];
     assert(pReadArray[0]);
 
-    pReadArray[1] = new uint8_t[(size_t)ByteCount];
+    pReadArray[1] = new uint64_t[(size_t)WordCount];
     assert(pReadArray[1]);
 
     activeChangesArray = pChangedArray[0];
@@ -48,13 +79,17 @@ PageStatusArray::PageStatusArray(uint64_t pageCount) {
     activeReadArray = pReadArray[0];
     capturedReadArray = pReadArray[1];
 
-    firstTimeLoadArray = new uint8_t[(size_t)ByteCount];
+    firstTimeLoadArray = new uint64_t[(size_t)WordCount];
     assert(firstTimeLoadArray);
 
+    sentArray = new uint64_t[(size_t)WordCount];
+    assert(sentArray);
+
     clearAll();
 }
 
 PageStatusArray::~PageStatusArray() {
+    delete[] sentArray;
     delete[] firstTimeLoadArray;
     delete[] pChangedArray[0];
     delete[] pChangedArray[1];
@@ -64,75 +99,79 @@ PageStatusArray::~PageStatusArray() {
 
 void PageStatusArray::toggleChangedArray() {
     // TODO use atomic exchange
-    uint8_t *tempArray = activeChangesArray;
+    uint64_t *tempArray = activeChangesArray;
     activeChangesArray = capturedChangesArray;
     capturedChangesArray = tempArray;
 }
 
 void PageStatusArray::toggleReadArray() {
     // TODO use atomic exchange
-    uint8_t *tempArray = activeReadArray;
+    uint64_t *tempArray = activeReadArray;
     activeReadArray = capturedReadArray;
     capturedReadArray = tempArray;
 }
 
 bool PageStatusArray::getBlockChangedArray(uint64_t index) {
-    return (activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE))) != 0;
+    return (activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
 }
 
 bool PageStatusArray::getBlockChangedArraySnapshot(uint64_t index) {
-    return (capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE))) != 0;
+    return (capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
 }
 
 bool PageStatusArray::getBlockReadArray(uint64_t index) {
-    return (activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE))) != 0;
+    return (activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
 }
 
 bool PageStatusArray::getBlockReadArraySnapshot(uint64_t index) {
-    return (capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE))) != 0;
+    return (capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
 }
 
 bool PageStatusArray::getBlockFirstTimeLoadArray(uint64_t index) {
-    return (firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE))) != 0;
+    return (firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
+}
+
+bool PageStatusArray::getBlockSentArray(uint64_t index) {
+    return (sentArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] & (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD))) != 0;
 }
 
 void PageStatusArray::setBlockChangedArray(uint64_t index, bool changed) {
     if (changed) {
-        activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE));
+        activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     } else {
-        activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~((uint8_t)(1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE)));
+        activeChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~(1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     }
 }
 
 void PageStatusArray::setBlockChangedArraySnapshot(uint64_t index, bool changed) {
     if (changed) {
-        capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE));
+        capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     } else {
-        capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~((uint8_t)(1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE)));
+        capturedChangesArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~(1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     }
 }
 
 void PageStatusArray::setBlockReadArray(uint64_t index, bool changed) {
     if (changed) {
-        activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE));
+        activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     } else {
-        activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~((uint8_t)(1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE)));
+        activeReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~(1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     }
 }
 
 void PageStatusArray::setBlockReadArraySnapshot(uint64_t index, bool changed) {
     if (changed) {
-        capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE));
+        capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     } else {
-        capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~((uint8_t)(1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE)));
+        capturedReadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~(1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     }
 }
 
 void PageStatusArray::setBlockFirstTimeLoadArray(uint64_t index, bool loaded) {
     if (loaded) {
-        firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE));
+        firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= (1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     } else {
-        firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~((uint8_t)(1 << (index % PAGE_FLAG_AMOUNT_PER_BYTE)));
+        firstTimeLoadArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~(1ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
     }
 }
 
@@ -141,9 +180,92 @@ void PageStatusArray::backupChangedArray() { toggleChangedArray(); }
 void PageStatusArray::backupReadArray() { toggleReadArray(); }
 
 void PageStatusArray::clearAll() {
-    memset(activeChangesArray, 0, (size_t)ByteCount);
-    memset(capturedChangesArray, 0, (size_t)ByteCount);
-    memset(activeReadArray, 0, (size_t)ByteCount);
-    memset(capturedReadArray, 0, (size_t)ByteCount);
-    memset(firstTimeLoadArray, 0, (size_t)ByteCount);
+    memset(activeChangesArray, 0, (size_t)WordCount * sizeof(uint64_t));
+    memset(capturedChangesArray, 0, (size_t)WordCount * sizeof(uint64_t));
+    memset(activeReadArray, 0, (size_t)WordCount * sizeof(uint64_t));
+    memset(capturedReadArray, 0, (size_t)WordCount * sizeof(uint64_t));
+    memset(firstTimeLoadArray, 0, (size_t)WordCount * sizeof(uint64_t));
+    memset(sentArray, 0, (size_t)WordCount * sizeof(uint64_t));
+}
+
+uint64_t *PageStatusArray::getArray(int which) {
+    switch (which) {
+        case BLOCK_FLAG_ARRAY_CHANGED:
+            return activeChangesArray;
+        case BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT:
+            return capturedChangesArray;
+        case BLOCK_FLAG_ARRAY_READ:
+            return activeReadArray;
+        case BLOCK_FLAG_ARRAY_READ_SNAPSHOT:
+            return capturedReadArray;
+        case BLOCK_FLAG_ARRAY_SENT:
+            return sentArray;
+        default:
+            assert(0);
+            return activeChangesArray;
+    }
+}
+
+void PageStatusArray::setBlockRange(int which, uint64_t index, uint64_t count, bool flag) {
+    uint64_t *pArray = getArray(which);
+    uint64_t end = index + count;
+    assert(end <= PageCount);
+    while (index < end) {
+        uint64_t bit = index % PAGE_FLAG_AMOUNT_PER_WORD;
+        uint64_t bits = PAGE_FLAG_AMOUNT_PER_WORD - bit;
+        if (bits > end - index) {
+            bits = end - index;
+        }
+        uint64_t mask = (bits == PAGE_FLAG_AMOUNT_PER_WORD) ? ~0ULL : (((1ULL << bits) - 1) << bit);
+        if (flag) {
+            pArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] |= mask;
+        } else {
+            pArray[index >> PAGE_NUMBER_FROM_BIT_SHIFT] &= ~mask;
+        }
+        index += bits;
+    }
+}
+
+bool PageStatusArray::findBlockRun(int which, uint64_t index, uint64_t *pRunStart, uint64_t *pRunEnd) {
+    uint64_t *pArray = getArray(which);
+    if (index >= PageCount) {
+        return false;
+    }
+
+    // skip the clear words, then the run starts at the lowest set bit at or after index
+    uint64_t wordIndex = index >> PAGE_NUMBER_FROM_BIT_SHIFT;
+    uint64_t word = pArray[wordIndex] & (~0ULL << (index % PAGE_FLAG_AMOUNT_PER_WORD));
+    while (word == 0) {
+        if (++wordIndex >= WordCount) {
+            return false;
+        }
+        word = pArray[wordIndex];
+    }
+    uint64_t runStart = (wordIndex << PAGE_NUMBER_FROM_BIT_SHIFT) + pageStatusLowestBit(word);
+    if (runStart >= PageCount) {
+        return false;
+    }
+
+    // the run ends at the lowest clear bit after its start, skip the words that are all set
+    word = ~pArray[wordIndex] & (~0ULL << (runStart % PAGE_FLAG_AMOUNT_PER_WORD));
+    while (word == 0) {
+        if (++wordIndex >= WordCount) {
+            break;
+        }
+        word = ~pArray[wordIndex];
+    }
+    uint64_t runEnd = (word == 0) ? PageCount : (wordIndex << PAGE_NUMBER_FROM_BIT_SHIFT) + pageStatusLowestBit(word);
+
+    *pRunStart = runStart;
+    *pRunEnd = (runEnd > PageCount) ? PageCount : runEnd;
+    return true;
+}
+
+uint64_t PageStatusArray::getBlockCount(int which) {
+    uint64_t *pArray = getArray(which);
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < WordCount; i++) {
+        count += pageStatusBitCount(pArray[i]);
+    }
+    return count;
 }
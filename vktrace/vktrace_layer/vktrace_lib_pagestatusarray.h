@@ -31,6 +31,7 @@ static const int BLOCK_FLAG_ARRAY_CHANGED = 0;
 static const int BLOCK_FLAG_ARRAY_CHANGED_SNAPSHOT = 1;
 static const int BLOCK_FLAG_ARRAY_READ = 2;
 static const int BLOCK_FLAG_ARRAY_READ_SNAPSHOT = 3;
+static const int BLOCK_FLAG_ARRAY_SENT = 4;
 
 typedef class PageStatusArray {
    public:
@@ -45,6 +46,7 @@ typedef class PageStatusArray {
     bool getBlockReadArray(uint64_t index);
     bool getBlockReadArraySnapshot(uint64_t index);
     bool getBlockFirstTimeLoadArray(uint64_t index);
+    bool getBlockSentArray(uint64_t index);
     void setBlockChangedArray(uint64_t index, bool changed);
     void setBlockChangedArraySnapshot(uint64_t index, bool changed);
     void setBlockReadArray(uint64_t index, bool changed);
@@ -54,21 +56,34 @@ typedef class PageStatusArray {
     void backupReadArray();
     void clearAll();
 
+    /// set or clear the flags of blocks [index, index + count) in the array selected by which (BLOCK_FLAG_ARRAY_*)
+    void setBlockRange(int which, uint64_t index, uint64_t count, bool flag);
+
+    /// find the first run of blocks with their flag set in the array selected by which, starting the search from block index.
+    /// return false if there is none, otherwise the run is [*pRunStart, *pRunEnd).
+    bool findBlockRun(int which, uint64_t index, uint64_t *pRunStart, uint64_t *pRunEnd);
+
+    /// return the amount of blocks with their flag set in the array selected by which
+    uint64_t getBlockCount(int which);
+
    private:
-    const static uint64_t PAGE_FLAG_AMOUNT_PER_BYTE;
+    uint64_t *getArray(int which);
+
+    const static uint64_t PAGE_FLAG_AMOUNT_PER_WORD;
     const static uint64_t PAGE_NUMBER_FROM_BIT_SHIFT;
-    uint64_t ByteCount;
-    uint8_t *activeChangesArray;
-    uint8_t *capturedChangesArray;
-    uint8_t *activeReadArray;
-    uint8_t *capturedReadArray;
-    uint8_t *pChangedArray[2];  /// include two array, one for page guard handler to record which block has been changed from
-                                /// vkMap.. or last time vkFlush..., the other one for flush data and reset pageguard
-    uint8_t *pReadArray[2];     /// include two array, one for page guard handler to record which block has been read by host from
-                                /// vkMap.. or last time vkinvalidate or vkpipelinebarrier with specific para..., the other one for
-                                /// reset page guard
+    uint64_t PageCount;
+    uint64_t WordCount;  /// the flags are bits of 64 bit words so runs of changed pages can be found a word at a time
+    uint64_t *activeChangesArray;
+    uint64_t *capturedChangesArray;
+    uint64_t *activeReadArray;
+    uint64_t *capturedReadArray;
+    uint64_t *pChangedArray[2];  /// include two array, one for page guard handler to record which block has been changed from
+                                 /// vkMap.. or last time vkFlush..., the other one for flush data and reset pageguard
+    uint64_t *pReadArray[2];     /// include two array, one for page guard handler to record which block has been read by host from
+                                 /// vkMap.. or last time vkinvalidate or vkpipelinebarrier with specific para..., the other one for
+                                 /// reset page guard
 
-    uint8_t *firstTimeLoadArray;
+    uint64_t *firstTimeLoadArray;
     /// the array is used for remove initial memcpy real mapped memory to shadow
     /// mapped memory in map process. When target app call map/unmap memory,
     /// some title use large mapped size and only access small part of mapped
@@ -93,4 +108,6 @@ typedef class PageStatusArray {
     /// platforms to capture read/write a page, we can also use it on those
     /// platforms.
 
+    uint64_t *sentArray;  /// the flag of a block is set once its contents have been saved to the trace file since vkMap..., only
+                          /// used when changed blocks are saved as the bytes that differ from the last saved contents
 } PageStatusArray;
@@ -172,13 +172,16 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkAllocateMemory(VkDevic
     vktrace_finalize_buffer_address(pHeader, (void**)&(pPacket->pAllocateInfo));
     vktrace_finalize_buffer_address(pHeader, (void**)&(pPacket->pAllocator));
     vktrace_finalize_buffer_address(pHeader, (void**)&(pPacket->pMemory));
+
+    // Finalizing clears the unused end of the packet, so the memory handle is stored there afterwards.
+    vktrace_finalize_trace_packet(pHeader);
     *((VkDeviceMemory*)((PBYTE)pHeader + pHeader->size - (sizeof(VkDeviceMemory)))) = *pMemory;
 
     if (!g_trimEnabled) {
         // trim not enabled, send packet as usual
-        FINISH_TRACE_PACKET();
+        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
+        vktrace_delete_trace_packet(&pHeader);
     } else {
-        vktrace_finalize_trace_packet(pHeader);
         trim::ObjectInfo& info = trim::add_DeviceMemory_object(*pMemory);
         info.belongsToDevice = device;
         info.ObjectInfo.DeviceMemory.pCreatePacket = trim::copy_packet(pHeader);
@@ -667,6 +670,11 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkBeginCommandBuffer(VkC
         trim::ClearImageTransitions(commandBuffer);
         trim::ClearBufferTransitions(commandBuffer);
 
+        trim::ObjectInfo* pInfo = trim::get_CommandBuffer_objectInfo(commandBuffer);
+        if (pInfo != NULL) {
+            pInfo->ObjectInfo.CommandBuffer.usageFlags = pBeginInfo->flags;
+        }
+
         if (g_trimIsInTrim) {
             trim::write_packet(pHeader);
         } else {
@@ -980,11 +988,6 @@ VkLayerInstanceCreateInfo* get_chain_info(const VkInstanceCreateInfo* pCreateInf
     return chain_info;
 }
 
-#if defined(USE_PAGEGUARD_SPEEDUP) && !defined(PAGEGUARD_MEMCPY_USE_PPL_LIB)
-extern "C" BOOL vktrace_pageguard_init_multi_threads_memcpy();
-extern "C" void vktrace_pageguard_done_multi_threads_memcpy();
-#endif
-
 static bool send_vk_trace_file_header(VkInstance instance) {
     bool rval = false;
     uint64_t packet_size;
@@ -1021,6 +1024,7 @@ static bool send_vk_trace_file_header(VkInstance instance) {
     pHeader->tracer_id_array[0].id = VKTRACE_TID_VULKAN;
     pHeader->tracer_id_array[0].is_64_bit = (sizeof(intptr_t) == 8) ? 1 : 0;
     pHeader->trace_start_time = vktrace_get_time();
+    vktrace_get_time_source(&pHeader->time_source, &pHeader->tsc_frequency);
     pHeader->endianess = get_endianess();
     pHeader->ptrsize = sizeof(void*);
     pHeader->arch = get_arch();
@@ -2145,6 +2149,14 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkQueueSubmit(VkQueue qu
                                 pBuffer->ObjectInfo.Buffer.accessFlags = transition->dstAccessMask;
                             }
                         }
+
+                        // A one-time-submit recording can't be submitted again, so it isn't
+                        // needed to recreate the command buffer.
+                        if (pCBInfo->ObjectInfo.CommandBuffer.usageFlags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) {
+                            trim::remove_CommandBuffer_calls(pSubmits[i].pCommandBuffers[c]);
+                            trim::ClearImageTransitions(pSubmits[i].pCommandBuffers[c]);
+                            trim::ClearBufferTransitions(pSubmits[i].pCommandBuffers[c]);
+                        }
                     }
 
                     if (pSubmits[i].pWaitSemaphores != NULL) {
@@ -2576,17 +2588,15 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkCreateGraphicsPipeline
             info.ObjectInfo.Pipeline.isGraphicsPipeline = true;
             info.ObjectInfo.Pipeline.pipelineCache = pipelineCache;
             info.ObjectInfo.Pipeline.renderPassVersion = trim::get_RenderPassVersion(pCreateInfos[i].renderPass);
-            info.ObjectInfo.Pipeline.shaderModuleCreateInfoCount = pCreateInfos[i].stageCount;
-            info.ObjectInfo.Pipeline.pShaderModuleCreateInfos =
-                VKTRACE_NEW_ARRAY(VkShaderModuleCreateInfo, pCreateInfos[i].stageCount);
+            info.ObjectInfo.Pipeline.shaderModuleCreatePacketCount = pCreateInfos[i].stageCount;
+            info.ObjectInfo.Pipeline.pShaderModuleCreatePackets =
+                VKTRACE_NEW_ARRAY(vktrace_trace_packet_header*, pCreateInfos[i].stageCount);
 
-            for (uint32_t stageIndex = 0; stageIndex < info.ObjectInfo.Pipeline.shaderModuleCreateInfoCount; stageIndex++) {
+            for (uint32_t stageIndex = 0; stageIndex < info.ObjectInfo.Pipeline.shaderModuleCreatePacketCount; stageIndex++) {
                 trim::ObjectInfo* pShaderModuleInfo = trim::get_ShaderModule_objectInfo(pCreateInfos[i].pStages[stageIndex].module);
-                if (pShaderModuleInfo != nullptr) {
-                    trim::StateTracker::copy_VkShaderModuleCreateInfo(
-                        &info.ObjectInfo.Pipeline.pShaderModuleCreateInfos[stageIndex],
-                        pShaderModuleInfo->ObjectInfo.ShaderModule.createInfo);
-                }
+                info.ObjectInfo.Pipeline.pShaderModuleCreatePackets[stageIndex] =
+                    (pShaderModuleInfo != nullptr) ? trim::copy_packet(pShaderModuleInfo->ObjectInfo.ShaderModule.pCreatePacket)
+                                                   : nullptr;
             }
 
             trim::StateTracker::copy_VkGraphicsPipelineCreateInfo(&info.ObjectInfo.Pipeline.graphicsPipelineCreateInfo,
@@ -2669,14 +2679,13 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkCreateComputePipelines
             info.belongsToDevice = device;
             info.ObjectInfo.Pipeline.isGraphicsPipeline = false;
             info.ObjectInfo.Pipeline.pipelineCache = pipelineCache;
-            info.ObjectInfo.Pipeline.shaderModuleCreateInfoCount = 1;
-            info.ObjectInfo.Pipeline.pShaderModuleCreateInfos = VKTRACE_NEW(VkShaderModuleCreateInfo);
+            info.ObjectInfo.Pipeline.shaderModuleCreatePacketCount = 1;
+            info.ObjectInfo.Pipeline.pShaderModuleCreatePackets = VKTRACE_NEW(vktrace_trace_packet_header*);
 
             trim::ObjectInfo* pShaderModuleInfo = trim::get_ShaderModule_objectInfo(pCreateInfos[i].stage.module);
-            if (pShaderModuleInfo != nullptr) {
-                trim::StateTracker::copy_VkShaderModuleCreateInfo(&info.ObjectInfo.Pipeline.pShaderModuleCreateInfos[0],
-                                                                  pShaderModuleInfo->ObjectInfo.ShaderModule.createInfo);
-            }
+            info.ObjectInfo.Pipeline.pShaderModuleCreatePackets[0] =
+                (pShaderModuleInfo != nullptr) ? trim::copy_packet(pShaderModuleInfo->ObjectInfo.ShaderModule.pCreatePacket)
+                                               : nullptr;
 
             trim::StateTracker::copy_VkComputePipelineCreateInfo(&info.ObjectInfo.Pipeline.computePipelineCreateInfo,
                                                                  pCreateInfos[i]);
@@ -3266,14 +3275,18 @@ VKTRACER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL __HOOKED_vkQueuePresentKHR(VkQueu
                 }
             }
         } else if (trim::is_trim_trigger_enabled(trim::enum_trim_trigger::frameCounter)) {
-            if (g_trimFrameCounter == g_trimStartFrame) {
-                vktrace_LogAlways("Trim starting now at frame: %d", g_trimStartFrame);
-                trim::start();
-            }
-            if (g_trimEndFrame < UINT64_MAX && g_trimFrameCounter == g_trimEndFrame + 1) {
+            // Stopping moves on to the next frame range, which may start right away.
+            if (g_trimIsInTrim && g_trimEndFrame < UINT64_MAX && g_trimFrameCounter == g_trimEndFrame + 1) {
                 vktrace_LogAlways("Trim stopping now at frame: %d", g_trimEndFrame);
                 trim::stop();
             }
+            if (g_trimIsPreTrim && g_trimFrameCounter == g_trimStartFrame) {
+                vktrace_LogAlways("Trim starting now at frame: %d", g_trimStartFrame);
+                trim::start();
+            }
+        }
+        if (g_trimIsPreTrim) {
+            trim::check_memory_budget();
         }
     }
     return result;
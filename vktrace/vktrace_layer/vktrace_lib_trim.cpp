@@ -13,7 +13,14 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
 #include "vktrace_lib_trim.h"
+#include "vktrace_lib_trim_spillfile.h"
 #include "vktrace_lib_helpers.h"
 #include "vktrace_trace_packet_utils.h"
 #include "vktrace_vk_vk_packets.h"
@@ -42,14 +49,202 @@ static StateTracker s_trimGlobalStateTracker;
 static StateTracker s_trimStateTrackerSnapshot;
 
 // Maximum length of the VKTRACE_TRIM_TRIGGER environment variable
-static const int MAX_TRIM_TRIGGER_OPTION_STRING_LENGTH = 32;
+static const int MAX_TRIM_TRIGGER_OPTION_STRING_LENGTH = 256;
 
 static const int MAX_TRIM_TRIGGER_TYPE_STRING_LENGTH = 16;
 static const int TRACE_TRIGGER_STRING_LENGTH = MAX_TRIM_TRIGGER_OPTION_STRING_LENGTH + MAX_TRIM_TRIGGER_TYPE_STRING_LENGTH;
 
+// The frame ranges of the frames trigger, in order. The current one is in
+// g_trimStartFrame and g_trimEndFrame.
+static std::vector<std::pair<uint64_t, uint64_t>> s_trimFrameRanges;
+static size_t s_trimNextFrameRange = 0;
+
+// The frame count of the hotkey-<keyname>-<frameCount> trigger, UINT64_MAX
+// when trimming is stopped by pressing the hotkey again.
+static uint64_t s_trimHotkeyFrameCount = UINT64_MAX;
+
+// Number of trim windows started so far. vktrace writes each window to its own
+// trace file.
+static uint32_t s_trimWindowCount = 0;
+
 VKTRACE_CRITICAL_SECTION trimRecordedPacketLock;
+
+// Guards the snapshot and the parts of the global state tracker that aren't
+// kept in a CopyOnWriteMap.
 VKTRACE_CRITICAL_SECTION trimStateTrackerLock;
-VKTRACE_CRITICAL_SECTION trimCommandBufferPacketLock;
+
+// The maps of the global state tracker are guarded per shard, so that threads
+// that record different command buffers, or create and destroy different
+// objects, don't wait for each other. A call that only touches one object or
+// command buffer takes the lock of its shard, see get_state_tracker_lock().
+// Anything that visits every object, like taking the snapshot, takes all of
+// the locks with lock_state_tracker().
+static VKTRACE_CRITICAL_SECTION s_trimStateTrackerShardLocks[kCopyOnWriteShardCount];
+
+//=========================================================================
+template <typename Key>
+VKTRACE_CRITICAL_SECTION *get_state_tracker_lock(const Key &key) {
+    return &s_trimStateTrackerShardLocks[get_copy_on_write_shard_index(key)];
+}
+
+//=========================================================================
+// Takes every lock of the state tracker. Don't call this while holding the
+// lock of a single shard: another thread that is taking all of them could
+// wait for that lock while holding the locks this thread still needs.
+//=========================================================================
+void lock_state_tracker() {
+    vktrace_enter_critical_section(&trimStateTrackerLock);
+    for (size_t i = 0; i < kCopyOnWriteShardCount; i++) {
+        vktrace_enter_critical_section(&s_trimStateTrackerShardLocks[i]);
+    }
+}
+
+//=========================================================================
+void unlock_state_tracker() {
+    for (size_t i = kCopyOnWriteShardCount; i > 0; i--) {
+        vktrace_leave_critical_section(&s_trimStateTrackerShardLocks[i - 1]);
+    }
+    vktrace_leave_critical_section(&trimStateTrackerLock);
+}
+
+//=========================================================================
+// Returns the command buffers that were allocated from commandPool. The
+// caller holds every lock of the state tracker.
+//=========================================================================
+static std::vector<VkCommandBuffer> get_CommandPool_CommandBuffers(VkCommandPool commandPool) {
+    std::vector<VkCommandBuffer> commandBuffers;
+    for (auto cbIter = s_trimGlobalStateTracker.createdCommandBuffers.begin();
+         cbIter != s_trimGlobalStateTracker.createdCommandBuffers.end(); cbIter++) {
+        if (cbIter->second.ObjectInfo.CommandBuffer.commandPool == commandPool) {
+            commandBuffers.push_back(cbIter->first);
+        }
+    }
+    return commandBuffers;
+}
+
+//=========================================================================
+// Drops the calls recorded into a command buffer and the transitions they
+// make, once the command buffer can't be submitted without being recorded
+// again. The caller holds the lock of the command buffer's shard.
+//=========================================================================
+static void release_CommandBuffer_recording(VkCommandBuffer commandBuffer) {
+    s_trimGlobalStateTracker.remove_CommandBuffer_calls(commandBuffer);
+    s_trimGlobalStateTracker.ClearImageTransitions(commandBuffer);
+    s_trimGlobalStateTracker.ClearBufferTransitions(commandBuffer);
+}
+
+//=========================================================================
+// Logs how much the global state tracker holds on to, so that captures that
+// keep growing it can be spotted. The packets are counted the way
+// check_memory_budget() counts them.
+//=========================================================================
+static void log_state_tracker_memory_usage(const char *pWhen) {
+    if (!vktrace_LogIsLogging(VKTRACE_LOG_VERBOSE)) {
+        return;
+    }
+
+    lock_state_tracker();
+    StateTracker::MemoryUsage usage = s_trimGlobalStateTracker.get_memory_usage();
+    unlock_state_tracker();
+
+    vktrace_LogVerbose("Trim state tracker %s: %" PRIu64 " objects, %" PRIu64 " calls recorded into %" PRIu64
+                       " command buffers (%" PRIu64 " bytes), %" PRIu64 " image calls (%" PRIu64 " bytes), %" PRIu64
+                       " bytes of packets in all, about %" PRIu64 " bytes in total.",
+                       pWhen, usage.objectCount, usage.commandBufferCallCount, usage.commandBufferCount,
+                       usage.commandBufferCallBytes, usage.imageCallCount, usage.imageCallBytes, usage.packetBytes,
+                       usage.totalBytes);
+}
+
+//=========================================================================
+// Before trimming starts, the packets that the global state tracker keeps
+// can be held to the memory budget of VKTRACE_TRIM_MEMORY_BUDGET_ENV. Every
+// TRIM_MEMORY_BUDGET_CHECK_FRAMES frames, if the packets are over budget,
+// packets of at least TRIM_MIN_SPILLED_PACKET_SIZE bytes that were already
+// kept at the previous check are moved to s_trimSpillFile, until the rest
+// fit. Those belong to objects, command buffers and image calls that live for
+// a while, so they are unlikely to be deleted again before trimming starts,
+// and their packets are only read back when they are written to the trace
+// file, or, for the updates of a descriptor set, when it is updated again.
+//=========================================================================
+static const uint64_t TRIM_MEMORY_BUDGET_CHECK_FRAMES = 60;
+static const uint64_t TRIM_MIN_SPILLED_PACKET_SIZE = 4 * 1024;
+
+static SpillFile s_trimSpillFile;
+static uint64_t s_trimLastMemoryBudgetCheckTime = 0;
+static bool s_trimReportedMemoryBudget = false;
+
+//=========================================================================
+// Returns the memory budget in bytes, 0 if there is none.
+//=========================================================================
+static uint64_t readMemoryBudget() {
+    const char *pBudgetEnv = vktrace_get_global_var(VKTRACE_TRIM_MEMORY_BUDGET_ENV);
+    if (pBudgetEnv == NULL) {
+        return 0;
+    }
+    unsigned long long megabytes = strtoull(pBudgetEnv, NULL, 10);
+    if (megabytes == 0) {
+        vktrace_LogWarning("Ignoring invalid %s value \"%s\".", VKTRACE_TRIM_MEMORY_BUDGET_ENV, pBudgetEnv);
+        return 0;
+    }
+    return static_cast<uint64_t>(megabytes) * 1024 * 1024;
+}
+
+//=========================================================================
+// The budget is read by the first caller, the initialization of a static
+// local is thread-safe.
+//=========================================================================
+static uint64_t getMemoryBudget() {
+    static const uint64_t budget = readMemoryBudget();
+    return budget;
+}
+
+//=========================================================================
+void check_memory_budget() {
+    uint64_t budget = getMemoryBudget();
+    if (budget == 0 || g_trimFrameCounter % TRIM_MEMORY_BUDGET_CHECK_FRAMES != 0) {
+        return;
+    }
+
+    uint64_t lastCheckTime = s_trimLastMemoryBudgetCheckTime;
+    s_trimLastMemoryBudgetCheckTime = vktrace_get_time();
+
+    lock_state_tracker();
+    uint64_t keptBytes = s_trimGlobalStateTracker.get_memory_usage().packetBytes;
+
+    uint64_t spilledBytes = 0;
+    uint32_t spilledCount = 0;
+    if (keptBytes > budget && (s_trimSpillFile.is_open() || s_trimSpillFile.open())) {
+        s_trimGlobalStateTracker.visit_packets([&](vktrace_trace_packet_header **ppHeader) {
+            vktrace_trace_packet_header *pHeader = *ppHeader;
+            if (keptBytes <= budget || pHeader == nullptr || pHeader->size < TRIM_MIN_SPILLED_PACKET_SIZE ||
+                SpillFile::is_spilled(pHeader) || pHeader->vktrace_begin_time >= lastCheckTime) {
+                return;
+            }
+
+            vktrace_trace_packet_header *pStandIn = s_trimSpillFile.spill(pHeader);
+            if (pStandIn != nullptr) {
+                keptBytes -= pHeader->size - pStandIn->size;
+                spilledBytes += pHeader->size;
+                spilledCount++;
+                vktrace_delete_trace_packet(ppHeader);
+                *ppHeader = pStandIn;
+            }
+        });
+    }
+    unlock_state_tracker();
+
+    if (spilledCount > 0) {
+        vktrace_LogVerbose("Trim moved %u packets (%" PRIu64 " bytes) to its scratch file at frame %" PRIu64 ", %" PRIu64
+                           " bytes of packets are kept in memory, %" PRIu64 " bytes in the scratch file.",
+                           spilledCount, spilledBytes, g_trimFrameCounter, keptBytes, s_trimSpillFile.get_size());
+    }
+    if (keptBytes > budget && lastCheckTime != 0 && !s_trimReportedMemoryBudget) {
+        s_trimReportedMemoryBudget = true;
+        vktrace_LogWarning("Trim keeps %" PRIu64 " bytes of packets in memory, more than the %s of %" PRIu64
+                           " bytes, at frame %" PRIu64 ".",
+                           keptBytes, VKTRACE_TRIM_MEMORY_BUDGET_ENV, budget, g_trimFrameCounter);
+    }
+}
 
 //=========================================================================
 // Information necessary to create the staged buffer and memory for DEVICE_LOCAL
@@ -89,11 +284,6 @@ static std::unordered_map<VkBuffer, StagingInfo> s_bufferToStagedInfoMap;
 //=========================================================================
 static std::unordered_map<VkImage, StagingInfo> s_imageToStagedInfoMap;
 
-//=========================================================================
-// Associates a Device to a trim-specific CommandPool
-//=========================================================================
-static std::unordered_map<VkDevice, std::unordered_map<uint32_t, VkCommandPool>> s_deviceToCommandPoolMap;
-
 //=========================================================================
 // Typically an application will have one VkAllocationCallbacks struct and
 // will pass in that same address as needed, so we'll keep a map to correlate
@@ -102,20 +292,171 @@ static std::unordered_map<VkDevice, std::unordered_map<uint32_t, VkCommandPool>>
 static std::unordered_map<const void *, VkAllocationCallbacks> s_trimAllocatorMap;
 
 //=========================================================================
-// Associates a Device to a trim-specific CommandBuffer
+// Makes the next frame range of the frames trigger the current one. Returns
+// false when all of them have been trimmed.
+//=========================================================================
+static bool next_frame_range() {
+    if (s_trimNextFrameRange == s_trimFrameRanges.size()) {
+        return false;
+    }
+    g_trimStartFrame = s_trimFrameRanges[s_trimNextFrameRange].first;
+    g_trimEndFrame = s_trimFrameRanges[s_trimNextFrameRange].second;
+    s_trimNextFrameRange++;
+    return true;
+}
+
+//=========================================================================
+// The packets that start() and stop() make to recreate and destroy the
+// trimmed state are written to the trace file by a background thread, so
+// that generating the next packet, or reading back the next resource, doesn't
+// wait for the previous one to be sent. At most
+// TRIM_STATE_PACKET_QUEUE_BYTES of packets wait to be written, more than that
+// blocks until the writer catches up, unless the queue is empty. start() and
+// stop() wait for the queue to drain before they return, so that the state
+// packets stay in front of the ones the application makes next. When the
+// writer isn't running, packets are written right away.
+//=========================================================================
+static const uint64_t TRIM_STATE_PACKET_QUEUE_BYTES = 32 * 1024 * 1024;
+
+struct QueuedStatePacket {
+    vktrace_trace_packet_header *pHeader;
+    bool deleteAfterWrite;  // false for packets that the state tracker owns
+};
+
+static std::mutex s_statePacketMutex;
+static std::condition_variable s_statePacketQueued;
+static std::condition_variable s_statePacketWritten;
+static std::deque<QueuedStatePacket> s_statePacketQueue;
+static uint64_t s_statePacketQueueBytes = 0;
+static bool s_statePacketWriterRunning = false;
+static bool s_statePacketWriterStopping = false;
+static std::thread s_statePacketWriterThread;
+
+//=========================================================================
+static void state_packet_writer_main() {
+    std::unique_lock<std::mutex> lock(s_statePacketMutex);
+    while (true) {
+        s_statePacketQueued.wait(lock, [] { return !s_statePacketQueue.empty() || s_statePacketWriterStopping; });
+        if (s_statePacketQueue.empty()) {
+            break;
+        }
+
+        // The packet stays counted until it has been written.
+        QueuedStatePacket packet = s_statePacketQueue.front();
+        uint64_t size = packet.pHeader->size;
+        lock.unlock();
+        vktrace_write_trace_packet(packet.pHeader, vktrace_trace_get_trace_file());
+        if (packet.deleteAfterWrite) {
+            vktrace_delete_trace_packet(&packet.pHeader);
+        }
+        lock.lock();
+
+        s_statePacketQueue.pop_front();
+        s_statePacketQueueBytes -= size;
+        s_statePacketWritten.notify_all();
+    }
+}
+
+//=========================================================================
+static void start_state_packet_writer() {
+    std::lock_guard<std::mutex> lock(s_statePacketMutex);
+    assert(!s_statePacketWriterRunning);
+    s_statePacketWriterRunning = true;
+    s_statePacketWriterStopping = false;
+    s_statePacketWriterThread = std::thread(state_packet_writer_main);
+}
+
+//=========================================================================
+// Waits until every queued packet has been written.
+//=========================================================================
+static void finish_state_packet_writer() {
+    {
+        std::lock_guard<std::mutex> lock(s_statePacketMutex);
+        if (!s_statePacketWriterRunning) {
+            return;
+        }
+        s_statePacketWriterStopping = true;
+        s_statePacketQueued.notify_one();
+    }
+    s_statePacketWriterThread.join();
+
+    std::lock_guard<std::mutex> lock(s_statePacketMutex);
+    assert(s_statePacketQueue.empty());
+    s_statePacketWriterRunning = false;
+}
+
+//=========================================================================
+static void queue_state_packet(vktrace_trace_packet_header *pHeader, bool deleteAfterWrite) {
+    if (SpillFile::is_spilled(pHeader)) {
+        // Write the packet that was moved to the scratch file instead.
+        vktrace_trace_packet_header *pLoaded = s_trimSpillFile.load(pHeader);
+        if (deleteAfterWrite) {
+            vktrace_delete_trace_packet(&pHeader);
+        }
+        if (pLoaded == nullptr) {
+            vktrace_LogError("Trim failed to read a packet back from its scratch file, the trace file will be missing it.");
+            return;
+        }
+        pHeader = pLoaded;
+        deleteAfterWrite = true;
+    }
+
+    std::unique_lock<std::mutex> lock(s_statePacketMutex);
+    if (!s_statePacketWriterRunning) {
+        lock.unlock();
+        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
+        if (deleteAfterWrite) {
+            vktrace_delete_trace_packet(&pHeader);
+        }
+        return;
+    }
+
+    uint64_t size = pHeader->size;
+    s_statePacketWritten.wait(lock, [size] {
+        return s_statePacketQueue.empty() || s_statePacketQueueBytes + size <= TRIM_STATE_PACKET_QUEUE_BYTES;
+    });
+    s_statePacketQueue.push_back({pHeader, deleteAfterWrite});
+    s_statePacketQueueBytes += size;
+    s_statePacketQueued.notify_one();
+}
+
+//=========================================================================
+// Writes a packet that the state tracker owns, it has to stay alive until the
+// writer is finished.
+//=========================================================================
+static void write_state_packet(vktrace_trace_packet_header *pHeader) { queue_state_packet(pHeader, false); }
+
+//=========================================================================
+// Writes a packet and deletes it once it is written.
 //=========================================================================
-static std::unordered_map<VkDevice, VkCommandBuffer> s_deviceToCommandBufferMap;
+static void write_and_delete_state_packet(vktrace_trace_packet_header **ppHeader) {
+    queue_state_packet(*ppHeader, true);
+    *ppHeader = nullptr;
+}
 
 //=========================================================================
 // Start trimming
 //=========================================================================
 void start() {
+    if (s_trimWindowCount > 0) {
+        // Tell vktrace to finish the trace file of the previous window and
+        // write the packets that follow to a new one.
+        vktrace_trace_packet_header *pHeader =
+            vktrace_create_trace_packet(VKTRACE_TID_VULKAN, VKTRACE_TPI_MARKER_TRIM_WINDOW, 0, 0);
+        vktrace_finalize_trace_packet(pHeader);
+        write_and_delete_state_packet(&pHeader);
+    }
+    s_trimWindowCount++;
+
     g_trimIsPreTrim = false;
     g_trimIsInTrim = true;
+    log_state_tracker_memory_usage("at trim start");
     snapshot_state_tracker();
 
     // This will write packets to recreate all objects (but not command buffers)
+    start_state_packet_writer();
     write_all_referenced_object_calls();
+    finish_state_packet_writer();
 }
 
 //=========================================================================
@@ -126,39 +467,89 @@ void stop() {
     g_trimIsPostTrim = true;
 
     // write packets to destroy all created objects
+    start_state_packet_writer();
     write_destroy_packets();
+    finish_state_packet_writer();
 
     // clean up
     s_trimStateTrackerSnapshot.clear();
+    // The staging resources of this window were destroyed when its state was
+    // written; the next window stages its own.
+    s_bufferToStagedInfoMap.clear();
+    s_imageToStagedInfoMap.clear();
+    log_state_tracker_memory_usage("at trim stop");
+
+    // Objects are still tracked after a window, so that the next one can
+    // recreate them in its own trace file.
+    bool nextWindow;
+    if (is_trim_trigger_enabled(enum_trim_trigger::hotKey)) {
+        g_trimEndFrame = s_trimHotkeyFrameCount;
+        nextWindow = true;
+    } else {
+        nextWindow = next_frame_range();
+    }
 
-    g_trimAlreadyFinished = true;
+    if (nextWindow) {
+        g_trimIsPostTrim = false;
+        g_trimIsPreTrim = true;
+    } else {
+        g_trimAlreadyFinished = true;
+    }
 }
 
 //=========================================================================
 void AddImageTransition(VkCommandBuffer commandBuffer, ImageTransition transition) {
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
     s_trimGlobalStateTracker.AddImageTransition(commandBuffer, transition);
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
 }
 
 //=========================================================================
 std::list<ImageTransition> GetImageTransitions(VkCommandBuffer commandBuffer) {
-    return s_trimGlobalStateTracker.m_cmdBufferToImageTransitionsMap[commandBuffer];
+    std::list<ImageTransition> result;
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
+    const StateTracker &stateTracker = s_trimGlobalStateTracker;
+    const std::list<ImageTransition> *pTransitions = stateTracker.m_cmdBufferToImageTransitionsMap.get(commandBuffer);
+    if (pTransitions != nullptr) {
+        result = *pTransitions;
+    }
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
+    return result;
 }
 
 //=========================================================================
-void ClearImageTransitions(VkCommandBuffer commandBuffer) { s_trimGlobalStateTracker.ClearImageTransitions(commandBuffer); }
+void ClearImageTransitions(VkCommandBuffer commandBuffer) {
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
+    s_trimGlobalStateTracker.ClearImageTransitions(commandBuffer);
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
+}
 
 //=========================================================================
 void AddBufferTransition(VkCommandBuffer commandBuffer, BufferTransition transition) {
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
     s_trimGlobalStateTracker.AddBufferTransition(commandBuffer, transition);
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
 }
 
 //=========================================================================
 std::list<BufferTransition> GetBufferTransitions(VkCommandBuffer commandBuffer) {
-    return s_trimGlobalStateTracker.m_cmdBufferToBufferTransitionsMap[commandBuffer];
+    std::list<BufferTransition> result;
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
+    const StateTracker &stateTracker = s_trimGlobalStateTracker;
+    const std::list<BufferTransition> *pTransitions = stateTracker.m_cmdBufferToBufferTransitionsMap.get(commandBuffer);
+    if (pTransitions != nullptr) {
+        result = *pTransitions;
+    }
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
+    return result;
 }
 
 //=========================================================================
-void ClearBufferTransitions(VkCommandBuffer commandBuffer) { s_trimGlobalStateTracker.ClearBufferTransitions(commandBuffer); }
+void ClearBufferTransitions(VkCommandBuffer commandBuffer) {
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
+    s_trimGlobalStateTracker.ClearBufferTransitions(commandBuffer);
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
+}
 
 //=========================================================================
 // Returns true if specified trigger enabled; false otherwise
@@ -396,19 +787,52 @@ char *getTraceTriggerOptionString(enum enum_trim_trigger triggerType) {
 void initialize() {
     const char *trimFrames = getTraceTriggerOptionString(enum_trim_trigger::frameCounter);
     if (trimFrames != nullptr) {
-        uint32_t numFrames = 0;
-        if (sscanf(trimFrames, "%" PRIu64 ",%" PRIu32, &g_trimStartFrame, &numFrames) == 2) {
-            g_trimEndFrame = g_trimStartFrame + numFrames;
-        } else {
-            int U_ASSERT_ONLY matches = sscanf(trimFrames, "%" PRIu64 "-%" PRIu64, &g_trimStartFrame, &g_trimEndFrame);
-            assert(matches == 2);
+        // The frames trigger option string is a list of frame ranges separated
+        // by ":", each either <startFrame>,<frameCount> or <startFrame>-<endFrame>.
+        // Both include startFrame, so <startFrame>,<frameCount> keeps frameCount
+        // frames, as vktrim -f does. Each range is trimmed to its own trace file,
+        // and the ranges must be in order and must not overlap.
+        const char *pRange = trimFrames;
+        bool validRanges = true;
+        while (validRanges && *pRange != '\0') {
+            uint64_t startFrame = 0;
+            uint64_t endFrame = 0;
+            uint32_t numFrames = 0;
+            int length = 0;
+            if (sscanf(pRange, "%" PRIu64 ",%" PRIu32 "%n", &startFrame, &numFrames, &length) == 2) {
+                if (numFrames == 0) {
+                    validRanges = false;
+                    break;
+                }
+                endFrame = startFrame + numFrames - 1;
+            } else if (sscanf(pRange, "%" PRIu64 "-%" PRIu64 "%n", &startFrame, &endFrame, &length) != 2) {
+                validRanges = false;
+                break;
+            }
+
+            // make sure the start/end frames are in expected order.
+            if (startFrame > endFrame || (!s_trimFrameRanges.empty() && startFrame <= s_trimFrameRanges.back().second)) {
+                validRanges = false;
+                break;
+            }
+            s_trimFrameRanges.push_back(std::make_pair(startFrame, endFrame));
+
+            pRange += length;
+            if (*pRange == ':') {
+                pRange++;
+            } else if (*pRange != '\0') {
+                validRanges = false;
+            }
         }
 
-        // make sure the start/end frames are in expected order.
-        if (g_trimStartFrame <= g_trimEndFrame) {
+        if (validRanges && next_frame_range()) {
             g_trimEnabled = true;
             g_trimIsPreTrim = (g_trimStartFrame > 0);
             g_trimIsInTrim = (g_trimStartFrame == 0);
+            s_trimWindowCount = g_trimIsInTrim ? 1 : 0;
+        } else {
+            vktrace_LogError("Invalid trim frame ranges: %s", trimFrames);
+            s_trimFrameRanges.clear();
         }
     }
     if ((!g_trimEnabled) && (trim::is_trim_trigger_enabled(trim::enum_trim_trigger::hotKey))) {
@@ -426,7 +850,9 @@ void initialize() {
         // the way of handling is we get frameCount here through parsing and save it
         // to g_trimEndFrame, then when user press hotkey later, the frame counter at
         // that time will be set to g_trimStartFrame and g_trimEndFrame will be added
-        // g_trimStartFrame.
+        // g_trimStartFrame. trim::stop() sets g_trimEndFrame back to frameCount, so
+        // that every press of the hotkey captures the next frameCount frames to a new
+        // trace file.
         //
         // the following process is to get frameCount through parsing and save it to
         // g_trimEndFrame. only valid value can be set to g_trimEndFrame, if the
@@ -446,7 +872,8 @@ void initialize() {
                     //the frame number after hotkey press should not be 0 or negtive.
                     if (numFrames > 0)
                     {
-                        g_trimEndFrame = static_cast<uint64_t>(numFrames);
+                        s_trimHotkeyFrameCount = static_cast<uint64_t>(numFrames);
+                        g_trimEndFrame = s_trimHotkeyFrameCount;
                     }
                 }
             }
@@ -459,8 +886,9 @@ void initialize() {
     if (g_trimEnabled) {
         vktrace_create_critical_section(&trimStateTrackerLock);
         vktrace_create_critical_section(&trimRecordedPacketLock);
-        vktrace_create_critical_section(&trimCommandBufferPacketLock);
-        vktrace_create_critical_section(&trimTransitionMapLock);
+        for (size_t i = 0; i < kCopyOnWriteShardCount; i++) {
+            vktrace_create_critical_section(&s_trimStateTrackerShardLocks[i]);
+        }
     }
 }
 
@@ -468,11 +896,13 @@ void initialize() {
 void deinitialize() {
     s_trimStateTrackerSnapshot.clear();
     s_trimGlobalStateTracker.clear();
+    s_trimSpillFile.close();
 
     vktrace_delete_critical_section(&trimRecordedPacketLock);
     vktrace_delete_critical_section(&trimStateTrackerLock);
-    vktrace_delete_critical_section(&trimCommandBufferPacketLock);
-    vktrace_delete_critical_section(&trimTransitionMapLock);
+    for (size_t i = 0; i < kCopyOnWriteShardCount; i++) {
+        vktrace_delete_critical_section(&s_trimStateTrackerShardLocks[i]);
+    }
 }
 
 //=========================================================================
@@ -573,158 +1003,45 @@ VkImageAspectFlags getImageAspectFromFormat(VkFormat format) {
 }
 
 //=========================================================================
-// Find existing trim-specific CommandPool from the Device, or
-// create a new one.
-//=========================================================================
-VkCommandPool getCommandPoolFromDevice(VkDevice device, uint32_t queueFamilyIndex = 0) {
-    assert(device != VK_NULL_HANDLE);
-
-    if (queueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) {
-        queueFamilyIndex = 0;
-    }
-
-    auto deviceIter = s_deviceToCommandPoolMap.find(device);
-    if (deviceIter == s_deviceToCommandPoolMap.end()) {
-        // need to add device to map
-        std::unordered_map<uint32_t, VkCommandPool> queueIndexToCommandPoolMap;
-        s_deviceToCommandPoolMap[device] = queueIndexToCommandPoolMap;
-
-        deviceIter = s_deviceToCommandPoolMap.find(device);
-    }
-
-    auto queueFamilyIter = deviceIter->second.find(queueFamilyIndex);
-    if (queueFamilyIter == deviceIter->second.end()) {
-        // create a new command pool on the device
-        VkCommandPoolCreateInfo cmdPoolCreateInfo;
-        cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        cmdPoolCreateInfo.pNext = NULL;
-        cmdPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
-        cmdPoolCreateInfo.flags = 0;
-
-        VkCommandPool commandPool = VK_NULL_HANDLE;
-        VkResult result = mdd(device)->devTable.CreateCommandPool(device, &cmdPoolCreateInfo, NULL, &commandPool);
-        assert(result == VK_SUCCESS);
-        if (result == VK_SUCCESS) {
-            s_deviceToCommandPoolMap[device][queueFamilyIndex] = commandPool;
-        }
-
-        queueFamilyIter = deviceIter->second.find(queueFamilyIndex);
-    }
-
-    return queueFamilyIter->second;
-}
-
-//=========================================================================
-// Find existing trim-specific CommandBuffer from the Device, or
-// create a new one.
-//=========================================================================
-VkCommandBuffer getCommandBufferFromDevice(VkDevice device, VkCommandPool commandPool = VK_NULL_HANDLE,
-                                           uint32_t queueFamilyIndex = 0) {
-    assert(device != VK_NULL_HANDLE);
-
-    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-    if (s_deviceToCommandBufferMap.find(device) == s_deviceToCommandBufferMap.end()) {
-        if (commandPool == VK_NULL_HANDLE) {
-            commandPool = getCommandPoolFromDevice(device, queueFamilyIndex);
-        }
-
-        // allocate a new command buffer on the device
-        VkCommandBufferAllocateInfo allocateInfo;
-        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocateInfo.pNext = NULL;
-        allocateInfo.commandPool = commandPool;
-        allocateInfo.level = (VkCommandBufferLevel)VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocateInfo.commandBufferCount = 1;
-
-        VkResult result = mdd(device)->devTable.AllocateCommandBuffers(device, &allocateInfo, &commandBuffer);
-        assert(result == VK_SUCCESS);
-        if (result == VK_SUCCESS) {
-            s_deviceToCommandBufferMap[device] = commandBuffer;
-        }
-    } else {
-        commandBuffer = s_deviceToCommandBufferMap[device];
-
-        // by Doc, "Executable command buffers can be submitted, reset, or
-        // recorded to another command buffer.", the command buffer here
-        // will be reused to record command, reset is needed to make it
-        // come back to initial state. Directly using without reset is
-        // not supported by Doc, for the target title, vkBeginCommandBuffer
-        // return fail can be found on specific hardware and driver.
-        mdd(device)->devTable.ResetCommandBuffer(commandBuffer, 0);
-    }
-
-    return commandBuffer;
-}
-
+// The staging memory that readback batches share is recreated for each
+// staging buffer with the handle of the shared memory, see
+// createReadbackStagingBuffer, so the generated vkAllocateMemory and
+// vkFreeMemory of a handle have to alternate. These are the handles that
+// are allocated and not freed yet.
 //=========================================================================
-StagingInfo createStagingBuffer(VkDevice device, VkCommandPool commandPool, VkCommandBuffer commandBuffer,
-                                uint32_t queueFamilyIndex, VkDeviceSize size) {
-    StagingInfo stagingInfo = {};
-
-    stagingInfo.commandPool = commandPool;
-    stagingInfo.commandBuffer = commandBuffer;
-
-    VkQueue queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
-    stagingInfo.queue = queue;
-
-    stagingInfo.bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    stagingInfo.bufferCreateInfo.pNext = NULL;
-    stagingInfo.bufferCreateInfo.flags = 0;
-    stagingInfo.bufferCreateInfo.size = size;
-    stagingInfo.bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    stagingInfo.bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    stagingInfo.bufferCreateInfo.queueFamilyIndexCount = 0;
-    stagingInfo.bufferCreateInfo.pQueueFamilyIndices = NULL;
-
-    mdd(device)->devTable.CreateBuffer(device, &stagingInfo.bufferCreateInfo, NULL, &stagingInfo.buffer);
-
-    mdd(device)->devTable.GetBufferMemoryRequirements(device, stagingInfo.buffer, &stagingInfo.bufferMemoryRequirements);
-
-    stagingInfo.memoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    stagingInfo.memoryAllocationInfo.pNext = NULL;
-    stagingInfo.memoryAllocationInfo.allocationSize = stagingInfo.bufferMemoryRequirements.size;
-    stagingInfo.memoryAllocationInfo.memoryTypeIndex =
-        FindMemoryTypeIndex(device, stagingInfo.bufferMemoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
-
-    mdd(device)->devTable.AllocateMemory(device, &stagingInfo.memoryAllocationInfo, nullptr, &stagingInfo.memory);
-
-    mdd(device)->devTable.BindBufferMemory(device, stagingInfo.buffer, stagingInfo.memory, 0);
-
-    return stagingInfo;
-}
+static std::unordered_set<VkDeviceMemory> s_generatedStagingMemory;
 
 //=========================================================================
 void generateCreateStagingBuffer(VkDevice device, StagingInfo stagingInfo) {
+    bool bNewStagingMemory = s_generatedStagingMemory.insert(stagingInfo.memory).second;
+    assert(bNewStagingMemory);
+    (void)bNewStagingMemory;
+
     vktrace_trace_packet_header *pHeader =
         generate::vkCreateBuffer(false, device, &stagingInfo.bufferCreateInfo, NULL, &stagingInfo.buffer);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 
     pHeader = generate::vkGetBufferMemoryRequirements(false, device, stagingInfo.buffer, &stagingInfo.bufferMemoryRequirements);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 
     pHeader = generate::vkAllocateMemory(false, device, &stagingInfo.memoryAllocationInfo, NULL, &stagingInfo.memory);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 
     // bind staging buffer to staging memory
     pHeader = generate::vkBindBufferMemory(false, device, stagingInfo.buffer, stagingInfo.memory, 0);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 }
 
 //=========================================================================
 void generateDestroyStagingBuffer(VkDevice device, StagingInfo stagingInfo) {
     // delete staging buffer
     vktrace_trace_packet_header *pHeader = generate::vkDestroyBuffer(false, device, stagingInfo.buffer, NULL);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 
     // free memory
     pHeader = generate::vkFreeMemory(false, device, stagingInfo.memory, NULL);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
+    s_generatedStagingMemory.erase(stagingInfo.memory);
 }
 
 //=========================================================================
@@ -753,9 +1070,9 @@ void transitionImage(VkDevice device, VkCommandBuffer commandBuffer, VkImage ima
 };
 
 //=========================================================================
-void generateTransitionImage(VkDevice device, VkCommandBuffer commandBuffer, VkImage image, VkAccessFlags srcAccessMask,
-                             VkAccessFlags dstAccessMask, uint32_t queueFamilyIndex, VkImageLayout oldLayout,
-                             VkImageLayout newLayout, VkImageAspectFlags aspectMask, uint32_t layerCount, uint32_t mipLevels) {
+void generateTransitionImage(VkCommandBuffer commandBuffer, VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask,
+                             uint32_t queueFamilyIndex, VkImageLayout oldLayout, VkImageLayout newLayout,
+                             VkImageAspectFlags aspectMask, uint32_t layerCount, uint32_t mipLevels) {
     // Create a pipeline barrier to make it host readable
     VkImageMemoryBarrier imageMemoryBarrier;
     imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -776,8 +1093,7 @@ void generateTransitionImage(VkDevice device, VkCommandBuffer commandBuffer, VkI
     vktrace_trace_packet_header *pHeader =
         generate::vkCmdPipelineBarrier(false, commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                                        0, 0, NULL, 0, NULL, 1, &imageMemoryBarrier);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 };
 
 //=========================================================================
@@ -809,7 +1125,7 @@ void transitionBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkBuffer b
 };
 
 //=========================================================================
-void generateTransitionBuffer(VkDevice device, VkCommandBuffer commandBuffer, VkBuffer buffer, VkAccessFlags srcAccessMask,
+void generateTransitionBuffer(VkCommandBuffer commandBuffer, VkBuffer buffer, VkAccessFlags srcAccessMask,
                               VkAccessFlags dstAccessMask, VkDeviceSize offset, VkDeviceSize size) {
     // Create a pipeline barrier to make it host readable
     VkBufferMemoryBarrier bufferMemoryBarrier;
@@ -826,8 +1142,7 @@ void generateTransitionBuffer(VkDevice device, VkCommandBuffer commandBuffer, Vk
     vktrace_trace_packet_header *pHeader =
         generate::vkCmdPipelineBarrier(false, commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                                        0, 0, NULL, 1, &bufferMemoryBarrier, 0, NULL);
-    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-    vktrace_delete_trace_packet(&pHeader);
+    write_and_delete_state_packet(&pHeader);
 };
 
 //=========================================================================
@@ -877,586 +1192,1060 @@ void generateMapUnmap(bool makeCalls, VkDevice device, VkDeviceMemory memory, Vk
     }
 }
 
-//=============================================================================
-// Use this to snapshot the global state tracker at the start of the trim
+//=========================================================================
+// Reading back the contents of images and buffers at the start of the trim
 // frames.
-//=============================================================================
-void snapshot_state_tracker() {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    s_trimStateTrackerSnapshot = s_trimGlobalStateTracker;
+//
+// Resources are read back in batches. The copies or barriers of all the
+// resources in a batch are recorded into one command buffer per queue
+// family, which is submitted with a fence. While the GPU works on a batch,
+// the map / unmap packets of the batch before it are generated from its
+// results, and then its host-visible resources are transitioned back by the
+// next batch.
+//
+// The staging buffers of all batches of a Device are bound to one staging
+// memory allocation of VKTRACE_TRIM_STAGING_BUDGET bytes, which the batches
+// of every queue family take ranges of in turn, like a ring. When it is
+// full, the batch holding its oldest range is finished first. A resource
+// that doesn't fit in it gets a staging allocation of its own, and only one
+// of those exists at a time, so trim never has more than two staging
+// allocations however many resources and queue families need them.
+//=========================================================================
 
-    //
-    // Copying all the buffers is a length process, it include the following
-    // sub-processes:
-    //
-    // for (any image in all tracked images)
-    // {
-    //    1a) Transition the image into host - readable state.
-    //    2a) Map, copy, unmap the image.
-    //    3a) Transition the images back to their previous state.
-    // }
-    //
-    // for (any buffer in all tracked buffers)
-    // {
-    //    1b) Transition the buffers into host - readable state.
-    //    2b) Map, copy, unmap the buffer.
-    //    3b) Transition the buffer back to their previous state.
-    // }
-    //
-    // 4) Destroy the command pools, command buffers, and fences.
-    //
-    // Please note: the above sub-process order arrangement include some
-    // consideration about driver limitation:
-    //
-    // Some driver has limitation on the max GPU memory allocations. For
-    // some title with heavily sub-allocation behavior, the staging memory
-    // allocations needed by trim will be a large number, the following
-    // sub-process order minimize the active GPU memory allocations needed
-    // by trim at same time, and avoid the allocations (needed by trim and
-    // by the title itself) beyond driver limitation. Otherwise, it cause
-    // some title hang problem due to fail to allocate memory.
-
-    // a) dump all images, the process include the following sub-process:
-    //    1a) Transition the image into host - readable state.
-    //    2a) Map, copy, unmap the image.
-    //    3a) Transition the image back to their previous state.
-    //
-    for (auto imageIter = s_trimStateTrackerSnapshot.createdImages.begin();
-         imageIter != s_trimStateTrackerSnapshot.createdImages.end(); imageIter++) {
-        VkDevice device = imageIter->second.belongsToDevice;
-        VkImage image = imageIter->first;
+// Number of batches of a queue family that can be in flight at once.
+static const uint32_t TRIM_READBACK_BATCH_COUNT = 2;
 
-        if ((imageIter->second.ObjectInfo.Image.memorySize != 0) && (device != VK_NULL_HANDLE)) {
-            // If the memorysize is zero, it mean the image is not bound to any
-            // memory so far, it might be just created when starting to trim.
-            // for such case, what we need to do is recreating the image in
-            // playback without copy its content to host side, it doesn't
-            // has any content now and the title might set its content after
-            // the trim starting. So skip the following process.
-            // Some target title belong to such case, the following process
-            // cause the title running crash during tracing because
-            // the following part of loop suppose the image is bound to
-            // memory so memorysize is not zero.
-            // If device is VK_NULL_HANDLE, this is likely a swapchain image
-            // which we haven't associated a device to, just skip over it.
+// Maximum number of resources read back by one batch.
+static const size_t TRIM_READBACK_MAX_BATCH_RESOURCES = 256;
 
-            // 1a) Transition the image into host-readable state.
+// Staging memory of all the batches of a Device, if the
+// VKTRACE_TRIM_STAGING_BUDGET env var isn't set.
+static const VkDeviceSize TRIM_READBACK_DEFAULT_STAGING_BUDGET = 64 * 1024 * 1024;
 
-            uint32_t queueFamilyIndex = imageIter->second.ObjectInfo.Image.queueFamilyIndex;
+struct ReadbackResource {
+    // Only one of image and buffer is set.
+    VkImage image = VK_NULL_HANDLE;
+    VkBuffer buffer = VK_NULL_HANDLE;
 
-            if (imageIter->second.ObjectInfo.Image.sharingMode == VK_SHARING_MODE_CONCURRENT) {
-                queueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            }
+    // Queue family index used in the barriers of the resource.
+    uint32_t queueFamilyIndex = 0;
 
-            VkCommandPool commandPool = getCommandPoolFromDevice(device, queueFamilyIndex);
-            VkCommandBuffer commandBuffer = getCommandBufferFromDevice(device, commandPool);
-
-            // Begin the command buffer
-            VkCommandBufferBeginInfo commandBufferBeginInfo;
-            commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            commandBufferBeginInfo.pNext = NULL;
-            commandBufferBeginInfo.pInheritanceInfo = NULL;
-            commandBufferBeginInfo.flags = 0;
-            VkResult result = mdd(device)->devTable.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-            assert(result == VK_SUCCESS);
-            if (result != VK_SUCCESS) continue;
-
-            if (imageIter->second.ObjectInfo.Image.needsStagingBuffer) {
-                StagingInfo stagingInfo = createStagingBuffer(device, commandPool, commandBuffer,
-                                                              (queueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) ? 0 : queueFamilyIndex,
-                                                              imageIter->second.ObjectInfo.Image.memorySize);
-
-                // From Docs: srcImage must have a sample count equal to
-                // VK_SAMPLE_COUNT_1_BIT
-                // From Docs: srcImage must have been created with
-                // VK_IMAGE_USAGE_TRANSFER_SRC_BIT usage flag
-
-                // Copy from device_local image to host_visible buffer
-
-                VkImageAspectFlags aspectMask = imageIter->second.ObjectInfo.Image.aspectMask;
-                if (aspectMask == (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)) {
-                    stagingInfo.imageCopyRegions.reserve(2);
-
-                    // First depth, then stencil
-                    VkImageSubresource sub;
-                    sub.arrayLayer = 0;
-                    sub.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-                    sub.mipLevel = 0;
-                    {
-                        VkSubresourceLayout layout;
-                        mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &layout);
-
-                        VkBufferImageCopy copyRegion = {};
-
-                        copyRegion.bufferRowLength = 0;
-                        copyRegion.bufferImageHeight = 0;
-                        // On some platform, originally set to layout.rowPitch and layout.arrayPitch
-                        // cause write outside of staging buffer memory size and hang at following
-                        // queue submission in other frames after finish trim starting process when
-                        // trim some titles.
-                        //
-                        // Here we set bufferRowLength and bufferImageHeight to 0 make the image
-                        // copy to be tightly packed according to the imageExtent, the change fix
-                        // the above problem.
-                        //
-                        // Although bufferRowLength,bufferImageHeight can be set to greater than
-                        // the width and height member of imageExtent, but because we allocate memory
-                        // for the staging buffer by image memory size and here we copy whole image,
-                        // so greater than imageExtent take a risk that the copy beyond the staging
-                        // buffer memory size.
-
-                        copyRegion.bufferOffset = layout.offset;
-                        copyRegion.imageExtent.depth = 1;
-                        copyRegion.imageExtent.width = imageIter->second.ObjectInfo.Image.extent.width;
-                        copyRegion.imageExtent.height = imageIter->second.ObjectInfo.Image.extent.height;
-                        copyRegion.imageOffset.x = 0;
-                        copyRegion.imageOffset.y = 0;
-                        copyRegion.imageOffset.z = 0;
-                        copyRegion.imageSubresource.aspectMask = sub.aspectMask;
-                        copyRegion.imageSubresource.baseArrayLayer = 0;
-                        copyRegion.imageSubresource.layerCount = imageIter->second.ObjectInfo.Image.arrayLayers;
-                        copyRegion.imageSubresource.mipLevel = 0;
-
-                        stagingInfo.imageCopyRegions.push_back(copyRegion);
-                    }
+    // Where the staging buffer of the resource is in the staging memory of
+    // its Device, unless it has staging memory of its own.
+    VkDeviceSize stagingOffset = 0;
+    bool hasOwnStagingMemory = false;
+};
 
-                    sub.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
-                    {
-                        VkSubresourceLayout layout;
-                        mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &layout);
-
-                        VkBufferImageCopy copyRegion;
-
-                        copyRegion.bufferRowLength = 0;
-                        copyRegion.bufferImageHeight = 0;
-                        // set bufferRowLength and bufferImageHeight to 0 make the image
-                        // copy to be tightly packed according to the imageExtent.
-
-                        copyRegion.bufferOffset = layout.offset;
-                        copyRegion.imageExtent.depth = 1;
-                        copyRegion.imageExtent.width = imageIter->second.ObjectInfo.Image.extent.width;
-                        copyRegion.imageExtent.height = imageIter->second.ObjectInfo.Image.extent.height;
-                        copyRegion.imageOffset.x = 0;
-                        copyRegion.imageOffset.y = 0;
-                        copyRegion.imageOffset.z = 0;
-                        copyRegion.imageSubresource.aspectMask = sub.aspectMask;
-                        copyRegion.imageSubresource.baseArrayLayer = 0;
-                        copyRegion.imageSubresource.layerCount = imageIter->second.ObjectInfo.Image.arrayLayers;
-                        copyRegion.imageSubresource.mipLevel = 0;
-
-                        stagingInfo.imageCopyRegions.push_back(copyRegion);
-                    }
-                } else {
-                    VkImageSubresource sub;
-                    sub.arrayLayer = 0;
-                    sub.aspectMask = aspectMask;
-                    sub.mipLevel = 0;
-
-                    // need to make a VkBufferImageCopy for each mip level
-                    stagingInfo.imageCopyRegions.reserve(imageIter->second.ObjectInfo.Image.mipLevels);
-                    for (uint32_t i = 0; i < imageIter->second.ObjectInfo.Image.mipLevels; i++) {
-                        VkSubresourceLayout lay;
-                        sub.mipLevel = i;
-                        mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &lay);
-
-                        VkBufferImageCopy copyRegion;
-                        copyRegion.bufferRowLength = 0;    //< tightly packed texels
-                        copyRegion.bufferImageHeight = 0;  //< tightly packed texels
-                        copyRegion.bufferOffset = lay.offset;
-                        copyRegion.imageExtent.depth = 1;
-                        copyRegion.imageExtent.width = (imageIter->second.ObjectInfo.Image.extent.width >> i);
-                        copyRegion.imageExtent.height = (imageIter->second.ObjectInfo.Image.extent.height >> i);
-                        copyRegion.imageOffset.x = 0;
-                        copyRegion.imageOffset.y = 0;
-                        copyRegion.imageOffset.z = 0;
-                        copyRegion.imageSubresource.aspectMask = aspectMask;
-                        copyRegion.imageSubresource.baseArrayLayer = 0;
-                        copyRegion.imageSubresource.layerCount = imageIter->second.ObjectInfo.Image.arrayLayers;
-                        copyRegion.imageSubresource.mipLevel = i;
-
-                        stagingInfo.imageCopyRegions.push_back(copyRegion);
-                    }
-                }
+struct ReadbackQueue;
 
-                // From docs: srcImageLayout must specify the layout of the image
-                // subresources of srcImage specified in pRegions at the time this
-                // command is executed on a VkDevice
-                // From docs: srcImageLayout must be either of
-                // VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL or VK_IMAGE_LAYOUT_GENERAL
-                VkImageLayout srcImageLayout = imageIter->second.ObjectInfo.Image.mostRecentLayout;
-
-                // Transition the image so that it's in an optimal transfer source
-                // layout.
-                transitionImage(device, commandBuffer, image, imageIter->second.ObjectInfo.Image.accessFlags,
-                                imageIter->second.ObjectInfo.Image.accessFlags, queueFamilyIndex, srcImageLayout,
-                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, aspectMask, imageIter->second.ObjectInfo.Image.arrayLayers,
-                                imageIter->second.ObjectInfo.Image.mipLevels);
-
-                mdd(device)->devTable.CmdCopyImageToBuffer(
-                    commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingInfo.buffer,
-                    static_cast<uint32_t>(stagingInfo.imageCopyRegions.size()), stagingInfo.imageCopyRegions.data());
+struct ReadbackBatch {
+    VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    bool isRecording = false;
+    bool isSubmitted = false;
 
-                // save the staging info for later
-                s_imageToStagedInfoMap[image] = stagingInfo;
+    // The queue family the batch belongs to.
+    ReadbackQueue *pReadbackQueue = NULL;
 
-                // now that the image data is in a host-readable buffer
-                // transition image back to it's previous layout
-                transitionImage(device, commandBuffer, image, imageIter->second.ObjectInfo.Image.accessFlags,
-                                imageIter->second.ObjectInfo.Image.accessFlags, queueFamilyIndex,
-                                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, srcImageLayout, aspectMask,
-                                imageIter->second.ObjectInfo.Image.arrayLayers, imageIter->second.ObjectInfo.Image.mipLevels);
-            } else {
-                // Create a pipeline barrier to make it host readable
-                transitionImage(device, commandBuffer, image, imageIter->second.ObjectInfo.Image.accessFlags,
-                                VK_ACCESS_HOST_READ_BIT, queueFamilyIndex, imageIter->second.ObjectInfo.Image.mostRecentLayout,
-                                imageIter->second.ObjectInfo.Image.mostRecentLayout, imageIter->second.ObjectInfo.Image.aspectMask,
-                                imageIter->second.ObjectInfo.Image.arrayLayers, imageIter->second.ObjectInfo.Image.mipLevels);
-            }
+    // Bytes of the staging memory of the Device used by the batch.
+    VkDeviceSize stagingUsed = 0;
 
-            // End the CommandBuffer
-            mdd(device)->devTable.EndCommandBuffer(commandBuffer);
+    std::vector<ReadbackResource> resources;
+};
 
-            // now submit the command buffer
-            VkSubmitInfo submitInfo;
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+// A range of the staging memory of a Device used by a batch.
+struct ReadbackStagingRange {
+    VkDeviceSize begin;
+    VkDeviceSize end;
+    ReadbackBatch *pBatch;
+};
+
+struct ReadbackStaging {
+    // The staging memory stays mapped until the readback is done.
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    uint32_t memoryTypeIndex = 0;
+    uint8_t *pData = NULL;
+    VkDeviceSize size = 0;
+
+    // The ranges used by batches that aren't finished yet, in the order
+    // they were taken.
+    std::deque<ReadbackStagingRange> ranges;
 
-            // Submit the queue and wait for it to complete
-            VkQueue queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
+    // The batch whose resource has the one staging allocation of its own
+    // that may exist, if any.
+    ReadbackBatch *pOwnMemoryBatch = NULL;
+};
 
-            mdd(device)->devTable.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-            VkResult waitResult = mdd(device)->devTable.QueueWaitIdle(queue);
-            assert(waitResult == VK_SUCCESS);
-            if (waitResult != VK_SUCCESS) continue;
+struct ReadbackQueue {
+    VkDevice device = VK_NULL_HANDLE;
+    VkQueue queue = VK_NULL_HANDLE;
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    ReadbackStaging *pStaging = NULL;
 
-            // 2a) Map, copy, unmap the image.
-            device = imageIter->second.belongsToDevice;
-            image = imageIter->first;
+    ReadbackBatch batches[TRIM_READBACK_BATCH_COUNT];
+    uint32_t currentBatch = 0;
 
-            VkDeviceMemory memory = imageIter->second.ObjectInfo.Image.memory;
-            VkDeviceSize offset = imageIter->second.ObjectInfo.Image.memoryOffset;
-            VkDeviceSize size = ROUNDUP_TO_4(imageIter->second.ObjectInfo.Image.memorySize);
+    // Host-visible resources that were read back and have to be
+    // transitioned back to their previous state by the next batch.
+    std::vector<ReadbackResource> pendingRestores;
+};
 
-            if (imageIter->second.ObjectInfo.Image.needsStagingBuffer) {
-                // Note that the staged memory object won't be in the state tracker,
-                // so we want to swap out the buffer and memory
-                // that will be mapped / unmapped.
-                StagingInfo staged = s_imageToStagedInfoMap[image];
-                memory = staged.memory;
-                offset = 0;
+struct ReadbackDevice {
+    ReadbackStaging staging;
+    std::unordered_map<uint32_t, ReadbackQueue> queues;
+};
 
-                void *mappedAddress = NULL;
+//=========================================================================
+// Associates a Device to its staging memory and to the batches that read
+// back resources on each of its queue families.
+//=========================================================================
+static std::unordered_map<VkDevice, ReadbackDevice> s_deviceToReadbackMap;
 
-                if (size != 0) {
-                    generateMapUnmap(true, device, memory, offset, size, 0, mappedAddress,
-                                     &imageIter->second.ObjectInfo.Image.pMapMemoryPacket,
-                                     &imageIter->second.ObjectInfo.Image.pUnmapMemoryPacket);
-                }
-            } else {
-                auto memoryIter = s_trimStateTrackerSnapshot.createdDeviceMemorys.find(memory);
-
-                if (memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end()) {
-                    void *mappedAddress = memoryIter->second.ObjectInfo.DeviceMemory.mappedAddress;
-                    VkDeviceSize mappedOffset = memoryIter->second.ObjectInfo.DeviceMemory.mappedOffset;
-                    VkDeviceSize mappedSize = memoryIter->second.ObjectInfo.DeviceMemory.mappedSize;
-
-                    if (size != 0) {
-                        // actually map the memory if it was not already mapped.
-                        bool bAlreadyMapped = (mappedAddress != NULL);
-                        if (bAlreadyMapped) {
-                            // I imagine there could be a scenario where the
-                            // application has persistently
-                            // mapped PART of the memory, which may not contain the
-                            // image that we're trying to copy right now.
-                            // In that case, there will be errors due to this code.
-                            // We know the range of memory that is mapped
-                            // so we should be able to confirm whether or not we get
-                            // into this situation.
-                            bAlreadyMapped = (offset >= mappedOffset && (offset + size) <= (mappedOffset + mappedSize));
-                        }
+// Counters logged when the readback is done.
+static uint32_t s_readbackResourceCount = 0;
+static uint32_t s_readbackBatchCount = 0;
+static uint32_t s_readbackStagingAllocationCount = 0;
 
-                        generateMapUnmap(!bAlreadyMapped, device, memory, offset, size, 0, mappedAddress,
-                                         &imageIter->second.ObjectInfo.Image.pMapMemoryPacket,
-                                         &imageIter->second.ObjectInfo.Image.pUnmapMemoryPacket);
-                    }
-                }
+//=========================================================================
+VkDeviceSize getReadbackStagingBudget() {
+    static VkDeviceSize budget = 0;
+    if (budget == 0) {
+        budget = TRIM_READBACK_DEFAULT_STAGING_BUDGET;
+        const char *pBudgetEnv = vktrace_get_global_var(VKTRACE_TRIM_STAGING_BUDGET_ENV);
+        if (pBudgetEnv != NULL) {
+            unsigned long long megabytes = strtoull(pBudgetEnv, NULL, 10);
+            if (megabytes != 0) {
+                budget = static_cast<VkDeviceSize>(megabytes) * 1024 * 1024;
+            } else {
+                vktrace_LogWarning("Ignoring invalid %s value \"%s\".", VKTRACE_TRIM_STAGING_BUDGET_ENV, pBudgetEnv);
             }
+        }
+    }
+    return budget;
+}
+
+//=========================================================================
+// Find the batches that read back resources on the given queue family of
+// the Device, or create them.
+//=========================================================================
+ReadbackQueue *getReadbackQueue(VkDevice device, uint32_t queueFamilyIndex) {
+    if (queueFamilyIndex == VK_QUEUE_FAMILY_IGNORED) {
+        queueFamilyIndex = 0;
+    }
 
-            // 3a) Transition the image back to their previous state.
-            device = imageIter->second.belongsToDevice;
-            image = imageIter->first;
+    ReadbackDevice &readbackDevice = s_deviceToReadbackMap[device];
+    std::unordered_map<uint32_t, ReadbackQueue> &readbackQueues = readbackDevice.queues;
+    auto queueIter = readbackQueues.find(queueFamilyIndex);
+    if (queueIter != readbackQueues.end()) {
+        return &queueIter->second;
+    }
 
-            queueFamilyIndex = imageIter->second.ObjectInfo.Image.queueFamilyIndex;
+    VkQueue queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
+    assert(queue != VK_NULL_HANDLE);
+    if (queue == VK_NULL_HANDLE) {
+        return NULL;
+    }
 
-            if (imageIter->second.ObjectInfo.Image.sharingMode == VK_SHARING_MODE_CONCURRENT) {
-                queueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-            }
+    // The command buffer of a batch is reset whenever the batch is reused.
+    VkCommandPoolCreateInfo cmdPoolCreateInfo;
+    cmdPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    cmdPoolCreateInfo.pNext = NULL;
+    cmdPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    cmdPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
 
-            commandPool = getCommandPoolFromDevice(device, queueFamilyIndex);
-            commandBuffer = getCommandBufferFromDevice(device, commandPool);
-
-            // Begin the command buffer
-            memset(reinterpret_cast<void *>(&commandBufferBeginInfo), 0, sizeof(VkCommandBufferBeginInfo));
-            commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            commandBufferBeginInfo.pNext = NULL;
-            commandBufferBeginInfo.pInheritanceInfo = NULL;
-            commandBufferBeginInfo.flags = 0;
-            result = mdd(device)->devTable.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-            assert(result == VK_SUCCESS);
-            if (result != VK_SUCCESS) continue;
-
-            // only need to restore the images that did NOT need a staging buffer
-            if (imageIter->second.ObjectInfo.Image.needsStagingBuffer) {
-                // delete the staging objects
-                StagingInfo staged = s_imageToStagedInfoMap[image];
-                mdd(device)->devTable.DestroyBuffer(device, staged.buffer, NULL);
-                mdd(device)->devTable.FreeMemory(device, staged.memory, NULL);
-            } else {
-                transitionImage(device, commandBuffer, image, VK_ACCESS_HOST_READ_BIT,
-                                imageIter->second.ObjectInfo.Image.accessFlags, queueFamilyIndex,
-                                imageIter->second.ObjectInfo.Image.mostRecentLayout,
-                                imageIter->second.ObjectInfo.Image.mostRecentLayout, imageIter->second.ObjectInfo.Image.aspectMask,
-                                imageIter->second.ObjectInfo.Image.arrayLayers, imageIter->second.ObjectInfo.Image.mipLevels);
-            }
+    VkCommandPool commandPool = VK_NULL_HANDLE;
+    VkResult result = mdd(device)->devTable.CreateCommandPool(device, &cmdPoolCreateInfo, NULL, &commandPool);
+    assert(result == VK_SUCCESS);
+    if (result != VK_SUCCESS) {
+        return NULL;
+    }
 
-            // End the CommandBuffer
-            mdd(device)->devTable.EndCommandBuffer(commandBuffer);
+    ReadbackQueue &readbackQueue = readbackQueues[queueFamilyIndex];
+    readbackQueue.device = device;
+    readbackQueue.queue = queue;
+    readbackQueue.commandPool = commandPool;
+    readbackQueue.pStaging = &readbackDevice.staging;
+    readbackQueue.pStaging->size = getReadbackStagingBudget();
+    for (uint32_t i = 0; i < TRIM_READBACK_BATCH_COUNT; i++) {
+        readbackQueue.batches[i].pReadbackQueue = &readbackQueue;
+    }
+    return &readbackQueue;
+}
 
-            // now submit the command buffer
-            memset(reinterpret_cast<void *>(&submitInfo), 0, sizeof(VkSubmitInfo));
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+//=========================================================================
+// Records the barriers that transition a host-visible resource back to the
+// state it was in before it was read back.
+//=========================================================================
+void recordReadbackRestore(VkDevice device, VkCommandBuffer commandBuffer, const ReadbackResource &resource) {
+    const StateTracker &snapshot = s_trimStateTrackerSnapshot;
+    if (resource.image != VK_NULL_HANDLE) {
+        const ObjectInfo *pInfo = snapshot.createdImages.get(resource.image);
+        transitionImage(device, commandBuffer, resource.image, VK_ACCESS_HOST_READ_BIT, pInfo->ObjectInfo.Image.accessFlags,
+                        resource.queueFamilyIndex, pInfo->ObjectInfo.Image.mostRecentLayout,
+                        pInfo->ObjectInfo.Image.mostRecentLayout, pInfo->ObjectInfo.Image.aspectMask,
+                        pInfo->ObjectInfo.Image.arrayLayers, pInfo->ObjectInfo.Image.mipLevels);
+    } else {
+        const ObjectInfo *pInfo = snapshot.createdBuffers.get(resource.buffer);
+        transitionBuffer(device, commandBuffer, resource.buffer, VK_ACCESS_HOST_READ_BIT, pInfo->ObjectInfo.Buffer.accessFlags, 0,
+                         pInfo->ObjectInfo.Buffer.size);
+    }
+}
 
-            // Submit the queue and wait for it to complete
-            queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
+//=========================================================================
+// Starts recording the current batch of readbackQueue, if it isn't being
+// recorded already, and returns it. The current batch must not be in
+// flight.
+//=========================================================================
+ReadbackBatch *beginReadbackBatch(ReadbackQueue &readbackQueue) {
+    VkDevice device = readbackQueue.device;
+    ReadbackBatch &batch = readbackQueue.batches[readbackQueue.currentBatch];
+    assert(!batch.isSubmitted);
+    if (batch.isRecording) {
+        return &batch;
+    }
+
+    if (batch.commandBuffer == VK_NULL_HANDLE) {
+        VkCommandBufferAllocateInfo allocateInfo;
+        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocateInfo.pNext = NULL;
+        allocateInfo.commandPool = readbackQueue.commandPool;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocateInfo.commandBufferCount = 1;
 
-            mdd(device)->devTable.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-            waitResult = mdd(device)->devTable.QueueWaitIdle(queue);
-            assert(waitResult == VK_SUCCESS);
+        VkResult result = mdd(device)->devTable.AllocateCommandBuffers(device, &allocateInfo, &batch.commandBuffer);
+        assert(result == VK_SUCCESS);
+        if (result != VK_SUCCESS) {
+            batch.commandBuffer = VK_NULL_HANDLE;
+            return NULL;
         }
     }
 
-    // b) Dump all buffers, the process include the following sub-process:
-    //    1b) Transition the buffer into host - readable state.
-    //    2b) Map, copy, unmap the buffer.
-    //    3b) Transition the buffer back to their previous state.
-    for (auto bufferIter = s_trimStateTrackerSnapshot.createdBuffers.begin();
-         bufferIter != s_trimStateTrackerSnapshot.createdBuffers.end(); bufferIter++) {
-        VkDevice device = bufferIter->second.belongsToDevice;
-        VkBuffer buffer = static_cast<VkBuffer>(bufferIter->first);
+    if (batch.fence == VK_NULL_HANDLE) {
+        VkFenceCreateInfo fenceCreateInfo;
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceCreateInfo.pNext = NULL;
+        fenceCreateInfo.flags = 0;
 
-        if ((bufferIter->second.ObjectInfo.Buffer.pBindBufferMemoryPacket != nullptr) &&
-            (bufferIter->second.ObjectInfo.Buffer.size != 0)) {
-            // Similiar with image handling, skip the following process
-            // if the buffer is not bound to any memory.
+        VkResult result = mdd(device)->devTable.CreateFence(device, &fenceCreateInfo, NULL, &batch.fence);
+        assert(result == VK_SUCCESS);
+        if (result != VK_SUCCESS) {
+            batch.fence = VK_NULL_HANDLE;
+            return NULL;
+        }
+    }
 
-            // 1b) Transition the buffer into host-readable state.
-
-            uint32_t queueFamilyIndex = bufferIter->second.ObjectInfo.Buffer.queueFamilyIndex;
-
-            VkCommandPool commandPool = getCommandPoolFromDevice(device, queueFamilyIndex);
-            VkCommandBuffer commandBuffer = getCommandBufferFromDevice(device, commandPool);
-
-            // Begin the command buffer
-            VkCommandBufferBeginInfo commandBufferBeginInfo;
-            commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            commandBufferBeginInfo.pNext = NULL;
-            commandBufferBeginInfo.pInheritanceInfo = NULL;
-            commandBufferBeginInfo.flags = 0;
-            VkResult result = mdd(device)->devTable.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-            assert(result == VK_SUCCESS);
-            if (result != VK_SUCCESS) continue;
-
-            // If the buffer needs a staging buffer, it's because it's on
-            // DEVICE_LOCAL memory that is not HOST_VISIBLE.
-            // So we have to create another buffer and memory that IS HOST_VISIBLE
-            // so that we can copy the data
-            // from the DEVICE_LOCAL memory into HOST_VISIBLE memory, then map /
-            // unmap the HOST_VISIBLE memory object.
-            // The staging info is kept so that we can generate similar calls in the
-            // trace file in order to recreate
-            // the DEVICE_LOCAL buffer.
-            if (bufferIter->second.ObjectInfo.Buffer.needsStagingBuffer) {
-                StagingInfo stagingInfo = createStagingBuffer(device, commandPool, commandBuffer, queueFamilyIndex,
-                                                              bufferIter->second.ObjectInfo.Buffer.size);
-
-                // Copy from device_local buffer to host_visible buffer
-                stagingInfo.copyRegion.srcOffset = 0;
-                stagingInfo.copyRegion.dstOffset = 0;
-                stagingInfo.copyRegion.size = bufferIter->second.ObjectInfo.Buffer.size;
+    VkCommandBufferBeginInfo commandBufferBeginInfo;
+    commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    commandBufferBeginInfo.pNext = NULL;
+    commandBufferBeginInfo.pInheritanceInfo = NULL;
+    commandBufferBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkResult result = mdd(device)->devTable.BeginCommandBuffer(batch.commandBuffer, &commandBufferBeginInfo);
+    assert(result == VK_SUCCESS);
+    if (result != VK_SUCCESS) {
+        return NULL;
+    }
+    batch.isRecording = true;
 
-                transitionBuffer(device, commandBuffer, buffer, VK_ACCESS_FLAG_BITS_MAX_ENUM, VK_ACCESS_TRANSFER_READ_BIT, 0,
-                                 bufferIter->second.ObjectInfo.Buffer.size, true);
-                mdd(device)->devTable.CmdCopyBuffer(commandBuffer, buffer, stagingInfo.buffer, 1, &stagingInfo.copyRegion);
-                transitionBuffer(device, commandBuffer, buffer, VK_ACCESS_TRANSFER_READ_BIT,
-                                 bufferIter->second.ObjectInfo.Buffer.accessFlags, 0, bufferIter->second.ObjectInfo.Buffer.size,
-                                 true);
+    for (size_t i = 0; i < readbackQueue.pendingRestores.size(); i++) {
+        recordReadbackRestore(device, batch.commandBuffer, readbackQueue.pendingRestores[i]);
+    }
+    readbackQueue.pendingRestores.clear();
 
-                // save the staging info for later
-                s_bufferToStagedInfoMap[buffer] = stagingInfo;
-            } else {
-                transitionBuffer(device, commandBuffer, buffer, bufferIter->second.ObjectInfo.Buffer.accessFlags,
-                                 VK_ACCESS_HOST_READ_BIT, 0, bufferIter->second.ObjectInfo.Buffer.size);
-            }
+    return &batch;
+}
 
-            // TODO: LESS THAN IDEAL TO END & SUBMIT these super small command buffers
-            // End the CommandBuffer
-            mdd(device)->devTable.EndCommandBuffer(commandBuffer);
+//=========================================================================
+void submitReadbackBatch(ReadbackQueue &readbackQueue, ReadbackBatch &batch) {
+    if (!batch.isRecording) {
+        return;
+    }
 
-            // now submit the command buffer
-            VkSubmitInfo submitInfo;
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+    VkDevice device = readbackQueue.device;
+    mdd(device)->devTable.EndCommandBuffer(batch.commandBuffer);
+    batch.isRecording = false;
 
-            // Submit the queue and wait for it to complete
-            VkQueue queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
+    VkSubmitInfo submitInfo;
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = NULL;
+    submitInfo.waitSemaphoreCount = 0;
+    submitInfo.pWaitSemaphores = NULL;
+    submitInfo.pWaitDstStageMask = NULL;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = 0;
+    submitInfo.pSignalSemaphores = NULL;
 
-            mdd(device)->devTable.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-            VkResult waitResult = mdd(device)->devTable.QueueWaitIdle(queue);
-            assert(waitResult == VK_SUCCESS);
-            if (waitResult != VK_SUCCESS) continue;
+    VkResult result = mdd(device)->devTable.QueueSubmit(readbackQueue.queue, 1, &submitInfo, batch.fence);
+    assert(result == VK_SUCCESS);
+    batch.isSubmitted = (result == VK_SUCCESS);
+    s_readbackBatchCount++;
+}
 
-            // 2b) Map, copy, unmap the buffer.
+//=========================================================================
+// Generates the map / unmap packets that set the contents of the staging
+// buffer of a resource on replay.
+//=========================================================================
+void generateStagingMapUnmap(VkDevice device, const ReadbackStaging &staging, const ReadbackResource &resource,
+                                    const StagingInfo &staged, VkDeviceSize size, vktrace_trace_packet_header **ppMapMemoryPacket,
+                                    vktrace_trace_packet_header **ppUnmapMemoryPacket) {
+    if (resource.hasOwnStagingMemory) {
+        void *mappedAddress = NULL;
+        generateMapUnmap(true, device, staged.memory, 0, size, 0, mappedAddress, ppMapMemoryPacket, ppUnmapMemoryPacket);
+    } else {
+        // The staging memory of the Device is already mapped, and on replay
+        // the staging buffer gets memory of its own, so the packets map
+        // that memory from offset 0.
+        void *mappedAddress = staging.pData + resource.stagingOffset;
+        generateMapUnmap(false, device, staged.memory, 0, size, 0, mappedAddress, ppMapMemoryPacket, ppUnmapMemoryPacket);
+    }
+}
 
-            device = bufferIter->second.belongsToDevice;
-            buffer = bufferIter->first;
+//=========================================================================
+void destroyReadbackStagingBuffer(VkDevice device, const ReadbackResource &resource, const StagingInfo &staged) {
+    mdd(device)->devTable.DestroyBuffer(device, staged.buffer, NULL);
+    if (resource.hasOwnStagingMemory) {
+        mdd(device)->devTable.FreeMemory(device, staged.memory, NULL);
+    }
+}
 
-            VkDeviceMemory memory = bufferIter->second.ObjectInfo.Buffer.memory;
-            VkDeviceSize offset = bufferIter->second.ObjectInfo.Buffer.memoryOffset;
-            VkDeviceSize size = ROUNDUP_TO_4(bufferIter->second.ObjectInfo.Buffer.size);
+//=========================================================================
+// 2a) Map, copy, unmap the image, and free its staging buffer.
+//=========================================================================
+void finishImageReadback(ReadbackQueue &readbackQueue, const ReadbackResource &resource, bool bCompleted) {
+    VkDevice device = readbackQueue.device;
+    VkImage image = resource.image;
+    ObjectInfo *pInfo = s_trimStateTrackerSnapshot.get_Image(image);
 
-            void *mappedAddress = NULL;
-            VkDeviceSize mappedOffset = 0;
-            VkDeviceSize mappedSize = 0;
+    VkDeviceMemory memory = pInfo->ObjectInfo.Image.memory;
+    VkDeviceSize offset = pInfo->ObjectInfo.Image.memoryOffset;
+    VkDeviceSize size = ROUNDUP_TO_4(pInfo->ObjectInfo.Image.memorySize);
 
-            if (bufferIter->second.ObjectInfo.Buffer.needsStagingBuffer) {
-                // Note that the staged memory object won't be in the state tracker,
-                // so we want to swap out the buffer and memory
-                // that will be mapped / unmapped.
-                StagingInfo staged = s_bufferToStagedInfoMap[buffer];
-                buffer = staged.buffer;
-                memory = staged.memory;
-                offset = 0;
-            } else {
-                auto memoryIter = s_trimStateTrackerSnapshot.createdDeviceMemorys.find(memory);
-                assert(memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end());
-                if (memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end()) {
-                    mappedAddress = memoryIter->second.ObjectInfo.DeviceMemory.mappedAddress;
-                    mappedOffset = memoryIter->second.ObjectInfo.DeviceMemory.mappedOffset;
-                    mappedSize = memoryIter->second.ObjectInfo.DeviceMemory.mappedSize;
-                }
-            }
+    if (pInfo->ObjectInfo.Image.needsStagingBuffer) {
+        // Note that the staged memory object won't be in the state tracker,
+        // so we want to swap out the buffer and memory
+        // that will be mapped / unmapped.
+        const StagingInfo &staged = s_imageToStagedInfoMap[image];
+        if (bCompleted && size != 0) {
+            generateStagingMapUnmap(device, *readbackQueue.pStaging, resource, staged, size,
+                                    &pInfo->ObjectInfo.Image.pMapMemoryPacket, &pInfo->ObjectInfo.Image.pUnmapMemoryPacket);
+        }
+        destroyReadbackStagingBuffer(device, resource, staged);
+    } else if (bCompleted) {
+        auto memoryIter = s_trimStateTrackerSnapshot.createdDeviceMemorys.find(memory);
+
+        if (memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end()) {
+            void *mappedAddress = memoryIter->second.ObjectInfo.DeviceMemory.mappedAddress;
+            VkDeviceSize mappedOffset = memoryIter->second.ObjectInfo.DeviceMemory.mappedOffset;
+            VkDeviceSize mappedSize = memoryIter->second.ObjectInfo.DeviceMemory.mappedSize;
 
             if (size != 0) {
                 // actually map the memory if it was not already mapped.
                 bool bAlreadyMapped = (mappedAddress != NULL);
                 if (bAlreadyMapped) {
-                    // I imagine there could be a scenario where the application has
-                    // persistently
-                    // mapped PART of the memory, which may not contain the image
-                    // that we're trying to copy right now.
-                    // In that case, there will be errors due to this code. We know
-                    // the range of memory that is mapped
-                    // so we should be able to confirm whether or not we get into
-                    // this situation.
+                    // I imagine there could be a scenario where the
+                    // application has persistently
+                    // mapped PART of the memory, which may not contain the
+                    // image that we're trying to copy right now.
+                    // In that case, there will be errors due to this code.
+                    // We know the range of memory that is mapped
+                    // so we should be able to confirm whether or not we get
+                    // into this situation.
                     bAlreadyMapped = (offset >= mappedOffset && (offset + size) <= (mappedOffset + mappedSize));
                 }
 
                 generateMapUnmap(!bAlreadyMapped, device, memory, offset, size, 0, mappedAddress,
-                                 &bufferIter->second.ObjectInfo.Buffer.pMapMemoryPacket,
-                                 &bufferIter->second.ObjectInfo.Buffer.pUnmapMemoryPacket);
+                                 &pInfo->ObjectInfo.Image.pMapMemoryPacket, &pInfo->ObjectInfo.Image.pUnmapMemoryPacket);
+            }
+        }
+
+        // 3a) Transition the image back to their previous state.
+        readbackQueue.pendingRestores.push_back(resource);
+    }
+}
+
+//=========================================================================
+// 2b) Map, copy, unmap the buffer, and free its staging buffer.
+//=========================================================================
+void finishBufferReadback(ReadbackQueue &readbackQueue, const ReadbackResource &resource, bool bCompleted) {
+    VkDevice device = readbackQueue.device;
+    VkBuffer buffer = resource.buffer;
+    ObjectInfo *pInfo = s_trimStateTrackerSnapshot.get_Buffer(buffer);
+
+    VkDeviceMemory memory = pInfo->ObjectInfo.Buffer.memory;
+    VkDeviceSize offset = pInfo->ObjectInfo.Buffer.memoryOffset;
+    VkDeviceSize size = ROUNDUP_TO_4(pInfo->ObjectInfo.Buffer.size);
+
+    if (pInfo->ObjectInfo.Buffer.needsStagingBuffer) {
+        // Note that the staged memory object won't be in the state tracker,
+        // so we want to swap out the buffer and memory
+        // that will be mapped / unmapped.
+        const StagingInfo &staged = s_bufferToStagedInfoMap[buffer];
+        if (bCompleted && size != 0) {
+            generateStagingMapUnmap(device, *readbackQueue.pStaging, resource, staged, size,
+                                    &pInfo->ObjectInfo.Buffer.pMapMemoryPacket, &pInfo->ObjectInfo.Buffer.pUnmapMemoryPacket);
+        }
+        destroyReadbackStagingBuffer(device, resource, staged);
+    } else if (bCompleted) {
+        void *mappedAddress = NULL;
+        VkDeviceSize mappedOffset = 0;
+        VkDeviceSize mappedSize = 0;
+
+        auto memoryIter = s_trimStateTrackerSnapshot.createdDeviceMemorys.find(memory);
+        assert(memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end());
+        if (memoryIter != s_trimStateTrackerSnapshot.createdDeviceMemorys.end()) {
+            mappedAddress = memoryIter->second.ObjectInfo.DeviceMemory.mappedAddress;
+            mappedOffset = memoryIter->second.ObjectInfo.DeviceMemory.mappedOffset;
+            mappedSize = memoryIter->second.ObjectInfo.DeviceMemory.mappedSize;
+        }
+
+        if (size != 0) {
+            // actually map the memory if it was not already mapped.
+            bool bAlreadyMapped = (mappedAddress != NULL);
+            if (bAlreadyMapped) {
+                // I imagine there could be a scenario where the application has
+                // persistently
+                // mapped PART of the memory, which may not contain the image
+                // that we're trying to copy right now.
+                // In that case, there will be errors due to this code. We know
+                // the range of memory that is mapped
+                // so we should be able to confirm whether or not we get into
+                // this situation.
+                bAlreadyMapped = (offset >= mappedOffset && (offset + size) <= (mappedOffset + mappedSize));
+            }
+
+            generateMapUnmap(!bAlreadyMapped, device, memory, offset, size, 0, mappedAddress,
+                             &pInfo->ObjectInfo.Buffer.pMapMemoryPacket, &pInfo->ObjectInfo.Buffer.pUnmapMemoryPacket);
+        }
+
+        // 3b) Transition the buffer back to their previous state.
+        readbackQueue.pendingRestores.push_back(resource);
+    }
+}
+
+//=========================================================================
+// Waits for a batch that was submitted and generates the packets of the
+// resources it read back.
+//=========================================================================
+void completeReadbackBatch(ReadbackQueue &readbackQueue, ReadbackBatch &batch) {
+    VkDevice device = readbackQueue.device;
+    assert(!batch.isRecording);
+
+    bool bCompleted = false;
+    if (batch.isSubmitted) {
+        VkResult result = mdd(device)->devTable.WaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        assert(result == VK_SUCCESS);
+        bCompleted = (result == VK_SUCCESS);
+        mdd(device)->devTable.ResetFences(device, 1, &batch.fence);
+        batch.isSubmitted = false;
+    }
+
+    if (bCompleted && batch.stagingUsed != 0) {
+        // The staging memory doesn't have to be host coherent.
+        VkMappedMemoryRange range;
+        range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+        range.pNext = NULL;
+        range.memory = readbackQueue.pStaging->memory;
+        range.offset = 0;
+        range.size = VK_WHOLE_SIZE;
+        mdd(device)->devTable.InvalidateMappedMemoryRanges(device, 1, &range);
+    }
+
+    // If the batch failed, the packets of its resources are left out, as
+    // they would be if the readback of a single resource failed.
+    for (size_t i = 0; i < batch.resources.size(); i++) {
+        if (batch.resources[i].image != VK_NULL_HANDLE) {
+            finishImageReadback(readbackQueue, batch.resources[i], bCompleted);
+        } else {
+            finishBufferReadback(readbackQueue, batch.resources[i], bCompleted);
+        }
+    }
+
+    // Give back the staging memory of the batch.
+    ReadbackStaging &staging = *readbackQueue.pStaging;
+    for (auto rangeIter = staging.ranges.begin(); rangeIter != staging.ranges.end();) {
+        if (rangeIter->pBatch == &batch) {
+            rangeIter = staging.ranges.erase(rangeIter);
+        } else {
+            rangeIter++;
+        }
+    }
+    if (staging.pOwnMemoryBatch == &batch) {
+        staging.pOwnMemoryBatch = NULL;
+    }
+
+    batch.resources.clear();
+    batch.stagingUsed = 0;
+}
+
+//=========================================================================
+// Submits the current batch of readbackQueue, moves on to the next batch
+// and finishes it, so that it can be started again.
+//=========================================================================
+void nextReadbackBatch(ReadbackQueue &readbackQueue) {
+    submitReadbackBatch(readbackQueue, readbackQueue.batches[readbackQueue.currentBatch]);
+    readbackQueue.currentBatch = (readbackQueue.currentBatch + 1) % TRIM_READBACK_BATCH_COUNT;
+    completeReadbackBatch(readbackQueue, readbackQueue.batches[readbackQueue.currentBatch]);
+}
+
+//=========================================================================
+// Finishes a batch of any queue family of the Device, to free the staging
+// memory it uses. A batch that is still being recorded is submitted first.
+//=========================================================================
+void retireReadbackBatch(ReadbackBatch &batch) {
+    ReadbackQueue &readbackQueue = *batch.pReadbackQueue;
+    if (batch.isRecording) {
+        // Only the current batch of a queue family is recorded.
+        nextReadbackBatch(readbackQueue);
+    }
+    completeReadbackBatch(readbackQueue, batch);
+}
+
+//=========================================================================
+// Returns where size bytes aligned to alignment fit in the staging memory
+// of the Device, finishing the batches that hold its oldest ranges until
+// they do. size must not be 0 or more than the staging memory.
+//=========================================================================
+VkDeviceSize reserveReadbackStaging(ReadbackStaging &staging, VkDeviceSize size, VkDeviceSize alignment) {
+    assert(size != 0 && size <= staging.size);
+    while (!staging.ranges.empty()) {
+        const ReadbackStagingRange &first = staging.ranges.front();
+        const ReadbackStagingRange &last = staging.ranges.back();
+        VkDeviceSize offset = (last.end + alignment - 1) / alignment * alignment;
+        if (last.begin >= first.begin) {
+            // The ranges in use don't wrap around the end of the memory.
+            if (offset + size <= staging.size) {
+                return offset;
+            }
+            if (size <= first.begin) {
+                return 0;
             }
+        } else if (offset + size <= first.begin) {
+            return offset;
+        }
+        retireReadbackBatch(*first.pBatch);
+    }
+    return 0;
+}
+
+//=========================================================================
+// Returns the batch of readbackQueue that the next resource is recorded
+// into. If the current batch is full, it is submitted, and the next batch
+// is finished and started again.
+//=========================================================================
+ReadbackBatch *getReadbackBatch(ReadbackQueue &readbackQueue) {
+    if (readbackQueue.batches[readbackQueue.currentBatch].resources.size() >= TRIM_READBACK_MAX_BATCH_RESOURCES) {
+        nextReadbackBatch(readbackQueue);
+    }
+    return beginReadbackBatch(readbackQueue);
+}
 
-            // 3b) Transition the buffer back to their previous state.
+//=========================================================================
+// Creates the staging buffer of a resource and returns the batch that
+// reads back the resource. The staging buffer is bound to the staging
+// memory of the Device if it fits in it, or else to memory of its own.
+//=========================================================================
+ReadbackBatch *createReadbackStagingBuffer(ReadbackQueue &readbackQueue, VkDeviceSize size, ReadbackResource *pResource,
+                                                  StagingInfo *pStagingInfo) {
+    VkDevice device = readbackQueue.device;
 
-            device = bufferIter->second.belongsToDevice;
-            buffer = static_cast<VkBuffer>(bufferIter->first);
+    pStagingInfo->bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    pStagingInfo->bufferCreateInfo.pNext = NULL;
+    pStagingInfo->bufferCreateInfo.flags = 0;
+    pStagingInfo->bufferCreateInfo.size = size;
+    pStagingInfo->bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    pStagingInfo->bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    pStagingInfo->bufferCreateInfo.queueFamilyIndexCount = 0;
+    pStagingInfo->bufferCreateInfo.pQueueFamilyIndices = NULL;
 
-            queueFamilyIndex = bufferIter->second.ObjectInfo.Buffer.queueFamilyIndex;
+    VkResult result = mdd(device)->devTable.CreateBuffer(device, &pStagingInfo->bufferCreateInfo, NULL, &pStagingInfo->buffer);
+    assert(result == VK_SUCCESS);
+    if (result != VK_SUCCESS) {
+        return NULL;
+    }
 
-            commandPool = getCommandPoolFromDevice(device, queueFamilyIndex);
-            commandBuffer = getCommandBufferFromDevice(device, commandPool);
+    VkMemoryRequirements &requirements = pStagingInfo->bufferMemoryRequirements;
+    mdd(device)->devTable.GetBufferMemoryRequirements(device, pStagingInfo->buffer, &requirements);
 
-            // Begin the command buffer
-            memset(reinterpret_cast<void *>(&commandBufferBeginInfo), 0, sizeof(VkCommandBufferBeginInfo));
-            commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            commandBufferBeginInfo.pNext = NULL;
-            commandBufferBeginInfo.pInheritanceInfo = NULL;
-            commandBufferBeginInfo.flags = 0;
-            result = mdd(device)->devTable.BeginCommandBuffer(commandBuffer, &commandBufferBeginInfo);
-            assert(result == VK_SUCCESS);
-            if (result != VK_SUCCESS) continue;
+    // The map / unmap packets read the rounded up size of the resource,
+    // which can be more than the staging buffer needs.
+    VkDeviceSize stagingSize = (requirements.size > ROUNDUP_TO_4(size)) ? requirements.size : ROUNDUP_TO_4(size);
 
-            if (bufferIter->second.ObjectInfo.Buffer.needsStagingBuffer) {
-                // if this buffer had a staging buffer, then we only need to do
-                // delete the staging objects
-                StagingInfo staged = s_bufferToStagedInfoMap[buffer];
-                mdd(device)->devTable.DestroyBuffer(device, staged.buffer, NULL);
-                mdd(device)->devTable.FreeMemory(device, staged.memory, NULL);
+    ReadbackStaging &staging = *readbackQueue.pStaging;
+    ReadbackBatch *pBatch = NULL;
+    if (stagingSize <= staging.size) {
+        if (staging.memory == VK_NULL_HANDLE) {
+            VkMemoryAllocateInfo allocateInfo;
+            allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocateInfo.pNext = NULL;
+            allocateInfo.allocationSize = staging.size;
+            allocateInfo.memoryTypeIndex =
+                FindMemoryTypeIndex(device, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+            void *pStagingData = NULL;
+            result = mdd(device)->devTable.AllocateMemory(device, &allocateInfo, NULL, &staging.memory);
+            if (result == VK_SUCCESS) {
+                s_readbackStagingAllocationCount++;
+                result = mdd(device)->devTable.MapMemory(device, staging.memory, 0, VK_WHOLE_SIZE, 0, &pStagingData);
+                if (result != VK_SUCCESS) {
+                    mdd(device)->devTable.FreeMemory(device, staging.memory, NULL);
+                    staging.memory = VK_NULL_HANDLE;
+                }
             } else {
-                transitionBuffer(device, commandBuffer, buffer, VK_ACCESS_HOST_READ_BIT,
-                                 bufferIter->second.ObjectInfo.Buffer.accessFlags, 0, bufferIter->second.ObjectInfo.Buffer.size);
+                staging.memory = VK_NULL_HANDLE;
             }
+            staging.memoryTypeIndex = allocateInfo.memoryTypeIndex;
+            staging.pData = static_cast<uint8_t *>(pStagingData);
+        }
 
-            // End the CommandBuffer
-            mdd(device)->devTable.EndCommandBuffer(commandBuffer);
+        if (staging.memory != VK_NULL_HANDLE && (requirements.memoryTypeBits & (1 << staging.memoryTypeIndex)) != 0) {
+            VkDeviceSize stagingOffset = reserveReadbackStaging(staging, stagingSize, requirements.alignment);
+            pBatch = getReadbackBatch(readbackQueue);
+            if (pBatch != NULL) {
+                result = mdd(device)->devTable.BindBufferMemory(device, pStagingInfo->buffer, staging.memory, stagingOffset);
+            }
+            if (pBatch != NULL && result == VK_SUCCESS) {
+                ReadbackStagingRange range;
+                range.begin = stagingOffset;
+                range.end = stagingOffset + stagingSize;
+                range.pBatch = pBatch;
+                staging.ranges.push_back(range);
+                pBatch->stagingUsed += stagingSize;
+                pResource->stagingOffset = stagingOffset;
+
+                // On replay the staging buffer gets memory of its own, which
+                // is created with the handle of the staging memory. The same
+                // handle is allocated and freed again for every resource of
+                // the Device, so write_all_referenced_object_calls writes the
+                // create, map / unmap and destroy of each staging buffer
+                // before the next one, see s_generatedStagingMemory.
+                pStagingInfo->memory = staging.memory;
+                pStagingInfo->memoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+                pStagingInfo->memoryAllocationInfo.pNext = NULL;
+                pStagingInfo->memoryAllocationInfo.allocationSize = requirements.size;
+                pStagingInfo->memoryAllocationInfo.memoryTypeIndex = staging.memoryTypeIndex;
+                pStagingInfo->commandPool = readbackQueue.commandPool;
+                pStagingInfo->commandBuffer = pBatch->commandBuffer;
+                pStagingInfo->queue = readbackQueue.queue;
+                return pBatch;
+            }
+        }
+    }
 
-            // now submit the command buffer
-            memset(reinterpret_cast<void *>(&submitInfo), 0, sizeof(VkSubmitInfo));
-            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-            submitInfo.pNext = NULL;
-            submitInfo.waitSemaphoreCount = 0;
-            submitInfo.pWaitSemaphores = NULL;
-            submitInfo.pWaitDstStageMask = NULL;
-            submitInfo.commandBufferCount = 1;
-            submitInfo.pCommandBuffers = &commandBuffer;
-            submitInfo.signalSemaphoreCount = 0;
-            submitInfo.pSignalSemaphores = NULL;
+    // Only one resource at a time has staging memory of its own, so the
+    // batch of the previous one is finished first.
+    if (staging.pOwnMemoryBatch != NULL) {
+        retireReadbackBatch(*staging.pOwnMemoryBatch);
+    }
+
+    pBatch = getReadbackBatch(readbackQueue);
+    if (pBatch == NULL) {
+        mdd(device)->devTable.DestroyBuffer(device, pStagingInfo->buffer, NULL);
+        return NULL;
+    }
+
+    pStagingInfo->memoryAllocationInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    pStagingInfo->memoryAllocationInfo.pNext = NULL;
+    pStagingInfo->memoryAllocationInfo.allocationSize = requirements.size;
+    pStagingInfo->memoryAllocationInfo.memoryTypeIndex =
+        FindMemoryTypeIndex(device, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+    result = mdd(device)->devTable.AllocateMemory(device, &pStagingInfo->memoryAllocationInfo, NULL, &pStagingInfo->memory);
+    assert(result == VK_SUCCESS);
+    if (result != VK_SUCCESS) {
+        mdd(device)->devTable.DestroyBuffer(device, pStagingInfo->buffer, NULL);
+        return NULL;
+    }
+    s_readbackStagingAllocationCount++;
+
+    mdd(device)->devTable.BindBufferMemory(device, pStagingInfo->buffer, pStagingInfo->memory, 0);
+
+    pResource->hasOwnStagingMemory = true;
+    staging.pOwnMemoryBatch = pBatch;
+    pStagingInfo->commandPool = readbackQueue.commandPool;
+    pStagingInfo->commandBuffer = pBatch->commandBuffer;
+    pStagingInfo->queue = readbackQueue.queue;
+    return pBatch;
+}
+
+//=========================================================================
+void addReadbackResource(ReadbackBatch &batch, const ReadbackResource &resource) {
+    batch.resources.push_back(resource);
+    s_readbackResourceCount++;
+}
+
+//=========================================================================
+// 1a) Transition the image into host-readable state, or copy it into a
+// staging buffer.
+//=========================================================================
+void readbackImage(VkImage image, const ObjectInfo &info) {
+    VkDevice device = info.belongsToDevice;
+    uint32_t queueFamilyIndex = info.ObjectInfo.Image.queueFamilyIndex;
+
+    if (info.ObjectInfo.Image.sharingMode == VK_SHARING_MODE_CONCURRENT) {
+        queueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    }
+
+    ReadbackQueue *pReadbackQueue = getReadbackQueue(device, queueFamilyIndex);
+    if (pReadbackQueue == NULL) {
+        return;
+    }
+
+    ReadbackResource resource;
+    resource.image = image;
+    resource.queueFamilyIndex = queueFamilyIndex;
+
+    if (info.ObjectInfo.Image.needsStagingBuffer) {
+        StagingInfo stagingInfo;
+        ReadbackBatch *pBatch =
+            createReadbackStagingBuffer(*pReadbackQueue, info.ObjectInfo.Image.memorySize, &resource, &stagingInfo);
+        if (pBatch == NULL) {
+            return;
+        }
+        VkCommandBuffer commandBuffer = pBatch->commandBuffer;
+
+        // From Docs: srcImage must have a sample count equal to
+        // VK_SAMPLE_COUNT_1_BIT
+        // From Docs: srcImage must have been created with
+        // VK_IMAGE_USAGE_TRANSFER_SRC_BIT usage flag
+
+        // Copy from device_local image to host_visible buffer
+
+        VkImageAspectFlags aspectMask = info.ObjectInfo.Image.aspectMask;
+        if (aspectMask == (VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT)) {
+            stagingInfo.imageCopyRegions.reserve(2);
+
+            // First depth, then stencil
+            VkImageSubresource sub;
+            sub.arrayLayer = 0;
+            sub.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+            sub.mipLevel = 0;
+            {
+                VkSubresourceLayout layout;
+                mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &layout);
+
+                VkBufferImageCopy copyRegion = {};
+
+                copyRegion.bufferRowLength = 0;
+                copyRegion.bufferImageHeight = 0;
+                // On some platform, originally set to layout.rowPitch and layout.arrayPitch
+                // cause write outside of staging buffer memory size and hang at following
+                // queue submission in other frames after finish trim starting process when
+                // trim some titles.
+                //
+                // Here we set bufferRowLength and bufferImageHeight to 0 make the image
+                // copy to be tightly packed according to the imageExtent, the change fix
+                // the above problem.
+                //
+                // Although bufferRowLength,bufferImageHeight can be set to greater than
+                // the width and height member of imageExtent, but because we allocate memory
+                // for the staging buffer by image memory size and here we copy whole image,
+                // so greater than imageExtent take a risk that the copy beyond the staging
+                // buffer memory size.
+
+                copyRegion.bufferOffset = layout.offset;
+                copyRegion.imageExtent.depth = 1;
+                copyRegion.imageExtent.width = info.ObjectInfo.Image.extent.width;
+                copyRegion.imageExtent.height = info.ObjectInfo.Image.extent.height;
+                copyRegion.imageOffset.x = 0;
+                copyRegion.imageOffset.y = 0;
+                copyRegion.imageOffset.z = 0;
+                copyRegion.imageSubresource.aspectMask = sub.aspectMask;
+                copyRegion.imageSubresource.baseArrayLayer = 0;
+                copyRegion.imageSubresource.layerCount = info.ObjectInfo.Image.arrayLayers;
+                copyRegion.imageSubresource.mipLevel = 0;
+
+                stagingInfo.imageCopyRegions.push_back(copyRegion);
+            }
+
+            sub.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
+            {
+                VkSubresourceLayout layout;
+                mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &layout);
+
+                VkBufferImageCopy copyRegion;
+
+                copyRegion.bufferRowLength = 0;
+                copyRegion.bufferImageHeight = 0;
+                // set bufferRowLength and bufferImageHeight to 0 make the image
+                // copy to be tightly packed according to the imageExtent.
+
+                copyRegion.bufferOffset = layout.offset;
+                copyRegion.imageExtent.depth = 1;
+                copyRegion.imageExtent.width = info.ObjectInfo.Image.extent.width;
+                copyRegion.imageExtent.height = info.ObjectInfo.Image.extent.height;
+                copyRegion.imageOffset.x = 0;
+                copyRegion.imageOffset.y = 0;
+                copyRegion.imageOffset.z = 0;
+                copyRegion.imageSubresource.aspectMask = sub.aspectMask;
+                copyRegion.imageSubresource.baseArrayLayer = 0;
+                copyRegion.imageSubresource.layerCount = info.ObjectInfo.Image.arrayLayers;
+                copyRegion.imageSubresource.mipLevel = 0;
+
+                stagingInfo.imageCopyRegions.push_back(copyRegion);
+            }
+        } else {
+            VkImageSubresource sub;
+            sub.arrayLayer = 0;
+            sub.aspectMask = aspectMask;
+            sub.mipLevel = 0;
+
+            // need to make a VkBufferImageCopy for each mip level
+            stagingInfo.imageCopyRegions.reserve(info.ObjectInfo.Image.mipLevels);
+            for (uint32_t i = 0; i < info.ObjectInfo.Image.mipLevels; i++) {
+                VkSubresourceLayout lay;
+                sub.mipLevel = i;
+                mdd(device)->devTable.GetImageSubresourceLayout(device, image, &sub, &lay);
+
+                VkBufferImageCopy copyRegion;
+                copyRegion.bufferRowLength = 0;    //< tightly packed texels
+                copyRegion.bufferImageHeight = 0;  //< tightly packed texels
+                copyRegion.bufferOffset = lay.offset;
+                copyRegion.imageExtent.depth = 1;
+                copyRegion.imageExtent.width = (info.ObjectInfo.Image.extent.width >> i);
+                copyRegion.imageExtent.height = (info.ObjectInfo.Image.extent.height >> i);
+                copyRegion.imageOffset.x = 0;
+                copyRegion.imageOffset.y = 0;
+                copyRegion.imageOffset.z = 0;
+                copyRegion.imageSubresource.aspectMask = aspectMask;
+                copyRegion.imageSubresource.baseArrayLayer = 0;
+                copyRegion.imageSubresource.layerCount = info.ObjectInfo.Image.arrayLayers;
+                copyRegion.imageSubresource.mipLevel = i;
+
+                stagingInfo.imageCopyRegions.push_back(copyRegion);
+            }
+        }
 
-            // Submit the queue and wait for it to complete
-            queue = trim::get_DeviceQueue(device, queueFamilyIndex, 0);
+        // From docs: srcImageLayout must specify the layout of the image
+        // subresources of srcImage specified in pRegions at the time this
+        // command is executed on a VkDevice
+        // From docs: srcImageLayout must be either of
+        // VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL or VK_IMAGE_LAYOUT_GENERAL
+        VkImageLayout srcImageLayout = info.ObjectInfo.Image.mostRecentLayout;
+
+        // Transition the image so that it's in an optimal transfer source
+        // layout.
+        transitionImage(device, commandBuffer, image, info.ObjectInfo.Image.accessFlags, info.ObjectInfo.Image.accessFlags,
+                        queueFamilyIndex, srcImageLayout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, aspectMask,
+                        info.ObjectInfo.Image.arrayLayers, info.ObjectInfo.Image.mipLevels);
+
+        mdd(device)->devTable.CmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, stagingInfo.buffer,
+                                                   static_cast<uint32_t>(stagingInfo.imageCopyRegions.size()),
+                                                   stagingInfo.imageCopyRegions.data());
+
+        // save the staging info for later
+        s_imageToStagedInfoMap[image] = stagingInfo;
+
+        // now that the image data is in a host-readable buffer
+        // transition image back to it's previous layout
+        transitionImage(device, commandBuffer, image, info.ObjectInfo.Image.accessFlags, info.ObjectInfo.Image.accessFlags,
+                        queueFamilyIndex, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, srcImageLayout, aspectMask,
+                        info.ObjectInfo.Image.arrayLayers, info.ObjectInfo.Image.mipLevels);
+
+        addReadbackResource(*pBatch, resource);
+    } else {
+        ReadbackBatch *pBatch = getReadbackBatch(*pReadbackQueue);
+        if (pBatch == NULL) {
+            return;
+        }
 
-            mdd(device)->devTable.QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
-            waitResult = mdd(device)->devTable.QueueWaitIdle(queue);
-            assert(waitResult == VK_SUCCESS);
+        // Create a pipeline barrier to make it host readable
+        transitionImage(device, pBatch->commandBuffer, image, info.ObjectInfo.Image.accessFlags, VK_ACCESS_HOST_READ_BIT,
+                        queueFamilyIndex, info.ObjectInfo.Image.mostRecentLayout, info.ObjectInfo.Image.mostRecentLayout,
+                        info.ObjectInfo.Image.aspectMask, info.ObjectInfo.Image.arrayLayers, info.ObjectInfo.Image.mipLevels);
+
+        addReadbackResource(*pBatch, resource);
+    }
+}
+
+//=========================================================================
+// 1b) Transition the buffer into host-readable state, or copy it into a
+// staging buffer.
+//=========================================================================
+void readbackBuffer(VkBuffer buffer, const ObjectInfo &info) {
+    VkDevice device = info.belongsToDevice;
+    uint32_t queueFamilyIndex = info.ObjectInfo.Buffer.queueFamilyIndex;
+
+    ReadbackQueue *pReadbackQueue = getReadbackQueue(device, queueFamilyIndex);
+    if (pReadbackQueue == NULL) {
+        return;
+    }
+
+    ReadbackResource resource;
+    resource.buffer = buffer;
+    resource.queueFamilyIndex = queueFamilyIndex;
+
+    // If the buffer needs a staging buffer, it's because it's on
+    // DEVICE_LOCAL memory that is not HOST_VISIBLE.
+    // So we have to create another buffer and memory that IS HOST_VISIBLE
+    // so that we can copy the data
+    // from the DEVICE_LOCAL memory into HOST_VISIBLE memory, then map /
+    // unmap the HOST_VISIBLE memory object.
+    // The staging info is kept so that we can generate similar calls in the
+    // trace file in order to recreate
+    // the DEVICE_LOCAL buffer.
+    if (info.ObjectInfo.Buffer.needsStagingBuffer) {
+        StagingInfo stagingInfo;
+        ReadbackBatch *pBatch = createReadbackStagingBuffer(*pReadbackQueue, info.ObjectInfo.Buffer.size, &resource, &stagingInfo);
+        if (pBatch == NULL) {
+            return;
+        }
+        VkCommandBuffer commandBuffer = pBatch->commandBuffer;
+
+        // Copy from device_local buffer to host_visible buffer
+        stagingInfo.copyRegion.srcOffset = 0;
+        stagingInfo.copyRegion.dstOffset = 0;
+        stagingInfo.copyRegion.size = info.ObjectInfo.Buffer.size;
+
+        transitionBuffer(device, commandBuffer, buffer, VK_ACCESS_FLAG_BITS_MAX_ENUM, VK_ACCESS_TRANSFER_READ_BIT, 0,
+                         info.ObjectInfo.Buffer.size, true);
+        mdd(device)->devTable.CmdCopyBuffer(commandBuffer, buffer, stagingInfo.buffer, 1, &stagingInfo.copyRegion);
+        transitionBuffer(device, commandBuffer, buffer, VK_ACCESS_TRANSFER_READ_BIT, info.ObjectInfo.Buffer.accessFlags, 0,
+                         info.ObjectInfo.Buffer.size, true);
+
+        // save the staging info for later
+        s_bufferToStagedInfoMap[buffer] = stagingInfo;
+
+        addReadbackResource(*pBatch, resource);
+    } else {
+        ReadbackBatch *pBatch = getReadbackBatch(*pReadbackQueue);
+        if (pBatch == NULL) {
+            return;
+        }
+
+        transitionBuffer(device, pBatch->commandBuffer, buffer, info.ObjectInfo.Buffer.accessFlags, VK_ACCESS_HOST_READ_BIT, 0,
+                         info.ObjectInfo.Buffer.size);
+
+        addReadbackResource(*pBatch, resource);
+    }
+}
+
+//=========================================================================
+// Waits for all batches, transitions the last host-visible resources back,
+// and destroys the objects used for the readback.
+//=========================================================================
+void finishReadback() {
+    for (auto deviceIter = s_deviceToReadbackMap.begin(); deviceIter != s_deviceToReadbackMap.end(); deviceIter++) {
+        VkDevice device = deviceIter->first;
+        ReadbackDevice &readbackDevice = deviceIter->second;
+        for (auto queueIter = readbackDevice.queues.begin(); queueIter != readbackDevice.queues.end(); queueIter++) {
+            ReadbackQueue &readbackQueue = queueIter->second;
+
+            // Completing the batches can leave resources to transition back,
+            // which takes one more batch.
+            for (;;) {
+                submitReadbackBatch(readbackQueue, readbackQueue.batches[readbackQueue.currentBatch]);
+                for (uint32_t i = 1; i <= TRIM_READBACK_BATCH_COUNT; i++) {
+                    uint32_t batchIndex = (readbackQueue.currentBatch + i) % TRIM_READBACK_BATCH_COUNT;
+                    completeReadbackBatch(readbackQueue, readbackQueue.batches[batchIndex]);
+                }
+                if (readbackQueue.pendingRestores.empty() || beginReadbackBatch(readbackQueue) == NULL) {
+                    break;
+                }
+            }
+
+            for (uint32_t i = 0; i < TRIM_READBACK_BATCH_COUNT; i++) {
+                ReadbackBatch &batch = readbackQueue.batches[i];
+                if (batch.fence != VK_NULL_HANDLE) {
+                    mdd(device)->devTable.DestroyFence(device, batch.fence, NULL);
+                }
+            }
+
+            // This also frees the command buffers of the batches.
+            mdd(device)->devTable.DestroyCommandPool(device, readbackQueue.commandPool, NULL);
+        }
+
+        ReadbackStaging &staging = readbackDevice.staging;
+        assert(staging.ranges.empty() && staging.pOwnMemoryBatch == NULL);
+        if (staging.memory != VK_NULL_HANDLE) {
+            mdd(device)->devTable.UnmapMemory(device, staging.memory);
+            mdd(device)->devTable.FreeMemory(device, staging.memory, NULL);
+        }
+    }
+    s_deviceToReadbackMap.clear();
+
+    vktrace_LogVerbose("Trim read back %u images and buffers in %u batches with %u staging allocations.", s_readbackResourceCount,
+                       s_readbackBatchCount, s_readbackStagingAllocationCount);
+    s_readbackResourceCount = 0;
+    s_readbackBatchCount = 0;
+    s_readbackStagingAllocationCount = 0;
+}
+
+//=============================================================================
+// Use this to snapshot the global state tracker at the start of the trim
+// frames.
+//=============================================================================
+void snapshot_state_tracker() {
+    lock_state_tracker();
+
+    // Objects handed out to calls that are still running may still be
+    // changing on other threads, so the snapshot gets its own copies of them.
+    s_trimStateTrackerSnapshot.snapshot(s_trimGlobalStateTracker);
+
+    //
+    // Copying all the images and buffers is a length process, it include
+    // the following sub-processes:
+    //
+    // for (any image in all tracked images)
+    // {
+    //    1a) Transition the image into host - readable state.
+    //    2a) Map, copy, unmap the image.
+    //    3a) Transition the images back to their previous state.
+    // }
+    //
+    // for (any buffer in all tracked buffers)
+    // {
+    //    1b) Transition the buffers into host - readable state.
+    //    2b) Map, copy, unmap the buffer.
+    //    3b) Transition the buffer back to their previous state.
+    // }
+    //
+    // 4) Destroy the command pools, command buffers, and fences.
+    //
+    // The images and buffers are read back in batches, see ReadbackBatch,
+    // so sub-process 2 of a batch runs while the GPU works on sub-process 1
+    // of the next one.
+    //
+    // Please note: some driver has limitation on the max GPU memory
+    // allocations. For some title with heavily sub-allocation behavior,
+    // the staging memory allocations needed by trim would be a large
+    // number, so the staging buffers share a few staging allocations,
+    // and avoid the allocations (needed by trim and by the title itself)
+    // going beyond driver limitation. Otherwise, it cause some title hang
+    // problem due to fail to allocate memory.
+
+    // a) dump all images.
+    for (auto imageIter = s_trimStateTrackerSnapshot.createdImages.begin();
+         imageIter != s_trimStateTrackerSnapshot.createdImages.end(); imageIter++) {
+        if ((imageIter->second.ObjectInfo.Image.memorySize != 0) && (imageIter->second.belongsToDevice != VK_NULL_HANDLE)) {
+            // If the memorysize is zero, it mean the image is not bound to any
+            // memory so far, it might be just created when starting to trim.
+            // for such case, what we need to do is recreating the image in
+            // playback without copy its content to host side, it doesn't
+            // has any content now and the title might set its content after
+            // the trim starting. So skip the following process.
+            // Some target title belong to such case, the following process
+            // cause the title running crash during tracing because
+            // the following part of loop suppose the image is bound to
+            // memory so memorysize is not zero.
+            // If device is VK_NULL_HANDLE, this is likely a swapchain image
+            // which we haven't associated a device to, just skip over it.
+            readbackImage(imageIter->first, imageIter->second);
+        }
+    }
+
+    // b) Dump all buffers.
+    for (auto bufferIter = s_trimStateTrackerSnapshot.createdBuffers.begin();
+         bufferIter != s_trimStateTrackerSnapshot.createdBuffers.end(); bufferIter++) {
+        if ((bufferIter->second.ObjectInfo.Buffer.pBindBufferMemoryPacket != nullptr) &&
+            (bufferIter->second.ObjectInfo.Buffer.size != 0)) {
+            // Similiar with image handling, skip the following process
+            // if the buffer is not bound to any memory.
+            readbackBuffer(bufferIter->first, bufferIter->second);
         }
     }
-    // 4) Destroy the command pools / command buffers and fences
-    for (auto deviceIter = s_trimStateTrackerSnapshot.createdDevices.begin();
-         deviceIter != s_trimStateTrackerSnapshot.createdDevices.end(); deviceIter++) {
-        VkDevice device = reinterpret_cast<VkDevice>(deviceIter->first);
-        VkCommandBuffer commandBuffer = getCommandBufferFromDevice(device);
 
-        mdd(device)->devTable.ResetCommandBuffer(commandBuffer, VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
-        s_deviceToCommandBufferMap.erase(device);
-
-        // command pools
-        VkCommandPool commandPool = getCommandPoolFromDevice(device);
-        mdd(device)->devTable.ResetCommandPool(device, commandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
-        mdd(device)->devTable.DestroyCommandPool(device, commandPool, NULL);
-        s_deviceToCommandPoolMap.erase(device);
-    }
+    // 4) Destroy the command pools, command buffers, and fences.
+    finishReadback();
 
     // Now: generate a vkMapMemory to recreate the persistently mapped buffers
     for (auto iter = s_trimStateTrackerSnapshot.createdDeviceMemorys.begin();
@@ -1476,12 +2265,13 @@ void snapshot_state_tracker() {
             if (size != 0) {
                 vktrace_trace_packet_header *pPersistentlyMapMemory =
                     generate::vkMapMemory(false, device, deviceMemory, offset, size, flags, &pData);
-                iter->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket = pPersistentlyMapMemory;
+                s_trimStateTrackerSnapshot.get_DeviceMemory(iter->first)->ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket =
+                    pPersistentlyMapMemory;
             }
         }
     }
 
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    unlock_state_tracker();
 }
 
 //=========================================================================
@@ -1495,55 +2285,47 @@ void add_Image_call(vktrace_trace_packet_header *pHeader) {
 
 //=========================================================================
 ObjectInfo &add_Instance_object(VkInstance var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Instance(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Instance_object(VkInstance var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Instance(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Instance_objectInfo(VkInstance var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdInstances.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdInstances.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Instance(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_PhysicalDevice_object(VkPhysicalDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_PhysicalDevice(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_PhysicalDevice_object(VkPhysicalDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_PhysicalDevice(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_PhysicalDevice_objectInfo(VkPhysicalDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdPhysicalDevices.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdPhysicalDevices.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_PhysicalDevice(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
@@ -1574,9 +2356,9 @@ VkQueue get_DeviceQueue(VkDevice device, uint32_t queueFamilyIndex, uint32_t que
 
 //=========================================================================
 ObjectInfo &add_Device_object(VkDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Device(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
@@ -1600,7 +2382,7 @@ ObjectInfo &add_Device_object(VkDevice var) {
 // tracked vulkan classes.
 //=========================================================================
 template <class object_class>
-void get_device_objects(VkDevice device, const std::unordered_map<object_class, ObjectInfo> &object_map,
+void get_device_objects(VkDevice device, const CopyOnWriteMap<object_class, ObjectInfo> &object_map,
                         std::vector<object_class> &result_objects) {
     for (auto info = object_map.begin(); info != object_map.end(); ++info) {
         if (info->second.belongsToDevice == device) {
@@ -1789,6 +2571,9 @@ void delete_objects_for_destroy_device(VkDevice device) {
     get_device_objects<VkCommandBuffer>(device, s_trimGlobalStateTracker.createdCommandBuffers, CommandBuffersToRemove);
     for (size_t i = 0; i < CommandBuffersToRemove.size(); i++) {
         trim::remove_CommandBuffer_object(CommandBuffersToRemove[i]);
+        trim::remove_CommandBuffer_calls(CommandBuffersToRemove[i]);
+        trim::ClearImageTransitions(CommandBuffersToRemove[i]);
+        trim::ClearBufferTransitions(CommandBuffersToRemove[i]);
     }
     delete_objects_number += CommandBuffersToRemove.size();
 
@@ -1808,7 +2593,7 @@ void delete_objects_for_destroy_device(VkDevice device) {
 
 //=========================================================================
 void remove_Device_object(VkDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    lock_state_tracker();
 
     std::vector<VkQueue> queuesToRemove;
     for (auto info = s_trimGlobalStateTracker.createdQueues.begin(); info != s_trimGlobalStateTracker.createdQueues.end(); ++info) {
@@ -1854,705 +2639,636 @@ void remove_Device_object(VkDevice var) {
     }
 
     s_trimGlobalStateTracker.remove_Device(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    unlock_state_tracker();
 }
 
 //=========================================================================
 ObjectInfo *get_Device_objectInfo(VkDevice var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdDevices.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdDevices.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Device(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_SurfaceKHR_object(VkSurfaceKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_SurfaceKHR(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_SurfaceKHR_object(VkSurfaceKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_SurfaceKHR(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_SurfaceKHR_objectInfo(VkSurfaceKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdSurfaceKHRs.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdSurfaceKHRs.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_SurfaceKHR(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Queue_object(VkQueue var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Queue(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Queue_object(const VkQueue var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Queue(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Queue_objectInfo(VkQueue var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdQueues.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdQueues.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Queue(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_SwapchainKHR_object(VkSwapchainKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_SwapchainKHR(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_SwapchainKHR_object(const VkSwapchainKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_SwapchainKHR(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_SwapchainKHR_objectInfo(VkSwapchainKHR var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdSwapchainKHRs.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdSwapchainKHRs.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_SwapchainKHR(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_CommandPool_object(VkCommandPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_CommandPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
+//=========================================================================
+// Destroying a command pool frees the command buffers that were allocated
+// from it.
 //=========================================================================
 void remove_CommandPool_object(const VkCommandPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    lock_state_tracker();
+    std::vector<VkCommandBuffer> commandBuffers = get_CommandPool_CommandBuffers(var);
+    for (size_t i = 0; i < commandBuffers.size(); i++) {
+        release_CommandBuffer_recording(commandBuffers[i]);
+        s_trimGlobalStateTracker.remove_CommandBuffer(commandBuffers[i]);
+    }
     s_trimGlobalStateTracker.remove_CommandPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    unlock_state_tracker();
 }
 
 //=========================================================================
 ObjectInfo *get_CommandPool_objectInfo(VkCommandPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdCommandPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdCommandPools.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_CommandPool(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_CommandBuffer_object(VkCommandBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_CommandBuffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_CommandBuffer_object(const VkCommandBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_CommandBuffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_CommandBuffer_objectInfo(VkCommandBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdCommandBuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdCommandBuffers.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_CommandBuffer(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_DeviceMemory_object(VkDeviceMemory var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_DeviceMemory(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_DeviceMemory_object(const VkDeviceMemory var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_DeviceMemory(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_DeviceMemory_objectInfo(VkDeviceMemory var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdDeviceMemorys.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdDeviceMemorys.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_DeviceMemory(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_ImageView_object(VkImageView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_ImageView(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_ImageView_object(const VkImageView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_ImageView(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_ImageView_objectInfo(VkImageView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdImageViews.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdImageViews.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_ImageView(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Image_object(VkImage var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Image(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Image_object(const VkImage var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Image(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Image_objectInfo(VkImage var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdImages.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdImages.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Image(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_BufferView_object(VkBufferView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_BufferView(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_BufferView_object(const VkBufferView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_BufferView(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_BufferView_objectInfo(VkBufferView var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdBufferViews.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdBufferViews.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_BufferView(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Buffer_object(VkBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Buffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Buffer_object(const VkBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Buffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Buffer_objectInfo(VkBuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdBuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdBuffers.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Buffer(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Sampler_object(VkSampler var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Sampler(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Sampler_object(const VkSampler var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Sampler(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Sampler_objectInfo(VkSampler var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdSamplers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdSamplers.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Sampler(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_DescriptorSetLayout_object(VkDescriptorSetLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_DescriptorSetLayout(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_DescriptorSetLayout_object(VkDescriptorSetLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_DescriptorSetLayout(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_DescriptorSetLayout_objectInfo(VkDescriptorSetLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdDescriptorSetLayouts.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdDescriptorSetLayouts.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_DescriptorSetLayout(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_PipelineLayout_object(VkPipelineLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_PipelineLayout(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_PipelineLayout_object(const VkPipelineLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_PipelineLayout(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_PipelineLayout_objectInfo(VkPipelineLayout var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdPipelineLayouts.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdPipelineLayouts.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_PipelineLayout(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_RenderPass_object(VkRenderPass var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_RenderPass(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_RenderPass_object(const VkRenderPass var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_RenderPass(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_RenderPass_objectInfo(VkRenderPass var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdRenderPasss.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdRenderPasss.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_RenderPass(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_ShaderModule_object(VkShaderModule var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_ShaderModule(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_ShaderModule_object(const VkShaderModule var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_ShaderModule(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_ShaderModule_objectInfo(VkShaderModule var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdShaderModules.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdShaderModules.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_ShaderModule(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_PipelineCache_object(VkPipelineCache var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_PipelineCache(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 void remove_PipelineCache_object(const VkPipelineCache var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_PipelineCache(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_PipelineCache_objectInfo(VkPipelineCache var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdPipelineCaches.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdPipelineCaches.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_PipelineCache(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_DescriptorPool_object(VkDescriptorPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_DescriptorPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_DescriptorPool_object(const VkDescriptorPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_DescriptorPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_DescriptorPool_objectInfo(VkDescriptorPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdDescriptorPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdDescriptorPools.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_DescriptorPool(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Pipeline_object(VkPipeline var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Pipeline(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Pipeline_object(const VkPipeline var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Pipeline(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Pipeline_objectInfo(VkPipeline var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdPipelines.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdPipelines.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Pipeline(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Semaphore_object(VkSemaphore var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Semaphore(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Semaphore_object(const VkSemaphore var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Semaphore(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Semaphore_objectInfo(VkSemaphore var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdSemaphores.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdSemaphores.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Semaphore(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Fence_object(VkFence var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Fence(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Fence_object(const VkFence var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Fence(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Fence_objectInfo(VkFence var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdFences.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdFences.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Fence(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Framebuffer_object(VkFramebuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Framebuffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Framebuffer_object(const VkFramebuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Framebuffer(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Framebuffer_objectInfo(VkFramebuffer var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdFramebuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdFramebuffers.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Framebuffer(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_Event_object(VkEvent var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_Event(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_Event_object(const VkEvent var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_Event(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_Event_objectInfo(VkEvent var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdEvents.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdEvents.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_Event(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_QueryPool_object(VkQueryPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_QueryPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_QueryPool_object(const VkQueryPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_QueryPool(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
 }
 
 //=========================================================================
 ObjectInfo *get_QueryPool_objectInfo(VkQueryPool var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdQueryPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdQueryPools.end()) {
-        pResult = &(iter->second);
-    }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_QueryPool(var);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 ObjectInfo &add_DescriptorSet_object(VkDescriptorSet var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     ObjectInfo &info = s_trimGlobalStateTracker.add_DescriptorSet(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return info;
 }
 
 //=========================================================================
 void remove_DescriptorSet_object(const VkDescriptorSet var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
     s_trimGlobalStateTracker.remove_DescriptorSet(var);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
+}
+
+//=========================================================================
+// Moves the updates of a descriptor set that check_memory_budget() packed,
+// and maybe spilled, back to its arrays, so that they can be updated.
+//=========================================================================
+static void unpack_DescriptorSet_bindings(ObjectInfo *pInfo) {
+    vktrace_trace_packet_header *pBindingsPacket = pInfo->ObjectInfo.DescriptorSet.pBindingsPacket;
+    if (pBindingsPacket == nullptr) {
+        return;
+    }
+    if (!SpillFile::is_spilled(pBindingsPacket)) {
+        StateTracker::unpack_DescriptorSet_bindings(pInfo, pBindingsPacket);
+        return;
+    }
+
+    vktrace_trace_packet_header *pLoaded = s_trimSpillFile.load(pBindingsPacket);
+    if (pLoaded == nullptr) {
+        vktrace_LogError("Trim failed to read the updates of a descriptor set back from its scratch file, the trace file will be "
+                         "missing them.");
+        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorSet.pBindingsPacket);
+        pInfo->ObjectInfo.DescriptorSet.numBindings = 0;
+        pInfo->ObjectInfo.DescriptorSet.writeDescriptorCount = 0;
+        pInfo->ObjectInfo.DescriptorSet.copyDescriptorCount = 0;
+        return;
+    }
+    StateTracker::unpack_DescriptorSet_bindings(pInfo, pLoaded);
+    vktrace_delete_trace_packet(&pLoaded);
 }
 
 //=========================================================================
 ObjectInfo *get_DescriptorSet_objectInfo(VkDescriptorSet var) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimGlobalStateTracker.createdDescriptorSets.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != s_trimGlobalStateTracker.createdDescriptorSets.end()) {
-        pResult = &(iter->second);
+    vktrace_enter_critical_section(get_state_tracker_lock(var));
+    ObjectInfo *pResult = s_trimGlobalStateTracker.get_DescriptorSet(var);
+    if (pResult != nullptr) {
+        unpack_DescriptorSet_bindings(pResult);
     }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(var));
     return pResult;
 }
 
 //=========================================================================
 
-#define TRIM_MARK_OBJECT_REFERENCE(type)                                   \
-    void mark_##type##_reference(Vk##type var) {                           \
-        vktrace_enter_critical_section(&trimStateTrackerLock);             \
-        auto iter = s_trimStateTrackerSnapshot.created##type##s.find(var); \
-        if (iter != s_trimStateTrackerSnapshot.created##type##s.end()) {   \
-            ObjectInfo *info = &iter->second;                              \
-            if (info != nullptr) {                                         \
-                info->bReferencedInTrim = true;                            \
-            }                                                              \
-        }                                                                  \
-        vktrace_leave_critical_section(&trimStateTrackerLock);             \
+#define TRIM_MARK_OBJECT_REFERENCE(type)                                                   \
+    void mark_##type##_reference(Vk##type var) {                                           \
+        vktrace_enter_critical_section(&trimStateTrackerLock);                             \
+        const StateTracker &snapshot = s_trimStateTrackerSnapshot;                         \
+        if (snapshot.created##type##s.get(var) != nullptr) {                               \
+            s_trimStateTrackerSnapshot.m_referencedObjects.insert((uint64_t)var);          \
+        }                                                                                  \
+        vktrace_leave_critical_section(&trimStateTrackerLock);                             \
     }
 
-#define TRIM_MARK_OBJECT_REFERENCE_WITH_DEVICE_DEPENDENCY(type)            \
-    void mark_##type##_reference(Vk##type var) {                           \
-        vktrace_enter_critical_section(&trimStateTrackerLock);             \
-        auto iter = s_trimStateTrackerSnapshot.created##type##s.find(var); \
-        if (iter != s_trimStateTrackerSnapshot.created##type##s.end()) {   \
-            ObjectInfo *info = &iter->second;                              \
-            if (info != nullptr) {                                         \
-                info->bReferencedInTrim = true;                            \
-                mark_Device_reference((VkDevice)info->belongsToDevice);    \
-            }                                                              \
-        }                                                                  \
-        vktrace_leave_critical_section(&trimStateTrackerLock);             \
+#define TRIM_MARK_OBJECT_REFERENCE_WITH_DEVICE_DEPENDENCY(type)                            \
+    void mark_##type##_reference(Vk##type var) {                                           \
+        vktrace_enter_critical_section(&trimStateTrackerLock);                             \
+        const StateTracker &snapshot = s_trimStateTrackerSnapshot;                         \
+        const ObjectInfo *info = snapshot.created##type##s.get(var);                       \
+        if (info != nullptr) {                                                             \
+            s_trimStateTrackerSnapshot.m_referencedObjects.insert((uint64_t)var);          \
+            mark_Device_reference((VkDevice)info->belongsToDevice);                        \
+        }                                                                                  \
+        vktrace_leave_critical_section(&trimStateTrackerLock);                             \
     }
 
 void mark_CommandBuffer_reference(VkCommandBuffer var) {
     vktrace_enter_critical_section(&trimStateTrackerLock);
-    auto iter = s_trimStateTrackerSnapshot.createdCommandBuffers.find(var);
-    if (iter != s_trimStateTrackerSnapshot.createdCommandBuffers.end()) {
-        ObjectInfo *info = &iter->second;
-        if (info != nullptr) {
-            info->bReferencedInTrim = true;
-        }
+    const StateTracker &snapshot = s_trimStateTrackerSnapshot;
+    if (snapshot.createdCommandBuffers.get(var) != nullptr) {
+        s_trimStateTrackerSnapshot.m_referencedObjects.insert((uint64_t)var);
     }
     vktrace_leave_critical_section(&trimStateTrackerLock);
 }
@@ -2592,24 +3308,19 @@ void write_all_referenced_object_calls() {
 
     vktrace_enter_critical_section(&trimStateTrackerLock);
     // write the referenced objects from the snapshot
-    StateTracker &stateTracker = s_trimStateTrackerSnapshot;
+    const StateTracker &stateTracker = s_trimStateTrackerSnapshot;
     vktrace_leave_critical_section(&trimStateTrackerLock);
 
     // Instances (& PhysicalDevices)
     for (auto obj = stateTracker.createdInstances.begin(); obj != stateTracker.createdInstances.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Instance.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Instance.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Instance.pCreatePacket);
 
         if (obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket));
+            write_state_packet(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
         }
 
         if (obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket));
+            write_state_packet(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
         }
     }
 
@@ -2618,55 +3329,38 @@ void write_all_referenced_object_calls() {
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket != nullptr) {
             // Generate GetPhysicalDeviceProperties Packet. It's needed by portability
             // process in vkAllocateMemory during playback.
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket);
         }
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket != nullptr) {
             // Generate GetPhysicalDeviceProperties2KHR Packet. It's needed by portability
             // process in vkAllocateMemory during playback.
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket);
         }
 
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket != nullptr) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
         }
 
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket != nullptr) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(
-                &(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
         }
 
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket != nullptr) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
         }
 
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket != nullptr) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(
-                &(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
         }
 
         if (obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket != nullptr) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket));
+            write_state_packet(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
         }
     }
 
     // SurfaceKHR and surface properties
     for (auto obj = stateTracker.createdSurfaceKHRs.begin(); obj != stateTracker.createdSurfaceKHRs.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.SurfaceKHR.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.SurfaceKHR.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.SurfaceKHR.pCreatePacket);
 
         VkSurfaceKHR surface = obj->first;
 
@@ -2679,16 +3373,14 @@ void write_all_referenced_object_calls() {
                 VkPresentModeKHR *pPresentModes;
                 vktrace_trace_packet_header *pSurfacePresentModesCountHeader =
                     generate::vkGetPhysicalDeviceSurfacePresentModesKHR(true, physicalDevice, surface, &presentModesCount, NULL);
-                vktrace_write_trace_packet(pSurfacePresentModesCountHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&(pSurfacePresentModesCountHeader));
+                write_and_delete_state_packet(&pSurfacePresentModesCountHeader);
 
                 if (presentModesCount > 0) {
                     pPresentModes = VKTRACE_NEW_ARRAY(VkPresentModeKHR, presentModesCount);
 
                     vktrace_trace_packet_header *pSurfacePresentModeHeader = generate::vkGetPhysicalDeviceSurfacePresentModesKHR(
                         true, physicalDevice, surface, &presentModesCount, pPresentModes);
-                    vktrace_write_trace_packet(pSurfacePresentModeHeader, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&(pSurfacePresentModeHeader));
+                    write_and_delete_state_packet(&pSurfacePresentModeHeader);
                     VKTRACE_DELETE(pPresentModes);
                 }
 
@@ -2696,32 +3388,28 @@ void write_all_referenced_object_calls() {
                 VkSurfaceFormatKHR *pSurfaceFormats;
                 vktrace_trace_packet_header *pSurfaceFormatsCountHeader =
                     generate::vkGetPhysicalDeviceSurfaceFormatsKHR(true, physicalDevice, surface, &surfaceFormatCount, NULL);
-                vktrace_write_trace_packet(pSurfaceFormatsCountHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pSurfaceFormatsCountHeader);
+                write_and_delete_state_packet(&pSurfaceFormatsCountHeader);
 
                 if (surfaceFormatCount > 0) {
                     pSurfaceFormats = VKTRACE_NEW_ARRAY(VkSurfaceFormatKHR, surfaceFormatCount);
 
                     vktrace_trace_packet_header *pSurfaceFormatsHeader = generate::vkGetPhysicalDeviceSurfaceFormatsKHR(
                         true, physicalDevice, surface, &surfaceFormatCount, pSurfaceFormats);
-                    vktrace_write_trace_packet(pSurfaceFormatsHeader, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pSurfaceFormatsHeader);
+                    write_and_delete_state_packet(&pSurfaceFormatsHeader);
                     VKTRACE_DELETE(pSurfaceFormats);
                 }
 
                 VkSurfaceCapabilitiesKHR surfaceCapabilities;
                 vktrace_trace_packet_header *pSurfaceCapabilitiesHeader =
                     generate::vkGetPhysicalDeviceSurfaceCapabilitiesKHR(true, physicalDevice, surface, &surfaceCapabilities);
-                vktrace_write_trace_packet(pSurfaceCapabilitiesHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pSurfaceCapabilitiesHeader);
+                write_and_delete_state_packet(&pSurfaceCapabilitiesHeader);
 
                 for (uint32_t queueFamilyIndex = 0;
                      queueFamilyIndex < physicalDeviceInfo->second.ObjectInfo.PhysicalDevice.queueFamilyCount; queueFamilyIndex++) {
                     VkBool32 supported;
                     vktrace_trace_packet_header *pHeader =
                         generate::vkGetPhysicalDeviceSurfaceSupportKHR(true, physicalDevice, queueFamilyIndex, surface, &supported);
-                    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pHeader);
+                    write_and_delete_state_packet(&pHeader);
                 }
             }
         }
@@ -2729,20 +3417,17 @@ void write_all_referenced_object_calls() {
 
     // Devices
     for (auto obj = stateTracker.createdDevices.begin(); obj != stateTracker.createdDevices.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Device.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Device.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Device.pCreatePacket);
     }
 
     // Queue
     for (auto obj = stateTracker.createdQueues.begin(); obj != stateTracker.createdQueues.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Queue.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Queue.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Queue.pCreatePacket);
     }
 
     // CommandPool
     for (auto poolObj = stateTracker.createdCommandPools.begin(); poolObj != stateTracker.createdCommandPools.end(); poolObj++) {
-        vktrace_write_trace_packet(poolObj->second.ObjectInfo.CommandPool.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(poolObj->second.ObjectInfo.CommandPool.pCreatePacket));
+        write_state_packet(poolObj->second.ObjectInfo.CommandPool.pCreatePacket);
 
         // Now allocate command buffers that were allocated on this pool
         for (int32_t level = VK_COMMAND_BUFFER_LEVEL_BEGIN_RANGE; level <= VK_COMMAND_BUFFER_LEVEL_END_RANGE; level++) {
@@ -2766,8 +3451,7 @@ void write_all_referenced_object_calls() {
 
                 vktrace_trace_packet_header *pHeader =
                     generate::vkAllocateCommandBuffers(false, poolObj->second.belongsToDevice, &allocateInfo, pCommandBuffers);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&(pHeader));
+                write_and_delete_state_packet(&pHeader);
 
                 delete[] pCommandBuffers;
             }
@@ -2776,22 +3460,17 @@ void write_all_referenced_object_calls() {
 
     // SwapchainKHR
     for (auto obj = stateTracker.createdSwapchainKHRs.begin(); obj != stateTracker.createdSwapchainKHRs.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.SwapchainKHR.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.SwapchainKHR.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.SwapchainKHR.pCreatePacket);
 
-        vktrace_write_trace_packet(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket,
-                                   vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket));
+        write_state_packet(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
 
-        vktrace_write_trace_packet(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket));
+        write_state_packet(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
     }
 
     // DeviceMemory
     for (auto obj = stateTracker.createdDeviceMemorys.begin(); obj != stateTracker.createdDeviceMemorys.end(); obj++) {
         // AllocateMemory
-        vktrace_write_trace_packet(obj->second.ObjectInfo.DeviceMemory.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.DeviceMemory.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.DeviceMemory.pCreatePacket);
     }
 
     // Image
@@ -2803,43 +3482,36 @@ void write_all_referenced_object_calls() {
             // write map / unmap packets so the memory contents gets set on
             // replay
             if (obj->second.ObjectInfo.Image.pMapMemoryPacket != NULL) {
-                vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pMapMemoryPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pMapMemoryPacket));
+                write_state_packet(obj->second.ObjectInfo.Image.pMapMemoryPacket);
             }
 
             if (obj->second.ObjectInfo.Image.pUnmapMemoryPacket != NULL) {
-                vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pUnmapMemoryPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pUnmapMemoryPacket));
+                write_state_packet(obj->second.ObjectInfo.Image.pUnmapMemoryPacket);
             }
         }
     }
 
 #ifdef TRIM_USE_ORDERED_IMAGE_CREATION
     for (auto iter = stateTracker.m_image_calls.begin(); iter != stateTracker.m_image_calls.end(); ++iter) {
-        vktrace_write_trace_packet(*iter, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(*iter));
+        write_state_packet(*iter);
     }
 #endif  // TRIM_USE_ORDERED_IMAGE_CREATION
     for (auto obj = stateTracker.createdImages.begin(); obj != stateTracker.createdImages.end(); obj++) {
 #ifndef TRIM_USE_ORDERED_IMAGE_CREATION
         // CreateImage
         if (obj->second.ObjectInfo.Image.pCreatePacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pCreatePacket, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pCreatePacket));
+            write_state_packet(obj->second.ObjectInfo.Image.pCreatePacket);
         }
 
         // GetImageMemoryRequirements
         if (obj->second.ObjectInfo.Image.pGetImageMemoryRequirementsPacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pGetImageMemoryRequirementsPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pGetImageMemoryRequirementsPacket));
+            write_state_packet(obj->second.ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
         }
 #endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
 
         // BindImageMemory
         if (obj->second.ObjectInfo.Image.pBindImageMemoryPacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pBindImageMemoryPacket, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pBindImageMemoryPacket));
+            write_state_packet(obj->second.ObjectInfo.Image.pBindImageMemoryPacket);
         }
     }
 
@@ -2872,7 +3544,10 @@ void write_all_referenced_object_calls() {
                 StagingInfo stagingInfo = s_imageToStagedInfoMap[image];
                 stagingInfo.bufferCreateInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
-                // generate packets needed to create a staging buffer
+                // generate packets needed to create a staging buffer. Its
+                // memory may have the handle of readback staging memory that
+                // other staging buffers also use, so it is freed below before
+                // the next resource is written.
                 generateCreateStagingBuffer(device, stagingInfo);
 
                 // here's where we map / unmap to insert data into the buffer
@@ -2880,13 +3555,11 @@ void write_all_referenced_object_calls() {
                     // write map / unmap packets so the memory contents gets set on
                     // replay
                     if (obj->second.ObjectInfo.Image.pMapMemoryPacket != NULL) {
-                        vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pMapMemoryPacket, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pMapMemoryPacket));
+                        write_state_packet(obj->second.ObjectInfo.Image.pMapMemoryPacket);
                     }
 
                     if (obj->second.ObjectInfo.Image.pUnmapMemoryPacket != NULL) {
-                        vktrace_write_trace_packet(obj->second.ObjectInfo.Image.pUnmapMemoryPacket, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Image.pUnmapMemoryPacket));
+                        write_state_packet(obj->second.ObjectInfo.Image.pUnmapMemoryPacket);
                     }
                 }
 
@@ -2896,8 +3569,7 @@ void write_all_referenced_object_calls() {
                     obj->second.ObjectInfo.Image.queueFamilyIndex};
                 vktrace_trace_packet_header *pCreateCommandPoolPacket =
                     generate::vkCreateCommandPool(false, device, &cmdPoolCreateInfo, NULL, &stagingInfo.commandPool);
-                vktrace_write_trace_packet(pCreateCommandPoolPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pCreateCommandPoolPacket);
+                write_and_delete_state_packet(&pCreateCommandPoolPacket);
 
                 // create command buffer
                 VkCommandBufferAllocateInfo commandBufferAllocateInfo;
@@ -2909,8 +3581,7 @@ void write_all_referenced_object_calls() {
 
                 vktrace_trace_packet_header *pHeader =
                     generate::vkAllocateCommandBuffers(false, device, &commandBufferAllocateInfo, &stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 VkCommandBufferBeginInfo commandBufferBeginInfo;
                 commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -2919,11 +3590,10 @@ void write_all_referenced_object_calls() {
                 commandBufferBeginInfo.pInheritanceInfo = NULL;
 
                 pHeader = generate::vkBeginCommandBuffer(false, stagingInfo.commandBuffer, &commandBufferBeginInfo);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // Transition image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-                generateTransitionImage(device, stagingInfo.commandBuffer, image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, queueFamilyIndex,
+                generateTransitionImage(stagingInfo.commandBuffer, image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, queueFamilyIndex,
                                         VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                                         obj->second.ObjectInfo.Image.aspectMask, obj->second.ObjectInfo.Image.arrayLayers,
                                         obj->second.ObjectInfo.Image.mipLevels);
@@ -2932,19 +3602,17 @@ void write_all_referenced_object_calls() {
                 pHeader = generate::vkCmdCopyBufferToImage(
                     false, stagingInfo.commandBuffer, stagingInfo.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                     static_cast<uint32_t>(stagingInfo.imageCopyRegions.size()), stagingInfo.imageCopyRegions.data());
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // transition image to final layout
-                generateTransitionImage(device, stagingInfo.commandBuffer, image, VK_ACCESS_TRANSFER_WRITE_BIT,
+                generateTransitionImage(stagingInfo.commandBuffer, image, VK_ACCESS_TRANSFER_WRITE_BIT,
                                         obj->second.ObjectInfo.Image.accessFlags, queueFamilyIndex,
                                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, obj->second.ObjectInfo.Image.mostRecentLayout,
                                         obj->second.ObjectInfo.Image.aspectMask, obj->second.ObjectInfo.Image.arrayLayers,
                                         obj->second.ObjectInfo.Image.mipLevels);
 
                 pHeader = generate::vkEndCommandBuffer(false, stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // Queue submit the command buffer
                 VkSubmitInfo submitInfo;
@@ -2959,27 +3627,24 @@ void write_all_referenced_object_calls() {
                 submitInfo.waitSemaphoreCount = 0;
 
                 pHeader = generate::vkQueueSubmit(false, stagingInfo.queue, 1, &submitInfo, VK_NULL_HANDLE);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // wait for queue to finish
                 pHeader = generate::vkQueueWaitIdle(false, stagingInfo.queue);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
-                // delete staging buffer
+                // delete staging buffer, which has to happen before the
+                // staging buffer of the next resource is created
                 generateDestroyStagingBuffer(device, stagingInfo);
 
                 // delete command buffer
                 pHeader = generate::vkFreeCommandBuffers(false, device, stagingInfo.commandPool, 1, &stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // delete command pool
                 vktrace_trace_packet_header *pDestroyCommandPoolPacket =
                     generate::vkDestroyCommandPool(false, device, stagingInfo.commandPool, nullptr);
-                vktrace_write_trace_packet(pDestroyCommandPoolPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pDestroyCommandPoolPacket);
+                write_and_delete_state_packet(&pDestroyCommandPoolPacket);
             } else {
                 VkImageLayout initialLayout = obj->second.ObjectInfo.Image.initialLayout;
                 VkImageLayout desiredLayout = obj->second.ObjectInfo.Image.mostRecentLayout;
@@ -3022,8 +3687,7 @@ void write_all_referenced_object_calls() {
                     // call
                     vktrace_trace_packet_header *pCreateCommandPoolPacket =
                         generate::vkCreateCommandPool(false, device, &cmdPoolCreateInfo, NULL, &tmpCommandPool);
-                    vktrace_write_trace_packet(pCreateCommandPoolPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pCreateCommandPoolPacket);
+                    write_and_delete_state_packet(&pCreateCommandPoolPacket);
 
                     // 1) Create & begin a command buffer. Arbitrarily name it something
                     // so that it has a unique handle which will be replaced
@@ -3034,8 +3698,7 @@ void write_all_referenced_object_calls() {
                                                                             tmpCommandPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
                     vktrace_trace_packet_header *pAllocateCommandBufferPacket =
                         generate::vkAllocateCommandBuffers(false, device, &cmdBufferAllocInfo, &tmpCommandBuffer);
-                    vktrace_write_trace_packet(pAllocateCommandBufferPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pAllocateCommandBufferPacket);
+                    write_and_delete_state_packet(&pAllocateCommandBufferPacket);
 
                     VkCommandBufferBeginInfo cmdBufferBeginInfo = {
                         VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -3046,8 +3709,7 @@ void write_all_referenced_object_calls() {
 
                     vktrace_trace_packet_header *pBeginCommandBufferPacket =
                         generate::vkBeginCommandBuffer(false, tmpCommandBuffer, &cmdBufferBeginInfo);
-                    vktrace_write_trace_packet(pBeginCommandBufferPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pBeginCommandBufferPacket);
+                    write_and_delete_state_packet(&pBeginCommandBufferPacket);
 
                     // 2) Make VkImageMemoryBarrier structs to change the image's
                     // layout
@@ -3089,13 +3751,11 @@ void write_all_referenced_object_calls() {
                     // 3) Use VkCmdPipelineBarrier to transition the images
                     vktrace_trace_packet_header *pCmdPipelineBarrierPacket = generate::vkCmdPipelineBarrier(
                         false, tmpCommandBuffer, src_stages, dest_stages, 0, 0, NULL, 0, NULL, 1, pmemory_barrier);
-                    vktrace_write_trace_packet(pCmdPipelineBarrierPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pCmdPipelineBarrierPacket);
+                    write_and_delete_state_packet(&pCmdPipelineBarrierPacket);
 
                     // 4) VkEndCommandBuffer()
                     vktrace_trace_packet_header *pEndCommandBufferPacket = generate::vkEndCommandBuffer(false, tmpCommandBuffer);
-                    vktrace_write_trace_packet(pEndCommandBufferPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pEndCommandBufferPacket);
+                    write_and_delete_state_packet(&pEndCommandBufferPacket);
 
                     VkQueue trimQueue = VK_NULL_HANDLE;
                     uint32_t queueIndex = 0;  // just using the first queue
@@ -3108,25 +3768,21 @@ void write_all_referenced_object_calls() {
                     VkFence nullFence = VK_NULL_HANDLE;
                     vktrace_trace_packet_header *pQueueSubmitPacket =
                         generate::vkQueueSubmit(false, trimQueue, 1, &submitInfo, nullFence);
-                    vktrace_write_trace_packet(pQueueSubmitPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pQueueSubmitPacket);
+                    write_and_delete_state_packet(&pQueueSubmitPacket);
 
                     // 5a) vkWaitQueueIdle()
                     vktrace_trace_packet_header *pQueueWaitIdlePacket = generate::vkQueueWaitIdle(false, trimQueue);
-                    vktrace_write_trace_packet(pQueueWaitIdlePacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pQueueWaitIdlePacket);
+                    write_and_delete_state_packet(&pQueueWaitIdlePacket);
 
                     // 6) vkResetCommandPool() or vkFreeCommandBuffers()
                     vktrace_trace_packet_header *pResetCommandPoolPacket =
                         generate::vkResetCommandPool(false, device, tmpCommandPool, VK_COMMAND_POOL_RESET_RELEASE_RESOURCES_BIT);
-                    vktrace_write_trace_packet(pResetCommandPoolPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pResetCommandPoolPacket);
+                    write_and_delete_state_packet(&pResetCommandPoolPacket);
 
                     // 7) vkDestroyCommandPool()
                     vktrace_trace_packet_header *pDestroyCommandPoolPacket =
                         generate::vkDestroyCommandPool(false, device, tmpCommandPool, NULL);
-                    vktrace_write_trace_packet(pDestroyCommandPoolPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pDestroyCommandPoolPacket);
+                    write_and_delete_state_packet(&pDestroyCommandPoolPacket);
                 }
             }
         }
@@ -3135,8 +3791,7 @@ void write_all_referenced_object_calls() {
 
     // ImageView
     for (auto obj = stateTracker.createdImageViews.begin(); obj != stateTracker.createdImageViews.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.ImageView.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.ImageView.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.ImageView.pCreatePacket);
     }
 
     // Buffer
@@ -3148,8 +3803,7 @@ void write_all_referenced_object_calls() {
         // CreateBuffer
         assert(obj->second.ObjectInfo.Buffer.pCreatePacket != NULL);
         if (obj->second.ObjectInfo.Buffer.pCreatePacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pCreatePacket, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pCreatePacket));
+            write_state_packet(obj->second.ObjectInfo.Buffer.pCreatePacket);
         }
 
         if ((obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket != nullptr) && (obj->second.ObjectInfo.Buffer.size != 0)) {
@@ -3159,15 +3813,17 @@ void write_all_referenced_object_calls() {
 
             // BindBufferMemory
             if (obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket != NULL) {
-                vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket));
+                write_state_packet(obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket);
             }
 
             if (obj->second.ObjectInfo.Buffer.needsStagingBuffer) {
                 StagingInfo stagingInfo = s_bufferToStagedInfoMap[buffer];
                 stagingInfo.bufferCreateInfo.usage |= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 
-                // Generate packets to create the staging buffer
+                // Generate packets to create the staging buffer. Its memory
+                // may have the handle of readback staging memory that other
+                // staging buffers also use, so it is freed below before the
+                // next resource is written.
                 generateCreateStagingBuffer(device, stagingInfo);
 
                 // here's where we map / unmap to insert data into the buffer
@@ -3175,14 +3831,11 @@ void write_all_referenced_object_calls() {
                     // write map / unmap packets so the memory contents gets set on
                     // replay
                     if (obj->second.ObjectInfo.Buffer.pMapMemoryPacket != NULL) {
-                        vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pMapMemoryPacket, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pMapMemoryPacket));
+                        write_state_packet(obj->second.ObjectInfo.Buffer.pMapMemoryPacket);
                     }
 
                     if (obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket != NULL) {
-                        vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket,
-                                                   vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket));
+                        write_state_packet(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket);
                     }
                 }
 
@@ -3192,8 +3845,7 @@ void write_all_referenced_object_calls() {
                     obj->second.ObjectInfo.Buffer.queueFamilyIndex};
                 vktrace_trace_packet_header *pCreateCommandPoolPacket =
                     generate::vkCreateCommandPool(false, device, &cmdPoolCreateInfo, NULL, &stagingInfo.commandPool);
-                vktrace_write_trace_packet(pCreateCommandPoolPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pCreateCommandPoolPacket);
+                write_and_delete_state_packet(&pCreateCommandPoolPacket);
 
                 // create command buffer
                 VkCommandBufferAllocateInfo commandBufferAllocateInfo;
@@ -3205,8 +3857,7 @@ void write_all_referenced_object_calls() {
 
                 vktrace_trace_packet_header *pHeader =
                     generate::vkAllocateCommandBuffers(false, device, &commandBufferAllocateInfo, &stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 VkCommandBufferBeginInfo commandBufferBeginInfo;
                 commandBufferBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -3215,11 +3866,10 @@ void write_all_referenced_object_calls() {
                 commandBufferBeginInfo.pInheritanceInfo = NULL;
 
                 pHeader = generate::vkBeginCommandBuffer(false, stagingInfo.commandBuffer, &commandBufferBeginInfo);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // Transition Buffer to be writeable
-                generateTransitionBuffer(device, stagingInfo.commandBuffer, buffer, 0, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+                generateTransitionBuffer(stagingInfo.commandBuffer, buffer, 0, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
                                          obj->second.ObjectInfo.Buffer.size);
 
                 // issue call to copy buffer
@@ -3227,16 +3877,14 @@ void write_all_referenced_object_calls() {
                 stagingInfo.copyRegion.srcOffset = 0;
                 pHeader = generate::vkCmdCopyBuffer(false, stagingInfo.commandBuffer, stagingInfo.buffer, buffer, 1,
                                                     &stagingInfo.copyRegion);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // transition buffer to final access mask
-                generateTransitionBuffer(device, stagingInfo.commandBuffer, buffer, VK_ACCESS_TRANSFER_WRITE_BIT,
+                generateTransitionBuffer(stagingInfo.commandBuffer, buffer, VK_ACCESS_TRANSFER_WRITE_BIT,
                                          obj->second.ObjectInfo.Buffer.accessFlags, 0, obj->second.ObjectInfo.Buffer.size);
 
                 pHeader = generate::vkEndCommandBuffer(false, stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // Queue submit the command buffer
                 VkSubmitInfo submitInfo;
@@ -3251,38 +3899,33 @@ void write_all_referenced_object_calls() {
                 submitInfo.waitSemaphoreCount = 0;
 
                 pHeader = generate::vkQueueSubmit(false, stagingInfo.queue, 1, &submitInfo, VK_NULL_HANDLE);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // wait for queue to finish
                 pHeader = generate::vkQueueWaitIdle(false, stagingInfo.queue);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
-                // delete staging buffer
+                // delete staging buffer, which has to happen before the
+                // staging buffer of the next resource is created
                 generateDestroyStagingBuffer(device, stagingInfo);
 
                 // delete command buffer
                 pHeader = generate::vkFreeCommandBuffers(false, device, stagingInfo.commandPool, 1, &stagingInfo.commandBuffer);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
 
                 // delete command pool
                 vktrace_trace_packet_header *pDestroyCommandPoolPacket =
                     generate::vkDestroyCommandPool(false, device, stagingInfo.commandPool, nullptr);
-                vktrace_write_trace_packet(pDestroyCommandPoolPacket, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pDestroyCommandPoolPacket);
+                write_and_delete_state_packet(&pDestroyCommandPoolPacket);
             } else {
                 // write map / unmap packets so the memory contents gets set on
                 // replay
                 if (obj->second.ObjectInfo.Buffer.pMapMemoryPacket != NULL) {
-                    vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pMapMemoryPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pMapMemoryPacket));
+                    write_state_packet(obj->second.ObjectInfo.Buffer.pMapMemoryPacket);
                 }
 
                 if (obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket != NULL) {
-                    vktrace_write_trace_packet(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket));
+                    write_state_packet(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket);
                 }
             }
         }
@@ -3292,57 +3935,44 @@ void write_all_referenced_object_calls() {
     // DeviceMemory
     for (auto obj = stateTracker.createdDeviceMemorys.begin(); obj != stateTracker.createdDeviceMemorys.end(); obj++) {
         if (obj->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket != NULL) {
-            vktrace_write_trace_packet(obj->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket,
-                                       vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(obj->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket));
+            write_state_packet(obj->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
         }
     }
 
     // BufferView
     for (auto obj = stateTracker.createdBufferViews.begin(); obj != stateTracker.createdBufferViews.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.BufferView.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.BufferView.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.BufferView.pCreatePacket);
     }
 
     // Sampler
     for (auto obj = stateTracker.createdSamplers.begin(); obj != stateTracker.createdSamplers.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Sampler.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Sampler.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Sampler.pCreatePacket);
     }
 
     // DescriptorSetLayout
     for (auto obj = stateTracker.createdDescriptorSetLayouts.begin(); obj != stateTracker.createdDescriptorSetLayouts.end();
          obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.DescriptorSetLayout.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.DescriptorSetLayout.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.DescriptorSetLayout.pCreatePacket);
     }
 
     // PipelineLayout
     for (auto obj = stateTracker.createdPipelineLayouts.begin(); obj != stateTracker.createdPipelineLayouts.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.PipelineLayout.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PipelineLayout.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.PipelineLayout.pCreatePacket);
     }
 
     // RenderPass
     for (auto obj = stateTracker.createdRenderPasss.begin(); obj != stateTracker.createdRenderPasss.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.RenderPass.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.RenderPass.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.RenderPass.pCreatePacket);
     }
 
     // ShaderModule
     for (auto obj = stateTracker.createdShaderModules.begin(); obj != stateTracker.createdShaderModules.end(); obj++) {
-        VkShaderModule shaderModule = static_cast<VkShaderModule>(obj->first);
-        vktrace_trace_packet_header *pHeader =
-            generate::vkCreateShaderModule(false, obj->second.belongsToDevice, &obj->second.ObjectInfo.ShaderModule.createInfo,
-                                           obj->second.ObjectInfo.ShaderModule.pAllocator, &shaderModule);
-        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&pHeader);
+        write_state_packet(obj->second.ObjectInfo.ShaderModule.pCreatePacket);
     }
 
     // PipelineCache
     for (auto obj = stateTracker.createdPipelineCaches.begin(); obj != stateTracker.createdPipelineCaches.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.PipelineCache.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.PipelineCache.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.PipelineCache.pCreatePacket);
     }
 
     // Pipeline
@@ -3353,17 +3983,15 @@ void write_all_referenced_object_calls() {
         vktrace_trace_packet_header *pHeader = nullptr;
 
         // Create necessary shader modules
-        for (uint32_t moduleIndex = 0; moduleIndex < obj->second.ObjectInfo.Pipeline.shaderModuleCreateInfoCount; moduleIndex++) {
+        for (uint32_t moduleIndex = 0; moduleIndex < obj->second.ObjectInfo.Pipeline.shaderModuleCreatePacketCount; moduleIndex++) {
             VkShaderModule module = (obj->second.ObjectInfo.Pipeline.isGraphicsPipeline)
                                         ? obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages[moduleIndex].module
                                         : obj->second.ObjectInfo.Pipeline.computePipelineCreateInfo.stage.module;
 
-            if (stateTracker.createdShaderModules.find(module) == stateTracker.createdShaderModules.end()) {
+            if (stateTracker.createdShaderModules.find(module) == stateTracker.createdShaderModules.end() &&
+                obj->second.ObjectInfo.Pipeline.pShaderModuleCreatePackets[moduleIndex] != nullptr) {
                 // the shader module does not yet exist, so create it specifically for this pipeline
-                vktrace_trace_packet_header *pCreateShaderModule = generate::vkCreateShaderModule(
-                    false, device, &obj->second.ObjectInfo.Pipeline.pShaderModuleCreateInfos[moduleIndex], nullptr, &module);
-                vktrace_write_trace_packet(pCreateShaderModule, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pCreateShaderModule);
+                write_state_packet(obj->second.ObjectInfo.Pipeline.pShaderModuleCreatePackets[moduleIndex]);
             }
         }
 
@@ -3375,51 +4003,49 @@ void write_all_referenced_object_calls() {
             // "version" of the RenderPass. If the Pipeline wasn't deleted
             // when the RenderPass was deleted, then we may have pipelines that
             // were created based on an older "version" of the RenderPass.
-            VkRenderPass originalRenderPass = obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo.renderPass;
+            // The snapshot is shared with the live state tracker, so recreate
+            // the RenderPass into a copy of the create info.
+            VkGraphicsPipelineCreateInfo createInfo = obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo;
+            VkRenderPass originalRenderPass = createInfo.renderPass;
             uint32_t thisRenderPassVersion = obj->second.ObjectInfo.Pipeline.renderPassVersion;
             uint32_t latestVersion = stateTracker.get_RenderPassVersion(originalRenderPass);
 
-            trim::ObjectInfo *pRenderPass = stateTracker.get_RenderPass(originalRenderPass);
+            const trim::ObjectInfo *pRenderPass = stateTracker.createdRenderPasss.get(originalRenderPass);
             if (thisRenderPassVersion < latestVersion || pRenderPass == nullptr) {
                 // Actually recreate the old RenderPass to get a new handle to
                 // supply to the pipeline creation call
-                VkRenderPassCreateInfo *pRPCreateInfo =
+                const VkRenderPassCreateInfo *pRPCreateInfo =
                     stateTracker.get_RenderPassCreateInfo(originalRenderPass, thisRenderPassVersion);
-                vktrace_trace_packet_header *pCreateRenderPass = trim::generate::vkCreateRenderPass(
-                    true, device, pRPCreateInfo, nullptr, &obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo.renderPass);
-                vktrace_write_trace_packet(pCreateRenderPass, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pCreateRenderPass);
+                vktrace_trace_packet_header *pCreateRenderPass =
+                    trim::generate::vkCreateRenderPass(true, device, pRPCreateInfo, nullptr, &createInfo.renderPass);
+                write_and_delete_state_packet(&pCreateRenderPass);
             }
 
-            pHeader = trim::generate::vkCreateGraphicsPipelines(
-                false, device, pipelineCache, 1, &obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo, nullptr, &pipeline);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            pHeader = trim::generate::vkCreateGraphicsPipelines(false, device, pipelineCache, 1, &createInfo, nullptr, &pipeline);
+            write_and_delete_state_packet(&pHeader);
 
             if (thisRenderPassVersion < latestVersion || pRenderPass == nullptr) {
-                vktrace_trace_packet_header *pDestroyRenderPass = generate::vkDestroyRenderPass(
-                    true, device, obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo.renderPass, nullptr);
-                vktrace_write_trace_packet(pDestroyRenderPass, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pDestroyRenderPass);
+                vktrace_trace_packet_header *pDestroyRenderPass =
+                    generate::vkDestroyRenderPass(true, device, createInfo.renderPass, nullptr);
+                write_and_delete_state_packet(&pDestroyRenderPass);
             }
         } else {
             pHeader = trim::generate::vkCreateComputePipelines(
                 false, device, pipelineCache, 1, &obj->second.ObjectInfo.Pipeline.computePipelineCreateInfo, nullptr, &pipeline);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
 
         // Destroy ShaderModule objects
-        for (uint32_t moduleIndex = 0; moduleIndex < obj->second.ObjectInfo.Pipeline.shaderModuleCreateInfoCount; moduleIndex++) {
+        for (uint32_t moduleIndex = 0; moduleIndex < obj->second.ObjectInfo.Pipeline.shaderModuleCreatePacketCount; moduleIndex++) {
             VkShaderModule module = (obj->second.ObjectInfo.Pipeline.isGraphicsPipeline)
                                         ? obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages[moduleIndex].module
                                         : obj->second.ObjectInfo.Pipeline.computePipelineCreateInfo.stage.module;
 
-            if (stateTracker.createdShaderModules.find(module) == stateTracker.createdShaderModules.end()) {
+            if (stateTracker.createdShaderModules.find(module) == stateTracker.createdShaderModules.end() &&
+                obj->second.ObjectInfo.Pipeline.pShaderModuleCreatePackets[moduleIndex] != nullptr) {
                 // the shader module did not previously exist, so delete it.
                 vktrace_trace_packet_header *pDestroyShaderModule = generate::vkDestroyShaderModule(false, device, module, nullptr);
-                vktrace_write_trace_packet(pDestroyShaderModule, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pDestroyShaderModule);
+                write_and_delete_state_packet(&pDestroyShaderModule);
             }
         }
     }
@@ -3428,8 +4054,7 @@ void write_all_referenced_object_calls() {
     for (auto poolObj = stateTracker.createdDescriptorPools.begin(); poolObj != stateTracker.createdDescriptorPools.end();
          poolObj++) {
         // write the createDescriptorPool packet
-        vktrace_write_trace_packet(poolObj->second.ObjectInfo.DescriptorPool.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(poolObj->second.ObjectInfo.DescriptorPool.pCreatePacket));
+        write_state_packet(poolObj->second.ObjectInfo.DescriptorPool.pCreatePacket);
 
         if (poolObj->second.ObjectInfo.DescriptorPool.numSets > 0) {
             // now allocate all DescriptorSets that are part of this pool
@@ -3464,8 +4089,7 @@ void write_all_referenced_object_calls() {
             vktrace_trace_packet_header *pHeader =
                 generate::vkAllocateDescriptorSets(false, device, &allocateInfo, pDescriptorSets);
             pHeader->vktrace_begin_time = vktraceStartTime;
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&(pHeader));
+            write_and_delete_state_packet(&pHeader);
 
             delete[] pSetLayouts;
             delete[] pDescriptorSets;
@@ -3488,30 +4112,43 @@ void write_all_referenced_object_calls() {
                 // descriptorset has been updated, if we start to trim at a location
                 // close to title's beginning, that's very possible not all bindings
                 // has been updated.
-                uint32_t descriptorWriteCount = setObj->second.ObjectInfo.DescriptorSet.writeDescriptorCount;
-                uint32_t descriptorCopyCount = setObj->second.ObjectInfo.DescriptorSet.copyDescriptorCount;
-                VkWriteDescriptorSet *pDescriptorWrites = setObj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets;
-                VkCopyDescriptorSet *pDescriptorCopies = setObj->second.ObjectInfo.DescriptorSet.pCopyDescriptorSets;
+                // If the updates were packed to be spilled, write them from
+                // a copy of the packet instead.
+                ObjectInfo setInfo = setObj->second;
+                vktrace_trace_packet_header *pBindingsPacket = setInfo.ObjectInfo.DescriptorSet.pBindingsPacket;
+                if (pBindingsPacket != nullptr) {
+                    pBindingsPacket = SpillFile::is_spilled(pBindingsPacket) ? s_trimSpillFile.load(pBindingsPacket)
+                                                                             : copy_packet(pBindingsPacket);
+                    if (pBindingsPacket == nullptr) {
+                        vktrace_LogError("Trim failed to read the updates of a descriptor set back from its scratch file, the "
+                                         "trace file will be missing them.");
+                        continue;
+                    }
+                    StateTracker::view_DescriptorSet_bindings(&setInfo, pBindingsPacket);
+                }
+
+                uint32_t descriptorWriteCount = setInfo.ObjectInfo.DescriptorSet.writeDescriptorCount;
+                uint32_t descriptorCopyCount = setInfo.ObjectInfo.DescriptorSet.copyDescriptorCount;
+                VkWriteDescriptorSet *pDescriptorWrites = setInfo.ObjectInfo.DescriptorSet.pWriteDescriptorSets;
+                VkCopyDescriptorSet *pDescriptorCopies = setInfo.ObjectInfo.DescriptorSet.pCopyDescriptorSets;
 
                 vktrace_trace_packet_header *pHeader =
-                    generate::vkUpdateDescriptorSets(false, setObj->second.belongsToDevice, descriptorWriteCount, pDescriptorWrites,
+                    generate::vkUpdateDescriptorSets(false, setInfo.belongsToDevice, descriptorWriteCount, pDescriptorWrites,
                                                      descriptorCopyCount, pDescriptorCopies);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
+                vktrace_delete_trace_packet(&pBindingsPacket);
             }
         }
     }
 
     // Framebuffer
     for (auto obj = stateTracker.createdFramebuffers.begin(); obj != stateTracker.createdFramebuffers.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Framebuffer.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Framebuffer.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Framebuffer.pCreatePacket);
     }
 
     // Semaphore
     for (auto obj = stateTracker.createdSemaphores.begin(); obj != stateTracker.createdSemaphores.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Semaphore.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Semaphore.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Semaphore.pCreatePacket);
     }
 
     // Fence
@@ -3525,20 +4162,17 @@ void write_all_referenced_object_calls() {
         createInfo.flags = (obj->second.ObjectInfo.Fence.signaled) ? VK_FENCE_CREATE_SIGNALED_BIT : 0;
 
         vktrace_trace_packet_header *pCreateFence = generate::vkCreateFence(false, device, &createInfo, pAllocator, &fence);
-        vktrace_write_trace_packet(pCreateFence, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(pCreateFence));
+        write_and_delete_state_packet(&pCreateFence);
     }
 
     // Event
     for (auto obj = stateTracker.createdEvents.begin(); obj != stateTracker.createdEvents.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.Event.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.Event.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.Event.pCreatePacket);
     }
 
     // QueryPool
     for (auto obj = stateTracker.createdQueryPools.begin(); obj != stateTracker.createdQueryPools.end(); obj++) {
-        vktrace_write_trace_packet(obj->second.ObjectInfo.QueryPool.pCreatePacket, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&(obj->second.ObjectInfo.QueryPool.pCreatePacket));
+        write_state_packet(obj->second.ObjectInfo.QueryPool.pCreatePacket);
 
         VkCommandBuffer commandBuffer = obj->second.ObjectInfo.QueryPool.commandBuffer;
 
@@ -3551,13 +4185,11 @@ void write_all_referenced_object_calls() {
             beginInfo.pInheritanceInfo = nullptr;
             beginInfo.flags = 0;
             vktrace_trace_packet_header *pBeginCB = generate::vkBeginCommandBuffer(false, commandBuffer, &beginInfo);
-            vktrace_write_trace_packet(pBeginCB, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pBeginCB);
+            write_and_delete_state_packet(&pBeginCB);
 
             vktrace_trace_packet_header *pResetPacket =
                 generate::vkCmdResetQueryPool(false, commandBuffer, queryPool, 0, obj->second.ObjectInfo.QueryPool.size);
-            vktrace_write_trace_packet(pResetPacket, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pResetPacket);
+            write_and_delete_state_packet(&pResetPacket);
 
             // Go through each query and start / stop if needed.
             for (uint32_t i = 0; i < obj->second.ObjectInfo.QueryPool.size; i++) {
@@ -3568,8 +4200,7 @@ void write_all_referenced_object_calls() {
                         // anything.
                         vktrace_trace_packet_header *pWriteTimestamp =
                             generate::vkCmdWriteTimestamp(false, commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, i);
-                        vktrace_write_trace_packet(pWriteTimestamp, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&pWriteTimestamp);
+                        write_and_delete_state_packet(&pWriteTimestamp);
                     } else {
                         // This query needs to be begin-ended to make a
                         // queryable result.
@@ -3579,21 +4210,18 @@ void write_all_referenced_object_calls() {
                         VkQueryControlFlags flags = 0;
                         vktrace_trace_packet_header *pBeginQuery =
                             generate::vkCmdBeginQuery(false, commandBuffer, queryPool, i, flags);
-                        vktrace_write_trace_packet(pBeginQuery, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&pBeginQuery);
+                        write_and_delete_state_packet(&pBeginQuery);
 
                         vktrace_trace_packet_header *pEndQuery = generate::vkCmdEndQuery(false, commandBuffer, queryPool, i);
-                        vktrace_write_trace_packet(pEndQuery, vktrace_trace_get_trace_file());
-                        vktrace_delete_trace_packet(&pEndQuery);
+                        write_and_delete_state_packet(&pEndQuery);
                     }
                 }
             }
 
             vktrace_trace_packet_header *pEndCB = generate::vkEndCommandBuffer(false, commandBuffer);
-            vktrace_write_trace_packet(pEndCB, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pEndCB);
+            write_and_delete_state_packet(&pEndCB);
 
-            ObjectInfo *cbInfo = s_trimStateTrackerSnapshot.get_CommandBuffer(commandBuffer);
+            const ObjectInfo *cbInfo = stateTracker.createdCommandBuffers.get(commandBuffer);
             VkQueue queue = cbInfo->ObjectInfo.CommandBuffer.submitQueue;
 
             VkSubmitInfo submitInfo;
@@ -3608,47 +4236,43 @@ void write_all_referenced_object_calls() {
             submitInfo.pWaitSemaphores = NULL;
 
             vktrace_trace_packet_header *pQueueSubmit = generate::vkQueueSubmit(false, queue, 1, &submitInfo, VK_NULL_HANDLE);
-            vktrace_write_trace_packet(pQueueSubmit, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pQueueSubmit);
+            write_and_delete_state_packet(&pQueueSubmit);
 
             vktrace_trace_packet_header *pQueueWait = generate::vkQueueWaitIdle(false, queue);
-            vktrace_write_trace_packet(pQueueWait, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pQueueWait);
+            write_and_delete_state_packet(&pQueueWait);
         }
     }
 
     // write out the packets to recreate the command buffers that were allocated
-    vktrace_enter_critical_section(&trimCommandBufferPacketLock);
     // Secondary command buffers should be replayed before primary command buffers.
     // 1. Go through secondary command buffers
     for (auto cmdBuffer = stateTracker.createdCommandBuffers.begin(); cmdBuffer != stateTracker.createdCommandBuffers.end();
          ++cmdBuffer) {
         if (cmdBuffer->second.ObjectInfo.CommandBuffer.level == VK_COMMAND_BUFFER_LEVEL_SECONDARY) {
-            std::list<vktrace_trace_packet_header *> &packets = stateTracker.m_cmdBufferPackets[(VkCommandBuffer)cmdBuffer->first];
+            const std::list<vktrace_trace_packet_header *> *pPackets = stateTracker.m_cmdBufferPackets.get(cmdBuffer->first);
+            if (pPackets == nullptr) {
+                continue;
+            }
 
-            for (std::list<vktrace_trace_packet_header *>::iterator packet = packets.begin(); packet != packets.end(); ++packet) {
-                vktrace_trace_packet_header *pHeader = *packet;
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+            for (auto packet = pPackets->cbegin(); packet != pPackets->cend(); ++packet) {
+                write_state_packet(*packet);
             }
-            packets.clear();
         }
     }
     // 2. Go through primary command buffers
     for (auto cmdBuffer = stateTracker.createdCommandBuffers.begin(); cmdBuffer != stateTracker.createdCommandBuffers.end();
          ++cmdBuffer) {
         if (cmdBuffer->second.ObjectInfo.CommandBuffer.level == VK_COMMAND_BUFFER_LEVEL_PRIMARY) {
-            std::list<vktrace_trace_packet_header *> &packets = stateTracker.m_cmdBufferPackets[(VkCommandBuffer)cmdBuffer->first];
+            const std::list<vktrace_trace_packet_header *> *pPackets = stateTracker.m_cmdBufferPackets.get(cmdBuffer->first);
+            if (pPackets == nullptr) {
+                continue;
+            }
 
-            for (std::list<vktrace_trace_packet_header *>::iterator packet = packets.begin(); packet != packets.end(); ++packet) {
-                vktrace_trace_packet_header *pHeader = *packet;
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+            for (auto packet = pPackets->cbegin(); packet != pPackets->cend(); ++packet) {
+                write_state_packet(*packet);
             }
-            packets.clear();
         }
     }
-    vktrace_leave_critical_section(&trimCommandBufferPacketLock);
 
     // Collect semaphores that need signaling
     size_t maxSemaphores = stateTracker.createdSemaphores.size();
@@ -3672,8 +4296,7 @@ void write_all_referenced_object_calls() {
             submit_info.pSignalSemaphores = &semaphore;
 
             vktrace_trace_packet_header *pHeader = generate::vkQueueSubmit(false, queue, 1, &submit_info, VK_NULL_HANDLE);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3686,50 +4309,68 @@ void write_all_referenced_object_calls() {
 // Object tracking
 //=========================================================================
 void add_RenderPassCreateInfo(VkRenderPass renderPass, const VkRenderPassCreateInfo *pCreateInfo) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(renderPass));
     s_trimGlobalStateTracker.add_RenderPassCreateInfo(renderPass, pCreateInfo);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(renderPass));
 }
 
 //=========================================================================
 uint32_t get_RenderPassVersion(VkRenderPass renderPass) {
     uint32_t version = 0;
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(renderPass));
     version = s_trimGlobalStateTracker.get_RenderPassVersion(renderPass);
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(renderPass));
     return version;
 }
 
+//=========================================================================
+// Vulkan requires the command pool of a command buffer to be externally
+// synchronized while the command buffer is recorded, so only one thread at a
+// time appends to the calls of a command buffer, and the lock of its shard is
+// only contended by threads recording command buffers in the same shard.
 //=========================================================================
 void add_CommandBuffer_call(VkCommandBuffer commandBuffer, vktrace_trace_packet_header *pHeader) {
     if (pHeader != NULL) {
-        vktrace_enter_critical_section(&trimCommandBufferPacketLock);
+        vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
         s_trimGlobalStateTracker.add_CommandBuffer_call(commandBuffer, pHeader);
-        vktrace_leave_critical_section(&trimCommandBufferPacketLock);
+        vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
     }
 }
 
 //=========================================================================
 void remove_CommandBuffer_calls(VkCommandBuffer commandBuffer) {
-    vktrace_enter_critical_section(&trimCommandBufferPacketLock);
+    vktrace_enter_critical_section(get_state_tracker_lock(commandBuffer));
     s_trimGlobalStateTracker.remove_CommandBuffer_calls(commandBuffer);
-    vktrace_leave_critical_section(&trimCommandBufferPacketLock);
+    vktrace_leave_critical_section(get_state_tracker_lock(commandBuffer));
+}
+
+//=========================================================================
+// Resetting a command pool resets all of its command buffers.
+//=========================================================================
+void reset_CommandPool(VkCommandPool commandPool) {
+    lock_state_tracker();
+    std::vector<VkCommandBuffer> commandBuffers = get_CommandPool_CommandBuffers(commandPool);
+    for (size_t i = 0; i < commandBuffers.size(); i++) {
+        release_CommandBuffer_recording(commandBuffers[i]);
+    }
+    unlock_state_tracker();
 }
 
 //=========================================================================
 void reset_DescriptorPool(VkDescriptorPool descriptorPool) {
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    lock_state_tracker();
+    std::vector<VkDescriptorSet> setsToRemove;
     for (auto dsIter = s_trimGlobalStateTracker.createdDescriptorSets.begin();
-         dsIter != s_trimGlobalStateTracker.createdDescriptorSets.end();) {
+         dsIter != s_trimGlobalStateTracker.createdDescriptorSets.end(); dsIter++) {
         if (dsIter->second.ObjectInfo.DescriptorSet.descriptorPool == descriptorPool) {
-            VkDescriptorSet setToRemove = (VkDescriptorSet)dsIter->first;
-            dsIter++;
-            s_trimGlobalStateTracker.remove_DescriptorSet(setToRemove);
-        } else {
-            dsIter++;
+            setsToRemove.push_back((VkDescriptorSet)dsIter->first);
         }
     }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+
+    for (size_t i = 0; i < setsToRemove.size(); i++) {
+        s_trimGlobalStateTracker.remove_DescriptorSet(setsToRemove[i]);
+    }
+    unlock_state_tracker();
 }
 
 //===============================================
@@ -3756,8 +4397,7 @@ void add_destroy_device_object_packets(VkDevice device) {
 
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyQueryPool(false, obj->second.belongsToDevice, queryPool, pAllocator);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3768,8 +4408,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             VkAllocationCallbacks *pAllocator = get_Allocator(obj->second.ObjectInfo.Event.pAllocator);
 
             vktrace_trace_packet_header *pHeader = generate::vkDestroyEvent(false, obj->second.belongsToDevice, event, pAllocator);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3780,8 +4419,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             VkAllocationCallbacks *pAllocator = get_Allocator(obj->second.ObjectInfo.Fence.pAllocator);
 
             vktrace_trace_packet_header *pHeader = generate::vkDestroyFence(false, obj->second.belongsToDevice, fence, pAllocator);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3794,8 +4432,7 @@ void add_destroy_device_object_packets(VkDevice device) {
 
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroySemaphore(false, obj->second.belongsToDevice, semaphore, pAllocator);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3808,8 +4445,7 @@ void add_destroy_device_object_packets(VkDevice device) {
 
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyFramebuffer(false, obj->second.belongsToDevice, framebuffer, pAllocator);
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3826,8 +4462,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             {
                 vktrace_trace_packet_header *pHeader =
                     generate::vkResetDescriptorPool(false, obj->second.belongsToDevice, descriptorPool, 0);
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
             }
 
             // Now destroy the DescriptorPool
@@ -3835,8 +4470,7 @@ void add_destroy_device_object_packets(VkDevice device) {
                 vktrace_trace_packet_header *pHeader =
                     generate::vkDestroyDescriptorPool(false, obj->second.belongsToDevice, descriptorPool,
                                                       get_Allocator(obj->second.ObjectInfo.DescriptorPool.pAllocator));
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
             }
         }
     }
@@ -3848,8 +4482,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyPipeline(false, obj->second.belongsToDevice, (VkPipeline)obj->first,
                                             get_Allocator(obj->second.ObjectInfo.Pipeline.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3860,8 +4493,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyPipelineCache(false, obj->second.belongsToDevice, (VkPipelineCache)obj->first,
                                                  get_Allocator(obj->second.ObjectInfo.PipelineCache.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3872,8 +4504,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyShaderModule(false, obj->second.belongsToDevice, (VkShaderModule)obj->first,
                                                 get_Allocator(obj->second.ObjectInfo.ShaderModule.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3884,8 +4515,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyRenderPass(false, obj->second.belongsToDevice, (VkRenderPass)obj->first,
                                               get_Allocator(obj->second.ObjectInfo.RenderPass.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3896,8 +4526,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyPipelineLayout(false, obj->second.belongsToDevice, (VkPipelineLayout)obj->first,
                                                   get_Allocator(obj->second.ObjectInfo.PipelineLayout.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3908,8 +4537,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyDescriptorSetLayout(false, obj->second.belongsToDevice, (VkDescriptorSetLayout)obj->first,
                                                        get_Allocator(obj->second.ObjectInfo.DescriptorSetLayout.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3920,8 +4548,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroySampler(false, obj->second.belongsToDevice, (VkSampler)obj->first,
                                            get_Allocator(obj->second.ObjectInfo.Sampler.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3930,8 +4557,7 @@ void add_destroy_device_object_packets(VkDevice device) {
         if (obj->second.belongsToDevice == device) {
             vktrace_trace_packet_header *pHeader = generate::vkDestroyBuffer(
                 false, obj->second.belongsToDevice, (VkBuffer)obj->first, get_Allocator(obj->second.ObjectInfo.Buffer.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3942,8 +4568,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyBufferView(false, obj->second.belongsToDevice, (VkBufferView)obj->first,
                                               get_Allocator(obj->second.ObjectInfo.BufferView.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3954,8 +4579,7 @@ void add_destroy_device_object_packets(VkDevice device) {
                 vktrace_trace_packet_header *pHeader =
                     generate::vkDestroyImage(false, obj->second.belongsToDevice, (VkImage)obj->first,
                                              get_Allocator(obj->second.ObjectInfo.Image.pAllocator));
-                vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                vktrace_delete_trace_packet(&pHeader);
+                write_and_delete_state_packet(&pHeader);
             }
         }
     }
@@ -3967,8 +4591,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyImageView(false, obj->second.belongsToDevice, (VkImageView)obj->first,
                                              get_Allocator(obj->second.ObjectInfo.ImageView.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3979,8 +4602,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkFreeMemory(false, obj->second.belongsToDevice, (VkDeviceMemory)obj->first,
                                        get_Allocator(obj->second.ObjectInfo.DeviceMemory.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -3991,8 +4613,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroySwapchainKHR(false, obj->second.belongsToDevice, (VkSwapchainKHR)obj->first,
                                                 get_Allocator(obj->second.ObjectInfo.SwapchainKHR.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 
@@ -4020,8 +4641,7 @@ void add_destroy_device_object_packets(VkDevice device) {
                     vktrace_trace_packet_header *pHeader = generate::vkFreeCommandBuffers(
                         false, obj->second.belongsToDevice, (VkCommandPool)obj->first, commandBufferCount, pCommandBuffers);
                     pHeader->vktrace_begin_time = vktrace_begin_time;
-                    vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-                    vktrace_delete_trace_packet(&pHeader);
+                    write_and_delete_state_packet(&pHeader);
 
                     delete[] pCommandBuffers;
                 }
@@ -4031,8 +4651,7 @@ void add_destroy_device_object_packets(VkDevice device) {
             vktrace_trace_packet_header *pHeader =
                 generate::vkDestroyCommandPool(false, obj->second.belongsToDevice, (VkCommandPool)obj->first,
                                                get_Allocator(obj->second.ObjectInfo.CommandPool.pAllocator));
-            vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-            vktrace_delete_trace_packet(&pHeader);
+            write_and_delete_state_packet(&pHeader);
         }
     }
 }
@@ -4047,13 +4666,12 @@ void add_destroy_device_object_packets(VkDevice device) {
 void write_destroy_packets() {
     vktrace_LogDebug("vktrace destroying objects after trim.");
 
-    vktrace_enter_critical_section(&trimStateTrackerLock);
+    lock_state_tracker();
     // Make sure all queues have completed before trying to delete anything
     for (auto obj = s_trimGlobalStateTracker.createdQueues.begin(); obj != s_trimGlobalStateTracker.createdQueues.end(); obj++) {
         VkQueue queue = obj->first;
         vktrace_trace_packet_header *pHeader = generate::vkQueueWaitIdle(false, queue);
-        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&pHeader);
+        write_and_delete_state_packet(&pHeader);
     }
 
     // Device
@@ -4062,8 +4680,7 @@ void write_destroy_packets() {
         add_destroy_device_object_packets((VkDevice)obj->first);
         vktrace_trace_packet_header *pHeader =
             generate::vkDestroyDevice(false, (VkDevice)obj->first, get_Allocator(obj->second.ObjectInfo.Device.pAllocator));
-        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&pHeader);
+        write_and_delete_state_packet(&pHeader);
     }
 
     // SurfaceKHR
@@ -4072,8 +4689,7 @@ void write_destroy_packets() {
         vktrace_trace_packet_header *pHeader =
             generate::vkDestroySurfaceKHR(false, obj->second.belongsToInstance, (VkSurfaceKHR)obj->first,
                                           get_Allocator(obj->second.ObjectInfo.SurfaceKHR.pAllocator));
-        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&pHeader);
+        write_and_delete_state_packet(&pHeader);
     }
 
     // Instance
@@ -4081,10 +4697,9 @@ void write_destroy_packets() {
          obj++) {
         vktrace_trace_packet_header *pHeader =
             generate::vkDestroyInstance(false, (VkInstance)obj->first, get_Allocator(obj->second.ObjectInfo.Instance.pAllocator));
-        vktrace_write_trace_packet(pHeader, vktrace_trace_get_trace_file());
-        vktrace_delete_trace_packet(&pHeader);
+        write_and_delete_state_packet(&pHeader);
     }
-    vktrace_leave_critical_section(&trimStateTrackerLock);
+    unlock_state_tracker();
 
     vktrace_LogDebug("vktrace done destroying objects after trim.");
 }
@@ -94,6 +94,11 @@ bool is_hotkey_trim_triggered();
 // frames.
 void snapshot_state_tracker();
 
+// Holds the packets that are kept to recreate objects to the memory budget of
+// VKTRACE_TRIM_MEMORY_BUDGET_ENV, call it once per frame before trimming
+// starts.
+void check_memory_budget();
+
 void start();
 void stop();
 
@@ -126,6 +131,7 @@ void ClearBufferTransitions(VkCommandBuffer commandBuffer);
 //-----------------------
 
 void reset_DescriptorPool(VkDescriptorPool descriptorPool);
+void reset_CommandPool(VkCommandPool commandPool);
 
 VkMemoryPropertyFlags LookUpMemoryProperties(VkDevice device, uint32_t memoryTypeIndex);
 
@@ -0,0 +1,605 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "vktrace_trace_packet_utils.h"
+
+namespace trim {
+
+static const size_t kCopyOnWriteShardCount = 256;
+
+//-------------------------------------------------------------------------
+// Returns the shard that a CopyOnWriteMap with keys of type Key puts key in.
+// Handles are pointers or counters whose low bits rarely differ, so the hash
+// is mixed before picking a shard.
+//-------------------------------------------------------------------------
+template <typename Key>
+size_t get_copy_on_write_shard_index(const Key &key) {
+    uint64_t hash = static_cast<uint64_t>(std::hash<Key>()(key));
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash % kCopyOnWriteShardCount);
+}
+
+//-------------------------------------------------------------------------
+// The values that each thread got through CopyOnWriteMap::lend() and
+// lend_new() in the last traced call that got any. Every traced call
+// creates its packet before it gets values, so they belong to a call that
+// is still running as long as vktrace_get_thread_packet_count() of their
+// thread hasn't changed. A thread's list is only cleared when the thread
+// lends again, so it can also hold values of a call that has returned.
+//-------------------------------------------------------------------------
+class LentValues {
+   public:
+    // Remembers that the current call of the calling thread got the value of
+    // key from pMap.
+    static void remember(const void *pMap, uint64_t key) {
+        LentValues &lent = get_thread_lent_values();
+        uint64_t packetCount = vktrace_get_thread_packet_count();
+        std::lock_guard<std::mutex> lock(lent.m_mutex);
+        if (lent.m_packetCount != packetCount) {
+            lent.m_values.clear();
+            lent.m_packetCount = packetCount;
+        }
+        lent.m_values.push_back(std::make_pair(pMap, key));
+    }
+
+    // Returns the keys of the values of pMap that calls on any thread may
+    // still be changing. The calling thread's own list only counts if it
+    // was filled in its current call.
+    static std::vector<uint64_t> get_keys(const void *pMap) {
+        const LentValues *pOwnLent = &get_thread_lent_values();
+        uint64_t packetCount = vktrace_get_thread_packet_count();
+        std::vector<uint64_t> result;
+        Registry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for (std::unordered_set<LentValues *>::const_iterator iter = registry.lists.begin(); iter != registry.lists.end(); ++iter) {
+            LentValues *pLent = *iter;
+            std::lock_guard<std::mutex> lentLock(pLent->m_mutex);
+            if (pLent == pOwnLent && pLent->m_packetCount != packetCount) {
+                continue;
+            }
+            for (std::vector<Value>::const_iterator value = pLent->m_values.begin(); value != pLent->m_values.end(); ++value) {
+                if (value->first == pMap) {
+                    result.push_back(value->second);
+                }
+            }
+        }
+        return result;
+    }
+
+   private:
+    // The map and the key of a lent value.
+    typedef std::pair<const void *, uint64_t> Value;
+
+    // The lists of the threads that are running. It is never freed, since
+    // threads can exit after static objects are destroyed.
+    struct Registry {
+        std::mutex mutex;
+        std::unordered_set<LentValues *> lists;
+    };
+
+    static Registry &get_registry() {
+        static Registry *s_pRegistry = new Registry();
+        return *s_pRegistry;
+    }
+
+    static LentValues &get_thread_lent_values() {
+        static thread_local LentValues t_lent;
+        return t_lent;
+    }
+
+    LentValues() : m_packetCount(0) {
+        Registry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.lists.insert(this);
+    }
+
+    ~LentValues() {
+        Registry &registry = get_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.lists.erase(this);
+    }
+
+    std::mutex m_mutex;
+    uint64_t m_packetCount;  // vktrace_get_thread_packet_count() when m_values were lent
+    std::vector<Value> m_values;
+};
+
+//-------------------------------------------------------------------------
+// A map whose copies share their entries until one of them changes.
+//
+// When trimming starts, the state tracker is copied so that the objects that
+// existed at that point can be recreated, and an application can have
+// hundreds of thousands of them. Copying one of these maps only copies the
+// pointers to its kShardCount shards. The first change to a shard that is
+// shared with a copy makes a new table of entry pointers for that shard, and
+// the first change to a shared entry copies that entry with the map's
+// CopyFunction. Entries are freed with the map's DeleteFunction once no map
+// holds them any more.
+//
+// Reading through the const members (begin(), end(), find() and the const
+// get()) never copies anything. Changing an entry has to go through get(),
+// add() or operator[], which return a value that isn't shared. As with
+// std::unordered_map, add() and operator[] invalidate iterators into the map
+// they change and erase() invalidates iterators to the erased entry, but an
+// iterator into a shard that was copied away keeps visiting that shard as it
+// was, for as long as another map still holds it.
+//
+// A value returned by get() or add() can only be changed while nothing
+// copies the map. A traced call that keeps changing it after letting go of
+// the lock of its shard gets it through lend() or lend_new() instead, and
+// copies are made with snapshot(), which gives the copy its own copies of
+// the values lent to calls that may still be running, see LentValues.
+// Those values are kept in a small overlay of the shard next to its shared
+// table, so the tables are still shared.
+//
+// get(), add(), lend(), lend_new(), operator[] and erase() only touch the
+// shard of their key, see get_copy_on_write_shard_index(), so changes to
+// different shards can be made from different threads at the same time.
+// Everything else visits every shard and mustn't run while any shard changes.
+//-------------------------------------------------------------------------
+template <typename Key, typename Value>
+class CopyOnWriteMap {
+   public:
+    typedef std::pair<const Key, Value> value_type;
+    typedef void (*CopyFunction)(Value *pDst, const Value &src);
+    typedef void (*DeleteFunction)(Value *pValue);
+
+    static const size_t kShardCount = kCopyOnWriteShardCount;
+
+   private:
+    struct EntryDeleter {
+        explicit EntryDeleter(DeleteFunction pDelete) : m_pDelete(pDelete) {}
+        void operator()(value_type *pEntry) const {
+            if (m_pDelete != nullptr) {
+                m_pDelete(&pEntry->second);
+            }
+            delete pEntry;
+        }
+        DeleteFunction m_pDelete;
+    };
+
+    typedef std::shared_ptr<value_type> Entry;
+    typedef std::unordered_map<Key, Entry> Shard;
+
+   public:
+    class const_iterator {
+       public:
+        const_iterator() : m_pMap(nullptr), m_shardIndex(kShardCount), m_pShard(nullptr), m_pOverlay(nullptr) {}
+
+        const value_type &operator*() const { return *current(); }
+        const value_type *operator->() const { return current(); }
+
+        const_iterator &operator++() {
+            ++m_entry;
+            skip_finished_shards();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator result = *this;
+            ++(*this);
+            return result;
+        }
+
+        bool operator==(const const_iterator &other) const {
+            return m_shardIndex == other.m_shardIndex && (m_shardIndex == kShardCount || m_entry == other.m_entry);
+        }
+        bool operator!=(const const_iterator &other) const { return !(*this == other); }
+
+       private:
+        friend class CopyOnWriteMap;
+
+        const_iterator(const CopyOnWriteMap *pMap, size_t shardIndex)
+            : m_pMap(pMap), m_shardIndex(shardIndex), m_pShard(nullptr), m_pOverlay(nullptr) {
+            if (m_shardIndex < kShardCount) {
+                m_pShard = m_pMap->m_shards[m_shardIndex].get();
+                m_pOverlay = &m_pMap->m_overlays[m_shardIndex];
+                if (m_pShard != nullptr) {
+                    m_entry = m_pShard->begin();
+                }
+            }
+            skip_finished_shards();
+        }
+
+        const_iterator(const CopyOnWriteMap *pMap, size_t shardIndex, const Shard *pShard, typename Shard::const_iterator entry)
+            : m_pMap(pMap), m_shardIndex(shardIndex), m_pShard(pShard), m_pOverlay(&pMap->m_overlays[shardIndex]), m_entry(entry) {}
+
+        // The entry of the overlay replaces the one of the table, see
+        // snapshot().
+        const value_type *current() const {
+            if (!m_pOverlay->empty()) {
+                typename Shard::const_iterator overlay = m_pOverlay->find(m_entry->first);
+                if (overlay != m_pOverlay->end()) {
+                    return overlay->second.get();
+                }
+            }
+            return m_entry->second.get();
+        }
+
+        // Moves on to the next shard that has entries once the current one is done.
+        void skip_finished_shards() {
+            while (m_shardIndex < kShardCount && (m_pShard == nullptr || m_entry == m_pShard->end())) {
+                m_shardIndex++;
+                m_pShard = (m_shardIndex < kShardCount) ? m_pMap->m_shards[m_shardIndex].get() : nullptr;
+                if (m_pShard != nullptr) {
+                    m_pOverlay = &m_pMap->m_overlays[m_shardIndex];
+                    m_entry = m_pShard->begin();
+                }
+            }
+        }
+
+        const CopyOnWriteMap *m_pMap;
+        size_t m_shardIndex;
+        const Shard *m_pShard;
+        const Shard *m_pOverlay;
+        typename Shard::const_iterator m_entry;
+    };
+
+    explicit CopyOnWriteMap(CopyFunction pCopy = nullptr, DeleteFunction pDelete = nullptr) : m_pCopy(pCopy), m_pDelete(pDelete) {}
+
+    size_t size() const {
+        size_t result = 0;
+        for (size_t i = 0; i < kShardCount; i++) {
+            if (m_shards[i] != nullptr) {
+                result += m_shards[i]->size();
+            }
+        }
+        return result;
+    }
+    bool empty() const { return begin() == end(); }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, kShardCount); }
+
+    const_iterator find(const Key &key) const {
+        size_t index = shard_index(key);
+        const Shard *pShard = m_shards[index].get();
+        if (pShard != nullptr) {
+            typename Shard::const_iterator entry = pShard->find(key);
+            if (entry != pShard->end()) {
+                return const_iterator(this, index, pShard, entry);
+            }
+        }
+        return end();
+    }
+
+    // Returns the value of key, or nullptr if the map doesn't have it.
+    const Value *get(const Key &key) const {
+        const_iterator iter = find(key);
+        return (iter != end()) ? &iter->second : nullptr;
+    }
+
+    // Returns the value of key, or nullptr if the map doesn't have it. The
+    // value is copied first if a copy of this map still shares it.
+    Value *get(const Key &key) {
+        size_t index = shard_index(key);
+        if (m_shards[index] == nullptr) {
+            return nullptr;
+        }
+        typename Shard::iterator entry = m_shards[index]->find(key);
+        if (entry == m_shards[index]->end()) {
+            return nullptr;
+        }
+        if (m_shards[index].use_count() > 1 || !m_overlays[index].empty()) {
+            entry = writable_shard(index).find(key);
+        }
+        if (entry->second.use_count() > 1) {
+            entry->second = copy_entry(*entry->second);
+        }
+        return &entry->second->second;
+    }
+
+    // Replaces the value of key, if there is one, with a value initialized one
+    // and returns it.
+    Value &add(const Key &key) {
+        Entry &entry = writable_shard(shard_index(key))[key];
+        entry = Entry(new value_type(key, Value()), EntryDeleter(m_pDelete));
+        return entry->second;
+    }
+
+    // Like get() and add(), and remembers that the current traced call of
+    // the calling thread got the value, see snapshot(). Keys must fit in 64
+    // bits, which handles do.
+    Value *lend(const Key &key) {
+        static_assert(sizeof(Key) <= sizeof(uint64_t), "lent keys are kept as 64 bit values");
+        Value *pValue = get(key);
+        if (pValue != nullptr) {
+            LentValues::remember(this, (uint64_t)key);
+        }
+        return pValue;
+    }
+    Value &lend_new(const Key &key) {
+        static_assert(sizeof(Key) <= sizeof(uint64_t), "lent keys are kept as 64 bit values");
+        LentValues::remember(this, (uint64_t)key);
+        return add(key);
+    }
+
+    Value &operator[](const Key &key) {
+        Value *pValue = get(key);
+        return (pValue != nullptr) ? *pValue : add(key);
+    }
+
+    void erase(const Key &key) {
+        size_t index = shard_index(key);
+        if (m_shards[index] != nullptr && m_shards[index]->count(key) != 0) {
+            writable_shard(index).erase(key);
+        }
+    }
+
+    // Makes this map a copy of live like the copy assignment does, except
+    // that the values live lent to calls that may still be running aren't
+    // shared, so those calls can go on changing them without changing this
+    // map.
+    //
+    // The calls hold pointers to the values in live, so live keeps those in
+    // the overlays of their shards and the shared tables get copies of them.
+    // The tables themselves stay shared, so this costs as much as the number
+    // of those values and of the values still in the overlays. Visits every
+    // shard.
+    void snapshot(CopyOnWriteMap &live) {
+        if (this == &live) {
+            return;
+        }
+        m_pCopy = live.m_pCopy;
+        m_pDelete = live.m_pDelete;
+
+        std::vector<uint64_t> lentKeys = LentValues::get_keys(&live);
+        std::vector<Key> lent[kShardCount];
+        for (std::vector<uint64_t>::const_iterator key = lentKeys.begin(); key != lentKeys.end(); ++key) {
+            lent[shard_index((Key)*key)].push_back((Key)*key);
+        }
+
+        for (size_t i = 0; i < kShardCount; i++) {
+            m_shards[i].reset();
+            m_overlays[i].clear();
+
+            // A shard that still shares its table with an older copy only
+            // kept the values in its overlay away from it. Any other lent
+            // value needs a table of its own first.
+            if (live.m_shards[i].use_count() > 1 && live.has_lent_outside_overlay(i, lent[i])) {
+                live.writable_shard(i);
+            }
+
+            // Values in the overlay of live are already kept away from the
+            // table, so this map gets them from its own overlay.
+            for (typename Shard::const_iterator entry = live.m_overlays[i].begin(); entry != live.m_overlays[i].end(); ++entry) {
+                bool bLent = std::find(lent[i].begin(), lent[i].end(), entry->first) != lent[i].end();
+                m_overlays[i][entry->first] = bLent ? copy_entry(*entry->second) : entry->second;
+            }
+            live.move_lent_to_overlay(i, lent[i]);
+            m_shards[i] = live.m_shards[i];
+        }
+    }
+
+    // Calls function(key, value) with every value of the map, after copying
+    // the ones a copy of this map still shares. Visits every shard.
+    template <typename Function>
+    void for_each(Function function) {
+        for (size_t i = 0; i < kShardCount; i++) {
+            if (m_shards[i] == nullptr) {
+                continue;
+            }
+            Shard &shard = writable_shard(i);
+            for (typename Shard::iterator entry = shard.begin(); entry != shard.end(); ++entry) {
+                if (entry->second.use_count() > 1) {
+                    entry->second = copy_entry(*entry->second);
+                }
+                function(entry->first, entry->second->second);
+            }
+        }
+    }
+
+    void clear() {
+        for (size_t i = 0; i < kShardCount; i++) {
+            m_shards[i].reset();
+            m_overlays[i].clear();
+        }
+    }
+
+   private:
+    static size_t shard_index(const Key &key) { return get_copy_on_write_shard_index(key); }
+
+    // Returns the table of shard index after making sure no copy of this map
+    // shares it, with the overlay of the shard put back into it.
+    Shard &writable_shard(size_t index) {
+        std::shared_ptr<Shard> &shard = m_shards[index];
+        if (shard == nullptr) {
+            shard = std::make_shared<Shard>();
+        } else if (shard.use_count() > 1) {
+            shard = std::make_shared<Shard>(*shard);
+        }
+        for (typename Shard::iterator entry = m_overlays[index].begin(); entry != m_overlays[index].end(); ++entry) {
+            (*shard)[entry->first] = entry->second;
+        }
+        m_overlays[index].clear();
+        return *shard;
+    }
+
+    bool has_lent_outside_overlay(size_t index, const std::vector<Key> &keys) const {
+        for (typename std::vector<Key>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+            if (m_overlays[index].count(*key) == 0 && m_shards[index]->count(*key) != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Moves the values of keys from the table of shard index to its overlay
+    // and puts copies of them in the table, which no other map may share.
+    void move_lent_to_overlay(size_t index, const std::vector<Key> &keys) {
+        if (m_shards[index] == nullptr) {
+            return;
+        }
+        Shard &shard = *m_shards[index];
+        for (typename std::vector<Key>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+            typename Shard::iterator entry = shard.find(*key);
+            if (entry == shard.end() || m_overlays[index].count(*key) != 0) {
+                continue;
+            }
+            m_overlays[index][*key] = entry->second;
+            entry->second = copy_entry(*entry->second);
+        }
+    }
+
+    Entry copy_entry(const value_type &src) const {
+        value_type *pCopy = new value_type(src.first, Value());
+        if (m_pCopy != nullptr) {
+            m_pCopy(&pCopy->second, src.second);
+        } else {
+            pCopy->second = src.second;
+        }
+        return Entry(pCopy, EntryDeleter(m_pDelete));
+    }
+
+    CopyFunction m_pCopy;
+    DeleteFunction m_pDelete;
+    std::shared_ptr<Shard> m_shards[kShardCount];
+
+    // The entries of each shard that replace the ones of its table, see
+    // snapshot(). Their keys are always in the table too.
+    Shard m_overlays[kShardCount];
+};
+
+template <typename Key, typename Value>
+const size_t CopyOnWriteMap<Key, Value>::kShardCount;
+
+//-------------------------------------------------------------------------
+// A list that is only ever appended to, whose copies share their items.
+// Copying it copies one pointer for every kChunkSize items, and appending to
+// a list that shares its last chunk copies the pointers of that chunk only.
+// Items are freed with the list's DeleteFunction once no list holds them.
+//-------------------------------------------------------------------------
+template <typename T>
+class CopyOnWriteList {
+   public:
+    typedef void (*DeleteFunction)(T *pItem);
+
+    static const size_t kChunkSize = 256;
+
+   private:
+    struct ItemDeleter {
+        explicit ItemDeleter(DeleteFunction pDelete) : m_pDelete(pDelete) {}
+        void operator()(T *pItem) const {
+            if (m_pDelete != nullptr) {
+                m_pDelete(pItem);
+            }
+        }
+        DeleteFunction m_pDelete;
+    };
+
+    typedef std::vector<std::shared_ptr<T>> Chunk;
+
+   public:
+    class const_iterator {
+       public:
+        const_iterator() : m_pList(nullptr), m_index(0) {}
+
+        T *operator*() const { return (*m_pList->m_chunks[m_index / kChunkSize])[m_index % kChunkSize].get(); }
+
+        const_iterator &operator++() {
+            m_index++;
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator result = *this;
+            m_index++;
+            return result;
+        }
+
+        bool operator==(const const_iterator &other) const { return m_index == other.m_index; }
+        bool operator!=(const const_iterator &other) const { return m_index != other.m_index; }
+
+       private:
+        friend class CopyOnWriteList;
+        const_iterator(const CopyOnWriteList *pList, size_t index) : m_pList(pList), m_index(index) {}
+
+        const CopyOnWriteList *m_pList;
+        size_t m_index;
+    };
+
+    explicit CopyOnWriteList(DeleteFunction pDelete = nullptr) : m_pDelete(pDelete), m_size(0) {}
+
+    size_t size() const { return m_size; }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, m_size); }
+
+    void push_back(T *pItem) {
+        if (m_size % kChunkSize == 0) {
+            m_chunks.push_back(std::make_shared<Chunk>());
+            m_chunks.back()->reserve(kChunkSize);
+        } else if (m_chunks.back().use_count() > 1) {
+            std::shared_ptr<Chunk> pCopy = std::make_shared<Chunk>();
+            pCopy->reserve(kChunkSize);
+            pCopy->assign(m_chunks.back()->begin(), m_chunks.back()->begin() + m_size % kChunkSize);
+            m_chunks.back() = pCopy;
+        }
+        m_chunks.back()->push_back(std::shared_ptr<T>(pItem, ItemDeleter(m_pDelete)));
+        m_size++;
+    }
+
+    // Calls function(&pItem) with every item that no copy of this list
+    // shares. The items can't be copied, so the shared ones are skipped. If
+    // function replaces pItem, it has deleted the old item, and the list
+    // deletes the new one.
+    template <typename Function>
+    void for_each_unshared(Function function) {
+        for (size_t i = 0; i < m_chunks.size(); i++) {
+            if (m_chunks[i].use_count() > 1) {
+                continue;
+            }
+            for (typename Chunk::iterator item = m_chunks[i]->begin(); item != m_chunks[i]->end(); ++item) {
+                if (item->use_count() > 1) {
+                    continue;
+                }
+                T *pItem = item->get();
+                function(&pItem);
+                if (pItem != item->get()) {
+                    std::get_deleter<ItemDeleter>(*item)->m_pDelete = nullptr;
+                    *item = std::shared_ptr<T>(pItem, ItemDeleter(m_pDelete));
+                }
+            }
+        }
+    }
+
+    void clear() {
+        m_chunks.clear();
+        m_size = 0;
+    }
+
+   private:
+    DeleteFunction m_pDelete;
+    size_t m_size;
+    std::vector<std::shared_ptr<Chunk>> m_chunks;
+};
+
+template <typename T>
+const size_t CopyOnWriteList<T>::kChunkSize;
+
+}  // namespace trim
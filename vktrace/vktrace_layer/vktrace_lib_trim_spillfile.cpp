@@ -0,0 +1,113 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#include "vktrace_lib_trim_spillfile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "vktrace_common.h"
+
+namespace trim {
+
+//-------------------------------------------------------------------------
+SpillFile::SpillFile() : m_pFile(nullptr), m_size(0) { vktrace_create_critical_section(&m_lock); }
+
+//-------------------------------------------------------------------------
+SpillFile::~SpillFile() {
+    close();
+    vktrace_delete_critical_section(&m_lock);
+}
+
+//-------------------------------------------------------------------------
+bool SpillFile::open() {
+    vktrace_enter_critical_section(&m_lock);
+    if (m_pFile == nullptr) {
+        m_pFile = tmpfile();
+        m_size = 0;
+    }
+    bool result = (m_pFile != nullptr);
+    vktrace_leave_critical_section(&m_lock);
+    return result;
+}
+
+//-------------------------------------------------------------------------
+void SpillFile::close() {
+    vktrace_enter_critical_section(&m_lock);
+    if (m_pFile != nullptr) {
+        fclose(m_pFile);
+        m_pFile = nullptr;
+        m_size = 0;
+    }
+    vktrace_leave_critical_section(&m_lock);
+}
+
+//-------------------------------------------------------------------------
+vktrace_trace_packet_header *SpillFile::spill(const vktrace_trace_packet_header *pHeader) {
+    assert(!is_spilled(pHeader));
+
+    vktrace_enter_critical_section(&m_lock);
+    Location location = {m_size, pHeader->size};
+    bool written = m_pFile != nullptr && Fseek(m_pFile, location.offset, SEEK_SET) == 0 &&
+                   fwrite(pHeader, (size_t)location.size, 1, m_pFile) == 1;
+    if (written) {
+        m_size += location.size;
+    }
+    vktrace_leave_critical_section(&m_lock);
+    if (!written) {
+        return nullptr;
+    }
+
+    // The stand-in keeps the header of the packet, so that it is as old as
+    // the packet was.
+    uint64_t standInSize = sizeof(vktrace_trace_packet_header) + sizeof(Location);
+    vktrace_trace_packet_header *pStandIn = static_cast<vktrace_trace_packet_header *>(malloc((size_t)standInSize));
+    if (pStandIn != nullptr) {
+        *pStandIn = *pHeader;
+        pStandIn->size = standInSize;
+        pStandIn->packet_id = VKTRACE_TPI_MARKER_TRIM_SPILLED_PACKET;
+        pStandIn->next_buffers_offset = standInSize;
+        pStandIn->pBody = (uintptr_t)(pStandIn + 1);
+        memcpy(pStandIn + 1, &location, sizeof(location));
+    }
+    return pStandIn;
+}
+
+//-------------------------------------------------------------------------
+vktrace_trace_packet_header *SpillFile::load(const vktrace_trace_packet_header *pStandIn) {
+    assert(is_spilled(pStandIn));
+
+    Location location;
+    memcpy(&location, pStandIn + 1, sizeof(location));
+    vktrace_trace_packet_header *pHeader = static_cast<vktrace_trace_packet_header *>(malloc((size_t)location.size));
+    if (pHeader == nullptr) {
+        return nullptr;
+    }
+
+    vktrace_enter_critical_section(&m_lock);
+    bool read = m_pFile != nullptr && Fseek(m_pFile, location.offset, SEEK_SET) == 0 &&
+                fread(pHeader, (size_t)location.size, 1, m_pFile) == 1;
+    vktrace_leave_critical_section(&m_lock);
+    if (!read) {
+        free(pHeader);
+        return nullptr;
+    }
+
+    // The body pointer was only valid where the packet was spilled from.
+    pHeader->pBody = (uintptr_t)(pHeader + 1);
+    return pHeader;
+}
+
+}  // namespace trim
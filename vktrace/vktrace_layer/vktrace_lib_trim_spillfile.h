@@ -0,0 +1,76 @@
+/*
+* Copyright (c) 2018 LunarG, Inc. All rights reserved.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+*     http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "vktrace_platform.h"
+#include "vktrace_trace_packet_identifiers.h"
+
+namespace trim {
+
+//-------------------------------------------------------------------------
+// A scratch file that packets kept by the state tracker are moved to when
+// the tracker grows past its memory budget.
+//
+// spill() writes a packet to the file and returns a small packet that stands
+// in for it, whose packet_id is VKTRACE_TPI_MARKER_TRIM_SPILLED_PACKET. The
+// stand-in is allocated with malloc like the packets of copy_packet(), so
+// it can be copied with copy_packet() and deleted with
+// vktrace_delete_trace_packet(), and every copy loads the same bytes. Only
+// load() looks inside it, so the state tracker can keep it wherever it kept
+// the packet until the packet has to be written to the trace file.
+//
+// The file is only ever appended to, the space of spilled packets that are
+// deleted again isn't reused. It is removed when it is closed.
+//-------------------------------------------------------------------------
+class SpillFile {
+   public:
+    SpillFile();
+    ~SpillFile();
+
+    // Creates the file, returns false if it can't be created.
+    bool open();
+    void close();
+    bool is_open() const { return m_pFile != nullptr; }
+
+    // Returns the stand-in of pHeader, or nullptr if it can't be written.
+    // pHeader is left alone either way.
+    vktrace_trace_packet_header *spill(const vktrace_trace_packet_header *pHeader);
+
+    // Returns a copy of the packet that pStandIn stands in for, to be deleted
+    // with vktrace_delete_trace_packet(), or nullptr if it can't be read.
+    vktrace_trace_packet_header *load(const vktrace_trace_packet_header *pStandIn);
+
+    static bool is_spilled(const vktrace_trace_packet_header *pHeader) {
+        return pHeader != nullptr && pHeader->packet_id == VKTRACE_TPI_MARKER_TRIM_SPILLED_PACKET;
+    }
+
+    uint64_t get_size() const { return m_size; }
+
+   private:
+    struct Location {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    VKTRACE_CRITICAL_SECTION m_lock;
+    FILE *m_pFile;
+    uint64_t m_size;
+};
+
+}  // namespace trim
@@ -17,9 +17,6 @@
 #include "vktrace_lib_trim.h"
 
 namespace trim {
-// declared extern in statetracker.h
-VKTRACE_CRITICAL_SECTION trimTransitionMapLock;
-
 //-------------------------------------------------------------------------
 #define COPY_PACKET(packet) packet = copy_packet(packet)
 
@@ -38,234 +35,986 @@ vktrace_trace_packet_header *copy_packet(vktrace_trace_packet_header *pHeader) {
 
 //-------------------------------------------------------------------------
 void StateTracker::AddImageTransition(VkCommandBuffer commandBuffer, ImageTransition transition) {
-    vktrace_enter_critical_section(&trimTransitionMapLock);
     m_cmdBufferToImageTransitionsMap[commandBuffer].push_back(transition);
-    vktrace_leave_critical_section(&trimTransitionMapLock);
 }
 
 //-------------------------------------------------------------------------
-void StateTracker::ClearImageTransitions(VkCommandBuffer commandBuffer) {
-    vktrace_enter_critical_section(&trimTransitionMapLock);
-    m_cmdBufferToImageTransitionsMap[commandBuffer].clear();
-    m_cmdBufferToImageTransitionsMap.erase(commandBuffer);
-    vktrace_leave_critical_section(&trimTransitionMapLock);
-}
+void StateTracker::ClearImageTransitions(VkCommandBuffer commandBuffer) { m_cmdBufferToImageTransitionsMap.erase(commandBuffer); }
 
 //-------------------------------------------------------------------------
 void StateTracker::AddBufferTransition(VkCommandBuffer commandBuffer, BufferTransition transition) {
-    vktrace_enter_critical_section(&trimTransitionMapLock);
     m_cmdBufferToBufferTransitionsMap[commandBuffer].push_back(transition);
-    vktrace_leave_critical_section(&trimTransitionMapLock);
 }
 
-void StateTracker::ClearBufferTransitions(VkCommandBuffer commandBuffer) {
-    vktrace_enter_critical_section(&trimTransitionMapLock);
-    m_cmdBufferToBufferTransitionsMap[commandBuffer].clear();
-    m_cmdBufferToBufferTransitionsMap.erase(commandBuffer);
-    vktrace_leave_critical_section(&trimTransitionMapLock);
-}
+void StateTracker::ClearBufferTransitions(VkCommandBuffer commandBuffer) { m_cmdBufferToBufferTransitionsMap.erase(commandBuffer); }
 
 //-------------------------------------------------------------------------
-StateTracker::StateTracker() {}
+// Copy and delete functions for the object maps. A map copies an ObjectInfo
+// the first time it changes an entry that it still shares with another
+// StateTracker, and deletes it once no StateTracker holds the entry.
+//-------------------------------------------------------------------------
+static void copy_Instance_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Instance.pCreatePacket);
+    COPY_PACKET(pDst->ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
+    COPY_PACKET(pDst->ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
+}
 
-StateTracker::StateTracker(const StateTracker &other) { *this = other; }
+static void delete_Instance_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pCreatePacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
+}
 
-//-------------------------------------------------------------------------
-StateTracker::~StateTracker() { clear(); }
+static void copy_PhysicalDevice_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
+    COPY_PACKET(pDst->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
+}
+
+static void delete_PhysicalDevice_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
+}
+
+static void copy_Device_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Device.pCreatePacket);
 
-//-------------------------------------------------------------------------
-void StateTracker::add_CommandBuffer_call(VkCommandBuffer commandBuffer, vktrace_trace_packet_header *pHeader) {
-    if (pHeader != NULL) {
-        m_cmdBufferPackets[commandBuffer].push_back(pHeader);
+    const trim::QueueFamily *pExistingFamilies = src.ObjectInfo.Device.pQueueFamilies;
+
+    pDst->ObjectInfo.Device.pQueueFamilies = VKTRACE_NEW_ARRAY(trim::QueueFamily, src.ObjectInfo.Device.queueFamilyCount);
+    for (uint32_t family = 0; family < src.ObjectInfo.Device.queueFamilyCount; family++) {
+        uint32_t count = pExistingFamilies[family].count;
+        pDst->ObjectInfo.Device.pQueueFamilies[family].count = count;
+        pDst->ObjectInfo.Device.pQueueFamilies[family].queues = VKTRACE_NEW_ARRAY(VkQueue, count);
+
+        for (uint32_t q = 0; q < count; q++) {
+            VkQueue queue = pExistingFamilies[family].queues[q];
+            pDst->ObjectInfo.Device.pQueueFamilies[family].queues[q] = queue;
+        }
     }
 }
 
-//-------------------------------------------------------------------------
-void StateTracker::remove_CommandBuffer_calls(VkCommandBuffer commandBuffer) {
-    std::unordered_map<VkCommandBuffer, std::list<vktrace_trace_packet_header *>>::iterator cmdBufferMap =
-        m_cmdBufferPackets.find(commandBuffer);
-    if (cmdBufferMap != m_cmdBufferPackets.end()) {
-        for (auto packet = cmdBufferMap->second.begin(); packet != cmdBufferMap->second.end(); ++packet) {
-            vktrace_trace_packet_header *pHeader = *packet;
-            vktrace_delete_trace_packet(&pHeader);
-        }
-        cmdBufferMap->second.clear();
+static void delete_Device_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Device.pCreatePacket);
 
-        m_cmdBufferPackets.erase(commandBuffer);
+    for (uint32_t family = 0; family < pInfo->ObjectInfo.Device.queueFamilyCount; family++) {
+        VKTRACE_DELETE(pInfo->ObjectInfo.Device.pQueueFamilies[family].queues);
     }
+    VKTRACE_DELETE(pInfo->ObjectInfo.Device.pQueueFamilies);
 }
 
-#if TRIM_USE_ORDERED_IMAGE_CREATION
-void StateTracker::add_Image_call(vktrace_trace_packet_header *pHeader) { m_image_calls.push_back(pHeader); }
-#endif  // TRIM_USE_ORDERED_IMAGE_CREATION
+static void copy_SurfaceKHR_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.SurfaceKHR.pCreatePacket);
+}
 
-//-------------------------------------------------------------------------
-void StateTracker::clear() {
-    while (createdInstances.size() != 0) {
-        remove_Instance(reinterpret_cast<const VkInstance>(createdInstances.begin()->first));
-    }
+static void delete_SurfaceKHR_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.SurfaceKHR.pCreatePacket);
+}
 
-    while (createdPhysicalDevices.size() != 0) {
-        remove_PhysicalDevice(reinterpret_cast<VkPhysicalDevice>(createdPhysicalDevices.begin()->first));
-    }
+static void copy_CommandPool_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.CommandPool.pCreatePacket);
+}
 
-    while (createdDevices.size() != 0) {
-        remove_Device(reinterpret_cast<VkDevice>(reinterpret_cast<void *>(createdDevices.begin()->first)));
-    }
+static void delete_CommandPool_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.CommandPool.pCreatePacket);
+}
 
-    while (createdSurfaceKHRs.size() != 0) {
-        remove_SurfaceKHR(createdSurfaceKHRs.begin()->first);
-    }
+static void copy_DescriptorPool_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.DescriptorPool.pCreatePacket);
+}
+
+static void delete_DescriptorPool_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorPool.pCreatePacket);
+}
+
+static void copy_SwapchainKHR_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.SwapchainKHR.pCreatePacket);
+    COPY_PACKET(pDst->ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
+    COPY_PACKET(pDst->ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
+}
+
+static void delete_SwapchainKHR_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pCreatePacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
+}
+
+static void copy_RenderPass_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.RenderPass.pCreatePacket);
+}
+
+static void delete_RenderPass_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.RenderPass.pCreatePacket);
+}
+
+static void copy_PipelineCache_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.PipelineCache.pCreatePacket);
+}
+
+static void delete_PipelineCache_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PipelineCache.pCreatePacket);
+}
+
+static void copy_Pipeline_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
 
-    while (createdCommandPools.size() != 0) {
-        remove_CommandPool(createdCommandPools.begin()->first);
+    vktrace_trace_packet_header **pShaderModuleCreatePackets =
+        VKTRACE_NEW_ARRAY(vktrace_trace_packet_header *, src.ObjectInfo.Pipeline.shaderModuleCreatePacketCount);
+    for (uint32_t stageIndex = 0; stageIndex < src.ObjectInfo.Pipeline.shaderModuleCreatePacketCount; stageIndex++) {
+        pShaderModuleCreatePackets[stageIndex] = copy_packet(src.ObjectInfo.Pipeline.pShaderModuleCreatePackets[stageIndex]);
     }
+    pDst->ObjectInfo.Pipeline.pShaderModuleCreatePackets = pShaderModuleCreatePackets;
 
-    while (createdCommandBuffers.size() != 0) {
-        remove_CommandBuffer(reinterpret_cast<VkCommandBuffer>(reinterpret_cast<void *>(createdCommandBuffers.begin()->first)));
+    if (src.ObjectInfo.Pipeline.isGraphicsPipeline) {
+        StateTracker::copy_VkGraphicsPipelineCreateInfo(&pDst->ObjectInfo.Pipeline.graphicsPipelineCreateInfo,
+                                                        src.ObjectInfo.Pipeline.graphicsPipelineCreateInfo);
+    } else {
+        StateTracker::copy_VkComputePipelineCreateInfo(&pDst->ObjectInfo.Pipeline.computePipelineCreateInfo,
+                                                       src.ObjectInfo.Pipeline.computePipelineCreateInfo);
     }
+}
 
-    while (createdDescriptorPools.size() != 0) {
-        remove_DescriptorPool(createdDescriptorPools.begin()->first);
+static void delete_Pipeline_objectInfo(ObjectInfo *pInfo) {
+    for (uint32_t i = 0; i < pInfo->ObjectInfo.Pipeline.shaderModuleCreatePacketCount; i++) {
+        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Pipeline.pShaderModuleCreatePackets[i]);
     }
+    VKTRACE_DELETE(pInfo->ObjectInfo.Pipeline.pShaderModuleCreatePackets);
+    pInfo->ObjectInfo.Pipeline.shaderModuleCreatePacketCount = 0;
+
+    StateTracker::delete_VkPipelineShaderStageCreateInfo(&pInfo->ObjectInfo.Pipeline.computePipelineCreateInfo.stage);
 
-    while (createdRenderPasss.size() != 0) {
-        remove_RenderPass(createdRenderPasss.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages != nullptr) {
+        for (uint32_t i = 0; i < pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.stageCount; ++i) {
+            StateTracker::delete_VkPipelineShaderStageCreateInfo(
+                const_cast<VkPipelineShaderStageCreateInfo *>(&pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages[i]));
+        }
+
+        delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages;
     }
 
-    while (createdPipelineCaches.size() != 0) {
-        remove_PipelineCache(createdPipelineCaches.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState != nullptr) {
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexAttributeDescriptions != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexAttributeDescriptions;
+        }
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexBindingDescriptions != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexBindingDescriptions;
+        }
+
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState;
     }
 
-    while (createdPipelines.size() != 0) {
-        remove_Pipeline(createdPipelines.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pInputAssemblyState != nullptr) {
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pInputAssemblyState;
     }
 
-    while (createdQueues.size() != 0) {
-        remove_Queue(reinterpret_cast<const VkQueue>(createdQueues.begin()->first));
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pTessellationState != nullptr) {
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pTessellationState;
     }
 
-    while (createdSemaphores.size() != 0) {
-        remove_Semaphore(createdSemaphores.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState != nullptr) {
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pViewports != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pViewports;
+        }
+
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pScissors != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pScissors;
+        }
+
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState;
     }
 
-    while (createdDeviceMemorys.size() != 0) {
-        remove_DeviceMemory(createdDeviceMemorys.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pRasterizationState != nullptr) {
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pRasterizationState;
     }
 
-    while (createdFences.size() != 0) {
-        remove_Fence(createdFences.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState != nullptr) {
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState->pSampleMask != nullptr) {
+            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState->pSampleMask;
+        }
+
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState;
     }
 
-    while (createdSwapchainKHRs.size() != 0) {
-        remove_SwapchainKHR(createdSwapchainKHRs.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDepthStencilState != nullptr) {
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDepthStencilState;
     }
 
-    while (createdImages.size() != 0) {
-        remove_Image(createdImages.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState != nullptr) {
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState->pAttachments != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState->pAttachments;
+        }
+
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState;
     }
 
-    while (createdImageViews.size() != 0) {
-        remove_ImageView(createdImageViews.begin()->first);
+    if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState != nullptr) {
+        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState->pDynamicStates != nullptr) {
+            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState->pDynamicStates;
+        }
+
+        delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState;
     }
+}
+
+static void copy_Queue_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Queue.pCreatePacket);
+}
+
+static void delete_Queue_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Queue.pCreatePacket);
+}
+
+static void copy_Semaphore_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Semaphore.pCreatePacket);
+}
+
+static void delete_Semaphore_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Semaphore.pCreatePacket);
+}
+
+static void copy_DeviceMemory_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.DeviceMemory.pCreatePacket);
+    COPY_PACKET(pDst->ObjectInfo.DeviceMemory.pMapMemoryPacket);
+    COPY_PACKET(pDst->ObjectInfo.DeviceMemory.pUnmapMemoryPacket);
+    COPY_PACKET(pDst->ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
+}
+
+static void delete_DeviceMemory_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pCreatePacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pMapMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pUnmapMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
+}
+
+static void copy_Image_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Image.pCreatePacket);
+    COPY_PACKET(pDst->ObjectInfo.Image.pMapMemoryPacket);
+    COPY_PACKET(pDst->ObjectInfo.Image.pUnmapMemoryPacket);
+#if !TRIM_USE_ORDERED_IMAGE_CREATION
+    COPY_PACKET(pDst->ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
+#endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
+    COPY_PACKET(pDst->ObjectInfo.Image.pBindImageMemoryPacket);
+}
+
+static void delete_Image_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pCreatePacket);
+#if !TRIM_USE_ORDERED_IMAGE_CREATION
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
+#endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pBindImageMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pMapMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pUnmapMemoryPacket);
+}
+
+static void copy_ImageView_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.ImageView.pCreatePacket);
+}
+
+static void delete_ImageView_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.ImageView.pCreatePacket);
+}
+
+static void copy_Buffer_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Buffer.pCreatePacket);
+    COPY_PACKET(pDst->ObjectInfo.Buffer.pBindBufferMemoryPacket);
+    COPY_PACKET(pDst->ObjectInfo.Buffer.pMapMemoryPacket);
+    COPY_PACKET(pDst->ObjectInfo.Buffer.pUnmapMemoryPacket);
+}
+
+static void delete_Buffer_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pCreatePacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pBindBufferMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pMapMemoryPacket);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pUnmapMemoryPacket);
+}
+
+static void copy_BufferView_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.BufferView.pCreatePacket);
+}
+
+static void delete_BufferView_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.BufferView.pCreatePacket);
+}
 
-    while (createdBuffers.size() != 0) {
-        remove_Buffer(createdBuffers.begin()->first);
+static void copy_Framebuffer_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Framebuffer.pCreatePacket);
+}
+
+static void delete_Framebuffer_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Framebuffer.pCreatePacket);
+}
+
+static void copy_Event_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Event.pCreatePacket);
+}
+
+static void delete_Event_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Event.pCreatePacket);
+}
+
+static void copy_QueryPool_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.QueryPool.pCreatePacket);
+
+    uint32_t queryCount = src.ObjectInfo.QueryPool.size;
+    if (queryCount > 0) {
+        bool *tmp = new bool[queryCount];
+        memcpy(tmp, src.ObjectInfo.QueryPool.pResultsAvailable, queryCount * sizeof(bool));
+        pDst->ObjectInfo.QueryPool.pResultsAvailable = tmp;
+    } else {
+        pDst->ObjectInfo.QueryPool.pResultsAvailable = nullptr;
     }
+}
 
-    while (createdBufferViews.size() != 0) {
-        remove_BufferView(createdBufferViews.begin()->first);
+static void delete_QueryPool_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.QueryPool.pCreatePacket);
+    pInfo->ObjectInfo.QueryPool.size = 0;
+    if (pInfo->ObjectInfo.QueryPool.pResultsAvailable != nullptr) {
+        delete[] pInfo->ObjectInfo.QueryPool.pResultsAvailable;
+        pInfo->ObjectInfo.QueryPool.pResultsAvailable = nullptr;
     }
+}
+
+static void copy_ShaderModule_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.ShaderModule.pCreatePacket);
+}
 
-    while (createdFramebuffers.size() != 0) {
-        remove_Framebuffer(createdFramebuffers.begin()->first);
+static void delete_ShaderModule_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.ShaderModule.pCreatePacket);
+}
+
+static void copy_PipelineLayout_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.PipelineLayout.pCreatePacket);
+
+    if (src.ObjectInfo.PipelineLayout.pDescriptorSetLayouts != nullptr) {
+        VkDescriptorSetLayout *pLayouts = new VkDescriptorSetLayout[src.ObjectInfo.PipelineLayout.descriptorSetLayoutCount];
+        memcpy(pLayouts, src.ObjectInfo.PipelineLayout.pDescriptorSetLayouts,
+               src.ObjectInfo.PipelineLayout.descriptorSetLayoutCount * sizeof(VkDescriptorSetLayout));
+        pDst->ObjectInfo.PipelineLayout.pDescriptorSetLayouts = pLayouts;
     }
+}
 
-    while (createdEvents.size() != 0) {
-        remove_Event(createdEvents.begin()->first);
+static void delete_PipelineLayout_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.PipelineLayout.pCreatePacket);
+    if (pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts != nullptr) {
+        delete[] pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts;
+        pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts = nullptr;
+        pInfo->ObjectInfo.PipelineLayout.descriptorSetLayoutCount = 0;
     }
+}
+
+static void copy_Sampler_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.Sampler.pCreatePacket);
+}
+
+static void delete_Sampler_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.Sampler.pCreatePacket);
+}
+
+static void copy_DescriptorSetLayout_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.DescriptorSetLayout.pCreatePacket);
 
-    while (createdQueryPools.size() != 0) {
-        remove_QueryPool(createdQueryPools.begin()->first);
+    uint32_t bindingCount = src.ObjectInfo.DescriptorSetLayout.bindingCount;
+    if (bindingCount > 0) {
+        VkDescriptorSetLayoutBinding *tmp = new VkDescriptorSetLayoutBinding[bindingCount];
+        memcpy(tmp, src.ObjectInfo.DescriptorSetLayout.pBindings, bindingCount * sizeof(VkDescriptorSetLayoutBinding));
+        pDst->ObjectInfo.DescriptorSetLayout.pBindings = tmp;
+    } else {
+        pDst->ObjectInfo.DescriptorSetLayout.pBindings = nullptr;
     }
+}
+
+static void delete_DescriptorSetLayout_objectInfo(ObjectInfo *pInfo) {
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorSetLayout.pCreatePacket);
 
-    while (createdShaderModules.size() != 0) {
-        remove_ShaderModule(createdShaderModules.begin()->first);
+    if (pInfo->ObjectInfo.DescriptorSetLayout.pBindings != nullptr) {
+        delete[] pInfo->ObjectInfo.DescriptorSetLayout.pBindings;
+        pInfo->ObjectInfo.DescriptorSetLayout.pBindings = nullptr;
+        pInfo->ObjectInfo.DescriptorSetLayout.bindingCount = 0;
     }
+}
 
-    while (createdPipelineLayouts.size() != 0) {
-        remove_PipelineLayout(createdPipelineLayouts.begin()->first);
+static void copy_DescriptorSet_objectInfo(ObjectInfo *pDst, const ObjectInfo &src) {
+    *pDst = src;
+    COPY_PACKET(pDst->ObjectInfo.DescriptorSet.pBindingsPacket);
+
+    uint32_t numBindings = src.ObjectInfo.DescriptorSet.numBindings;
+    if (numBindings > 0 && src.ObjectInfo.DescriptorSet.pWriteDescriptorSets != nullptr) {
+        VkWriteDescriptorSet *tmp = new VkWriteDescriptorSet[numBindings];
+        memcpy(tmp, src.ObjectInfo.DescriptorSet.pWriteDescriptorSets, numBindings * sizeof(VkWriteDescriptorSet));
+        pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets = tmp;
+
+        for (uint32_t s = 0; s < numBindings; s++) {
+            uint32_t count = pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].descriptorCount;
+
+            if (pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo != nullptr) {
+                VkDescriptorImageInfo *pTmp = new VkDescriptorImageInfo[count];
+                memcpy(pTmp, pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo,
+                       count * sizeof(VkDescriptorImageInfo));
+                pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo = pTmp;
+            }
+            if (pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo != nullptr) {
+                VkDescriptorBufferInfo *pTmp = new VkDescriptorBufferInfo[count];
+                memcpy(pTmp, pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo,
+                       count * sizeof(VkDescriptorBufferInfo));
+                pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo = pTmp;
+            }
+            if (pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView != nullptr) {
+                VkBufferView *pTmp = new VkBufferView[count];
+                memcpy(pTmp, pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView,
+                       count * sizeof(VkBufferView));
+                pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView = pTmp;
+            }
+        }
+    } else {
+        pDst->ObjectInfo.DescriptorSet.pWriteDescriptorSets = nullptr;
     }
 
-    while (createdSamplers.size() != 0) {
-        remove_Sampler(createdSamplers.begin()->first);
+    if (numBindings > 0 && src.ObjectInfo.DescriptorSet.pCopyDescriptorSets != nullptr) {
+        VkCopyDescriptorSet *tmp = new VkCopyDescriptorSet[numBindings];
+        memcpy(tmp, src.ObjectInfo.DescriptorSet.pCopyDescriptorSets, numBindings * sizeof(VkCopyDescriptorSet));
+        pDst->ObjectInfo.DescriptorSet.pCopyDescriptorSets = tmp;
+    } else {
+        pDst->ObjectInfo.DescriptorSet.pCopyDescriptorSets = nullptr;
     }
+}
 
-    while (createdDescriptorSetLayouts.size() != 0) {
-        remove_DescriptorSetLayout(createdDescriptorSetLayouts.begin()->first);
+static void delete_DescriptorSet_bindings(ObjectInfo *pInfo) {
+    if (pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets != nullptr) {
+        delete[] pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets;
+        pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets = nullptr;
     }
+    if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets != nullptr) {
+        for (uint32_t s = 0; s < pInfo->ObjectInfo.DescriptorSet.numBindings; s++) {
+            if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo != nullptr) {
+                delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo;
+                pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo = nullptr;
+            }
+            if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo != nullptr) {
+                delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo;
+                pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo = nullptr;
+            }
+            if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView != nullptr) {
+                delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView;
+                pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView = nullptr;
+            }
+        }
 
-    while (createdDescriptorSets.size() != 0) {
-        remove_DescriptorSet(createdDescriptorSets.begin()->first);
+        delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets;
+        pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets = nullptr;
     }
+}
 
-    for (auto iter = m_cmdBufferPackets.begin(); iter != m_cmdBufferPackets.end(); ++iter) {
-        std::list<vktrace_trace_packet_header *> &packets = iter->second;
-        for (auto packetIter = iter->second.begin(); packetIter != iter->second.end(); ++packetIter) {
-            vktrace_trace_packet_header *pHeader = *packetIter;
-            vktrace_delete_trace_packet(&pHeader);
-        }
-        packets.clear();
+static void delete_DescriptorSet_objectInfo(ObjectInfo *pInfo) {
+    delete_DescriptorSet_bindings(pInfo);
+    vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorSet.pBindingsPacket);
+}
+
+//-------------------------------------------------------------------------
+static void copy_CommandBuffer_calls(std::list<vktrace_trace_packet_header *> *pDst,
+                                     const std::list<vktrace_trace_packet_header *> &src) {
+    for (auto packetIter = src.cbegin(); packetIter != src.cend(); ++packetIter) {
+        pDst->push_back(copy_packet(*packetIter));
     }
-    m_cmdBufferPackets.clear();
+}
 
-    for (auto packet = m_image_calls.begin(); packet != m_image_calls.end(); ++packet) {
+static void delete_CommandBuffer_calls(std::list<vktrace_trace_packet_header *> *pPackets) {
+    for (auto packet = pPackets->begin(); packet != pPackets->end(); ++packet) {
         vktrace_trace_packet_header *pHeader = *packet;
         vktrace_delete_trace_packet(&pHeader);
     }
-    m_image_calls.clear();
+    pPackets->clear();
+}
 
-    for (auto renderPassIter = m_renderPassVersions.begin(); renderPassIter != m_renderPassVersions.end(); ++renderPassIter) {
-        std::vector<VkRenderPassCreateInfo *> versions = renderPassIter->second;
+static void delete_Image_call(vktrace_trace_packet_header *pHeader) { vktrace_delete_trace_packet(&pHeader); }
 
-        for (uint32_t i = 0; i < versions.size(); i++) {
-            VkRenderPassCreateInfo *pCreateInfo = versions[i];
+//-------------------------------------------------------------------------
+static void copy_RenderPass_versions(std::vector<VkRenderPassCreateInfo *> *pDst,
+                                     const std::vector<VkRenderPassCreateInfo *> &src) {
+    for (uint32_t i = 0; i < src.size(); i++) {
+        VkRenderPassCreateInfo *pCopiedCreateInfo = static_cast<VkRenderPassCreateInfo *>(VKTRACE_NEW(VkRenderPassCreateInfo));
+        StateTracker::copy_VkRenderPassCreateInfo(pCopiedCreateInfo, *src[i]);
+        pDst->push_back(pCopiedCreateInfo);
+    }
+}
 
-            for (uint32_t subpass = 0; subpass < pCreateInfo->subpassCount; subpass++) {
-                if (pCreateInfo->pSubpasses[subpass].inputAttachmentCount > 0 &&
-                    pCreateInfo->pSubpasses[subpass].pInputAttachments != nullptr) {
-                    VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pInputAttachments));
-                }
+static void delete_RenderPass_versions(std::vector<VkRenderPassCreateInfo *> *pVersions) {
+    for (uint32_t i = 0; i < pVersions->size(); i++) {
+        VkRenderPassCreateInfo *pCreateInfo = (*pVersions)[i];
 
-                if (pCreateInfo->pSubpasses[subpass].colorAttachmentCount > 0) {
-                    if (pCreateInfo->pSubpasses[subpass].pColorAttachments != nullptr) {
-                        VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pColorAttachments));
-                    }
+        for (uint32_t subpass = 0; subpass < pCreateInfo->subpassCount; subpass++) {
+            if (pCreateInfo->pSubpasses[subpass].inputAttachmentCount > 0 &&
+                pCreateInfo->pSubpasses[subpass].pInputAttachments != nullptr) {
+                VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pInputAttachments));
+            }
 
-                    if (pCreateInfo->pSubpasses[subpass].pResolveAttachments != nullptr) {
-                        VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pResolveAttachments));
-                    }
+            if (pCreateInfo->pSubpasses[subpass].colorAttachmentCount > 0) {
+                if (pCreateInfo->pSubpasses[subpass].pColorAttachments != nullptr) {
+                    VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pColorAttachments));
                 }
 
-                if (pCreateInfo->pSubpasses[subpass].pDepthStencilAttachment != nullptr) {
-                    VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pDepthStencilAttachment));
+                if (pCreateInfo->pSubpasses[subpass].pResolveAttachments != nullptr) {
+                    VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pResolveAttachments));
                 }
+            }
 
-                if (pCreateInfo->pSubpasses[subpass].preserveAttachmentCount > 0 &&
-                    pCreateInfo->pSubpasses[subpass].pPreserveAttachments != nullptr) {
-                    VKTRACE_DELETE(const_cast<uint32_t *>(pCreateInfo->pSubpasses[subpass].pPreserveAttachments));
-                }
+            if (pCreateInfo->pSubpasses[subpass].pDepthStencilAttachment != nullptr) {
+                VKTRACE_DELETE(const_cast<VkAttachmentReference *>(pCreateInfo->pSubpasses[subpass].pDepthStencilAttachment));
             }
 
-            if (pCreateInfo->pAttachments != nullptr) {
-                VKTRACE_DELETE(const_cast<VkAttachmentDescription *>(pCreateInfo->pAttachments));
+            if (pCreateInfo->pSubpasses[subpass].preserveAttachmentCount > 0 &&
+                pCreateInfo->pSubpasses[subpass].pPreserveAttachments != nullptr) {
+                VKTRACE_DELETE(const_cast<uint32_t *>(pCreateInfo->pSubpasses[subpass].pPreserveAttachments));
             }
+        }
 
-            VKTRACE_DELETE(pCreateInfo);
+        if (pCreateInfo->pAttachments != nullptr) {
+            VKTRACE_DELETE(const_cast<VkAttachmentDescription *>(pCreateInfo->pAttachments));
         }
-        versions.clear();
+
+        VKTRACE_DELETE(pCreateInfo);
+    }
+    pVersions->clear();
+}
+
+//-------------------------------------------------------------------------
+StateTracker::StateTracker()
+    : m_cmdBufferPackets(copy_CommandBuffer_calls, delete_CommandBuffer_calls),
+      m_renderPassVersions(copy_RenderPass_versions, delete_RenderPass_versions),
+      m_image_calls(delete_Image_call),
+      createdInstances(copy_Instance_objectInfo, delete_Instance_objectInfo),
+      createdPhysicalDevices(copy_PhysicalDevice_objectInfo, delete_PhysicalDevice_objectInfo),
+      createdDevices(copy_Device_objectInfo, delete_Device_objectInfo),
+      createdSurfaceKHRs(copy_SurfaceKHR_objectInfo, delete_SurfaceKHR_objectInfo),
+      createdCommandPools(copy_CommandPool_objectInfo, delete_CommandPool_objectInfo),
+      createdDescriptorPools(copy_DescriptorPool_objectInfo, delete_DescriptorPool_objectInfo),
+      createdRenderPasss(copy_RenderPass_objectInfo, delete_RenderPass_objectInfo),
+      createdPipelineCaches(copy_PipelineCache_objectInfo, delete_PipelineCache_objectInfo),
+      createdPipelines(copy_Pipeline_objectInfo, delete_Pipeline_objectInfo),
+      createdQueues(copy_Queue_objectInfo, delete_Queue_objectInfo),
+      createdSemaphores(copy_Semaphore_objectInfo, delete_Semaphore_objectInfo),
+      createdDeviceMemorys(copy_DeviceMemory_objectInfo, delete_DeviceMemory_objectInfo),
+      createdSwapchainKHRs(copy_SwapchainKHR_objectInfo, delete_SwapchainKHR_objectInfo),
+      createdImages(copy_Image_objectInfo, delete_Image_objectInfo),
+      createdImageViews(copy_ImageView_objectInfo, delete_ImageView_objectInfo),
+      createdBuffers(copy_Buffer_objectInfo, delete_Buffer_objectInfo),
+      createdBufferViews(copy_BufferView_objectInfo, delete_BufferView_objectInfo),
+      createdFramebuffers(copy_Framebuffer_objectInfo, delete_Framebuffer_objectInfo),
+      createdEvents(copy_Event_objectInfo, delete_Event_objectInfo),
+      createdQueryPools(copy_QueryPool_objectInfo, delete_QueryPool_objectInfo),
+      createdShaderModules(copy_ShaderModule_objectInfo, delete_ShaderModule_objectInfo),
+      createdPipelineLayouts(copy_PipelineLayout_objectInfo, delete_PipelineLayout_objectInfo),
+      createdSamplers(copy_Sampler_objectInfo, delete_Sampler_objectInfo),
+      createdDescriptorSetLayouts(copy_DescriptorSetLayout_objectInfo, delete_DescriptorSetLayout_objectInfo),
+      createdDescriptorSets(copy_DescriptorSet_objectInfo, delete_DescriptorSet_objectInfo) {}
+
+StateTracker::StateTracker(const StateTracker &other) { *this = other; }
+
+//-------------------------------------------------------------------------
+StateTracker::~StateTracker() { clear(); }
+
+//-------------------------------------------------------------------------
+void StateTracker::add_CommandBuffer_call(VkCommandBuffer commandBuffer, vktrace_trace_packet_header *pHeader) {
+    if (pHeader != NULL) {
+        m_cmdBufferPackets[commandBuffer].push_back(pHeader);
     }
+}
+
+//-------------------------------------------------------------------------
+void StateTracker::remove_CommandBuffer_calls(VkCommandBuffer commandBuffer) { m_cmdBufferPackets.erase(commandBuffer); }
+
+#if TRIM_USE_ORDERED_IMAGE_CREATION
+void StateTracker::add_Image_call(vktrace_trace_packet_header *pHeader) { m_image_calls.push_back(pHeader); }
+#endif  // TRIM_USE_ORDERED_IMAGE_CREATION
+
+//-------------------------------------------------------------------------
+void StateTracker::clear() {
+    createdInstances.clear();
+    createdPhysicalDevices.clear();
+    createdDevices.clear();
+    createdSurfaceKHRs.clear();
+    createdCommandPools.clear();
+    createdCommandBuffers.clear();
+    createdDescriptorPools.clear();
+    createdRenderPasss.clear();
+    createdPipelineCaches.clear();
+    createdPipelines.clear();
+    createdQueues.clear();
+    createdSemaphores.clear();
+    createdDeviceMemorys.clear();
+    createdFences.clear();
+    createdSwapchainKHRs.clear();
+    createdImages.clear();
+    createdImageViews.clear();
+    createdBuffers.clear();
+    createdBufferViews.clear();
+    createdFramebuffers.clear();
+    createdEvents.clear();
+    createdQueryPools.clear();
+    createdShaderModules.clear();
+    createdPipelineLayouts.clear();
+    createdSamplers.clear();
+    createdDescriptorSetLayouts.clear();
+    createdDescriptorSets.clear();
+
+    m_cmdBufferPackets.clear();
+    m_image_calls.clear();
     m_renderPassVersions.clear();
+    m_referencedObjects.clear();
+}
+
+//-------------------------------------------------------------------------
+// Returns the size of the image, buffer or texel buffer view array of a write
+// that a descriptor set keeps.
+//-------------------------------------------------------------------------
+static uint64_t get_descriptor_info_size(const VkWriteDescriptorSet &write) {
+    uint64_t size = 0;
+    if (write.pImageInfo != nullptr) {
+        size += write.descriptorCount * sizeof(VkDescriptorImageInfo);
+    }
+    if (write.pBufferInfo != nullptr) {
+        size += write.descriptorCount * sizeof(VkDescriptorBufferInfo);
+    }
+    if (write.pTexelBufferView != nullptr) {
+        size += write.descriptorCount * sizeof(VkBufferView);
+    }
+    return size;
+}
+
+//-------------------------------------------------------------------------
+StateTracker::MemoryUsage StateTracker::get_memory_usage() {
+    MemoryUsage usage = {};
+    usage.objectCount = createdInstances.size() + createdPhysicalDevices.size() + createdDevices.size() +
+                        createdSurfaceKHRs.size() + createdCommandPools.size() + createdCommandBuffers.size() +
+                        createdDescriptorPools.size() + createdRenderPasss.size() + createdPipelineCaches.size() +
+                        createdPipelines.size() + createdQueues.size() + createdSemaphores.size() + createdDeviceMemorys.size() +
+                        createdFences.size() + createdSwapchainKHRs.size() + createdImages.size() + createdImageViews.size() +
+                        createdBuffers.size() + createdBufferViews.size() + createdFramebuffers.size() + createdEvents.size() +
+                        createdQueryPools.size() + createdShaderModules.size() + createdPipelineLayouts.size() +
+                        createdSamplers.size() + createdDescriptorSetLayouts.size() + createdDescriptorSets.size();
+
+    for (auto iter = m_cmdBufferPackets.begin(); iter != m_cmdBufferPackets.end(); ++iter) {
+        usage.commandBufferCount++;
+        for (auto packet = iter->second.cbegin(); packet != iter->second.cend(); ++packet) {
+            usage.commandBufferCallCount++;
+            usage.commandBufferCallBytes += (*packet)->size;
+        }
+    }
+
+    for (auto packet = m_image_calls.begin(); packet != m_image_calls.end(); ++packet) {
+        usage.imageCallCount++;
+        usage.imageCallBytes += (*packet)->size;
+    }
+
+    // The same packets that check_memory_budget() holds to the budget.
+    visit_packets([&usage](vktrace_trace_packet_header **ppHeader) {
+        if (*ppHeader != nullptr) {
+            usage.packetBytes += (*ppHeader)->size;
+        }
+    });
+
+    usage.totalBytes = usage.objectCount * sizeof(ObjectInfo) + usage.packetBytes;
+    return usage;
+}
+
+//-------------------------------------------------------------------------
+// Visit functions for the packets of the object maps, they visit the packets
+// that the copy functions above copy.
+//-------------------------------------------------------------------------
+static void visit_Instance_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Instance.pCreatePacket);
+    visit(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
+    visit(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
+}
+
+static void visit_PhysicalDevice_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
+    visit(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
+}
+
+static void visit_Device_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Device.pCreatePacket);
+}
+
+static void visit_SurfaceKHR_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.SurfaceKHR.pCreatePacket);
+}
+
+static void visit_CommandPool_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.CommandPool.pCreatePacket);
+}
+
+static void visit_DescriptorPool_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.DescriptorPool.pCreatePacket);
+}
+
+static void visit_SwapchainKHR_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.SwapchainKHR.pCreatePacket);
+    visit(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
+    visit(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
+}
+
+static void visit_RenderPass_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.RenderPass.pCreatePacket);
+}
+
+static void visit_PipelineCache_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.PipelineCache.pCreatePacket);
+}
+
+static void visit_Queue_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Queue.pCreatePacket);
+}
+
+static void visit_Semaphore_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Semaphore.pCreatePacket);
+}
+
+static void visit_DeviceMemory_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.DeviceMemory.pCreatePacket);
+    visit(&pInfo->ObjectInfo.DeviceMemory.pMapMemoryPacket);
+    visit(&pInfo->ObjectInfo.DeviceMemory.pUnmapMemoryPacket);
+    visit(&pInfo->ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
+}
+
+static void visit_Image_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Image.pCreatePacket);
+    visit(&pInfo->ObjectInfo.Image.pMapMemoryPacket);
+    visit(&pInfo->ObjectInfo.Image.pUnmapMemoryPacket);
+#if !TRIM_USE_ORDERED_IMAGE_CREATION
+    visit(&pInfo->ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
+#endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
+    visit(&pInfo->ObjectInfo.Image.pBindImageMemoryPacket);
+}
+
+static void visit_ImageView_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.ImageView.pCreatePacket);
+}
+
+static void visit_Buffer_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Buffer.pCreatePacket);
+    visit(&pInfo->ObjectInfo.Buffer.pBindBufferMemoryPacket);
+    visit(&pInfo->ObjectInfo.Buffer.pMapMemoryPacket);
+    visit(&pInfo->ObjectInfo.Buffer.pUnmapMemoryPacket);
+}
+
+static void visit_BufferView_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.BufferView.pCreatePacket);
+}
+
+static void visit_Framebuffer_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Framebuffer.pCreatePacket);
+}
+
+static void visit_Event_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Event.pCreatePacket);
+}
+
+static void visit_QueryPool_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.QueryPool.pCreatePacket);
+}
+
+static void visit_PipelineLayout_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.PipelineLayout.pCreatePacket);
+}
+
+static void visit_Sampler_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.Sampler.pCreatePacket);
+}
+
+static void visit_DescriptorSetLayout_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.DescriptorSetLayout.pCreatePacket);
+}
+
+static void visit_ShaderModule_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    visit(&pInfo->ObjectInfo.ShaderModule.pCreatePacket);
+}
+
+static void visit_Pipeline_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    for (uint32_t i = 0; i < pInfo->ObjectInfo.Pipeline.shaderModuleCreatePacketCount; i++) {
+        visit(&pInfo->ObjectInfo.Pipeline.pShaderModuleCreatePackets[i]);
+    }
+}
+
+static void visit_DescriptorSet_objectInfo(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit) {
+    StateTracker::pack_DescriptorSet_bindings(pInfo);
+    visit(&pInfo->ObjectInfo.DescriptorSet.pBindingsPacket);
+}
+
+template <typename Key>
+static void visit_objectInfo_packets(CopyOnWriteMap<Key, ObjectInfo> *pMap,
+                                     void (*pVisitObjectInfo)(ObjectInfo *pInfo, const StateTracker::PacketVisitor &visit),
+                                     const StateTracker::PacketVisitor &visit) {
+    pMap->for_each([&](const Key &, ObjectInfo &info) { pVisitObjectInfo(&info, visit); });
+}
+
+//-------------------------------------------------------------------------
+void StateTracker::visit_packets(const PacketVisitor &visit) {
+    visit_objectInfo_packets(&createdInstances, visit_Instance_objectInfo, visit);
+    visit_objectInfo_packets(&createdPhysicalDevices, visit_PhysicalDevice_objectInfo, visit);
+    visit_objectInfo_packets(&createdDevices, visit_Device_objectInfo, visit);
+    visit_objectInfo_packets(&createdSurfaceKHRs, visit_SurfaceKHR_objectInfo, visit);
+    visit_objectInfo_packets(&createdCommandPools, visit_CommandPool_objectInfo, visit);
+    visit_objectInfo_packets(&createdDescriptorPools, visit_DescriptorPool_objectInfo, visit);
+    visit_objectInfo_packets(&createdRenderPasss, visit_RenderPass_objectInfo, visit);
+    visit_objectInfo_packets(&createdPipelineCaches, visit_PipelineCache_objectInfo, visit);
+    visit_objectInfo_packets(&createdQueues, visit_Queue_objectInfo, visit);
+    visit_objectInfo_packets(&createdSemaphores, visit_Semaphore_objectInfo, visit);
+    visit_objectInfo_packets(&createdDeviceMemorys, visit_DeviceMemory_objectInfo, visit);
+    visit_objectInfo_packets(&createdSwapchainKHRs, visit_SwapchainKHR_objectInfo, visit);
+    visit_objectInfo_packets(&createdImages, visit_Image_objectInfo, visit);
+    visit_objectInfo_packets(&createdImageViews, visit_ImageView_objectInfo, visit);
+    visit_objectInfo_packets(&createdBuffers, visit_Buffer_objectInfo, visit);
+    visit_objectInfo_packets(&createdBufferViews, visit_BufferView_objectInfo, visit);
+    visit_objectInfo_packets(&createdFramebuffers, visit_Framebuffer_objectInfo, visit);
+    visit_objectInfo_packets(&createdEvents, visit_Event_objectInfo, visit);
+    visit_objectInfo_packets(&createdQueryPools, visit_QueryPool_objectInfo, visit);
+    visit_objectInfo_packets(&createdPipelineLayouts, visit_PipelineLayout_objectInfo, visit);
+    visit_objectInfo_packets(&createdSamplers, visit_Sampler_objectInfo, visit);
+    visit_objectInfo_packets(&createdDescriptorSetLayouts, visit_DescriptorSetLayout_objectInfo, visit);
+    visit_objectInfo_packets(&createdShaderModules, visit_ShaderModule_objectInfo, visit);
+    visit_objectInfo_packets(&createdPipelines, visit_Pipeline_objectInfo, visit);
+    visit_objectInfo_packets(&createdDescriptorSets, visit_DescriptorSet_objectInfo, visit);
+
+    m_cmdBufferPackets.for_each([&](const VkCommandBuffer &, std::list<vktrace_trace_packet_header *> &packets) {
+        for (auto packet = packets.begin(); packet != packets.end(); ++packet) {
+            visit(&*packet);
+        }
+    });
+
+    m_image_calls.for_each_unshared([&](vktrace_trace_packet_header **ppHeader) { visit(ppHeader); });
+}
+
+//-------------------------------------------------------------------------
+// The packet holds the VkWriteDescriptorSet array, then the
+// VkCopyDescriptorSet array, then the image, buffer or texel buffer view
+// array of each write that has one. The pointers of the packed writes are
+// only kept to tell which of the arrays they have.
+//-------------------------------------------------------------------------
+void StateTracker::pack_DescriptorSet_bindings(ObjectInfo *pInfo) {
+    auto &set = pInfo->ObjectInfo.DescriptorSet;
+    if (set.pBindingsPacket != nullptr || set.pWriteDescriptorSets == nullptr || set.pCopyDescriptorSets == nullptr) {
+        return;
+    }
+
+    uint64_t packetSize =
+        sizeof(vktrace_trace_packet_header) + set.numBindings * (sizeof(VkWriteDescriptorSet) + sizeof(VkCopyDescriptorSet));
+    for (uint32_t i = 0; i < set.numBindings; i++) {
+        packetSize += get_descriptor_info_size(set.pWriteDescriptorSets[i]);
+    }
+    vktrace_trace_packet_header *pHeader = static_cast<vktrace_trace_packet_header *>(malloc((size_t)packetSize));
+    if (pHeader == nullptr) {
+        return;
+    }
+
+    // The packet is as old as the packing, so that a descriptor set that is
+    // updated again soon is unpacked before it gets spilled.
+    memset(pHeader, 0, sizeof(vktrace_trace_packet_header));
+    pHeader->size = packetSize;
+    pHeader->packet_id = VKTRACE_TPI_MARKER_TRIM_DESCRIPTOR_SET;
+    pHeader->vktrace_begin_time = vktrace_get_time();
+    pHeader->vktrace_end_time = pHeader->vktrace_begin_time;
+    pHeader->next_buffers_offset = packetSize;
+    pHeader->pBody = (uintptr_t)(pHeader + 1);
+
+    uint8_t *pCursor = reinterpret_cast<uint8_t *>(pHeader + 1);
+    memcpy(pCursor, set.pWriteDescriptorSets, set.numBindings * sizeof(VkWriteDescriptorSet));
+    pCursor += set.numBindings * sizeof(VkWriteDescriptorSet);
+    memcpy(pCursor, set.pCopyDescriptorSets, set.numBindings * sizeof(VkCopyDescriptorSet));
+    pCursor += set.numBindings * sizeof(VkCopyDescriptorSet);
+    for (uint32_t i = 0; i < set.numBindings; i++) {
+        const VkWriteDescriptorSet &write = set.pWriteDescriptorSets[i];
+        if (write.pImageInfo != nullptr) {
+            memcpy(pCursor, write.pImageInfo, write.descriptorCount * sizeof(VkDescriptorImageInfo));
+            pCursor += write.descriptorCount * sizeof(VkDescriptorImageInfo);
+        }
+        if (write.pBufferInfo != nullptr) {
+            memcpy(pCursor, write.pBufferInfo, write.descriptorCount * sizeof(VkDescriptorBufferInfo));
+            pCursor += write.descriptorCount * sizeof(VkDescriptorBufferInfo);
+        }
+        if (write.pTexelBufferView != nullptr) {
+            memcpy(pCursor, write.pTexelBufferView, write.descriptorCount * sizeof(VkBufferView));
+            pCursor += write.descriptorCount * sizeof(VkBufferView);
+        }
+    }
+
+    delete_DescriptorSet_bindings(pInfo);
+    set.pBindingsPacket = pHeader;
+}
+
+//-------------------------------------------------------------------------
+void StateTracker::view_DescriptorSet_bindings(ObjectInfo *pInfo, vktrace_trace_packet_header *pBindingsPacket) {
+    assert(pBindingsPacket->packet_id == VKTRACE_TPI_MARKER_TRIM_DESCRIPTOR_SET);
+    auto &set = pInfo->ObjectInfo.DescriptorSet;
+
+    uint8_t *pCursor = reinterpret_cast<uint8_t *>(pBindingsPacket + 1);
+    set.pWriteDescriptorSets = reinterpret_cast<VkWriteDescriptorSet *>(pCursor);
+    pCursor += set.numBindings * sizeof(VkWriteDescriptorSet);
+    set.pCopyDescriptorSets = reinterpret_cast<VkCopyDescriptorSet *>(pCursor);
+    pCursor += set.numBindings * sizeof(VkCopyDescriptorSet);
+    for (uint32_t i = 0; i < set.numBindings; i++) {
+        VkWriteDescriptorSet &write = set.pWriteDescriptorSets[i];
+        if (write.pImageInfo != nullptr) {
+            write.pImageInfo = reinterpret_cast<VkDescriptorImageInfo *>(pCursor);
+            pCursor += write.descriptorCount * sizeof(VkDescriptorImageInfo);
+        }
+        if (write.pBufferInfo != nullptr) {
+            write.pBufferInfo = reinterpret_cast<VkDescriptorBufferInfo *>(pCursor);
+            pCursor += write.descriptorCount * sizeof(VkDescriptorBufferInfo);
+        }
+        if (write.pTexelBufferView != nullptr) {
+            write.pTexelBufferView = reinterpret_cast<VkBufferView *>(pCursor);
+            pCursor += write.descriptorCount * sizeof(VkBufferView);
+        }
+    }
+    assert(pCursor == reinterpret_cast<uint8_t *>(pBindingsPacket) + pBindingsPacket->size);
+}
+
+//-------------------------------------------------------------------------
+void StateTracker::unpack_DescriptorSet_bindings(ObjectInfo *pInfo, vktrace_trace_packet_header *pBindingsPacket) {
+    ObjectInfo packed = *pInfo;
+    packed.ObjectInfo.DescriptorSet.pBindingsPacket = nullptr;
+    view_DescriptorSet_bindings(&packed, pBindingsPacket);
+
+    vktrace_trace_packet_header *pOwnPacket = pInfo->ObjectInfo.DescriptorSet.pBindingsPacket;
+    copy_DescriptorSet_objectInfo(pInfo, packed);
+    vktrace_delete_trace_packet(&pOwnPacket);
 }
 
 //-------------------------------------------------------------------------
@@ -354,302 +1103,104 @@ void StateTracker::add_RenderPassCreateInfo(VkRenderPass renderPass, const VkRen
 }
 
 //-------------------------------------------------------------------------
-uint32_t StateTracker::get_RenderPassVersion(VkRenderPass renderPass) {
-    return static_cast<uint32_t>(m_renderPassVersions[renderPass].size() - 1);
+uint32_t StateTracker::get_RenderPassVersion(VkRenderPass renderPass) const {
+    const std::vector<VkRenderPassCreateInfo *> *pVersions = m_renderPassVersions.get(renderPass);
+    if (pVersions == nullptr) {
+        return static_cast<uint32_t>(-1);
+    }
+    return static_cast<uint32_t>(pVersions->size() - 1);
 }
 
 //-------------------------------------------------------------------------
-VkRenderPassCreateInfo *StateTracker::get_RenderPassCreateInfo(VkRenderPass renderPass, uint32_t version) {
-    return m_renderPassVersions[renderPass][version];
+const VkRenderPassCreateInfo *StateTracker::get_RenderPassCreateInfo(VkRenderPass renderPass, uint32_t version) const {
+    return (*m_renderPassVersions.get(renderPass))[version];
 }
 
 //-------------------------------------------------------------------------
+// The copy shares every object with other. Each side copies an object the
+// first time it changes it, so taking a snapshot doesn't depend on how many
+// objects the application has created.
 StateTracker &StateTracker::operator=(const StateTracker &other) {
     if (this == &other) return *this;
 
+    m_cmdBufferPackets = other.m_cmdBufferPackets;
     m_renderPassVersions = other.m_renderPassVersions;
-    for (auto iter = m_renderPassVersions.begin(); iter != m_renderPassVersions.end(); ++iter) {
-        for (uint32_t i = 0; i < iter->second.size(); i++) {
-            VkRenderPassCreateInfo *pCreateInfoVersion = iter->second[i];
-            VkRenderPassCreateInfo *pCopiedCreateInfo = static_cast<VkRenderPassCreateInfo *>(VKTRACE_NEW(VkRenderPassCreateInfo));
-            copy_VkRenderPassCreateInfo(pCopiedCreateInfo, *pCreateInfoVersion);
-            iter->second[i] = pCopiedCreateInfo;
-        }
-    }
-
-    for (auto iter = other.m_cmdBufferPackets.cbegin(); iter != other.m_cmdBufferPackets.cend(); ++iter) {
-        std::list<vktrace_trace_packet_header *> packets;
-        for (auto packetIter = iter->second.cbegin(); packetIter != iter->second.cend(); ++packetIter) {
-            packets.push_back(copy_packet(*packetIter));
-        }
-        m_cmdBufferPackets[iter->first] = packets;
-    }
-
-    for (auto packet = other.m_image_calls.cbegin(); packet != other.m_image_calls.cend(); ++packet) {
-        m_image_calls.push_back(copy_packet(*packet));
-    }
+    m_image_calls = other.m_image_calls;
+    m_referencedObjects = other.m_referencedObjects;
 
     createdInstances = other.createdInstances;
-    for (auto obj = createdInstances.begin(); obj != createdInstances.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Instance.pCreatePacket);
-        COPY_PACKET(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
-        COPY_PACKET(obj->second.ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
-    }
-
     createdPhysicalDevices = other.createdPhysicalDevices;
-    for (auto obj = createdPhysicalDevices.begin(); obj != createdPhysicalDevices.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDevicePropertiesPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceProperties2KHRPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
-        COPY_PACKET(obj->second.ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
-    }
-
     createdDevices = other.createdDevices;
-    for (auto obj = createdDevices.begin(); obj != createdDevices.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Device.pCreatePacket);
-
-        trim::QueueFamily *pExistingFamilies = obj->second.ObjectInfo.Device.pQueueFamilies;
-
-        obj->second.ObjectInfo.Device.pQueueFamilies =
-            VKTRACE_NEW_ARRAY(trim::QueueFamily, obj->second.ObjectInfo.Device.queueFamilyCount);
-        for (uint32_t family = 0; family < obj->second.ObjectInfo.Device.queueFamilyCount; family++) {
-            uint32_t count = pExistingFamilies[family].count;
-            obj->second.ObjectInfo.Device.pQueueFamilies[family].count = count;
-            obj->second.ObjectInfo.Device.pQueueFamilies[family].queues = VKTRACE_NEW_ARRAY(VkQueue, count);
-
-            for (uint32_t q = 0; q < count; q++) {
-                VkQueue queue = pExistingFamilies[family].queues[q];
-                obj->second.ObjectInfo.Device.pQueueFamilies[family].queues[q] = queue;
-            }
-        }
-    }
-
     createdSurfaceKHRs = other.createdSurfaceKHRs;
-    for (auto obj = createdSurfaceKHRs.begin(); obj != createdSurfaceKHRs.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.SurfaceKHR.pCreatePacket);
-    }
-
     createdCommandPools = other.createdCommandPools;
-    for (auto obj = createdCommandPools.begin(); obj != createdCommandPools.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.CommandPool.pCreatePacket);
-    }
-
     createdCommandBuffers = other.createdCommandBuffers;
-
     createdDescriptorPools = other.createdDescriptorPools;
-    for (auto obj = createdDescriptorPools.begin(); obj != createdDescriptorPools.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.DescriptorPool.pCreatePacket);
-    }
-
-    createdSwapchainKHRs = other.createdSwapchainKHRs;
-    for (auto obj = createdSwapchainKHRs.begin(); obj != createdSwapchainKHRs.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.SwapchainKHR.pCreatePacket);
-        COPY_PACKET(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
-        COPY_PACKET(obj->second.ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
-    }
-
     createdRenderPasss = other.createdRenderPasss;
-    for (auto obj = createdRenderPasss.begin(); obj != createdRenderPasss.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.RenderPass.pCreatePacket);
-    }
-
     createdPipelineCaches = other.createdPipelineCaches;
-    for (auto obj = createdPipelineCaches.begin(); obj != createdPipelineCaches.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.PipelineCache.pCreatePacket);
-    }
-
     createdPipelines = other.createdPipelines;
-    for (auto obj = createdPipelines.begin(); obj != createdPipelines.end(); obj++) {
-        VkShaderModuleCreateInfo *pShaderModuleCreateInfos =
-            VKTRACE_NEW_ARRAY(VkShaderModuleCreateInfo, obj->second.ObjectInfo.Pipeline.shaderModuleCreateInfoCount);
-        for (uint32_t stageIndex = 0; stageIndex < obj->second.ObjectInfo.Pipeline.shaderModuleCreateInfoCount; stageIndex++) {
-            trim::StateTracker::copy_VkShaderModuleCreateInfo(&pShaderModuleCreateInfos[stageIndex],
-                                                              obj->second.ObjectInfo.Pipeline.pShaderModuleCreateInfos[stageIndex]);
-        }
-        obj->second.ObjectInfo.Pipeline.pShaderModuleCreateInfos = pShaderModuleCreateInfos;
-
-        VkGraphicsPipelineCreateInfo *pCreateInfo = &obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo;
-
-        // note: Using the same memory as both the destination and the source.
-        // We're copying what is currently there, which will properly result in
-        // new copies of any pointed-to objects and arrays.
-        if (obj->second.ObjectInfo.Pipeline.isGraphicsPipeline) {
-            // here we keep the original value of source to a copy, so we can
-            // change the destination value in pCreateInfo and make it a
-            // deepcopy of the source. note: src parameter in the define of
-            // copy_VkGraphicsPipelineCreateInfo function is a reference.
-            VkGraphicsPipelineCreateInfo createInfoCopy = obj->second.ObjectInfo.Pipeline.graphicsPipelineCreateInfo;
-            copy_VkGraphicsPipelineCreateInfo(pCreateInfo, createInfoCopy);
-        } else {
-            VkComputePipelineCreateInfo createInfoCopy = obj->second.ObjectInfo.Pipeline.computePipelineCreateInfo;
-            copy_VkComputePipelineCreateInfo(
-                const_cast<VkComputePipelineCreateInfo *>(&obj->second.ObjectInfo.Pipeline.computePipelineCreateInfo),
-                createInfoCopy);
-        }
-    }
-
     createdQueues = other.createdQueues;
-    for (auto obj = createdQueues.begin(); obj != createdQueues.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Queue.pCreatePacket);
-    }
-
     createdSemaphores = other.createdSemaphores;
-    for (auto obj = createdSemaphores.begin(); obj != createdSemaphores.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Semaphore.pCreatePacket);
-    }
-
     createdDeviceMemorys = other.createdDeviceMemorys;
-    for (auto obj = createdDeviceMemorys.begin(); obj != createdDeviceMemorys.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.DeviceMemory.pCreatePacket);
-        COPY_PACKET(obj->second.ObjectInfo.DeviceMemory.pMapMemoryPacket);
-        COPY_PACKET(obj->second.ObjectInfo.DeviceMemory.pUnmapMemoryPacket);
-        COPY_PACKET(obj->second.ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
-    }
-
     createdFences = other.createdFences;
-
+    createdSwapchainKHRs = other.createdSwapchainKHRs;
     createdImages = other.createdImages;
-    for (auto obj = createdImages.begin(); obj != createdImages.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Image.pCreatePacket);
-        COPY_PACKET(obj->second.ObjectInfo.Image.pMapMemoryPacket);
-        COPY_PACKET(obj->second.ObjectInfo.Image.pUnmapMemoryPacket);
-#if !TRIM_USE_ORDERED_IMAGE_CREATION
-        COPY_PACKET(obj->second.ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
-#endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
-        COPY_PACKET(obj->second.ObjectInfo.Image.pBindImageMemoryPacket);
-    }
-
     createdImageViews = other.createdImageViews;
-    for (auto obj = createdImageViews.begin(); obj != createdImageViews.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.ImageView.pCreatePacket);
-    }
-
     createdBuffers = other.createdBuffers;
-    for (auto obj = createdBuffers.begin(); obj != createdBuffers.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Buffer.pCreatePacket);
-        COPY_PACKET(obj->second.ObjectInfo.Buffer.pBindBufferMemoryPacket);
-        COPY_PACKET(obj->second.ObjectInfo.Buffer.pMapMemoryPacket);
-        COPY_PACKET(obj->second.ObjectInfo.Buffer.pUnmapMemoryPacket);
-    }
-
     createdBufferViews = other.createdBufferViews;
-    for (auto obj = createdBufferViews.begin(); obj != createdBufferViews.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.BufferView.pCreatePacket);
-    }
-
     createdFramebuffers = other.createdFramebuffers;
-    for (auto obj = createdFramebuffers.begin(); obj != createdFramebuffers.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Framebuffer.pCreatePacket);
-    }
-
     createdEvents = other.createdEvents;
-    for (auto obj = createdEvents.begin(); obj != createdEvents.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Event.pCreatePacket);
-    }
-
     createdQueryPools = other.createdQueryPools;
-    for (auto obj = createdQueryPools.begin(); obj != createdQueryPools.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.QueryPool.pCreatePacket);
-
-        uint32_t queryCount = obj->second.ObjectInfo.QueryPool.size;
-        if (queryCount > 0) {
-            bool *tmp = new bool[queryCount];
-            memcpy(tmp, obj->second.ObjectInfo.QueryPool.pResultsAvailable, queryCount * sizeof(bool));
-            obj->second.ObjectInfo.QueryPool.pResultsAvailable = tmp;
-        } else {
-            obj->second.ObjectInfo.QueryPool.pResultsAvailable = nullptr;
-        }
-    }
-
     createdShaderModules = other.createdShaderModules;
-    for (auto obj = createdShaderModules.begin(); obj != createdShaderModules.end(); obj++) {
-        uint32_t *pCodeCopy = static_cast<uint32_t *>(malloc(obj->second.ObjectInfo.ShaderModule.createInfo.codeSize));
-        memcpy(pCodeCopy, obj->second.ObjectInfo.ShaderModule.createInfo.pCode,
-               obj->second.ObjectInfo.ShaderModule.createInfo.codeSize);
-        obj->second.ObjectInfo.ShaderModule.createInfo.pCode = pCodeCopy;
-    }
-
     createdPipelineLayouts = other.createdPipelineLayouts;
-    for (auto obj = createdPipelineLayouts.begin(); obj != createdPipelineLayouts.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.PipelineLayout.pCreatePacket);
-
-        if (obj->second.ObjectInfo.PipelineLayout.pDescriptorSetLayouts != nullptr) {
-            VkDescriptorSetLayout *pLayouts =
-                new VkDescriptorSetLayout[obj->second.ObjectInfo.PipelineLayout.descriptorSetLayoutCount];
-            memcpy(pLayouts, obj->second.ObjectInfo.PipelineLayout.pDescriptorSetLayouts,
-                   obj->second.ObjectInfo.PipelineLayout.descriptorSetLayoutCount * sizeof(VkDescriptorSetLayout));
-            obj->second.ObjectInfo.PipelineLayout.pDescriptorSetLayouts = pLayouts;
-        }
-    }
-
     createdSamplers = other.createdSamplers;
-    for (auto obj = createdSamplers.begin(); obj != createdSamplers.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.Sampler.pCreatePacket);
-    }
-
     createdDescriptorSetLayouts = other.createdDescriptorSetLayouts;
-    for (auto obj = createdDescriptorSetLayouts.begin(); obj != createdDescriptorSetLayouts.end(); obj++) {
-        COPY_PACKET(obj->second.ObjectInfo.DescriptorSetLayout.pCreatePacket);
-
-        uint32_t bindingCount = obj->second.ObjectInfo.DescriptorSetLayout.bindingCount;
-        if (bindingCount > 0) {
-            VkDescriptorSetLayoutBinding *tmp = new VkDescriptorSetLayoutBinding[bindingCount];
-            memcpy(tmp, obj->second.ObjectInfo.DescriptorSetLayout.pBindings, bindingCount * sizeof(VkDescriptorSetLayoutBinding));
-            obj->second.ObjectInfo.DescriptorSetLayout.pBindings = tmp;
-        } else {
-            obj->second.ObjectInfo.DescriptorSetLayout.pBindings = nullptr;
-        }
-    }
-
     createdDescriptorSets = other.createdDescriptorSets;
-    for (auto obj = createdDescriptorSets.begin(); obj != createdDescriptorSets.end(); obj++) {
-        uint32_t numBindings = obj->second.ObjectInfo.DescriptorSet.numBindings;
-        if (numBindings > 0) {
-            VkWriteDescriptorSet *tmp = new VkWriteDescriptorSet[numBindings];
-            memcpy(tmp, obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets, numBindings * sizeof(VkWriteDescriptorSet));
-            obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets = tmp;
-
-            for (uint32_t s = 0; s < numBindings; s++) {
-                uint32_t count = obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].descriptorCount;
-
-                if (obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo != nullptr) {
-                    VkDescriptorImageInfo *pTmp = new VkDescriptorImageInfo[count];
-                    memcpy(pTmp, obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo,
-                           count * sizeof(VkDescriptorImageInfo));
-                    obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo = pTmp;
-                }
-                if (obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo != nullptr) {
-                    VkDescriptorBufferInfo *pTmp = new VkDescriptorBufferInfo[count];
-                    memcpy(pTmp, obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo,
-                           count * sizeof(VkDescriptorBufferInfo));
-                    obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo = pTmp;
-                }
-                if (obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView != nullptr) {
-                    VkBufferView *pTmp = new VkBufferView[count];
-                    memcpy(pTmp, obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView,
-                           count * sizeof(VkBufferView));
-                    obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView = pTmp;
-                }
-            }
-        } else {
-            obj->second.ObjectInfo.DescriptorSet.pWriteDescriptorSets = nullptr;
-        }
-
-        if (numBindings > 0) {
-            VkCopyDescriptorSet *tmp = new VkCopyDescriptorSet[numBindings];
-            memcpy(tmp, obj->second.ObjectInfo.DescriptorSet.pCopyDescriptorSets, numBindings * sizeof(VkCopyDescriptorSet));
-            obj->second.ObjectInfo.DescriptorSet.pCopyDescriptorSets = tmp;
-        } else {
-            obj->second.ObjectInfo.DescriptorSet.pCopyDescriptorSets = nullptr;
-        }
-    }
 
     return *this;
 }
 
+//-------------------------------------------------------------------------
+// Like the copy assignment, but the objects that live handed out with add_*()
+// or get_*() to calls that may still be running aren't shared: those calls
+// may still be changing them, and the changes belong to live only. See
+// CopyOnWriteMap::snapshot().
+void StateTracker::snapshot(StateTracker &live) {
+    if (this == &live) return;
+
+    m_cmdBufferPackets = live.m_cmdBufferPackets;
+    m_renderPassVersions = live.m_renderPassVersions;
+    m_image_calls = live.m_image_calls;
+    m_referencedObjects = live.m_referencedObjects;
+
+    createdInstances.snapshot(live.createdInstances);
+    createdPhysicalDevices.snapshot(live.createdPhysicalDevices);
+    createdDevices.snapshot(live.createdDevices);
+    createdSurfaceKHRs.snapshot(live.createdSurfaceKHRs);
+    createdCommandPools.snapshot(live.createdCommandPools);
+    createdCommandBuffers.snapshot(live.createdCommandBuffers);
+    createdDescriptorPools.snapshot(live.createdDescriptorPools);
+    createdRenderPasss.snapshot(live.createdRenderPasss);
+    createdPipelineCaches.snapshot(live.createdPipelineCaches);
+    createdPipelines.snapshot(live.createdPipelines);
+    createdQueues.snapshot(live.createdQueues);
+    createdSemaphores.snapshot(live.createdSemaphores);
+    createdDeviceMemorys.snapshot(live.createdDeviceMemorys);
+    createdFences.snapshot(live.createdFences);
+    createdSwapchainKHRs.snapshot(live.createdSwapchainKHRs);
+    createdImages.snapshot(live.createdImages);
+    createdImageViews.snapshot(live.createdImageViews);
+    createdBuffers.snapshot(live.createdBuffers);
+    createdBufferViews.snapshot(live.createdBufferViews);
+    createdFramebuffers.snapshot(live.createdFramebuffers);
+    createdEvents.snapshot(live.createdEvents);
+    createdQueryPools.snapshot(live.createdQueryPools);
+    createdShaderModules.snapshot(live.createdShaderModules);
+    createdPipelineLayouts.snapshot(live.createdPipelineLayouts);
+    createdSamplers.snapshot(live.createdSamplers);
+    createdDescriptorSetLayouts.snapshot(live.createdDescriptorSetLayouts);
+    createdDescriptorSets.snapshot(live.createdDescriptorSets);
+}
+
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
 void StateTracker::copy_VkPipelineShaderStageCreateInfo(VkPipelineShaderStageCreateInfo *pDstStage,
@@ -701,35 +1252,6 @@ void StateTracker::delete_VkPipelineShaderStageCreateInfo(VkPipelineShaderStageC
     }
 }
 
-//---------------------------------------------------------------------
-//---------------------------------------------------------------------
-void StateTracker::copy_VkShaderModuleCreateInfo(VkShaderModuleCreateInfo *pDst, const VkShaderModuleCreateInfo &src) {
-    if (pDst != nullptr) {
-        *pDst = src;
-
-        if (src.pCode != nullptr) {
-            uint32_t *pCodeCopy = static_cast<uint32_t *>(malloc(src.codeSize));
-            memcpy(pCodeCopy, src.pCode, src.codeSize);
-            pDst->pCode = pCodeCopy;
-        }
-        pDst->pNext = nullptr;
-    }
-}
-
-//---------------------------------------------------------------------
-//---------------------------------------------------------------------
-void StateTracker::delete_VkShaderModuleCreateInfo(VkShaderModuleCreateInfo *pModule) {
-    if (pModule != nullptr) {
-        if (pModule->pCode != nullptr) {
-            uint32_t *pCode = const_cast<uint32_t *>(pModule->pCode);
-            free(pCode);
-            pModule->pCode = nullptr;
-        }
-        pModule->codeSize = 0;
-        pModule->pNext = nullptr;
-    }
-}
-
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
 void StateTracker::copy_VkGraphicsPipelineCreateInfo(VkGraphicsPipelineCreateInfo *pDst, const VkGraphicsPipelineCreateInfo &src) {
@@ -878,189 +1400,189 @@ void StateTracker::copy_VkComputePipelineCreateInfo(VkComputePipelineCreateInfo
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
 ObjectInfo &StateTracker::add_Instance(VkInstance var) {
-    ObjectInfo &info = createdInstances[var];
+    ObjectInfo &info = createdInstances.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_PhysicalDevice(VkPhysicalDevice var) {
-    ObjectInfo &info = createdPhysicalDevices[var];
+    ObjectInfo &info = createdPhysicalDevices.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Device(VkDevice var) {
-    ObjectInfo &info = createdDevices[var];
+    ObjectInfo &info = createdDevices.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_SurfaceKHR(VkSurfaceKHR var) {
-    ObjectInfo &info = createdSurfaceKHRs[var];
+    ObjectInfo &info = createdSurfaceKHRs.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_CommandPool(VkCommandPool var) {
-    ObjectInfo &info = createdCommandPools[var];
+    ObjectInfo &info = createdCommandPools.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_CommandBuffer(VkCommandBuffer var) {
-    ObjectInfo &info = createdCommandBuffers[var];
+    ObjectInfo &info = createdCommandBuffers.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_DescriptorPool(VkDescriptorPool var) {
-    ObjectInfo &info = createdDescriptorPools[var];
+    ObjectInfo &info = createdDescriptorPools.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_RenderPass(VkRenderPass var) {
-    ObjectInfo &info = createdRenderPasss[var];
+    ObjectInfo &info = createdRenderPasss.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_PipelineCache(VkPipelineCache var) {
-    ObjectInfo &info = createdPipelineCaches[var];
+    ObjectInfo &info = createdPipelineCaches.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Pipeline(VkPipeline var) {
-    ObjectInfo &info = createdPipelines[var];
+    ObjectInfo &info = createdPipelines.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Queue(VkQueue var) {
-    ObjectInfo &info = createdQueues[var];
+    ObjectInfo &info = createdQueues.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Semaphore(VkSemaphore var) {
-    ObjectInfo &info = createdSemaphores[var];
+    ObjectInfo &info = createdSemaphores.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_DeviceMemory(VkDeviceMemory var) {
-    ObjectInfo &info = createdDeviceMemorys[var];
+    ObjectInfo &info = createdDeviceMemorys.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Fence(VkFence var) {
-    ObjectInfo &info = createdFences[var];
+    ObjectInfo &info = createdFences.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_SwapchainKHR(VkSwapchainKHR var) {
-    ObjectInfo &info = createdSwapchainKHRs[var];
+    ObjectInfo &info = createdSwapchainKHRs.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Image(VkImage var) {
-    ObjectInfo &info = createdImages[var];
+    ObjectInfo &info = createdImages.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_ImageView(VkImageView var) {
-    ObjectInfo &info = createdImageViews[var];
+    ObjectInfo &info = createdImageViews.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Buffer(VkBuffer var) {
-    ObjectInfo &info = createdBuffers[var];
+    ObjectInfo &info = createdBuffers.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_BufferView(VkBufferView var) {
-    ObjectInfo &info = createdBufferViews[var];
+    ObjectInfo &info = createdBufferViews.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Framebuffer(VkFramebuffer var) {
-    ObjectInfo &info = createdFramebuffers[var];
+    ObjectInfo &info = createdFramebuffers.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Event(VkEvent var) {
-    ObjectInfo &info = createdEvents[var];
+    ObjectInfo &info = createdEvents.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_QueryPool(VkQueryPool var) {
-    ObjectInfo &info = createdQueryPools[var];
+    ObjectInfo &info = createdQueryPools.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_ShaderModule(VkShaderModule var) {
-    ObjectInfo &info = createdShaderModules[var];
+    ObjectInfo &info = createdShaderModules.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_PipelineLayout(VkPipelineLayout var) {
-    ObjectInfo &info = createdPipelineLayouts[var];
+    ObjectInfo &info = createdPipelineLayouts.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_Sampler(VkSampler var) {
-    ObjectInfo &info = createdSamplers[var];
+    ObjectInfo &info = createdSamplers.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_DescriptorSetLayout(VkDescriptorSetLayout var) {
-    ObjectInfo &info = createdDescriptorSetLayouts[var];
+    ObjectInfo &info = createdDescriptorSetLayouts.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
 }
 
 ObjectInfo &StateTracker::add_DescriptorSet(VkDescriptorSet var) {
-    ObjectInfo &info = createdDescriptorSets[var];
+    ObjectInfo &info = createdDescriptorSets.lend_new(var);
     memset(&info, 0, sizeof(ObjectInfo));
     info.vkObject = (uint64_t)var;
     return info;
@@ -1068,596 +1590,115 @@ ObjectInfo &StateTracker::add_DescriptorSet(VkDescriptorSet var) {
 
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
-ObjectInfo *StateTracker::get_Instance(VkInstance var) {
-    auto iter = createdInstances.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdInstances.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Instance(VkInstance var) { return createdInstances.lend(var); }
 
-ObjectInfo *StateTracker::get_PhysicalDevice(VkPhysicalDevice var) {
-    auto iter = createdPhysicalDevices.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdPhysicalDevices.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_PhysicalDevice(VkPhysicalDevice var) { return createdPhysicalDevices.lend(var); }
 
-ObjectInfo *StateTracker::get_Device(VkDevice var) {
-    auto iter = createdDevices.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdDevices.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Device(VkDevice var) { return createdDevices.lend(var); }
 
-ObjectInfo *StateTracker::get_SurfaceKHR(VkSurfaceKHR var) {
-    auto iter = createdSurfaceKHRs.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdSurfaceKHRs.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_SurfaceKHR(VkSurfaceKHR var) { return createdSurfaceKHRs.lend(var); }
 
-ObjectInfo *StateTracker::get_Queue(VkQueue var) {
-    auto iter = createdQueues.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdQueues.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Queue(VkQueue var) { return createdQueues.lend(var); }
 
-ObjectInfo *StateTracker::get_SwapchainKHR(VkSwapchainKHR var) {
-    auto iter = createdSwapchainKHRs.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdSwapchainKHRs.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_SwapchainKHR(VkSwapchainKHR var) { return createdSwapchainKHRs.lend(var); }
 
-ObjectInfo *StateTracker::get_CommandPool(VkCommandPool var) {
-    auto iter = createdCommandPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdCommandPools.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_CommandPool(VkCommandPool var) { return createdCommandPools.lend(var); }
 
-ObjectInfo *StateTracker::get_CommandBuffer(VkCommandBuffer var) {
-    auto iter = createdCommandBuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdCommandBuffers.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_CommandBuffer(VkCommandBuffer var) { return createdCommandBuffers.lend(var); }
 
-ObjectInfo *StateTracker::get_DeviceMemory(VkDeviceMemory var) {
-    auto iter = createdDeviceMemorys.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdDeviceMemorys.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_DeviceMemory(VkDeviceMemory var) { return createdDeviceMemorys.lend(var); }
 
-ObjectInfo *StateTracker::get_ImageView(VkImageView var) {
-    auto iter = createdImageViews.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdImageViews.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_ImageView(VkImageView var) { return createdImageViews.lend(var); }
 
-ObjectInfo *StateTracker::get_Image(VkImage var) {
-    auto iter = createdImages.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdImages.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Image(VkImage var) { return createdImages.lend(var); }
 
-ObjectInfo *StateTracker::get_BufferView(VkBufferView var) {
-    auto iter = createdBufferViews.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdBufferViews.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_BufferView(VkBufferView var) { return createdBufferViews.lend(var); }
 
-ObjectInfo *StateTracker::get_Buffer(VkBuffer var) {
-    auto iter = createdBuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdBuffers.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Buffer(VkBuffer var) { return createdBuffers.lend(var); }
 
-ObjectInfo *StateTracker::get_Sampler(VkSampler var) {
-    auto iter = createdSamplers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdSamplers.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Sampler(VkSampler var) { return createdSamplers.lend(var); }
 
 ObjectInfo *StateTracker::get_DescriptorSetLayout(VkDescriptorSetLayout var) {
-    auto iter = createdDescriptorSetLayouts.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdDescriptorSetLayouts.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
+    return createdDescriptorSetLayouts.lend(var);
 }
 
-ObjectInfo *StateTracker::get_PipelineLayout(VkPipelineLayout var) {
-    auto iter = createdPipelineLayouts.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdPipelineLayouts.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_PipelineLayout(VkPipelineLayout var) { return createdPipelineLayouts.lend(var); }
 
-ObjectInfo *StateTracker::get_RenderPass(VkRenderPass var) {
-    auto iter = createdRenderPasss.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdRenderPasss.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_RenderPass(VkRenderPass var) { return createdRenderPasss.lend(var); }
 
-ObjectInfo *StateTracker::get_ShaderModule(VkShaderModule var) {
-    auto iter = createdShaderModules.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdShaderModules.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_ShaderModule(VkShaderModule var) { return createdShaderModules.lend(var); }
 
-ObjectInfo *StateTracker::get_PipelineCache(VkPipelineCache var) {
-    auto iter = createdPipelineCaches.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdPipelineCaches.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_PipelineCache(VkPipelineCache var) { return createdPipelineCaches.lend(var); }
 
-ObjectInfo *StateTracker::get_DescriptorPool(VkDescriptorPool var) {
-    auto iter = createdDescriptorPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdDescriptorPools.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_DescriptorPool(VkDescriptorPool var) { return createdDescriptorPools.lend(var); }
 
-ObjectInfo *StateTracker::get_Pipeline(VkPipeline var) {
-    auto iter = createdPipelines.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdPipelines.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Pipeline(VkPipeline var) { return createdPipelines.lend(var); }
 
-ObjectInfo *StateTracker::get_Semaphore(VkSemaphore var) {
-    auto iter = createdSemaphores.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdSemaphores.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Semaphore(VkSemaphore var) { return createdSemaphores.lend(var); }
 
-ObjectInfo *StateTracker::get_Fence(VkFence var) {
-    auto iter = createdFences.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdFences.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Fence(VkFence var) { return createdFences.lend(var); }
 
-ObjectInfo *StateTracker::get_Framebuffer(VkFramebuffer var) {
-    auto iter = createdFramebuffers.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdFramebuffers.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Framebuffer(VkFramebuffer var) { return createdFramebuffers.lend(var); }
 
-ObjectInfo *StateTracker::get_Event(VkEvent var) {
-    auto iter = createdEvents.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdEvents.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_Event(VkEvent var) { return createdEvents.lend(var); }
 
-ObjectInfo *StateTracker::get_QueryPool(VkQueryPool var) {
-    auto iter = createdQueryPools.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdQueryPools.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_QueryPool(VkQueryPool var) { return createdQueryPools.lend(var); }
 
-ObjectInfo *StateTracker::get_DescriptorSet(VkDescriptorSet var) {
-    auto iter = createdDescriptorSets.find(var);
-    ObjectInfo *pResult = NULL;
-    if (iter != createdDescriptorSets.end()) {
-        pResult = &(iter->second);
-    }
-    return pResult;
-}
+ObjectInfo *StateTracker::get_DescriptorSet(VkDescriptorSet var) { return createdDescriptorSets.lend(var); }
 
 //---------------------------------------------------------------------
 //---------------------------------------------------------------------
-void StateTracker::remove_Instance(const VkInstance var) {
-    ObjectInfo *pInfo = get_Instance(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pCreatePacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesCountPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Instance.pEnumeratePhysicalDevicesPacket);
-    }
-    createdInstances.erase(var);
-}
+void StateTracker::remove_Instance(const VkInstance var) { createdInstances.erase(var); }
 
-void StateTracker::remove_PhysicalDevice(const VkPhysicalDevice var) {
-    ObjectInfo *pInfo = get_PhysicalDevice(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceMemoryPropertiesPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesCountPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyPropertiesPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRCountPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PhysicalDevice.pGetPhysicalDeviceQueueFamilyProperties2KHRPacket);
-    }
-    createdPhysicalDevices.erase(var);
-}
-
-void StateTracker::remove_Device(const VkDevice var) {
-    ObjectInfo *pInfo = get_Device(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Device.pCreatePacket);
-    }
-
-    for (uint32_t family = 0; family < pInfo->ObjectInfo.Device.queueFamilyCount; family++) {
-        VKTRACE_DELETE(pInfo->ObjectInfo.Device.pQueueFamilies[family].queues);
-    }
-    VKTRACE_DELETE(pInfo->ObjectInfo.Device.pQueueFamilies);
+void StateTracker::remove_PhysicalDevice(const VkPhysicalDevice var) { createdPhysicalDevices.erase(var); }
 
-    createdDevices.erase(var);
-}
+void StateTracker::remove_Device(const VkDevice var) { createdDevices.erase(var); }
 
-void StateTracker::remove_SurfaceKHR(const VkSurfaceKHR var) {
-    ObjectInfo *pInfo = get_SurfaceKHR(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.SurfaceKHR.pCreatePacket);
-    }
-    createdSurfaceKHRs.erase(var);
-}
+void StateTracker::remove_SurfaceKHR(const VkSurfaceKHR var) { createdSurfaceKHRs.erase(var); }
 
-void StateTracker::remove_Queue(const VkQueue var) {
-    ObjectInfo *pInfo = get_Queue(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Queue.pCreatePacket);
-    }
-    createdQueues.erase(var);
-}
+void StateTracker::remove_Queue(const VkQueue var) { createdQueues.erase(var); }
 
-void StateTracker::remove_CommandPool(const VkCommandPool var) {
-    ObjectInfo *pInfo = get_CommandPool(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.CommandPool.pCreatePacket);
-    }
-    createdCommandPools.erase(var);
-}
+void StateTracker::remove_CommandPool(const VkCommandPool var) { createdCommandPools.erase(var); }
 
-void StateTracker::remove_SwapchainKHR(const VkSwapchainKHR var) {
-    ObjectInfo *pInfo = get_SwapchainKHR(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pCreatePacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImageCountPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.SwapchainKHR.pGetSwapchainImagesPacket);
-    }
-    createdSwapchainKHRs.erase(var);
-}
+void StateTracker::remove_SwapchainKHR(const VkSwapchainKHR var) { createdSwapchainKHRs.erase(var); }
 
 void StateTracker::remove_CommandBuffer(const VkCommandBuffer var) { createdCommandBuffers.erase(var); }
 
-void StateTracker::remove_DeviceMemory(const VkDeviceMemory var) {
-    ObjectInfo *pInfo = get_DeviceMemory(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pCreatePacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pMapMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pUnmapMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DeviceMemory.pPersistentlyMapMemoryPacket);
-    }
-    createdDeviceMemorys.erase(var);
-}
-
-void StateTracker::remove_Image(const VkImage var) {
-    ObjectInfo *pInfo = get_Image(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pCreatePacket);
-#if !TRIM_USE_ORDERED_IMAGE_CREATION
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pGetImageMemoryRequirementsPacket);
-#endif  //! TRIM_USE_ORDERED_IMAGE_CREATION
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pBindImageMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pMapMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Image.pUnmapMemoryPacket);
-    }
-    createdImages.erase(var);
-}
-
-void StateTracker::remove_ImageView(const VkImageView var) {
-    ObjectInfo *pInfo = get_ImageView(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.ImageView.pCreatePacket);
-    }
-    createdImageViews.erase(var);
-}
-
-void StateTracker::remove_Buffer(const VkBuffer var) {
-    ObjectInfo *pInfo = get_Buffer(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pCreatePacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pBindBufferMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pMapMemoryPacket);
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Buffer.pUnmapMemoryPacket);
-    }
-    createdBuffers.erase(var);
-}
-
-void StateTracker::remove_BufferView(const VkBufferView var) {
-    ObjectInfo *pInfo = get_BufferView(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.BufferView.pCreatePacket);
-    }
-    createdBufferViews.erase(var);
-}
-
-void StateTracker::remove_Sampler(const VkSampler var) {
-    ObjectInfo *pInfo = get_Sampler(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Sampler.pCreatePacket);
-    }
-    createdSamplers.erase(var);
-}
-
-void StateTracker::remove_DescriptorSetLayout(const VkDescriptorSetLayout var) {
-    ObjectInfo *pInfo = get_DescriptorSetLayout(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorSetLayout.pCreatePacket);
-
-        if (pInfo->ObjectInfo.DescriptorSetLayout.pBindings != nullptr) {
-            delete[] pInfo->ObjectInfo.DescriptorSetLayout.pBindings;
-            pInfo->ObjectInfo.DescriptorSetLayout.pBindings = nullptr;
-            pInfo->ObjectInfo.DescriptorSetLayout.bindingCount = 0;
-        }
-    }
-    createdDescriptorSetLayouts.erase(var);
-}
-
-void StateTracker::remove_PipelineLayout(const VkPipelineLayout var) {
-    ObjectInfo *pInfo = get_PipelineLayout(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PipelineLayout.pCreatePacket);
-        if (pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts != nullptr) {
-            delete[] pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts;
-            pInfo->ObjectInfo.PipelineLayout.pDescriptorSetLayouts = nullptr;
-            pInfo->ObjectInfo.PipelineLayout.descriptorSetLayoutCount = 0;
-        }
-    }
-    createdPipelineLayouts.erase(var);
-}
-
-void StateTracker::remove_RenderPass(const VkRenderPass var) {
-    ObjectInfo *pInfo = get_RenderPass(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.RenderPass.pCreatePacket);
-    }
-    createdRenderPasss.erase(var);
-}
-
-void StateTracker::remove_ShaderModule(const VkShaderModule var) {
-    ObjectInfo *pInfo = get_ShaderModule(var);
-    if (pInfo != nullptr) {
-        uint32_t *pCode = const_cast<uint32_t *>(pInfo->ObjectInfo.ShaderModule.createInfo.pCode);
-        free(pCode);
-        pInfo->ObjectInfo.ShaderModule.createInfo.pCode = nullptr;
-    }
-    createdShaderModules.erase(var);
-}
-
-void StateTracker::remove_PipelineCache(const VkPipelineCache var) {
-    ObjectInfo *pInfo = get_PipelineCache(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.PipelineCache.pCreatePacket);
-    }
-    createdPipelineCaches.erase(var);
-}
-
-void StateTracker::remove_Pipeline(const VkPipeline var) {
-    ObjectInfo *pInfo = get_Pipeline(var);
-    if (pInfo != nullptr) {
-        for (uint32_t i = 0; i < pInfo->ObjectInfo.Pipeline.shaderModuleCreateInfoCount; i++) {
-            delete_VkShaderModuleCreateInfo(&pInfo->ObjectInfo.Pipeline.pShaderModuleCreateInfos[i]);
-        }
-        VKTRACE_DELETE(pInfo->ObjectInfo.Pipeline.pShaderModuleCreateInfos);
-        pInfo->ObjectInfo.Pipeline.shaderModuleCreateInfoCount = 0;
-
-        delete_VkPipelineShaderStageCreateInfo(&pInfo->ObjectInfo.Pipeline.computePipelineCreateInfo.stage);
-
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages != nullptr) {
-            for (uint32_t i = 0; i < pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.stageCount; ++i) {
-                delete_VkPipelineShaderStageCreateInfo(const_cast<VkPipelineShaderStageCreateInfo *>(
-                    &pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages[i]));
-            }
-
-            delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pStages;
-        }
-
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState != nullptr) {
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexAttributeDescriptions != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexAttributeDescriptions;
-            }
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexBindingDescriptions != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState->pVertexBindingDescriptions;
-            }
-
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pVertexInputState;
-        }
-
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pInputAssemblyState != nullptr) {
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pInputAssemblyState;
-        }
-
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pTessellationState != nullptr) {
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pTessellationState;
-        }
-
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState != nullptr) {
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pViewports != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pViewports;
-            }
+void StateTracker::remove_DeviceMemory(const VkDeviceMemory var) { createdDeviceMemorys.erase(var); }
 
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pScissors != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState->pScissors;
-            }
+void StateTracker::remove_Image(const VkImage var) { createdImages.erase(var); }
 
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pViewportState;
-        }
+void StateTracker::remove_ImageView(const VkImageView var) { createdImageViews.erase(var); }
 
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pRasterizationState != nullptr) {
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pRasterizationState;
-        }
+void StateTracker::remove_Buffer(const VkBuffer var) { createdBuffers.erase(var); }
 
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState != nullptr) {
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState->pSampleMask != nullptr) {
-                delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState->pSampleMask;
-            }
+void StateTracker::remove_BufferView(const VkBufferView var) { createdBufferViews.erase(var); }
 
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pMultisampleState;
-        }
+void StateTracker::remove_Sampler(const VkSampler var) { createdSamplers.erase(var); }
 
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDepthStencilState != nullptr) {
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDepthStencilState;
-        }
+void StateTracker::remove_DescriptorSetLayout(const VkDescriptorSetLayout var) { createdDescriptorSetLayouts.erase(var); }
 
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState != nullptr) {
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState->pAttachments != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState->pAttachments;
-            }
+void StateTracker::remove_PipelineLayout(const VkPipelineLayout var) { createdPipelineLayouts.erase(var); }
 
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pColorBlendState;
-        }
+void StateTracker::remove_RenderPass(const VkRenderPass var) { createdRenderPasss.erase(var); }
 
-        if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState != nullptr) {
-            if (pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState->pDynamicStates != nullptr) {
-                delete[] pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState->pDynamicStates;
-            }
+void StateTracker::remove_ShaderModule(const VkShaderModule var) { createdShaderModules.erase(var); }
 
-            delete pInfo->ObjectInfo.Pipeline.graphicsPipelineCreateInfo.pDynamicState;
-        }
-    }
-    createdPipelines.erase(var);
-}
+void StateTracker::remove_PipelineCache(const VkPipelineCache var) { createdPipelineCaches.erase(var); }
 
-void StateTracker::remove_DescriptorPool(const VkDescriptorPool var) {
-    ObjectInfo *pInfo = get_DescriptorPool(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.DescriptorPool.pCreatePacket);
-    }
-    createdDescriptorPools.erase(var);
-}
+void StateTracker::remove_Pipeline(const VkPipeline var) { createdPipelines.erase(var); }
 
-void StateTracker::remove_DescriptorSet(const VkDescriptorSet var) {
-    ObjectInfo *pInfo = get_DescriptorSet(var);
-    if (pInfo != nullptr) {
-        if (pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets != nullptr) {
-            delete[] pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets;
-            pInfo->ObjectInfo.DescriptorSet.pCopyDescriptorSets = nullptr;
-        }
-        if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets != nullptr) {
-            for (uint32_t s = 0; s < pInfo->ObjectInfo.DescriptorSet.numBindings; s++) {
-                if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo != nullptr) {
-                    delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo;
-                    pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pImageInfo = nullptr;
-                }
-                if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo != nullptr) {
-                    delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo;
-                    pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pBufferInfo = nullptr;
-                }
-                if (pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView != nullptr) {
-                    delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView;
-                    pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets[s].pTexelBufferView = nullptr;
-                }
-            }
+void StateTracker::remove_DescriptorPool(const VkDescriptorPool var) { createdDescriptorPools.erase(var); }
 
-            delete[] pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets;
-            pInfo->ObjectInfo.DescriptorSet.pWriteDescriptorSets = nullptr;
-        }
-    }
-    createdDescriptorSets.erase(var);
-}
+void StateTracker::remove_DescriptorSet(const VkDescriptorSet var) { createdDescriptorSets.erase(var); }
 
-void StateTracker::remove_Framebuffer(const VkFramebuffer var) {
-    ObjectInfo *pInfo = get_Framebuffer(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Framebuffer.pCreatePacket);
-    }
-    createdFramebuffers.erase(var);
-}
+void StateTracker::remove_Framebuffer(const VkFramebuffer var) { createdFramebuffers.erase(var); }
 
-void StateTracker::remove_Semaphore(const VkSemaphore var) {
-    ObjectInfo *pInfo = get_Semaphore(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Semaphore.pCreatePacket);
-    }
-    createdSemaphores.erase(var);
-}
+void StateTracker::remove_Semaphore(const VkSemaphore var) { createdSemaphores.erase(var); }
 
 void StateTracker::remove_Fence(const VkFence var) { createdFences.erase(var); }
 
-void StateTracker::remove_Event(const VkEvent var) {
-    ObjectInfo *pInfo = get_Event(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.Event.pCreatePacket);
-    }
-    createdEvents.erase(var);
-}
+void StateTracker::remove_Event(const VkEvent var) { createdEvents.erase(var); }
 
-void StateTracker::remove_QueryPool(const VkQueryPool var) {
-    ObjectInfo *pInfo = get_QueryPool(var);
-    if (pInfo != nullptr) {
-        vktrace_delete_trace_packet(&pInfo->ObjectInfo.QueryPool.pCreatePacket);
-        pInfo->ObjectInfo.QueryPool.size = 0;
-        if (pInfo->ObjectInfo.QueryPool.pResultsAvailable != nullptr) {
-            delete[] pInfo->ObjectInfo.QueryPool.pResultsAvailable;
-            pInfo->ObjectInfo.QueryPool.pResultsAvailable = nullptr;
-        }
-    }
-    createdQueryPools.erase(var);
-}
+void StateTracker::remove_QueryPool(const VkQueryPool var) { createdQueryPools.erase(var); }
 }
@@ -15,10 +15,13 @@
 */
 #pragma once
 
+#include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <list>
 #include <vector>
 #include "vktrace_trace_packet_utils.h"
+#include "vktrace_lib_trim_copyonwrite.h"
 
 // Create / Destroy all image resources in the order performed by the
 // application.
@@ -44,8 +47,6 @@ struct ImageTransition {
     VkAccessFlags dstAccessMask;
 };
 
-extern VKTRACE_CRITICAL_SECTION trimTransitionMapLock;
-
 // VkCmdPipelineBarrier can transition memory to a different accessMask, but
 // the change doesn't happen when the API call is made but rather when the
 // command buffer is executed. Cache these transitions so that they can be
@@ -67,8 +68,6 @@ struct QueueFamily {
 //-------------------------------------------------------------------------
 typedef struct _Trim_ObjectInfo {
     uint64_t vkObject;                         // object handle
-    bool bReferencedInTrim;                    // True if the object was referenced during the trim
-                                               // frames
     VkInstance belongsToInstance;              // owning Instance
     VkPhysicalDevice belongsToPhysicalDevice;  // owning PhysicalDevice
     VkDevice belongsToDevice;                  // owning Device
@@ -123,6 +122,7 @@ typedef struct _Trim_ObjectInfo {
             VkCommandBufferLevel level;
             VkRenderPass activeRenderPass;
             VkQueue submitQueue;
+            VkCommandBufferUsageFlags usageFlags;  // of the current recording
         } CommandBuffer;
         struct _DeviceMemory {  // VkDeviceMemory
             vktrace_trace_packet_header *pCreatePacket;
@@ -210,7 +210,7 @@ typedef struct _Trim_ObjectInfo {
             ImageTransition *pAttachments;
         } RenderPass;
         struct _ShaderModule {  // VkShaderModule
-            VkShaderModuleCreateInfo createInfo;
+            vktrace_trace_packet_header *pCreatePacket;
             const VkAllocationCallbacks *pAllocator;
         } ShaderModule;
         struct _PipelineCache {  // VkPipelineCache
@@ -224,8 +224,8 @@ typedef struct _Trim_ObjectInfo {
             VkGraphicsPipelineCreateInfo graphicsPipelineCreateInfo;
             VkComputePipelineCreateInfo computePipelineCreateInfo;
             uint32_t renderPassVersion;
-            uint32_t shaderModuleCreateInfoCount;
-            VkShaderModuleCreateInfo *pShaderModuleCreateInfos;
+            uint32_t shaderModuleCreatePacketCount;  // one create packet of the shader module of each stage
+            vktrace_trace_packet_header **pShaderModuleCreatePackets;
         } Pipeline;
         struct _DescriptorPool {  // VkDescriptorPool
             vktrace_trace_packet_header *pCreatePacket;
@@ -246,6 +246,10 @@ typedef struct _Trim_ObjectInfo {
             uint32_t copyDescriptorCount;  // this is the number of descriptor
                                            // sets that will need a copy update.
             VkCopyDescriptorSet *pCopyDescriptorSets;
+            // When the two arrays above are packed, so that they can be
+            // spilled, they are null and this holds them, see
+            // StateTracker::pack_DescriptorSet_bindings().
+            vktrace_trace_packet_header *pBindingsPacket;
         } DescriptorSet;
         struct _Framebuffer {  // VkFramebuffer
             vktrace_trace_packet_header *pCreatePacket;
@@ -289,11 +293,36 @@ class StateTracker {
 
     void clear();
 
-    std::unordered_map<VkCommandBuffer, std::list<ImageTransition>> m_cmdBufferToImageTransitionsMap;
+    // What the state tracker holds on to. The packets are the ones that
+    // visit_packets() visits, so this is meant to be called while there is
+    // no snapshot, and it packs the updates of the descriptor sets.
+    struct MemoryUsage {
+        uint64_t objectCount;
+        uint64_t commandBufferCount;  // command buffers with recorded calls
+        uint64_t commandBufferCallCount;
+        uint64_t commandBufferCallBytes;
+        uint64_t imageCallCount;
+        uint64_t imageCallBytes;
+        uint64_t packetBytes;  // the packets of the objects, the recorded calls and the image calls
+        uint64_t totalBytes;   // the packets plus the ObjectInfo entries
+    };
+    MemoryUsage get_memory_usage();
+
+    // Calls visit with the address of every packet pointer of the objects, the
+    // recorded command buffer calls and the image calls, so that it can
+    // replace the packet. The pointer may be null. Entries that are shared
+    // with a snapshot are copied first, and image calls that are shared with
+    // one are skipped, so this is meant to be called while there is none.
+    // The updates of the descriptor sets are packed first, see
+    // pack_DescriptorSet_bindings().
+    typedef std::function<void(vktrace_trace_packet_header **ppHeader)> PacketVisitor;
+    void visit_packets(const PacketVisitor &visit);
+
+    CopyOnWriteMap<VkCommandBuffer, std::list<ImageTransition>> m_cmdBufferToImageTransitionsMap;
     void AddImageTransition(VkCommandBuffer commandBuffer, ImageTransition transition);
     void ClearImageTransitions(VkCommandBuffer commandBuffer);
 
-    std::unordered_map<VkCommandBuffer, std::list<BufferTransition>> m_cmdBufferToBufferTransitionsMap;
+    CopyOnWriteMap<VkCommandBuffer, std::list<BufferTransition>> m_cmdBufferToBufferTransitionsMap;
     void AddBufferTransition(VkCommandBuffer commandBuffer, BufferTransition transition);
     void ClearBufferTransitions(VkCommandBuffer commandBuffer);
 
@@ -301,14 +330,19 @@ class StateTracker {
     void remove_CommandBuffer_calls(VkCommandBuffer commandBuffer);
 
     void add_RenderPassCreateInfo(VkRenderPass renderPass, const VkRenderPassCreateInfo *pCreateInfo);
-    VkRenderPassCreateInfo *get_RenderPassCreateInfo(VkRenderPass renderPass, uint32_t version);
-    uint32_t get_RenderPassVersion(VkRenderPass renderPass);
+    const VkRenderPassCreateInfo *get_RenderPassCreateInfo(VkRenderPass renderPass, uint32_t version) const;
+    uint32_t get_RenderPassVersion(VkRenderPass renderPass) const;
 
 #if TRIM_USE_ORDERED_IMAGE_CREATION
     void add_Image_call(vktrace_trace_packet_header *pHeader);
 #endif  // TRIM_USE_ORDERED_IMAGE_CREATION
 
     StateTracker &operator=(const StateTracker &other);
+    void snapshot(StateTracker &live);
+
+    // The objects returned by add_*() and get_*() can be changed by the
+    // traced call that got them after the lock of their shard is let go, see
+    // CopyOnWriteMap::lend(). The call must have created its packet first.
 
     ObjectInfo &add_Instance(VkInstance var);
     ObjectInfo &add_PhysicalDevice(VkPhysicalDevice var);
@@ -396,9 +430,20 @@ class StateTracker {
 
     static void copy_VkRenderPassCreateInfo(VkRenderPassCreateInfo *pDst, const VkRenderPassCreateInfo &src);
 
-    static void copy_VkShaderModuleCreateInfo(VkShaderModuleCreateInfo *pDst, const VkShaderModuleCreateInfo &src);
+    // Moves the write and copy updates of a descriptor set into its
+    // pBindingsPacket, a packet of its own that visit_packets() visits, so
+    // that they can be spilled like the packets of other objects.
+    static void pack_DescriptorSet_bindings(ObjectInfo *pInfo);
+
+    // Points the arrays of pInfo into pBindingsPacket, the packed updates of
+    // the descriptor set, or a copy of them, which is changed to do so. The
+    // arrays stay owned by the packet.
+    static void view_DescriptorSet_bindings(ObjectInfo *pInfo, vktrace_trace_packet_header *pBindingsPacket);
 
-    static void delete_VkShaderModuleCreateInfo(VkShaderModuleCreateInfo *pModule);
+    // Moves the updates of a packed descriptor set back to its arrays.
+    // pBindingsPacket is its pBindingsPacket, or the packet that it stands
+    // in for if it was spilled, which stays owned by the caller then.
+    static void unpack_DescriptorSet_bindings(ObjectInfo *pInfo, vktrace_trace_packet_header *pBindingsPacket);
 
     static void copy_VkGraphicsPipelineCreateInfo(VkGraphicsPipelineCreateInfo *pDst, const VkGraphicsPipelineCreateInfo &src);
     static void copy_VkComputePipelineCreateInfo(VkComputePipelineCreateInfo *pDst, const VkComputePipelineCreateInfo &src);
@@ -408,43 +453,46 @@ class StateTracker {
 
     // Map relating a command buffer object to all the calls that have been
     // made on that command buffer since it was started or last reset.
-    std::unordered_map<VkCommandBuffer, std::list<vktrace_trace_packet_header *>> m_cmdBufferPackets;
+    CopyOnWriteMap<VkCommandBuffer, std::list<vktrace_trace_packet_header *>> m_cmdBufferPackets;
 
     // Map to keep track of older RenderPass versions so that we can recreate
     // pipelines.
-    std::unordered_map<VkRenderPass, std::vector<VkRenderPassCreateInfo *>> m_renderPassVersions;
+    CopyOnWriteMap<VkRenderPass, std::vector<VkRenderPassCreateInfo *>> m_renderPassVersions;
 
     // List of all packets used to create or delete images.
     // We need to recreate them in the same order to ensure they will have the
     // same size requirements as they had a trace-time.
-    std::list<vktrace_trace_packet_header *> m_image_calls;
-
-    std::unordered_map<VkInstance, ObjectInfo> createdInstances;
-    std::unordered_map<VkPhysicalDevice, ObjectInfo> createdPhysicalDevices;
-    std::unordered_map<VkDevice, ObjectInfo> createdDevices;
-    std::unordered_map<VkSurfaceKHR, ObjectInfo> createdSurfaceKHRs;
-    std::unordered_map<VkCommandPool, ObjectInfo> createdCommandPools;
-    std::unordered_map<VkCommandBuffer, ObjectInfo> createdCommandBuffers;
-    std::unordered_map<VkDescriptorPool, ObjectInfo> createdDescriptorPools;
-    std::unordered_map<VkRenderPass, ObjectInfo> createdRenderPasss;
-    std::unordered_map<VkPipelineCache, ObjectInfo> createdPipelineCaches;
-    std::unordered_map<VkPipeline, ObjectInfo> createdPipelines;
-    std::unordered_map<VkQueue, ObjectInfo> createdQueues;
-    std::unordered_map<VkSemaphore, ObjectInfo> createdSemaphores;
-    std::unordered_map<VkDeviceMemory, ObjectInfo> createdDeviceMemorys;
-    std::unordered_map<VkFence, ObjectInfo> createdFences;
-    std::unordered_map<VkSwapchainKHR, ObjectInfo> createdSwapchainKHRs;
-    std::unordered_map<VkImage, ObjectInfo> createdImages;
-    std::unordered_map<VkImageView, ObjectInfo> createdImageViews;
-    std::unordered_map<VkBuffer, ObjectInfo> createdBuffers;
-    std::unordered_map<VkBufferView, ObjectInfo> createdBufferViews;
-    std::unordered_map<VkFramebuffer, ObjectInfo> createdFramebuffers;
-    std::unordered_map<VkEvent, ObjectInfo> createdEvents;
-    std::unordered_map<VkQueryPool, ObjectInfo> createdQueryPools;
-    std::unordered_map<VkShaderModule, ObjectInfo> createdShaderModules;
-    std::unordered_map<VkPipelineLayout, ObjectInfo> createdPipelineLayouts;
-    std::unordered_map<VkSampler, ObjectInfo> createdSamplers;
-    std::unordered_map<VkDescriptorSetLayout, ObjectInfo> createdDescriptorSetLayouts;
-    std::unordered_map<VkDescriptorSet, ObjectInfo> createdDescriptorSets;
+    CopyOnWriteList<vktrace_trace_packet_header> m_image_calls;
+
+    // Handles of the objects that were referenced during the trim frames.
+    std::unordered_set<uint64_t> m_referencedObjects;
+
+    CopyOnWriteMap<VkInstance, ObjectInfo> createdInstances;
+    CopyOnWriteMap<VkPhysicalDevice, ObjectInfo> createdPhysicalDevices;
+    CopyOnWriteMap<VkDevice, ObjectInfo> createdDevices;
+    CopyOnWriteMap<VkSurfaceKHR, ObjectInfo> createdSurfaceKHRs;
+    CopyOnWriteMap<VkCommandPool, ObjectInfo> createdCommandPools;
+    CopyOnWriteMap<VkCommandBuffer, ObjectInfo> createdCommandBuffers;
+    CopyOnWriteMap<VkDescriptorPool, ObjectInfo> createdDescriptorPools;
+    CopyOnWriteMap<VkRenderPass, ObjectInfo> createdRenderPasss;
+    CopyOnWriteMap<VkPipelineCache, ObjectInfo> createdPipelineCaches;
+    CopyOnWriteMap<VkPipeline, ObjectInfo> createdPipelines;
+    CopyOnWriteMap<VkQueue, ObjectInfo> createdQueues;
+    CopyOnWriteMap<VkSemaphore, ObjectInfo> createdSemaphores;
+    CopyOnWriteMap<VkDeviceMemory, ObjectInfo> createdDeviceMemorys;
+    CopyOnWriteMap<VkFence, ObjectInfo> createdFences;
+    CopyOnWriteMap<VkSwapchainKHR, ObjectInfo> createdSwapchainKHRs;
+    CopyOnWriteMap<VkImage, ObjectInfo> createdImages;
+    CopyOnWriteMap<VkImageView, ObjectInfo> createdImageViews;
+    CopyOnWriteMap<VkBuffer, ObjectInfo> createdBuffers;
+    CopyOnWriteMap<VkBufferView, ObjectInfo> createdBufferViews;
+    CopyOnWriteMap<VkFramebuffer, ObjectInfo> createdFramebuffers;
+    CopyOnWriteMap<VkEvent, ObjectInfo> createdEvents;
+    CopyOnWriteMap<VkQueryPool, ObjectInfo> createdQueryPools;
+    CopyOnWriteMap<VkShaderModule, ObjectInfo> createdShaderModules;
+    CopyOnWriteMap<VkPipelineLayout, ObjectInfo> createdPipelineLayouts;
+    CopyOnWriteMap<VkSampler, ObjectInfo> createdSamplers;
+    CopyOnWriteMap<VkDescriptorSetLayout, ObjectInfo> createdDescriptorSetLayouts;
+    CopyOnWriteMap<VkDescriptorSet, ObjectInfo> createdDescriptorSets;
 };
 }
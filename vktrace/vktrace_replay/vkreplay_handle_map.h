@@ -0,0 +1,194 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Hash map from Vulkan handles to their replay values, used by vkReplayObjMapper.
+//
+// Entries live in one flat array and collisions are resolved by linear
+// probing, so a lookup is normally a single cache line. Erasing shifts later
+// entries of the same probe run back instead of leaving tombstones. Only the
+// subset of the std::map interface the object mapper uses is provided, and
+// unlike std::map, inserting or erasing invalidates iterators and references.
+
+// Handles are pointers for dispatchable objects and either pointers or uint64_t
+// for non-dispatchable ones, depending on the platform.
+template <typename T>
+inline uint64_t vkReplayHandleKey(T *handle) {
+    return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(handle));
+}
+inline uint64_t vkReplayHandleKey(uint64_t handle) { return handle; }
+
+template <typename Key, typename Value>
+class vkReplayHandleMap {
+   public:
+    typedef std::pair<Key, Value> value_type;
+
+    template <bool IsConst>
+    class iteratorBase {
+       public:
+        typedef typename std::conditional<IsConst, const vkReplayHandleMap, vkReplayHandleMap>::type map_type;
+        typedef typename std::conditional<IsConst, const value_type, value_type>::type entry_type;
+
+        iteratorBase() : m_pMap(nullptr), m_index(0) {}
+        iteratorBase(map_type *pMap, size_t index) : m_pMap(pMap), m_index(index) {}
+        // iterator converts to const_iterator
+        iteratorBase(const iteratorBase<false> &other) : m_pMap(other.m_pMap), m_index(other.m_index) {}
+
+        entry_type &operator*() const { return m_pMap->m_entries[m_index]; }
+        entry_type *operator->() const { return &m_pMap->m_entries[m_index]; }
+        iteratorBase &operator++() {
+            m_index = m_pMap->next_used(m_index + 1);
+            return *this;
+        }
+        bool operator==(const iteratorBase &other) const { return m_index == other.m_index; }
+        bool operator!=(const iteratorBase &other) const { return m_index != other.m_index; }
+
+       private:
+        friend class vkReplayHandleMap;
+        friend class iteratorBase<true>;
+        map_type *m_pMap;
+        size_t m_index;
+    };
+    typedef iteratorBase<false> iterator;
+    typedef iteratorBase<true> const_iterator;
+
+    vkReplayHandleMap() : m_count(0), m_shift(64) {}
+
+    iterator begin() { return iterator(this, next_used(0)); }
+    const_iterator begin() const { return const_iterator(this, next_used(0)); }
+    iterator end() { return iterator(this, m_entries.size()); }
+    const_iterator end() const { return const_iterator(this, m_entries.size()); }
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+
+    iterator find(const Key &key) { return iterator(this, find_index(key)); }
+    const_iterator find(const Key &key) const { return const_iterator(this, find_index(key)); }
+    size_t count(const Key &key) const { return find_index(key) != m_entries.size() ? 1 : 0; }
+
+    Value &operator[](const Key &key) {
+        size_t index = find_index(key);
+        if (index != m_entries.size()) {
+            return m_entries[index].second;
+        }
+        // Keep the load factor at or below one half.
+        if ((m_count + 1) * 2 > m_entries.size()) {
+            grow();
+        }
+        index = home(key);
+        while (m_used[index]) {
+            index = (index + 1) & (m_entries.size() - 1);
+        }
+        m_used[index] = 1;
+        m_entries[index].first = key;
+        m_entries[index].second = Value();
+        m_count++;
+        return m_entries[index].second;
+    }
+
+    size_t erase(const Key &key) {
+        size_t index = find_index(key);
+        if (index == m_entries.size()) {
+            return 0;
+        }
+        // Move later entries of the probe run into the hole when that brings them
+        // no further from their home slot, so lookups never need tombstones.
+        size_t mask = m_entries.size() - 1;
+        size_t hole = index;
+        for (size_t next = (hole + 1) & mask; m_used[next]; next = (next + 1) & mask) {
+            size_t nextHome = home(m_entries[next].first);
+            if (((next - nextHome) & mask) >= ((next - hole) & mask)) {
+                m_entries[hole] = std::move(m_entries[next]);
+                hole = next;
+            }
+        }
+        m_used[hole] = 0;
+        m_entries[hole] = value_type();
+        m_count--;
+        return 1;
+    }
+
+    void clear() {
+        m_entries.clear();
+        m_used.clear();
+        m_count = 0;
+        m_shift = 64;
+    }
+
+   private:
+    size_t home(const Key &key) const {
+        // Fibonacci hashing spreads the aligned, often sequential handle values over the table.
+        return static_cast<size_t>((vkReplayHandleKey(key) * 0x9E3779B97F4A7C15ULL) >> m_shift);
+    }
+
+    size_t find_index(const Key &key) const {
+        if (m_count == 0) {
+            return m_entries.size();
+        }
+        size_t mask = m_entries.size() - 1;
+        for (size_t index = home(key); m_used[index]; index = (index + 1) & mask) {
+            if (m_entries[index].first == key) {
+                return index;
+            }
+        }
+        return m_entries.size();
+    }
+
+    size_t next_used(size_t index) const {
+        while (index < m_entries.size() && !m_used[index]) {
+            index++;
+        }
+        return index;
+    }
+
+    void grow() {
+        std::vector<value_type> oldEntries;
+        std::vector<uint8_t> oldUsed;
+        oldEntries.swap(m_entries);
+        oldUsed.swap(m_used);
+
+        size_t capacity = oldEntries.empty() ? 16 : oldEntries.size() * 2;
+        m_entries.resize(capacity);
+        m_used.assign(capacity, 0);
+        m_shift = 64;
+        for (size_t bits = capacity; bits > 1; bits >>= 1) {
+            m_shift--;
+        }
+
+        for (size_t i = 0; i < oldEntries.size(); i++) {
+            if (oldUsed[i]) {
+                size_t index = home(oldEntries[i].first);
+                while (m_used[index]) {
+                    index = (index + 1) & (capacity - 1);
+                }
+                m_used[index] = 1;
+                m_entries[index] = std::move(oldEntries[i]);
+            }
+        }
+    }
+
+    std::vector<value_type> m_entries;
+    std::vector<uint8_t> m_used;
+    size_t m_count;
+    unsigned int m_shift;  // 64 - log2(capacity)
+};
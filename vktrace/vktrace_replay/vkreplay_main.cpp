@@ -33,13 +33,16 @@
 #include "vktrace_tracelog.h"
 #include "vktrace_filelike.h"
 #include "vktrace_trace_packet_utils.h"
+#include "vktrace_trace_index.h"
+#include "vktrace_pageguard_memorycopy.h"
 #include "vkreplay_main.h"
 #include "vkreplay_factory.h"
 #include "vkreplay_seq.h"
+#include "vkreplay_prefetch.h"
 #include "vkreplay_window.h"
 #include "screenshot_parsing.h"
 
-vkreplayer_settings replaySettings = {NULL, 1, -1, -1, NULL, NULL, NULL};
+vkreplayer_settings replaySettings = {NULL, 1, -1, -1, NULL, NULL, NULL, 0};
 
 vktrace_SettingInfo g_settings_info[] = {
     {"o",
@@ -94,6 +97,13 @@ vktrace_SettingInfo g_settings_info[] = {
      {&replaySettings.screenshotColorFormat},
      TRUE,
      "Color Space format of screenshot files. Formats are UNORM, SNORM, USCALED, SSCALED, UINT, SINT, SRGB"},
+    {"pd",
+     "PrefetchDepth",
+     VKTRACE_SETTING_UINT,
+     {&replaySettings.prefetchDepth},
+     {&replaySettings.prefetchDepth},
+     TRUE,
+     "Number of packets to read and interpret ahead of replay on a separate thread, 0 to disable."},
 #if _DEBUG
     {"v",
      "Verbosity",
@@ -118,7 +128,7 @@ vktrace_SettingInfo g_settings_info[] = {
 vktrace_SettingGroup g_replaySettingGroup = {"vkreplay", sizeof(g_settings_info) / sizeof(g_settings_info[0]), &g_settings_info[0]};
 
 namespace vktrace_replay {
-int main_loop(vktrace_replay::ReplayDisplay display, Sequencer& seq, vktrace_trace_packet_replay_library* replayerArray[],
+int main_loop(vktrace_replay::ReplayDisplay display, AbstractSequencer& seq, vktrace_trace_packet_replay_library* replayerArray[],
               vkreplayer_settings settings) {
     int err = 0;
     vktrace_trace_packet_header* packet;
@@ -188,9 +198,9 @@ int main_loop(vktrace_replay::ReplayDisplay display, Sequencer& seq, vktrace_tra
                         vktrace_LogWarning("Tracer_id %d has no valid replayer.", packet->tracer_id);
                         continue;
                     }
-                    if (packet->packet_id >= VKTRACE_TPI_VK_vkApiVersion) {
+                    if (VKTRACE_TPI_IS_API_PACKET(packet->packet_id)) {
                         // replay the API packet
-                        res = replayer->Replay(replayer->Interpret(packet));
+                        res = replayer->Replay(seq.interpret_packet(replayer, packet));
                         if (res != VKTRACE_REPLAY_SUCCESS) {
                             vktrace_LogError("Failed to replay packet_id %d, with global_packet_index %d.", packet->packet_id,
                                              packet->global_packet_index);
@@ -438,9 +448,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
         if (pAllSettings != NULL) {
             vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
         }
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
@@ -451,24 +461,33 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
     // We can't play trace files with a version prior to the minimum compatible version.
     // We also won't attempt to play trace files that are newer than this replayer.
     if (fileHeader.trace_file_version < VKTRACE_TRACE_FILE_VERSION_MINIMUM_COMPATIBLE ||
-        fileHeader.trace_file_version > VKTRACE_TRACE_FILE_VERSION) {
+        fileHeader.trace_file_version > VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED) {
         vktrace_LogError(
             "Trace file version %u is not compatible with this replayer version (%u).\nYou'll need to make a new trace file, or "
             "use "
             "the appropriate replayer.",
             fileHeader.trace_file_version, VKTRACE_TRACE_FILE_VERSION_MINIMUM_COMPATIBLE);
+        vktrace_FileLike_destroy(&traceFile);
+        fclose(tracefp);
+        vktrace_free(pTraceFile);
+        return -1;
+    }
+
+    // A block compressed trace is only readable through its block index.
+    if (VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(fileHeader.trace_file_version) && traceFile->mMode != FileLike::BlockFile) {
+        vktrace_LogError("%s is a compressed trace file but its block index is missing or damaged.", pTraceFile);
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
     // Make sure magic number in trace file is valid and we have at least one gpuinfo struct
     if (fileHeader.magic != VKTRACE_FILE_MAGIC || fileHeader.n_gpuinfo < 1) {
         vktrace_LogError("%s does not appear to be a valid Vulkan trace file.", pTraceFile);
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
@@ -479,9 +498,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
         if (pAllSettings != NULL) {
             vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
         }
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
@@ -492,9 +511,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
         if (pAllSettings != NULL) {
             vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
         }
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
@@ -503,6 +522,22 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
     if (!pFileHeader->portability_table_valid)
         vktrace_LogAlways("Trace file does not appear to contain portability table. Will not attempt to map memoryType indices.");
 
+    if (pFileHeader->time_source == VKTRACE_TIME_SOURCE_TSC) {
+        vktrace_LogVerbose("Packet timestamps were taken from a %llu Hz TSC.", (unsigned long long)pFileHeader->tsc_frequency);
+    }
+
+    // Replay can't start in the middle of a trace, but the trace index tells up front whether the loop range is in it.
+    vktrace_trace_index* pTraceIndex = vktrace_trace_index_load(pTraceFile, traceFile->mFileLen);
+    if (pTraceIndex != NULL) {
+        vktrace_LogVerbose("Trace file has %llu packets in %llu frames.", (unsigned long long)pTraceIndex->header.packetCount,
+                           (unsigned long long)pTraceIndex->header.frameCount);
+        if (replaySettings.loopStartFrame > 0 && (uint64_t)replaySettings.loopStartFrame > pTraceIndex->header.frameCount) {
+            vktrace_LogWarning("Loop start frame %d is past the last frame of the trace (%llu), the whole trace will be looped.",
+                               replaySettings.loopStartFrame, (unsigned long long)pTraceIndex->header.frameCount);
+        }
+        vktrace_trace_index_destroy(&pTraceIndex);
+    }
+
     // load any API specific driver libraries and init replayer objects
     uint8_t tidApi = VKTRACE_TID_RESERVED;
     vktrace_trace_packet_replay_library* replayer[VKTRACE_MAX_TRACER_ID_ARRAY_SIZE];
@@ -545,9 +580,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
                 if (pAllSettings != NULL) {
                     vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
                 }
+                vktrace_FileLike_destroy(&traceFile);
                 fclose(tracefp);
                 vktrace_free(pTraceFile);
-                vktrace_free(traceFile);
                 return -1;
             }
 
@@ -565,9 +600,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
                 if (pAllSettings != NULL) {
                     vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
                 }
+                vktrace_FileLike_destroy(&traceFile);
                 fclose(tracefp);
                 vktrace_free(pTraceFile);
-                vktrace_free(traceFile);
                 return err;
             }
         }
@@ -578,15 +613,36 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
         if (pAllSettings != NULL) {
             vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
         }
+        vktrace_FileLike_destroy(&traceFile);
         fclose(tracefp);
         vktrace_free(pTraceFile);
-        vktrace_free(traceFile);
         return -1;
     }
 
     // main loop
-    Sequencer sequencer(traceFile);
-    err = vktrace_replay::main_loop(disp, sequencer, replayer, replaySettings);
+    // Packets are read ahead on a separate thread if requested, otherwise uncompressed trace
+    // files are replayed straight out of a mapping of the file when possible.
+    vktrace_replay::AbstractSequencer* pSequencer = NULL;
+    if (replaySettings.prefetchDepth > 0) {
+        pSequencer = vktrace_replay::PrefetchSequencer::create(pTraceFile, vktrace_FileLike_GetCurrentPosition(traceFile),
+                                                               replaySettings.prefetchDepth, replayer);
+    }
+    if (pSequencer == NULL) {
+        pSequencer = vktrace_replay::MappedFileSequencer::create(traceFile);
+    }
+    if (pSequencer == NULL) {
+        pSequencer = new vktrace_replay::Sequencer(traceFile);
+    }
+#if defined(USE_PAGEGUARD_SPEEDUP) && !defined(PAGEGUARD_MEMCPY_USE_PPL_LIB)
+    // Mapped memory contents in the trace are copied on the memcpy threads.
+    vktrace_pageguard_init_multi_threads_memcpy();
+    vktrace_pageguard_calibrate_multi_threads_memcpy();
+#endif
+    err = vktrace_replay::main_loop(disp, *pSequencer, replayer, replaySettings);
+    delete pSequencer;
+#if defined(USE_PAGEGUARD_SPEEDUP) && !defined(PAGEGUARD_MEMCPY_USE_PPL_LIB)
+    vktrace_pageguard_done_multi_threads_memcpy();
+#endif
 
     for (int i = 0; i < VKTRACE_MAX_TRACER_ID_ARRAY_SIZE; i++) {
         if (replayer[i] != NULL) {
@@ -599,9 +655,9 @@ int vkreplay_main(int argc, char** argv, vktrace_window_handle window = 0) {
         vktrace_SettingGroup_Delete_Loaded(&pAllSettings, &numAllSettings);
     }
 
+    vktrace_FileLike_destroy(&traceFile);
     fclose(tracefp);
     vktrace_free(pTraceFile);
-    vktrace_free(traceFile);
 
     return err;
 }
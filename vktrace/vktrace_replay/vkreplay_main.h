@@ -30,6 +30,7 @@ typedef struct vkreplayer_settings {
     const char* screenshotList;
     const char* screenshotColorFormat;
     const char* verbosity;
+    unsigned int prefetchDepth;
 } vkreplayer_settings;
 
 #include <vector>
@@ -3,8 +3,45 @@
 
 class objMemory {
    public:
-    objMemory() : m_numAllocations(0), m_pMemReqs(NULL) {}
+    objMemory() : m_numAllocations(0), m_numMemReqs(0), m_pMemReqs(NULL) {}
     ~objMemory() { free(m_pMemReqs); }
+
+    // The handle maps move their entries around as they grow, so copies must not share
+    // m_pMemReqs.
+    objMemory(const objMemory &other) : m_numAllocations(0), m_numMemReqs(0), m_pMemReqs(NULL) { *this = other; }
+    objMemory(objMemory &&other)
+        : m_numAllocations(other.m_numAllocations), m_numMemReqs(other.m_numMemReqs), m_pMemReqs(other.m_pMemReqs) {
+        other.m_numMemReqs = 0;
+        other.m_pMemReqs = NULL;
+    }
+    objMemory &operator=(const objMemory &other) {
+        if (this != &other) {
+            free(m_pMemReqs);
+            m_pMemReqs = NULL;
+            m_numMemReqs = 0;
+            m_numAllocations = other.m_numAllocations;
+            if (other.m_pMemReqs != NULL) {
+                m_pMemReqs = (VkMemoryRequirements *)vktrace_malloc(other.m_numMemReqs * sizeof(VkMemoryRequirements));
+                if (m_pMemReqs != NULL) {
+                    memcpy(m_pMemReqs, other.m_pMemReqs, other.m_numMemReqs * sizeof(VkMemoryRequirements));
+                    m_numMemReqs = other.m_numMemReqs;
+                }
+            }
+        }
+        return *this;
+    }
+    objMemory &operator=(objMemory &&other) {
+        if (this != &other) {
+            free(m_pMemReqs);
+            m_numAllocations = other.m_numAllocations;
+            m_numMemReqs = other.m_numMemReqs;
+            m_pMemReqs = other.m_pMemReqs;
+            other.m_numMemReqs = 0;
+            other.m_pMemReqs = NULL;
+        }
+        return *this;
+    }
+
     void setCount(const uint32_t num) { m_numAllocations = num; }
 
     void setReqs(const VkMemoryRequirements *pReqs, const uint32_t num) {
@@ -18,11 +55,13 @@ class objMemory {
                 return;
             }
             memcpy(m_pMemReqs, pReqs, num * sizeof(VkMemoryRequirements));
+            m_numMemReqs = num;
         }
     }
 
    private:
     uint32_t m_numAllocations;
+    uint32_t m_numMemReqs;
     VkMemoryRequirements *m_pMemReqs;
 };
 
@@ -66,6 +105,9 @@ class gpuMemory {
     // memory and the size of the changed block.  Element [0] of the array describes how many changed blocks are in the
     // package and the combined size of all the changed data. Part B is raw data, these changed data blocks are put in
     // part B one by one, in the order their description appeares in Part A.
+    //
+    // A changed block is a run of changed pages, or with VKTRACE_PAGEGUARD_ENABLE_DELTA set at capture time, any range of bytes
+    // that changed in a page, so the offset and size of a block have no alignment.
 
     void copyMappingDataPageGuard(const void *pSrcData) {
         if (m_mapRange.empty()) {
@@ -84,14 +126,7 @@ class gpuMemory {
         PageGuardChangedBlockInfo *pChangedInfoArray = (PageGuardChangedBlockInfo *)pSrcData;
         if (pChangedInfoArray[0].length) {
             PBYTE pChangedData = (PBYTE)(pSrcData) + sizeof(PageGuardChangedBlockInfo) * (pChangedInfoArray[0].offset + 1);
-            size_t CurrentOffset = 0;
-            for (size_t i = 0; i < pChangedInfoArray[0].offset; i++) {
-                if (pChangedInfoArray[i + 1].length) {
-                    memcpy(mr.pData + (size_t)pChangedInfoArray[i + 1].offset, pChangedData + CurrentOffset,
-                           pChangedInfoArray[i + 1].length);
-                }
-                CurrentOffset += pChangedInfoArray[i + 1].length;
-            }
+            vktrace_pageguard_memcpy_blocks(mr.pData, pChangedData, &pChangedInfoArray[1], pChangedInfoArray[0].offset);
         }
     }
 
@@ -128,7 +163,7 @@ class gpuMemory {
             assert(offset >= mr.offset);
             assert(size <= mr.size && (size + offset) <= (size_t)m_allocInfo.allocationSize);
         }
-        memcpy(mr.pData + offset, pSrcData, size);
+        vktrace_pageguard_memcpy(mr.pData + offset, pSrcData, size);
         if (!mr.pending && entire_map) m_mapRange.pop_back();
     }
 
@@ -170,7 +205,7 @@ class vkReplayObjMapper {
     void init_objMemCount(const uint64_t handle, const VkDebugReportObjectTypeEXT objectType, const uint32_t &num) {
         switch (objectType) {
             case VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT: {
-                std::map<VkBuffer, bufferObj>::iterator it = m_buffers.find((VkBuffer)handle);
+                vkReplayHandleMap<VkBuffer, bufferObj>::iterator it = m_buffers.find((VkBuffer)handle);
                 if (it != m_buffers.end()) {
                     objMemory obj = it->second.bufferMem;
                     obj.setCount(num);
@@ -179,7 +214,7 @@ class vkReplayObjMapper {
                 break;
             }
             case VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT: {
-                std::map<VkImage, imageObj>::iterator it = m_images.find((VkImage)handle);
+                vkReplayHandleMap<VkImage, imageObj>::iterator it = m_images.find((VkImage)handle);
                 if (it != m_images.end()) {
                     objMemory obj = it->second.imageMem;
                     obj.setCount(num);
@@ -197,7 +232,7 @@ class vkReplayObjMapper {
                          const unsigned int num) {
         switch (objectType) {
             case VK_DEBUG_REPORT_OBJECT_TYPE_BUFFER_EXT: {
-                std::map<VkBuffer, bufferObj>::iterator it = m_buffers.find((VkBuffer)handle);
+                vkReplayHandleMap<VkBuffer, bufferObj>::iterator it = m_buffers.find((VkBuffer)handle);
                 if (it != m_buffers.end()) {
                     objMemory obj = it->second.bufferMem;
                     obj.setReqs(pMemReqs, num);
@@ -206,7 +241,7 @@ class vkReplayObjMapper {
                 break;
             }
             case VK_DEBUG_REPORT_OBJECT_TYPE_IMAGE_EXT: {
-                std::map<VkImage, imageObj>::iterator it = m_images.find((VkImage)handle);
+                vkReplayHandleMap<VkImage, imageObj>::iterator it = m_images.find((VkImage)handle);
                 if (it != m_images.end()) {
                     objMemory obj = it->second.imageMem;
                     obj.setReqs(pMemReqs, num);
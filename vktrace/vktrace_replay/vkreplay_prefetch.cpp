@@ -0,0 +1,248 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vkreplay_prefetch.h"
+
+#include <string.h>
+
+extern "C" {
+#include "vktrace_trace_packet_utils.h"
+}
+
+namespace vktrace_replay {
+
+PrefetchSequencer *PrefetchSequencer::create(const char *pTraceFilePath, uint64_t startOffset, uint32_t depth,
+                                             vktrace_trace_packet_replay_library *replayerArray[]) {
+    FILE *pFile = fopen(pTraceFilePath, "rb");
+    if (pFile == NULL) {
+        vktrace_LogError("Cannot open trace file '%s' for prefetching.", pTraceFilePath);
+        return NULL;
+    }
+    FileLike *pFileLike = vktrace_FileLike_create_file(pFile);
+    if (pFileLike == NULL) {
+        fclose(pFile);
+        return NULL;
+    }
+    MappedFileSequencer *pMapped = MappedFileSequencer::create(pFileLike);
+    return new PrefetchSequencer(pFile, pFileLike, pMapped, startOffset, depth, replayerArray);
+}
+
+PrefetchSequencer::PrefetchSequencer(FILE *pFile, FileLike *pFileLike, MappedFileSequencer *pMapped, uint64_t startOffset,
+                                     uint32_t depth, vktrace_trace_packet_replay_library *replayerArray[])
+    : m_pFile(pFile),
+      m_pFileLike(pFileLike),
+      m_pMapped(pMapped),
+      m_depth(depth > 0 ? depth : 1),
+      m_generation(0),
+      m_seekOffset(startOffset),
+      m_releaseLimit(startOffset),
+      m_seekPending(true),
+      m_endOfFile(false),
+      m_stop(false),
+      m_position(startOffset),
+      m_packetCount(0),
+      m_replayWaitCount(0),
+      m_replayWaitTime(0),
+      m_readerWaitCount(0) {
+    for (int i = 0; i < VKTRACE_MAX_TRACER_ID_ARRAY_SIZE; i++) {
+        m_replayerArray[i] = replayerArray[i];
+    }
+    m_current.pPacket = NULL;
+    m_current.pInterpreted = NULL;
+    m_current.interpreted = false;
+    m_current.inPlace = false;
+    m_current.offset = startOffset;
+    m_current.nextOffset = startOffset;
+    m_bookmark.file_offset = startOffset;
+    m_thread = std::thread(&PrefetchSequencer::read_packets, this);
+}
+
+PrefetchSequencer::~PrefetchSequencer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_spaceReady.notify_one();
+    m_thread.join();
+
+    clean_up();
+    for (auto &prefetched : m_queue) {
+        free_packet(prefetched);
+    }
+    m_queue.clear();
+    delete m_pMapped;
+    vktrace_FileLike_destroy(&m_pFileLike);
+    fclose(m_pFile);
+
+    vktrace_LogAlways(
+        "Prefetched %llu packets, up to %zu ahead: replay waited for the reader %llu times (%.3f seconds), the reader waited "
+        "for replay %llu times.",
+        (unsigned long long)m_packetCount, m_depth, (unsigned long long)m_replayWaitCount,
+        static_cast<double>(m_replayWaitTime) / 1000000000, (unsigned long long)m_readerWaitCount);
+}
+
+void PrefetchSequencer::clean_up() { free_packet(m_current); }
+
+void PrefetchSequencer::free_packet(PrefetchedPacket &prefetched) {
+    if (prefetched.pPacket && !prefetched.inPlace) {
+        vktrace_free(prefetched.pPacket);
+    }
+    prefetched.pPacket = NULL;
+}
+
+vktrace_trace_packet_header *PrefetchSequencer::get_next_packet() {
+    clean_up();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_queue.empty() && !m_endOfFile) {
+        m_replayWaitCount++;
+        uint64_t waitStart = vktrace_get_time();
+        m_packetReady.wait(lock, [this] { return !m_queue.empty() || m_endOfFile; });
+        m_replayWaitTime += vktrace_get_time() - waitStart;
+    }
+    if (m_queue.empty()) {
+        return (NULL);
+    }
+
+    m_current = m_queue.front();
+    m_queue.pop_front();
+    m_position = m_current.nextOffset;
+    m_releaseLimit = m_current.offset;
+    m_packetCount++;
+    lock.unlock();
+    m_spaceReady.notify_one();
+    return (m_current.pPacket);
+}
+
+void PrefetchSequencer::get_bookmark(seqBookmark &bookmark) { bookmark.file_offset = m_bookmark.file_offset; }
+
+void PrefetchSequencer::set_bookmark(const seqBookmark &bookmark) {
+    clean_up();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &prefetched : m_queue) {
+        free_packet(prefetched);
+    }
+    m_queue.clear();
+    m_generation++;
+    m_seekOffset = bookmark.file_offset;
+    m_releaseLimit = bookmark.file_offset;
+    m_seekPending = true;
+    m_endOfFile = false;
+    m_position = bookmark.file_offset;
+    m_spaceReady.notify_one();
+}
+
+void PrefetchSequencer::record_bookmark() { m_bookmark.file_offset = m_position; }
+
+vktrace_trace_packet_header *PrefetchSequencer::interpret_packet(vktrace_trace_packet_replay_library *pReplayer,
+                                                                 vktrace_trace_packet_header *pPacket) {
+    if (pPacket == m_current.pPacket && m_current.interpreted) {
+        return m_current.pInterpreted;
+    }
+    return AbstractSequencer::interpret_packet(pReplayer, pPacket);
+}
+
+void PrefetchSequencer::read_packets() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+        if (m_seekPending) {
+            if (m_pMapped) {
+                seqBookmark bookmark;
+                bookmark.file_offset = m_seekOffset;
+                m_pMapped->set_bookmark(bookmark);
+            } else if (!vktrace_FileLike_SetCurrentPosition(m_pFileLike, m_seekOffset)) {
+                vktrace_LogError("Failed to seek to offset %llu of the trace file.", (unsigned long long)m_seekOffset);
+                m_endOfFile = true;
+            }
+            m_seekPending = false;
+            m_packetReady.notify_one();
+        }
+        if (m_endOfFile || m_queue.size() >= m_depth) {
+            if (!m_endOfFile) m_readerWaitCount++;
+            m_spaceReady.wait(lock, [this] { return m_stop || m_seekPending || (!m_endOfFile && m_queue.size() < m_depth); });
+            continue;
+        }
+
+        // Read and interpret the packet without holding the lock.
+        uint64_t generation = m_generation;
+        uint64_t releaseLimit = m_releaseLimit;
+        lock.unlock();
+        PrefetchedPacket prefetched;
+        read_packet(prefetched, releaseLimit);
+        if (prefetched.pPacket != NULL && VKTRACE_TPI_IS_API_PACKET(prefetched.pPacket->packet_id) &&
+            prefetched.pPacket->tracer_id < VKTRACE_MAX_TRACER_ID_ARRAY_SIZE &&
+            m_replayerArray[prefetched.pPacket->tracer_id] != NULL) {
+            // The same packets main_loop would hand to the replayer's Interpret.
+            prefetched.pInterpreted = m_replayerArray[prefetched.pPacket->tracer_id]->Interpret(prefetched.pPacket);
+            prefetched.interpreted = true;
+        }
+        lock.lock();
+
+        if (generation != m_generation) {
+            // set_bookmark moved the read position while this packet was being read.
+            free_packet(prefetched);
+            continue;
+        }
+        if (prefetched.pPacket == NULL) {
+            m_endOfFile = true;
+        } else {
+            m_queue.push_back(prefetched);
+        }
+        m_packetReady.notify_one();
+    }
+}
+
+// Reads the next packet without interpreting it. releaseLimit can only be behind the packets
+// replay still uses, because m_releaseLimit only moves back in set_bookmark, which drops them.
+void PrefetchSequencer::read_packet(PrefetchedPacket &prefetched, uint64_t releaseLimit) {
+    prefetched.pInterpreted = NULL;
+    prefetched.interpreted = false;
+    prefetched.inPlace = false;
+    if (m_pMapped == NULL) {
+        prefetched.offset = vktrace_FileLike_GetCurrentPosition(m_pFileLike);
+        prefetched.pPacket = vktrace_read_trace_packet(m_pFileLike);
+        prefetched.nextOffset = vktrace_FileLike_GetCurrentPosition(m_pFileLike);
+        return;
+    }
+
+    seqBookmark bookmark;
+    m_pMapped->record_bookmark();
+    m_pMapped->get_bookmark(bookmark);
+    prefetched.offset = bookmark.file_offset;
+    m_pMapped->set_release_limit(releaseLimit);
+    prefetched.pPacket = m_pMapped->get_next_packet();
+    m_pMapped->record_bookmark();
+    m_pMapped->get_bookmark(bookmark);
+    prefetched.nextOffset = bookmark.file_offset;
+    if (prefetched.pPacket == NULL || m_pMapped->is_in_place(prefetched.pPacket)) {
+        prefetched.inPlace = (prefetched.pPacket != NULL);
+        return;
+    }
+
+    // Unaligned and deduplicated packets come back in a copy that the next packet reuses.
+    vktrace_trace_packet_header *pCopy = (vktrace_trace_packet_header *)vktrace_malloc((size_t)prefetched.pPacket->size);
+    if (pCopy != NULL) {
+        memcpy(pCopy, prefetched.pPacket, (size_t)prefetched.pPacket->size);
+        pCopy->pBody = (uintptr_t)pCopy + sizeof(vktrace_trace_packet_header);
+    } else {
+        vktrace_LogError("Malloc failed in read_packet of size %llu.", (unsigned long long)prefetched.pPacket->size);
+    }
+    prefetched.pPacket = pCopy;
+}
+
+} /* namespace vktrace_replay */
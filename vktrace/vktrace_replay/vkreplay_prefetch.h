@@ -0,0 +1,101 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "vkreplay_seq.h"
+#include "vkreplay_factory.h"
+
+namespace vktrace_replay {
+
+/* Sequencer that reads and interprets packets on a worker thread, up to a fixed
+ * number of packets ahead of replay, so the replay thread only has to replay them.
+ * The worker opens the trace file again and never touches the FileLike the
+ * replayer itself reads from. If the file can be mapped, the worker hands out
+ * packets in place through its own MappedFileSequencer, which keeps the pages of
+ * packets read ahead until replay is done with them; otherwise it reads each
+ * packet into an allocation of its own. Packets are handed out in file order, and
+ * set_bookmark throws away everything read ahead and restarts the worker at the
+ * bookmark. When it is destroyed it reports how often each side had to wait for
+ * the other, which shows whether a replay is limited by reading the trace or by
+ * replaying it. */
+class PrefetchSequencer : public AbstractSequencer {
+   public:
+    // Starts reading pTraceFilePath at startOffset. Returns NULL if the file can't be opened.
+    static PrefetchSequencer *create(const char *pTraceFilePath, uint64_t startOffset, uint32_t depth,
+                                     vktrace_trace_packet_replay_library *replayerArray[]);
+    ~PrefetchSequencer();
+
+    void clean_up();
+
+    vktrace_trace_packet_header *get_next_packet();
+    void get_bookmark(seqBookmark &bookmark);
+    void set_bookmark(const seqBookmark &bookmark);
+    void record_bookmark();
+    vktrace_trace_packet_header *interpret_packet(vktrace_trace_packet_replay_library *pReplayer,
+                                                  vktrace_trace_packet_header *pPacket);
+
+   private:
+    struct PrefetchedPacket {
+        vktrace_trace_packet_header *pPacket;
+        vktrace_trace_packet_header *pInterpreted;
+        bool interpreted;
+        bool inPlace;         // pPacket points into m_pMapped's mapping, rather than an allocation of its own
+        uint64_t offset;      // file offset of the packet
+        uint64_t nextOffset;  // file offset of the packet after this one
+    };
+
+    PrefetchSequencer(FILE *pFile, FileLike *pFileLike, MappedFileSequencer *pMapped, uint64_t startOffset, uint32_t depth,
+                      vktrace_trace_packet_replay_library *replayerArray[]);
+    void read_packets();
+    void read_packet(PrefetchedPacket &prefetched, uint64_t releaseLimit);
+    static void free_packet(PrefetchedPacket &prefetched);
+
+    FILE *m_pFile;
+    FileLike *m_pFileLike;             // only used by the worker thread
+    MappedFileSequencer *m_pMapped;    // only used by the worker thread, NULL if the file can't be mapped
+    vktrace_trace_packet_replay_library *m_replayerArray[VKTRACE_MAX_TRACER_ID_ARRAY_SIZE];
+    size_t m_depth;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_packetReady;
+    std::condition_variable m_spaceReady;
+    std::deque<PrefetchedPacket> m_queue;
+    uint64_t m_generation;  // bumped by set_bookmark so the worker drops a packet it was reading
+    uint64_t m_seekOffset;
+    uint64_t m_releaseLimit;  // file offset of the oldest packet replay may still use
+    bool m_seekPending;
+    bool m_endOfFile;
+    bool m_stop;
+
+    PrefetchedPacket m_current;
+    uint64_t m_position;  // file offset of the packet after m_current
+    seqBookmark m_bookmark;
+
+    uint64_t m_packetCount;
+    uint64_t m_replayWaitCount;
+    uint64_t m_replayWaitTime;
+    uint64_t m_readerWaitCount;
+};
+
+} /* namespace vktrace_replay */
@@ -0,0 +1,107 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "vktrace_common.h"
+
+// Bump allocator for the temporary arrays the manual replay functions build while
+// remapping a packet, such as the remapped command buffers of a vkQueueSubmit.
+//
+// Nothing allocated from the arena is freed on its own. vkReplay::replay resets the
+// arena before each packet, which releases everything the previous packet allocated,
+// so error returns can't leak. Memory is handed out from large blocks; when a packet
+// needs more than one block, reset() replaces them with a single block big enough for
+// all of it, so replay settles into one block and no malloc or free per packet.
+class vkReplayScratchArena {
+   public:
+    vkReplayScratchArena() : m_used(0) {}
+    ~vkReplayScratchArena() { release_blocks(); }
+
+    // Uninitialized storage for count objects of type T, valid until the next reset().
+    // Returns NULL only if memory runs out.
+    template <typename T>
+    T *alloc(size_t count) {
+        return static_cast<T *>(allocate(count * sizeof(T)));
+    }
+
+    void *allocate(size_t size) {
+        // Zero sized requests still get a distinct pointer, as malloc would give them.
+        size = (size + kAlignment - 1) & ~(kAlignment - 1);
+        if (size == 0) {
+            size = kAlignment;
+        }
+        if (m_blocks.empty() || size > m_blocks.back().size - m_used) {
+            size_t blockSize = m_blocks.empty() ? kMinBlockSize : m_blocks.back().size * 2;
+            if (blockSize < size) {
+                blockSize = size;
+            }
+            if (!add_block(blockSize)) {
+                return NULL;
+            }
+        }
+        void *pData = m_blocks.back().pData + m_used;
+        m_used += size;
+        return pData;
+    }
+
+    void reset() {
+        if (m_blocks.size() > 1) {
+            size_t total = 0;
+            for (size_t i = 0; i < m_blocks.size(); i++) {
+                total += m_blocks[i].size;
+            }
+            release_blocks();
+            add_block(total);
+        }
+        m_used = 0;
+    }
+
+   private:
+    static const size_t kAlignment = 16;
+    static const size_t kMinBlockSize = 64 * 1024;
+
+    struct Block {
+        uint8_t *pData;
+        size_t size;
+    };
+
+    bool add_block(size_t size) {
+        Block block;
+        block.pData = static_cast<uint8_t *>(vktrace_malloc(size));
+        if (block.pData == NULL) {
+            return false;
+        }
+        block.size = size;
+        m_blocks.push_back(block);
+        m_used = 0;
+        return true;
+    }
+
+    void release_blocks() {
+        for (size_t i = 0; i < m_blocks.size(); i++) {
+            vktrace_free(m_blocks[i].pData);
+        }
+        m_blocks.clear();
+    }
+
+    std::vector<Block> m_blocks;
+    size_t m_used;  // bytes used in the last block
+};
@@ -19,6 +19,13 @@
  * Author: Jon Ashburn <jon@lunarg.com>
  **************************************************************************/
 #include "vkreplay_seq.h"
+#include "vkreplay_factory.h"
+
+#include <string.h>
+#if defined(PLATFORM_POSIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 extern "C" {
 #include "vktrace_trace_packet_utils.h"
@@ -26,6 +33,11 @@ extern "C" {
 
 namespace vktrace_replay {
 
+vktrace_trace_packet_header *AbstractSequencer::interpret_packet(vktrace_trace_packet_replay_library *pReplayer,
+                                                                 vktrace_trace_packet_header *pPacket) {
+    return pReplayer->Interpret(pPacket);
+}
+
 vktrace_trace_packet_header *Sequencer::get_next_packet() {
     vktrace_free(m_lastPacket);
     if (!m_pFile) return (NULL);
@@ -39,4 +51,179 @@ void Sequencer::set_bookmark(const seqBookmark &bookmark) { vktrace_FileLike_Set
 
 void Sequencer::record_bookmark() { m_bookmark.file_offset = vktrace_FileLike_GetCurrentPosition(m_pFile); }
 
+// Pages ahead of the replay position are requested from the kernel, and pages behind it
+// are given back, this many bytes at a time.
+static const uint64_t kMappedWindowSize = 32 * 1024 * 1024;
+
+MappedFileSequencer *MappedFileSequencer::create(FileLike *pFile) {
+#if defined(PLATFORM_POSIX)
+    if (pFile == NULL || pFile->mMode != FileLike::File || pFile->mFile == NULL || pFile->mFileLen == 0 ||
+        pFile->mFileLen != (size_t)pFile->mFileLen) {
+        return NULL;
+    }
+
+    int fd = fileno(pFile->mFile);
+    void *pBase = mmap(NULL, (size_t)pFile->mFileLen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (pBase == MAP_FAILED) {
+        vktrace_LogWarning("Unable to map the trace file into memory, reading it with file I/O instead.");
+        return NULL;
+    }
+    madvise(pBase, (size_t)pFile->mFileLen, MADV_SEQUENTIAL);
+
+    return new MappedFileSequencer(fd, (uint8_t *)pBase, pFile->mFileLen, vktrace_FileLike_GetCurrentPosition(pFile),
+                                   (uint64_t)sysconf(_SC_PAGESIZE));
+#else
+    return NULL;
+#endif
+}
+
+MappedFileSequencer::MappedFileSequencer(int fd, uint8_t *pBase, uint64_t length, uint64_t position, uint64_t pageSize)
+    : m_fd(fd),
+      m_pBase(pBase),
+      m_length(length),
+      m_pageSize(pageSize),
+      m_position(position),
+      m_dirtyBegin(position & ~(pageSize - 1)),
+      m_dirtyEnd(position),
+      m_willNeedEnd(position),
+      m_releaseLimit(UINT64_MAX),
+      m_pCopy(NULL),
+      m_pDedupReader(NULL) {
+    m_bookmark.file_offset = position;
+}
+
+MappedFileSequencer::~MappedFileSequencer() {
+    clean_up();
+    vktrace_dedup_reader_destroy(&m_pDedupReader);
+#if defined(PLATFORM_POSIX)
+    munmap(m_pBase, (size_t)m_length);
+#endif
+}
+
+void MappedFileSequencer::clean_up() {
+    if (m_pCopy) {
+        vktrace_free(m_pCopy);
+        m_pCopy = NULL;
+    }
+}
+
+vktrace_trace_packet_header *MappedFileSequencer::get_next_packet() {
+    clean_up();
+    if (m_position + sizeof(uint64_t) > m_length) return (NULL);
+
+    uint64_t packetOffset = m_position;
+    uint64_t total_packet_size;
+    memcpy(&total_packet_size, m_pBase + packetOffset, sizeof(uint64_t));
+    if (total_packet_size < sizeof(vktrace_trace_packet_header) || total_packet_size > m_length - packetOffset) {
+        vktrace_LogError("Trace packet at offset %llu has an invalid size of %llu.", (unsigned long long)packetOffset,
+                         (unsigned long long)total_packet_size);
+        return (NULL);
+    }
+    m_position += total_packet_size;
+
+    vktrace_trace_packet_header *pHeader = (vktrace_trace_packet_header *)(m_pBase + packetOffset);
+    if (((uintptr_t)pHeader & 7) != 0) {
+        m_pCopy = (vktrace_trace_packet_header *)vktrace_malloc((size_t)total_packet_size);
+        if (m_pCopy == NULL) {
+            vktrace_LogError("Malloc failed in get_next_packet of size %llu.", (unsigned long long)total_packet_size);
+            return (NULL);
+        }
+        memcpy(m_pCopy, pHeader, (size_t)total_packet_size);
+        pHeader = m_pCopy;
+    } else if (m_position > m_dirtyEnd) {
+        // Interpreting the packet writes to it, so its pages no longer match the file.
+        m_dirtyEnd = m_position;
+    }
+    pHeader->pBody = (uintptr_t)pHeader + sizeof(vktrace_trace_packet_header);
+
+    if (pHeader->packet_id == VKTRACE_TPI_DEDUPLICATED_PACKET) {
+        if (m_pDedupReader == NULL) {
+            m_pDedupReader = vktrace_dedup_reader_create(0);
+        }
+        vktrace_trace_packet_header *pRestored = vktrace_dedup_reader_restore(m_pDedupReader, pHeader, read_file, this);
+        clean_up();
+        if (pRestored == NULL) {
+            return (NULL);
+        }
+        m_pCopy = pRestored;
+        pHeader = pRestored;
+    }
+
+    update_windows(packetOffset);
+    return (pHeader);
+}
+
+// Chunks of deduplicated packets are read from the file rather than the mapping, whose
+// pages may hold packets that have already been interpreted.
+BOOL MappedFileSequencer::read_file(void *pUserData, uint64_t fileOffset, void *pBytes, uint64_t size) {
+#if defined(PLATFORM_POSIX)
+    MappedFileSequencer *pSequencer = (MappedFileSequencer *)pUserData;
+    uint8_t *pDst = (uint8_t *)pBytes;
+    while (size > 0) {
+        ssize_t count = pread(pSequencer->m_fd, pDst, (size_t)size, (off_t)fileOffset);
+        if (count <= 0) {
+            vktrace_LogError("Unable to read %llu bytes at trace file offset %llu.", (unsigned long long)size,
+                             (unsigned long long)fileOffset);
+            return FALSE;
+        }
+        pDst += count;
+        fileOffset += (uint64_t)count;
+        size -= (uint64_t)count;
+    }
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+void MappedFileSequencer::get_bookmark(seqBookmark &bookmark) { bookmark.file_offset = m_bookmark.file_offset; }
+
+void MappedFileSequencer::set_bookmark(const seqBookmark &bookmark) {
+    // Packets replayed since the bookmark have been interpreted in place, so their pages
+    // are put back to what the file holds before they are handed out again.
+    clean_up();
+    uint64_t begin = bookmark.file_offset & ~(m_pageSize - 1);
+    discard_changes(begin > m_dirtyBegin ? begin : m_dirtyBegin, m_dirtyEnd);
+    m_position = bookmark.file_offset;
+    m_dirtyBegin = begin;
+    m_dirtyEnd = bookmark.file_offset;
+    m_willNeedEnd = bookmark.file_offset;
+}
+
+void MappedFileSequencer::record_bookmark() { m_bookmark.file_offset = m_position; }
+
+void MappedFileSequencer::update_windows(uint64_t packetOffset) {
+#if defined(PLATFORM_POSIX)
+    if (m_position + kMappedWindowSize / 2 > m_willNeedEnd && m_willNeedEnd < m_length) {
+        uint64_t begin = m_willNeedEnd & ~(m_pageSize - 1);
+        uint64_t end = (m_position + kMappedWindowSize < m_length) ? m_position + kMappedWindowSize : m_length;
+        madvise(m_pBase + begin, (size_t)(end - begin), MADV_WILLNEED);
+        m_willNeedEnd = end;
+    }
+
+    // Nothing before the current packet, or the release limit, is referenced any more.
+    uint64_t releaseEnd = (packetOffset < m_releaseLimit ? packetOffset : m_releaseLimit) & ~(m_pageSize - 1);
+    if (releaseEnd >= m_dirtyBegin + kMappedWindowSize) {
+        discard_changes(m_dirtyBegin, releaseEnd);
+        m_dirtyBegin = releaseEnd;
+    }
+#endif
+}
+
+void MappedFileSequencer::discard_changes(uint64_t begin, uint64_t end) {
+#if defined(PLATFORM_POSIX)
+    // Mapping the file again over a range drops its private copies of modified pages,
+    // which both restores the original packets and returns the memory.
+    begin &= ~(m_pageSize - 1);
+    end = (end + m_pageSize - 1) & ~(m_pageSize - 1);
+    if (end <= begin) return;
+    if (mmap(m_pBase + begin, (size_t)(end - begin), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, m_fd, (off_t)begin) ==
+        MAP_FAILED) {
+        vktrace_LogError("Unable to remap trace file range %llu-%llu.", (unsigned long long)begin, (unsigned long long)end);
+        return;
+    }
+    madvise(m_pBase + begin, (size_t)(end - begin), MADV_SEQUENTIAL);
+#endif
+}
+
 } /* namespace vktrace_replay */
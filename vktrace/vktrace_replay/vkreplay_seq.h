@@ -34,6 +34,8 @@ struct seqBookmark {
     uint64_t file_offset;
 };
 
+struct vktrace_trace_packet_replay_library;
+
 // replay Sequencer interface
 class AbstractSequencer {
    public:
@@ -41,6 +43,12 @@ class AbstractSequencer {
     virtual vktrace_trace_packet_header *get_next_packet() = 0;
     virtual void get_bookmark(seqBookmark &bookmark) = 0;
     virtual void set_bookmark(const seqBookmark &bookmark) = 0;
+    virtual void record_bookmark() = 0;
+    virtual void clean_up() = 0;
+
+    // Returns the packet last returned by get_next_packet, interpreted for pReplayer.
+    virtual vktrace_trace_packet_header *interpret_packet(vktrace_trace_packet_replay_library *pReplayer,
+                                                          vktrace_trace_packet_header *pPacket);
 };
 
 class Sequencer : public AbstractSequencer {
@@ -66,4 +74,52 @@ class Sequencer : public AbstractSequencer {
     FileLike *m_pFile;
 };
 
+/* Sequencer for uncompressed trace files that maps the whole file and hands out
+ * packets in place instead of reading each one into its own allocation. The
+ * mapping is private, so packets can still be interpreted (which rewrites their
+ * offsets as pointers) without touching the file. Like Sequencer, a packet is
+ * only valid until the next get_next_packet or set_bookmark call. */
+class MappedFileSequencer : public AbstractSequencer {
+   public:
+    // Returns NULL if pFile can't be mapped (sockets, block compressed files, platforms
+    // without mmap), in which case the caller should use Sequencer instead.
+    static MappedFileSequencer *create(FileLike *pFile);
+    ~MappedFileSequencer();
+
+    void clean_up();
+
+    vktrace_trace_packet_header *get_next_packet();
+    void get_bookmark(seqBookmark &bookmark);
+    void set_bookmark(const seqBookmark &bookmark);
+    void record_bookmark();
+
+    // Packets from fileOffset on are kept as they are, for callers that use packets
+    // after the next get_next_packet call. By default only the last packet is kept.
+    void set_release_limit(uint64_t fileOffset) { m_releaseLimit = fileOffset; }
+    // Returns true if pPacket was handed out in place, false if it is a copy that
+    // is only valid until the next get_next_packet or set_bookmark call.
+    bool is_in_place(const vktrace_trace_packet_header *pPacket) const {
+        return (const uint8_t *)pPacket >= m_pBase && (const uint8_t *)pPacket < m_pBase + m_length;
+    }
+
+   private:
+    MappedFileSequencer(int fd, uint8_t *pBase, uint64_t length, uint64_t position, uint64_t pageSize);
+    void update_windows(uint64_t packetOffset);
+    void discard_changes(uint64_t begin, uint64_t end);
+    static BOOL read_file(void *pUserData, uint64_t fileOffset, void *pBytes, uint64_t size);
+
+    int m_fd;
+    uint8_t *m_pBase;
+    uint64_t m_length;
+    uint64_t m_pageSize;
+    uint64_t m_position;      // file offset of the next packet
+    uint64_t m_dirtyBegin;    // pages outside [m_dirtyBegin, m_dirtyEnd) hold unmodified file data
+    uint64_t m_dirtyEnd;
+    uint64_t m_willNeedEnd;   // end of the range already requested with MADV_WILLNEED
+    uint64_t m_releaseLimit;  // pages from here on are not given back
+    vktrace_trace_packet_header *m_pCopy;  // for packets that aren't 8 byte aligned in the file, or were deduplicated
+    vktrace_dedup_reader *m_pDedupReader;  // created on the first deduplicated packet
+    seqBookmark m_bookmark;
+};
+
 } /* namespace vktrace_replay */
@@ -552,7 +552,7 @@ VkResult vkReplay::manually_replay_vkEnumeratePhysicalDevices(packet_vkEnumerate
             vktrace_LogError("Skipping vkEnumeratePhysicalDevices() due to invalid remapped VkInstance.");
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
-        if (pPacket->pPhysicalDevices != NULL) pDevices = VKTRACE_NEW_ARRAY(VkPhysicalDevice, deviceCount);
+        if (pPacket->pPhysicalDevices != NULL) pDevices = m_scratch.alloc<VkPhysicalDevice>(deviceCount);
         replayResult = m_vkFuncs.EnumeratePhysicalDevices(remappedInstance, &deviceCount, pDevices);
 
         // TODO handle different number of physical devices in trace versus replay
@@ -570,7 +570,6 @@ VkResult vkReplay::manually_replay_vkEnumeratePhysicalDevices(packet_vkEnumerate
                 m_objMapper.add_to_physicaldevices_map(pPacket->pPhysicalDevices[i], pDevices[i]);
             }
         }
-        VKTRACE_DELETE(pDevices);
     }
     return replayResult;
 }
@@ -626,10 +625,7 @@ VkResult vkReplay::manually_replay_vkQueueSubmit(packet_vkQueueSubmit *pPacket)
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkSubmitInfo *remappedSubmits = NULL;
-    remappedSubmits = VKTRACE_NEW_ARRAY(VkSubmitInfo, pPacket->submitCount);
-    VkCommandBuffer *pRemappedBuffers = NULL;
-    VkSemaphore *pRemappedWaitSems = NULL, *pRemappedSignalSems = NULL;
+    VkSubmitInfo *remappedSubmits = m_scratch.alloc<VkSubmitInfo>(pPacket->submitCount);
 
     for (uint32_t submit_idx = 0; submit_idx < pPacket->submitCount; submit_idx++) {
         const VkSubmitInfo *submit = &pPacket->pSubmits[submit_idx];
@@ -641,56 +637,43 @@ VkResult vkReplay::manually_replay_vkQueueSubmit(packet_vkQueueSubmit *pPacket)
         // Remap Semaphores & CommandBuffers for this submit
         uint32_t i = 0;
         if (submit->pCommandBuffers != NULL) {
-            pRemappedBuffers = VKTRACE_NEW_ARRAY(VkCommandBuffer, submit->commandBufferCount);
+            VkCommandBuffer *pRemappedBuffers = m_scratch.alloc<VkCommandBuffer>(submit->commandBufferCount);
             remappedSubmit->pCommandBuffers = pRemappedBuffers;
             remappedSubmit->commandBufferCount = submit->commandBufferCount;
             for (i = 0; i < submit->commandBufferCount; i++) {
                 *(pRemappedBuffers + i) = m_objMapper.remap_commandbuffers(*(submit->pCommandBuffers + i));
                 if (*(pRemappedBuffers + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueueSubmit() due to invalid remapped VkCommandBuffer.");
-                    VKTRACE_DELETE(remappedSubmits);
-                    VKTRACE_DELETE(pRemappedBuffers);
                     return replayResult;
                 }
             }
         }
         if (submit->pWaitSemaphores != NULL) {
-            pRemappedWaitSems = VKTRACE_NEW_ARRAY(VkSemaphore, submit->waitSemaphoreCount);
+            VkSemaphore *pRemappedWaitSems = m_scratch.alloc<VkSemaphore>(submit->waitSemaphoreCount);
             remappedSubmit->pWaitSemaphores = pRemappedWaitSems;
             remappedSubmit->waitSemaphoreCount = submit->waitSemaphoreCount;
             for (i = 0; i < submit->waitSemaphoreCount; i++) {
                 (*(pRemappedWaitSems + i)) = m_objMapper.remap_semaphores((*(submit->pWaitSemaphores + i)));
                 if (*(pRemappedWaitSems + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueueSubmit() due to invalid remapped wait VkSemaphore.");
-                    VKTRACE_DELETE(remappedSubmits);
-                    VKTRACE_DELETE(pRemappedBuffers);
-                    VKTRACE_DELETE(pRemappedWaitSems);
                     return replayResult;
                 }
             }
         }
         if (submit->pSignalSemaphores != NULL) {
-            pRemappedSignalSems = VKTRACE_NEW_ARRAY(VkSemaphore, submit->signalSemaphoreCount);
+            VkSemaphore *pRemappedSignalSems = m_scratch.alloc<VkSemaphore>(submit->signalSemaphoreCount);
             remappedSubmit->pSignalSemaphores = pRemappedSignalSems;
             remappedSubmit->signalSemaphoreCount = submit->signalSemaphoreCount;
             for (i = 0; i < submit->signalSemaphoreCount; i++) {
                 (*(pRemappedSignalSems + i)) = m_objMapper.remap_semaphores((*(submit->pSignalSemaphores + i)));
                 if (*(pRemappedSignalSems + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueueSubmit() due to invalid remapped signal VkSemaphore.");
-                    VKTRACE_DELETE(remappedSubmits);
-                    VKTRACE_DELETE(pRemappedBuffers);
-                    VKTRACE_DELETE(pRemappedWaitSems);
-                    VKTRACE_DELETE(pRemappedSignalSems);
                     return replayResult;
                 }
             }
         }
     }
     replayResult = m_vkDeviceFuncs.QueueSubmit(remappedQueue, pPacket->submitCount, remappedSubmits, remappedFence);
-    VKTRACE_DELETE(pRemappedBuffers);
-    VKTRACE_DELETE(pRemappedWaitSems);
-    VKTRACE_DELETE(pRemappedSignalSems);
-    VKTRACE_DELETE(remappedSubmits);
     return replayResult;
 }
 
@@ -708,7 +691,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkBindSparseInfo *remappedBindSparseInfos = VKTRACE_NEW_ARRAY(VkBindSparseInfo, pPacket->bindInfoCount);
+    VkBindSparseInfo *remappedBindSparseInfos = m_scratch.alloc<VkBindSparseInfo>(pPacket->bindInfoCount);
     VkSparseImageMemoryBind *pRemappedImageMemories = NULL;
     VkSparseMemoryBind *pRemappedBufferMemories = NULL;
     VkSparseMemoryBind *pRemappedImageOpaqueMemories = NULL;
@@ -724,7 +707,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
         vktrace_interpret_pnext_pointers(pPacket->header, (void *)&remappedBindSparseInfos[bindInfo_idx]);
 
         if (remappedBindSparseInfos[bindInfo_idx].pBufferBinds) {
-            sBMBinf = VKTRACE_NEW_ARRAY(VkSparseBufferMemoryBindInfo, remappedBindSparseInfos[bindInfo_idx].bufferBindCount);
+            sBMBinf = m_scratch.alloc<VkSparseBufferMemoryBindInfo>(remappedBindSparseInfos[bindInfo_idx].bufferBindCount);
             remappedBindSparseInfos[bindInfo_idx].pBufferBinds =
                 (const VkSparseBufferMemoryBindInfo *)(vktrace_trace_packet_interpret_buffer_pointer(
                     pPacket->header, (intptr_t)remappedBindSparseInfos[bindInfo_idx].pBufferBinds));
@@ -735,7 +718,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
             if (sBMBinf->buffer == VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkBuffer.");
-                goto FAILURE;
+                return replayResult;
             }
 
             if (sBMBinf->bindCount > 0 && sBMBinf->pBinds) {
@@ -749,7 +732,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
                 if (replay_mem == VK_NULL_HANDLE || local_mem.pGpuMem == NULL) {
                     vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkDeviceMemory.");
-                    goto FAILURE;
+                    return replayResult;
                 }
                 pRemappedBufferMemories[bindCountIdx].memory = replay_mem;
             }
@@ -758,7 +741,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
         }
 
         if (remappedBindSparseInfos[bindInfo_idx].pImageBinds) {
-            sIMBinf = VKTRACE_NEW_ARRAY(VkSparseImageMemoryBindInfo, remappedBindSparseInfos[bindInfo_idx].imageBindCount);
+            sIMBinf = m_scratch.alloc<VkSparseImageMemoryBindInfo>(remappedBindSparseInfos[bindInfo_idx].imageBindCount);
             remappedBindSparseInfos[bindInfo_idx].pImageBinds =
                 (const VkSparseImageMemoryBindInfo *)(vktrace_trace_packet_interpret_buffer_pointer(
                     pPacket->header, (intptr_t)remappedBindSparseInfos[bindInfo_idx].pImageBinds));
@@ -769,7 +752,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
             if (sIMBinf->image == VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkImage.");
-                goto FAILURE;
+                return replayResult;
             }
 
             if (sIMBinf->bindCount > 0 && sIMBinf->pBinds) {
@@ -782,7 +765,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
                 if (replay_mem == VK_NULL_HANDLE || local_mem.pGpuMem == NULL) {
                     vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkDeviceMemory.");
-                    goto FAILURE;
+                    return replayResult;
                 }
                 pRemappedImageMemories[bindCountIdx].memory = replay_mem;
             }
@@ -792,7 +775,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
         if (remappedBindSparseInfos[bindInfo_idx].pImageOpaqueBinds) {
             sIMOBinf =
-                VKTRACE_NEW_ARRAY(VkSparseImageOpaqueMemoryBindInfo, remappedBindSparseInfos[bindInfo_idx].imageOpaqueBindCount);
+                m_scratch.alloc<VkSparseImageOpaqueMemoryBindInfo>(remappedBindSparseInfos[bindInfo_idx].imageOpaqueBindCount);
             remappedBindSparseInfos[bindInfo_idx].pImageOpaqueBinds =
                 (const VkSparseImageOpaqueMemoryBindInfo *)(vktrace_trace_packet_interpret_buffer_pointer(
                     pPacket->header, (intptr_t)remappedBindSparseInfos[bindInfo_idx].pImageOpaqueBinds));
@@ -803,7 +786,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
             if (sIMOBinf->image == VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkImage.");
-                goto FAILURE;
+                return replayResult;
             }
 
             if (sIMOBinf->bindCount > 0 && sIMOBinf->pBinds) {
@@ -817,7 +800,7 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
 
                 if (replay_mem == VK_NULL_HANDLE || local_mem.pGpuMem == NULL) {
                     vktrace_LogError("Skipping vkQueueBindSparse() due to invalid remapped VkDeviceMemory.");
-                    goto FAILURE;
+                    return replayResult;
                 }
                 pRemappedImageOpaqueMemories[bindCountIdx].memory = replay_mem;
             }
@@ -826,40 +809,32 @@ VkResult vkReplay::manually_replay_vkQueueBindSparse(packet_vkQueueBindSparse *p
         }
 
         if (remappedBindSparseInfos[bindInfo_idx].pWaitSemaphores != NULL) {
-            pRemappedWaitSems = VKTRACE_NEW_ARRAY(VkSemaphore, remappedBindSparseInfos[bindInfo_idx].waitSemaphoreCount);
+            pRemappedWaitSems = m_scratch.alloc<VkSemaphore>(remappedBindSparseInfos[bindInfo_idx].waitSemaphoreCount);
             remappedBindSparseInfos[bindInfo_idx].pWaitSemaphores = pRemappedWaitSems;
             for (uint32_t i = 0; i < remappedBindSparseInfos[bindInfo_idx].waitSemaphoreCount; i++) {
                 (*(pRemappedWaitSems + i)) =
-                    m_objMapper.remap_semaphores((*(remappedBindSparseInfos[bindInfo_idx].pWaitSemaphores + i)));
+                    m_objMapper.remap_semaphores((*(pPacket->pBindInfo[bindInfo_idx].pWaitSemaphores + i)));
                 if (*(pRemappedWaitSems + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueueSubmit() due to invalid remapped wait VkSemaphore.");
-                    goto FAILURE;
+                    return replayResult;
                 }
             }
         }
         if (remappedBindSparseInfos[bindInfo_idx].pSignalSemaphores != NULL) {
-            pRemappedSignalSems = VKTRACE_NEW_ARRAY(VkSemaphore, remappedBindSparseInfos[bindInfo_idx].signalSemaphoreCount);
+            pRemappedSignalSems = m_scratch.alloc<VkSemaphore>(remappedBindSparseInfos[bindInfo_idx].signalSemaphoreCount);
             remappedBindSparseInfos[bindInfo_idx].pSignalSemaphores = pRemappedSignalSems;
             for (uint32_t i = 0; i < remappedBindSparseInfos[bindInfo_idx].signalSemaphoreCount; i++) {
                 (*(pRemappedSignalSems + i)) =
-                    m_objMapper.remap_semaphores((*(remappedBindSparseInfos[bindInfo_idx].pSignalSemaphores + i)));
+                    m_objMapper.remap_semaphores((*(pPacket->pBindInfo[bindInfo_idx].pSignalSemaphores + i)));
                 if (*(pRemappedSignalSems + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueueSubmit() due to invalid remapped signal VkSemaphore.");
-                    goto FAILURE;
+                    return replayResult;
                 }
             }
         }
     }
 
     replayResult = m_vkDeviceFuncs.QueueBindSparse(remappedQueue, pPacket->bindInfoCount, remappedBindSparseInfos, remappedFence);
-
-FAILURE:
-    VKTRACE_DELETE(remappedBindSparseInfos);
-    VKTRACE_DELETE(sIMBinf);
-    VKTRACE_DELETE(sBMBinf);
-    VKTRACE_DELETE(sIMOBinf);
-    VKTRACE_DELETE(pRemappedSignalSems);
-    VKTRACE_DELETE(pRemappedWaitSems);
     return replayResult;
 }
 
@@ -876,14 +851,14 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
     // allocate a new array for the writes and clear the memory, we'll update the contents further down
     VkWriteDescriptorSet *pRemappedWrites = NULL;
     if (pPacket->descriptorWriteCount > 0) {
-        pRemappedWrites = VKTRACE_NEW_ARRAY(VkWriteDescriptorSet, pPacket->descriptorWriteCount);
+        pRemappedWrites = m_scratch.alloc<VkWriteDescriptorSet>(pPacket->descriptorWriteCount);
         memset(pRemappedWrites, 0, pPacket->descriptorWriteCount * sizeof(VkWriteDescriptorSet));
     }
 
     // allocate a new array for the copies, and simply copy the original data in since there are no pointers to update.
     VkCopyDescriptorSet *pRemappedCopies = NULL;
     if (pPacket->descriptorCopyCount > 0) {
-        pRemappedCopies = VKTRACE_NEW_ARRAY(VkCopyDescriptorSet, pPacket->descriptorCopyCount);
+        pRemappedCopies = m_scratch.alloc<VkCopyDescriptorSet>(pPacket->descriptorCopyCount);
         memcpy(pRemappedCopies, pPacket->pDescriptorCopies, pPacket->descriptorCopyCount * sizeof(VkCopyDescriptorSet));
     }
 
@@ -906,7 +881,7 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
         switch (pPacket->pDescriptorWrites[i].descriptorType) {
             case VK_DESCRIPTOR_TYPE_SAMPLER:
                 pRemappedWrites[i].pImageInfo =
-                    VKTRACE_NEW_ARRAY(VkDescriptorImageInfo, pPacket->pDescriptorWrites[i].descriptorCount);
+                    m_scratch.alloc<VkDescriptorImageInfo>(pPacket->pDescriptorWrites[i].descriptorCount);
                 memcpy((void *)pRemappedWrites[i].pImageInfo, pPacket->pDescriptorWrites[i].pImageInfo,
                        pPacket->pDescriptorWrites[i].descriptorCount * sizeof(VkDescriptorImageInfo));
                 for (uint32_t j = 0; j < pPacket->pDescriptorWrites[i].descriptorCount; j++) {
@@ -925,7 +900,7 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
             case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
             case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
                 pRemappedWrites[i].pImageInfo =
-                    VKTRACE_NEW_ARRAY(VkDescriptorImageInfo, pPacket->pDescriptorWrites[i].descriptorCount);
+                    m_scratch.alloc<VkDescriptorImageInfo>(pPacket->pDescriptorWrites[i].descriptorCount);
                 memcpy((void *)pRemappedWrites[i].pImageInfo, pPacket->pDescriptorWrites[i].pImageInfo,
                        pPacket->pDescriptorWrites[i].descriptorCount * sizeof(VkDescriptorImageInfo));
                 for (uint32_t j = 0; j < pPacket->pDescriptorWrites[i].descriptorCount; j++) {
@@ -942,7 +917,7 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
                 break;
             case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
                 pRemappedWrites[i].pImageInfo =
-                    VKTRACE_NEW_ARRAY(VkDescriptorImageInfo, pPacket->pDescriptorWrites[i].descriptorCount);
+                    m_scratch.alloc<VkDescriptorImageInfo>(pPacket->pDescriptorWrites[i].descriptorCount);
                 memcpy((void *)pRemappedWrites[i].pImageInfo, pPacket->pDescriptorWrites[i].pImageInfo,
                        pPacket->pDescriptorWrites[i].descriptorCount * sizeof(VkDescriptorImageInfo));
                 for (uint32_t j = 0; j < pPacket->pDescriptorWrites[i].descriptorCount; j++) {
@@ -968,8 +943,7 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
                 break;
             case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
             case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-                pRemappedWrites[i].pTexelBufferView =
-                    VKTRACE_NEW_ARRAY(VkBufferView, pPacket->pDescriptorWrites[i].descriptorCount);
+                pRemappedWrites[i].pTexelBufferView = m_scratch.alloc<VkBufferView>(pPacket->pDescriptorWrites[i].descriptorCount);
                 memcpy((void *)pRemappedWrites[i].pTexelBufferView, pPacket->pDescriptorWrites[i].pTexelBufferView,
                        pPacket->pDescriptorWrites[i].descriptorCount * sizeof(VkBufferView));
                 for (uint32_t j = 0; j < pPacket->pDescriptorWrites[i].descriptorCount; j++) {
@@ -989,7 +963,7 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
             case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
             case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
                 pRemappedWrites[i].pBufferInfo =
-                    VKTRACE_NEW_ARRAY(VkDescriptorBufferInfo, pPacket->pDescriptorWrites[i].descriptorCount);
+                    m_scratch.alloc<VkDescriptorBufferInfo>(pPacket->pDescriptorWrites[i].descriptorCount);
                 memcpy((void *)pRemappedWrites[i].pBufferInfo, pPacket->pDescriptorWrites[i].pBufferInfo,
                        pPacket->pDescriptorWrites[i].descriptorCount * sizeof(VkDescriptorBufferInfo));
                 for (uint32_t j = 0; j < pPacket->pDescriptorWrites[i].descriptorCount; j++) {
@@ -1026,45 +1000,9 @@ void vkReplay::manually_replay_vkUpdateDescriptorSets(packet_vkUpdateDescriptorS
     }
 
     if (!errorBadRemap) {
-        // If an error occurred, don't call the real function, but skip ahead so that memory is cleaned up!
-
         m_vkDeviceFuncs.UpdateDescriptorSets(remappedDevice, pPacket->descriptorWriteCount, pRemappedWrites,
                                              pPacket->descriptorCopyCount, pRemappedCopies);
     }
-
-    for (uint32_t d = 0; d < pPacket->descriptorWriteCount; d++) {
-        switch (pPacket->pDescriptorWrites[d].descriptorType) {
-            case VK_DESCRIPTOR_TYPE_SAMPLER:
-            case VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE:
-            case VK_DESCRIPTOR_TYPE_STORAGE_IMAGE:
-            case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
-            case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER:
-                if (pRemappedWrites[d].pImageInfo != NULL) {
-                    VKTRACE_DELETE((void *)pRemappedWrites[d].pImageInfo);
-                    pRemappedWrites[d].pImageInfo = NULL;
-                }
-                break;
-            case VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER:
-            case VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER:
-                if (pRemappedWrites[d].pTexelBufferView != NULL) {
-                    VKTRACE_DELETE((void *)pRemappedWrites[d].pTexelBufferView);
-                    pRemappedWrites[d].pTexelBufferView = NULL;
-                }
-                break;
-            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
-            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER:
-            case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC:
-            case VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC:
-                if (pRemappedWrites[d].pBufferInfo != NULL) {
-                    VKTRACE_DELETE((void *)pRemappedWrites[d].pBufferInfo);
-                    pRemappedWrites[d].pBufferInfo = NULL;
-                }
-            default:
-                break;
-        }
-    }
-    VKTRACE_DELETE(pRemappedWrites);
-    VKTRACE_DELETE(pRemappedCopies);
 }
 
 VkResult vkReplay::manually_replay_vkCreateDescriptorSetLayout(packet_vkCreateDescriptorSetLayout *pPacket) {
@@ -1132,8 +1070,7 @@ VkResult vkReplay::manually_replay_vkAllocateDescriptorSets(packet_vkAllocateDes
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkDescriptorSetLayout *pRemappedSetLayouts =
-        VKTRACE_NEW_ARRAY(VkDescriptorSetLayout, pPacket->pAllocateInfo->descriptorSetCount);
+    VkDescriptorSetLayout *pRemappedSetLayouts = m_scratch.alloc<VkDescriptorSetLayout>(pPacket->pAllocateInfo->descriptorSetCount);
 
     VkDescriptorSetAllocateInfo allocateInfo;
     allocateInfo.pNext = NULL;
@@ -1146,7 +1083,6 @@ VkResult vkReplay::manually_replay_vkAllocateDescriptorSets(packet_vkAllocateDes
         pRemappedSetLayouts[i] = m_objMapper.remap_descriptorsetlayouts(pPacket->pAllocateInfo->pSetLayouts[i]);
         if (pRemappedSetLayouts[i] == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkAllocateDescriptorSets() due to invalid remapped VkDescriptorSetLayout.");
-            VKTRACE_DELETE(pRemappedSetLayouts);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
     }
@@ -1159,8 +1095,6 @@ VkResult vkReplay::manually_replay_vkAllocateDescriptorSets(packet_vkAllocateDes
         }
     }
 
-    VKTRACE_DELETE(pRemappedSetLayouts);
-
     return replayResult;
 }
 
@@ -1180,13 +1114,12 @@ VkResult vkReplay::manually_replay_vkFreeDescriptorSets(packet_vkFreeDescriptorS
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkDescriptorSet *localDSs = VKTRACE_NEW_ARRAY(VkDescriptorSet, pPacket->descriptorSetCount);
+    VkDescriptorSet *localDSs = m_scratch.alloc<VkDescriptorSet>(pPacket->descriptorSetCount);
     uint32_t i;
     for (i = 0; i < pPacket->descriptorSetCount; ++i) {
         localDSs[i] = m_objMapper.remap_descriptorsets(pPacket->pDescriptorSets[i]);
         if (localDSs[i] == VK_NULL_HANDLE && pPacket->pDescriptorSets[i] != VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkFreeDescriptorSets() due to invalid remapped VkDescriptorSet.");
-            VKTRACE_DELETE(localDSs);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
     }
@@ -1198,7 +1131,6 @@ VkResult vkReplay::manually_replay_vkFreeDescriptorSets(packet_vkFreeDescriptorS
             m_objMapper.rm_from_descriptorsets_map(pPacket->pDescriptorSets[i]);
         }
     }
-    VKTRACE_DELETE(localDSs);
     return replayResult;
 }
 
@@ -1215,7 +1147,7 @@ void vkReplay::manually_replay_vkCmdBindDescriptorSets(packet_vkCmdBindDescripto
         return;
     }
 
-    VkDescriptorSet *pRemappedSets = (VkDescriptorSet *)vktrace_malloc(sizeof(VkDescriptorSet) * pPacket->descriptorSetCount);
+    VkDescriptorSet *pRemappedSets = m_scratch.alloc<VkDescriptorSet>(pPacket->descriptorSetCount);
     if (pRemappedSets == NULL) {
         vktrace_LogError("Replay of CmdBindDescriptorSets out of memory.");
         return;
@@ -1225,7 +1157,6 @@ void vkReplay::manually_replay_vkCmdBindDescriptorSets(packet_vkCmdBindDescripto
         pRemappedSets[idx] = m_objMapper.remap_descriptorsets(pPacket->pDescriptorSets[idx]);
         if (pRemappedSets[idx] == VK_NULL_HANDLE && pPacket->pDescriptorSets[idx] != VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdBindDescriptorSets() due to invalid remapped VkDescriptorSet.");
-            vktrace_free(pRemappedSets);
             return;
         }
     }
@@ -1233,7 +1164,6 @@ void vkReplay::manually_replay_vkCmdBindDescriptorSets(packet_vkCmdBindDescripto
     m_vkDeviceFuncs.CmdBindDescriptorSets(remappedCommandBuffer, pPacket->pipelineBindPoint, remappedLayout, pPacket->firstSet,
                                           pPacket->descriptorSetCount, pRemappedSets, pPacket->dynamicOffsetCount,
                                           pPacket->pDynamicOffsets);
-    vktrace_free(pRemappedSets);
     return;
 }
 
@@ -1244,7 +1174,7 @@ void vkReplay::manually_replay_vkCmdBindVertexBuffers(packet_vkCmdBindVertexBuff
         return;
     }
 
-    VkBuffer *pSaveBuff = VKTRACE_NEW_ARRAY(VkBuffer, pPacket->bindingCount);
+    VkBuffer *pSaveBuff = m_scratch.alloc<VkBuffer>(pPacket->bindingCount);
     if (pSaveBuff == NULL && pPacket->bindingCount > 0) {
         vktrace_LogError("Replay of CmdBindVertexBuffers out of memory.");
         return;
@@ -1257,7 +1187,6 @@ void vkReplay::manually_replay_vkCmdBindVertexBuffers(packet_vkCmdBindVertexBuff
             *pBuff = m_objMapper.remap_buffers(pPacket->pBuffers[i]);
             if (*pBuff == VK_NULL_HANDLE && pPacket->pBuffers[i] != VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkCmdBindVertexBuffers() due to invalid remapped VkBuffer.");
-                VKTRACE_DELETE(pSaveBuff);
                 return;
             }
         }
@@ -1268,7 +1197,6 @@ void vkReplay::manually_replay_vkCmdBindVertexBuffers(packet_vkCmdBindVertexBuff
         VkBuffer *pBuff = (VkBuffer *)&(pPacket->pBuffers[k]);
         *pBuff = pSaveBuff[k];
     }
-    VKTRACE_DELETE(pSaveBuff);
     return;
 }
 
@@ -1291,9 +1219,8 @@ VkResult vkReplay::manually_replay_vkGetPipelineCacheData(packet_vkGetPipelineCa
     replayResult = m_vkDeviceFuncs.GetPipelineCacheData(remappeddevice, remappedpipelineCache, &dataSize, NULL);
     if (replayResult != VK_SUCCESS) return replayResult;
     if (pPacket->pData) {
-        uint8_t *pData = VKTRACE_NEW_ARRAY(uint8_t, dataSize);
+        uint8_t *pData = m_scratch.alloc<uint8_t>(dataSize);
         replayResult = m_vkDeviceFuncs.GetPipelineCacheData(remappeddevice, remappedpipelineCache, &dataSize, pData);
-        VKTRACE_DELETE(pData);
     }
     return replayResult;
 }
@@ -1310,7 +1237,7 @@ VkResult vkReplay::manually_replay_vkCreateComputePipelines(packet_vkCreateCompu
     VkPipelineCache pipelineCache;
     pipelineCache = m_objMapper.remap_pipelinecaches(pPacket->pipelineCache);
 
-    VkComputePipelineCreateInfo *pLocalCIs = VKTRACE_NEW_ARRAY(VkComputePipelineCreateInfo, pPacket->createInfoCount);
+    VkComputePipelineCreateInfo *pLocalCIs = m_scratch.alloc<VkComputePipelineCreateInfo>(pPacket->createInfoCount);
     memcpy((void *)pLocalCIs, (void *)(pPacket->pCreateInfos), sizeof(VkComputePipelineCreateInfo) * pPacket->createInfoCount);
 
     // Fix up stage sub-elements
@@ -1324,7 +1251,7 @@ VkResult vkReplay::manually_replay_vkCreateComputePipelines(packet_vkCreateCompu
                 (const char *)(vktrace_trace_packet_interpret_buffer_pointer(pPacket->header, (intptr_t)pLocalCIs[i].stage.pName));
 
         if (pLocalCIs[i].stage.pSpecializationInfo) {
-            VkSpecializationInfo *si = VKTRACE_NEW(VkSpecializationInfo);
+            VkSpecializationInfo *si = m_scratch.alloc<VkSpecializationInfo>(1);
             pLocalCIs[i].stage.pSpecializationInfo = (const VkSpecializationInfo *)(vktrace_trace_packet_interpret_buffer_pointer(
                 pPacket->header, (intptr_t)pLocalCIs[i].stage.pSpecializationInfo));
             memcpy((void *)si, (void *)(pLocalCIs[i].stage.pSpecializationInfo), sizeof(VkSpecializationInfo));
@@ -1341,7 +1268,7 @@ VkResult vkReplay::manually_replay_vkCreateComputePipelines(packet_vkCreateCompu
         pLocalCIs[i].basePipelineHandle = m_objMapper.remap_pipelines(pLocalCIs[i].basePipelineHandle);
     }
 
-    VkPipeline *local_pPipelines = VKTRACE_NEW_ARRAY(VkPipeline, pPacket->createInfoCount);
+    VkPipeline *local_pPipelines = m_scratch.alloc<VkPipeline>(pPacket->createInfoCount);
 
     replayResult = m_vkDeviceFuncs.CreateComputePipelines(remappeddevice, pipelineCache, pPacket->createInfoCount, pLocalCIs, NULL,
                                                           local_pPipelines);
@@ -1352,11 +1279,6 @@ VkResult vkReplay::manually_replay_vkCreateComputePipelines(packet_vkCreateCompu
         }
     }
 
-    for (i = 0; i < pPacket->createInfoCount; i++)
-        if (pLocalCIs[i].stage.pSpecializationInfo) VKTRACE_DELETE((void *)pLocalCIs[i].stage.pSpecializationInfo);
-    VKTRACE_DELETE(pLocalCIs);
-    VKTRACE_DELETE(local_pPipelines);
-
     return replayResult;
 }
 
@@ -1369,15 +1291,11 @@ VkResult vkReplay::manually_replay_vkCreateGraphicsPipelines(packet_vkCreateGrap
     }
 
     // remap shaders from each stage
-    VkPipelineShaderStageCreateInfo **ppRemappedStages =
-        VKTRACE_NEW_ARRAY(VkPipelineShaderStageCreateInfo *, pPacket->createInfoCount);
-    memset(ppRemappedStages, 0, sizeof(VkPipelineShaderStageCreateInfo *) * pPacket->createInfoCount);
     VkPipelineShaderStageCreateInfo *pRemappedStages;
-    VkGraphicsPipelineCreateInfo *pLocalCIs = VKTRACE_NEW_ARRAY(VkGraphicsPipelineCreateInfo, pPacket->createInfoCount);
-    uint32_t i, j, k;
+    VkGraphicsPipelineCreateInfo *pLocalCIs = m_scratch.alloc<VkGraphicsPipelineCreateInfo>(pPacket->createInfoCount);
+    uint32_t i, j;
     for (i = 0; i < pPacket->createInfoCount; i++) {
-        pRemappedStages = VKTRACE_NEW_ARRAY(VkPipelineShaderStageCreateInfo, pPacket->pCreateInfos[i].stageCount);
-        ppRemappedStages[i] = pRemappedStages;
+        pRemappedStages = m_scratch.alloc<VkPipelineShaderStageCreateInfo>(pPacket->pCreateInfos[i].stageCount);
         memcpy(pRemappedStages, pPacket->pCreateInfos[i].pStages,
                sizeof(VkPipelineShaderStageCreateInfo) * pPacket->pCreateInfos[i].stageCount);
 
@@ -1386,11 +1304,6 @@ VkResult vkReplay::manually_replay_vkCreateGraphicsPipelines(packet_vkCreateGrap
             pRemappedStages[j].module = m_objMapper.remap_shadermodules(pRemappedStages[j].module);
             if (pRemappedStages[j].module == VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkCreateGraphicsPipelines() due to invalid remapped VkShaderModule.");
-                for (k = 0; k < pPacket->createInfoCount; k++) {
-                    VKTRACE_DELETE(ppRemappedStages[k]);
-                }
-                VKTRACE_DELETE(ppRemappedStages);
-                VKTRACE_DELETE(pLocalCIs);
                 return VK_ERROR_VALIDATION_FAILED_EXT;
             }
         }
@@ -1413,33 +1326,18 @@ VkResult vkReplay::manually_replay_vkCreateGraphicsPipelines(packet_vkCreateGrap
         pLocalCIs[i].layout = m_objMapper.remap_pipelinelayouts(pPacket->pCreateInfos[i].layout);
         if (pLocalCIs[i].layout == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCreateGraphicsPipelines() due to invalid remapped VkPipelineLayout.");
-            for (k = 0; k < pPacket->createInfoCount; k++) {
-                VKTRACE_DELETE(ppRemappedStages[k]);
-            }
-            VKTRACE_DELETE(ppRemappedStages);
-            VKTRACE_DELETE(pLocalCIs);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
 
         pLocalCIs[i].renderPass = m_objMapper.remap_renderpasss(pPacket->pCreateInfos[i].renderPass);
         if (pLocalCIs[i].renderPass == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCreateGraphicsPipelines() due to invalid remapped VkRenderPass.");
-            for (k = 0; k < pPacket->createInfoCount; k++) {
-                VKTRACE_DELETE(ppRemappedStages[k]);
-            }
-            VKTRACE_DELETE(ppRemappedStages);
-            VKTRACE_DELETE(pLocalCIs);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
 
         pLocalCIs[i].basePipelineHandle = m_objMapper.remap_pipelines(pPacket->pCreateInfos[i].basePipelineHandle);
         if (pLocalCIs[i].basePipelineHandle == VK_NULL_HANDLE && pPacket->pCreateInfos[i].basePipelineHandle != VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCreateGraphicsPipelines() due to invalid remapped VkPipeline.");
-            for (k = 0; k < pPacket->createInfoCount; k++) {
-                VKTRACE_DELETE(ppRemappedStages[k]);
-            }
-            VKTRACE_DELETE(ppRemappedStages);
-            VKTRACE_DELETE(pLocalCIs);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
 
@@ -1459,16 +1357,11 @@ VkResult vkReplay::manually_replay_vkCreateGraphicsPipelines(packet_vkCreateGrap
     remappedPipelineCache = m_objMapper.remap_pipelinecaches(pPacket->pipelineCache);
     if (remappedPipelineCache == VK_NULL_HANDLE && pPacket->pipelineCache != VK_NULL_HANDLE) {
         vktrace_LogError("Skipping vkCreateGraphicsPipelines() due to invalid remapped VkPipelineCache.");
-        for (k = 0; k < pPacket->createInfoCount; k++) {
-            VKTRACE_DELETE(ppRemappedStages[k]);
-        }
-        VKTRACE_DELETE(ppRemappedStages);
-        VKTRACE_DELETE(pLocalCIs);
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
     uint32_t createInfoCount = pPacket->createInfoCount;
-    VkPipeline *local_pPipelines = VKTRACE_NEW_ARRAY(VkPipeline, pPacket->createInfoCount);
+    VkPipeline *local_pPipelines = m_scratch.alloc<VkPipeline>(pPacket->createInfoCount);
 
     replayResult = m_vkDeviceFuncs.CreateGraphicsPipelines(remappedDevice, remappedPipelineCache, createInfoCount, pLocalCIs, NULL,
                                                            local_pPipelines);
@@ -1479,13 +1372,6 @@ VkResult vkReplay::manually_replay_vkCreateGraphicsPipelines(packet_vkCreateGrap
         }
     }
 
-    for (k = 0; k < pPacket->createInfoCount; k++) {
-        VKTRACE_DELETE(ppRemappedStages[k]);
-    }
-    VKTRACE_DELETE(ppRemappedStages);
-    VKTRACE_DELETE(pLocalCIs);
-    VKTRACE_DELETE(local_pPipelines);
-
     return replayResult;
 }
 
@@ -1499,8 +1385,7 @@ VkResult vkReplay::manually_replay_vkCreatePipelineLayout(packet_vkCreatePipelin
     // restore them after replaying the API call.
     VkDescriptorSetLayout *pSaveLayouts = NULL;
     if (pPacket->pCreateInfo->setLayoutCount > 0) {
-        pSaveLayouts =
-            (VkDescriptorSetLayout *)vktrace_malloc(sizeof(VkDescriptorSetLayout) * pPacket->pCreateInfo->setLayoutCount);
+        pSaveLayouts = m_scratch.alloc<VkDescriptorSetLayout>(pPacket->pCreateInfo->setLayoutCount);
         if (!pSaveLayouts) {
             vktrace_LogError("Replay of CreatePipelineLayout out of memory.");
             return VK_ERROR_VALIDATION_FAILED_EXT;
@@ -1522,9 +1407,6 @@ VkResult vkReplay::manually_replay_vkCreatePipelineLayout(packet_vkCreatePipelin
         VkDescriptorSetLayout *pSL = (VkDescriptorSetLayout *)&(pPacket->pCreateInfo->pSetLayouts[k]);
         *pSL = pSaveLayouts[k];
     }
-    if (pSaveLayouts != NULL) {
-        vktrace_free(pSaveLayouts);
-    }
     return replayResult;
 }
 
@@ -1538,7 +1420,7 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
         return;
     }
 
-    VkEvent *saveEvent = VKTRACE_NEW_ARRAY(VkEvent, pPacket->eventCount);
+    VkEvent *saveEvent = m_scratch.alloc<VkEvent>(pPacket->eventCount);
     uint32_t idx = 0;
     uint32_t numRemapBuf = 0;
     uint32_t numRemapImg = 0;
@@ -1548,12 +1430,11 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
         *pEvent = m_objMapper.remap_events(pPacket->pEvents[idx]);
         if (*pEvent == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdWaitEvents() due to invalid remapped VkEvent.");
-            VKTRACE_DELETE(saveEvent);
             return;
         }
     }
 
-    VkBuffer *saveBuf = VKTRACE_NEW_ARRAY(VkBuffer, pPacket->bufferMemoryBarrierCount);
+    VkBuffer *saveBuf = m_scratch.alloc<VkBuffer>(pPacket->bufferMemoryBarrierCount);
     for (idx = 0; idx < pPacket->bufferMemoryBarrierCount; idx++) {
         VkBufferMemoryBarrier *pNextBuf = (VkBufferMemoryBarrier *)&(pPacket->pBufferMemoryBarriers[idx]);
         saveBuf[numRemapBuf++] = pNextBuf->buffer;
@@ -1561,8 +1442,6 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
         pNextBuf->buffer = m_objMapper.remap_buffers(pNextBuf->buffer);
         if (pNextBuf->buffer == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdWaitEvents() due to invalid remapped VkBuffer.");
-            VKTRACE_DELETE(saveEvent);
-            VKTRACE_DELETE(saveBuf);
             return;
         }
         replayDevice = replayBufferToDevice[pNextBuf->buffer];
@@ -1572,12 +1451,10 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
             *((uint32_t *)&pPacket->pBufferMemoryBarriers[idx].srcQueueFamilyIndex) = dstReplayIdx;
         } else {
             vktrace_LogError("vkCmdWaitEvents failed, bad srcQueueFamilyIndex");
-            VKTRACE_DELETE(saveEvent);
-            VKTRACE_DELETE(saveBuf);
             return;
         }
     }
-    VkImage *saveImg = VKTRACE_NEW_ARRAY(VkImage, pPacket->imageMemoryBarrierCount);
+    VkImage *saveImg = m_scratch.alloc<VkImage>(pPacket->imageMemoryBarrierCount);
     for (idx = 0; idx < pPacket->imageMemoryBarrierCount; idx++) {
         VkImageMemoryBarrier *pNextImg = (VkImageMemoryBarrier *)&(pPacket->pImageMemoryBarriers[idx]);
         saveImg[numRemapImg++] = pNextImg->image;
@@ -1585,9 +1462,6 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
         pNextImg->image = m_objMapper.remap_images(pNextImg->image);
         if (pNextImg->image == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdWaitEvents() due to invalid remapped VkImage.");
-            VKTRACE_DELETE(saveEvent);
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
         replayDevice = replayImageToDevice[pNextImg->image];
@@ -1597,9 +1471,6 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
             *((uint32_t *)&pPacket->pImageMemoryBarriers[idx].srcQueueFamilyIndex) = dstReplayIdx;
         } else {
             vktrace_LogError("vkCmdWaitEvents failed, bad srcQueueFamilyIndex");
-            VKTRACE_DELETE(saveEvent);
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
     }
@@ -1620,9 +1491,6 @@ void vkReplay::manually_replay_vkCmdWaitEvents(packet_vkCmdWaitEvents *pPacket)
         VkEvent *pEvent = (VkEvent *)&(pPacket->pEvents[idx]);
         *pEvent = saveEvent[idx];
     }
-    VKTRACE_DELETE(saveEvent);
-    VKTRACE_DELETE(saveBuf);
-    VKTRACE_DELETE(saveImg);
     return;
 }
 
@@ -1639,8 +1507,8 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
     uint32_t idx = 0;
     uint32_t numRemapBuf = 0;
     uint32_t numRemapImg = 0;
-    VkBuffer *saveBuf = VKTRACE_NEW_ARRAY(VkBuffer, pPacket->bufferMemoryBarrierCount);
-    VkImage *saveImg = VKTRACE_NEW_ARRAY(VkImage, pPacket->imageMemoryBarrierCount);
+    VkBuffer *saveBuf = m_scratch.alloc<VkBuffer>(pPacket->bufferMemoryBarrierCount);
+    VkImage *saveImg = m_scratch.alloc<VkImage>(pPacket->imageMemoryBarrierCount);
     for (idx = 0; idx < pPacket->bufferMemoryBarrierCount; idx++) {
         VkBufferMemoryBarrier *pNextBuf = (VkBufferMemoryBarrier *)&(pPacket->pBufferMemoryBarriers[idx]);
         saveBuf[numRemapBuf++] = pNextBuf->buffer;
@@ -1648,8 +1516,6 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
         pNextBuf->buffer = m_objMapper.remap_buffers(pNextBuf->buffer);
         if (pNextBuf->buffer == VK_NULL_HANDLE && saveBuf[numRemapBuf - 1] != VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdPipelineBarrier() due to invalid remapped VkBuffer.");
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
         replayDevice = replayBufferToDevice[pNextBuf->buffer];
@@ -1659,8 +1525,6 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
             *((uint32_t *)&pPacket->pBufferMemoryBarriers[idx].srcQueueFamilyIndex) = dstReplayIdx;
         } else {
             vktrace_LogError("vkCmdPipelineBarrier failed, bad srcQueueFamilyIndex");
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
     }
@@ -1672,8 +1536,6 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
         pNextImg->image = m_objMapper.remap_images(pNextImg->image);
         if (pNextImg->image == VK_NULL_HANDLE && saveImg[numRemapImg - 1] != VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkCmdPipelineBarrier() due to invalid remapped VkImage.");
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
         replayDevice = replayImageToDevice[pNextImg->image];
@@ -1683,8 +1545,6 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
             *((uint32_t *)&pPacket->pImageMemoryBarriers[idx].srcQueueFamilyIndex) = dstReplayIdx;
         } else {
             vktrace_LogError("vkPipelineBarrier failed, bad srcQueueFamilyIndex");
-            VKTRACE_DELETE(saveBuf);
-            VKTRACE_DELETE(saveImg);
             return;
         }
     }
@@ -1701,8 +1561,6 @@ void vkReplay::manually_replay_vkCmdPipelineBarrier(packet_vkCmdPipelineBarrier
         VkImageMemoryBarrier *pNextImg = (VkImageMemoryBarrier *)&(pPacket->pImageMemoryBarriers[idx]);
         pNextImg->image = saveImg[idx];
     }
-    VKTRACE_DELETE(saveBuf);
-    VKTRACE_DELETE(saveImg);
     return;
 }
 
@@ -1716,16 +1574,13 @@ VkResult vkReplay::manually_replay_vkCreateFramebuffer(packet_vkCreateFramebuffe
 
     VkFramebufferCreateInfo *pInfo = (VkFramebufferCreateInfo *)pPacket->pCreateInfo;
     VkImageView *pAttachments = NULL, *pSavedAttachments = (VkImageView *)pInfo->pAttachments;
-    bool allocatedAttachments = false;
     if (pSavedAttachments != NULL) {
-        allocatedAttachments = true;
-        pAttachments = VKTRACE_NEW_ARRAY(VkImageView, pInfo->attachmentCount);
+        pAttachments = m_scratch.alloc<VkImageView>(pInfo->attachmentCount);
         memcpy(pAttachments, pSavedAttachments, sizeof(VkImageView) * pInfo->attachmentCount);
         for (uint32_t i = 0; i < pInfo->attachmentCount; i++) {
             pAttachments[i] = m_objMapper.remap_imageviews(pInfo->pAttachments[i]);
             if (pAttachments[i] == VK_NULL_HANDLE && pInfo->pAttachments[i] != VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkCreateFramebuffer() due to invalid remapped VkImageView.");
-                VKTRACE_DELETE(pAttachments);
                 return VK_ERROR_VALIDATION_FAILED_EXT;
             }
         }
@@ -1735,9 +1590,6 @@ VkResult vkReplay::manually_replay_vkCreateFramebuffer(packet_vkCreateFramebuffe
     pInfo->renderPass = m_objMapper.remap_renderpasss(pPacket->pCreateInfo->renderPass);
     if (pInfo->renderPass == VK_NULL_HANDLE && pPacket->pCreateInfo->renderPass != VK_NULL_HANDLE) {
         vktrace_LogError("Skipping vkCreateFramebuffer() due to invalid remapped VkRenderPass.");
-        if (allocatedAttachments) {
-            VKTRACE_DELETE(pAttachments);
-        }
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
@@ -1748,9 +1600,6 @@ VkResult vkReplay::manually_replay_vkCreateFramebuffer(packet_vkCreateFramebuffe
     if (replayResult == VK_SUCCESS) {
         m_objMapper.add_to_framebuffers_map(*(pPacket->pFramebuffer), local_framebuffer);
     }
-    if (allocatedAttachments) {
-        VKTRACE_DELETE((void *)pAttachments);
-    }
     return replayResult;
 }
 
@@ -1834,12 +1683,11 @@ VkResult vkReplay::manually_replay_vkWaitForFences(packet_vkWaitForFences *pPack
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkFence *pFence = VKTRACE_NEW_ARRAY(VkFence, pPacket->fenceCount);
+    VkFence *pFence = m_scratch.alloc<VkFence>(pPacket->fenceCount);
     for (i = 0; i < pPacket->fenceCount; i++) {
         (*(pFence + i)) = m_objMapper.remap_fences((*(pPacket->pFences + i)));
         if (*(pFence + i) == VK_NULL_HANDLE) {
             vktrace_LogError("Skipping vkWaitForFences() due to invalid remapped VkFence.");
-            VKTRACE_DELETE(pFence);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
     }
@@ -1854,7 +1702,6 @@ VkResult vkReplay::manually_replay_vkWaitForFences(packet_vkWaitForFences *pPack
                 m_vkDeviceFuncs.WaitForFences(remappedDevice, pPacket->fenceCount, pFence, pPacket->waitAll, pPacket->timeout);
         }
     }
-    VKTRACE_DELETE(pFence);
     return replayResult;
 }
 
@@ -2318,17 +2165,15 @@ VkResult vkReplay::manually_replay_vkFlushMappedMemoryRanges(packet_vkFlushMappe
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkMappedMemoryRange *localRanges = VKTRACE_NEW_ARRAY(VkMappedMemoryRange, pPacket->memoryRangeCount);
+    VkMappedMemoryRange *localRanges = m_scratch.alloc<VkMappedMemoryRange>(pPacket->memoryRangeCount);
     memcpy(localRanges, pPacket->pMemoryRanges, sizeof(VkMappedMemoryRange) * (pPacket->memoryRangeCount));
 
-    devicememoryObj *pLocalMems = VKTRACE_NEW_ARRAY(devicememoryObj, pPacket->memoryRangeCount);
+    devicememoryObj *pLocalMems = m_scratch.alloc<devicememoryObj>(pPacket->memoryRangeCount);
     for (uint32_t i = 0; i < pPacket->memoryRangeCount; i++) {
         pLocalMems[i] = m_objMapper.m_devicememorys.find(pPacket->pMemoryRanges[i].memory)->second;
         localRanges[i].memory = m_objMapper.remap_devicememorys(pPacket->pMemoryRanges[i].memory);
         if (localRanges[i].memory == VK_NULL_HANDLE || pLocalMems[i].pGpuMem == NULL) {
             vktrace_LogError("Skipping vkFlushMappedMemoryRanges() due to invalid remapped VkDeviceMemory.");
-            VKTRACE_DELETE(localRanges);
-            VKTRACE_DELETE(pLocalMems);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
 
@@ -2373,9 +2218,6 @@ VkResult vkReplay::manually_replay_vkFlushMappedMemoryRanges(packet_vkFlushMappe
         replayResult = m_vkDeviceFuncs.FlushMappedMemoryRanges(remappedDevice, pPacket->memoryRangeCount, localRanges);
     }
 
-    VKTRACE_DELETE(localRanges);
-    VKTRACE_DELETE(pLocalMems);
-
     return replayResult;
 }
 
@@ -2390,17 +2232,15 @@ VkResult vkReplay::manually_replay_vkInvalidateMappedMemoryRanges(packet_vkInval
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkMappedMemoryRange *localRanges = VKTRACE_NEW_ARRAY(VkMappedMemoryRange, pPacket->memoryRangeCount);
+    VkMappedMemoryRange *localRanges = m_scratch.alloc<VkMappedMemoryRange>(pPacket->memoryRangeCount);
     memcpy(localRanges, pPacket->pMemoryRanges, sizeof(VkMappedMemoryRange) * (pPacket->memoryRangeCount));
 
-    devicememoryObj *pLocalMems = VKTRACE_NEW_ARRAY(devicememoryObj, pPacket->memoryRangeCount);
+    devicememoryObj *pLocalMems = m_scratch.alloc<devicememoryObj>(pPacket->memoryRangeCount);
     for (uint32_t i = 0; i < pPacket->memoryRangeCount; i++) {
         pLocalMems[i] = m_objMapper.m_devicememorys.find(pPacket->pMemoryRanges[i].memory)->second;
         localRanges[i].memory = m_objMapper.remap_devicememorys(pPacket->pMemoryRanges[i].memory);
         if (localRanges[i].memory == VK_NULL_HANDLE || pLocalMems[i].pGpuMem == NULL) {
             vktrace_LogError("Skipping vkInvalidsateMappedMemoryRanges() due to invalid remapped VkDeviceMemory.");
-            VKTRACE_DELETE(localRanges);
-            VKTRACE_DELETE(pLocalMems);
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
 
@@ -2422,8 +2262,6 @@ VkResult vkReplay::manually_replay_vkInvalidateMappedMemoryRanges(packet_vkInval
 
     replayResult = m_vkDeviceFuncs.InvalidateMappedMemoryRanges(remappedDevice, pPacket->memoryRangeCount, localRanges);
 
-    VKTRACE_DELETE(localRanges);
-    VKTRACE_DELETE(pLocalMems);
 
     return replayResult;
 }
@@ -2517,7 +2355,7 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceQueueFamilyProperties(packet_v
         if (queueFamPropCnt[pPacket->physicalDevice] > *pPacket->pQueueFamilyPropertyCount) {
             *pPacket->pQueueFamilyPropertyCount = queueFamPropCnt[pPacket->physicalDevice];
             savepQueueFamilyProperties = pPacket->pQueueFamilyProperties;
-            pPacket->pQueueFamilyProperties = VKTRACE_NEW_ARRAY(VkQueueFamilyProperties, *pPacket->pQueueFamilyPropertyCount);
+            pPacket->pQueueFamilyProperties = m_scratch.alloc<VkQueueFamilyProperties>(*pPacket->pQueueFamilyPropertyCount);
         }
     }
 
@@ -2569,7 +2407,6 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceQueueFamilyProperties(packet_v
     if (savepQueueFamilyProperties) {
         // Restore pPacket->pQueueFamilyProperties. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pQueueFamilyProperties);
         pPacket->pQueueFamilyProperties = savepQueueFamilyProperties;
     }
 
@@ -2596,7 +2433,7 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceQueueFamilyProperties2KHR(
         if (queueFamProp2KHRCnt[pPacket->physicalDevice] > *pPacket->pQueueFamilyPropertyCount) {
             *pPacket->pQueueFamilyPropertyCount = queueFamProp2KHRCnt[pPacket->physicalDevice];
             savepQueueFamilyProperties = pPacket->pQueueFamilyProperties;
-            pPacket->pQueueFamilyProperties = VKTRACE_NEW_ARRAY(VkQueueFamilyProperties2KHR, *pPacket->pQueueFamilyPropertyCount);
+            pPacket->pQueueFamilyProperties = m_scratch.alloc<VkQueueFamilyProperties2KHR>(*pPacket->pQueueFamilyPropertyCount);
         }
     }
 
@@ -2648,7 +2485,6 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceQueueFamilyProperties2KHR(
     if (savepQueueFamilyProperties) {
         // Restore pPacket->pQueueFamilyProperties. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pQueueFamilyProperties);
         pPacket->pQueueFamilyProperties = savepQueueFamilyProperties;
     }
 
@@ -2673,7 +2509,7 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceSparseImageFormatProperties(
         if (propCnt[pPacket->physicalDevice] > *pPacket->pPropertyCount) {
             *pPacket->pPropertyCount = propCnt[pPacket->physicalDevice];
             savepProperties = pPacket->pProperties;
-            pPacket->pProperties = VKTRACE_NEW_ARRAY(VkSparseImageFormatProperties, *pPacket->pPropertyCount);
+            pPacket->pProperties = m_scratch.alloc<VkSparseImageFormatProperties>(*pPacket->pPropertyCount);
         }
     }
 
@@ -2690,7 +2526,6 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceSparseImageFormatProperties(
     if (savepProperties) {
         // Restore pPacket->pProperties. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pProperties);
         pPacket->pProperties = savepProperties;
     }
 
@@ -2715,7 +2550,7 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceSparseImageFormatProperties2KH
         if (prop2KHRCnt[pPacket->physicalDevice] > *pPacket->pPropertyCount) {
             *pPacket->pPropertyCount = prop2KHRCnt[pPacket->physicalDevice];
             savepProperties = pPacket->pProperties;
-            pPacket->pProperties = VKTRACE_NEW_ARRAY(VkSparseImageFormatProperties2KHR, *pPacket->pPropertyCount);
+            pPacket->pProperties = m_scratch.alloc<VkSparseImageFormatProperties2KHR>(*pPacket->pPropertyCount);
         }
     }
 
@@ -2731,7 +2566,6 @@ void vkReplay::manually_replay_vkGetPhysicalDeviceSparseImageFormatProperties2KH
     if (savepProperties) {
         // Restore pPacket->pProperties. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pProperties);
         pPacket->pProperties = savepProperties;
     }
 
@@ -2955,7 +2789,7 @@ VkResult vkReplay::manually_replay_vkGetPhysicalDeviceSurfaceFormatsKHR(packet_v
         if (surfFmtCnt[pPacket->physicalDevice] > *pPacket->pSurfaceFormatCount) {
             *pPacket->pSurfaceFormatCount = surfFmtCnt[pPacket->physicalDevice];
             savepSurfaceFormats = pPacket->pSurfaceFormats;
-            pPacket->pSurfaceFormats = VKTRACE_NEW_ARRAY(VkSurfaceFormatKHR, *pPacket->pSurfaceFormatCount);
+            pPacket->pSurfaceFormats = m_scratch.alloc<VkSurfaceFormatKHR>(*pPacket->pSurfaceFormatCount);
         }
     }
 
@@ -2971,7 +2805,6 @@ VkResult vkReplay::manually_replay_vkGetPhysicalDeviceSurfaceFormatsKHR(packet_v
     if (savepSurfaceFormats) {
         // Restore pPacket->pSurfaceFormats. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pSurfaceFormats);
         pPacket->pSurfaceFormats = savepSurfaceFormats;
     }
 
@@ -3003,7 +2836,7 @@ VkResult vkReplay::manually_replay_vkGetPhysicalDeviceSurfacePresentModesKHR(
         if (presModeCnt[pPacket->physicalDevice] > *pPacket->pPresentModeCount) {
             *pPacket->pPresentModeCount = presModeCnt[pPacket->physicalDevice];
             savepPresentModes = pPacket->pPresentModes;
-            pPacket->pPresentModes = VKTRACE_NEW_ARRAY(VkPresentModeKHR, *pPacket->pPresentModeCount);
+            pPacket->pPresentModes = m_scratch.alloc<VkPresentModeKHR>(*pPacket->pPresentModeCount);
         }
     }
 
@@ -3019,7 +2852,6 @@ VkResult vkReplay::manually_replay_vkGetPhysicalDeviceSurfacePresentModesKHR(
     if (savepPresentModes) {
         // Restore pPacket->pPresentModes. We do this because the replay will free the memory.
         // Note that we don't copy the queried data - it wouldn't fit, and it's not used by the replayer anyway.
-        VKTRACE_DELETE(pPacket->pPresentModes);
         pPacket->pPresentModes = savepPresentModes;
     }
 
@@ -3186,28 +3018,13 @@ VkResult vkReplay::manually_replay_vkQueuePresentKHR(packet_vkQueuePresentKHR *p
         return VK_ERROR_VALIDATION_FAILED_EXT;
     }
 
-    VkSemaphore localSemaphores[5];
-    VkSwapchainKHR localSwapchains[5];
-    VkResult localResults[5];
-    VkSemaphore *pRemappedWaitSems = localSemaphores;
-    VkSwapchainKHR *pRemappedSwapchains = localSwapchains;
-    VkResult *pResults = localResults;
+    VkSemaphore *pRemappedWaitSems = m_scratch.alloc<VkSemaphore>(pPacket->pPresentInfo->waitSemaphoreCount);
+    VkSwapchainKHR *pRemappedSwapchains = m_scratch.alloc<VkSwapchainKHR>(pPacket->pPresentInfo->swapchainCount);
+    VkResult *pResults = m_scratch.alloc<VkResult>(pPacket->pPresentInfo->swapchainCount);
     VkPresentInfoKHR present;
     uint32_t i;
     uint32_t remappedImageIndex = UINT32_MAX;
 
-    if (pPacket->pPresentInfo->swapchainCount > 5) {
-        pRemappedSwapchains = VKTRACE_NEW_ARRAY(VkSwapchainKHR, pPacket->pPresentInfo->swapchainCount);
-    }
-
-    if (pPacket->pPresentInfo->swapchainCount > 5 && pPacket->pPresentInfo->pResults != NULL) {
-        pResults = VKTRACE_NEW_ARRAY(VkResult, pPacket->pPresentInfo->swapchainCount);
-    }
-
-    if (pPacket->pPresentInfo->waitSemaphoreCount > 5) {
-        pRemappedWaitSems = VKTRACE_NEW_ARRAY(VkSemaphore, pPacket->pPresentInfo->waitSemaphoreCount);
-    }
-
     if (pRemappedSwapchains == NULL || pRemappedWaitSems == NULL || pResults == NULL) {
         replayResult = VK_ERROR_OUT_OF_HOST_MEMORY;
     }
@@ -3218,7 +3035,7 @@ VkResult vkReplay::manually_replay_vkQueuePresentKHR(packet_vkQueuePresentKHR *p
             if (pRemappedSwapchains[i] == VK_NULL_HANDLE) {
                 vktrace_LogError("Skipping vkQueuePresentKHR() due to invalid remapped VkSwapchainKHR.");
                 replayResult = VK_ERROR_VALIDATION_FAILED_EXT;
-                goto out;
+                return replayResult;
             }
         }
 
@@ -3232,7 +3049,7 @@ VkResult vkReplay::manually_replay_vkQueuePresentKHR(packet_vkQueuePresentKHR *p
         if (remappedImageIndex == UINT32_MAX) {
             vktrace_LogError("Skipping vkQueuePresentKHR() due to invalid remapped pImageIndices.");
             replayResult = VK_ERROR_VALIDATION_FAILED_EXT;
-            goto out;
+            return replayResult;
         }
 
         present.sType = pPacket->pPresentInfo->sType;
@@ -3249,7 +3066,7 @@ VkResult vkReplay::manually_replay_vkQueuePresentKHR(packet_vkQueuePresentKHR *p
                 if (*(pRemappedWaitSems + i) == VK_NULL_HANDLE) {
                     vktrace_LogError("Skipping vkQueuePresentKHR() due to invalid remapped wait VkSemaphore.");
                     replayResult = VK_ERROR_VALIDATION_FAILED_EXT;
-                    goto out;
+                    return replayResult;
                 }
             }
         }
@@ -3279,18 +3096,6 @@ VkResult vkReplay::manually_replay_vkQueuePresentKHR(packet_vkQueuePresentKHR *p
         }
     }
 
-out:
-
-    if (pRemappedWaitSems != NULL && pRemappedWaitSems != localSemaphores) {
-        VKTRACE_DELETE(pRemappedWaitSems);
-    }
-    if (pResults != NULL && pResults != localResults) {
-        VKTRACE_DELETE(pResults);
-    }
-    if (pRemappedSwapchains != NULL && pRemappedSwapchains != localSwapchains) {
-        VKTRACE_DELETE(pRemappedSwapchains);
-    }
-
     return replayResult;
 }
 
@@ -4236,7 +4041,7 @@ VkResult vkReplay::manually_replay_vkGetDisplayPlaneSupportedDisplaysKHR(packet_
     // No need to remap pDisplayCount
 
     // Get remapped displays
-    VkDisplayKHR *remapped_displays = VKTRACE_NEW_ARRAY(VkDisplayKHR, *pPacket->pDisplayCount);
+    VkDisplayKHR *remapped_displays = m_scratch.alloc<VkDisplayKHR>(*pPacket->pDisplayCount);
     for (uint32_t i = 0; i < *pPacket->pDisplayCount; ++i) {
         remapped_displays[i] = m_objMapper.remap_displaykhrs(*(pPacket->pDisplays + i));
     }
@@ -4274,7 +4079,7 @@ VkResult vkReplay::manually_replay_vkEnumerateDeviceExtensionProperties(packet_v
             return VK_ERROR_VALIDATION_FAILED_EXT;
         }
         propertyCount = replayDeviceExtensionPropertyCount[pPacket->physicalDevice];
-        pProperties = VKTRACE_NEW_ARRAY(VkExtensionProperties, propertyCount);
+        pProperties = m_scratch.alloc<VkExtensionProperties>(propertyCount);
     }
 
     auto result =
@@ -4285,10 +4090,7 @@ VkResult vkReplay::manually_replay_vkEnumerateDeviceExtensionProperties(packet_v
         replayDeviceExtensionPropertyCount[pPacket->physicalDevice] = propertyCount;
     }
 
-    // Clean up properties array. For portability, we will want to compare this to what is in the packet.
-    if (pProperties != nullptr) {
-        VKTRACE_DELETE(pProperties);
-    }
+    // For portability, we will want to compare pProperties to what is in the packet.
 
     return result;
 }
@@ -54,6 +54,7 @@ extern "C" {
 
 #include "vkreplay_vkdisplay.h"
 #include "vkreplay_vk_objmapper.h"
+#include "vkreplay_scratch_arena.h"
 
 #define CHECK_RETURN_VALUE(entrypoint) returnValue = handle_replay_errors(#entrypoint, replayResult, pPacket->result, returnValue);
 
@@ -84,6 +85,8 @@ class vkReplay {
     VkLayerInstanceDispatchTable m_vkFuncs;
     VkLayerDispatchTable m_vkDeviceFuncs;
     vkReplayObjMapper m_objMapper;
+    // Temporary arrays for remapping the current packet, released before the next one is replayed.
+    vkReplayScratchArena m_scratch;
     void (*m_pDSDump)(char*);
     void (*m_pCBDump)(char*);
     // VKTRACESNAPSHOT_PRINT_OBJECTS m_pVktraceSnapshotPrint;
@@ -27,6 +27,7 @@ extern "C" {
 #include "vktrace_common.h"
 #include "vktrace_filelike.h"
 #include "vktrace_interconnect.h"
+#include "vktrace_shm_ring.h"
 #include "vktrace_trace_packet_identifiers.h"
 #include "vktrace_trace_packet_utils.h"
 }
@@ -93,6 +94,38 @@ vktrace_SettingInfo g_settings_info[] = {
      {&g_default_settings.enable_pmb},
      TRUE,
      "Enable tracking of persistently mapped buffers, default is TRUE."},
+    {"shm",
+     "SharedMemoryRing",
+     VKTRACE_SETTING_BOOL,
+     {&g_settings.enable_shm_ring},
+     {&g_default_settings.enable_shm_ring},
+     TRUE,
+     "Receive trace packets from the traced program through shared memory instead of a socket, default is TRUE. "
+     "Only supported on Linux."},
+    {"c",
+     "Compress",
+     VKTRACE_SETTING_BOOL,
+     {&g_settings.compress_trace},
+     {&g_default_settings.compress_trace},
+     TRUE,
+     "Store the trace file as independently compressed blocks, default is FALSE. "
+     "vktraceconvert converts between compressed and uncompressed trace files."},
+    {"dd",
+     "DedupMinSize",
+     VKTRACE_SETTING_UINT,
+     {&g_settings.dedup_min_size},
+     {&g_default_settings.dedup_min_size},
+     TRUE,
+     "Store the bytes of trace packets of at least this many KB only once, referring back to earlier copies of them. "
+     "Default is 0, which leaves packets as they are."},
+    {"tsc",
+     "TscClock",
+     VKTRACE_SETTING_BOOL,
+     {&g_settings.enable_tsc_clock},
+     {&g_default_settings.enable_tsc_clock},
+     TRUE,
+     "Take packet timestamps from the CPU timestamp counter instead of the OS clock, default is FALSE. "
+     "Only used on x86-64 CPUs with an invariant TSC."},
 #if _DEBUG
     {"v",
      "Verbosity",
@@ -122,7 +155,9 @@ vktrace_SettingInfo g_settings_info[] = {
      "Start/stop trim by hotkey or frame range:\n\
                                          hotkey-[F1-F12|TAB|CONTROL]\n\
                                          hotkey-[F1-F12|TAB|CONTROL]-<frameCount>\n\
-                                         frames-<startFrame>-<endFrame>"},
+                                         frames-<startFrame>-<endFrame>[:<startFrame>-<endFrame>...]\n\
+                                         Each trim window after the first is written to\n\
+                                         <outputTrace>-trim-<window>.vktrace"},
     //{ "z", "pauze", VKTRACE_SETTING_BOOL, &g_settings.pause,
     //&g_default_settings.pause, TRUE, "Wait for a key at startup (so a debugger
     // can be attached)" },
@@ -270,9 +305,12 @@ uint32_t lastPacketThreadId;
 uint64_t lastPacketIndex;
 uint64_t lastPacketEndTime;
 
-static void vktrace_appendPortabilityPacket(FILE* pTraceFile) {
+void vktrace_appendPortabilityPacket(vktrace_process_info* pProcInfo) {
+    FILE* pTraceFile = pProcInfo->pTraceFile;
+    vktrace_block_writer* pBlockWriter = pProcInfo->pTraceBlockWriter;
     vktrace_trace_packet_header hdr;
     uint64_t one_64 = 1;
+    bool tableWritten;
 
     if (pTraceFile == NULL) {
         vktrace_LogError("tracefile was not created");
@@ -294,9 +332,25 @@ static void vktrace_appendPortabilityPacket(FILE* pTraceFile) {
     hdr.vktrace_begin_time = hdr.entrypoint_begin_time = hdr.entrypoint_end_time = hdr.vktrace_end_time = lastPacketEndTime;
     hdr.next_buffers_offset = 0;
     hdr.pBody = (uintptr_t)NULL;
-    if (0 == Fseek(pTraceFile, 0, SEEK_END) && 1 == fwrite(&hdr, sizeof(hdr), 1, pTraceFile) &&
-        portabilityTable.size() == fwrite(&portabilityTable[0], sizeof(uint64_t), portabilityTable.size(), pTraceFile)) {
-        // Set the flag in the file header that indicates the portability table has been written
+    if (pBlockWriter != NULL) {
+        // The table goes at the end of the uncompressed stream, followed by the block index.
+        tableWritten = vktrace_block_writer_write(pBlockWriter, &hdr, sizeof(hdr)) &&
+                       vktrace_block_writer_write(pBlockWriter, &portabilityTable[0], portabilityTable.size() * sizeof(uint64_t));
+        tableWritten = vktrace_block_writer_finish(pBlockWriter) && tableWritten;
+    } else {
+        tableWritten = 0 == Fseek(pTraceFile, 0, SEEK_END) && 1 == fwrite(&hdr, sizeof(hdr), 1, pTraceFile) &&
+                       portabilityTable.size() == fwrite(&portabilityTable[0], sizeof(uint64_t), portabilityTable.size(), pTraceFile);
+    }
+    if (tableWritten) {
+        // The table is the last packet, so the index is complete once it has been added.
+        vktrace_trace_index_writer* pIndexWriter = pProcInfo->pTraceIndexWriter;
+        if (pIndexWriter != NULL) {
+            vktrace_trace_index_writer_add(pIndexWriter, vktrace_trace_index_writer_get_end_offset(pIndexWriter), &hdr, 0);
+            vktrace_trace_index_writer_finish(pIndexWriter);
+        }
+
+        // Set the flag in the file header that indicates the portability table has been written.
+        // The header is never compressed, so it can be patched in place either way.
         if (0 == fseek(pTraceFile, offsetof(vktrace_trace_file_header, portability_table_valid), SEEK_SET))
             fwrite(&one_64, sizeof(uint64_t), 1, pTraceFile);
     }
@@ -319,6 +373,10 @@ int main(int argc, char* argv[]) {
     g_default_settings.screenshotList = NULL;
     g_default_settings.screenshotColorFormat = NULL;
     g_default_settings.enable_pmb = true;
+    g_default_settings.enable_shm_ring = true;
+    g_default_settings.compress_trace = false;
+    g_default_settings.dedup_min_size = 0;
+    g_default_settings.enable_tsc_clock = false;
 
     // Check to see if the PAGEGUARD_PAGEGUARD_ENABLE_ENV env var is set.
     // If it is set to anything but "1", set the default to false.
@@ -406,6 +464,7 @@ int main(int argc, char* argv[]) {
     }
 
     vktrace_set_global_var(VKTRACE_PMB_ENABLE_ENV, g_settings.enable_pmb ? "1" : "0");
+    vktrace_set_global_var(_VKTRACE_TSC_CLOCK_ENV, g_settings.enable_tsc_clock ? "1" : "0");
 
     if (g_settings.traceTrigger) {
         // Export list to screenshot layer
@@ -471,6 +530,21 @@ int main(int argc, char* argv[]) {
                 char* newEnv = vktrace_copy_and_append("VK_LAYER_LUNARG_vktrace", VKTRACE_LIST_SEPARATOR, devEnv);
                 vktrace_set_global_var("VK_DEVICE_LAYERS", newEnv);
             }
+#if defined(VKTRACE_SHM_RING_SUPPORTED)
+            // Set up the shared memory ring before the application starts so the trace layer can attach to it
+            // as soon as it loads. The layer uses the socket only if the env var is empty; the recording thread
+            // doesn't listen on the socket while it reads from the ring, so a layer that can't open it traces nothing.
+            char shmRingName[64] = "";
+            if (g_settings.enable_shm_ring) {
+                snprintf(shmRingName, sizeof(shmRingName), "/vktrace-%d-%u", (int)getpid(), serverIndex);
+                procInfo.pCaptureThreads[0].pMessageStream = vktrace_MessageStream_create_shm(TRUE, shmRingName);
+                if (procInfo.pCaptureThreads[0].pMessageStream == NULL) {
+                    vktrace_LogWarning("Unable to create shared memory ring, trace packets will be sent over a socket.");
+                    shmRingName[0] = '\0';
+                }
+            }
+            vktrace_set_global_var(_VKTRACE_SHM_RING_ENV, shmRingName);
+#endif
             // call CreateProcess to launch the application
             procStarted = vktrace_process_spawn(&procInfo);
         }
@@ -505,7 +579,7 @@ int main(int argc, char* argv[]) {
             exitval = (int)MessageLoop();
 #endif
         }
-        vktrace_appendPortabilityPacket(procInfo.pTraceFile);
+        vktrace_appendPortabilityPacket(&procInfo);
         vktrace_process_info_delete(&procInfo);
         serverIndex++;
     } while (g_settings.program == NULL);
@@ -42,6 +42,10 @@ typedef struct vktrace_settings {
     const char* screenshotList;
     const char* screenshotColorFormat;
     BOOL enable_pmb;
+    BOOL enable_shm_ring;
+    BOOL compress_trace;
+    uint32_t dedup_min_size;
+    BOOL enable_tsc_clock;
     const char* verbosity;
     const char* traceTrigger;
 
@@ -57,3 +61,9 @@ extern std::vector<uint64_t> portabilityTable;
 extern uint32_t lastPacketThreadId;
 extern uint64_t lastPacketIndex;
 extern uint64_t lastPacketEndTime;
+
+// Appends the portability table to the trace file and completes its index.
+void vktrace_appendPortabilityPacket(struct vktrace_process_info* pProcInfo);
+
+// Returns base, followed by "-<index>" and extension, which may be NULL.
+char* append_index_to_filename(const char* base, uint32_t index, const char* extension);
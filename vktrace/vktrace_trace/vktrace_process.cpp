@@ -22,6 +22,7 @@
 #include <string>
 #include "vktrace_process.h"
 #include "vktrace.h"
+#include "vktrace_writer.h"
 
 #if defined(PLATFORM_LINUX)
 #include <sys/prctl.h>
@@ -113,6 +114,171 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunWatchdogThread(LPVOID _procInfoPtr
 bool terminationSignalArrived = false;
 void terminationSignalHandler(int sig) { terminationSignalArrived = true; }
 
+// ------------------------------------------------------------------------------------------------
+// Reads the next packet from the socket straight into space reserved in the trace file writer.
+// On success the reservation is left open; the caller must commit or drop it.
+static vktrace_trace_packet_header* receive_trace_packet(FileLike* pFileLike, TraceFileWriter& traceWriter) {
+    uint64_t total_packet_size = 0;
+
+    if (vktrace_FileLike_ReadRaw(pFileLike, &total_packet_size, sizeof(uint64_t)) == FALSE) {
+        return NULL;
+    }
+
+    if (total_packet_size < sizeof(vktrace_trace_packet_header)) {
+        vktrace_LogError("Received trace packet with invalid size of %llu.", (unsigned long long)total_packet_size);
+        return NULL;
+    }
+
+    vktrace_trace_packet_header* pHeader = (vktrace_trace_packet_header*)traceWriter.reserve(total_packet_size);
+    if (pHeader == NULL) {
+        return NULL;
+    }
+
+    pHeader->size = total_packet_size;
+    if (vktrace_FileLike_ReadRaw(pFileLike, (char*)pHeader + sizeof(uint64_t), total_packet_size - sizeof(uint64_t)) == FALSE) {
+        vktrace_LogError("Failed to read trace packet with size of %llu.", (unsigned long long)total_packet_size);
+        traceWriter.commit(0);
+        return NULL;
+    }
+
+    pHeader->pBody = (uintptr_t)pHeader + sizeof(vktrace_trace_packet_header);
+    return pHeader;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Writes the trace file header, followed by the gpu_info structs.
+static bool write_trace_file_header(vktrace_process_info* pProcessInfo, const vktrace_trace_file_header& fileHeader,
+                                    const std::vector<struct_gpuinfo>& gpuinfo) {
+    uint64_t bytes_written;
+
+    vktrace_enter_critical_section(&pProcessInfo->traceFileCriticalSection);
+    bytes_written = fwrite(&fileHeader, 1, sizeof(fileHeader), pProcessInfo->pTraceFile);
+    if (!gpuinfo.empty()) {
+        bytes_written += fwrite(&gpuinfo[0], 1, gpuinfo.size() * sizeof(struct_gpuinfo), pProcessInfo->pTraceFile);
+    }
+    fflush(pProcessInfo->pTraceFile);
+    vktrace_leave_critical_section(&pProcessInfo->traceFileCriticalSection);
+
+    if (bytes_written != sizeof(fileHeader) + gpuinfo.size() * sizeof(struct_gpuinfo)) {
+        vktrace_LogError("Unable to write trace file header - fwrite failed.");
+        return false;
+    }
+    return true;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Creates the writers for the packets of a trace file whose header has been written, and starts the
+// writer thread. Returns NULL if it can't be started.
+static TraceFileWriter* start_trace_file_writer(vktrace_process_info* pProcessInfo, const vktrace_trace_file_header& fileHeader,
+                                                vktrace_dedup_writer** ppDedupWriter) {
+    uint64_t fileOffset = fileHeader.first_packet_offset;
+
+    // Everything after the header is compressed by the writer thread. File offsets used
+    // below, such as those in the portability table, are offsets in the uncompressed stream.
+    if (VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(fileHeader.trace_file_version)) {
+        pProcessInfo->pTraceBlockWriter = vktrace_block_writer_create(pProcessInfo->pTraceFile, fileOffset, 0);
+    }
+
+    // The packet index is written alongside the trace. Capture carries on without one if it can't be created.
+    pProcessInfo->pTraceIndexWriter = vktrace_trace_index_writer_create(pProcessInfo->traceFilename, fileOffset);
+
+    // Packets are batched into large buffers and written to disk on a separate thread,
+    // so receiving from the socket never waits on the file system.
+    TraceFileWriter* pTraceWriter =
+        new TraceFileWriter(pProcessInfo->pTraceFile, &pProcessInfo->traceFileCriticalSection, pProcessInfo->pTraceBlockWriter);
+
+    // Packets are deduplicated on the writer thread too. vkreplay reads the packets in the
+    // portability table straight from the file, so those are always stored as they are.
+    *ppDedupWriter = NULL;
+    if (VKTRACE_TRACE_FILE_IS_DEDUPLICATED(fileHeader.trace_file_version)) {
+        *ppDedupWriter = vktrace_dedup_writer_create((uint64_t)g_settings.dedup_min_size * 1024);
+        uint32_t portabilityPacketCount = 0;
+        const uint16_t* pPortabilityPacketIds = vktrace_get_portability_table_packet_ids(&portabilityPacketCount);
+        for (uint32_t i = 0; i < portabilityPacketCount; i++) {
+            vktrace_dedup_writer_exclude(*ppDedupWriter, pPortabilityPacketIds[i]);
+        }
+        pTraceWriter->setDedupWriter(*ppDedupWriter);
+    }
+
+    // File offsets are only known once the writer thread has deduplicated the packets before them.
+    vktrace_trace_index_writer* pIndexWriter = pProcessInfo->pTraceIndexWriter;
+    pTraceWriter->setPacketFunction(fileOffset, [pIndexWriter](const vktrace_trace_packet_header* pHeader, uint64_t packetOffset,
+                                                               uint64_t storedSize) {
+        if (vktrace_is_portability_table_packet(pHeader->packet_id)) {
+            vktrace_LogDebug("Add packet to portability table: %s",
+                             vktrace_vk_packet_id_name((VKTRACE_TRACE_PACKET_ID_VK)pHeader->packet_id));
+            portabilityTable.push_back(packetOffset);
+        }
+        if (pIndexWriter != NULL) {
+            // The index has the packet as it was traced, at the size it was stored.
+            vktrace_trace_packet_header storedHeader = *pHeader;
+            storedHeader.size = storedSize;
+            uint8_t flags = (pHeader->packet_id == VKTRACE_TPI_VK_vkQueuePresentKHR) ? VKTRACE_TRACE_INDEX_FRAME_END : 0;
+            vktrace_trace_index_writer_add(pIndexWriter, packetOffset, &storedHeader, flags);
+        }
+        lastPacketIndex = pHeader->global_packet_index;
+        lastPacketThreadId = pHeader->thread_id;
+        lastPacketEndTime = pHeader->vktrace_end_time;
+    });
+
+    if (!pTraceWriter->start()) {
+        vktrace_LogError("Unable to start the trace file writer.");
+        delete pTraceWriter;
+        vktrace_dedup_writer_destroy(ppDedupWriter);
+        return NULL;
+    }
+    return pTraceWriter;
+}
+
+// ------------------------------------------------------------------------------------------------
+// Waits for the writer thread to write every packet it was given and deletes the writers that
+// start_trace_file_writer() created, except for the ones the portability table is written with.
+static void finish_trace_file_writer(TraceFileWriter* pTraceWriter, vktrace_dedup_writer** ppDedupWriter) {
+    pTraceWriter->finish();
+    delete pTraceWriter;
+
+    if (*ppDedupWriter != NULL) {
+        vktrace_dedup_stats stats = vktrace_dedup_writer_get_total_stats(*ppDedupWriter);
+        vktrace_LogVerbose("Deduplicated %llu of %llu packets, storing %llu bytes of trace packets in %llu bytes (%.2fx).",
+                           (unsigned long long)stats.deduplicatedCount, (unsigned long long)stats.packetCount,
+                           (unsigned long long)stats.packetBytes, (unsigned long long)stats.storedBytes,
+                           stats.storedBytes > 0 ? (double)stats.packetBytes / (double)stats.storedBytes : 1.0);
+        vktrace_dedup_writer_destroy(ppDedupWriter);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// The trace layer sends a VKTRACE_TPI_MARKER_TRIM_WINDOW before each trim window after the first, so
+// that every window can be replayed on its own. Finishes the trace file of the previous window and
+// starts the trace file of the next one, which is named after the first trace file with
+// "-trim-<window>" appended, and has the same header apart from its uuid.
+static bool start_trim_window_file(vktrace_process_info* pProcessInfo, const char* pFirstFilename, uint32_t window,
+                                   vktrace_trace_file_header& fileHeader, const std::vector<struct_gpuinfo>& gpuinfo) {
+    vktrace_appendPortabilityPacket(pProcessInfo);
+    vktrace_block_writer_destroy(&pProcessInfo->pTraceBlockWriter);
+    vktrace_trace_index_writer_destroy(&pProcessInfo->pTraceIndexWriter);
+    fclose(pProcessInfo->pTraceFile);
+
+    const char* pExtension = strrchr(pFirstFilename, '.');
+    char* basename = vktrace_allocate_and_copy_n(
+        pFirstFilename, (int)((pExtension == NULL) ? strlen(pFirstFilename) : pExtension - pFirstFilename));
+    char* trimBasename = vktrace_copy_and_append(basename, "-", "trim");
+    VKTRACE_DELETE(pProcessInfo->traceFilename);
+    pProcessInfo->traceFilename = append_index_to_filename(trimBasename, window, pExtension);
+    VKTRACE_DELETE(trimBasename);
+    VKTRACE_DELETE(basename);
+
+    pProcessInfo->pTraceFile = fopen(pProcessInfo->traceFilename, "w+b");
+    if (pProcessInfo->pTraceFile == NULL) {
+        vktrace_LogError("Cannot open trace file for writing %s.", pProcessInfo->traceFilename);
+        return false;
+    }
+    vktrace_LogVerbose("Writing trim window %u to trace file: '%s'", window, pProcessInfo->traceFilename);
+
+    vktrace_gen_uuid(fileHeader.uuid);
+    return write_trace_file_header(pProcessInfo, fileHeader, gpuinfo);
+}
+
 // ------------------------------------------------------------------------------------------------
 VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadInfo) {
     vktrace_process_capture_trace_thread_info* pInfo = (vktrace_process_capture_trace_thread_info*)_threadInfo;
@@ -120,8 +286,6 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
     uint64_t fileHeaderSize;
     vktrace_trace_file_header file_header;
     vktrace_trace_packet_header* pHeader = NULL;
-    uint64_t bytes_written;
-    uint64_t fileOffset;
 #if defined(WIN32)
     BOOL rval;
 #elif defined(PLATFORM_LINUX)
@@ -130,7 +294,11 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
     sig_t rval __attribute__((unused));
 #endif
 
-    MessageStream* pMessageStream = vktrace_MessageStream_create(TRUE, "", VKTRACE_BASE_PORT + pInfo->tracerId);
+    MessageStream* pMessageStream = pInfo->pMessageStream;
+    pInfo->pMessageStream = NULL;
+    if (pMessageStream == NULL) {
+        pMessageStream = vktrace_MessageStream_create(TRUE, "", VKTRACE_BASE_PORT + pInfo->tracerId);
+    }
     if (pMessageStream == NULL) {
         vktrace_LogError("Thread_CaptureTrace() cannot create message stream.");
         return 1;
@@ -164,26 +332,43 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
         return 1;
     }
 
-    vktrace_enter_critical_section(&pInfo->pProcessInfo->traceFileCriticalSection);
-
-    // Write the trace file header to the file
-    bytes_written = fwrite(&file_header, 1, sizeof(file_header), pInfo->pProcessInfo->pTraceFile);
+    bool deduplicate = g_settings.dedup_min_size > 0;
+    if (g_settings.compress_trace || deduplicate) {
+        if (file_header.trace_file_version != VKTRACE_TRACE_FILE_VERSION) {
+            vktrace_LogWarning("Trace file version %u can't be compressed or deduplicated, writing it as it is.",
+                               file_header.trace_file_version);
+        } else if (deduplicate) {
+            file_header.trace_file_version = g_settings.compress_trace ? VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED_BLOCK_COMPRESSED
+                                                                       : VKTRACE_TRACE_FILE_VERSION_DEDUPLICATED;
+        } else {
+            file_header.trace_file_version = VKTRACE_TRACE_FILE_VERSION_BLOCK_COMPRESSED;
+        }
+    }
 
-    // Read and write the gpu_info structs
-    struct_gpuinfo gpuinfo;
+    // Read the gpu_info structs. They are kept, along with the header, for the trace files of trim windows.
+    std::vector<struct_gpuinfo> gpuinfo(file_header.n_gpuinfo);
     for (uint64_t i = 0; i < file_header.n_gpuinfo; i++) {
-        vktrace_FileLike_ReadRaw(fileLikeSocket, &gpuinfo, sizeof(struct_gpuinfo));
-        bytes_written += fwrite(&gpuinfo, 1, sizeof(struct_gpuinfo), pInfo->pProcessInfo->pTraceFile);
+        vktrace_FileLike_ReadRaw(fileLikeSocket, &gpuinfo[i], sizeof(struct_gpuinfo));
     }
-    fflush(pInfo->pProcessInfo->pTraceFile);
-    vktrace_leave_critical_section(&pInfo->pProcessInfo->traceFileCriticalSection);
 
-    if (bytes_written != sizeof(file_header) + file_header.n_gpuinfo * sizeof(struct_gpuinfo)) {
-        vktrace_LogError("Unable to write trace file header - fwrite failed.");
+    // Write the trace file header to the file
+    if (!write_trace_file_header(pInfo->pProcessInfo, file_header, gpuinfo)) {
+        vktrace_process_info_delete(pInfo->pProcessInfo);
+        return 1;
+    }
+
+    vktrace_dedup_writer* pDedupWriter = NULL;
+    TraceFileWriter* pTraceWriter = start_trace_file_writer(pInfo->pProcessInfo, file_header, &pDedupWriter);
+    if (pTraceWriter == NULL) {
         vktrace_process_info_delete(pInfo->pProcessInfo);
         return 1;
     }
-    fileOffset = file_header.first_packet_offset;
+
+    // The trace files of trim windows after the first are named after the first one, and start with
+    // the vkApiVersion packet it starts with.
+    std::string firstFilename = pInfo->pProcessInfo->traceFilename;
+    std::vector<uint8_t> apiVersionPacket;
+    uint32_t trimWindow = 0;
 
 #if defined(WIN32)
     rval = SetConsoleCtrlHandler((PHANDLER_ROUTINE)terminationSignalHandler, TRUE);
@@ -202,7 +387,7 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
         // vktrace_LogDebug("Waiting for a packet...");
 
         // read entire packet in
-        pHeader = vktrace_read_trace_packet(fileLikeSocket);
+        pHeader = receive_trace_packet(fileLikeSocket, *pTraceWriter);
 
         if (pHeader == NULL) {
             if (pMessageStream->mErrorNum == WSAECONNRESET) {
@@ -217,6 +402,7 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
 
         if (pHeader->pBody == (uintptr_t)NULL) {
             vktrace_LogWarning("Received empty packet body for id: %hu", pHeader->packet_id);
+            pTraceWriter->commit(0);
         } else {
             // handle special case packets
             if (pHeader->packet_id == VKTRACE_TPI_MESSAGE) {
@@ -230,41 +416,54 @@ VKTRACE_THREAD_ROUTINE_RETURN_TYPE Process_RunRecordTraceThread(LPVOID _threadIn
 
             if (pHeader->packet_id == VKTRACE_TPI_MARKER_TERMINATE_PROCESS) {
                 pInfo->pProcessInfo->serverRequestsTermination = true;
-                vktrace_delete_trace_packet(&pHeader);
+                pTraceWriter->commit(0);
                 vktrace_LogVerbose("Thread_CaptureTrace is exiting.");
                 break;
             }
 
-            if (pInfo->pProcessInfo->pTraceFile != NULL) {
-                vktrace_enter_critical_section(&pInfo->pProcessInfo->traceFileCriticalSection);
-                bytes_written = fwrite(pHeader, 1, (size_t)pHeader->size, pInfo->pProcessInfo->pTraceFile);
-                fflush(pInfo->pProcessInfo->pTraceFile);
-                vktrace_leave_critical_section(&pInfo->pProcessInfo->traceFileCriticalSection);
-                if (bytes_written != pHeader->size) {
-                    vktrace_LogError("Failed to write the packet for packet_id = %hu", pHeader->packet_id);
+            if (pHeader->packet_id == VKTRACE_TPI_MARKER_TRIM_WINDOW) {
+                pTraceWriter->commit(0);
+                finish_trace_file_writer(pTraceWriter, &pDedupWriter);
+                pTraceWriter = NULL;
+
+                trimWindow++;
+                if (!start_trim_window_file(pInfo->pProcessInfo, firstFilename.c_str(), trimWindow, file_header, gpuinfo)) {
+                    break;
+                }
+                pTraceWriter = start_trace_file_writer(pInfo->pProcessInfo, file_header, &pDedupWriter);
+                if (pTraceWriter == NULL) {
+                    break;
                 }
 
-                // If the packet is one we need to track, add it to the table
-                if (pHeader->packet_id == VKTRACE_TPI_VK_vkBindImageMemory ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkBindBufferMemory ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkBindImageMemory2KHR ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkBindBufferMemory2KHR ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkAllocateMemory || pHeader->packet_id == VKTRACE_TPI_VK_vkDestroyImage ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkDestroyBuffer || pHeader->packet_id == VKTRACE_TPI_VK_vkFreeMemory ||
-                    pHeader->packet_id == VKTRACE_TPI_VK_vkCreateBuffer || pHeader->packet_id == VKTRACE_TPI_VK_vkCreateImage) {
-                    vktrace_LogDebug("Add packet to portability table: %s",
-                                     vktrace_vk_packet_id_name((VKTRACE_TRACE_PACKET_ID_VK)pHeader->packet_id));
-                    portabilityTable.push_back(fileOffset);
+                if (!apiVersionPacket.empty()) {
+                    vktrace_trace_packet_header* pApiVersionHeader =
+                        (vktrace_trace_packet_header*)pTraceWriter->reserve(apiVersionPacket.size());
+                    if (pApiVersionHeader != NULL) {
+                        memcpy(pApiVersionHeader, &apiVersionPacket[0], apiVersionPacket.size());
+                        pApiVersionHeader->pBody = (uintptr_t)pApiVersionHeader + sizeof(vktrace_trace_packet_header);
+                        pTraceWriter->commit(apiVersionPacket.size());
+                    }
                 }
-                lastPacketIndex = pHeader->global_packet_index;
-                lastPacketThreadId = pHeader->thread_id;
-                lastPacketEndTime = pHeader->vktrace_end_time;
-                fileOffset += bytes_written;
+                continue;
+            }
+
+            if (pHeader->packet_id == VKTRACE_TPI_VK_vkApiVersion) {
+                apiVersionPacket.assign((uint8_t*)pHeader, (uint8_t*)pHeader + pHeader->size);
+            }
+
+            if (pInfo->pProcessInfo->pTraceFile != NULL) {
+                // The packet is written to the file by the writer thread, which also adds it to the portability
+                // table and the index; pHeader must not be used after this.
+                pTraceWriter->commit(pHeader->size);
+            } else {
+                pTraceWriter->commit(0);
             }
         }
+    }
 
-        // clean up
-        vktrace_delete_trace_packet(&pHeader);
+    // Drain everything that was received before handing the file back for post processing.
+    if (pTraceWriter != NULL) {
+        finish_trace_file_writer(pTraceWriter, &pDedupWriter);
     }
 
 #if defined(WIN32)
@@ -0,0 +1,240 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrace_writer.h"
+
+#include <string.h>
+
+#include <chrono>
+
+extern "C" {
+#include "vktrace_trace_packet_utils.h"
+}
+
+const size_t TraceFileWriter::kDefaultBufferSize;
+const uint32_t TraceFileWriter::kDefaultBufferCount;
+const uint32_t TraceFileWriter::kFlushIntervalMs;
+
+TraceFileWriter::TraceFileWriter(FILE* pTraceFile, VKTRACE_CRITICAL_SECTION* pFileLock, vktrace_block_writer* pBlockWriter,
+                                 size_t bufferSize, uint32_t bufferCount)
+    : m_pTraceFile(pTraceFile),
+      m_pFileLock(pFileLock),
+      m_pBlockWriter(pBlockWriter),
+      m_pDedupWriter(nullptr),
+      m_fileOffset(0),
+      m_pCurrent(nullptr),
+      m_reserved(false),
+      m_stopWriter(false),
+      m_started(false),
+      m_writeError(false),
+      m_bytesWritten(0),
+      m_writeCalls(0),
+      m_startTime(0) {
+    Buffer buffer = {nullptr, bufferSize, 0};
+    m_buffers.resize(bufferCount, buffer);
+}
+
+TraceFileWriter::~TraceFileWriter() {
+    finish();
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        vktrace_free(m_buffers[i].pData);
+    }
+}
+
+bool TraceFileWriter::start() {
+    assert(!m_started);
+    for (size_t i = 0; i < m_buffers.size(); i++) {
+        m_buffers[i].pData = (char*)vktrace_malloc(m_buffers[i].capacity);
+        if (m_buffers[i].pData == NULL) {
+            vktrace_LogError("Unable to allocate %llu bytes for the trace file writer.", (unsigned long long)m_buffers[i].capacity);
+            return false;
+        }
+        m_freeBuffers.push_back(&m_buffers[i]);
+    }
+
+    m_startTime = vktrace_get_time();
+    m_writerThread = std::thread(&TraceFileWriter::writerThreadMain, this);
+    m_started = true;
+    return true;
+}
+
+void TraceFileWriter::setPacketFunction(uint64_t firstPacketOffset, PacketFunction packetFunction) {
+    assert(!m_started);
+    m_fileOffset = firstPacketOffset;
+    m_packetFunction = packetFunction;
+}
+
+void TraceFileWriter::setDedupWriter(vktrace_dedup_writer* pDedupWriter) {
+    assert(!m_started);
+    m_pDedupWriter = pDedupWriter;
+}
+
+void* TraceFileWriter::reserve(uint64_t byteCount) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    assert(m_started && !m_reserved);
+
+    // Hand off the current buffer if the packet doesn't fit behind what is already in it.
+    if (m_pCurrent != nullptr && m_pCurrent->used > 0 && m_pCurrent->capacity - m_pCurrent->used < byteCount) {
+        queueCurrentBufferLocked();
+    }
+
+    if (m_pCurrent == nullptr) {
+        m_bufferFreed.wait(lock, [this] { return !m_freeBuffers.empty(); });
+        m_pCurrent = m_freeBuffers.front();
+        m_freeBuffers.pop_front();
+    }
+
+    if (m_pCurrent->capacity < byteCount) {
+        // A packet larger than a whole buffer grows that buffer; it keeps the larger size for reuse.
+        char* pData = (char*)vktrace_realloc(m_pCurrent->pData, (size_t)byteCount);
+        if (pData == NULL) {
+            vktrace_LogError("Unable to allocate %llu bytes for a trace packet.", (unsigned long long)byteCount);
+            return NULL;
+        }
+        m_pCurrent->pData = pData;
+        m_pCurrent->capacity = (size_t)byteCount;
+    }
+
+    m_reserved = true;
+    return m_pCurrent->pData + m_pCurrent->used;
+}
+
+void TraceFileWriter::commit(uint64_t byteCount) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_reserved && m_pCurrent != nullptr);
+    assert(m_pCurrent->used + byteCount <= m_pCurrent->capacity);
+
+    m_pCurrent->used += (size_t)byteCount;
+    m_reserved = false;
+    if (m_pCurrent->used == m_pCurrent->capacity) {
+        queueCurrentBufferLocked();
+    }
+}
+
+void TraceFileWriter::flush() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pCurrent != nullptr && m_pCurrent->used > 0 && !m_reserved) {
+        queueCurrentBufferLocked();
+    }
+}
+
+void TraceFileWriter::finish() {
+    if (!m_started) {
+        return;
+    }
+
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopWriter = true;
+    }
+    m_bufferQueued.notify_one();
+    m_writerThread.join();
+    m_started = false;
+
+    uint64_t elapsed = vktrace_get_time() - m_startTime;
+    double seconds = (double)elapsed / 1000000000.0;
+    vktrace_LogVerbose("Trace file writer stored %llu bytes with %llu writes in %.3f seconds (%.2f MB/s).",
+                       (unsigned long long)m_bytesWritten, (unsigned long long)m_writeCalls, seconds,
+                       (seconds > 0.0) ? ((double)m_bytesWritten / (1024.0 * 1024.0)) / seconds : 0.0);
+}
+
+void TraceFileWriter::queueCurrentBufferLocked() {
+    m_fullBuffers.push_back(m_pCurrent);
+    m_pCurrent = nullptr;
+    m_bufferQueued.notify_one();
+}
+
+void TraceFileWriter::writerThreadMain() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        if (m_fullBuffers.empty()) {
+            if (m_stopWriter) {
+                break;
+            }
+            if (!m_bufferQueued.wait_for(lock, std::chrono::milliseconds(kFlushIntervalMs),
+                                         [this] { return !m_fullBuffers.empty() || m_stopWriter; })) {
+                // Nothing has filled up for a while; push out whatever has been received so far.
+                if (m_pCurrent != nullptr && m_pCurrent->used > 0 && !m_reserved) {
+                    m_fullBuffers.push_back(m_pCurrent);
+                    m_pCurrent = nullptr;
+                }
+            }
+            continue;
+        }
+
+        Buffer* pBuffer = m_fullBuffers.front();
+        m_fullBuffers.pop_front();
+
+        lock.unlock();
+        processPackets(pBuffer);
+        writeBuffer(pBuffer);
+        lock.lock();
+
+        pBuffer->used = 0;
+        m_freeBuffers.push_back(pBuffer);
+        m_bufferFreed.notify_one();
+    }
+}
+
+// Deduplicated packets are moved down over the bytes they no longer need, so the buffer
+// can still be written out with a single write.
+void TraceFileWriter::processPackets(Buffer* pBuffer) {
+    if (!m_packetFunction && m_pDedupWriter == nullptr) {
+        return;
+    }
+
+    size_t readOffset = 0;
+    size_t writeOffset = 0;
+    while (readOffset < pBuffer->used) {
+        vktrace_trace_packet_header* pHeader = (vktrace_trace_packet_header*)(pBuffer->pData + readOffset);
+        vktrace_trace_packet_header header = *pHeader;
+        uint64_t storedSize = header.size;
+        if (m_pDedupWriter != nullptr) {
+            storedSize = vktrace_dedup_writer_process(m_pDedupWriter, pHeader, m_fileOffset);
+        }
+        if (m_packetFunction) {
+            m_packetFunction(&header, m_fileOffset, storedSize);
+        }
+        if (writeOffset != readOffset) {
+            memmove(pBuffer->pData + writeOffset, pHeader, (size_t)storedSize);
+        }
+        readOffset += (size_t)header.size;
+        writeOffset += (size_t)storedSize;
+        m_fileOffset += storedSize;
+    }
+    pBuffer->used = writeOffset;
+}
+
+void TraceFileWriter::writeBuffer(Buffer* pBuffer) {
+    vktrace_enter_critical_section(m_pFileLock);
+    size_t written;
+    if (m_pBlockWriter != nullptr) {
+        written = vktrace_block_writer_write(m_pBlockWriter, pBuffer->pData, pBuffer->used) ? pBuffer->used : 0;
+    } else {
+        written = fwrite(pBuffer->pData, 1, pBuffer->used, m_pTraceFile);
+    }
+    fflush(m_pTraceFile);
+    vktrace_leave_critical_section(m_pFileLock);
+
+    if (written != pBuffer->used) {
+        vktrace_LogError("Failed to write %llu bytes of trace packets to the trace file.", (unsigned long long)pBuffer->used);
+        m_writeError = true;
+    }
+    m_bytesWritten += written;
+    m_writeCalls++;
+}
@@ -0,0 +1,130 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include "vktrace_common.h"
+#include "vktrace_block_file.h"
+#include "vktrace_dedup.h"
+#include "vktrace_trace_packet_identifiers.h"
+}
+
+// TraceFileWriter decouples receiving trace packets from writing them to disk.
+//
+// The record thread reserves space for each packet directly inside one of a small,
+// fixed set of large buffers and reads the packet from the socket into it. Full
+// buffers are handed to a dedicated writer thread, which issues a single fwrite and
+// fflush per buffer and then returns the buffer to the free list. A partially filled
+// buffer is also written out once it has been idle for kFlushInterval, so a trace
+// that is being captured slowly still reaches the disk promptly. When given a block
+// writer, the writer thread compresses the buffers through it instead.
+//
+// When given a dedup writer, the writer thread also deduplicates packets before
+// writing them. Deduplicated packets are smaller than the packets received, so file
+// offsets are only known once the writer thread gets to a packet, which is why it
+// reports them to the packet function.
+//
+// Usage from the record thread:
+//   void* p = writer.reserve(size);   // may block while all buffers are in flight
+//   ... fill p ...
+//   writer.commit(size);              // or writer.commit(0) to drop the reservation
+//   ...
+//   writer.finish();                  // drains all buffers and joins the writer thread
+class TraceFileWriter {
+   public:
+    static const size_t kDefaultBufferSize = 8 * 1024 * 1024;
+    static const uint32_t kDefaultBufferCount = 4;
+    static const uint32_t kFlushIntervalMs = 100;
+
+    TraceFileWriter(FILE* pTraceFile, VKTRACE_CRITICAL_SECTION* pFileLock, vktrace_block_writer* pBlockWriter = nullptr,
+                    size_t bufferSize = kDefaultBufferSize, uint32_t bufferCount = kDefaultBufferCount);
+    ~TraceFileWriter();
+
+    bool start();
+
+    // Returns a pointer to byteCount contiguous bytes. Only one reservation may be outstanding at a time.
+    void* reserve(uint64_t byteCount);
+
+    // Completes the outstanding reservation, keeping the first byteCount bytes of it.
+    void commit(uint64_t byteCount);
+
+    typedef std::function<void(const vktrace_trace_packet_header* pHeader, uint64_t fileOffset, uint64_t storedSize)>
+        PacketFunction;
+
+    // Called on the writer thread for every packet, in file order, with the packet as it was received, the
+    // file offset it is written at and its size in the file. firstPacketOffset is the file offset of the
+    // first packet. Must be called before start().
+    void setPacketFunction(uint64_t firstPacketOffset, PacketFunction packetFunction);
+
+    // Deduplicates packets through pDedupWriter. Must be called before start().
+    void setDedupWriter(vktrace_dedup_writer* pDedupWriter);
+
+    // Hands the current buffer to the writer thread even if it is not full.
+    void flush();
+
+    // Flushes, waits for all buffers to reach the file and stops the writer thread.
+    void finish();
+
+    // Only meaningful once finish() has returned.
+    bool hasWriteError() const { return m_writeError; }
+    uint64_t getBytesWritten() const { return m_bytesWritten; }
+
+   private:
+    struct Buffer {
+        char* pData;
+        size_t capacity;
+        size_t used;
+    };
+
+    void writerThreadMain();
+    void processPackets(Buffer* pBuffer);
+    void writeBuffer(Buffer* pBuffer);
+    void queueCurrentBufferLocked();
+
+    FILE* m_pTraceFile;
+    VKTRACE_CRITICAL_SECTION* m_pFileLock;
+    vktrace_block_writer* m_pBlockWriter;
+    vktrace_dedup_writer* m_pDedupWriter;
+    PacketFunction m_packetFunction;
+    uint64_t m_fileOffset;  // of the next packet the writer thread processes
+
+    std::vector<Buffer> m_buffers;
+    std::deque<Buffer*> m_freeBuffers;
+    std::deque<Buffer*> m_fullBuffers;
+    Buffer* m_pCurrent;
+    bool m_reserved;
+
+    std::mutex m_mutex;
+    std::condition_variable m_bufferFreed;
+    std::condition_variable m_bufferQueued;
+    std::thread m_writerThread;
+    bool m_stopWriter;
+    bool m_started;
+
+    bool m_writeError;
+    uint64_t m_bytesWritten;
+    uint64_t m_writeCalls;
+    uint64_t m_startTime;
+};
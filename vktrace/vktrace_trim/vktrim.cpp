@@ -0,0 +1,336 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+#include "vktrim_statetracker.h"
+
+extern "C" {
+#include "vktrace_common.h"
+#include "vktrace_filelike.h"
+#include "vktrace_settings.h"
+#include "vktrace_trace_index.h"
+#include "vktrace_trace_packet_identifiers.h"
+#include "vktrace_trace_packet_utils.h"
+}
+
+// vktrim cuts a range of frames out of a full trace file, the way the trace layer does
+// when trimming is enabled while capturing (see vktrace_lib_trim.cpp). The packets before
+// the first frame are only followed by a vktrim::StateTracker, and the packets that
+// recreate the objects that are still alive at that point, along with the contents of
+// their host visible memory, are written in their place. The frames themselves are
+// copied as they are, and everything after them is left out.
+
+typedef struct vktrim_settings {
+    const char* pInputTrace;
+    const char* pOutputTrace;
+    const char* pFrames;
+    const char* verbosity;
+} vktrim_settings;
+
+static vktrim_settings g_settings = {NULL, NULL, NULL, NULL};
+static vktrim_settings g_default_settings = {NULL, NULL, NULL, NULL};
+
+static vktrace_SettingInfo g_settings_info[] = {
+    {"i",
+     "InputTrace",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pInputTrace},
+     {&g_default_settings.pInputTrace},
+     TRUE,
+     "Path to the trace file to trim."},
+    {"o",
+     "OutputTrace",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pOutputTrace},
+     {&g_default_settings.pOutputTrace},
+     TRUE,
+     "Path to the trimmed trace file to create."},
+    {"f",
+     "Frames",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.pFrames},
+     {&g_default_settings.pFrames},
+     TRUE,
+     "Frames to keep, as <start>-<end> to keep frames start through end, or <start>,<count> to keep count frames from "
+     "start. Frame 0 ends with the first vkQueuePresentKHR."},
+    {"v",
+     "Verbosity",
+     VKTRACE_SETTING_STRING,
+     {&g_settings.verbosity},
+     {&g_default_settings.verbosity},
+     TRUE,
+     "Verbosity mode. Modes are \"quiet\", \"errors\", \"warnings\", "
+     "\"full\"."},
+};
+
+static vktrace_SettingGroup g_settingGroup = {"vktrim", sizeof(g_settings_info) / sizeof(g_settings_info[0]), &g_settings_info[0]};
+
+// Writes packets to the trimmed trace file, numbering them from 0 again, and keeps its
+// index and portability table.
+class TrimmedTraceWriter {
+   public:
+    TrimmedTraceWriter(FILE* pFile, vktrace_trace_index_writer* pIndexWriter, uint64_t firstPacketOffset)
+        : m_pFile(pFile), m_pIndexWriter(pIndexWriter), m_fileOffset(firstPacketOffset), m_packetCount(0), m_lastPacket() {}
+
+    bool write(vktrace_trace_packet_header* pHeader) {
+        uint8_t flags = (pHeader->packet_id == VKTRACE_TPI_VK_vkQueuePresentKHR) ? VKTRACE_TRACE_INDEX_FRAME_END : 0;
+        pHeader->global_packet_index = m_packetCount;
+        if (fwrite(pHeader, 1, (size_t)pHeader->size, m_pFile) != pHeader->size) {
+            vktrace_LogError("Failed to write %llu bytes to the trimmed trace file.", (unsigned long long)pHeader->size);
+            return false;
+        }
+        if (m_pIndexWriter != NULL && !vktrace_trace_index_writer_add(m_pIndexWriter, m_fileOffset, pHeader, flags)) {
+            return false;
+        }
+        if (vktrace_is_portability_table_packet(pHeader->packet_id)) {
+            m_portabilityTable.push_back(m_fileOffset);
+        }
+        m_fileOffset += pHeader->size;
+        m_packetCount++;
+        m_lastPacket = *pHeader;
+        return true;
+    }
+
+    // Appends the portability table and sets the flag in the file header that says it is there,
+    // the way vktrace_appendPortabilityPacket does.
+    bool finish() {
+        m_portabilityTable.push_back(m_portabilityTable.size());
+
+        vktrace_trace_packet_header hdr = m_lastPacket;
+        hdr.size = sizeof(hdr) + m_portabilityTable.size() * sizeof(uint64_t);
+        hdr.global_packet_index = m_packetCount;
+        hdr.tracer_id = VKTRACE_TID_VULKAN;
+        hdr.packet_id = VKTRACE_TPI_PORTABILITY_TABLE;
+        hdr.vktrace_begin_time = hdr.entrypoint_begin_time = hdr.entrypoint_end_time = hdr.vktrace_end_time;
+        hdr.next_buffers_offset = 0;
+        hdr.pBody = (uintptr_t)NULL;
+        if (fwrite(&hdr, sizeof(hdr), 1, m_pFile) != 1 ||
+            fwrite(m_portabilityTable.data(), sizeof(uint64_t), m_portabilityTable.size(), m_pFile) != m_portabilityTable.size()) {
+            vktrace_LogError("Failed to write the portability table of the trimmed trace file.");
+            return false;
+        }
+        if (m_pIndexWriter != NULL && (!vktrace_trace_index_writer_add(m_pIndexWriter, m_fileOffset, &hdr, 0) ||
+                                       !vktrace_trace_index_writer_finish(m_pIndexWriter))) {
+            return false;
+        }
+
+        uint64_t one_64 = 1;
+        return fseek(m_pFile, offsetof(vktrace_trace_file_header, portability_table_valid), SEEK_SET) == 0 &&
+               fwrite(&one_64, sizeof(uint64_t), 1, m_pFile) == 1;
+    }
+
+    uint64_t get_packet_count() const { return m_packetCount; }
+
+   private:
+    FILE* m_pFile;
+    vktrace_trace_index_writer* m_pIndexWriter;
+    uint64_t m_fileOffset;
+    uint64_t m_packetCount;
+    vktrace_trace_packet_header m_lastPacket;
+    std::vector<uint64_t> m_portabilityTable;
+};
+
+static bool parse_frames(const char* pFrames, uint64_t* pStartFrame, uint64_t* pEndFrame) {
+    uint64_t frameCount = 0;
+    if (sscanf(pFrames, "%" SCNu64 ",%" SCNu64, pStartFrame, &frameCount) == 2) {
+        if (frameCount == 0) {
+            return false;
+        }
+        *pEndFrame = *pStartFrame + frameCount - 1;
+        return true;
+    }
+    return sscanf(pFrames, "%" SCNu64 "-%" SCNu64, pStartFrame, pEndFrame) == 2 && *pStartFrame <= *pEndFrame;
+}
+
+static int trim(FileLike* pInput, FILE* pOutput, uint64_t startFrame, uint64_t endFrame) {
+    vktrace_trace_file_header header;
+    if (!vktrace_FileLike_ReadRaw(pInput, &header, sizeof(header)) || header.magic != VKTRACE_FILE_MAGIC ||
+        header.first_packet_offset < sizeof(header) || header.first_packet_offset > pInput->mFileLen) {
+        vktrace_LogError("%s does not appear to be a valid Vulkan trace file.", g_settings.pInputTrace);
+        return -1;
+    }
+    if (header.trace_file_version < VKTRACE_TRACE_FILE_VERSION_MINIMUM_COMPATIBLE) {
+        vktrace_LogError("%s is version %u, vktrim needs version %u or later.", g_settings.pInputTrace, header.trace_file_version,
+                         VKTRACE_TRACE_FILE_VERSION_MINIMUM_COMPATIBLE);
+        return -1;
+    }
+    if (header.ptrsize != sizeof(void*)) {
+        // Packet bodies hold pointers, which are only interpreted right by a vktrim of the same size.
+        vktrace_LogError("%s was captured by a %u bit application, vktrim is %u bit.", g_settings.pInputTrace,
+                         (unsigned)header.ptrsize * 8, (unsigned)sizeof(void*) * 8);
+        return -1;
+    }
+
+    // The header and gpu info are copied as they are. Packets are written as they are restored, so the
+    // trimmed trace is neither compressed nor deduplicated, and it gets a portability table of its own.
+    std::vector<char> headerData((size_t)header.first_packet_offset);
+    if (!vktrace_FileLike_SetCurrentPosition(pInput, 0) ||
+        !vktrace_FileLike_ReadRaw(pInput, headerData.data(), header.first_packet_offset)) {
+        vktrace_LogError("Unable to read header from file.");
+        return -1;
+    }
+    header.trace_file_version = VKTRACE_TRACE_FILE_VERSION;
+    header.portability_table_valid = 0;
+    memcpy(headerData.data(), &header, sizeof(header));
+    if (fwrite(headerData.data(), 1, headerData.size(), pOutput) != headerData.size()) {
+        vktrace_LogError("Unable to write trace file header.");
+        return -1;
+    }
+
+    vktrace_trace_index_writer* pIndexWriter =
+        vktrace_trace_index_writer_create(g_settings.pOutputTrace, header.first_packet_offset);
+    TrimmedTraceWriter writer(pOutput, pIndexWriter, header.first_packet_offset);
+    vktrim::StateTracker stateTracker;
+    vktrim::StateTracker::WriteFunction writeFunction = [&writer](vktrace_trace_packet_header* pHeader) {
+        return writer.write(pHeader);
+    };
+
+    bool trimmed = true;
+    bool started = false;
+    uint64_t frame = 0;
+    uint64_t stateBytes = 0;
+    uint64_t statePacketCount = 0;
+    while (trimmed && frame <= endFrame && vktrace_FileLike_GetCurrentPosition(pInput) < pInput->mFileLen) {
+        vktrace_trace_packet_header* pHeader = vktrace_read_trace_packet(pInput);
+        if (pHeader == NULL) {
+            vktrace_LogError("Failed to read the packet at offset %llu.",
+                             (unsigned long long)vktrace_FileLike_GetCurrentPosition(pInput));
+            trimmed = false;
+            break;
+        }
+
+        if (!started && frame == startFrame) {
+            statePacketCount = stateTracker.get_packet_count();
+            stateBytes = stateTracker.get_packet_bytes() + stateTracker.get_memory_bytes();
+            vktrace_LogVerbose("Writing %llu objects in %llu packets before frame %llu.",
+                               (unsigned long long)stateTracker.get_object_count(), (unsigned long long)statePacketCount,
+                               (unsigned long long)startFrame);
+            trimmed = stateTracker.write_state(writeFunction);
+            statePacketCount = writer.get_packet_count();
+            started = true;
+        }
+
+        // Messages, markers and the portability table of the input aren't needed by vkreplay.
+        bool isPresent = (pHeader->packet_id == VKTRACE_TPI_VK_vkQueuePresentKHR);
+        if (VKTRACE_TPI_IS_API_PACKET(pHeader->packet_id)) {
+            if (!started) {
+                stateTracker.add_packet(pHeader);
+            } else if (trimmed) {
+                trimmed = writer.write(pHeader);
+            }
+        }
+        vktrace_free(pHeader);
+        if (isPresent) {
+            frame++;
+        }
+    }
+
+    if (trimmed && !started) {
+        vktrace_LogError("%s has %llu frames, so frame %llu can't be kept.", g_settings.pInputTrace, (unsigned long long)frame,
+                         (unsigned long long)startFrame);
+        trimmed = false;
+    }
+    if (trimmed) {
+        trimmed = writer.finish();
+    }
+    vktrace_trace_index_writer_destroy(&pIndexWriter);
+    if (!trimmed) {
+        return -1;
+    }
+
+    if (frame <= endFrame) {
+        vktrace_LogWarning("%s ends at frame %llu, before frame %llu.", g_settings.pInputTrace, (unsigned long long)frame,
+                           (unsigned long long)endFrame);
+    }
+    vktrace_LogVerbose("Wrote %llu packets that recreate the state of frame %llu from %llu bytes of tracked state, and %llu "
+                       "packets of frames %llu to %llu, into %s.",
+                       (unsigned long long)statePacketCount, (unsigned long long)startFrame, (unsigned long long)stateBytes,
+                       (unsigned long long)(writer.get_packet_count() - statePacketCount), (unsigned long long)startFrame,
+                       (unsigned long long)(frame - 1), g_settings.pOutputTrace);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+
+    if (vktrace_SettingGroup_init_from_cmdline(&g_settingGroup, argc, argv, NULL) != 0) {
+        return -1;
+    }
+
+    if (g_settings.verbosity == NULL || !strcmp(g_settings.verbosity, "errors"))
+        vktrace_LogSetLevel(VKTRACE_LOG_ERROR);
+    else if (!strcmp(g_settings.verbosity, "quiet"))
+        vktrace_LogSetLevel(VKTRACE_LOG_NONE);
+    else if (!strcmp(g_settings.verbosity, "warnings"))
+        vktrace_LogSetLevel(VKTRACE_LOG_WARNING);
+    else if (!strcmp(g_settings.verbosity, "full"))
+        vktrace_LogSetLevel(VKTRACE_LOG_VERBOSE);
+    else {
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    uint64_t startFrame = 0;
+    uint64_t endFrame = 0;
+    if (g_settings.pInputTrace == NULL || g_settings.pOutputTrace == NULL || g_settings.pFrames == NULL ||
+        !parse_frames(g_settings.pFrames, &startFrame, &endFrame)) {
+        vktrace_LogError("Usage: vktrim -i <input trace> -o <output trace> -f <start>-<end> [options]");
+        vktrace_SettingGroup_print(&g_settingGroup);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+    if (!strcmp(g_settings.pInputTrace, g_settings.pOutputTrace)) {
+        vktrace_LogError("The input and output trace files must be different.");
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FILE* pInputFile = fopen(g_settings.pInputTrace, "rb");
+    if (pInputFile == NULL) {
+        vktrace_LogError("Cannot open trace file: '%s'.", g_settings.pInputTrace);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+    FILE* pOutputFile = fopen(g_settings.pOutputTrace, "wb");
+    if (pOutputFile == NULL) {
+        vktrace_LogError("Cannot create trace file: '%s'.", g_settings.pOutputTrace);
+        fclose(pInputFile);
+        vktrace_SettingGroup_delete(&g_settingGroup);
+        return -1;
+    }
+
+    FileLike* pInput = vktrace_FileLike_create_file(pInputFile);
+    int result = trim(pInput, pOutputFile, startFrame, endFrame);
+    vktrace_FileLike_destroy(&pInput);
+
+    fclose(pInputFile);
+    if (fclose(pOutputFile) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        remove(g_settings.pOutputTrace);
+    }
+    vktrace_SettingGroup_delete(&g_settingGroup);
+    return result;
+}
@@ -0,0 +1,1258 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#include "vktrim_statetracker.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include "vktrace_pageguard_memorycopy.h"
+
+extern "C" {
+#include "vktrace_dedup.h"
+#include "vktrace_vk_packet_id.h"
+}
+
+namespace vktrim {
+
+// Every Vulkan command takes a dispatchable handle, which is a pointer, as its first parameter, so the
+// object that a vkCmd* call or a physical device query belongs to can be read from any packet body.
+typedef struct packet_dispatchable_call {
+    vktrace_trace_packet_header* header;
+    void* object;
+} packet_dispatchable_call;
+
+template <typename T>
+static uint64_t handle_value(T handle) {
+    return (uint64_t)(handle);
+}
+
+static const uint64_t kNoObject = 0;
+
+// Where a member of an interpreted packet is in the copy of the packet that was made before it was interpreted.
+template <typename T>
+static T* member_of_copy(vktrace_trace_packet_header* pCopy, const vktrace_trace_packet_header* pHeader, const T* pMember) {
+    return (T*)((char*)pCopy + ((const char*)pMember - (const char*)pHeader));
+}
+
+static vktrace_trace_packet_header* copy_packet(const vktrace_trace_packet_header* pHeader) {
+    vktrace_trace_packet_header* pCopy = (vktrace_trace_packet_header*)vktrace_malloc((size_t)pHeader->size);
+    if (pCopy != NULL) {
+        memcpy(pCopy, pHeader, (size_t)pHeader->size);
+        pCopy->pBody = (uintptr_t)pCopy + sizeof(vktrace_trace_packet_header);
+    }
+    return pCopy;
+}
+
+static bool has_prefix(const char* pName, const char* pPrefix) {
+    return pName != NULL && strncmp(pName, pPrefix, strlen(pPrefix)) == 0;
+}
+
+static vktrace_trace_packet_header* create_queue_wait_idle_packet(VkQueue queue) {
+    vktrace_trace_packet_header* pHeader;
+    packet_vkQueueWaitIdle* pPacket;
+    CREATE_TRACE_PACKET(vkQueueWaitIdle, 0);
+    pPacket = interpret_body_as_vkQueueWaitIdle(pHeader);
+    pPacket->queue = queue;
+    pPacket->result = VK_SUCCESS;
+    vktrace_finalize_trace_packet(pHeader);
+    return pHeader;
+}
+
+static void delete_packets(std::vector<vktrace_trace_packet_header*>& packets) {
+    for (vktrace_trace_packet_header*& pHeader : packets) {
+        vktrace_delete_trace_packet(&pHeader);
+    }
+    packets.clear();
+}
+
+// Packets that create one object from a create info. The object's parent is the first parameter.
+#define TRACK_CREATE(name, parentMember, objectMember)                                                \
+    case VKTRACE_TPI_VK_##name: {                                                                     \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader);                                   \
+        if (pPacket->result == VK_SUCCESS && pPacket->objectMember != NULL) {                         \
+            add_object(handle_value(*pPacket->objectMember), handle_value(pPacket->parentMember)); \
+        }                                                                                             \
+        break;                                                                                        \
+    }
+
+// Packets that destroy one object, along with any children it still has.
+#define TRACK_DESTROY(name, objectMember)                                              \
+    case VKTRACE_TPI_VK_##name:                                                        \
+        destroy_object(handle_value(interpret_body_as_##name(pHeader)->objectMember)); \
+        break;
+
+// Packets that are kept for as long as the object they are about is.
+#define TRACK_USE(name, objectMember)                                                         \
+    case VKTRACE_TPI_VK_##name:                                                               \
+        add_to_object(handle_value(interpret_body_as_##name(pHeader)->objectMember)); \
+        break;
+
+// Packets that query the requirements of the buffers or images in their pInfo.
+#define TRACK_USE_ARRAY(name, arrayMember, countMember, objectMember)                 \
+    case VKTRACE_TPI_VK_##name: {                                                     \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader);                   \
+        for (uint32_t i = 0; pPacket->arrayMember != NULL && i < (countMember); i++) { \
+            add_to_object(handle_value(pPacket->arrayMember[i].objectMember));        \
+        }                                                                             \
+        break;                                                                        \
+    }
+
+// Packets that bind memory to a buffer or an image, which then needs the memory to be recreated.
+#define TRACK_BIND(name, objectMember)                                                                          \
+    case VKTRACE_TPI_VK_##name: {                                                                               \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader);                                             \
+        bind_memory(handle_value(pPacket->objectMember), handle_value(pPacket->memory), pPacket->memoryOffset); \
+        break;                                                                                                  \
+    }
+
+#define TRACK_BIND_ARRAY(name, objectMember)                                                               \
+    case VKTRACE_TPI_VK_##name: {                                                                          \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader);                                        \
+        for (uint32_t i = 0; pPacket->pBindInfos != NULL && i < pPacket->bindInfoCount; i++) {             \
+            bind_memory(handle_value(pPacket->pBindInfos[i].objectMember),                                 \
+                        handle_value(pPacket->pBindInfos[i].memory), pPacket->pBindInfos[i].memoryOffset); \
+        }                                                                                                  \
+        break;                                                                                             \
+    }
+
+// Commands of an upload that read one object and write another, or that only write one.
+#define TRACK_TRANSFER(name, sourceMember, destinationMember)                   \
+    case VKTRACE_TPI_VK_##name: {                                               \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader);             \
+        state.sources.push_back(handle_value(pPacket->sourceMember));           \
+        state.destinations.push_back(handle_value(pPacket->destinationMember)); \
+        break;                                                                  \
+    }
+
+#define TRACK_TRANSFER_TO(name, destinationMember)                                                        \
+    case VKTRACE_TPI_VK_##name:                                                                           \
+        state.destinations.push_back(handle_value(interpret_body_as_##name(pHeader)->destinationMember)); \
+        break;
+
+// vkGetPhysicalDeviceSurface*KHR, which are kept for as long as the surface is.
+#define TRACK_SURFACE_QUERY(name, surface)                          \
+    case VKTRACE_TPI_VK_##name: {                                   \
+        packet_##name* pPacket = interpret_body_as_##name(pHeader); \
+        if (handle_value(surface) != kNoObject) {                   \
+            add_query(handle_value(surface));                       \
+        }                                                           \
+        break;                                                      \
+    }
+
+StateTracker::StateTracker() : m_packetBytes(0), m_packetCount(0), m_position(0), m_pPacket(NULL) { m_global.parent = kNoObject; }
+
+StateTracker::~StateTracker() {
+    for (auto& entry : m_packets) {
+        vktrace_free(entry.second.pHeader);
+        delete_packets(entry.second.before);
+        delete_packets(entry.second.after);
+    }
+    for (auto& entry : m_memories) {
+        vktrace_free(entry.second.pMapPacket);
+    }
+}
+
+uint64_t StateTracker::get_memory_bytes() const {
+    uint64_t bytes = 0;
+    for (auto& entry : m_memories) {
+        bytes += entry.second.contents.size();
+    }
+    return bytes;
+}
+
+void StateTracker::add_packet(vktrace_trace_packet_header* pHeader) {
+    // Messages, markers and the portability table say nothing about the state.
+    if (pHeader->tracer_id != VKTRACE_TID_VULKAN || !VKTRACE_TPI_IS_API_PACKET(pHeader->packet_id)) {
+        return;
+    }
+
+    // Memory contents are copied out of the packets that carry them, and the packets are dropped.
+    switch (pHeader->packet_id) {
+        case VKTRACE_TPI_VK_vkMapMemory:
+            map_memory(pHeader);
+            return;
+        case VKTRACE_TPI_VK_vkUnmapMemory:
+            unmap_memory(pHeader);
+            return;
+        case VKTRACE_TPI_VK_vkFlushMappedMemoryRanges:
+            flush_memory(pHeader);
+            return;
+        case VKTRACE_TPI_VK_vkInvalidateMappedMemoryRanges:
+            invalidate_memory(pHeader);
+            return;
+        default:
+            break;
+    }
+
+    m_pPacket = copy_packet(pHeader);
+    if (m_pPacket == NULL) {
+        vktrace_LogError("Failed to copy a packet of %llu bytes.", (unsigned long long)pHeader->size);
+        return;
+    }
+    m_position = m_packetCount++;
+    track_packet(pHeader);
+    if (m_packets.find(m_position) == m_packets.end()) {
+        vktrace_free(m_pPacket);
+    }
+    m_pPacket = NULL;
+}
+
+void StateTracker::track_packet(vktrace_trace_packet_header* pHeader) {
+    switch (pHeader->packet_id) {
+        case VKTRACE_TPI_VK_vkApiVersion:
+            reference_packet(m_global.packets);
+            break;
+
+        // Instances, physical devices, devices and queues
+        case VKTRACE_TPI_VK_vkCreateInstance: {
+            packet_vkCreateInstance* pPacket = interpret_body_as_vkCreateInstance(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pInstance != NULL) {
+                add_object(handle_value(*pPacket->pInstance), kNoObject);
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyInstance, instance)
+        case VKTRACE_TPI_VK_vkEnumeratePhysicalDevices: {
+            packet_vkEnumeratePhysicalDevices* pPacket = interpret_body_as_vkEnumeratePhysicalDevices(pHeader);
+            if (pPacket->pPhysicalDevices == NULL || pPacket->pPhysicalDeviceCount == NULL) {
+                add_to_object(handle_value(pPacket->instance));
+            } else if (pPacket->result == VK_SUCCESS || pPacket->result == VK_INCOMPLETE) {
+                for (uint32_t i = 0; i < *pPacket->pPhysicalDeviceCount; i++) {
+                    add_object(handle_value(pPacket->pPhysicalDevices[i]), handle_value(pPacket->instance));
+                }
+            }
+            break;
+        }
+        TRACK_CREATE(vkCreateDevice, physicalDevice, pDevice)
+        TRACK_DESTROY(vkDestroyDevice, device)
+        case VKTRACE_TPI_VK_vkGetDeviceQueue: {
+            packet_vkGetDeviceQueue* pPacket = interpret_body_as_vkGetDeviceQueue(pHeader);
+            if (pPacket->pQueue != NULL) {
+                add_object(handle_value(*pPacket->pQueue), handle_value(pPacket->device));
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkGetDeviceQueue2: {
+            packet_vkGetDeviceQueue2* pPacket = interpret_body_as_vkGetDeviceQueue2(pHeader);
+            if (pPacket->pQueue != NULL) {
+                add_object(handle_value(*pPacket->pQueue), handle_value(pPacket->device));
+            }
+            break;
+        }
+
+        // Surfaces and swapchains
+        TRACK_CREATE(vkCreateXcbSurfaceKHR, instance, pSurface)
+        TRACK_CREATE(vkCreateXlibSurfaceKHR, instance, pSurface)
+        TRACK_CREATE(vkCreateWaylandSurfaceKHR, instance, pSurface)
+        TRACK_CREATE(vkCreateWin32SurfaceKHR, instance, pSurface)
+        TRACK_CREATE(vkCreateAndroidSurfaceKHR, instance, pSurface)
+        TRACK_DESTROY(vkDestroySurfaceKHR, surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceSupportKHR, pPacket->surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceCapabilitiesKHR, pPacket->surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceFormatsKHR, pPacket->surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfacePresentModesKHR, pPacket->surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceCapabilities2EXT, pPacket->surface)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceCapabilities2KHR,
+                            (pPacket->pSurfaceInfo != NULL) ? pPacket->pSurfaceInfo->surface : VK_NULL_HANDLE)
+        TRACK_SURFACE_QUERY(vkGetPhysicalDeviceSurfaceFormats2KHR,
+                            (pPacket->pSurfaceInfo != NULL) ? pPacket->pSurfaceInfo->surface : VK_NULL_HANDLE)
+        case VKTRACE_TPI_VK_vkCreateSwapchainKHR: {
+            packet_vkCreateSwapchainKHR* pPacket = interpret_body_as_vkCreateSwapchainKHR(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pSwapchain != NULL) {
+                add_object(handle_value(*pPacket->pSwapchain), handle_value(pPacket->device));
+                if (pPacket->pCreateInfo != NULL) {
+                    add_dependency(handle_value(*pPacket->pSwapchain), handle_value(pPacket->pCreateInfo->oldSwapchain));
+                }
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroySwapchainKHR, swapchain)
+        case VKTRACE_TPI_VK_vkGetSwapchainImagesKHR: {
+            packet_vkGetSwapchainImagesKHR* pPacket = interpret_body_as_vkGetSwapchainImagesKHR(pHeader);
+            if (pPacket->pSwapchainImages == NULL || pPacket->pSwapchainImageCount == NULL) {
+                add_to_object(handle_value(pPacket->swapchain));
+            } else if (pPacket->result == VK_SUCCESS || pPacket->result == VK_INCOMPLETE) {
+                for (uint32_t i = 0; i < *pPacket->pSwapchainImageCount; i++) {
+                    add_object(handle_value(pPacket->pSwapchainImages[i]), handle_value(pPacket->swapchain));
+                    m_swapchainImages.insert(handle_value(pPacket->pSwapchainImages[i]));
+                }
+            }
+            break;
+        }
+        TRACK_CREATE(vkCreateDebugReportCallbackEXT, instance, pCallback)
+        TRACK_DESTROY(vkDestroyDebugReportCallbackEXT, callback)
+
+        // Memory, buffers and images
+        case VKTRACE_TPI_VK_vkAllocateMemory: {
+            packet_vkAllocateMemory* pPacket = interpret_body_as_vkAllocateMemory(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pMemory != NULL && pPacket->pAllocateInfo != NULL) {
+                uint64_t handle = handle_value(*pPacket->pMemory);
+                add_object(handle, handle_value(pPacket->device));
+                DeviceMemory& memory = m_memories[handle];
+                memory.device = pPacket->device;
+                memory.memory = *pPacket->pMemory;
+                memory.allocationSize = pPacket->pAllocateInfo->allocationSize;
+                memory.writtenBegin = 0;
+                memory.writtenEnd = 0;
+                memory.mapOffset = 0;
+                memory.mapSize = 0;
+                memory.pMapPacket = NULL;
+            }
+            break;
+        }
+        TRACK_DESTROY(vkFreeMemory, memory)
+        case VKTRACE_TPI_VK_vkCreateBuffer: {
+            packet_vkCreateBuffer* pPacket = interpret_body_as_vkCreateBuffer(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pBuffer != NULL && pPacket->pCreateInfo != NULL) {
+                uint64_t handle = handle_value(*pPacket->pBuffer);
+                add_object(handle, handle_value(pPacket->device));
+                Buffer& buffer = m_buffers[handle];
+                buffer.size = pPacket->pCreateInfo->size;
+                buffer.memory = kNoObject;
+                buffer.memoryOffset = 0;
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyBuffer, buffer)
+        TRACK_CREATE(vkCreateBufferView, device, pView)
+        TRACK_DESTROY(vkDestroyBufferView, bufferView)
+        TRACK_CREATE(vkCreateImage, device, pImage)
+        TRACK_DESTROY(vkDestroyImage, image)
+        TRACK_CREATE(vkCreateImageView, device, pView)
+        TRACK_DESTROY(vkDestroyImageView, imageView)
+        TRACK_BIND(vkBindBufferMemory, buffer)
+        TRACK_BIND(vkBindImageMemory, image)
+        TRACK_BIND_ARRAY(vkBindBufferMemory2, buffer)
+        TRACK_BIND_ARRAY(vkBindBufferMemory2KHR, buffer)
+        TRACK_BIND_ARRAY(vkBindImageMemory2, image)
+        TRACK_BIND_ARRAY(vkBindImageMemory2KHR, image)
+        TRACK_USE(vkGetBufferMemoryRequirements, buffer)
+        TRACK_USE(vkGetImageMemoryRequirements, image)
+        TRACK_USE(vkGetImageSparseMemoryRequirements, image)
+        TRACK_USE(vkGetImageSubresourceLayout, image)
+        TRACK_USE_ARRAY(vkGetBufferMemoryRequirements2, pInfo, 1, buffer)
+        TRACK_USE_ARRAY(vkGetBufferMemoryRequirements2KHR, pInfo, 1, buffer)
+        TRACK_USE_ARRAY(vkGetImageMemoryRequirements2, pInfo, 1, image)
+        TRACK_USE_ARRAY(vkGetImageMemoryRequirements2KHR, pInfo, 1, image)
+
+        // Synchronization and queries. Fences are recreated signaled if they were left signaled.
+        case VKTRACE_TPI_VK_vkCreateFence: {
+            packet_vkCreateFence* pPacket = interpret_body_as_vkCreateFence(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pFence != NULL && pPacket->pCreateInfo != NULL) {
+                uint64_t handle = handle_value(*pPacket->pFence);
+                add_object(handle, handle_value(pPacket->device));
+                Fence& fence = m_fences[handle];
+                fence.createPacket = m_position;
+                fence.flagsOffset = (uint64_t)((const char*)&pPacket->pCreateInfo->flags - (const char*)pHeader);
+                fence.signaled = (pPacket->pCreateInfo->flags & VK_FENCE_CREATE_SIGNALED_BIT) != 0;
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyFence, fence)
+        case VKTRACE_TPI_VK_vkResetFences: {
+            packet_vkResetFences* pPacket = interpret_body_as_vkResetFences(pHeader);
+            for (uint32_t i = 0; pPacket->pFences != NULL && i < pPacket->fenceCount; i++) {
+                auto fence = m_fences.find(handle_value(pPacket->pFences[i]));
+                if (fence != m_fences.end()) {
+                    fence->second.signaled = false;
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkQueueSubmit:
+        case VKTRACE_TPI_VK_vkQueueBindSparse:
+        case VKTRACE_TPI_VK_vkAcquireNextImageKHR: {
+            VkFence signaledFence = VK_NULL_HANDLE;
+            if (pHeader->packet_id == VKTRACE_TPI_VK_vkQueueSubmit) {
+                signaledFence = interpret_body_as_vkQueueSubmit(pHeader)->fence;
+            } else if (pHeader->packet_id == VKTRACE_TPI_VK_vkQueueBindSparse) {
+                signaledFence = interpret_body_as_vkQueueBindSparse(pHeader)->fence;
+            } else {
+                signaledFence = interpret_body_as_vkAcquireNextImageKHR(pHeader)->fence;
+            }
+            auto fence = m_fences.find(handle_value(signaledFence));
+            if (fence != m_fences.end()) {
+                fence->second.signaled = true;
+            }
+            if (pHeader->packet_id == VKTRACE_TPI_VK_vkQueueSubmit) {
+                add_upload(pHeader);
+            }
+            break;
+        }
+        TRACK_CREATE(vkCreateSemaphore, device, pSemaphore)
+        TRACK_DESTROY(vkDestroySemaphore, semaphore)
+        TRACK_CREATE(vkCreateEvent, device, pEvent)
+        TRACK_DESTROY(vkDestroyEvent, event)
+        // Both have the same parameters, so the latest one replaces the one before it like a repeated query.
+        case VKTRACE_TPI_VK_vkSetEvent:
+            add_query(handle_value(interpret_body_as_vkSetEvent(pHeader)->event));
+            break;
+        case VKTRACE_TPI_VK_vkResetEvent:
+            add_query(handle_value(interpret_body_as_vkResetEvent(pHeader)->event));
+            break;
+        TRACK_CREATE(vkCreateQueryPool, device, pQueryPool)
+        TRACK_DESTROY(vkDestroyQueryPool, queryPool)
+
+        // Pipelines and the objects they are made from. Those can be destroyed as soon as the objects made
+        // from them are created, but they are needed to recreate them, see destroy_object.
+        TRACK_CREATE(vkCreateShaderModule, device, pShaderModule)
+        TRACK_DESTROY(vkDestroyShaderModule, shaderModule)
+        TRACK_CREATE(vkCreatePipelineCache, device, pPipelineCache)
+        TRACK_DESTROY(vkDestroyPipelineCache, pipelineCache)
+        case VKTRACE_TPI_VK_vkCreatePipelineLayout: {
+            packet_vkCreatePipelineLayout* pPacket = interpret_body_as_vkCreatePipelineLayout(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pPipelineLayout != NULL) {
+                uint64_t pipelineLayout = handle_value(*pPacket->pPipelineLayout);
+                add_object(pipelineLayout, handle_value(pPacket->device));
+                for (uint32_t i = 0; pPacket->pCreateInfo != NULL && pPacket->pCreateInfo->pSetLayouts != NULL &&
+                                     i < pPacket->pCreateInfo->setLayoutCount;
+                     i++) {
+                    add_dependency(pipelineLayout, handle_value(pPacket->pCreateInfo->pSetLayouts[i]));
+                }
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyPipelineLayout, pipelineLayout)
+        TRACK_CREATE(vkCreateRenderPass, device, pRenderPass)
+        TRACK_DESTROY(vkDestroyRenderPass, renderPass)
+        case VKTRACE_TPI_VK_vkCreateFramebuffer: {
+            packet_vkCreateFramebuffer* pPacket = interpret_body_as_vkCreateFramebuffer(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pFramebuffer != NULL && pPacket->pCreateInfo != NULL) {
+                uint64_t framebuffer = handle_value(*pPacket->pFramebuffer);
+                add_object(framebuffer, handle_value(pPacket->device));
+                add_dependency(framebuffer, handle_value(pPacket->pCreateInfo->renderPass));
+                for (uint32_t i = 0; pPacket->pCreateInfo->pAttachments != NULL && i < pPacket->pCreateInfo->attachmentCount; i++) {
+                    add_dependency(framebuffer, handle_value(pPacket->pCreateInfo->pAttachments[i]));
+                }
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyFramebuffer, framebuffer)
+        TRACK_CREATE(vkCreateSampler, device, pSampler)
+        TRACK_DESTROY(vkDestroySampler, sampler)
+        TRACK_CREATE(vkCreateSamplerYcbcrConversion, device, pYcbcrConversion)
+        TRACK_CREATE(vkCreateSamplerYcbcrConversionKHR, device, pYcbcrConversion)
+        TRACK_DESTROY(vkDestroySamplerYcbcrConversion, ycbcrConversion)
+        TRACK_DESTROY(vkDestroySamplerYcbcrConversionKHR, ycbcrConversion)
+        case VKTRACE_TPI_VK_vkCreateGraphicsPipelines: {
+            packet_vkCreateGraphicsPipelines* pPacket = interpret_body_as_vkCreateGraphicsPipelines(pHeader);
+            for (uint32_t i = 0; pPacket->result == VK_SUCCESS && pPacket->pPipelines != NULL && i < pPacket->createInfoCount;
+                 i++) {
+                uint64_t pipeline = handle_value(pPacket->pPipelines[i]);
+                add_object(pipeline, handle_value(pPacket->device));
+                add_dependency(pipeline, handle_value(pPacket->pipelineCache));
+                if (pPacket->pCreateInfos != NULL) {
+                    const VkGraphicsPipelineCreateInfo& createInfo = pPacket->pCreateInfos[i];
+                    for (uint32_t j = 0; createInfo.pStages != NULL && j < createInfo.stageCount; j++) {
+                        add_dependency(pipeline, handle_value(createInfo.pStages[j].module));
+                    }
+                    add_dependency(pipeline, handle_value(createInfo.layout));
+                    add_dependency(pipeline, handle_value(createInfo.renderPass));
+                    add_dependency(pipeline, handle_value(createInfo.basePipelineHandle));
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkCreateComputePipelines: {
+            packet_vkCreateComputePipelines* pPacket = interpret_body_as_vkCreateComputePipelines(pHeader);
+            for (uint32_t i = 0; pPacket->result == VK_SUCCESS && pPacket->pPipelines != NULL && i < pPacket->createInfoCount;
+                 i++) {
+                uint64_t pipeline = handle_value(pPacket->pPipelines[i]);
+                add_object(pipeline, handle_value(pPacket->device));
+                add_dependency(pipeline, handle_value(pPacket->pipelineCache));
+                if (pPacket->pCreateInfos != NULL) {
+                    const VkComputePipelineCreateInfo& createInfo = pPacket->pCreateInfos[i];
+                    add_dependency(pipeline, handle_value(createInfo.stage.module));
+                    add_dependency(pipeline, handle_value(createInfo.layout));
+                    add_dependency(pipeline, handle_value(createInfo.basePipelineHandle));
+                }
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyPipeline, pipeline)
+
+        // Descriptors. Only the latest packet that wrote each descriptor of a set is kept.
+        TRACK_CREATE(vkCreateDescriptorSetLayout, device, pSetLayout)
+        TRACK_DESTROY(vkDestroyDescriptorSetLayout, descriptorSetLayout)
+        case VKTRACE_TPI_VK_vkCreateDescriptorUpdateTemplate:
+        case VKTRACE_TPI_VK_vkCreateDescriptorUpdateTemplateKHR: {
+            // Both have the same parameters.
+            packet_vkCreateDescriptorUpdateTemplate* pPacket = interpret_body_as_vkCreateDescriptorUpdateTemplate(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pDescriptorUpdateTemplate != NULL && pPacket->pCreateInfo != NULL) {
+                uint64_t descriptorUpdateTemplate = handle_value(*pPacket->pDescriptorUpdateTemplate);
+                add_object(descriptorUpdateTemplate, handle_value(pPacket->device));
+                add_dependency(descriptorUpdateTemplate, handle_value(pPacket->pCreateInfo->descriptorSetLayout));
+                add_dependency(descriptorUpdateTemplate, handle_value(pPacket->pCreateInfo->pipelineLayout));
+            }
+            break;
+        }
+        TRACK_DESTROY(vkDestroyDescriptorUpdateTemplate, descriptorUpdateTemplate)
+        TRACK_DESTROY(vkDestroyDescriptorUpdateTemplateKHR, descriptorUpdateTemplate)
+        TRACK_CREATE(vkCreateDescriptorPool, device, pDescriptorPool)
+        TRACK_DESTROY(vkDestroyDescriptorPool, descriptorPool)
+        case VKTRACE_TPI_VK_vkResetDescriptorPool:
+            remove_children(handle_value(interpret_body_as_vkResetDescriptorPool(pHeader)->descriptorPool));
+            break;
+        case VKTRACE_TPI_VK_vkAllocateDescriptorSets: {
+            packet_vkAllocateDescriptorSets* pPacket = interpret_body_as_vkAllocateDescriptorSets(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pAllocateInfo != NULL && pPacket->pDescriptorSets != NULL) {
+                for (uint32_t i = 0; i < pPacket->pAllocateInfo->descriptorSetCount; i++) {
+                    add_object(handle_value(pPacket->pDescriptorSets[i]), handle_value(pPacket->pAllocateInfo->descriptorPool));
+                    if (pPacket->pAllocateInfo->pSetLayouts != NULL) {
+                        add_dependency(handle_value(pPacket->pDescriptorSets[i]),
+                                       handle_value(pPacket->pAllocateInfo->pSetLayouts[i]));
+                    }
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkFreeDescriptorSets: {
+            packet_vkFreeDescriptorSets* pPacket = interpret_body_as_vkFreeDescriptorSets(pHeader);
+            for (uint32_t i = 0; pPacket->pDescriptorSets != NULL && i < pPacket->descriptorSetCount; i++) {
+                destroy_object(handle_value(pPacket->pDescriptorSets[i]));
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkUpdateDescriptorSets: {
+            packet_vkUpdateDescriptorSets* pPacket = interpret_body_as_vkUpdateDescriptorSets(pHeader);
+            for (uint32_t i = 0; pPacket->pDescriptorWrites != NULL && i < pPacket->descriptorWriteCount; i++) {
+                const VkWriteDescriptorSet& write = pPacket->pDescriptorWrites[i];
+                for (uint32_t j = 0; j < write.descriptorCount; j++) {
+                    write_descriptor(handle_value(write.dstSet), false,
+                                     ((uint64_t)write.dstBinding << 32) | (uint64_t)(write.dstArrayElement + j));
+                }
+            }
+            for (uint32_t i = 0; pPacket->pDescriptorCopies != NULL && i < pPacket->descriptorCopyCount; i++) {
+                const VkCopyDescriptorSet& copy = pPacket->pDescriptorCopies[i];
+                for (uint32_t j = 0; j < copy.descriptorCount; j++) {
+                    write_descriptor(handle_value(copy.dstSet), false,
+                                     ((uint64_t)copy.dstBinding << 32) | (uint64_t)(copy.dstArrayElement + j));
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkUpdateDescriptorSetWithTemplate: {
+            packet_vkUpdateDescriptorSetWithTemplate* pPacket = interpret_body_as_vkUpdateDescriptorSetWithTemplate(pHeader);
+            write_descriptor(handle_value(pPacket->descriptorSet), true, handle_value(pPacket->descriptorUpdateTemplate));
+            break;
+        }
+        case VKTRACE_TPI_VK_vkUpdateDescriptorSetWithTemplateKHR: {
+            packet_vkUpdateDescriptorSetWithTemplateKHR* pPacket = interpret_body_as_vkUpdateDescriptorSetWithTemplateKHR(pHeader);
+            write_descriptor(handle_value(pPacket->descriptorSet), true, handle_value(pPacket->descriptorUpdateTemplate));
+            break;
+        }
+
+        // Command buffers keep what was recorded since they were last begun or reset.
+        TRACK_CREATE(vkCreateCommandPool, device, pCommandPool)
+        TRACK_DESTROY(vkDestroyCommandPool, commandPool)
+        case VKTRACE_TPI_VK_vkResetCommandPool: {
+            uint64_t commandPool = handle_value(interpret_body_as_vkResetCommandPool(pHeader)->commandPool);
+            Object* pCommandPool = find_object(commandPool);
+            if (pCommandPool != NULL) {
+                for (uint64_t commandBuffer : pCommandPool->children) {
+                    Object* pCommandBuffer = find_object(commandBuffer);
+                    if (pCommandBuffer != NULL && pCommandBuffer->parent == commandPool) {
+                        reset_command_buffer(commandBuffer);
+                    }
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkAllocateCommandBuffers: {
+            packet_vkAllocateCommandBuffers* pPacket = interpret_body_as_vkAllocateCommandBuffers(pHeader);
+            if (pPacket->result == VK_SUCCESS && pPacket->pAllocateInfo != NULL && pPacket->pCommandBuffers != NULL) {
+                for (uint32_t i = 0; i < pPacket->pAllocateInfo->commandBufferCount; i++) {
+                    add_object(handle_value(pPacket->pCommandBuffers[i]), handle_value(pPacket->pAllocateInfo->commandPool));
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkFreeCommandBuffers: {
+            packet_vkFreeCommandBuffers* pPacket = interpret_body_as_vkFreeCommandBuffers(pHeader);
+            for (uint32_t i = 0; pPacket->pCommandBuffers != NULL && i < pPacket->commandBufferCount; i++) {
+                destroy_object(handle_value(pPacket->pCommandBuffers[i]));
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkBeginCommandBuffer:
+            reset_command_buffer(handle_value(interpret_body_as_vkBeginCommandBuffer(pHeader)->commandBuffer));
+            record_command(handle_value(interpret_body_as_vkBeginCommandBuffer(pHeader)->commandBuffer));
+            break;
+        case VKTRACE_TPI_VK_vkEndCommandBuffer:
+            record_command(handle_value(interpret_body_as_vkEndCommandBuffer(pHeader)->commandBuffer));
+            break;
+        case VKTRACE_TPI_VK_vkResetCommandBuffer:
+            reset_command_buffer(handle_value(interpret_body_as_vkResetCommandBuffer(pHeader)->commandBuffer));
+            break;
+
+        default: {
+            // vkCmd* calls are recorded as they are, and physical device and instance queries are kept for
+            // as long as what they are about. Anything else, like presents, waits, submits that aren't
+            // uploads and other queries, only matters at the time it was made.
+            const char* pName = vktrace_vk_packet_id_name((VKTRACE_TRACE_PACKET_ID_VK)pHeader->packet_id);
+            packet_dispatchable_call* pCall = (packet_dispatchable_call*)pHeader->pBody;
+            if (has_prefix(pName, "vkCmd")) {
+                record_command(handle_value(pCall->object));
+                record_transfer(handle_value(pCall->object), pHeader);
+            } else if (has_prefix(pName, "vkGetPhysicalDevice") || has_prefix(pName, "vkEnumerateDevice")) {
+                add_query(handle_value(pCall->object));
+            } else if (has_prefix(pName, "vkEnumerateInstance")) {
+                add_query(kNoObject);
+            }
+            break;
+        }
+    }
+}
+
+void StateTracker::reference_packet(std::vector<uint64_t>& packets) {
+    auto entry = m_packets.find(m_position);
+    if (entry == m_packets.end()) {
+        StoredPacket packet = {m_pPacket, 0};
+        entry = m_packets.insert(std::make_pair(m_position, packet)).first;
+        m_packetBytes += m_pPacket->size;
+    }
+    entry->second.refCount++;
+    packets.push_back(m_position);
+}
+
+void StateTracker::reference_packets(const std::vector<uint64_t>& from, std::vector<uint64_t>& packets) {
+    for (uint64_t position : from) {
+        auto entry = m_packets.find(position);
+        if (entry != m_packets.end()) {
+            entry->second.refCount++;
+            packets.push_back(position);
+        }
+    }
+}
+
+void StateTracker::release_packet(uint64_t position) {
+    auto entry = m_packets.find(position);
+    if (entry != m_packets.end() && --entry->second.refCount == 0) {
+        m_packetBytes -= entry->second.pHeader->size;
+        vktrace_free(entry->second.pHeader);
+        for (vktrace_trace_packet_header* pHeader : entry->second.before) {
+            m_packetBytes -= pHeader->size;
+        }
+        for (vktrace_trace_packet_header* pHeader : entry->second.after) {
+            m_packetBytes -= pHeader->size;
+        }
+        delete_packets(entry->second.before);
+        delete_packets(entry->second.after);
+        m_packets.erase(entry);
+    }
+}
+
+void StateTracker::release_packets(std::vector<uint64_t>& packets) {
+    for (uint64_t position : packets) {
+        release_packet(position);
+    }
+    packets.clear();
+}
+
+StateTracker::Object* StateTracker::find_object(uint64_t handle) {
+    if (handle == kNoObject) {
+        return &m_global;
+    }
+    auto object = m_objects.find(handle);
+    return (object != m_objects.end()) ? &object->second : NULL;
+}
+
+// Handles that are returned again, like queues and physical devices, collect the packets that returned
+// them. A handle that comes back with a different parent belongs to a new object that reused it.
+void StateTracker::add_object(uint64_t handle, uint64_t parent) {
+    if (handle == kNoObject) {
+        return;
+    }
+    Object* pObject = find_object(handle);
+    if (pObject != NULL && pObject->parent != parent) {
+        remove_object(handle);
+        pObject = NULL;
+    }
+    if (pObject == NULL) {
+        pObject = &m_objects[handle];
+        pObject->parent = parent;
+        Object* pParent = find_object(parent);
+        if (pParent != NULL && parent != kNoObject) {
+            pParent->children.push_back(handle);
+        }
+    }
+    reference_packet(pObject->packets);
+}
+
+void StateTracker::add_to_object(uint64_t handle) {
+    Object* pObject = find_object(handle);
+    if (pObject != NULL) {
+        reference_packet(pObject->packets);
+    }
+}
+
+void StateTracker::add_dependency(uint64_t handle, uint64_t dependency) {
+    Object* pObject = find_object(handle);
+    Object* pDependency = find_object(dependency);
+    if (pObject == NULL || pDependency == NULL || handle == kNoObject || dependency == kNoObject || handle == dependency ||
+        std::find(pObject->dependencies.begin(), pObject->dependencies.end(), dependency) != pObject->dependencies.end()) {
+        return;
+    }
+    pObject->dependencies.push_back(dependency);
+    pDependency->dependents.push_back(handle);
+}
+
+// An object that the application destroys while objects made from it are still alive, like a shader module
+// after its pipelines were created, is still needed to recreate them. Each of them keeps the packets that
+// created the object and the one that destroyed it, which comes after their own create packets, and takes
+// over what the object was made from in turn.
+void StateTracker::destroy_object(uint64_t handle) {
+    hand_over(handle);
+    remove_object(handle);
+}
+
+// The children of the object go away with it, like the command buffers of a command pool that a kept upload
+// submitted, so they are handed over too, with the object's destroy packet as theirs.
+void StateTracker::hand_over(uint64_t handle) {
+    Object* pObject = find_object(handle);
+    if (pObject == NULL || handle == kNoObject) {
+        return;
+    }
+    for (uint64_t child : pObject->children) {
+        Object* pChild = find_object(child);
+        if (pChild != NULL && pChild->parent == handle) {
+            hand_over(child);
+        }
+    }
+    for (uint64_t dependent : pObject->dependents) {
+        Object* pDependent = find_object(dependent);
+        if (pDependent == NULL) {
+            continue;
+        }
+        reference_packets(pObject->packets, pDependent->packets);
+        reference_packets(pObject->uploads, pDependent->uploads);
+        reference_packet(pDependent->packets);
+        for (uint64_t dependency : pObject->dependencies) {
+            add_dependency(dependent, dependency);
+        }
+    }
+}
+
+void StateTracker::remove_object(uint64_t handle) {
+    auto entry = m_objects.find(handle);
+    if (handle == kNoObject || entry == m_objects.end()) {
+        return;
+    }
+    Object object = std::move(entry->second);
+    m_objects.erase(entry);
+
+    for (uint64_t child : object.children) {
+        Object* pChild = find_object(child);
+        if (pChild != NULL && pChild->parent == handle) {
+            remove_object(child);
+        }
+    }
+    for (uint64_t dependency : object.dependencies) {
+        Object* pDependency = find_object(dependency);
+        if (pDependency != NULL) {
+            pDependency->dependents.erase(std::remove(pDependency->dependents.begin(), pDependency->dependents.end(), handle),
+                                          pDependency->dependents.end());
+        }
+    }
+    for (uint64_t dependent : object.dependents) {
+        Object* pDependent = find_object(dependent);
+        if (pDependent != NULL) {
+            pDependent->dependencies.erase(std::remove(pDependent->dependencies.begin(), pDependent->dependencies.end(), handle),
+                                           pDependent->dependencies.end());
+        }
+    }
+    release_packets(object.packets);
+    release_packets(object.recording);
+    release_packets(object.uploads);
+
+    auto memory = m_memories.find(handle);
+    if (memory != m_memories.end()) {
+        vktrace_free(memory->second.pMapPacket);
+        m_memories.erase(memory);
+    }
+    m_fences.erase(handle);
+    m_buffers.erase(handle);
+    m_commandBuffers.erase(handle);
+    m_swapchainImages.erase(handle);
+    auto descriptorSet = m_descriptorSets.find(handle);
+    if (descriptorSet != m_descriptorSets.end()) {
+        for (auto& packet : descriptorSet->second.packets) {
+            release_packet(packet.first);
+        }
+        m_descriptorSets.erase(descriptorSet);
+    }
+    m_queries.erase(handle);
+}
+
+void StateTracker::remove_children(uint64_t handle) {
+    Object* pObject = find_object(handle);
+    if (pObject == NULL || handle == kNoObject) {
+        return;
+    }
+    std::vector<uint64_t> children;
+    children.swap(pObject->children);
+    for (uint64_t child : children) {
+        Object* pChild = find_object(child);
+        if (pChild != NULL && pChild->parent == handle) {
+            remove_object(child);
+        }
+    }
+}
+
+// Applications query the same properties again and again, so a query replaces an earlier one of the same
+// object that had the same parameters and results.
+void StateTracker::add_query(uint64_t handle) {
+    Object* pObject = find_object(handle);
+    if (pObject == NULL) {
+        return;
+    }
+
+    // The body starts with the address of the header at the time it was traced, which is left out.
+    uint64_t hash[2];
+    const char* pParameters = (const char*)m_pPacket + sizeof(vktrace_trace_packet_header) + sizeof(void*);
+    uint64_t parametersSize = m_pPacket->size - sizeof(vktrace_trace_packet_header) - sizeof(void*);
+    vktrace_dedup_hash128(pParameters, parametersSize, hash);
+
+    std::map<QueryHash, uint64_t>& queries = m_queries[handle];
+    auto query = queries.find(QueryHash(hash[0], hash[1]));
+    if (query != queries.end()) {
+        auto position = std::find(pObject->packets.begin(), pObject->packets.end(), query->second);
+        if (position != pObject->packets.end()) {
+            pObject->packets.erase(position);
+            release_packet(query->second);
+        }
+    }
+    queries[QueryHash(hash[0], hash[1])] = m_position;
+    reference_packet(pObject->packets);
+}
+
+void StateTracker::bind_memory(uint64_t handle, uint64_t memory, VkDeviceSize memoryOffset) {
+    add_to_object(handle);
+    add_dependency(handle, memory);
+    auto buffer = m_buffers.find(handle);
+    if (buffer != m_buffers.end()) {
+        buffer->second.memory = memory;
+        buffer->second.memoryOffset = memoryOffset;
+    }
+}
+
+void StateTracker::record_command(uint64_t commandBuffer) {
+    Object* pCommandBuffer = find_object(commandBuffer);
+    if (pCommandBuffer != NULL && commandBuffer != kNoObject) {
+        reference_packet(pCommandBuffer->recording);
+    }
+}
+
+// Follows what a command buffer reads and writes for as long as everything it recorded can be submitted
+// again on its own, see add_upload. Swapchain images can't be, since they aren't acquired at that point.
+void StateTracker::record_transfer(uint64_t commandBuffer, vktrace_trace_packet_header* pHeader) {
+    auto entry = m_commandBuffers.find(commandBuffer);
+    if (entry == m_commandBuffers.end() || !entry->second.uploadOnly) {
+        return;
+    }
+    CommandBuffer& state = entry->second;
+    auto writesAll = [this](uint64_t buffer, VkDeviceSize offset, VkDeviceSize size) {
+        auto found = m_buffers.find(buffer);
+        return found != m_buffers.end() && offset == 0 && (size == VK_WHOLE_SIZE || size >= found->second.size);
+    };
+
+    switch (pHeader->packet_id) {
+        TRACK_TRANSFER(vkCmdCopyImage, srcImage, dstImage)
+        TRACK_TRANSFER(vkCmdBlitImage, srcImage, dstImage)
+        TRACK_TRANSFER(vkCmdResolveImage, srcImage, dstImage)
+        TRACK_TRANSFER(vkCmdCopyBufferToImage, srcBuffer, dstImage)
+        TRACK_TRANSFER_TO(vkCmdClearColorImage, image)
+        TRACK_TRANSFER_TO(vkCmdClearDepthStencilImage, image)
+        TRACK_TRANSFER_TO(vkCmdResetQueryPool, queryPool)
+        TRACK_TRANSFER_TO(vkCmdSetEvent, event)
+        TRACK_TRANSFER_TO(vkCmdResetEvent, event)
+        case VKTRACE_TPI_VK_vkCmdCopyBuffer: {
+            packet_vkCmdCopyBuffer* pPacket = interpret_body_as_vkCmdCopyBuffer(pHeader);
+            state.sources.push_back(handle_value(pPacket->srcBuffer));
+            state.destinations.push_back(handle_value(pPacket->dstBuffer));
+            for (uint32_t i = 0; pPacket->pRegions != NULL && i < pPacket->regionCount; i++) {
+                if (writesAll(handle_value(pPacket->dstBuffer), pPacket->pRegions[i].dstOffset, pPacket->pRegions[i].size)) {
+                    state.overwritten.push_back(handle_value(pPacket->dstBuffer));
+                }
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkCmdUpdateBuffer: {
+            packet_vkCmdUpdateBuffer* pPacket = interpret_body_as_vkCmdUpdateBuffer(pHeader);
+            state.destinations.push_back(handle_value(pPacket->dstBuffer));
+            if (writesAll(handle_value(pPacket->dstBuffer), pPacket->dstOffset, pPacket->dataSize)) {
+                state.overwritten.push_back(handle_value(pPacket->dstBuffer));
+            }
+            break;
+        }
+        case VKTRACE_TPI_VK_vkCmdFillBuffer: {
+            packet_vkCmdFillBuffer* pPacket = interpret_body_as_vkCmdFillBuffer(pHeader);
+            state.destinations.push_back(handle_value(pPacket->dstBuffer));
+            if (writesAll(handle_value(pPacket->dstBuffer), pPacket->dstOffset, pPacket->size)) {
+                state.overwritten.push_back(handle_value(pPacket->dstBuffer));
+            }
+            break;
+        }
+        // Images whose layout changes are written, the rest are only waited for.
+        case VKTRACE_TPI_VK_vkCmdPipelineBarrier: {
+            packet_vkCmdPipelineBarrier* pPacket = interpret_body_as_vkCmdPipelineBarrier(pHeader);
+            for (uint32_t i = 0; pPacket->pBufferMemoryBarriers != NULL && i < pPacket->bufferMemoryBarrierCount; i++) {
+                state.sources.push_back(handle_value(pPacket->pBufferMemoryBarriers[i].buffer));
+            }
+            for (uint32_t i = 0; pPacket->pImageMemoryBarriers != NULL && i < pPacket->imageMemoryBarrierCount; i++) {
+                const VkImageMemoryBarrier& barrier = pPacket->pImageMemoryBarriers[i];
+                if (barrier.oldLayout != barrier.newLayout) {
+                    state.destinations.push_back(handle_value(barrier.image));
+                } else {
+                    state.sources.push_back(handle_value(barrier.image));
+                }
+            }
+            break;
+        }
+        default:
+            state.uploadOnly = false;
+            break;
+    }
+
+    for (uint64_t handle : state.sources) {
+        state.uploadOnly = state.uploadOnly && m_swapchainImages.count(handle) == 0;
+    }
+    for (uint64_t handle : state.destinations) {
+        state.uploadOnly = state.uploadOnly && m_swapchainImages.count(handle) == 0;
+    }
+    if (!state.uploadOnly) {
+        state.sources.clear();
+        state.destinations.clear();
+        state.overwritten.clear();
+    }
+}
+
+void StateTracker::reset_command_buffer(uint64_t commandBuffer) {
+    Object* pCommandBuffer = find_object(commandBuffer);
+    if (pCommandBuffer != NULL && commandBuffer != kNoObject) {
+        release_packets(pCommandBuffer->recording);
+        CommandBuffer& state = m_commandBuffers[commandBuffer];
+        state.uploadOnly = true;
+        state.sources.clear();
+        state.destinations.clear();
+        state.overwritten.clear();
+    }
+}
+
+// A submit whose command buffers only copied, filled, cleared, transitioned or reset objects, like a staging
+// upload, is kept by each object it wrote, along with what its command buffers recorded. The objects that the
+// upload needs are made dependencies of those objects, so they are recreated, and destroyed again, around it
+// even if the application destroyed them right after. The staging memory is likely rewritten before the state
+// is written, so its contents at the time of the submit are restored just before it. An upload that writes all
+// of a buffer replaces the ones before it.
+void StateTracker::add_upload(vktrace_trace_packet_header* pHeader) {
+    // track_packet already interpreted it.
+    packet_vkQueueSubmit* pPacket = (packet_vkQueueSubmit*)pHeader->pBody;
+    std::vector<uint64_t> commandBuffers;
+    std::vector<uint64_t> needed;
+    std::vector<uint64_t> destinations;
+    std::vector<uint64_t> overwritten;
+    std::vector<uint64_t> sources;
+    for (uint32_t i = 0; pPacket->pSubmits != NULL && i < pPacket->submitCount; i++) {
+        const VkSubmitInfo& submit = pPacket->pSubmits[i];
+        for (uint32_t j = 0; submit.pCommandBuffers != NULL && j < submit.commandBufferCount; j++) {
+            uint64_t commandBuffer = handle_value(submit.pCommandBuffers[j]);
+            auto state = m_commandBuffers.find(commandBuffer);
+            Object* pCommandBuffer = find_object(commandBuffer);
+            if (state == m_commandBuffers.end() || !state->second.uploadOnly || pCommandBuffer == NULL) {
+                return;
+            }
+            commandBuffers.push_back(commandBuffer);
+            needed.push_back(commandBuffer);
+            needed.push_back(pCommandBuffer->parent);
+            sources.insert(sources.end(), state->second.sources.begin(), state->second.sources.end());
+            destinations.insert(destinations.end(), state->second.destinations.begin(), state->second.destinations.end());
+            overwritten.insert(overwritten.end(), state->second.overwritten.begin(), state->second.overwritten.end());
+        }
+    }
+    if (destinations.empty()) {
+        return;
+    }
+    std::sort(destinations.begin(), destinations.end());
+    destinations.erase(std::unique(destinations.begin(), destinations.end()), destinations.end());
+    needed.insert(needed.end(), sources.begin(), sources.end());
+    needed.insert(needed.end(), destinations.begin(), destinations.end());
+
+    // Nothing waits for or signals the copy that is kept, so it is submitted without a fence or semaphores.
+    *member_of_copy(m_pPacket, pHeader, &pPacket->fence) = VK_NULL_HANDLE;
+    for (uint32_t i = 0; i < pPacket->submitCount; i++) {
+        *member_of_copy(m_pPacket, pHeader, &pPacket->pSubmits[i].waitSemaphoreCount) = 0;
+        *member_of_copy(m_pPacket, pHeader, &pPacket->pSubmits[i].signalSemaphoreCount) = 0;
+    }
+
+    // Each of these holds a reference until the destinations took theirs.
+    std::vector<uint64_t> packets;
+    for (uint64_t commandBuffer : commandBuffers) {
+        reference_packets(find_object(commandBuffer)->recording, packets);
+    }
+    reference_packet(packets);
+
+    StoredPacket& submit = m_packets[m_position];
+    for (uint64_t source : sources) {
+        auto buffer = m_buffers.find(source);
+        auto memory = (buffer != m_buffers.end()) ? m_memories.find(buffer->second.memory) : m_memories.end();
+        if (memory == m_memories.end() || memory->second.contents.empty()) {
+            continue;
+        }
+        VkDeviceSize begin = std::max(buffer->second.memoryOffset, memory->second.writtenBegin);
+        VkDeviceSize end = std::min(buffer->second.memoryOffset + buffer->second.size, memory->second.writtenEnd);
+        if (begin < end) {
+            create_memory_packets(memory->second, begin, end, submit.before);
+        }
+    }
+    submit.after.push_back(create_queue_wait_idle_packet(pPacket->queue));
+    for (vktrace_trace_packet_header* pGenerated : submit.before) {
+        m_packetBytes += pGenerated->size;
+    }
+    m_packetBytes += submit.after.back()->size;
+
+    for (uint64_t destination : destinations) {
+        Object* pDestination = find_object(destination);
+        if (pDestination == NULL || destination == kNoObject) {
+            continue;
+        }
+        std::vector<uint64_t> replaced;
+        if (std::find(overwritten.begin(), overwritten.end(), destination) != overwritten.end()) {
+            replaced.swap(pDestination->uploads);
+        }
+        reference_packets(packets, pDestination->uploads);
+        release_packets(replaced);
+        for (uint64_t dependency : needed) {
+            add_dependency(destination, dependency);
+        }
+    }
+    release_packets(packets);
+}
+
+// slot is the binding and array element that was written, or the update template that was used, which
+// writes the same descriptors each time.
+void StateTracker::write_descriptor(uint64_t descriptorSet, bool withTemplate, uint64_t slot) {
+    if (descriptorSet == kNoObject || find_object(descriptorSet) == NULL) {
+        return;
+    }
+    DescriptorSet& state = m_descriptorSets[descriptorSet];
+    std::map<uint64_t, uint64_t>& writes = withTemplate ? state.templateWrites : state.writes;
+    auto write = writes.find(slot);
+    if (write != writes.end()) {
+        if (write->second == m_position) {
+            return;
+        }
+        auto packet = state.packets.find(write->second);
+        if (packet != state.packets.end() && --packet->second == 0) {
+            release_packet(packet->first);
+            state.packets.erase(packet);
+        }
+    }
+    writes[slot] = m_position;
+    if (state.packets[m_position]++ == 0) {
+        std::vector<uint64_t> packets;
+        reference_packet(packets);
+    }
+}
+
+void StateTracker::map_memory(vktrace_trace_packet_header* pHeader) {
+    vktrace_trace_packet_header* pCopy = copy_packet(pHeader);
+    packet_vkMapMemory* pPacket = interpret_body_as_vkMapMemory(pHeader);
+    auto entry = m_memories.find(handle_value(pPacket->memory));
+    if (pCopy == NULL || pPacket->result != VK_SUCCESS || entry == m_memories.end()) {
+        vktrace_free(pCopy);
+        return;
+    }
+
+    DeviceMemory& memory = entry->second;
+    if (memory.contents.empty()) {
+        memory.contents.resize((size_t)ROUNDUP_TO_4(memory.allocationSize));
+    }
+    memory.mapOffset = pPacket->offset;
+    memory.mapSize = (pPacket->size == VK_WHOLE_SIZE) ? memory.allocationSize - pPacket->offset : pPacket->size;
+    vktrace_free(memory.pMapPacket);
+    memory.pMapPacket = pCopy;
+}
+
+void StateTracker::unmap_memory(vktrace_trace_packet_header* pHeader) {
+    packet_vkUnmapMemory* pPacket = interpret_body_as_vkUnmapMemory(pHeader);
+    auto entry = m_memories.find(handle_value(pPacket->memory));
+    if (entry == m_memories.end()) {
+        return;
+    }
+
+    // Without persistently mapped buffer support, the packet has everything that was mapped.
+    DeviceMemory& memory = entry->second;
+    if (pPacket->pData != NULL && memory.mapSize > 0) {
+        write_memory(memory, memory.mapOffset, pPacket->pData, memory.mapSize);
+    }
+    memory.mapSize = 0;
+    vktrace_free(memory.pMapPacket);
+    memory.pMapPacket = NULL;
+}
+
+// The data of each range is a persistently mapped buffer package, see
+// vkReplay::manually_replay_vkFlushMappedMemoryRanges: block [0] holds the number of changed blocks,
+// the others where each one goes from the start of the mapping, and their contents follow.
+void StateTracker::flush_memory(vktrace_trace_packet_header* pHeader) {
+    packet_vkFlushMappedMemoryRanges* pPacket = interpret_body_as_vkFlushMappedMemoryRanges(pHeader);
+    const char* pPacketEnd = (const char*)pHeader + pHeader->size;
+    for (uint32_t i = 0; pPacket->pMemoryRanges != NULL && pPacket->ppData != NULL && i < pPacket->memoryRangeCount; i++) {
+        auto entry = m_memories.find(handle_value(pPacket->pMemoryRanges[i].memory));
+        if (entry == m_memories.end() || entry->second.mapSize == 0 || pPacket->ppData[i] == NULL ||
+            pPacket->pMemoryRanges[i].size == 0) {
+            continue;
+        }
+
+        const PageGuardChangedBlockInfo* pBlocks = (const PageGuardChangedBlockInfo*)pPacket->ppData[i];
+        const char* pData = (const char*)(pBlocks + 1);
+        if (pData > pPacketEnd || pBlocks[0].length == 0) {
+            continue;
+        }
+        uint32_t blockCount = pBlocks[0].offset;
+        pData = (const char*)(pBlocks + blockCount + 1);
+        for (uint32_t j = 1; j <= blockCount && pData <= pPacketEnd; j++) {
+            if (pBlocks[j].length > (uint64_t)(pPacketEnd - pData)) {
+                vktrace_LogWarning("Ignoring a changed block of vkFlushMappedMemoryRanges that goes past the end of its packet.");
+                break;
+            }
+            write_memory(entry->second, entry->second.mapOffset + pBlocks[j].offset, pData, pBlocks[j].length);
+            pData += pBlocks[j].length;
+        }
+    }
+}
+
+void StateTracker::invalidate_memory(vktrace_trace_packet_header* pHeader) {
+    packet_vkInvalidateMappedMemoryRanges* pPacket = interpret_body_as_vkInvalidateMappedMemoryRanges(pHeader);
+    for (uint32_t i = 0; pPacket->pMemoryRanges != NULL && pPacket->ppData != NULL && i < pPacket->memoryRangeCount; i++) {
+        const VkMappedMemoryRange& range = pPacket->pMemoryRanges[i];
+        auto entry = m_memories.find(handle_value(range.memory));
+        if (entry != m_memories.end() && pPacket->ppData[i] != NULL && range.size != VK_WHOLE_SIZE) {
+            write_memory(entry->second, range.offset, pPacket->ppData[i], range.size);
+        }
+    }
+}
+
+void StateTracker::write_memory(DeviceMemory& memory, VkDeviceSize offset, const void* pData, VkDeviceSize size) {
+    if (offset > memory.allocationSize || size > memory.allocationSize - offset || memory.contents.empty()) {
+        vktrace_LogWarning("Ignoring %llu bytes written at offset %llu of memory %llx, which has %llu bytes.",
+                           (unsigned long long)size, (unsigned long long)offset, (unsigned long long)handle_value(memory.memory),
+                           (unsigned long long)memory.allocationSize);
+        return;
+    }
+    if (size == 0) {
+        return;
+    }
+    memcpy(&memory.contents[(size_t)offset], pData, (size_t)size);
+    if (memory.writtenBegin == memory.writtenEnd) {
+        memory.writtenBegin = offset;
+        memory.writtenEnd = offset + size;
+    } else {
+        memory.writtenBegin = std::min(memory.writtenBegin, offset);
+        memory.writtenEnd = std::max(memory.writtenEnd, offset + size);
+    }
+}
+
+// Creates a vkMapMemory and vkUnmapMemory pair that puts back bytes begin to end of the memory, the way
+// trim::generateMapUnmap does in the trace layer.
+void StateTracker::create_memory_packets(const DeviceMemory& memory, VkDeviceSize begin, VkDeviceSize end,
+                                         std::vector<vktrace_trace_packet_header*>& packets) {
+    VkDeviceSize offset = begin & ~(VkDeviceSize)3;
+    VkDeviceSize size = std::min((VkDeviceSize)ROUNDUP_TO_4(end), memory.allocationSize) - offset;
+    const void* pData = &memory.contents[(size_t)offset];
+
+    vktrace_trace_packet_header* pHeader;
+    packet_vkMapMemory* pMapPacket;
+    CREATE_TRACE_PACKET(vkMapMemory, sizeof(void*));
+    pMapPacket = interpret_body_as_vkMapMemory(pHeader);
+    pMapPacket->device = memory.device;
+    pMapPacket->memory = memory.memory;
+    pMapPacket->offset = offset;
+    pMapPacket->size = size;
+    pMapPacket->flags = 0;
+    vktrace_add_buffer_to_trace_packet(pHeader, (void**)&(pMapPacket->ppData), sizeof(void*), &pData);
+    vktrace_finalize_buffer_address(pHeader, (void**)&(pMapPacket->ppData));
+    pMapPacket->result = VK_SUCCESS;
+    vktrace_finalize_trace_packet(pHeader);
+    packets.push_back(pHeader);
+
+    packet_vkUnmapMemory* pUnmapPacket;
+    CREATE_TRACE_PACKET(vkUnmapMemory, ROUNDUP_TO_4(size));
+    pUnmapPacket = interpret_body_as_vkUnmapMemory(pHeader);
+    vktrace_add_buffer_to_trace_packet(pHeader, (void**)&(pUnmapPacket->pData), ROUNDUP_TO_4(size), pData);
+    vktrace_finalize_buffer_address(pHeader, (void**)&(pUnmapPacket->pData));
+    pUnmapPacket->device = memory.device;
+    pUnmapPacket->memory = memory.memory;
+    vktrace_finalize_trace_packet(pHeader);
+    packets.push_back(pHeader);
+}
+
+bool StateTracker::write_memory_contents(const DeviceMemory& memory, const WriteFunction& write) {
+    std::vector<vktrace_trace_packet_header*> packets;
+    create_memory_packets(memory, memory.writtenBegin, memory.writtenEnd, packets);
+    bool written = true;
+    for (vktrace_trace_packet_header* pHeader : packets) {
+        written = written && write(pHeader);
+    }
+    delete_packets(packets);
+    return written;
+}
+
+bool StateTracker::write_state(const WriteFunction& write) {
+    for (auto& entry : m_fences) {
+        auto packet = m_packets.find(entry.second.createPacket);
+        if (packet != m_packets.end()) {
+            VkFenceCreateFlags* pFlags = (VkFenceCreateFlags*)((char*)packet->second.pHeader + entry.second.flagsOffset);
+            if (entry.second.signaled) {
+                *pFlags |= VK_FENCE_CREATE_SIGNALED_BIT;
+            } else {
+                *pFlags &= ~VK_FENCE_CREATE_SIGNALED_BIT;
+            }
+        }
+    }
+
+    for (auto& entry : m_packets) {
+        for (vktrace_trace_packet_header* pHeader : entry.second.before) {
+            if (!write(pHeader)) {
+                return false;
+            }
+        }
+        if (!write(entry.second.pHeader)) {
+            return false;
+        }
+        for (vktrace_trace_packet_header* pHeader : entry.second.after) {
+            if (!write(pHeader)) {
+                return false;
+            }
+        }
+    }
+
+    for (auto& entry : m_memories) {
+        if (entry.second.writtenEnd > entry.second.writtenBegin && !write_memory_contents(entry.second, write)) {
+            return false;
+        }
+    }
+    for (auto& entry : m_memories) {
+        if (entry.second.pMapPacket != NULL && !write(entry.second.pMapPacket)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace vktrim
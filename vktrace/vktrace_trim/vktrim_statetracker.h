@@ -0,0 +1,195 @@
+/**************************************************************************
+ *
+ * Copyright (C) 2018 LunarG, Inc.
+ * All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ **************************************************************************/
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "vulkan/vulkan.h"
+
+extern "C" {
+#include "vktrace_trace_packet_identifiers.h"
+}
+
+namespace vktrim {
+
+//-------------------------------------------------------------------------
+// Follows the state that the packets of a trace leave behind, so that the
+// trace can be cut at any frame without a GPU.
+//
+// For every object that is alive it keeps the packets that created it and the
+// ones that bound, updated, recorded or queried it, and it keeps the contents
+// that the application wrote to host visible memory, as recorded by
+// vkUnmapMemory, vkInvalidateMappedMemoryRanges and the persistently mapped
+// buffer packages of vkFlushMappedMemoryRanges. Packets are copied before
+// they are interpreted, so kept packets are written out as they were read.
+//
+// Buffers, images, query pools and events also keep the vkQueueSubmits of
+// command buffers that only copied, filled, cleared, transitioned or reset
+// them, like staging uploads, along with what those command buffers recorded
+// and the contents of the staging memory at the time of the submit. They are
+// submitted again without their fences and semaphores, followed by a
+// vkQueueWaitIdle. The latest vkSetEvent or vkResetEvent of each event is
+// kept too.
+//
+// Contents, image layouts and query results that rendering or dispatches
+// left behind aren't rebuilt, since those submits can't be told apart from
+// the frames they drew.
+//-------------------------------------------------------------------------
+class StateTracker {
+   public:
+    // Writes one packet of the rebuilt state, returns false to stop writing.
+    typedef std::function<bool(vktrace_trace_packet_header* pHeader)> WriteFunction;
+
+    StateTracker();
+    ~StateTracker();
+
+    // Updates the state with the next packet of the trace, which may be
+    // interpreted in place.
+    void add_packet(vktrace_trace_packet_header* pHeader);
+
+    // Writes the packets that recreate the current state: the kept packets in
+    // the order they were traced, each kept submit preceded by the contents of
+    // its staging memory, then a vkMapMemory and vkUnmapMemory pair
+    // that restores the contents of each piece of host visible memory, then
+    // the vkMapMemory of memory that is still mapped. Returns false as soon as
+    // write does.
+    bool write_state(const WriteFunction& write);
+
+    size_t get_object_count() const { return m_objects.size(); }
+    size_t get_packet_count() const { return m_packets.size(); }
+    uint64_t get_packet_bytes() const { return m_packetBytes; }
+    uint64_t get_memory_bytes() const;
+
+   private:
+    struct StoredPacket {
+        vktrace_trace_packet_header* pHeader;
+        uint32_t refCount;
+        std::vector<vktrace_trace_packet_header*> before;  // packets made to be written around it, see add_upload
+        std::vector<vktrace_trace_packet_header*> after;
+    };
+
+    struct Object {
+        uint64_t parent;
+        std::vector<uint64_t> packets;       // positions of the packets that created, bound or queried it
+        std::vector<uint64_t> recording;     // command buffers: the packets since the last vkBeginCommandBuffer
+        std::vector<uint64_t> children;      // objects that go away with it, unless they already did
+        std::vector<uint64_t> dependencies;  // objects that its create info names
+        std::vector<uint64_t> dependents;    // objects whose create infos name it
+        std::vector<uint64_t> uploads;       // the submits that wrote it and the commands they submitted
+    };
+
+    struct Buffer {
+        VkDeviceSize size;
+        uint64_t memory;  // kNoObject until it is bound
+        VkDeviceSize memoryOffset;
+    };
+
+    // What a command buffer recorded since it was last begun, as long as it only copied, filled, cleared,
+    // transitioned or reset objects.
+    struct CommandBuffer {
+        bool uploadOnly;
+        std::vector<uint64_t> sources;       // objects it reads or waits for
+        std::vector<uint64_t> destinations;  // objects it writes
+        std::vector<uint64_t> overwritten;   // destinations it writes all of
+    };
+
+    struct DeviceMemory {
+        VkDevice device;
+        VkDeviceMemory memory;
+        VkDeviceSize allocationSize;
+        std::vector<uint8_t> contents;  // allocated when the memory is first mapped
+        VkDeviceSize writtenBegin;      // range of contents that the application wrote
+        VkDeviceSize writtenEnd;
+        VkDeviceSize mapOffset;  // the current mapping, mapSize is 0 when the memory isn't mapped
+        VkDeviceSize mapSize;
+        vktrace_trace_packet_header* pMapPacket;  // the vkMapMemory of the current mapping
+    };
+
+    struct Fence {
+        uint64_t createPacket;  // position of the vkCreateFence
+        uint64_t flagsOffset;   // where its VkFenceCreateInfo::flags is, from the start of the packet
+        bool signaled;
+    };
+
+    // The packet that last wrote each descriptor of a descriptor set, by binding and array element or
+    // by update template, and how many descriptors each of those packets still provides.
+    struct DescriptorSet {
+        std::map<uint64_t, uint64_t> writes;
+        std::map<uint64_t, uint64_t> templateWrites;
+        std::map<uint64_t, uint32_t> packets;
+    };
+
+    typedef std::pair<uint64_t, uint64_t> QueryHash;
+
+    void track_packet(vktrace_trace_packet_header* pHeader);
+
+    void reference_packet(std::vector<uint64_t>& packets);
+    void reference_packets(const std::vector<uint64_t>& from, std::vector<uint64_t>& packets);
+    void release_packet(uint64_t position);
+    void release_packets(std::vector<uint64_t>& packets);
+
+    Object* find_object(uint64_t handle);
+    void add_object(uint64_t handle, uint64_t parent);
+    void add_to_object(uint64_t handle);
+    void add_dependency(uint64_t handle, uint64_t dependency);
+    void destroy_object(uint64_t handle);
+    void hand_over(uint64_t handle);
+    void remove_object(uint64_t handle);
+    void remove_children(uint64_t handle);
+
+    void add_query(uint64_t handle);
+    void bind_memory(uint64_t handle, uint64_t memory, VkDeviceSize memoryOffset);
+    void record_command(uint64_t commandBuffer);
+    void record_transfer(uint64_t commandBuffer, vktrace_trace_packet_header* pHeader);
+    void reset_command_buffer(uint64_t commandBuffer);
+    void add_upload(vktrace_trace_packet_header* pHeader);
+    void write_descriptor(uint64_t descriptorSet, bool withTemplate, uint64_t slot);
+
+    void map_memory(vktrace_trace_packet_header* pHeader);
+    void unmap_memory(vktrace_trace_packet_header* pHeader);
+    void flush_memory(vktrace_trace_packet_header* pHeader);
+    void invalidate_memory(vktrace_trace_packet_header* pHeader);
+    void write_memory(DeviceMemory& memory, VkDeviceSize offset, const void* pData, VkDeviceSize size);
+    void create_memory_packets(const DeviceMemory& memory, VkDeviceSize begin, VkDeviceSize end,
+                               std::vector<vktrace_trace_packet_header*>& packets);
+    bool write_memory_contents(const DeviceMemory& memory, const WriteFunction& write);
+
+    std::map<uint64_t, StoredPacket> m_packets;  // by position in the trace
+    uint64_t m_packetBytes;
+    uint64_t m_packetCount;                  // packets tracked so far
+    uint64_t m_position;                     // of the packet being tracked
+    vktrace_trace_packet_header* m_pPacket;  // copy of it, as it was read
+
+    Object m_global;  // owns the packets that belong to no object, like vkApiVersion
+    std::unordered_map<uint64_t, Object> m_objects;
+    std::unordered_map<uint64_t, DeviceMemory> m_memories;
+    std::unordered_map<uint64_t, Fence> m_fences;
+    std::unordered_map<uint64_t, Buffer> m_buffers;
+    std::unordered_map<uint64_t, CommandBuffer> m_commandBuffers;
+    std::unordered_set<uint64_t> m_swapchainImages;
+    std::unordered_map<uint64_t, DescriptorSet> m_descriptorSets;
+    std::unordered_map<uint64_t, std::map<QueryHash, uint64_t>> m_queries;  // latest of each query, by owner
+};
+
+}  // namespace vktrim
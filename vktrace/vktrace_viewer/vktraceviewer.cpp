@@ -465,7 +465,7 @@ void vktraceviewer::GenerateTraceFileStats() {
     QMap<uint16_t, vtvApiUsageStats> statMap;
     for (uint64_t i = 0; i < m_traceFileInfo.packetCount; i++) {
         vktrace_trace_packet_header* pHeader = m_traceFileInfo.pPacketOffsets[i].pHeader;
-        if (pHeader->packet_id >= VKTRACE_TPI_VK_vkApiVersion) {
+        if (VKTRACE_TPI_IS_API_PACKET(pHeader->packet_id)) {
             totalStats.totalCallCount++;
             totalStats.totalCpuExecutionTime += (pHeader->entrypoint_end_time - pHeader->entrypoint_begin_time);
             totalStats.totalTraceOverhead += ((pHeader->vktrace_end_time - pHeader->vktrace_begin_time) -
@@ -24,6 +24,7 @@
 
 extern "C" {
 #include "vktrace_trace_packet_utils.h"
+#include "vktrace_trace_index.h"
 }
 
 vktraceviewer_QTraceFileLoader::vktraceviewer_QTraceFileLoader() : QObject(NULL) {
@@ -183,6 +184,12 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
         return false;
     }
 
+    // The packets of a compressed trace can't be read in place
+    if (VKTRACE_TRACE_FILE_IS_BLOCK_COMPRESSED(header.trace_file_version)) {
+        emit OutputMessage(VKTRACE_LOG_ERROR, "This is a compressed trace file. Use vktraceconvert to decompress it first.");
+        return false;
+    }
+
     // Make sure there is at least one gpuinfo struct in header
     if (header.n_gpuinfo < 1) {
         emit OutputMessage(VKTRACE_LOG_ERROR, "Trace file head may be corrupt - gpu info missing.");
@@ -209,7 +216,17 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
     // Set global version num
     vktrace_set_trace_version(pTraceFileInfo->pHeader->trace_file_version);
 
-    // Find out how many trace packets there are.
+    // An up to date trace index has the offset of every packet, so the packets can be read without scanning the file
+    // for them first.
+    bool bRead = false;
+    if (Fseek(pTraceFileInfo->pFile, 0, SEEK_END) == 0) {
+        uint64_t fileLength = Ftell(pTraceFileInfo->pFile);
+        vktrace_trace_index* pTraceIndex = vktrace_trace_index_load(pTraceFileInfo->filename, fileLength);
+        if (pTraceIndex != NULL) {
+            bRead = read_packets_from_index(pTraceFileInfo, pTraceIndex, fileLength);
+            vktrace_trace_index_destroy(&pTraceIndex);
+        }
+    }
 
     // Seek to first packet
     long first_offset = pTraceFileInfo->pHeader->first_packet_offset;
@@ -221,7 +238,7 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
     // "Walk" through each packet based on the packet size (which is the first 64-bits of the packet header)
     uint64_t fileOffset = pTraceFileInfo->pHeader->first_packet_offset;
     uint64_t packetSize = 0;
-    while (1 == fread(&packetSize, sizeof(uint64_t), 1, pTraceFileInfo->pFile)) {
+    while (!bRead && 1 == fread(&packetSize, sizeof(uint64_t), 1, pTraceFileInfo->pFile)) {
         // success!
         pTraceFileInfo->packetCount++;
         fileOffset += packetSize;
@@ -248,7 +265,7 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
         }
         emit OutputMessage(VKTRACE_LOG_WARNING, "There are no trace packets in this trace file.");
         pTraceFileInfo->pPacketOffsets = NULL;
-    } else {
+    } else if (!bRead) {
         pTraceFileInfo->pPacketOffsets = VKTRACE_NEW_ARRAY(vktraceviewer_trace_file_packet_offsets, pTraceFileInfo->packetCount);
 
         // rewind to first packet and this time, populate the packet offsets
@@ -260,7 +277,7 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
 
         unsigned int packetIndex = 0;
         fileOffset = first_offset;
-        while (1 == fread(&packetSize, sizeof(uint64_t), 1, pTraceFileInfo->pFile)) {
+        while (packetIndex < pTraceFileInfo->packetCount && 1 == fread(&packetSize, sizeof(uint64_t), 1, pTraceFileInfo->pFile)) {
             // the fread confirms that this packet exists
             // NOTE: We do not actually read the entire packet into memory right now.
             pTraceFileInfo->pPacketOffsets[packetIndex].fileOffset = fileOffset;
@@ -289,7 +306,9 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
             fileOffset += packetSize;
             packetIndex++;
         }
+    }
 
+    if (pTraceFileInfo->packetCount > 0) {
         // If the last packet is the portability table, remove it
         if (pTraceFileInfo->pPacketOffsets[pTraceFileInfo->packetCount - 1].pHeader->packet_id == VKTRACE_TPI_PORTABILITY_TABLE) {
             vktrace_free(pTraceFileInfo->pPacketOffsets[pTraceFileInfo->packetCount - 1].pHeader);
@@ -305,3 +324,56 @@ bool vktraceviewer_QTraceFileLoader::populate_trace_file_info(vktraceviewer_trac
 
     return true;
 }
+
+//-----------------------------------------------------------------------------
+// Reads every packet at the offset its index entry gives. Returns false, leaving no packets behind, if the packets
+// don't match the index, so the caller can find them by scanning the file instead.
+bool vktraceviewer_QTraceFileLoader::read_packets_from_index(vktraceviewer_trace_file_info* pTraceFileInfo,
+                                                             const vktrace_trace_index* pTraceIndex, uint64_t fileLength) {
+    uint64_t packetCount = pTraceIndex->header.packetCount;
+    if (packetCount == 0) {
+        return true;
+    }
+
+    pTraceFileInfo->pPacketOffsets = VKTRACE_NEW_ARRAY(vktraceviewer_trace_file_packet_offsets, packetCount);
+    memset(pTraceFileInfo->pPacketOffsets, 0, (size_t)packetCount * sizeof(vktraceviewer_trace_file_packet_offsets));
+
+    bool bMatches = Fseek(pTraceFileInfo->pFile, pTraceIndex->pEntries[0].fileOffset, SEEK_SET) == 0;
+    uint64_t packetIndex = 0;
+    for (; bMatches && packetIndex < packetCount; packetIndex++) {
+        // Packets follow each other, so each one ends where the next one starts.
+        uint64_t fileOffset = pTraceIndex->pEntries[packetIndex].fileOffset;
+        uint64_t nextOffset = (packetIndex + 1 < packetCount) ? pTraceIndex->pEntries[packetIndex + 1].fileOffset : fileLength;
+        uint64_t packetSize = nextOffset - fileOffset;
+        if (nextOffset <= fileOffset || packetSize < sizeof(vktrace_trace_packet_header)) {
+            bMatches = false;
+            break;
+        }
+
+        vktrace_trace_packet_header* pHeader = (vktrace_trace_packet_header*)vktrace_malloc((size_t)packetSize);
+        pTraceFileInfo->pPacketOffsets[packetIndex].fileOffset = (unsigned int)fileOffset;
+        pTraceFileInfo->pPacketOffsets[packetIndex].pHeader = pHeader;
+        if (pHeader == NULL || 1 != fread(pHeader, (size_t)packetSize, 1, pTraceFileInfo->pFile) || pHeader->size != packetSize ||
+            pHeader->packet_id != pTraceIndex->pEntries[packetIndex].packetId) {
+            bMatches = false;
+            packetIndex++;
+            break;
+        }
+
+        // adjust pointer to body of the packet
+        pHeader->pBody = (uintptr_t)pHeader + sizeof(vktrace_trace_packet_header);
+    }
+
+    if (!bMatches) {
+        emit OutputMessage(VKTRACE_LOG_WARNING, "The trace index doesn't match the trace file, scanning the file for packets instead.");
+        for (uint64_t i = 0; i < packetIndex; i++) {
+            vktrace_free(pTraceFileInfo->pPacketOffsets[i].pHeader);
+        }
+        VKTRACE_DELETE(pTraceFileInfo->pPacketOffsets);
+        pTraceFileInfo->pPacketOffsets = NULL;
+        return false;
+    }
+
+    pTraceFileInfo->packetCount = packetCount;
+    return true;
+}
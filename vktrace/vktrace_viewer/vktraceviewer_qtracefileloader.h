@@ -25,6 +25,10 @@
 #include "vktraceviewer_controller_factory.h"
 #include "vktraceviewer_controller.h"
 
+extern "C" {
+#include "vktrace_trace_index.h"
+}
+
 #define USE_STATIC_CONTROLLER_LIBRARY 1
 class vktraceviewer_QTraceFileLoader : public QObject {
     Q_OBJECT
@@ -52,6 +56,9 @@ class vktraceviewer_QTraceFileLoader : public QObject {
     bool load_controllers(vktraceviewer_trace_file_info* pTraceFileInfo);
 
     bool populate_trace_file_info(vktraceviewer_trace_file_info* pTraceFileInfo);
+
+    bool read_packets_from_index(vktraceviewer_trace_file_info* pTraceFileInfo, const vktrace_trace_index* pTraceIndex,
+                                 uint64_t fileLength);
 };
 
 #endif  // VKTRACEVIEWER_QTRACEFILELOADER_H
@@ -31,7 +31,7 @@ vktraceviewer_vk_QFileModel::vktraceviewer_vk_QFileModel(QObject* parent, vktrac
 vktraceviewer_vk_QFileModel::~vktraceviewer_vk_QFileModel() {}
 
 QString vktraceviewer_vk_QFileModel::get_packet_string(const vktrace_trace_packet_header* pHeader) const {
-    if (pHeader->packet_id < VKTRACE_TPI_VK_vkApiVersion) {
+    if (!VKTRACE_TPI_IS_API_PACKET(pHeader->packet_id)) {
         return vktraceviewer_QTraceFileModel::get_packet_string(pHeader);
     } else {
         QString packetString = vktrace_stringify_vk_packet_id((const VKTRACE_TRACE_PACKET_ID_VK)pHeader->packet_id, pHeader);
@@ -40,7 +40,7 @@ QString vktraceviewer_vk_QFileModel::get_packet_string(const vktrace_trace_packe
 }
 
 QString vktraceviewer_vk_QFileModel::get_packet_string_multiline(const vktrace_trace_packet_header* pHeader) const {
-    if (pHeader->packet_id < VKTRACE_TPI_VK_vkApiVersion) {
+    if (!VKTRACE_TPI_IS_API_PACKET(pHeader->packet_id)) {
         return vktraceviewer_QTraceFileModel::get_packet_string_multiline(pHeader);
     } else {
         QString packetString = vktrace_stringify_vk_packet_id((const VKTRACE_TRACE_PACKET_ID_VK)pHeader->packet_id, pHeader);